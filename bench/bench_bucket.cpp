@@ -0,0 +1,152 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Benchmark of @ref Bucket::bucket throughput.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include "../src/tr1_cstdint.h"
+#include <boost/tr1/random.hpp>
+#include "benchmark.h"
+#include "../src/bucket.h"
+#include "../src/grid.h"
+#include "../src/splat.h"
+#include "../src/splat_set.h"
+#include "../src/timer.h"
+
+namespace
+{
+
+/**
+ * Measures the rate at which @ref Bucket::bucket partitions a uniformly
+ * distributed cloud of splats. The processor callback only counts the
+ * generated buckets, so the result isolates the bucketing recursion itself
+ * rather than the downstream consumers.
+ */
+class BucketBenchmark : public Bench::Benchmark
+{
+private:
+    typedef SplatSet::SequenceSet<const Splat *> Set;
+
+    static const std::size_t numSplats = 1000000;
+    static const int passes = 3;
+
+    /// Accumulates counts from the processor callback
+    struct Counts
+    {
+        std::tr1::uint64_t blocks;
+        std::tr1::uint64_t splats;
+
+        Counts() : blocks(0), splats(0) {}
+    };
+
+    /// Processor callback: counts the buckets without reading the splats
+    static void processBucket(
+        Counts &counts,
+        const SplatSet::Traits<Set>::subset_type &splats,
+        const Grid &grid,
+        const Bucket::Recursion &recursionState);
+
+public:
+    virtual std::string name() const { return "bucket.bucket"; }
+    virtual void run(const Environment &env, std::map<std::string, double> &metrics);
+};
+
+void BucketBenchmark::processBucket(
+    Counts &counts,
+    const SplatSet::Traits<Set>::subset_type &splats,
+    const Grid &grid,
+    const Bucket::Recursion &recursionState)
+{
+    (void) grid;
+    (void) recursionState;
+    counts.blocks++;
+    counts.splats += splats.numSplats();
+}
+
+void BucketBenchmark::run(const Environment &env, std::map<std::string, double> &metrics)
+{
+    (void) env;
+
+    using std::tr1::mt19937;
+    using std::tr1::uniform_real;
+    using std::tr1::variate_generator;
+
+    const Grid::size_type cells = 512;
+    mt19937 engine;
+    variate_generator<mt19937 &, uniform_real<float> > genPos(
+        engine, uniform_real<float>(0.0f, float(cells)));
+    variate_generator<mt19937 &, uniform_real<float> > genRadius(
+        engine, uniform_real<float>(0.5f, 2.0f));
+
+    std::vector<Splat> splats(numSplats);
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        Splat &splat = splats[i];
+        for (int j = 0; j < 3; j++)
+        {
+            splat.position[j] = genPos();
+            splat.normal[j] = (j == 2) ? 1.0f : 0.0f;
+        }
+        splat.radius = genRadius();
+        splat.quality = 1.0f;
+    }
+
+    Set set(&splats[0], &splats[0] + numSplats);
+    const float ref[3] = {0.0f, 0.0f, 0.0f};
+    Grid grid(ref, 1.0f, 0, cells, 0, cells, 0, cells);
+
+    const std::size_t maxSplats = 100000;
+    const Grid::size_type maxCells = 64;
+    const std::size_t maxSplit = 1000000;
+
+    Counts counts;
+    const Bucket::ProcessorType<Set>::type process =
+        boost::bind(&BucketBenchmark::processBucket, boost::ref(counts), _1, _2, _3);
+
+    // warm-up
+    Bucket::bucket(set, grid, maxSplats, maxCells, 0, maxCells, maxSplit, process);
+    counts = Counts();
+
+    Timer timer;
+    for (int pass = 0; pass < passes; pass++)
+        Bucket::bucket(set, grid, maxSplats, maxCells, 0, maxCells, maxSplit, process);
+    double elapsed = timer.getElapsed();
+
+    metrics["seconds_per_pass"] = elapsed / passes;
+    metrics["splats_per_second"] = numSplats * passes / elapsed;
+    metrics["blocks"] = double(counts.blocks) / passes;
+    metrics["splat_duplication"] = double(counts.splats) / passes / numSplats;
+}
+
+Bench::Register<BucketBenchmark> registerBucketBenchmark;
+
+} // anonymous namespace
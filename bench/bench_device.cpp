@@ -0,0 +1,285 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Benchmarks of the device-side pipeline: @ref SplatTreeCL::enqueueBuild and
+ * @ref Marching::generate driven by @ref MlsFunctor.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <CL/cl.hpp>
+#include "../src/tr1_cstdint.h"
+#include <boost/tr1/random.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include "benchmark.h"
+#include "../src/clh.h"
+#include "../src/grid.h"
+#include "../src/marching.h"
+#include "../src/mesh.h"
+#include "../src/mls.h"
+#include "../src/splat.h"
+#include "../src/splat_tree_cl.h"
+#include "../src/timer.h"
+
+namespace
+{
+
+/// Number of cells per side of the benchmark region
+static const Grid::size_type benchCells = 64;
+/// Number of splats in the synthetic scene
+static const std::size_t benchSplats = 200000;
+/// Subsampling shift used when building the octree
+static const unsigned int benchShift = 2;
+/// Octree levels: the region must fit in 2^(levels - shift - 1) cells
+static const std::size_t benchLevels = 9;
+
+/**
+ * Generates splats uniformly distributed over a sphere that fits inside the
+ * benchmark region, with outward normals. This resembles scanner input and
+ * gives marching cubes a real surface to extract.
+ */
+static void makeScene(std::vector<Splat> &splats)
+{
+    using std::tr1::mt19937;
+    using std::tr1::uniform_real;
+    using std::tr1::variate_generator;
+
+    const float center = benchCells * 0.5f;
+    const float radius = benchCells * 0.375f;
+
+    mt19937 engine;
+    variate_generator<mt19937 &, uniform_real<float> > gen(
+        engine, uniform_real<float>(-1.0f, 1.0f));
+
+    splats.resize(benchSplats);
+    for (std::size_t i = 0; i < benchSplats; i++)
+    {
+        float dir[3];
+        float len2;
+        do
+        {
+            len2 = 0.0f;
+            for (int j = 0; j < 3; j++)
+            {
+                dir[j] = gen();
+                len2 += dir[j] * dir[j];
+            }
+        } while (len2 < 0.01f || len2 > 1.0f);
+
+        const float scale = 1.0f / std::sqrt(len2);
+        Splat &splat = splats[i];
+        for (int j = 0; j < 3; j++)
+        {
+            dir[j] *= scale;
+            splat.position[j] = center + radius * dir[j];
+            splat.normal[j] = dir[j];
+        }
+        splat.radius = 1.5f;
+        splat.quality = 1.0f;
+    }
+}
+
+/**
+ * Convert interleaved host splats to the two-plane structure-of-arrays
+ * device layout expected by @ref SplatTreeCL::enqueueBuild, with a plane
+ * stride equal to the number of splats.
+ */
+static void splatsToDeviceLayout(const std::vector<Splat> &splats,
+                                 std::vector<cl_float4> &out)
+{
+    out.resize(splats.size() * 2);
+    for (std::size_t i = 0; i < splats.size(); i++)
+    {
+        // The halves of a Splat are exactly the two planes' float4s
+        std::memcpy(&out[i], splats[i].position, sizeof(cl_float4));
+        std::memcpy(&out[splats.size() + i], splats[i].normal, sizeof(cl_float4));
+    }
+}
+
+/**
+ * Measures the rate at which @ref SplatTreeCL::enqueueBuild constructs an
+ * octree over the synthetic scene. Since building rewrites the splat radii
+ * in-place, each timed pass restores the splats from a pristine copy with a
+ * device-to-device copy, whose cost is negligible against the build itself.
+ */
+class SplatTreeBuildBenchmark : public Bench::Benchmark
+{
+private:
+    static const int passes = 5;
+
+public:
+    virtual std::string name() const { return "splat_tree.build"; }
+    virtual bool needsDevice() const { return true; }
+    virtual void run(const Environment &env, std::map<std::string, double> &metrics);
+};
+
+void SplatTreeBuildBenchmark::run(const Environment &env, std::map<std::string, double> &metrics)
+{
+    std::vector<Splat> splats;
+    makeScene(splats);
+    std::vector<cl_float4> hostSplats;
+    splatsToDeviceLayout(splats, hostSplats);
+    const std::size_t bytes = hostSplats.size() * sizeof(cl_float4);
+
+    cl::CommandQueue queue(env.context, env.device);
+    cl::Buffer pristine(env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &hostSplats[0]);
+    cl::Buffer working(env.context, CL_MEM_READ_WRITE, bytes);
+
+    SplatTreeCL tree(env.context, env.device, benchLevels, splats.size());
+
+    const Grid::size_type size[3] = {benchCells, benchCells, benchCells};
+    const Grid::difference_type offset[3] = {0, 0, 0};
+
+    // warm-up, including lazy allocations inside the tree
+    cl::Event event;
+    queue.enqueueCopyBuffer(pristine, working, 0, 0, bytes);
+    tree.enqueueBuild(queue, working, splats.size(), 0, splats.size(), size, offset, benchShift, NULL, &event);
+    event.wait();
+
+    Timer timer;
+    for (int pass = 0; pass < passes; pass++)
+    {
+        queue.enqueueCopyBuffer(pristine, working, 0, 0, bytes);
+        tree.enqueueBuild(queue, working, splats.size(), 0, splats.size(), size, offset, benchShift, NULL, &event);
+        event.wait();
+    }
+    double elapsed = timer.getElapsed();
+
+    metrics["seconds_per_build"] = elapsed / passes;
+    metrics["splats_per_second"] = double(splats.size()) * passes / elapsed;
+}
+
+/**
+ * Measures @ref Marching::generate with @ref MlsFunctor as the generator,
+ * mirroring the per-bucket work done by @ref DeviceWorkerGroup. The octree is
+ * built once outside the timed region, so the result covers the MLS
+ * evaluation and the marching cubes extraction.
+ */
+class MarchingGenerateBenchmark : public Bench::Benchmark
+{
+private:
+    static const int passes = 3;
+
+    /// Output functor: counts the mesh sizes and signals completion
+    static void countOutput(
+        std::tr1::uint64_t &vertices,
+        std::tr1::uint64_t &triangles,
+        const cl::CommandQueue &queue,
+        const DeviceKeyMesh &mesh,
+        const std::vector<cl::Event> *events,
+        cl::Event *event);
+
+public:
+    virtual std::string name() const { return "marching.generate"; }
+    virtual bool needsDevice() const { return true; }
+    virtual void run(const Environment &env, std::map<std::string, double> &metrics);
+};
+
+void MarchingGenerateBenchmark::countOutput(
+    std::tr1::uint64_t &vertices,
+    std::tr1::uint64_t &triangles,
+    const cl::CommandQueue &queue,
+    const DeviceKeyMesh &mesh,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    vertices += mesh.numVertices();
+    triangles += mesh.numTriangles();
+    CLH::enqueueMarkerWithWaitList(queue, events, event);
+}
+
+void MarchingGenerateBenchmark::run(const Environment &env, std::map<std::string, double> &metrics)
+{
+    std::vector<Splat> splats;
+    makeScene(splats);
+    std::vector<cl_float4> hostSplats;
+    splatsToDeviceLayout(splats, hostSplats);
+    const std::size_t bytes = hostSplats.size() * sizeof(cl_float4);
+
+    cl::CommandQueue queue(env.context, env.device);
+    cl::Buffer working(env.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes, &hostSplats[0]);
+
+    SplatTreeCL tree(env.context, env.device, benchLevels, splats.size());
+    const Grid::size_type treeSize[3] = {benchCells, benchCells, benchCells};
+    const Grid::difference_type offset[3] = {0, 0, 0};
+    cl::Event treeEvent;
+    tree.enqueueBuild(queue, working, splats.size(), 0, splats.size(), treeSize, offset, benchShift, NULL, &treeEvent);
+    treeEvent.wait();
+
+    MlsFunctor input(env.context, MLS_SHAPE_SPHERE);
+    input.setBoundaryLimit(1.0f);
+    input.set(offset, tree, 0, benchShift);
+
+    const Grid::size_type maxSize = benchCells + 1;
+    const Grid::size_type maxSwathe = 64;
+    const std::size_t meshMemory =
+        std::size_t(maxSize - 1) * (maxSize - 1) * Marching::MAX_CELL_BYTES;
+    Marching marching(env.context, env.device, maxSize, maxSize, maxSize,
+                      maxSwathe, meshMemory, MlsFunctor::maxWgs);
+
+    const Grid::size_type size[3] = {maxSize, maxSize, maxSize};
+    cl_uint3 keyOffset;
+    std::memset(&keyOffset, 0, sizeof(keyOffset));
+
+    std::tr1::uint64_t vertices = 0, triangles = 0;
+    const Marching::OutputFunctor output =
+        boost::bind(&MarchingGenerateBenchmark::countOutput,
+                    boost::ref(vertices), boost::ref(triangles), _1, _2, _3, _4);
+
+    // warm-up
+    marching.generate(queue, input, output, size, keyOffset, NULL);
+    queue.finish();
+    vertices = 0;
+    triangles = 0;
+
+    Timer timer;
+    for (int pass = 0; pass < passes; pass++)
+    {
+        marching.generate(queue, input, output, size, keyOffset, NULL);
+        queue.finish();
+    }
+    double elapsed = timer.getElapsed();
+
+    const double cells = double(benchCells) * benchCells * benchCells;
+    metrics["seconds_per_pass"] = elapsed / passes;
+    metrics["cells_per_second"] = cells * passes / elapsed;
+    metrics["vertices_per_pass"] = double(vertices) / passes;
+    metrics["triangles_per_pass"] = double(triangles) / passes;
+}
+
+Bench::Register<SplatTreeBuildBenchmark> registerSplatTreeBuildBenchmark;
+Bench::Register<MarchingGenerateBenchmark> registerMarchingGenerateBenchmark;
+
+} // anonymous namespace
@@ -0,0 +1,132 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Benchmark of @ref FastPly::Reader decode throughput.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <boost/smart_ptr/scoped_array.hpp>
+#include "../src/tr1_cstdint.h"
+#include "benchmark.h"
+#include "../src/fast_ply.h"
+#include "../src/splat.h"
+#include "../src/timer.h"
+#include "../test/memory_reader.h"
+
+namespace
+{
+
+/**
+ * Measures the rate at which @ref FastPly::Reader::decodeBatch converts raw
+ * vertex data to @ref Splat. The input is a synthetic in-memory PLY file with
+ * the common layout of seven tightly-packed FLOAT32 fields, which is the case
+ * the specialized decode loop targets.
+ */
+class FastPlyDecodeBenchmark : public Bench::Benchmark
+{
+private:
+    static const std::size_t numSplats = 2000000;
+    static const int passes = 10;
+
+    /// Generates the content of the synthetic PLY file
+    static std::string makeContent();
+
+public:
+    virtual std::string name() const { return "fastply.decode"; }
+    virtual void run(const Environment &env, std::map<std::string, double> &metrics);
+};
+
+std::string FastPlyDecodeBenchmark::makeContent()
+{
+    std::ostringstream content;
+    content <<
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex " << numSplats << "\n" <<
+        "property float32 x\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "property float32 radius\n"
+        "end_header\n";
+
+    /* The values themselves do not matter for throughput, but they must be
+     * finite. A simple linear congruential sequence avoids any chance of the
+     * compiler spotting a repeating pattern.
+     */
+    std::vector<char> payload(numSplats * 7 * sizeof(float));
+    std::tr1::uint32_t state = 12345;
+    for (std::size_t i = 0; i < numSplats * 7; i++)
+    {
+        state = state * 1103515245 + 12345;
+        float value = float(state >> 16) * (1.0f / 65536.0f);
+        std::memcpy(&payload[i * sizeof(float)], &value, sizeof(float));
+    }
+    content.write(&payload[0], payload.size());
+    return content.str();
+}
+
+void FastPlyDecodeBenchmark::run(const Environment &env, std::map<std::string, double> &metrics)
+{
+    (void) env;
+
+    const std::string content = makeContent();
+    FastPly::Reader reader(MemoryReaderFactory(content), "<benchmark>", 1.0f, 1000.0f);
+    FastPly::Reader::Handle handle(reader);
+
+    const std::size_t vertexSize = reader.getVertexSize();
+    const char *data = handle.dataRaw(0, numSplats);
+    boost::scoped_array<char> buffer;
+    if (data == NULL)
+    {
+        buffer.reset(new char[numSplats * vertexSize]);
+        handle.readRaw(0, numSplats, buffer.get());
+        data = buffer.get();
+    }
+
+    std::vector<Splat> out(numSplats);
+    reader.decodeBatch(data, 0, numSplats, &out[0]); // warm-up
+
+    Timer timer;
+    for (int pass = 0; pass < passes; pass++)
+        reader.decodeBatch(data, 0, numSplats, &out[0]);
+    double elapsed = timer.getElapsed();
+
+    metrics["seconds_per_pass"] = elapsed / passes;
+    metrics["splats_per_second"] = numSplats * passes / elapsed;
+    metrics["bytes_per_second"] = double(numSplats) * vertexSize * passes / elapsed;
+}
+
+Bench::Register<FastPlyDecodeBenchmark> registerFastPlyDecodeBenchmark;
+
+} // anonymous namespace
@@ -0,0 +1,185 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Benchmark of @ref OOCMesher welding (@c add) and output (@c write).
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/smart_ptr/scoped_array.hpp>
+#include "../src/tr1_cstdint.h"
+#include "benchmark.h"
+#include "../src/fast_ply.h"
+#include "../src/mesh.h"
+#include "../src/mesher.h"
+#include "../src/timeplot.h"
+#include "../src/timer.h"
+
+namespace
+{
+
+/**
+ * Measures @ref OOCMesher on a synthetic mesh: a square grid of square
+ * blocks, each a triangulated height-field patch. The patch borders are
+ * external vertices with keys shared between neighboring blocks, so the
+ * welding of external vertices and the clump bookkeeping are exercised the
+ * same way as in production, while interior vertices take the internal fast
+ * path. The blocks are fed through the mesher's input functor (timed as
+ * @c add) and then written to a scratch PLY file (timed as @c write).
+ */
+class MesherBenchmark : public Bench::Benchmark
+{
+private:
+    static const unsigned int blocksPerSide = 8;
+    static const unsigned int cellsPerBlock = 64;
+
+    /**
+     * Feeds one block to the functor. The buffer must have room for
+     * the block's @ref MeshSizes::getHostBytes.
+     */
+    static void addBlock(
+        const MesherBase::InputFunctor &functor,
+        Timeplot::Worker &tworker,
+        char *buffer,
+        unsigned int bx, unsigned int by);
+
+public:
+    virtual std::string name() const { return "mesher.add_write"; }
+    virtual void run(const Environment &env, std::map<std::string, double> &metrics);
+};
+
+void MesherBenchmark::addBlock(
+    const MesherBase::InputFunctor &functor,
+    Timeplot::Worker &tworker,
+    char *buffer,
+    unsigned int bx, unsigned int by)
+{
+    const unsigned int G = cellsPerBlock;
+    const unsigned int side = G + 1;
+    const std::size_t numVertices = std::size_t(side) * side;
+    const std::size_t numTriangles = 2 * std::size_t(G) * G;
+    const std::size_t numInternal = std::size_t(G - 1) * (G - 1);
+
+    MesherWork work;
+    work.mesh = HostKeyMesh(buffer, MeshSizes(numVertices, numTriangles, numInternal));
+    work.hasEvents = false;
+    work.chunkId = ChunkId();
+
+    /* Assign local indices: internal (interior) vertices first, then the
+     * external (border) vertices, as the device mesh layout requires.
+     */
+    std::vector<cl_uint> indexMap(numVertices);
+    std::size_t nextInternal = 0;
+    std::size_t nextExternal = numInternal;
+    for (unsigned int ly = 0; ly < side; ly++)
+        for (unsigned int lx = 0; lx < side; lx++)
+        {
+            const bool internal = lx > 0 && lx < G && ly > 0 && ly < G;
+            const std::size_t idx = internal ? nextInternal++ : nextExternal++;
+            indexMap[ly * side + lx] = idx;
+
+            const unsigned int gx = bx * G + lx;
+            const unsigned int gy = by * G + ly;
+            work.mesh.vertices[idx][0] = float(gx);
+            work.mesh.vertices[idx][1] = float(gy);
+            work.mesh.vertices[idx][2] = float((gx * 3 + gy * 5) % 7);
+            if (!internal)
+                work.mesh.vertexKeys[idx] = (std::tr1::uint64_t(gy) << 32) | gx;
+        }
+
+    std::size_t t = 0;
+    for (unsigned int ly = 0; ly < G; ly++)
+        for (unsigned int lx = 0; lx < G; lx++)
+        {
+            const cl_uint v00 = indexMap[ly * side + lx];
+            const cl_uint v10 = indexMap[ly * side + lx + 1];
+            const cl_uint v01 = indexMap[(ly + 1) * side + lx];
+            const cl_uint v11 = indexMap[(ly + 1) * side + lx + 1];
+            work.mesh.triangles[t][0] = v00;
+            work.mesh.triangles[t][1] = v10;
+            work.mesh.triangles[t][2] = v11;
+            t++;
+            work.mesh.triangles[t][0] = v00;
+            work.mesh.triangles[t][1] = v11;
+            work.mesh.triangles[t][2] = v01;
+            t++;
+        }
+
+    functor(work, tworker);
+}
+
+void MesherBenchmark::run(const Environment &env, std::map<std::string, double> &metrics)
+{
+    (void) env;
+
+    const unsigned int side = cellsPerBlock + 1;
+    const std::size_t blockVertices = std::size_t(side) * side;
+    const std::size_t blockTriangles = 2 * std::size_t(cellsPerBlock) * cellsPerBlock;
+    const std::size_t numBlocks = std::size_t(blocksPerSide) * blocksPerSide;
+    const MeshSizes blockSizes(
+        blockVertices, blockTriangles,
+        std::size_t(cellsPerBlock - 1) * (cellsPerBlock - 1));
+
+    const boost::filesystem::path outPath =
+        boost::filesystem::temp_directory_path() / "mlsgpu-bench-mesher.ply";
+
+    Timeplot::Worker tworker("bench");
+    FastPly::Writer writer(SYSCALL_WRITER);
+    OOCMesher mesher(writer, TrivialNamer(outPath.string()));
+
+    boost::scoped_array<char> buffer(new char[blockSizes.getHostBytes()]);
+    const MesherBase::InputFunctor functor = mesher.functor();
+
+    Timer addTimer;
+    for (unsigned int by = 0; by < blocksPerSide; by++)
+        for (unsigned int bx = 0; bx < blocksPerSide; bx++)
+            addBlock(functor, tworker, buffer.get(), bx, by);
+    double addElapsed = addTimer.getElapsed();
+
+    Timer writeTimer;
+    mesher.write(tworker);
+    double writeElapsed = writeTimer.getElapsed();
+
+    boost::filesystem::remove(outPath);
+
+    const double totalTriangles = double(blockTriangles) * numBlocks;
+    metrics["add_seconds"] = addElapsed;
+    metrics["add_triangles_per_second"] = totalTriangles / addElapsed;
+    metrics["write_seconds"] = writeElapsed;
+    metrics["write_triangles_per_second"] = totalTriangles / writeElapsed;
+}
+
+Bench::Register<MesherBenchmark> registerMesherBenchmark;
+
+} // anonymous namespace
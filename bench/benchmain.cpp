@@ -0,0 +1,207 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Driver for the microbenchmark suite. Runs the benchmarks registered with
+ * @ref Bench::registry and writes the collected metrics as JSON, either to
+ * standard output or to a file given with <tt>--output</tt>.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <boost/next_prior.hpp>
+#include <CL/cl.hpp>
+#include "benchmark.h"
+#include "../src/clh.h"
+#include "../src/logging.h"
+
+namespace po = boost::program_options;
+
+namespace
+{
+
+/// Orders benchmarks by name, making the run order deterministic
+struct BenchmarkNameOrder
+{
+    bool operator()(const Bench::Benchmark *a, const Bench::Benchmark *b) const
+    {
+        return a->name() < b->name();
+    }
+};
+
+po::variables_map processOptions(int argc, char **argv)
+{
+    po::options_description desc("General options");
+    desc.add_options()
+        ("help,h",                  "Show usage")
+        ("benchmark", po::value<std::string>(), "Only run benchmarks whose name contains this substring")
+        ("output,o", po::value<std::string>(), "File to write the JSON results to (default: standard output)");
+
+    po::options_description cl("OpenCL options");
+    CLH::addOptions(cl);
+    desc.add(cl);
+
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+        po::notify(vm);
+
+        if (vm.count("help"))
+        {
+            std::cout << desc << '\n';
+            std::exit(0);
+        }
+        return vm;
+    }
+    catch (po::error &e)
+    {
+        std::cerr << e.what() << "\n\n" << desc << '\n';
+        std::exit(1);
+    }
+}
+
+/**
+ * Writes the results as JSON. Names are restricted to identifier-like
+ * characters by convention, so no string escaping is needed.
+ */
+void writeResults(
+    std::ostream &out,
+    const std::vector<std::pair<std::string, std::map<std::string, double> > > &results)
+{
+    out.precision(12);
+    out << "{\n  \"benchmarks\": [\n";
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        out << "    {\n      \"name\": \"" << results[i].first << "\",\n";
+        out << "      \"metrics\": {\n";
+        const std::map<std::string, double> &metrics = results[i].second;
+        for (std::map<std::string, double>::const_iterator j = metrics.begin();
+             j != metrics.end(); ++j)
+        {
+            out << "        \"" << j->first << "\": " << j->second;
+            if (boost::next(j) != metrics.end())
+                out << ',';
+            out << '\n';
+        }
+        out << "      }\n    }";
+        if (i + 1 < results.size())
+            out << ',';
+        out << '\n';
+    }
+    out << "  ]\n}\n";
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    Log::log.setLevel(Log::info);
+
+    po::variables_map vm = processOptions(argc, argv);
+
+    Bench::Benchmark::Environment env;
+    std::vector<cl::Device> devices = CLH::findDevices(vm);
+    if (!devices.empty())
+    {
+        env.haveDevice = true;
+        env.device = devices[0];
+        env.context = CLH::makeContext(env.device);
+        Log::log[Log::info] << "Using device " << env.device.getInfo<CL_DEVICE_NAME>() << "\n";
+    }
+    else
+        Log::log[Log::warn] << "No OpenCL device found: device benchmarks will be skipped\n";
+
+    std::string filter;
+    if (vm.count("benchmark"))
+        filter = vm["benchmark"].as<std::string>();
+
+    std::vector<Bench::Benchmark *> benchmarks = Bench::registry();
+    std::sort(benchmarks.begin(), benchmarks.end(), BenchmarkNameOrder());
+
+    std::vector<std::pair<std::string, std::map<std::string, double> > > results;
+    bool failed = false;
+    for (std::size_t i = 0; i < benchmarks.size(); i++)
+    {
+        Bench::Benchmark *benchmark = benchmarks[i];
+        const std::string name = benchmark->name();
+        if (name.find(filter) == std::string::npos)
+            continue;
+        if (benchmark->needsDevice() && !env.haveDevice)
+        {
+            Log::log[Log::info] << "Skipping " << name << " (no device)\n";
+            continue;
+        }
+
+        Log::log[Log::info] << "Running " << name << "...\n";
+        try
+        {
+            std::map<std::string, double> metrics;
+            benchmark->run(env, metrics);
+            results.push_back(std::make_pair(name, metrics));
+        }
+        catch (cl::Error &e)
+        {
+            Log::log[Log::error] << name << " failed: " << e.what()
+                << " (" << e.err() << ")\n";
+            failed = true;
+        }
+        catch (std::exception &e)
+        {
+            Log::log[Log::error] << name << " failed: " << e.what() << "\n";
+            failed = true;
+        }
+    }
+
+    if (vm.count("output"))
+    {
+        const std::string filename = vm["output"].as<std::string>();
+        std::ofstream out(filename.c_str());
+        writeResults(out, results);
+        if (!out)
+        {
+            std::cerr << "Could not write to " << filename << '\n';
+            return 1;
+        }
+    }
+    else
+        writeResults(std::cout, results);
+
+    return failed ? 1 : 0;
+}
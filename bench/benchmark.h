@@ -0,0 +1,116 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Framework for microbenchmarks of the hot paths in the pipeline.
+ *
+ * Each benchmark generates its own synthetic workload, so the results are
+ * reproducible and do not depend on production data sets. The driver
+ * (@c benchmain.cpp) runs the registered benchmarks and emits the collected
+ * metrics as JSON, allowing regressions to be detected by diffing runs.
+ */
+
+#ifndef BENCH_BENCHMARK_H
+#define BENCH_BENCHMARK_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <string>
+#include <map>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <CL/cl.hpp>
+
+namespace Bench
+{
+
+/**
+ * A single timed harness. Subclasses implement @ref run to execute a
+ * synthetic workload and report named metrics (typically a time in seconds
+ * and a derived rate such as splats per second).
+ */
+class Benchmark : public boost::noncopyable
+{
+public:
+    /**
+     * Resources shared by all benchmarks in a run. The OpenCL members are
+     * only valid when @ref haveDevice is true; benchmarks that return true
+     * from @ref needsDevice are skipped when no device was selected.
+     */
+    struct Environment
+    {
+        bool haveDevice;       ///< Whether @ref context and @ref device are usable
+        cl::Context context;   ///< Context for the benchmark device
+        cl::Device device;     ///< Device selected on the command line
+
+        Environment() : haveDevice(false) {}
+    };
+
+    /// Unique name of the benchmark, used for filtering and in the JSON output
+    virtual std::string name() const = 0;
+
+    /// Whether the benchmark requires an OpenCL device
+    virtual bool needsDevice() const { return false; }
+
+    /**
+     * Execute the workload and record metrics. Implementations should do an
+     * untimed warm-up pass before the timed passes so that one-off costs
+     * (lazy allocation, kernel compilation, autotuning) are excluded.
+     *
+     * @param env            Shared resources for the run.
+     * @param[out] metrics   Name-value pairs describing the results.
+     */
+    virtual void run(const Environment &env, std::map<std::string, double> &metrics) = 0;
+
+    virtual ~Benchmark();
+};
+
+/**
+ * Global list of registered benchmarks. The order is determined by static
+ * initialization and hence unspecified across translation units; the driver
+ * sorts by name before running.
+ */
+std::vector<Benchmark *> &registry();
+
+/**
+ * Registers a benchmark by adding an instance to @ref registry. Declare a
+ * namespace-scope instance of this class in the benchmark's translation unit.
+ */
+template<typename T>
+class Register
+{
+public:
+    Register()
+    {
+        registry().push_back(new T);
+    }
+};
+
+} // namespace Bench
+
+#endif /* !BENCH_BENCHMARK_H */
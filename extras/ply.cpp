@@ -108,6 +108,23 @@ static string getHeaderLine(istream &in) throw(FormatError)
 
 } // namespace detail
 
+std::size_t fieldSize(FieldType type)
+{
+    switch (type)
+    {
+    case INT8:
+    case UINT8:    return 1;
+    case INT16:
+    case UINT16:   return 2;
+    case INT32:
+    case UINT32:
+    case FLOAT32:  return 4;
+    case FLOAT64:  return 8;
+    default:       std::abort();
+    }
+    return 0; // should never be reached
+}
+
 template<typename T> long ElementRangeReaderBase::PropertyAsLong::operator()(T)
 {
     return long(reader.readField<T>());
@@ -319,4 +336,64 @@ void Reader::readHeader()
     }
 }
 
+MmapReader::MmapReader(const std::string &filename)
+    : mapping(filename), buffer(mapping.data(), mapping.size()), reader(&buffer)
+{
+}
+
+void MmapReader::readHeader()
+{
+    reader.readHeader();
+
+    /* Offsets are only known up to the first element whose size cannot be
+     * computed from the header; everything from there on can only be reached
+     * by scanning, which is what the streaming interface does.
+     */
+    std::tr1::uintmax_t offset = buffer.pubseekoff(0, ios::cur, ios::in);
+    bool seekable = (reader.format != FILE_FORMAT_ASCII);
+    BOOST_FOREACH(const ElementRangeReaderBase &e, reader.readers)
+    {
+        ElementLayout layout;
+        std::size_t elementSize = 0;
+        bool fixed = true;
+        BOOST_FOREACH(const PropertyType &p, e.getProperties())
+        {
+            if (p.isList)
+                fixed = false;
+            else
+                elementSize += fieldSize(p.valueType);
+        }
+        layout.seekable = seekable && fixed;
+        layout.offset = offset;
+        layout.elementSize = layout.seekable ? elementSize : 0;
+        layouts[e.getName()] = layout;
+        if (layout.seekable)
+            offset += e.getNumber() * elementSize;
+        else
+            seekable = false;
+    }
+}
+
+ElementRangeReaderBase &MmapReader::findElement(const std::string &name)
+{
+    BOOST_FOREACH(ElementRangeReaderBase &e, reader.readers)
+    {
+        if (e.getName() == name)
+            return e;
+    }
+    throw FormatError("No element called `" + name + "'");
+}
+
+bool MmapReader::canSeek(const std::string &name)
+{
+    findElement(name); // for the error check
+    return layouts.find(name)->second.seekable;
+}
+
+void MmapReader::seekTo(std::tr1::uintmax_t offset)
+{
+    reader.in.clear();
+    buffer.pubseekpos(std::streambuf::pos_type(std::streambuf::off_type(offset)), ios::in);
+}
+
 } // namespace PLY
@@ -24,6 +24,8 @@
 #include <algorithm>
 #include <memory>
 #include <vector>
+#include <map>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/iterator/iterator_facade.hpp>
 #include <boost/iterator/iterator_concepts.hpp>
 #include <boost/multi_index_container.hpp>
@@ -144,8 +146,53 @@ public:
     }
 };
 
+/**
+ * A read-only stream buffer over an in-memory byte range, supporting
+ * seeking. It does not own the memory; the caller must keep it alive.
+ */
+class MemoryStreambuf : public std::streambuf
+{
+public:
+    MemoryStreambuf(const char *data, std::size_t size)
+    {
+        char *base = const_cast<char *>(data);
+        setg(base, base, base + size);
+    }
+
+protected:
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir way,
+                             std::ios_base::openmode which)
+    {
+        if (!(which & std::ios_base::in))
+            return pos_type(off_type(-1));
+        off_type base;
+        switch (way)
+        {
+        case std::ios_base::beg: base = 0; break;
+        case std::ios_base::cur: base = gptr() - eback(); break;
+        case std::ios_base::end: base = egptr() - eback(); break;
+        default: return pos_type(off_type(-1));
+        }
+        off_type target = base + off;
+        if (target < 0 || target > egptr() - eback())
+            return pos_type(off_type(-1));
+        setg(eback(), eback() + target, egptr());
+        return pos_type(target);
+    }
+
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which)
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
 } // namespace detail
 
+/**
+ * Size in bytes of the binary encoding of a field.
+ */
+std::size_t fieldSize(FieldType type);
+
 /**
  * Encapsulates the information on a @c property line of a PLY header.
  */
@@ -299,6 +346,7 @@ public:
 };
 
 class Reader;
+class MmapReader;
 
 /**
  * A base class representing a single element type in a PLY file.
@@ -374,6 +422,7 @@ class Reader : public boost::noncopyable
 {
     friend class ElementRangeReaderBase;
     template<typename> friend class ElementRangeReader;
+    friend class MmapReader;
     friend class ::TestPlyReader;
 private:
     /// Stream used to wrap the underlying streambuf to parse the header
@@ -593,6 +642,37 @@ private:
         }
     };
 
+private:
+    friend class MmapReader;
+
+    /**
+     * Decode a single element at the current position of the underlying
+     * stream. The element cursor of the reader is not advanced; that is the
+     * responsibility of the caller (@ref iterator does so, while @ref
+     * MmapReader positions the stream explicitly).
+     */
+    Element decodeCurrent()
+    {
+        Builder builder(templateBuilder);
+        BOOST_FOREACH(const PropertyType &p, getProperties())
+        {
+            if (p.isList)
+            {
+                FieldCaster<std::size_t> lengthCaster(reader);
+                detail::FieldTypeFunction<FieldCaster<std::size_t> > caster(lengthCaster);
+                std::size_t length = caster(p.lengthType);
+                detail::FieldTypeFunction<PropertyListSetter> setter(PropertyListSetter(reader, builder, p.name, length));
+                setter(p.valueType);
+            }
+            else
+            {
+                detail::FieldTypeFunction<PropertySetter> setter(PropertySetter(reader, builder, p.name));
+                setter(p.valueType);
+            }
+        }
+        return builder.create();
+    }
+
 public:
     /**
      * Input iterator for iterating over the vertices.
@@ -628,24 +708,9 @@ public:
         Element dereference() const
         {
             validate();
-            Builder builder(owner->templateBuilder);
-            BOOST_FOREACH(const PropertyType &p, owner->getProperties())
-            {
-                if (p.isList)
-                {
-                    detail::FieldTypeFunction<FieldCaster<std::size_t> > caster(FieldCaster<std::size_t>(owner->reader));
-                    std::size_t length = caster(p.lengthType);
-                    detail::FieldTypeFunction<PropertyListSetter> setter(PropertyListSetter(owner->reader, builder, p.name, length));
-                    setter(p.valueType);
-                }
-                else
-                {
-                    detail::FieldTypeFunction<PropertySetter> setter(PropertySetter(owner->reader, builder, p.name));
-                    setter(p.valueType);
-                }
-            }
+            Element element = owner->decodeCurrent();
             owner->reader.increment();
-            return builder.create();
+            return element;
         }
 
     public:
@@ -670,6 +735,134 @@ public:
      */
 };
 
+/**
+ * Memory-mapped access to a PLY file with lazy per-element decoding.
+ *
+ * The file is mapped rather than streamed, so nothing beyond the header is
+ * parsed until an element is requested. Elements of a fixed-size binary
+ * element range can be fetched at random by index in constant time; an
+ * element range is directly addressable when the file is binary, none of the
+ * range's properties is a list, and the same holds for every preceding range
+ * (otherwise its starting offset cannot be computed without scanning). Use
+ * @ref canSeek to query this. ASCII files and list elements remain
+ * accessible through the streaming interface returned by @ref getReader.
+ *
+ * Random access and the streaming interface share a file position, so a
+ * @ref fetchElement call invalidates any streaming iteration in progress.
+ */
+class MmapReader : public boost::noncopyable
+{
+private:
+    /// Placement of one element range within the file
+    struct ElementLayout
+    {
+        std::tr1::uintmax_t offset;   ///< Byte offset of the first element
+        std::size_t elementSize;      ///< Bytes per element (0 if variable)
+        bool seekable;                ///< Whether elements can be addressed by index
+    };
+
+    boost::iostreams::mapped_file_source mapping;  ///< The mapped file
+    detail::MemoryStreambuf buffer;    ///< Stream buffer over the mapping
+    Reader reader;                     ///< Decoder operating on @ref buffer
+    std::map<std::string, ElementLayout> layouts;  ///< Layout per element name, filled by @ref readHeader
+
+    /// Retrieve the element range reader for @a name, throwing @ref FormatError if absent
+    ElementRangeReaderBase &findElement(const std::string &name);
+
+    /// Clear stream state and position the stream buffer at @a offset
+    void seekTo(std::tr1::uintmax_t offset);
+
+public:
+    /**
+     * Constructor. Maps the file and keeps it mapped for the lifetime of
+     * this object.
+     *
+     * @param filename  File to map.
+     * @throw std::ios::failure if the file could not be opened or mapped.
+     */
+    explicit MmapReader(const std::string &filename);
+
+    /// Register a new property handler (see @ref Reader::addBuilder)
+    template<typename Builder>
+    void addBuilder(const std::string &name, const Builder &templateBuilder)
+    {
+        reader.addBuilder(name, templateBuilder);
+    }
+
+    /**
+     * Read the PLY header and compute element offsets. This must only be
+     * called after registering builders with @ref addBuilder.
+     */
+    void readHeader();
+
+    /**
+     * The streaming interface over the mapping, for elements that cannot be
+     * addressed by index.
+     */
+    Reader &getReader() { return reader; }
+
+    /**
+     * Whether elements of @a name can be fetched at random by index.
+     * @throw FormatError if there is no element called @a name.
+     * @pre @ref readHeader has been called.
+     */
+    bool canSeek(const std::string &name);
+
+    /**
+     * Decode a single element by index.
+     *
+     * @param name   Name of the element range.
+     * @param index  Index of the element within the range.
+     * @throw FormatError        if there is no element called @a name
+     * @throw FormatError        if the element does not support random access
+     * @throw std::out_of_range  if @a index is out of range
+     * @throw std::bad_cast      if there is a builder type mismatch
+     * @pre @ref readHeader has been called.
+     */
+    template<typename Builder>
+    typename Builder::Element fetchElement(const std::string &name, std::tr1::uintmax_t index)
+    {
+        ElementRangeReader<Builder> &r = dynamic_cast<ElementRangeReader<Builder> &>(findElement(name));
+        const ElementLayout &layout = layouts.find(name)->second;
+        if (!layout.seekable)
+            throw FormatError("Element `" + name + "' does not support random access");
+        if (index >= r.getNumber())
+            throw std::out_of_range("Element index out of range");
+        seekTo(layout.offset + index * layout.elementSize);
+        return r.decodeCurrent();
+    }
+
+    /**
+     * Decode a contiguous run of elements by index. This is equivalent to
+     * calling @ref fetchElement for each index in <code>[first, last)</code>,
+     * but seeks only once.
+     *
+     * @param name         Name of the element range.
+     * @param first, last  Range of element indices to decode.
+     * @param out          Output iterator receiving the elements.
+     * @throw FormatError        if there is no element called @a name
+     * @throw FormatError        if the element does not support random access
+     * @throw std::out_of_range  if the index range is invalid
+     * @throw std::bad_cast      if there is a builder type mismatch
+     * @pre @ref readHeader has been called.
+     */
+    template<typename Builder, typename OutputIterator>
+    void fetchElements(const std::string &name,
+                       std::tr1::uintmax_t first, std::tr1::uintmax_t last,
+                       OutputIterator out)
+    {
+        ElementRangeReader<Builder> &r = dynamic_cast<ElementRangeReader<Builder> &>(findElement(name));
+        const ElementLayout &layout = layouts.find(name)->second;
+        if (!layout.seekable)
+            throw FormatError("Element `" + name + "' does not support random access");
+        if (first > last || last > r.getNumber())
+            throw std::out_of_range("Element index out of range");
+        seekTo(layout.offset + first * layout.elementSize);
+        for (std::tr1::uintmax_t i = first; i < last; i++)
+            *out++ = r.decodeCurrent();
+    }
+};
+
 template<typename Builder>
 ElementRangeReaderBase *Reader::Factory<Builder>::operator()(Reader &reader, const std::string &name, std::tr1::uintmax_t number, const PropertyTypeSet &properties) const
 {
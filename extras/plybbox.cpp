@@ -0,0 +1,150 @@
+/**
+ * @file
+ *
+ * Print the bounding box of the splats in each input PLY file. The box
+ * covers the full support of the splats (position &plusmn; radius), using
+ * the same smoothing and radius limit options as mlsgpu, so it bounds the
+ * region of the reconstruction that the file can influence. This is the
+ * input to utils/tile.py, which uses the per-file boxes to assign files to
+ * the tiles of a tiled reconstruction.
+ *
+ * Each input produces one line of output:
+ * <pre>
+ * minX minY minZ maxX maxY maxZ numSplats filename
+ * </pre>
+ * where the count is of finite splats. A file with no finite splats prints
+ * an empty box (min &gt; max) and a zero count.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include "../src/fast_ply.h"
+#include "../src/splat.h"
+#include "../src/binary_io.h"
+
+namespace po = boost::program_options;
+
+namespace
+{
+
+/// Number of splats decoded at a time
+const std::size_t BLOCK_SPLATS = std::size_t(1) << 18;
+
+/// Bounding box of the support of the finite splats in one file
+struct Bbox
+{
+    float bboxMin[3];
+    float bboxMax[3];
+    FastPly::Reader::size_type numSplats;
+
+    Bbox() : numSplats(0)
+    {
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            bboxMin[i] = std::numeric_limits<float>::infinity();
+            bboxMax[i] = -std::numeric_limits<float>::infinity();
+        }
+    }
+};
+
+/// Compute the support bounding box of one file
+Bbox fileBbox(const FastPly::Reader &reader)
+{
+    FastPly::Reader::Handle handle(reader);
+    std::vector<char> raw(BLOCK_SPLATS * reader.getVertexSize());
+    std::vector<Splat> splats(BLOCK_SPLATS);
+
+    Bbox bbox;
+    for (FastPly::Reader::size_type first = 0; first < reader.size(); first += BLOCK_SPLATS)
+    {
+        const std::size_t n = std::min(reader.size() - first,
+                                       FastPly::Reader::size_type(BLOCK_SPLATS));
+        handle.readRaw(first, first + n, &raw[0]);
+        reader.decodeBatch(&raw[0], 0, n, &splats[0]);
+        for (std::size_t i = 0; i < n; i++)
+            if (splats[i].isFinite())
+            {
+                for (unsigned int j = 0; j < 3; j++)
+                {
+                    bbox.bboxMin[j] = std::min(bbox.bboxMin[j], splats[i].position[j] - splats[i].radius);
+                    bbox.bboxMax[j] = std::max(bbox.bboxMax[j], splats[i].position[j] + splats[i].radius);
+                }
+                bbox.numSplats++;
+            }
+    }
+    return bbox;
+}
+
+} // anonymous namespace
+
+int main(int argc, const char **argv)
+{
+    double smooth;
+    double maxRadius = std::numeric_limits<double>::infinity();
+    std::vector<std::string> inputs;
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help",       "Show usage")
+        ("fit-smooth", po::value<double>(&smooth)->default_value(4.0), "Smoothing factor (must match mlsgpu)")
+        ("max-radius", po::value<double>(&maxRadius),                  "Limit influence radii (must match mlsgpu)");
+    po::options_description hidden("Hidden options");
+    hidden.add_options()
+        ("input", po::value<std::vector<std::string> >(&inputs)->composing(), "Input files");
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    try
+    {
+        po::options_description all;
+        all.add(desc).add(hidden);
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv)
+                  .options(all).positional(positional).run(), vm);
+        po::notify(vm);
+        if (vm.count("help") || inputs.empty())
+        {
+            std::cerr << "Usage: plybbox [options] file.ply [file.ply...]\n" << desc;
+            return vm.count("help") ? 0 : 2;
+        }
+    }
+    catch (po::error &e)
+    {
+        std::cerr << e.what() << "\nUsage: plybbox [options] file.ply [file.ply...]\n" << desc;
+        return 2;
+    }
+
+    try
+    {
+        std::cout.precision(std::numeric_limits<float>::digits10 + 2);
+        for (std::size_t i = 0; i < inputs.size(); i++)
+        {
+            FastPly::Reader reader(SYSCALL_READER, inputs[i], smooth, maxRadius);
+            const Bbox bbox = fileBbox(reader);
+            for (unsigned int j = 0; j < 3; j++)
+                std::cout << bbox.bboxMin[j] << ' ';
+            for (unsigned int j = 0; j < 3; j++)
+                std::cout << bbox.bboxMax[j] << ' ';
+            std::cout << bbox.numSplats << ' ' << inputs[i] << '\n';
+        }
+        std::cout.flush();
+        if (!std::cout)
+        {
+            std::cerr << "Error writing output\n";
+            return 1;
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
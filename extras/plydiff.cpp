@@ -0,0 +1,352 @@
+/**
+ * @file
+ *
+ * Program to measure the geometric difference between two PLY meshes that
+ * are expected to be near-identical, such as reconstructions of the same
+ * input at different kernel math tiers (see @c --cl-math). For each vertex
+ * of one mesh it finds the distance to the nearest vertex of the other,
+ * accelerated by a uniform grid hash, and reports the maximum, mean and
+ * RMS of these distances in both directions. The symmetric maximum is a
+ * Hausdorff-style bound: for meshes whose triangles are small relative to
+ * the tolerance of interest (true of marching-cubes output compared at the
+ * cell scale), vertex-to-vertex distance is an adequate proxy for the true
+ * surface-to-surface distance.
+ *
+ * The whole computation is in-core; both vertex sets must fit in memory.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstddef>
+#include <boost/array.hpp>
+#include <boost/program_options.hpp>
+#include "../src/tr1_cstdint.h"
+#include "../src/tr1_unordered_map.h"
+#include "ply.h"
+
+namespace po = boost::program_options;
+
+using namespace std;
+
+namespace
+{
+
+/// Builder for @ref PLY::Reader that reads vertices (just position)
+class VertexBuilder
+#ifdef DOXYGEN_FAKE_CODE
+: public PLY::Builder
+#endif
+{
+public:
+    typedef boost::array<float, 3> Element;
+
+    template<typename Iterator>
+    void setProperty(const string &name, Iterator first, Iterator last)
+    {
+        (void) name;
+        (void) first;
+        (void) last;
+    }
+
+    template<typename T>
+    void setProperty(const std::string &name, const T &value)
+    {
+        if (name == "x" || name == "y" || name == "z")
+            current[name[0] - 'x'] = value;
+    }
+
+    Element create()
+    {
+        return current;
+    }
+
+    static void validateProperties(const PLY::PropertyTypeSet &properties)
+    {
+        const string fields[] = {"x", "y", "z"};
+        PLY::PropertyTypeSet::index<PLY::Name>::type::const_iterator p;
+        for (int i = 0; i < 3; i++)
+        {
+            p = properties.get<PLY::Name>().find(fields[i]);
+            if (p == properties.get<PLY::Name>().end())
+            {
+                throw PLY::FormatError("Missing property " + fields[i]);
+            }
+            else if (p->isList)
+                throw PLY::FormatError("Property " + fields[i] + " should not be a list");
+        }
+    }
+
+private:
+    Element current;
+};
+
+typedef VertexBuilder::Element Vertex;
+
+/// Load just the vertex positions from a PLY file
+static void loadVertices(const string &filename, vector<Vertex> &out)
+{
+    filebuf in;
+    in.open(filename.c_str(), ios::in);
+    if (!in.is_open())
+        throw PLY::FormatError("Could not open " + filename);
+    PLY::Reader reader(&in);
+    reader.addBuilder("vertex", VertexBuilder());
+    reader.readHeader();
+    PLY::ElementRangeReader<VertexBuilder> &vertexReader = reader.skipTo<VertexBuilder>("vertex");
+    out.clear();
+    out.reserve(vertexReader.getNumber());
+    for (PLY::ElementRangeReader<VertexBuilder>::iterator i = vertexReader.begin();
+         i != vertexReader.end(); ++i)
+        out.push_back(*i);
+}
+
+/**
+ * Nearest-vertex queries against a fixed point set, backed by a uniform
+ * grid hash. The cell size is chosen for a few points per occupied cell,
+ * and queries search outwards one shell of cells at a time, stopping once
+ * no unvisited shell can contain a closer point.
+ */
+class NearestVertex
+{
+private:
+    typedef std::tr1::uint64_t CellKey;
+
+    const vector<Vertex> &points;
+    float origin[3];                ///< Lower corner of the bounding box
+    float cellSize;
+    int minCell[3], maxCell[3];     ///< Range of occupied cell coordinates
+    std::tr1::unordered_map<CellKey, vector<std::tr1::uint32_t> > cells;
+
+    static CellKey makeKey(int x, int y, int z)
+    {
+        // The cell coordinate range is bounded by construction, so 21 bits suffice
+        const CellKey bias = CellKey(1) << 20;
+        return ((CellKey(x) + bias) << 42)
+            | ((CellKey(y) + bias) << 21)
+            | (CellKey(z) + bias);
+    }
+
+    void cellOf(const Vertex &v, int out[3]) const
+    {
+        for (unsigned int i = 0; i < 3; i++)
+            out[i] = int(floor((v[i] - origin[i]) / cellSize));
+    }
+
+    /// Squared distance from @a v to the points in one cell, if it exists
+    void scanCell(int x, int y, int z, const Vertex &v, float &best2) const
+    {
+        std::tr1::unordered_map<CellKey, vector<std::tr1::uint32_t> >::const_iterator
+            pos = cells.find(makeKey(x, y, z));
+        if (pos == cells.end())
+            return;
+        for (size_t i = 0; i < pos->second.size(); i++)
+        {
+            const Vertex &p = points[pos->second[i]];
+            float d2 = 0.0f;
+            for (unsigned int j = 0; j < 3; j++)
+                d2 += (p[j] - v[j]) * (p[j] - v[j]);
+            best2 = min(best2, d2);
+        }
+    }
+
+public:
+    explicit NearestVertex(const vector<Vertex> &points)
+        : points(points)
+    {
+        float bboxMin[3], bboxMax[3];
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            bboxMin[i] = numeric_limits<float>::infinity();
+            bboxMax[i] = -numeric_limits<float>::infinity();
+        }
+        for (size_t i = 0; i < points.size(); i++)
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                bboxMin[j] = min(bboxMin[j], points[i][j]);
+                bboxMax[j] = max(bboxMax[j], points[i][j]);
+            }
+
+        float diag = 0.0f;
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            origin[i] = bboxMin[i];
+            diag += (bboxMax[i] - bboxMin[i]) * (bboxMax[i] - bboxMin[i]);
+        }
+        diag = sqrt(diag);
+        // Aim for a few points per occupied cell; guard degenerate inputs
+        cellSize = diag / max(1.0f, float(pow(double(points.size()), 1.0 / 3.0)));
+        if (!(cellSize > 0.0f))
+            cellSize = 1.0f;
+
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            int c[3];
+            cellOf(points[i], c);
+            cells[makeKey(c[0], c[1], c[2])].push_back(std::tr1::uint32_t(i));
+        }
+        cellOf(points[0], minCell);
+        for (unsigned int i = 0; i < 3; i++)
+            maxCell[i] = minCell[i];
+        for (size_t i = 1; i < points.size(); i++)
+        {
+            int c[3];
+            cellOf(points[i], c);
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                minCell[j] = min(minCell[j], c[j]);
+                maxCell[j] = max(maxCell[j], c[j]);
+            }
+        }
+    }
+
+    /// Distance from @a v to the nearest point in the set
+    float operator()(const Vertex &v) const
+    {
+        int c[3];
+        cellOf(v, c);
+        // No shell beyond this can contain any points at all
+        int lastShell = 0;
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            lastShell = max(lastShell, abs(minCell[i] - c[i]));
+            lastShell = max(lastShell, abs(maxCell[i] - c[i]));
+        }
+
+        float best2 = numeric_limits<float>::infinity();
+        for (int r = 0; r <= lastShell; r++)
+        {
+            /* Points in shell r are at least (r-1) cells away, so once the
+             * current best is closer than that the search is complete.
+             */
+            if (r > 0 && best2 <= (r - 1) * cellSize * (r - 1) * cellSize)
+                break;
+            for (int x = c[0] - r; x <= c[0] + r; x++)
+                for (int y = c[1] - r; y <= c[1] + r; y++)
+                    for (int z = c[2] - r; z <= c[2] + r; z++)
+                    {
+                        if (max(abs(x - c[0]), max(abs(y - c[1]), abs(z - c[2]))) != r)
+                            continue;
+                        scanCell(x, y, z, v, best2);
+                    }
+        }
+        return sqrt(best2);
+    }
+};
+
+/// Accumulated one-directional distance statistics
+struct DirStats
+{
+    double maxDist;
+    double sumDist;
+    double sumDist2;
+    size_t count;
+
+    DirStats() : maxDist(0.0), sumDist(0.0), sumDist2(0.0), count(0) {}
+
+    void add(double d)
+    {
+        maxDist = max(maxDist, d);
+        sumDist += d;
+        sumDist2 += d * d;
+        count++;
+    }
+
+    double mean() const { return count ? sumDist / count : 0.0; }
+    double rms() const { return count ? sqrt(sumDist2 / count) : 0.0; }
+};
+
+/// Distances from every vertex of @a from to its nearest vertex in @a to
+static DirStats oneDirection(const vector<Vertex> &from, const vector<Vertex> &to)
+{
+    NearestVertex nearest(to);
+    DirStats stats;
+    for (size_t i = 0; i < from.size(); i++)
+        stats.add(nearest(from[i]));
+    return stats;
+}
+
+} // anonymous namespace
+
+int main(int argc, const char **argv)
+{
+    double tolerance = -1.0;
+    vector<string> inputs;
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help",      "Show usage")
+        ("tolerance", po::value<double>(&tolerance), "Fail (exit 1) if the symmetric maximum exceeds this");
+    po::options_description hidden("Hidden options");
+    hidden.add_options()
+        ("input", po::value<vector<string> >(&inputs)->composing(), "Input files");
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    try
+    {
+        po::options_description all;
+        all.add(desc).add(hidden);
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv)
+                  .options(all).positional(positional).run(), vm);
+        po::notify(vm);
+        if (vm.count("help") || inputs.size() != 2)
+        {
+            cerr << "Usage: plydiff [options] a.ply b.ply\n" << desc;
+            return vm.count("help") ? 0 : 2;
+        }
+    }
+    catch (po::error &e)
+    {
+        cerr << e.what() << "\nUsage: plydiff [options] a.ply b.ply\n" << desc;
+        return 2;
+    }
+
+    try
+    {
+        vector<Vertex> a, b;
+        loadVertices(inputs[0], a);
+        loadVertices(inputs[1], b);
+        if (a.empty() || b.empty())
+        {
+            cerr << "Cannot compare an empty mesh\n";
+            return 2;
+        }
+
+        const DirStats forward = oneDirection(a, b);
+        const DirStats backward = oneDirection(b, a);
+        const double symmetric = max(forward.maxDist, backward.maxDist);
+
+        cout.precision(numeric_limits<float>::digits10 + 2);
+        cout << inputs[0] << " -> " << inputs[1]
+            << ": max " << forward.maxDist
+            << " mean " << forward.mean()
+            << " rms " << forward.rms() << '\n';
+        cout << inputs[1] << " -> " << inputs[0]
+            << ": max " << backward.maxDist
+            << " mean " << backward.mean()
+            << " rms " << backward.rms() << '\n';
+        cout << "symmetric max " << symmetric << '\n';
+        cout.flush();
+
+        if (tolerance >= 0.0 && symmetric > tolerance)
+        {
+            cerr << "Symmetric maximum " << symmetric << " exceeds tolerance " << tolerance << '\n';
+            return 1;
+        }
+    }
+    catch (std::exception &e)
+    {
+        cerr << e.what() << '\n';
+        return 2;
+    }
+    return 0;
+}
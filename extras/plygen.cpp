@@ -0,0 +1,228 @@
+/**
+ * @file
+ *
+ * Generate large synthetic point-cloud PLY inputs for scale testing. The
+ * splats sample the surface of a sphere, optionally with a skewed density
+ * distribution, Gaussian noise along the normals, and simulated overlapping
+ * scans split across several files. Generation is counter-based (each splat
+ * is a pure function of the seed and its index), so output is reproducible
+ * and can be produced in parallel at disk speed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <boost/program_options.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include "../src/binary_io.h"
+#include "../src/tr1_cstdint.h"
+
+namespace po = boost::program_options;
+
+namespace
+{
+
+/// On-disk layout of one vertex, matching the header written by @ref writeFile
+struct OutSplat
+{
+    float position[3];
+    float normal[3];
+    float radius;
+};
+
+/// Number of splats generated and written per batch
+const std::size_t BUFFER_SPLATS = 1 << 20;
+
+/// MurmurHash3 finalizer, used to build a counter-based random generator
+std::tr1::uint64_t mix(std::tr1::uint64_t h)
+{
+    h ^= h >> 33;
+    h *= UINT64_C(0xFF51AFD7ED558CCD);
+    h ^= h >> 33;
+    h *= UINT64_C(0xC4CEB9FE1A85EC53);
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * The @a k'th uniform variate in [0, 1) for splat @a id. Being a pure
+ * function of its arguments, it needs no per-thread generator state and
+ * gives the same splat for the same seed regardless of threading.
+ */
+double uniform(std::tr1::uint64_t seed, std::tr1::uint64_t id, unsigned int k)
+{
+    const std::tr1::uint64_t h = mix(mix(seed + id) + k);
+    return (h >> 11) * (1.0 / 9007199254740992.0); // 53-bit mantissa
+}
+
+/// Standard Gaussian variate by Box-Muller from uniforms @a k and @a k + 1
+double gaussian(std::tr1::uint64_t seed, std::tr1::uint64_t id, unsigned int k)
+{
+    const double u1 = 1.0 - uniform(seed, id, k);     // avoid log(0)
+    const double u2 = uniform(seed, id, k + 1);
+    return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+}
+
+struct Params
+{
+    std::tr1::uint64_t numSplats;
+    unsigned int numFiles;
+    std::tr1::uint64_t seed;
+    double radius;      ///< Sphere radius (world units)
+    double spacing;     ///< Approximate sample spacing; also scales splat radii
+    double noise;       ///< Noise standard deviation, as a multiple of spacing
+    double density;     ///< Latitude density exponent (1 = uniform)
+    double overlap;     ///< Fraction of each scan sector shared with its neighbour
+};
+
+/**
+ * Generate one splat. Scan @a file covers a longitude sector, widened by the
+ * overlap fraction so that adjacent scans resample each other's boundary
+ * region as real registered scans do. The density exponent skews the
+ * latitude distribution: values above 1 crowd the samples towards one pole,
+ * mimicking the near-to-far density falloff of a stationary scanner.
+ */
+void makeSplat(const Params &params, unsigned int file,
+               std::tr1::uint64_t id, OutSplat &out)
+{
+    const double sectorWidth = 2.0 * M_PI / params.numFiles * (1.0 + params.overlap);
+    const double sectorStart = 2.0 * M_PI * file / params.numFiles
+        - 0.5 * M_PI * params.overlap / params.numFiles;
+
+    const double phi = sectorStart + uniform(params.seed, id, 0) * sectorWidth;
+    double v = uniform(params.seed, id, 1);
+    if (params.density != 1.0)
+        v = std::pow(v, params.density);
+    const double z = 2.0 * v - 1.0;
+    const double s = std::sqrt(1.0 - z * z);
+
+    const double n[3] = { s * std::cos(phi), s * std::sin(phi), z };
+    const double offset = params.radius
+        + params.noise * params.spacing * gaussian(params.seed, id, 2);
+    for (int j = 0; j < 3; j++)
+    {
+        out.normal[j] = n[j];
+        out.position[j] = offset * n[j];
+    }
+    // Jitter the radii so that neighbourhood sizes are not all identical
+    out.radius = params.spacing * (1.0 + uniform(params.seed, id, 4));
+}
+
+void writeFile(const Params &params, const std::string &filename,
+               unsigned int file,
+               std::tr1::uint64_t firstSplat, std::tr1::uint64_t numSplats)
+{
+    std::ostringstream header;
+    header <<
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex " << numSplats << "\n" <<
+        "property float x\n"
+        "property float y\n"
+        "property float z\n"
+        "property float nx\n"
+        "property float ny\n"
+        "property float nz\n"
+        "property float radius\n"
+        "end_header\n";
+    const std::string headerStr = header.str();
+
+    boost::scoped_ptr<BinaryWriter> writer(createWriter(SYSCALL_WRITER));
+    writer->open(filename);
+    writer->preallocate(headerStr.size() + numSplats * sizeof(OutSplat));
+    writer->write(headerStr.data(), headerStr.size(), 0);
+
+    std::vector<OutSplat> buffer(std::min(std::tr1::uint64_t(BUFFER_SPLATS), numSplats));
+    BinaryWriter::offset_type offset = headerStr.size();
+    for (std::tr1::uint64_t start = 0; start < numSplats; start += BUFFER_SPLATS)
+    {
+        const std::size_t count = std::min(std::tr1::uint64_t(BUFFER_SPLATS), numSplats - start);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+        for (std::ptrdiff_t i = 0; i < (std::ptrdiff_t) count; i++)
+            makeSplat(params, file, firstSplat + start + i, buffer[i]);
+        writer->write(&buffer[0], count * sizeof(OutSplat), offset);
+        offset += count * sizeof(OutSplat);
+    }
+    writer->close();
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    Params params;
+    std::string output;
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help",                                                                       "Show usage")
+        ("output,o",  po::value<std::string>(&output)->default_value("synthetic"),     "Output filename prefix")
+        ("splats,n",  po::value<std::tr1::uint64_t>(&params.numSplats)->default_value(1000000), "Total number of splats")
+        ("files,f",   po::value<unsigned int>(&params.numFiles)->default_value(1),     "Number of output files (simulated scans)")
+        ("seed",      po::value<std::tr1::uint64_t>(&params.seed)->default_value(0),   "Random seed")
+        ("radius,r",  po::value<double>(&params.radius)->default_value(100.0),         "Sphere radius")
+        ("spacing,s", po::value<double>(&params.spacing)->default_value(0.0),          "Sample spacing (0 = derive from splat count)")
+        ("noise",     po::value<double>(&params.noise)->default_value(0.2),            "Noise standard deviation, in units of spacing")
+        ("density",   po::value<double>(&params.density)->default_value(1.0),          "Latitude density exponent (1 = uniform)")
+        ("overlap",   po::value<double>(&params.overlap)->default_value(0.1),          "Fraction of each scan shared with its neighbour");
+
+    try
+    {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+        if (vm.count("help"))
+        {
+            std::cout << "Usage: plygen [options]\n" << desc;
+            return 0;
+        }
+        if (params.numFiles == 0 || params.numSplats == 0)
+            throw po::error("--splats and --files must be positive");
+        if (params.overlap < 0.0 || params.density <= 0.0)
+            throw po::error("--overlap must be non-negative and --density positive");
+    }
+    catch (po::error &e)
+    {
+        std::cerr << e.what() << "\nUsage: plygen [options]\n" << desc;
+        return 1;
+    }
+
+    if (params.spacing <= 0.0)
+    {
+        // Spacing that would tile the sphere's area with numSplats samples
+        params.spacing = params.radius * std::sqrt(4.0 * M_PI / params.numSplats);
+    }
+
+    try
+    {
+        std::tr1::uint64_t firstSplat = 0;
+        for (unsigned int file = 0; file < params.numFiles; file++)
+        {
+            const std::tr1::uint64_t lastSplat =
+                params.numSplats * (file + 1) / params.numFiles;
+            std::ostringstream filename;
+            filename << output;
+            if (params.numFiles > 1)
+                filename << '.' << file;
+            filename << ".ply";
+            writeFile(params, filename.str(), file, firstSplat, lastSplat - firstSplat);
+            std::cout << filename.str() << ": " << (lastSplat - firstSplat) << " splats\n";
+            firstSplat = lastSplat;
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Failed to write output: " << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -1,7 +1,12 @@
 /**
  * @file
  *
- * Program to check whether a PLY file is valid and contains a manifold surface.
+ * Program to check whether a PLY file is valid and contains a manifold
+ * surface. The check runs out-of-core: edge records are extracted in bounded
+ * chunks, sorted in parallel and spilled to temporary files, then merged and
+ * verified one vertex neighbourhood at a time by several threads. Peak memory
+ * is the sort buffer (bounded by @c --memory) plus a union-find array of a
+ * few bytes per vertex, so meshes far larger than RAM can be validated.
  */
 
 #if HAVE_CONFIG_H
@@ -11,15 +16,36 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <sstream>
 #include <algorithm>
 #include <iterator>
+#include <utility>
+#include <map>
+#include <set>
+#include <cstddef>
 #include <boost/array.hpp>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/program_options.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include "../test/manifold.h"
+#include "../src/tr1_cstdint.h"
+#include "../src/union_find.h"
+#include "../src/misc.h"
 #include "../src/logging.h"
 #include "ply.h"
 
+namespace po = boost::program_options;
+
 using namespace std;
 
+namespace
+{
+
 /// Builder for @ref PLY::Reader that reads vertices (just position)
 class VertexBuilder
 #ifdef DOXYGEN_FAKE_CODE
@@ -149,19 +175,492 @@ static void validateVertices(Iterator first, Iterator last)
     }
 }
 
+/**
+ * One directed edge of the neighbourhood of @ref centre. For each corner
+ * @c v of a triangle <code>(v, x, y)</code> a record <code>(v, x, y)</code>
+ * is emitted, i.e. the opposite edge with the triangle's winding. This is
+ * the external-memory form of the per-vertex edge lists built by
+ * @ref Manifold::isManifold.
+ */
+struct EdgeRecord
+{
+    std::tr1::uint32_t centre;   ///< Vertex whose neighbourhood the edge belongs to
+    std::tr1::uint32_t from;     ///< Source of the directed opposite edge
+    std::tr1::uint32_t to;       ///< Target of the directed opposite edge
+};
+
+/// Orders records by the vertex they describe; the order within a neighbourhood is irrelevant
+static inline bool operator<(const EdgeRecord &a, const EdgeRecord &b)
+{
+    return a.centre < b.centre;
+}
+
+/// A sorted run of edge records that has been spilled to a temporary file
+struct SpillFile
+{
+    boost::filesystem::path path;
+    std::tr1::uint64_t numRecords;
+};
+
+/// Sorts a contiguous range of records (thread entry point for @ref EdgeStore)
+static void sortRange(EdgeRecord *first, EdgeRecord *last)
+{
+    std::sort(first, last);
+}
+
+/**
+ * Accumulates edge records in a buffer of bounded size, spilling sorted runs
+ * to temporary files as the buffer fills. The final partial buffer is kept in
+ * memory as a sorted tail rather than spilled.
+ */
+class EdgeStore : public boost::noncopyable
+{
+public:
+    EdgeStore(std::size_t maxRecords, unsigned int numThreads)
+        : maxRecords(std::max(maxRecords, std::size_t(1))), numThreads(numThreads)
+    {
+        buffer.reserve(this->maxRecords);
+    }
+
+    ~EdgeStore()
+    {
+        for (std::size_t i = 0; i < spills.size(); i++)
+        {
+            boost::system::error_code dummy;
+            boost::filesystem::remove(spills[i].path, dummy);
+        }
+    }
+
+    void append(const EdgeRecord &record)
+    {
+        buffer.push_back(record);
+        if (buffer.size() == maxRecords)
+            spill();
+    }
+
+    /// Sorts the in-memory tail. No more records may be appended afterwards.
+    void finish()
+    {
+        sortBuffer();
+    }
+
+    const std::vector<SpillFile> &getSpills() const { return spills; }
+    const std::vector<EdgeRecord> &getTail() const { return buffer; }
+
+private:
+    /**
+     * Sorts the buffer, using one thread per contiguous sub-range followed by
+     * a cascade of in-place merges.
+     */
+    void sortBuffer()
+    {
+        const std::size_t minPerThread = 1024 * 1024;
+        std::size_t pieces = std::min<std::size_t>(numThreads, buffer.size() / minPerThread);
+        if (pieces <= 1)
+        {
+            std::sort(buffer.begin(), buffer.end());
+            return;
+        }
+
+        std::vector<std::size_t> bounds(pieces + 1);
+        for (std::size_t i = 0; i <= pieces; i++)
+            bounds[i] = buffer.size() * i / pieces;
+        boost::thread_group threads;
+        for (std::size_t i = 0; i < pieces; i++)
+            threads.create_thread(boost::bind(&sortRange,
+                                              &buffer[0] + bounds[i],
+                                              &buffer[0] + bounds[i + 1]));
+        threads.join_all();
+        while (pieces > 1)
+        {
+            std::size_t out = 0;
+            for (std::size_t i = 0; i + 1 < pieces; i += 2)
+            {
+                std::inplace_merge(buffer.begin() + bounds[i],
+                                   buffer.begin() + bounds[i + 1],
+                                   buffer.begin() + bounds[i + 2]);
+                bounds[++out] = bounds[i + 2];
+            }
+            if (pieces % 2 == 1)
+                bounds[++out] = bounds[pieces];
+            pieces = out;
+        }
+    }
+
+    /// Sorts the buffer and writes it to a new temporary file
+    void spill()
+    {
+        sortBuffer();
+
+        SpillFile file;
+        boost::filesystem::ofstream out;
+        createTmpFile(file.path, out);
+        out.write(reinterpret_cast<const char *>(&buffer[0]),
+                  buffer.size() * sizeof(EdgeRecord));
+        out.close();
+        if (!out)
+        {
+            cerr << "Failed to write spill file " << file.path.string() << "\n";
+            exit(1);
+        }
+        file.numRecords = buffer.size();
+        spills.push_back(file);
+        buffer.clear();
+    }
+
+    std::size_t maxRecords;           ///< Buffer capacity in records
+    unsigned int numThreads;          ///< Sorting parallelism
+    std::vector<EdgeRecord> buffer;   ///< Records not yet spilled
+    std::vector<SpillFile> spills;    ///< Sorted runs already on disk
+};
+
+/**
+ * Streams the records of one sorted run whose centre lies in
+ * <code>[firstCentre, lastCentre)</code>, either from a spill file or from
+ * the in-memory tail of an @ref EdgeStore. The starting position within a
+ * spill file is found by binary search on the (fixed-size) records, so each
+ * verification thread reads only its own stripe of each run.
+ */
+class EdgeCursor : public boost::noncopyable
+{
+public:
+    EdgeCursor(const SpillFile &file,
+               std::tr1::uint32_t firstCentre, std::tr1::uint32_t lastCentre)
+        : lastCentre(lastCentre), tail(NULL), tailPos(0), blockPos(0)
+    {
+        in.open(file.path, ios::binary);
+        if (!in)
+        {
+            cerr << "Failed to reopen spill file " << file.path.string() << "\n";
+            exit(1);
+        }
+        filePos = lowerBound(file.numRecords, firstCentre);
+        fileEnd = file.numRecords;
+        in.seekg(boost::filesystem::ifstream::off_type(filePos * sizeof(EdgeRecord)));
+        refill();
+    }
+
+    EdgeCursor(const std::vector<EdgeRecord> &tailRecords,
+               std::tr1::uint32_t firstCentre, std::tr1::uint32_t lastCentre)
+        : lastCentre(lastCentre), tail(&tailRecords), blockPos(0),
+          filePos(0), fileEnd(0)
+    {
+        EdgeRecord key;
+        key.centre = firstCentre;
+        tailPos = std::lower_bound(tailRecords.begin(), tailRecords.end(), key)
+            - tailRecords.begin();
+    }
+
+    bool empty() const
+    {
+        if (tail != NULL)
+            return tailPos == tail->size() || (*tail)[tailPos].centre >= lastCentre;
+        else
+            return blockPos == block.size() || block[blockPos].centre >= lastCentre;
+    }
+
+    const EdgeRecord &front() const
+    {
+        return tail != NULL ? (*tail)[tailPos] : block[blockPos];
+    }
+
+    void pop()
+    {
+        if (tail != NULL)
+            tailPos++;
+        else
+        {
+            blockPos++;
+            if (blockPos == block.size())
+                refill();
+        }
+    }
+
+private:
+    /// Index of the first record with centre at least @a key
+    std::tr1::uint64_t lowerBound(std::tr1::uint64_t numRecords, std::tr1::uint32_t key)
+    {
+        std::tr1::uint64_t lo = 0, hi = numRecords;
+        while (lo < hi)
+        {
+            std::tr1::uint64_t mid = lo + (hi - lo) / 2;
+            EdgeRecord record;
+            in.seekg(boost::filesystem::ifstream::off_type(mid * sizeof(EdgeRecord)));
+            in.read(reinterpret_cast<char *>(&record), sizeof(record));
+            if (!in)
+            {
+                cerr << "Failed to read spill file\n";
+                exit(1);
+            }
+            if (record.centre < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    /// Reads the next block of records from the spill file
+    void refill()
+    {
+        const std::size_t blockRecords = 8192;
+        std::size_t n = std::size_t(std::min<std::tr1::uint64_t>(blockRecords, fileEnd - filePos));
+        block.resize(n);
+        blockPos = 0;
+        if (n > 0)
+        {
+            in.read(reinterpret_cast<char *>(&block[0]), n * sizeof(EdgeRecord));
+            if (!in)
+            {
+                cerr << "Failed to read spill file\n";
+                exit(1);
+            }
+            filePos += n;
+        }
+    }
+
+    std::tr1::uint32_t lastCentre;        ///< Upper bound (exclusive) on centres to produce
+    const std::vector<EdgeRecord> *tail;  ///< In-memory source, or NULL for a spill file
+    std::size_t tailPos;                  ///< Current position in @ref tail
+    std::vector<EdgeRecord> block;        ///< Buffered records from the spill file
+    std::size_t blockPos;                 ///< Current position in @ref block
+    boost::filesystem::ifstream in;       ///< Spill file stream
+    std::tr1::uint64_t filePos;           ///< Next record index to read from the file
+    std::tr1::uint64_t fileEnd;           ///< Total records in the file
+};
+
+/**
+ * Checks that one vertex neighbourhood is a ring or a disjoint collection of
+ * linear runs. This is the per-vertex body of @ref Manifold::isManifold,
+ * operating on an explicit neighbourhood instead of a prebuilt edge table.
+ *
+ * @param centre           The vertex being checked.
+ * @param neigh            The opposite edges of the triangles incident on @a centre.
+ * @param boundaryMerges   Vertex pairs to merge when counting boundary loops.
+ * @return The empty string on success, else a human-readable explanation.
+ */
+static std::string checkVertex(
+    std::tr1::uint32_t centre,
+    const std::vector<std::pair<std::tr1::uint32_t, std::tr1::uint32_t> > &neigh,
+    std::vector<std::pair<std::tr1::uint32_t, std::tr1::uint32_t> > &boundaryMerges)
+{
+    typedef std::tr1::uint32_t index_type;
+    ostringstream reason;
+
+    std::map<index_type, index_type> arrow; // maps .first to .second
+    std::set<index_type> seen; // .second that have been observed
+    for (std::size_t j = 0; j < neigh.size(); j++)
+    {
+        index_type x = neigh[j].first;
+        index_type y = neigh[j].second;
+        if (arrow.count(x))
+        {
+            reason << "Edge " << centre << " - " << x << " occurs twice with same winding\n";
+            return reason.str();
+        }
+        arrow[x] = y;
+        if (seen.count(y))
+        {
+            reason << "Edge " << y << " - " << centre << " occurs twice with same winding\n";
+            return reason.str();
+        }
+        seen.insert(y);
+    }
+
+    /* At this point, we have in-degree and out-degree of at most 1 for
+     * each vertex, so we have a collection of lines and rings.
+     */
+
+    // Find lines
+    std::size_t len = 0;
+    for (std::size_t j = 0; j < neigh.size(); j++)
+    {
+        if (!seen.count(neigh[j].first))
+        {
+            index_type first = neigh[j].first;
+            index_type cur = first;
+            while (arrow.count(cur))
+            {
+                cur = arrow[cur];
+                len++;
+            }
+            // track boundary loops
+            boundaryMerges.push_back(std::make_pair(first, centre));
+            boundaryMerges.push_back(std::make_pair(cur, centre));
+        }
+    }
+    if (len != 0 && len != neigh.size())
+    {
+        // There were lines but they didn't cover everything.
+        reason << "Vertex " << centre << " is both in the interior and on the boundary\n";
+        return reason.str();
+    }
+    else if (len == 0)
+    {
+        // There are only rings. Check that there is exactly one.
+        index_type start = neigh[0].first;
+        index_type cur = start;
+        do
+        {
+            cur = arrow[cur];
+            len++;
+        } while (cur != start);
+        if (len != neigh.size())
+        {
+            reason << "Vertex " << centre << " tunnels between interior regions\n";
+            return reason.str();
+        }
+    }
+    return "";
+}
+
+/**
+ * Verifies the neighbourhoods of one stripe of the vertex range. Each worker
+ * merges the sorted runs over its own stripe, so the workers proceed
+ * independently; boundary-loop merges are recorded per worker and applied
+ * after all workers have finished.
+ */
+class VerifyWorker
+{
+public:
+    VerifyWorker(const EdgeStore &store,
+                 std::tr1::uint32_t firstCentre, std::tr1::uint32_t lastCentre,
+                 bool &anyFailed)
+        : store(store), firstCentre(firstCentre), lastCentre(lastCentre),
+          anyFailed(anyFailed)
+    {
+    }
+
+    void operator()()
+    {
+        std::vector<boost::shared_ptr<EdgeCursor> > cursors;
+        for (std::size_t i = 0; i < store.getSpills().size(); i++)
+            cursors.push_back(boost::shared_ptr<EdgeCursor>(
+                new EdgeCursor(store.getSpills()[i], firstCentre, lastCentre)));
+        cursors.push_back(boost::shared_ptr<EdgeCursor>(
+            new EdgeCursor(store.getTail(), firstCentre, lastCentre)));
+
+        std::tr1::uint32_t expected = firstCentre;
+        std::vector<std::pair<std::tr1::uint32_t, std::tr1::uint32_t> > neigh;
+        while (true)
+        {
+            if (anyFailed)
+                return; // some other worker has already found a problem
+
+            // Find the lowest unprocessed centre across the sorted runs
+            std::tr1::uint32_t centre = lastCentre;
+            bool found = false;
+            for (std::size_t i = 0; i < cursors.size(); i++)
+                if (!cursors[i]->empty() && (!found || cursors[i]->front().centre < centre))
+                {
+                    centre = cursors[i]->front().centre;
+                    found = true;
+                }
+            if (expected < (found ? centre : lastCentre))
+            {
+                // disallow isolated vertices
+                ostringstream msg;
+                msg << "Vertex " << expected << " is isolated\n";
+                fail(msg.str());
+                return;
+            }
+            if (!found)
+                break;
+
+            neigh.clear();
+            for (std::size_t i = 0; i < cursors.size(); i++)
+                while (!cursors[i]->empty() && cursors[i]->front().centre == centre)
+                {
+                    const EdgeRecord &record = cursors[i]->front();
+                    neigh.push_back(std::make_pair(record.from, record.to));
+                    cursors[i]->pop();
+                }
+
+            const std::string vreason = checkVertex(centre, neigh, boundaryMerges);
+            if (vreason != "")
+            {
+                fail(vreason);
+                return;
+            }
+            expected = centre + 1;
+        }
+    }
+
+    const std::string &getReason() const { return reason; }
+    const std::vector<std::pair<std::tr1::uint32_t, std::tr1::uint32_t> > &getBoundaryMerges() const
+    {
+        return boundaryMerges;
+    }
+
+private:
+    void fail(const std::string &why)
+    {
+        reason = why;
+        anyFailed = true;
+    }
+
+    const EdgeStore &store;
+    std::tr1::uint32_t firstCentre;       ///< First vertex in the stripe
+    std::tr1::uint32_t lastCentre;        ///< One past the last vertex in the stripe
+    bool &anyFailed;                      ///< Shared early-out flag (advisory only)
+    std::string reason;                   ///< Failure explanation, or empty
+    /// Deferred boundary-loop union-find merges
+    std::vector<std::pair<std::tr1::uint32_t, std::tr1::uint32_t> > boundaryMerges;
+};
+
+} // anonymous namespace
+
 int main(int argc, const char **argv)
 {
-    if (argc != 2)
+    std::string filename;
+    std::size_t memoryMiB;
+    unsigned int numThreads;
+    std::string tmpDir;
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help",                                               "Show usage")
+        ("memory",  po::value<std::size_t>(&memoryMiB)->default_value(512),
+                                                               "Edge sort buffer size (MiB)")
+        ("threads", po::value<unsigned int>(&numThreads)->default_value(
+                        std::max(boost::thread::hardware_concurrency(), 1U)),
+                                                               "Number of worker threads")
+        ("tmp-dir", po::value<std::string>(&tmpDir)->default_value(""),
+                                                               "Directory for spill files");
+    po::options_description hidden("Hidden options");
+    hidden.add_options()
+        ("input", po::value<std::string>(&filename), "Input file");
+    po::positional_options_description positional;
+    positional.add("input", 1);
+
+    try
+    {
+        po::options_description all;
+        all.add(desc).add(hidden);
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv)
+                  .options(all).positional(positional).run(), vm);
+        po::notify(vm);
+        if (vm.count("help") || !vm.count("input"))
+        {
+            cerr << "Usage: plymanifold [options] file.ply\n" << desc;
+            return vm.count("help") ? 0 : 2;
+        }
+        if (memoryMiB == 0 || numThreads == 0)
+            throw po::error("--memory and --threads must be positive");
+    }
+    catch (po::error &e)
     {
-        cerr << "Usage: plymanifold file.ply\n";
+        cerr << e.what() << "\nUsage: plymanifold [options] file.ply\n" << desc;
         return 2;
     }
+    if (tmpDir != "")
+        setTmpFileDir(tmpDir);
 
-    const char *filename = argv[1];
     try
     {
         filebuf in;
-        in.open(filename, ios::in);
+        in.open(filename.c_str(), ios::in);
         if (!in.is_open())
         {
             cerr << "Could not open " << filename << "\n";
@@ -174,22 +673,100 @@ int main(int argc, const char **argv)
         PLY::ElementRangeReader<VertexBuilder> &vertexReader = reader.skipTo<VertexBuilder>("vertex");
         size_t numVertices = vertexReader.getNumber();
         validateVertices(vertexReader.begin(), vertexReader.end());
-        PLY::ElementRangeReader<TriangleBuilder> &triangleReader = reader.skipTo<TriangleBuilder>("face");
+
         Manifold::Metadata metadata;
-        string reason = Manifold::isManifold(numVertices, triangleReader.begin(), triangleReader.end(), &metadata);
-        if (reason != "")
+        metadata.numVertices = numVertices;
+        std::vector<UnionFind::Node<std::tr1::int64_t> > components(numVertices);
+
+        /* Extraction pass: stream the triangles once, emitting each
+         * triangle's three opposite-edge records into the bounded sorter
+         * and merging connected components as we go.
+         */
+        const std::size_t maxRecords = memoryMiB * (1024 * 1024 / sizeof(EdgeRecord));
+        EdgeStore store(maxRecords, numThreads);
+        PLY::ElementRangeReader<TriangleBuilder> &triangleReader = reader.skipTo<TriangleBuilder>("face");
+        for (PLY::ElementRangeReader<TriangleBuilder>::iterator i = triangleReader.begin();
+             i != triangleReader.end(); ++i)
         {
-            cout << "Mesh is not manifold: " << reason << "\n";
-            return 1;
+            const TriangleBuilder::Element &triangle = *i;
+            std::tr1::uint32_t indices[3] = {triangle[0], triangle[1], triangle[2]};
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                if (indices[0] >= numVertices)
+                {
+                    cout << "Mesh is not manifold: Triangle " << metadata.numTriangles
+                        << " contains out-of-range index " << indices[0] << "\n";
+                    return 1;
+                }
+                if (indices[0] == indices[1])
+                {
+                    cout << "Mesh is not manifold: Triangle " << metadata.numTriangles
+                        << " contains vertex " << indices[0] << " twice\n";
+                    return 1;
+                }
+                EdgeRecord record;
+                record.centre = indices[0];
+                record.from = indices[1];
+                record.to = indices[2];
+                store.append(record);
+                std::rotate(indices, indices + 1, indices + 3);
+            }
+            UnionFind::merge(components, indices[0], indices[1]);
+            UnionFind::merge(components, indices[1], indices[2]);
+            metadata.numTriangles++;
         }
-        else
+        store.finish();
+
+        // Count components
+        for (std::size_t i = 0; i < numVertices; i++)
         {
-            cout << "Mesh is manifold."
-                << "\nVertices: " << metadata.numVertices
-                << "\nTriangles: " << metadata.numTriangles
-                << "\nComponents: " << metadata.numComponents
-                << "\nBoundaries: " << metadata.numBoundaries << endl;
+            if (components[i].isRoot())
+                metadata.numComponents++;
+            components[i] = UnionFind::Node<std::tr1::int64_t>(); // reset to use for counting boundaries
         }
+
+        /* Verification pass: each worker merges the sorted runs over its own
+         * stripe of the vertex range and checks every neighbourhood within it.
+         */
+        bool anyFailed = false;
+        std::vector<boost::shared_ptr<VerifyWorker> > workers;
+        boost::thread_group threads;
+        for (unsigned int t = 0; t < numThreads; t++)
+        {
+            std::tr1::uint32_t first = std::tr1::uint32_t(numVertices * t / numThreads);
+            std::tr1::uint32_t last = std::tr1::uint32_t(numVertices * (t + 1) / numThreads);
+            workers.push_back(boost::shared_ptr<VerifyWorker>(
+                new VerifyWorker(store, first, last, anyFailed)));
+            threads.create_thread(boost::ref(*workers.back()));
+        }
+        threads.join_all();
+
+        for (std::size_t t = 0; t < workers.size(); t++)
+            if (workers[t]->getReason() != "")
+            {
+                cout << "Mesh is not manifold: " << workers[t]->getReason() << "\n";
+                return 1;
+            }
+
+        // Count boundaries
+        for (std::size_t t = 0; t < workers.size(); t++)
+        {
+            const std::vector<std::pair<std::tr1::uint32_t, std::tr1::uint32_t> > &merges
+                = workers[t]->getBoundaryMerges();
+            for (std::size_t i = 0; i < merges.size(); i++)
+                UnionFind::merge(components, merges[i].first, merges[i].second);
+        }
+        for (std::size_t i = 0; i < numVertices; i++)
+        {
+            if (components[i].isRoot() && components[i].size() >= 3)
+                metadata.numBoundaries++;
+        }
+
+        cout << "Mesh is manifold."
+            << "\nVertices: " << metadata.numVertices
+            << "\nTriangles: " << metadata.numTriangles
+            << "\nComponents: " << metadata.numComponents
+            << "\nBoundaries: " << metadata.numBoundaries << endl;
     }
     catch (ios::failure &e)
     {
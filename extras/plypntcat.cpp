@@ -2,18 +2,49 @@
  * @file
  *
  * Concatenate several PLY files containing points.
+ *
+ * When an output file is given (@c -o), the concatenation avoids decoding
+ * wherever it can: inputs whose vertex layout already matches the output
+ * (see @ref FastPly::Reader::isDenseLayout) have their bodies transferred
+ * byte-for-byte, with @c copy_file_range where the OS provides it so the
+ * data never crosses into user space. The output is preallocated and each
+ * input is assigned its own region, so the inputs are processed by parallel
+ * workers. Inputs with other layouts are re-encoded through the usual
+ * decode path, which also drops non-finite splats; spliced inputs pass
+ * their bytes through untouched (mlsgpu skips non-finite splats on read, so
+ * carrying them across a merge is harmless).
+ *
+ * Without @c -o the original streaming behaviour is preserved and the
+ * result is written to standard output.
  */
 
 #if HAVE_CONFIG_H
 # include <config.h>
 #endif
 
+#if HAVE_COPY_FILE_RANGE && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE 1 /* glibc only declares copy_file_range with _GNU_SOURCE */
+#endif
+
 #include <memory>
 #include <iostream>
+#include <sstream>
 #include <limits>
+#include <string>
 #include <vector>
+#include <algorithm>
+#include <cerrno>
 #include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/exception/all.hpp>
+#if HAVE_COPY_FILE_RANGE
+# include <unistd.h>
+#endif
 #include "src/fast_ply.h"
+#include "src/binary_io.h"
 #include "src/logging.h"
 #include "src/tr1_cstdint.h"
 #include "src/splat.h"
@@ -26,24 +57,269 @@ struct OutSplat
     float radius;
 };
 
-int main(int argc, char **argv)
+namespace
 {
-    std::ios::sync_with_stdio(false);
 
-    if (argc <= 1)
+/// Number of splats per block in the decode and re-encode paths
+const std::size_t BLOCK_SPLATS = std::size_t(1) << 18;
+
+/// Buffer size for byte-level copies when zero-copy transfer is unavailable
+const std::size_t COPY_BUFFER = std::size_t(8) << 20;
+
+/**
+ * Upper bound on concurrent copy workers. A handful of streams saturates a
+ * storage device; more just adds seeking.
+ */
+const std::size_t MAX_WORKERS = 8;
+
+/// One input file and its assigned region of the output
+struct Input
+{
+    FastPly::Reader *reader;              ///< Parsed input file
+    bool splice;                          ///< Whether the body is copied verbatim
+    FastPly::Reader::size_type count;     ///< Splats contributed to the output
+    BinaryWriter::offset_type offset;     ///< Byte offset of the region in the output
+};
+
+/// Count the finite splats in a file that needs re-encoding
+FastPly::Reader::size_type countFinite(const FastPly::Reader &reader)
+{
+    FastPly::Reader::Handle handle(reader);
+    std::vector<char> raw(BLOCK_SPLATS * reader.getVertexSize());
+    std::vector<Splat> splats(BLOCK_SPLATS);
+
+    FastPly::Reader::size_type total = 0;
+    for (FastPly::Reader::size_type first = 0; first < reader.size(); first += BLOCK_SPLATS)
     {
-        std::cerr << "Usage: plypntcat file1.ply [file2.ply ... ] > output.ply\n";
-        return 1;
+        const std::size_t n = std::min(reader.size() - first,
+                                       FastPly::Reader::size_type(BLOCK_SPLATS));
+        handle.readRaw(first, first + n, &raw[0]);
+        reader.decodeBatch(&raw[0], 0, n, &splats[0]);
+        for (std::size_t i = 0; i < n; i++)
+            if (splats[i].isFinite())
+                total++;
     }
+    return total;
+}
 
-    SplatSet::FileSet files;
-    for (int i = 1; i < argc; i++)
+/**
+ * Transfer the body of a dense-layout input into its region of the output
+ * without decoding. Uses @c copy_file_range when available so the data stays
+ * in the kernel; otherwise (or when the copy cannot be done in-kernel, e.g.
+ * across filesystems on older kernels) falls back to a buffered copy.
+ */
+void splice(const Input &input, const BinaryWriter &out)
+{
+    const FastPly::Reader &reader = *input.reader;
+    boost::scoped_ptr<BinaryReader> in(createReader(SYSCALL_READER));
+    in->open(reader.getDataPath());
+
+    BinaryReader::offset_type inOffset = reader.getHeaderSize();
+    BinaryWriter::offset_type outOffset = input.offset;
+    BinaryWriter::offset_type remain = input.count * reader.getVertexSize();
+
+#if HAVE_COPY_FILE_RANGE
+    const int inFd = in->fileDescriptor();
+    const int outFd = out.fileDescriptor();
+    if (inFd >= 0 && outFd >= 0)
+    {
+        while (remain > 0)
+        {
+            loff_t inOff = inOffset;
+            loff_t outOff = outOffset;
+            ssize_t n = copy_file_range(inFd, &inOff, outFd, &outOff, remain, 0);
+            if (n < 0)
+            {
+                if (errno == EXDEV || errno == EINVAL || errno == ENOSYS
+                    || errno == EOPNOTSUPP)
+                    break; // in-kernel copy unsupported here: use the buffered path
+                throw boost::enable_error_info(std::ios::failure("copy_file_range failed"))
+                    << boost::errinfo_errno(errno)
+                    << boost::errinfo_file_name(reader.getPath().string());
+            }
+            if (n == 0)
+                break; // unexpectedly short file: let the buffered path diagnose it
+            inOffset += n;
+            outOffset += n;
+            remain -= n;
+        }
+        if (remain == 0)
+            return;
+    }
+#endif
+
+    std::vector<char> buffer(COPY_BUFFER);
+    while (remain > 0)
     {
-        std::string filename(argv[i]);
-        std::auto_ptr<FastPly::Reader> reader(new FastPly::Reader(SYSCALL_READER, filename, 1.0f, std::numeric_limits<float>::infinity()));
-        files.addFile(reader.get());
-        reader.release();
+        const std::size_t want = std::size_t(std::min(
+            remain, BinaryWriter::offset_type(COPY_BUFFER)));
+        const std::size_t n = in->read(&buffer[0], want, inOffset);
+        if (n == 0)
+            throw boost::enable_error_info(std::ios::failure("Unexpected end of file"))
+                << boost::errinfo_file_name(reader.getPath().string());
+        out.write(&buffer[0], n, outOffset);
+        inOffset += n;
+        outOffset += n;
+        remain -= n;
     }
+}
+
+/**
+ * Re-encode an input whose layout does not match the output, dropping
+ * non-finite splats (matching the streaming path).
+ */
+void transcode(const Input &input, const BinaryWriter &out)
+{
+    const FastPly::Reader &reader = *input.reader;
+    FastPly::Reader::Handle handle(reader);
+    std::vector<char> raw(BLOCK_SPLATS * reader.getVertexSize());
+    std::vector<Splat> splats(BLOCK_SPLATS);
+    std::vector<OutSplat> outSplats(BLOCK_SPLATS);
+
+    BinaryWriter::offset_type outOffset = input.offset;
+    for (FastPly::Reader::size_type first = 0; first < reader.size(); first += BLOCK_SPLATS)
+    {
+        const std::size_t n = std::min(reader.size() - first,
+                                       FastPly::Reader::size_type(BLOCK_SPLATS));
+        handle.readRaw(first, first + n, &raw[0]);
+        reader.decodeBatch(&raw[0], 0, n, &splats[0]);
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < n; i++)
+        {
+            if (!splats[i].isFinite())
+                continue;
+            std::copy(splats[i].position, splats[i].position + 3, outSplats[kept].position);
+            std::copy(splats[i].normal, splats[i].normal + 3, outSplats[kept].normal);
+            outSplats[kept].radius = splats[i].radius;
+            kept++;
+        }
+        out.write(&outSplats[0], kept * sizeof(OutSplat), outOffset);
+        outOffset += kept * sizeof(OutSplat);
+    }
+}
+
+/**
+ * Worker that pulls input files off a shared index and copies each into its
+ * region of the output. Regions are disjoint, so the workers only share the
+ * index counter and the error flag.
+ */
+class CopyWorker
+{
+private:
+    const std::vector<Input> &inputs;
+    const BinaryWriter &out;
+    std::size_t &next;
+    bool &failed;
+    boost::mutex &mutex;
+
+public:
+    CopyWorker(const std::vector<Input> &inputs, const BinaryWriter &out,
+               std::size_t &next, bool &failed, boost::mutex &mutex)
+        : inputs(inputs), out(out), next(next), failed(failed), mutex(mutex)
+    {
+    }
+
+    void operator()()
+    {
+        while (true)
+        {
+            std::size_t idx;
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                if (failed || next >= inputs.size())
+                    return;
+                idx = next++;
+            }
+            try
+            {
+                if (inputs[idx].splice)
+                    splice(inputs[idx], out);
+                else
+                    transcode(inputs[idx], out);
+            }
+            catch (std::exception &e)
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                std::cerr << inputs[idx].reader->getPath().string() << ": "
+                    << e.what() << '\n';
+                failed = true;
+                return;
+            }
+        }
+    }
+};
+
+/// Produce the output header for the given total splat count
+std::string makeHeader(SplatSet::splat_id numSplats)
+{
+    std::ostringstream header;
+    header <<
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex " << numSplats << "\n" <<
+        "property float x\n"
+        "property float y\n"
+        "property float z\n"
+        "property float nx\n"
+        "property float ny\n"
+        "property float nz\n"
+        "property float radius\n"
+        "end_header\n";
+    return header.str();
+}
+
+/// Concatenate into a file, splicing matching inputs and copying in parallel
+int runFile(boost::ptr_vector<FastPly::Reader> &readers, const std::string &outName)
+{
+    std::vector<Input> inputs(readers.size());
+    SplatSet::splat_id numSplats = 0;
+    for (std::size_t i = 0; i < readers.size(); i++)
+    {
+        Input &input = inputs[i];
+        input.reader = &readers[i];
+        /* A dense input matches the output byte-for-byte (the tool applies
+         * no smoothing or radius cap), so its body can be spliced. Its raw
+         * vertex count is used directly: non-finite splats pass through.
+         */
+        input.splice = readers[i].isDenseLayout();
+        input.count = input.splice ? readers[i].size() : countFinite(readers[i]);
+        numSplats += input.count;
+    }
+
+    const std::string header = makeHeader(numSplats);
+    BinaryWriter::offset_type offset = header.size();
+    for (std::size_t i = 0; i < inputs.size(); i++)
+    {
+        inputs[i].offset = offset;
+        offset += inputs[i].count * sizeof(OutSplat);
+    }
+
+    boost::scoped_ptr<BinaryWriter> out(createWriter(SYSCALL_WRITER));
+    out->open(outName);
+    /* The regions are written concurrently and out of order; allocating the
+     * extent up front keeps the output contiguous on disk.
+     */
+    out->preallocate(offset);
+    out->write(header.data(), header.size(), 0);
+
+    std::size_t next = 0;
+    bool failed = false;
+    boost::mutex mutex;
+    boost::thread_group workers;
+    const std::size_t numWorkers = std::min(inputs.size(), MAX_WORKERS);
+    for (std::size_t i = 0; i < numWorkers; i++)
+        workers.create_thread(CopyWorker(inputs, *out, next, failed, mutex));
+    workers.join_all();
+    out->close();
+    return failed ? 1 : 0;
+}
+
+/// Original behaviour: stream the decoded splats to standard output
+int runStream(boost::ptr_vector<FastPly::Reader> &readers)
+{
+    SplatSet::FileSet files;
+    while (!readers.empty())
+        files.addFile(readers.release(readers.begin()).release());
 
     const std::size_t bufferSize = 1 << 20;
     std::vector<Splat> buffer(bufferSize);
@@ -61,18 +337,7 @@ int main(int argc, char **argv)
     } while (numRead == bufferSize);
 
     // Now write the splats
-    std::cout <<
-        "ply\n"
-        "format binary_little_endian 1.0\n"
-        "element vertex " << numSplats << "\n" <<
-        "property float x\n"
-        "property float y\n"
-        "property float z\n"
-        "property float nx\n"
-        "property float ny\n"
-        "property float nz\n"
-        "property float radius\n"
-        "end_header\n";
+    std::cout << makeHeader(numSplats);
     stream.reset(files.makeSplatStream());
     do
     {
@@ -88,4 +353,46 @@ int main(int argc, char **argv)
         }
         std::cout.write(reinterpret_cast<const char *>(&outBuffer[0]), numRead * sizeof(OutSplat));
     } while (numRead == bufferSize);
+    return 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+    std::ios::sync_with_stdio(false);
+
+    std::string outName;
+    int firstFile = 1;
+    if (argc >= 3 && std::string(argv[1]) == "-o")
+    {
+        outName = argv[2];
+        firstFile = 3;
+    }
+    if (firstFile >= argc)
+    {
+        std::cerr << "Usage: plypntcat [-o output.ply] file1.ply [file2.ply ... ]\n"
+                     "Without -o the result is written to standard output.\n";
+        return 1;
+    }
+
+    try
+    {
+        boost::ptr_vector<FastPly::Reader> readers;
+        for (int i = firstFile; i < argc; i++)
+        {
+            readers.push_back(new FastPly::Reader(
+                SYSCALL_READER, argv[i], 1.0f, std::numeric_limits<float>::infinity()));
+        }
+
+        if (!outName.empty())
+            return runFile(readers, outName);
+        else
+            return runStream(readers);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
 }
@@ -0,0 +1,385 @@
+/**
+ * @file
+ *
+ * Merge the PLY outputs of a tiled reconstruction into a single mesh,
+ * welding the vertices that the tiles share. Tiles produced by runs of
+ * mlsgpu with the same @c --fit-grid see grid vertices in exactly the same
+ * world positions (bounding grids are anchored at the world origin), so
+ * where two tiles reconstruct the same cells — along their common boundary
+ * and in the overlap band left by @c --tile-box — they emit bitwise
+ * identical vertices and triangles. Vertices are therefore welded by exact
+ * coordinate match, and triangles that are exact duplicates of one from
+ * another file are dropped. No tolerance is applied: inputs that were not
+ * produced by such a tiled run will simply pass through unmerged.
+ *
+ * The same welding applies to the chunk files of a single @c --split run,
+ * which duplicate their boundary vertices across files in the same way.
+ *
+ * The tool runs in-core: the welded vertices, the weld map and the output
+ * triangles are all held in memory, so it is sized for merging the tiles of
+ * one site rather than arbitrary meshes. Vertex normals are not carried
+ * across: each tile only sees its own triangles, so per-tile normals are
+ * wrong along the seams anyway; recompute them from the merged mesh if they
+ * are needed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cstddef>
+#include <boost/array.hpp>
+#include <boost/program_options.hpp>
+#include <boost/functional/hash.hpp>
+#include "../src/tr1_cstdint.h"
+#include "../src/tr1_unordered_map.h"
+#include "../src/tr1_unordered_set.h"
+#include "binary_io.h"
+#include "ply.h"
+
+namespace po = boost::program_options;
+
+using namespace std;
+
+namespace
+{
+
+/// Builder for @ref PLY::Reader that reads vertices (just position)
+class VertexBuilder
+#ifdef DOXYGEN_FAKE_CODE
+: public PLY::Builder
+#endif
+{
+public:
+    typedef boost::array<float, 3> Element;
+
+    template<typename Iterator>
+    void setProperty(const string &name, Iterator first, Iterator last)
+    {
+        (void) name;
+        (void) first;
+        (void) last;
+    }
+
+    template<typename T>
+    void setProperty(const std::string &name, const T &value)
+    {
+        if (name == "x" || name == "y" || name == "z")
+            current[name[0] - 'x'] = value;
+    }
+
+    Element create()
+    {
+        return current;
+    }
+
+    static void validateProperties(const PLY::PropertyTypeSet &properties)
+    {
+        const string fields[] = {"x", "y", "z"};
+        PLY::PropertyTypeSet::index<PLY::Name>::type::const_iterator p;
+        for (int i = 0; i < 3; i++)
+        {
+            p = properties.get<PLY::Name>().find(fields[i]);
+            if (p == properties.get<PLY::Name>().end())
+            {
+                throw PLY::FormatError("Missing property " + fields[i]);
+            }
+            else if (p->isList)
+                throw PLY::FormatError("Property " + fields[i] + " should not be a list");
+        }
+    }
+
+private:
+    Element current;
+};
+
+/// Builder for @ref PLY::Reader that reads triangles
+class TriangleBuilder
+#ifdef DOXYGEN_FAKE_CODE
+: public PLY::Builder
+#endif
+{
+public:
+    typedef boost::array<std::tr1::uint32_t, 3> Element;
+
+    template<typename Iterator>
+    void setProperty(const string &name, Iterator first, Iterator last)
+    {
+        if (name == "vertex_indices")
+        {
+            if (distance(first, last) != 3)
+                throw PLY::FormatError("Face does not contain 3 vertices");
+            Iterator c = first;
+            for (unsigned int i = 0; i < 3; i++, c++)
+            {
+                // Roundabout way to write c < 0 so that it doesn't warn for unsigned types
+                if (!(*c == 0 || *c > 0))
+                    throw PLY::FormatError("Negative or out-of-range index");
+                std::tr1::uint32_t idx = *c;
+                current[i] = idx;
+            }
+        }
+    }
+
+    template<typename T>
+    void setProperty(const std::string &name, const T &value)
+    {
+        (void) name;
+        (void) value;
+    }
+
+    Element create()
+    {
+        return current;
+    }
+
+    static void validateProperties(const PLY::PropertyTypeSet &properties)
+    {
+        PLY::PropertyTypeSet::index<PLY::Name>::type::const_iterator p;
+        p = properties.get<PLY::Name>().find("vertex_indices");
+        if (p == properties.get<PLY::Name>().end())
+        {
+            throw PLY::FormatError("Missing property vertex_indices");
+        }
+        else if (!p->isList)
+            throw PLY::FormatError("Property vertex_indices should be a list");
+        else if (p->valueType != PLY::INT8
+                 && p->valueType != PLY::UINT8
+                 && p->valueType != PLY::INT16
+                 && p->valueType != PLY::UINT16
+                 && p->valueType != PLY::INT32
+                 && p->valueType != PLY::UINT32)
+            throw PLY::FormatError("Property vertex_indices should have integral type");
+    }
+
+private:
+    Element current;
+};
+
+/**
+ * A vertex position as a bit pattern. Welding matches exactly, so comparing
+ * and hashing the bits is both cheaper and stricter than comparing floats
+ * (it also lets a non-finite vertex match itself, although mlsgpu does not
+ * produce those).
+ */
+typedef boost::array<std::tr1::uint32_t, 3> VertexKey;
+
+/// Hasher for @ref VertexKey and canonicalized triangles
+struct ArrayHash
+{
+    std::size_t operator()(const boost::array<std::tr1::uint32_t, 3> &a) const
+    {
+        return boost::hash_range(a.begin(), a.end());
+    }
+};
+
+typedef std::tr1::unordered_map<VertexKey, std::tr1::uint32_t, ArrayHash> weld_map_type;
+typedef std::tr1::unordered_set<TriangleBuilder::Element, ArrayHash> triangle_set_type;
+
+/// Extract the welding key from a vertex position
+static VertexKey makeKey(const VertexBuilder::Element &position)
+{
+    VertexKey key;
+    std::memcpy(&key[0], &position[0], sizeof(key));
+    return key;
+}
+
+/**
+ * Rotate a triangle so that its smallest index comes first, preserving the
+ * winding. Exact duplicates from different tiles have the same cyclic order,
+ * so this makes them compare equal without merging a triangle with its
+ * opposite-facing twin.
+ */
+static TriangleBuilder::Element canonicalize(const TriangleBuilder::Element &triangle)
+{
+    TriangleBuilder::Element out = triangle;
+    unsigned int shift = 0;
+    if (triangle[1] < triangle[shift])
+        shift = 1;
+    if (triangle[2] < triangle[shift])
+        shift = 2;
+    for (unsigned int i = 0; i < 3; i++)
+        out[i] = triangle[(i + shift) % 3];
+    return out;
+}
+
+} // anonymous namespace
+
+int main(int argc, const char **argv)
+{
+    std::string outName;
+    std::vector<std::string> inputs;
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help",                                          "Show usage")
+        ("output,o", po::value<std::string>(&outName),    "Output file (required)");
+    po::options_description hidden("Hidden options");
+    hidden.add_options()
+        ("input", po::value<std::vector<std::string> >(&inputs)->composing(), "Input files");
+    po::positional_options_description positional;
+    positional.add("input", -1);
+
+    try
+    {
+        po::options_description all;
+        all.add(desc).add(hidden);
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv)
+                  .options(all).positional(positional).run(), vm);
+        po::notify(vm);
+        if (vm.count("help") || inputs.empty() || outName.empty())
+        {
+            cerr << "Usage: plyweld -o out.ply file.ply [file.ply...]\n" << desc;
+            return vm.count("help") ? 0 : 2;
+        }
+    }
+    catch (po::error &e)
+    {
+        cerr << e.what() << "\nUsage: plyweld -o out.ply file.ply [file.ply...]\n" << desc;
+        return 2;
+    }
+
+    try
+    {
+        std::vector<VertexBuilder::Element> positions;
+        weld_map_type weld;
+        /* Vertices that occurred in more than one input (or twice in one).
+         * Only triangles whose corners are all marked can be duplicates, so
+         * only those pay for an entry in the duplicate set below.
+         */
+        std::vector<bool> isShared;
+
+        /* First pass: weld the vertices of all the inputs, so that the
+         * second pass knows which vertices are shared before it sees any
+         * triangle.
+         */
+        for (std::size_t i = 0; i < inputs.size(); i++)
+        {
+            filebuf in;
+            in.open(inputs[i].c_str(), ios::in);
+            if (!in.is_open())
+            {
+                cerr << "Could not open " << inputs[i] << "\n";
+                return 1;
+            }
+            PLY::Reader reader(&in);
+            reader.addBuilder("vertex", VertexBuilder());
+            reader.addBuilder("face", TriangleBuilder());
+            reader.readHeader();
+            PLY::ElementRangeReader<VertexBuilder> &vertexReader = reader.skipTo<VertexBuilder>("vertex");
+            for (PLY::ElementRangeReader<VertexBuilder>::iterator v = vertexReader.begin();
+                 v != vertexReader.end(); ++v)
+            {
+                const VertexBuilder::Element position = *v;
+                std::pair<weld_map_type::iterator, bool> added =
+                    weld.insert(std::make_pair(makeKey(position), std::tr1::uint32_t(positions.size())));
+                if (added.second)
+                {
+                    if (positions.size() >= std::numeric_limits<std::tr1::uint32_t>::max())
+                        throw PLY::FormatError("Too many vertices to weld into one file");
+                    positions.push_back(position);
+                    isShared.push_back(false);
+                }
+                else
+                    isShared[added.first->second] = true;
+            }
+        }
+
+        /* Second pass: remap the triangles of each input onto the welded
+         * vertices, dropping exact duplicates of triangles already kept.
+         */
+        std::vector<TriangleBuilder::Element> triangles;
+        triangle_set_type seen;
+        for (std::size_t i = 0; i < inputs.size(); i++)
+        {
+            filebuf in;
+            in.open(inputs[i].c_str(), ios::in);
+            if (!in.is_open())
+            {
+                cerr << "Could not open " << inputs[i] << "\n";
+                return 1;
+            }
+            PLY::Reader reader(&in);
+            reader.addBuilder("vertex", VertexBuilder());
+            reader.addBuilder("face", TriangleBuilder());
+            reader.readHeader();
+
+            // Rebuild this file's map from local indices to welded indices
+            std::vector<std::tr1::uint32_t> remap;
+            PLY::ElementRangeReader<VertexBuilder> &vertexReader = reader.skipTo<VertexBuilder>("vertex");
+            remap.reserve(vertexReader.getNumber());
+            for (PLY::ElementRangeReader<VertexBuilder>::iterator v = vertexReader.begin();
+                 v != vertexReader.end(); ++v)
+            {
+                remap.push_back(weld[makeKey(*v)]);
+            }
+
+            PLY::ElementRangeReader<TriangleBuilder> &triangleReader = reader.skipTo<TriangleBuilder>("face");
+            for (PLY::ElementRangeReader<TriangleBuilder>::iterator t = triangleReader.begin();
+                 t != triangleReader.end(); ++t)
+            {
+                const TriangleBuilder::Element &local = *t;
+                TriangleBuilder::Element triangle;
+                bool allShared = true;
+                for (unsigned int j = 0; j < 3; j++)
+                {
+                    if (local[j] >= remap.size())
+                        throw PLY::FormatError("Face contains an out-of-range index");
+                    triangle[j] = remap[local[j]];
+                    allShared = allShared && isShared[triangle[j]];
+                }
+                if (allShared && !seen.insert(canonicalize(triangle)).second)
+                    continue; // exact duplicate from an overlapping tile
+                triangles.push_back(triangle);
+            }
+        }
+        weld.clear();
+        seen.clear();
+
+        ofstream out(outName.c_str(), ios::out | ios::binary);
+        if (!out)
+        {
+            cerr << "Could not open " << outName << "\n";
+            return 1;
+        }
+        out << "ply\n"
+            << "format binary_little_endian 1.0\n"
+            << "comment Welded from " << inputs.size() << " files by plyweld\n"
+            << "element vertex " << positions.size() << '\n'
+            << "property float32 x\n"
+            << "property float32 y\n"
+            << "property float32 z\n"
+            << "element face " << triangles.size() << '\n'
+            << "property list uint8 uint32 vertex_indices\n"
+            << "end_header\n";
+        for (std::size_t i = 0; i < positions.size(); i++)
+            for (unsigned int j = 0; j < 3; j++)
+                writeBinary(out, positions[i][j], boost::true_type());
+        for (std::size_t i = 0; i < triangles.size(); i++)
+        {
+            writeBinary(out, std::tr1::uint8_t(3), boost::true_type());
+            for (unsigned int j = 0; j < 3; j++)
+                writeBinary(out, triangles[i][j], boost::true_type());
+        }
+        out.close();
+        if (!out)
+        {
+            cerr << "Error writing " << outName << "\n";
+            return 1;
+        }
+    }
+    catch (std::exception &e)
+    {
+        cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -12,7 +12,13 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <iterator>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include "../extras/ply.h"
+#include "../src/misc.h"
 #include "../test/testutil.h"
 
 using namespace std;
@@ -537,3 +543,171 @@ void TestPlyReader::testSkipToEmpty()
     CPPUNIT_ASSERT_EQUAL(&*r.currentReader, static_cast<PLY::ElementRangeReaderBase *>(&face));
     CPPUNIT_ASSERT_EQUAL(std::tr1::uintmax_t(0), r.currentPos);
 }
+
+/**
+ * Builder for @ref TestPlyMmapReader that extracts a single int property.
+ */
+class MmapIntBuilder
+#if DOXYGEN_FAKE_CODE
+: public PLY::Builder
+#endif
+{
+public:
+    typedef std::tr1::int32_t Element;
+
+    template<typename Iterator>
+    void setProperty(const string &name, Iterator first, Iterator last)
+    {
+        (void) name;
+        (void) first;
+        (void) last;
+    }
+
+    template<typename T>
+    void setProperty(const std::string &name, const T &value)
+    {
+        if (name == "x")
+            current = Element(value);
+    }
+
+    Element create() { return current; }
+
+    static void validateProperties(const PLY::PropertyTypeSet &properties)
+    {
+        (void) properties;
+    }
+
+private:
+    Element current;
+};
+
+/**
+ * Test fixture for PLY::MmapReader.
+ */
+class TestPlyMmapReader : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestPlyMmapReader);
+    CPPUNIT_TEST(testFetchElement);
+    CPPUNIT_TEST(testFetchElements);
+    CPPUNIT_TEST(testNotSeekableList);
+    CPPUNIT_TEST(testNotSeekableAscii);
+    CPPUNIT_TEST_EXCEPTION(testFetchOutOfRange, std::out_of_range);
+    CPPUNIT_TEST_EXCEPTION(testFetchMissing, PLY::FormatError);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    virtual void tearDown();
+
+private:
+    boost::filesystem::path testPath;  ///< File created by @ref writeFile
+
+    /// Write @a data to a temporary file and store its path in @ref testPath
+    void writeFile(const std::string &data);
+    /// Write a little-endian file with int32 vertices 10, 20, 30 and two faces
+    void writeBinaryFile();
+
+    void testFetchElement();     ///< Fetches single elements out of order
+    void testFetchElements();    ///< Fetches a run of elements from the middle
+    void testNotSeekableList();  ///< A list element does not support random access
+    void testNotSeekableAscii(); ///< An ASCII file does not support random access
+    void testFetchOutOfRange();  ///< Fetches an element index past the end
+    void testFetchMissing();     ///< Queries an element that doesn't exist
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestPlyMmapReader, TestSet::perBuild());
+
+void TestPlyMmapReader::tearDown()
+{
+    if (!testPath.empty())
+        boost::filesystem::remove(testPath);
+}
+
+void TestPlyMmapReader::writeFile(const std::string &data)
+{
+    boost::filesystem::ofstream f;
+    createTmpFile(testPath, f);
+    f.exceptions(ios::failbit | ios::badbit);
+    f.write(data.data(), data.size());
+    f.close();
+}
+
+void TestPlyMmapReader::writeBinaryFile()
+{
+    string data =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex 3\n"
+        "property int32 x\n"
+        "element face 2\n"
+        "property list uint8 int32 v\n"
+        "end_header\n";
+    data += string("\x0A\x00\x00\x00", 4);
+    data += string("\x14\x00\x00\x00", 4);
+    data += string("\x1E\x00\x00\x00", 4);
+    data += string("\x02\x01\x00\x00\x00\x02\x00\x00\x00", 9);
+    data += string("\x01\x03\x00\x00\x00", 5);
+    writeFile(data);
+}
+
+void TestPlyMmapReader::testFetchElement()
+{
+    writeBinaryFile();
+    PLY::MmapReader r(testPath.string());
+    r.addBuilder("vertex", MmapIntBuilder());
+    r.readHeader();
+    CPPUNIT_ASSERT(r.canSeek("vertex"));
+    CPPUNIT_ASSERT_EQUAL(std::tr1::int32_t(30), r.fetchElement<MmapIntBuilder>("vertex", 2));
+    CPPUNIT_ASSERT_EQUAL(std::tr1::int32_t(10), r.fetchElement<MmapIntBuilder>("vertex", 0));
+    CPPUNIT_ASSERT_EQUAL(std::tr1::int32_t(20), r.fetchElement<MmapIntBuilder>("vertex", 1));
+}
+
+void TestPlyMmapReader::testFetchElements()
+{
+    writeBinaryFile();
+    PLY::MmapReader r(testPath.string());
+    r.addBuilder("vertex", MmapIntBuilder());
+    r.readHeader();
+    vector<std::tr1::int32_t> out;
+    r.fetchElements<MmapIntBuilder>("vertex", 1, 3, back_inserter(out));
+    CPPUNIT_ASSERT_EQUAL(size_t(2), out.size());
+    CPPUNIT_ASSERT_EQUAL(std::tr1::int32_t(20), out[0]);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::int32_t(30), out[1]);
+}
+
+void TestPlyMmapReader::testNotSeekableList()
+{
+    writeBinaryFile();
+    PLY::MmapReader r(testPath.string());
+    r.readHeader();
+    CPPUNIT_ASSERT(!r.canSeek("face"));
+    CPPUNIT_ASSERT_THROW(r.fetchElement<PLY::EmptyBuilder>("face", 0), PLY::FormatError);
+}
+
+void TestPlyMmapReader::testNotSeekableAscii()
+{
+    writeFile("ply\nformat ascii 1.0\n"
+              "element vertex 2\nproperty int32 x\n"
+              "end_header\n"
+              "1\n2\n");
+    PLY::MmapReader r(testPath.string());
+    r.addBuilder("vertex", MmapIntBuilder());
+    r.readHeader();
+    CPPUNIT_ASSERT(!r.canSeek("vertex"));
+    CPPUNIT_ASSERT_THROW(r.fetchElement<MmapIntBuilder>("vertex", 0), PLY::FormatError);
+}
+
+void TestPlyMmapReader::testFetchOutOfRange()
+{
+    writeBinaryFile();
+    PLY::MmapReader r(testPath.string());
+    r.addBuilder("vertex", MmapIntBuilder());
+    r.readHeader();
+    r.fetchElement<MmapIntBuilder>("vertex", 3);
+}
+
+void TestPlyMmapReader::testFetchMissing()
+{
+    writeBinaryFile();
+    PLY::MmapReader r(testPath.string());
+    r.readHeader();
+    r.canSeek("missing");
+}
@@ -0,0 +1,162 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Classification of splats into microblocks, producing a per-microblock
+ * histogram and a per-splat cell code. This reproduces on the device the
+ * rounding done by @c SplatSet::detail::SplatToBuckets on the host, so the
+ * counts can be fed back into the host-side bucketing driver.
+ */
+
+/**
+ * GPU representation of a splat.
+ * Only the position and radius are used in this file, but the full set of information
+ * is there for compatibility with other files.
+ */
+typedef struct
+{
+    float4 positionRadius;   // position in xyz, radius in w
+    float4 normalQuality;    // normal in xyz, quality metric in w
+} Splat;
+
+/**
+ * Divide with round-to-negative-infinity. This must match @c divDown in
+ * @c src/misc.h, which the host-side classification uses.
+ */
+inline int3 divDown(int3 a, int size)
+{
+    int3 q = a / size;
+    int3 r = a - q * size;
+    // (r < 0) is component-wise -1 for true, 0 for false
+    return q + (r < 0);
+}
+
+/**
+ * Turn cell coordinates into a cell code (bits of the coordinates
+ * interleaved, z major). This must match @c makeCode in
+ * @c kernels/octree.cl so that the codes can seed the octree build.
+ */
+inline uint makeCode(int3 xyz)
+{
+    uint ans = 0;
+    uint scale = 1;
+    xyz.y <<= 1;  // pre-shift these to avoid shifts inside the loop
+    xyz.z <<= 2;
+    while (any(xyz != 0))
+    {
+        uint bits = (xyz.x & 1) | (xyz.y & 2) | (xyz.z & 4);
+        ans += bits * scale;
+        scale <<= 3;
+        xyz >>= 1;
+    }
+    return ans;
+}
+
+/**
+ * Count splats into a per-microblock histogram and emit a cell code per
+ * splat. A splat whose bounding box lies inside a single microblock gets the
+ * Morton code of that microblock; a splat covering several microblocks is
+ * counted in each of them and gets a code of @c UINT_MAX, since no single
+ * code describes it. A splat entirely outside the region is not counted at
+ * all and also gets @c UINT_MAX.
+ *
+ * Each workitem processes one splat. Counting uses global atomics: the
+ * histogram is small (at most @c maxSplit bins) so collisions are common,
+ * but the work per splat is tiny and the batch sizes amortize the cost.
+ *
+ * @param[in,out] counts  Histogram of [@a dims.z][@a dims.y][@a dims.x] microblock counts. Must be zeroed beforehand.
+ * @param[out] codes      Per-splat Morton code of the containing microblock, or @c UINT_MAX.
+ * @param      splats     The splats to classify.
+ * @param      ref        World coordinates of the grid reference point.
+ * @param      invSpacing Reciprocal of the grid spacing.
+ * @param      cellBias   Lower extent of the grid, subtracted from cell coordinates.
+ * @param      microSize  Side length of a microblock in cells.
+ * @param      dims       Size of the region in microblocks.
+ */
+__kernel void classifySplats(
+    __global uint *counts,
+    __global uint *codes,
+    __global const Splat *splats,
+    float3 ref,
+    float invSpacing,
+    int3 cellBias,
+    int microSize,
+    int3 dims)
+{
+    uint gid = get_global_id(0);
+    float4 positionRadius = splats[gid].positionRadius;
+    float3 vlo = (positionRadius.xyz - positionRadius.w - ref) * invSpacing;
+    float3 vhi = (positionRadius.xyz + positionRadius.w - ref) * invSpacing;
+    int3 lo = divDown(convert_int3_rtn(vlo) - cellBias, microSize);
+    int3 hi = divDown(convert_int3_rtn(vhi) - cellBias, microSize);
+    if (any(hi < 0) || any(lo >= dims))
+    {
+        // Splat lies entirely outside the region
+        codes[gid] = UINT_MAX;
+        return;
+    }
+    lo = clamp(lo, (int3) 0, dims - 1);
+    hi = clamp(hi, (int3) 0, dims - 1);
+
+    if (all(lo == hi))
+    {
+        atomic_inc(&counts[(lo.z * dims.y + lo.y) * dims.x + lo.x]);
+        codes[gid] = makeCode(lo);
+    }
+    else
+    {
+        for (int z = lo.z; z <= hi.z; z++)
+            for (int y = lo.y; y <= hi.y; y++)
+                for (int x = lo.x; x <= hi.x; x++)
+                    atomic_inc(&counts[(z * dims.y + y) * dims.x + x]);
+        codes[gid] = UINT_MAX;
+    }
+}
+
+/**
+ * Fill a buffer with a constant value.
+ */
+__kernel void fill(__global uint *out, uint value)
+{
+    out[get_global_id(0)] = value;
+}
+
+/*******************************************************************************
+ * Test code only below here.
+ *******************************************************************************/
+
+#if UNIT_TESTS
+
+__kernel void testDivDown(__global int *out, int3 a, int size)
+{
+    int3 ans = divDown(a, size);
+    out[0] = ans.x;
+    out[1] = ans.y;
+    out[2] = ans.z;
+}
+
+__kernel void testMakeCode(__global uint *out, int3 xyz)
+{
+    *out = makeCode(xyz);
+}
+
+#endif /* UNIT_TESTS */
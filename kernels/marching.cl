@@ -27,6 +27,16 @@
 /// Number of edges in a cell
 #define NUM_EDGES 19
 
+/**
+ * @name
+ * @{
+ * Number of cells along each side of a tile in the coarse occupancy pass.
+ * These must match @ref Marching::TILE_SIZE.
+ */
+#define TILE_X 16
+#define TILE_Y 16
+/** @} */
+
 /// Number of bits in fixed-point xyz fields in a vertex key (including fractional bits)
 #define KEY_AXIS_BITS 21
 #define KEY_AXIS_MASK ((1U << KEY_AXIS_BITS) - 1)
@@ -62,12 +72,99 @@ inline bool isValid(const float iso[8])
         && isfinite(iso[7]);
 }
 
+/**
+ * Coarse occupancy test over tiles of @ref TILE_X x @ref TILE_Y cells,
+ * which compacts the tiles that might intersect the isosurface into a
+ * list. Most tiles in a typical scan are entirely inside or outside the
+ * surface, so this lets @ref genOccupied skip the dead cells instead of
+ * classifying every cell in the swathe.
+ *
+ * There is one work-group per tile, arranged in a 3D NDRange padded up to
+ * a whole number of tiles; @a cellsDim bounds the cells with payload.
+ *
+ * @param[out] tiles         List of tile coordinates for candidate tiles
+ *                           (x and y in tile units, z an absolute slice index).
+ * @param[in,out] numTiles   Number of candidate tiles, incremented atomically.
+ * @param      isoImage      Image holding samples.
+ * @param      zStride, zBias See @ref Marching::ImageParams.
+ * @param      cellsDim      Number of cells in a slice along x and y.
+ * @param      zFirst        First cell-slice in the swathe.
+ */
+__kernel
+__attribute__((reqd_work_group_size(TILE_X, TILE_Y, 1)))
+void genTiles(
+    __global uint3 * restrict tiles,
+    volatile __global uint * restrict numTiles,
+    __read_only image2d_t isoImage,
+    uint zStride,
+    int zBias,
+    uint2 cellsDim,
+    uint zFirst)
+{
+    __local float lmin[TILE_X * TILE_Y];
+    __local float lmax[TILE_X * TILE_Y];
+
+    const uint lx = get_local_id(0);
+    const uint ly = get_local_id(1);
+    const uint lid = ly * TILE_X + lx;
+    const uint z = zFirst + get_group_id(2);
+    const uint y0 = zStride * z + zBias;
+
+    /* Each work-item folds in the samples at its position in the two slices
+     * bounding the tile's cells. Items in the last row/column also load the
+     * apron samples shared with the next tile, so every corner of every cell
+     * in the tile is covered. fmin/fmax ignore NaNs, which is safe because a
+     * cell with a NaN corner is invalid and generates nothing.
+     */
+    float mn = INFINITY;
+    float mx = -INFINITY;
+    const uint nx = (lx == TILE_X - 1) ? 2 : 1;
+    const uint ny = (ly == TILE_Y - 1) ? 2 : 1;
+    for (uint dy = 0; dy < ny; dy++)
+        for (uint dx = 0; dx < nx; dx++)
+        {
+            const uint sx = get_group_id(0) * TILE_X + lx + dx;
+            const uint sy = get_group_id(1) * TILE_Y + ly + dy;
+            if (sx <= cellsDim.x && sy <= cellsDim.y)
+            {
+                const float a = read_imagef(isoImage, nearest, (int2) (sx, y0 + sy)).x;
+                const float b = read_imagef(isoImage, nearest, (int2) (sx, y0 + sy + zStride)).x;
+                mn = fmin(mn, fmin(a, b));
+                mx = fmax(mx, fmax(a, b));
+            }
+        }
+
+    lmin[lid] = mn;
+    lmax[lid] = mx;
+    for (uint step = (TILE_X * TILE_Y) / 2; step > 0; step >>= 1)
+    {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (lid < step)
+        {
+            lmin[lid] = fmin(lmin[lid], lmin[lid + step]);
+            lmax[lid] = fmax(lmax[lid], lmax[lid + step]);
+        }
+    }
+
+    /* The isosurface can only pass through the tile if both signs occur
+     * among its samples (makeCode treats non-negative as outside).
+     */
+    if (lid == 0 && lmin[0] < 0.0f && lmax[0] >= 0.0f)
+    {
+        const uint pos = atomic_inc(numTiles);
+        tiles[pos] = (uint3) (get_group_id(0), get_group_id(1), z);
+    }
+}
+
 /**
  * For each cell which might produce triangles, appends the coordinates of the
  * cell to a buffer and the count of vertices and triangles to another. It also
  * produces a per-slice histogram.
  *
- * There is one work-item per cell in a swathe, arranged in a 3D NDRange.
+ * There is one work-group per tile slot, with one work-item per cell of a
+ * tile. Only the candidate tiles compacted by @ref genTiles are classified;
+ * groups beyond @a numTiles exit immediately, so the launch size need not
+ * depend on a host readback of the tile count.
  *
  * @param[out] occupied      List of cell coordinates for occupied cells
  * @param[out] viCount       Number of triangles+indices per cell.
@@ -76,12 +173,17 @@ inline bool isValid(const float iso[8])
  * @param      isoImage      Image holding samples.
  * @param      zStride, zBias See @ref Marching::ImageParams.
  * @param      countTable    Lookup table of counts per cube code.
+ * @param      tiles         Candidate tiles written by @ref genTiles.
+ * @param      numTiles      Number of candidate tiles written by @ref genTiles.
+ * @param      cellsDim      Number of cells in a slice along x and y.
  *
  * @todo
  * - Explore Morton order, which will have better texture cache hits.
  * - Consider storing the count table in an image
  */
-__kernel void genOccupied(
+__kernel
+__attribute__((reqd_work_group_size(TILE_X * TILE_Y, 1, 1)))
+void genOccupied(
     __global uint3 * restrict occupied,
     __global uint2 * restrict viCount,
     volatile __global uint * restrict N,
@@ -89,9 +191,21 @@ __kernel void genOccupied(
     __read_only image2d_t isoImage,
     uint zStride,
     int zBias,
-    __constant uchar2 * restrict countTable)
+    __constant uchar2 * restrict countTable,
+    __global const uint3 * restrict tiles,
+    __global const uint * restrict numTiles,
+    uint2 cellsDim)
 {
-    uint3 gid = (uint3) (get_global_id(0), get_global_id(1), get_global_id(2));
+    const uint group = get_group_id(0);
+    if (group >= *numTiles)
+        return;
+    const uint3 tile = tiles[group];
+    const uint lid = get_local_id(0);
+    uint3 gid = (uint3) (tile.x * TILE_X + (lid % TILE_X),
+                         tile.y * TILE_Y + (lid / TILE_X),
+                         tile.z);
+    if (gid.x >= cellsDim.x || gid.y >= cellsDim.y)
+        return;
     uint y0 = gid.y + zStride * gid.z + zBias;
     uint y1 = y0 + zStride;
 
@@ -280,7 +394,16 @@ __kernel void countUniqueVertices(__global uint * restrict vertexUnique,
 
 /**
  * Copy the unique vertices to a new array and generate a remapping table.
- * There is one work-item per input vertex.
+ * There is one work-item per input vertex. The vertices are transformed from
+ * grid to world coordinates on the way past (each is replaced by
+ * <code>v * scaleBias.w + scaleBias.xyz</code>), which saves a separate pass
+ * over the vertex buffer.
+ *
+ * If @c COMPACT_KEYS is defined, the output keys are instead 32-bit
+ * block-relative keys: the three axis fields are repacked into
+ * @c COMPACT_KEY_X_BITS, @c COMPACT_KEY_Y_BITS and the remaining high bits,
+ * and @a keyOffset is @em not added (the host adds it back after readback).
+ * This halves the size of the key readback.
  *
  * @param[out] outVertices     Output vertices, written as packed x,y,z triplets.
  * @param[out] outKeys         Vertex keys corresponding to @a outVertices, only written for external vertices, and with the high bit stripped off.
@@ -291,17 +414,23 @@ __kernel void countUniqueVertices(__global uint * restrict vertexUnique,
  * @param      inKeys          Vertex keys corresponding to @a inVertices (plus a sentinel @c ULONG_MAX).
  * @param      minExternalKey  Vertex keys >= @a minExternalKey are considered to be external vertices.
  * @param      keyOffset       Value added to keys on output (after comparison with @a minExternalKey).
+ * @param      scaleBias       Scale (in @c w) and bias (in @c xyz) applied to output vertices.
  */
 __kernel void compactVertices(
     __global float * restrict outVertices,
+#ifdef COMPACT_KEYS
+    __global uint * restrict outKeys,
+#else
     __global ulong * restrict outKeys,
+#endif
     __global uint * restrict indexRemap,
     __global uint * firstExternal,
     __global const uint * restrict vertexUnique,
     __global const float4 * restrict inVertices,
     __global const ulong * restrict inKeys,
     ulong minExternalKey,
-    ulong keyOffset)
+    ulong keyOffset,
+    float4 scaleBias)
 {
     const uint gid = get_global_id(0);
     const uint u = vertexUnique[gid];
@@ -311,10 +440,17 @@ __kernel void compactVertices(
     bool ext = key >= minExternalKey;
     if (key != nextKey)
     {
-        vstore3(v.xyz, u, outVertices);
+        vstore3(fma(v.xyz, scaleBias.w, scaleBias.xyz), u, outVertices);
         if (ext)
         {
+#ifdef COMPACT_KEYS
+            uint x = (uint) (key & KEY_AXIS_MASK);
+            uint y = (uint) ((key >> KEY_AXIS_BITS) & KEY_AXIS_MASK);
+            uint z = (uint) ((key >> (2 * KEY_AXIS_BITS)) & KEY_AXIS_MASK);
+            outKeys[u] = (((z << COMPACT_KEY_Y_BITS) | y) << COMPACT_KEY_X_BITS) | x;
+#else
             outKeys[u] = (key & (KEY_EXTERNAL_FLAG - 1)) + keyOffset;
+#endif
             if (u == 0)
                 *firstExternal = 0;
         }
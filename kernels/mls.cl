@@ -39,6 +39,12 @@
 #if !defined(WGS_X) || !defined(WGS_Y) || !defined(WGS_Z)
 # error "WGS_X, WGS_Y and WGS_Z must all be defined"
 #endif
+#if !defined(FILL_WGS_X) || !defined(FILL_WGS_Y)
+# error "FILL_WGS_X and FILL_WGS_Y must both be defined"
+#endif
+#if !defined(CLASSIFY_WGS)
+# error "CLASSIFY_WGS must be defined"
+#endif
 #if !defined(FIT_PLANE) || (FIT_PLANE != 0 && FIT_PLANE != 1)
 # error "FIT_PLANE must be defined as 0 or 1"
 #endif
@@ -50,9 +56,13 @@
 #endif
 
 /**
- * The number of workitems that cooperate to load splat IDs.
+ * The number of splats staged into local memory per batch by the cooperating
+ * workitems. The default may be overridden from the build options by the
+ * autotuner.
  */
-#define MAX_BUCKET 256
+#ifndef MAX_BUCKET
+# define MAX_BUCKET 256
+#endif
 
 #if WGS_X * WGS_Y * WGS_Z < MAX_BUCKET
 # error "The workgroup must have at least MAX_BUCKET elements"
@@ -60,11 +70,51 @@
 
 typedef int command_type;
 
-typedef struct
+/* Splats are stored on the device as a structure of arrays: a plane of
+ * position/radius values (position in xyz, inverse-squared radius in w)
+ * followed, @c splatStride elements later in the same buffer, by a plane of
+ * normal/quality values (normal in xyz, quality metric in w). Splitting the
+ * planes keeps the gather in @ref processCell down to coalesced float4
+ * loads of exactly the fields it needs.
+ *
+ * With HALF_NORMALS the normal/quality plane holds half4 values instead
+ * (quantized on the host), at the same plane boundary of @c splatStride
+ * float4 elements. Positions and radii are always full floats.
+ */
+#ifndef HALF_NORMALS
+# define HALF_NORMALS 0
+#endif
+
+/**
+ * Optional device-resident diagnostic counters (see
+ * @c Statistics::KernelCounters). With KERNEL_STATS set to 1 the process and
+ * classify kernels take a trailing counter buffer argument and record their
+ * workload with global atomics; the host reads the buffer back in one
+ * transfer per bin. The cost when enabled is a handful of atomics per cell,
+ * so the counters can be left on in production.
+ */
+#ifndef KERNEL_STATS
+# define KERNEL_STATS 0
+#endif
+
+#if KERNEL_STATS
+/* Slot assignments in the counter buffer. The order must match the names
+ * registered by MlsFunctor::init (see mls.cpp).
+ */
+# define STATS_CELLS_EXACT       0   /**< Cells processed by @ref processCorners */
+# define STATS_CELLS_PERSISTENT  1   /**< Cells processed by @ref processCornersPersistent */
+# define STATS_CELLS_OCCUPIED    2   /**< Occupied cells found by @ref classifyCells */
+#endif
+
+/// Load one normal/quality value from the plane starting at splats + splatStride
+inline float4 loadNormalQuality(__global const float4 *splats, uint splatStride, uint idx)
 {
-    float4 positionRadius;   // position in xyz, inverse-squared radius in w
-    float4 normalQuality;    // normal in xyz, quality metric in w
-} Splat;
+#if HALF_NORMALS
+    return vload_half4(idx, (__global const half *) (splats + splatStride));
+#else
+    return splats[splatStride + idx];
+#endif
+}
 
 typedef struct
 {
@@ -147,6 +197,40 @@ inline void planeFitAdd(PlaneFit *pf, float w, float3 p, float pp, float3 n)
     pf->hits++;
 }
 
+/**
+ * Evaluate one staged splat against a corner and accumulate it into the fit
+ * if it is in range. Factored out so that @ref processCorners can instantiate
+ * the neighbour loop twice: once with a compile-time trip count for full
+ * batches and once with the runtime remainder.
+ */
+inline void accumulateSplat(
+#if FIT_SPHERE
+    SphereFit *fit,
+#elif FIT_PLANE
+    PlaneFit *fit,
+#else
+#error "Expected FIT_SPHERE or FIT_PLANE"
+#endif
+    float3 coord, float4 positionRadius, float4 normalQuality)
+{
+    float3 p = positionRadius.xyz - coord;
+    float pp = dot3(p, p);
+    float d = pp * positionRadius.w; // .w is the inverse squared radius
+    if (d < RADIUS_CUTOFF)
+    {
+        float w = 1.0f - d;
+        w *= w; // raise to the 4th power
+        w *= w;
+        w *= normalQuality.w;
+
+#if FIT_SPHERE
+        sphereFitAdd(fit, w, p, pp, normalQuality.xyz);
+#elif FIT_PLANE
+        planeFitAdd(fit, w, p, pp, normalQuality.xyz);
+#endif
+    }
+}
+
 /**
  * Turn cell coordinates into a cell code.
  *
@@ -280,42 +364,116 @@ inline float3 projectOriginPlane(const Plane * restrict plane)
 }
 
 /**
- * Compute isovalues for all grid corners in a slice. Those with no defined
- * isovalue are assigned a value of NaN.
+ * Fill a rectangular region of the corners image with NaN. This runs before
+ * @ref processCorners, which then only revisits the corners of occupied
+ * cells; everything else keeps the NaN written here.
+ *
+ * The region covered is x in [0, @a width) and y in the global offset to
+ * @a lastRow (inclusive). Work items outside the region do nothing, so the
+ * global size may be rounded up to the workgroup size.
  *
  * @param[out] corners     The isovalues from a slice.
- * @param      splats      Input splats, in global grid coordinates, and with the inverse squared radius in the w component.
- * @param      commands, start Encoded octree for the local bin
+ * @param      width       Number of image columns to fill.
+ * @param      lastRow     Last image row to fill.
+ */
+KERNEL(FILL_WGS_X, FILL_WGS_Y, 1)
+void fillCorners(
+    __write_only image2d_t corners,
+    uint width,
+    uint lastRow)
+{
+    int2 coord = (int2) (get_global_id(0), get_global_id(1));
+    if ((uint) coord.x < width && (uint) coord.y <= lastRow)
+        write_imagef(corners, coord, nan(0U));
+}
+
+/**
+ * Identify the cells (workgroup-sized blocks of corners) whose octree bucket
+ * chains are non-empty, and compact them into a cell list for
+ * @ref processCorners. Cells whose chains are empty cannot contribute any
+ * isovalue, so skipping them is safe.
+ *
+ * Each work item classifies one cell. A cell is encoded in the output as its
+ * block coordinates packed into 10-bit fields (x in the low bits, then y,
+ * then z); the order of the output is non-deterministic.
+ *
+ * @param[out] cells       Compacted list of occupied cells.
+ * @param[in,out] numCells Number of cells appended to @a cells; must be zero on entry.
+ * @param      start       Encoded octrees for a batch of bins (see @ref processCorners).
+ * @param      startBase   Offset in @a start of the octree for the local bin.
  * @param      startShift  Subsampling shift for octree, times 3.
- * @param      offset      Difference between global grid coordinates and the local region of interest.
- * @param      zStride, zBias See @ref Marching::ImageParams
- * @param      boundaryFactor Value of \f$1 - \gamma^2\f$ where \f$\gamma\f$ is the maximum
- *                         normalised distance between the projection point and the weighted
- *                         center of the region.
+ * @param      blocks      Number of candidate cells along each axis.
+ * @param      zFirstBlock First block along the z axis (derived from @ref Marching::Swathe::zFirst).
+ * @param      stats       Diagnostic counters (only present when built with @c KERNEL_STATS).
+ */
+KERNEL(CLASSIFY_WGS, 1, 1)
+void classifyCells(
+    __global uint * restrict cells,
+    __global uint * restrict numCells,
+    __global const command_type * restrict start,
+    uint startBase,
+    uint startShift,
+    uint3 blocks,
+    uint zFirstBlock
+#if KERNEL_STATS
+    , __global uint * restrict stats
+#endif
+    )
+{
+    uint gid = get_global_id(0);
+    if (gid >= blocks.x * blocks.y * blocks.z)
+        return;
+
+    uint3 bid;
+    bid.x = gid % blocks.x;
+    bid.y = (gid / blocks.x) % blocks.y;
+    bid.z = gid / (blocks.x * blocks.y) + zFirstBlock;
+
+    int3 wid = (int3) (bid.x * WGS_X, bid.y * WGS_Y, bid.z * WGS_Z);
+    uint code = startBase + (makeCode(wid) >> startShift);
+    if (start[code] >= 0)
+    {
+        uint idx = atomic_inc(numCells);
+        cells[idx] = bid.x | (bid.y << 10) | (bid.z << 20);
+#if KERNEL_STATS
+        atomic_inc(&stats[STATS_CELLS_OCCUPIED]);
+#endif
+    }
+}
+
+/**
+ * Compute isovalues for the corners of one occupied cell, cooperatively
+ * across the workgroup. This is the body shared by @ref processCorners and
+ * @ref processCornersPersistent.
  *
  * The local ID is a one-dimension encoding of a 3D local ID (see @ref decode).
- * The group ID specifies which of these 3D blocks we are processing.
+ * The caller passes one entry of the compacted cell list produced by
+ * @ref classifyCells; corners in cells that do not appear in the list are
+ * expected to have been pre-filled with NaN by @ref fillCorners.
+ *
+ * @pre @a cell is uniform across the workgroup (there are internal barriers).
  */
-KERNEL(WGS_X * WGS_Y * WGS_Z, 1, 1)
-void processCorners(
+inline void processCell(
     __write_only image2d_t corners,
-    __global const Splat * restrict splats,
+    __global const float4 * restrict splats,
+    uint splatStride,
     __global const command_type * restrict commands,
     __global const command_type * restrict start,
+    uint startBase,
     uint startShift,
     int3 offset,
     uint zStride,
     int zBias,
-    float boundaryFactor)
+    float boundaryFactor,
+    uint cell,
+    __local float4 * restrict lPositionRadius,
+    __local float4 * restrict lNormalQuality)
 {
-    __local command_type lSplatIds[MAX_BUCKET];
-    __local float4 lPositionRadius[MAX_BUCKET];
-
     int3 wid;  // position of one corner of the workgroup in region coordinates
-    wid.x = get_group_id(0) * WGS_X;
-    wid.y = get_group_id(1) * WGS_Y;
-    wid.z = get_group_id(2) * WGS_Z + get_global_offset(2);
-    uint code = makeCode(wid) >> startShift;
+    wid.x = (cell & 0x3ffU) * WGS_X;
+    wid.y = ((cell >> 10) & 0x3ffU) * WGS_Y;
+    wid.z = (cell >> 20) * WGS_Z;
+    uint code = startBase + (makeCode(wid) >> startShift);
     command_type pos = start[code];
 
     uint lid = get_local_id(0);
@@ -339,18 +497,19 @@ void processCorners(
         command_type end = commands[pos++];
         while (pos < end)
         {
-            if (lid < MAX_BUCKET)
+            /* pos and end are uniform across the workgroup (they derive from
+             * the cell code), so every workitem computes the same batch size
+             * and the barriers below are safe.
+             */
+            const command_type batch = min(end - pos, (command_type) MAX_BUCKET);
+            if (lid < (uint) batch)
             {
-                command_type lpos = pos + lid;
-                command_type mine = (lpos < end) ? commands[lpos] : -1;
-                lSplatIds[lid] = mine;
-                if (mine >= 0)
-                {
-                    lPositionRadius[lid] = splats[mine].positionRadius;
-                }
+                command_type mine = commands[pos + lid];
+                lPositionRadius[lid] = splats[mine];
+                lNormalQuality[lid] = loadNormalQuality(splats, splatStride, mine);
             }
 
-            pos += MAX_BUCKET;
+            pos += batch;
             if (pos >= end)
             {
                 pos = commands[end];
@@ -359,34 +518,20 @@ void processCorners(
 
             barrier(CLK_LOCAL_MEM_FENCE);
 
-            for (int i = 0; i < MAX_BUCKET; i++)
+            if (batch == (command_type) MAX_BUCKET)
             {
-                command_type splatId = lSplatIds[i];
-                if (splatId < 0)
-                {
-                    break;
-                }
-
-                float4 positionRadius = lPositionRadius[i];
-                float3 p = positionRadius.xyz - coord;
-                float pp = dot3(p, p);
-                float d = pp * positionRadius.w; // .w is the inverse squared radius
-                if (d < RADIUS_CUTOFF)
-                {
-                    __global const Splat *splat = &splats[splatId];
-                    float w = 1.0f - d;
-                    w *= w; // raise to the 4th power
-                    w *= w;
-                    w *= splat->normalQuality.w;
-
-#if FIT_SPHERE
-                    sphereFitAdd(&fit, w, p, pp, splat->normalQuality.xyz);
-#elif FIT_PLANE
-                    planeFitAdd(&fit, w, p, pp, splat->normalQuality.xyz);
-#else
-#error "Expected FIT_SPHERE or FIT_PLANE"
-#endif
-                }
+                /* Full batches dominate in the dense neighbourhoods where
+                 * this loop is hottest. The compile-time trip count lets the
+                 * compiler unroll and schedule the local-memory reads ahead
+                 * of the arithmetic.
+                 */
+                for (command_type i = 0; i < (command_type) MAX_BUCKET; i++)
+                    accumulateSplat(&fit, coord, lPositionRadius[i], lNormalQuality[i]);
+            }
+            else
+            {
+                for (command_type i = 0; i < batch; i++)
+                    accumulateSplat(&fit, coord, lPositionRadius[i], lNormalQuality[i]);
             }
             barrier(CLK_LOCAL_MEM_FENCE);
         }
@@ -432,6 +577,126 @@ void processCorners(
     write_imagef(corners, outCoord.xy, f);
 }
 
+/**
+ * Compute isovalues for all grid corners in a slice. Those with no defined
+ * isovalue are assigned a value of NaN.
+ *
+ * @param[out] corners     The isovalues from a slice.
+ * @param      splats      Input splats in the two-plane layout described at the top of the file,
+ *                         in global grid coordinates, and with the inverse squared radius in the
+ *                         w component of the position/radius plane.
+ * @param      splatStride Offset in @a splats from the position/radius plane to the normal/quality plane.
+ * @param      commands, start Encoded octrees for a batch of bins
+ * @param      startBase   Offset in @a start of the octree for the local bin.
+ * @param      startShift  Subsampling shift for octree, times 3.
+ * @param      offset      Difference between global grid coordinates and the local region of interest.
+ * @param      zStride, zBias See @ref Marching::ImageParams
+ * @param      boundaryFactor Value of \f$1 - \gamma^2\f$ where \f$\gamma\f$ is the maximum
+ *                         normalised distance between the projection point and the weighted
+ *                         center of the region.
+ * @param      cells       Compacted list of occupied cells from @ref classifyCells.
+ * @param      firstCell   Index in @a cells of the first cell to process.
+ * @param      stats       Diagnostic counters (only present when built with @c KERNEL_STATS).
+ *
+ * Each workgroup handles one entry of the cell list (see @ref processCell),
+ * so the launch must be sized from the occupied-cell count. Time-sliced
+ * launches cover a sub-range of the list, indicated by @a firstCell.
+ */
+KERNEL(WGS_X * WGS_Y * WGS_Z, 1, 1)
+void processCorners(
+    __write_only image2d_t corners,
+    __global const float4 * restrict splats,
+    __global const command_type * restrict commands,
+    __global const command_type * restrict start,
+    uint startBase,
+    uint startShift,
+    int3 offset,
+    uint zStride,
+    int zBias,
+    float boundaryFactor,
+    __global const uint * restrict cells,
+    uint firstCell,
+    uint splatStride
+#if KERNEL_STATS
+    , __global uint * restrict stats
+#endif
+    )
+{
+    /* Each workgroup stages a batch of splats for its cell's neighbourhood
+     * here once, and every corner then evaluates against the staged set.
+     * Without this, neighbouring corners would each re-fetch the same splats
+     * from global memory.
+     */
+    __local float4 lPositionRadius[MAX_BUCKET];
+    __local float4 lNormalQuality[MAX_BUCKET];
+
+#if KERNEL_STATS
+    if (get_local_id(0) == 0)
+        atomic_inc(&stats[STATS_CELLS_EXACT]);
+#endif
+
+    processCell(corners, splats, splatStride, commands, start, startBase, startShift,
+                offset, zStride, zBias, boundaryFactor,
+                cells[get_group_id(0) + firstCell], lPositionRadius, lNormalQuality);
+}
+
+/**
+ * Persistent-threads variant of @ref processCorners for low-occupancy
+ * swathes. A fixed grid of workgroups strides over the compacted cell list,
+ * reading its length directly from the device counter, so the host can
+ * launch it without first reading back the occupied-cell count. See
+ * @ref processCorners for the shared parameters.
+ *
+ * The length read is uniform across each workgroup (the counter does not
+ * change during the launch), so the internal barriers of @ref processCell
+ * remain safe. Workgroups past the end of the list exit immediately; a
+ * launch against an empty list is a no-op.
+ *
+ * @param numCells  Number of entries in @a cells, written by @ref classifyCells.
+ */
+KERNEL(WGS_X * WGS_Y * WGS_Z, 1, 1)
+void processCornersPersistent(
+    __write_only image2d_t corners,
+    __global const float4 * restrict splats,
+    __global const command_type * restrict commands,
+    __global const command_type * restrict start,
+    uint startBase,
+    uint startShift,
+    int3 offset,
+    uint zStride,
+    int zBias,
+    float boundaryFactor,
+    __global const uint * restrict cells,
+    __global const uint * restrict numCells,
+    uint splatStride
+#if KERNEL_STATS
+    , __global uint * restrict stats
+#endif
+    )
+{
+    // See processCorners for the purpose of this staging area
+    __local float4 lPositionRadius[MAX_BUCKET];
+    __local float4 lNormalQuality[MAX_BUCKET];
+
+#if KERNEL_STATS
+    uint processed = 0;
+#endif
+    const uint total = *numCells;
+    for (uint i = get_group_id(0); i < total; i += get_num_groups(0))
+    {
+        processCell(corners, splats, splatStride, commands, start, startBase, startShift,
+                    offset, zStride, zBias, boundaryFactor,
+                    cells[i], lPositionRadius, lNormalQuality);
+#if KERNEL_STATS
+        processed++;
+#endif
+    }
+#if KERNEL_STATS
+    if (get_local_id(0) == 0 && processed > 0)
+        atomic_add(&stats[STATS_CELLS_PERSISTENT], processed);
+#endif
+}
+
 /*******************************************************************************
  * Test code only below here.
  *******************************************************************************/
@@ -449,15 +714,16 @@ __kernel void testProjectDistOriginSphere(__global float *out, float p0, float p
     *out = projectDistOriginSphere(&sphere);
 }
 
-__kernel void testFitSphere(__global float *out, __global const Splat *in, uint nsplats)
+__kernel void testFitSphere(__global float *out, __global const float4 *in, uint nsplats)
 {
+    // in uses the two-plane layout with a plane stride of nsplats
     SphereFit sf;
     sphereFitInit(&sf);
     for (uint i = 0; i < nsplats; i++)
     {
-        const float3 p = in[i].positionRadius.xyz;
-        const float3 n = in[i].normalQuality.xyz;
-        sphereFitAdd(&sf, in[i].normalQuality.w, p, dot3(p, p), n);
+        const float3 p = in[i].xyz;
+        const float4 nq = loadNormalQuality(in, nsplats, i);
+        sphereFitAdd(&sf, nq.w, p, dot3(p, p), nq.xyz);
     }
     Sphere sphere;
     fitSphere(&sf, &sphere);
@@ -0,0 +1,302 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Kernels for estimating normals and radii for raw point clouds that carry
+ * positions only. Neighbourhoods are found by walking the same per-cell
+ * command chains that @ref mls.cl traverses, so the octree built by
+ * @c SplatTreeCL doubles as the k-NN structure:
+ *
+ * -# @ref prepareSplats assigns a uniform provisional search radius, which
+ *    determines the cell ranges the octree build will index each splat into.
+ * -# The octree is built as usual (this rewrites the radius field to its
+ *    inverse square, as for MLS).
+ * -# @ref estimateNormals walks each splat's own cell chain, fits a plane
+ *    through the weighted neighbourhood by principal component analysis and
+ *    replaces the normal, and derives a radius from the local sample density.
+ *
+ * The splats are then in exactly the state the MLS kernels expect, so the
+ * stage can run fused, per bin, ahead of @c processCorners.
+ */
+
+typedef int command_type;
+
+/* Splats are stored on the device as a structure of arrays: a plane of
+ * position/radius values (position in xyz; radius field in w, see the file
+ * comment) followed, @c splatStride elements later in the same buffer, by a
+ * plane of normal/quality values (normal in xyz, quality metric in w). This
+ * matches the layout the octree build and the MLS kernels use. With
+ * HALF_NORMALS the normal/quality plane holds half4 values (see mls.cl);
+ * this stage only writes that plane, so it stores through vstore_half4.
+ */
+#ifndef HALF_NORMALS
+# define HALF_NORMALS 0
+#endif
+
+/// Store one normal/quality value to the plane starting at splats + splatStride
+inline void storeNormalQuality(__global float4 *splats, uint splatStride, uint idx, float4 value)
+{
+#if HALF_NORMALS
+    vstore_half4(value, idx, (__global half *) (splats + splatStride));
+#else
+    splats[splatStride + idx] = value;
+#endif
+}
+
+/// Minimum neighbour count for a usable plane fit
+#define MIN_HITS 4
+
+// This seems to generate fewer instructions than NVIDIA's implementation
+inline float dot3(float3 a, float3 b)
+{
+    return fma(a.x, b.x, fma(a.y, b.y, a.z * b.z));
+}
+
+/**
+ * Turn cell coordinates into a cell code. This must match the function of
+ * the same name in @ref octree.cl so that the command chains are addressed
+ * identically.
+ */
+inline uint makeCode(int3 xyz)
+{
+    uint ans = 0;
+    uint scale = 1;
+    xyz.y <<= 1;  // pre-shift these to avoid shifts inside the loop
+    xyz.z <<= 2;
+    while (any(xyz != 0))
+    {
+        uint bits = (xyz.x & 1) | (xyz.y & 2) | (xyz.z & 4);
+        ans += bits * scale;
+        scale <<= 3;
+        xyz >>= 1;
+    }
+    return ans;
+}
+
+/**
+ * Return a unit eigenvector for the smallest eigenvalue of the symmetric
+ * matrix with upper triangle (@a cxx, @a cxy, @a cxz; @a cyy, @a cyz; @a czz).
+ *
+ * The eigenvalues are computed with the trigonometric method for symmetric
+ * 3x3 matrices and the eigenvector is taken as the largest cross product of
+ * rows of C - &lambda;I, which is robust to one (but not two) of the rows
+ * vanishing. Degenerate inputs (an isotropic neighbourhood, or one sampled
+ * along a line) have no well-defined plane normal; (0, 0, 1) is returned so
+ * that the caller still writes something finite.
+ */
+inline float3 smallestEigenvector(
+    float cxx, float cxy, float cxz, float cyy, float cyz, float czz)
+{
+    const float q = (cxx + cyy + czz) * (1.0f / 3.0f);
+    const float b00 = cxx - q;
+    const float b11 = cyy - q;
+    const float b22 = czz - q;
+    const float p1 = cxy * cxy + cxz * cxz + cyz * cyz;
+    const float p2 = b00 * b00 + b11 * b11 + b22 * b22 + 2.0f * p1;
+    const float pp = sqrt(p2 * (1.0f / 6.0f));
+
+    float eig;
+    if (p2 <= 0.0f || !isfinite(pp))
+        return (float3) (0.0f, 0.0f, 1.0f); // isotropic (or garbage) input
+    else
+    {
+        const float detB =
+            b00 * (b11 * b22 - cyz * cyz)
+            - cxy * (cxy * b22 - cyz * cxz)
+            + cxz * (cxy * cyz - b11 * cxz);
+        const float r = clamp(detB / (2.0f * pp * pp * pp), -1.0f, 1.0f);
+        const float phi = acos(r) * (1.0f / 3.0f);
+        // cos(phi + 2pi/3) yields the smallest of the three roots
+        eig = q + 2.0f * pp * cos(phi + 2.0943951023931953f);
+    }
+
+    const float3 r0 = (float3) (cxx - eig, cxy, cxz);
+    const float3 r1 = (float3) (cxy, cyy - eig, cyz);
+    const float3 r2 = (float3) (cxz, cyz, czz - eig);
+    float3 best = cross(r0, r1);
+    float bestLen = dot3(best, best);
+    float3 v = cross(r0, r2);
+    float len = dot3(v, v);
+    if (len > bestLen)
+    {
+        best = v;
+        bestLen = len;
+    }
+    v = cross(r1, r2);
+    len = dot3(v, v);
+    if (len > bestLen)
+    {
+        best = v;
+        bestLen = len;
+    }
+    if (!(bestLen > 0.0f))
+        return (float3) (0.0f, 0.0f, 1.0f); // rank-deficient: no unique normal
+    return best * rsqrt(bestLen);
+}
+
+/**
+ * Assign the provisional search radius to a range of raw splats. The radius
+ * (in grid units) determines which cells the subsequent octree build indexes
+ * each splat into, and hence the neighbourhood that @ref estimateNormals
+ * sees. The normal and quality are also set to sane values so that a splat
+ * whose estimation fails still reads back as finite.
+ *
+ * @param[in,out] splats   The splats in the two-plane layout; only positions need be valid on entry.
+ * @param      splatStride Offset in @a splats from the position/radius plane to the normal/quality plane.
+ * @param      firstSplat  Index of the first splat to prepare.
+ * @param      radius      Provisional search radius, in grid units.
+ */
+__kernel void prepareSplats(
+    __global float4 * restrict splats,
+    uint splatStride,
+    uint firstSplat,
+    float radius)
+{
+    const uint gid = get_global_id(0) + firstSplat;
+    splats[gid].w = radius;
+    storeNormalQuality(splats, splatStride, gid, (float4) (0.0f, 0.0f, 1.0f, 1.0f / (radius * radius)));
+}
+
+/**
+ * Estimate a normal and radius for each splat of a bin from its
+ * neighbourhood in the octree.
+ *
+ * Each work item walks the command chain of its own splat's cell, which by
+ * construction lists every splat whose provisional sphere of influence
+ * intersects that cell; since all provisional radii are equal, that is a
+ * superset of the neighbours within the search radius. Neighbours are
+ * accumulated into a compactly-weighted covariance, the normal is the
+ * weakest principal direction, and the radius is derived from the sample
+ * density: @a hits samples over a disc of the search radius imply a mean
+ * spacing of R&radic;(&pi;/hits), which is scaled by @a radiusScale and
+ * clamped to the search radius. On output the radius field holds the
+ * inverse squared radius and the quality matches it, which is the form the
+ * MLS kernels consume.
+ *
+ * @param[in,out] splats   The splats in the two-plane layout, after the octree build.
+ * @param      splatStride Offset in @a splats from the position/radius plane to the normal/quality plane.
+ * @param      commands, start Encoded octrees for a batch of bins (see @ref mls.cl).
+ * @param      startBase   Offset in @a start of the octree for the local bin.
+ * @param      startShift  Subsampling shift for the octree, times 3.
+ * @param      firstSplat  Index of the bin's first splat.
+ * @param      offset      Offset of the octree within the overall grid.
+ * @param      viewpoint   Reference point (in grid coordinates) towards which
+ *                         normals are oriented, e.g. the scanner position.
+ * @param      radiusScale Output radius as a multiple of the estimated
+ *                         sample spacing.
+ */
+__kernel void estimateNormals(
+    __global float4 * restrict splats,
+    uint splatStride,
+    __global const command_type * restrict commands,
+    __global const command_type * restrict start,
+    uint startBase,
+    uint startShift,
+    uint firstSplat,
+    int3 offset,
+    float3 viewpoint,
+    float radiusScale)
+{
+    const uint sid = get_global_id(0) + firstSplat;
+    const float3 p = splats[sid].xyz;
+    const float invR2 = splats[sid].w; // 1/R^2 after the octree build
+
+    const int3 cell = convert_int3(floor(p)) - offset;
+    const uint code = startBase + (makeCode(cell) >> startShift);
+
+    float sumW = 0.0f;
+    float3 sumWq = (float3) (0.0f, 0.0f, 0.0f);
+    float cxx = 0.0f, cxy = 0.0f, cxz = 0.0f;
+    float cyy = 0.0f, cyz = 0.0f, czz = 0.0f;
+    uint hits = 0;
+
+    command_type pos = start[code];
+    while (pos >= 0)
+    {
+        command_type end = commands[pos++];
+        while (pos < end)
+        {
+            const command_type mine = commands[pos++];
+            const float3 q = splats[mine].xyz - p;
+            const float qq = dot3(q, q);
+            const float d = qq * invR2;
+            if (d < 1.0f)
+            {
+                float w = 1.0f - d;
+                w *= w;
+                sumW += w;
+                sumWq += w * q;
+                cxx += w * q.x * q.x;
+                cxy += w * q.x * q.y;
+                cxz += w * q.x * q.z;
+                cyy += w * q.y * q.y;
+                cyz += w * q.y * q.z;
+                czz += w * q.z * q.z;
+                hits++;
+            }
+        }
+        pos = commands[end];
+    }
+
+    float3 normal = (float3) (0.0f, 0.0f, 1.0f);
+    if (hits >= MIN_HITS)
+    {
+        // Recentre the second moments on the weighted mean
+        const float invW = 1.0f / sumW;
+        const float3 mean = sumWq * invW;
+        normal = smallestEigenvector(
+            cxx * invW - mean.x * mean.x,
+            cxy * invW - mean.x * mean.y,
+            cxz * invW - mean.x * mean.z,
+            cyy * invW - mean.y * mean.y,
+            cyz * invW - mean.y * mean.z,
+            czz * invW - mean.z * mean.z);
+        if (dot3(normal, viewpoint - p) < 0.0f)
+            normal = -normal;
+    }
+
+    const float R = rsqrt(invR2);
+    // hits >= 1 always, since the splat finds itself
+    const float spacing = R * sqrt(M_PI_F / (float) hits);
+    const float radius = min(radiusScale * spacing, R);
+    const float invRadius2 = 1.0f / (radius * radius);
+    splats[sid].w = invRadius2;
+    storeNormalQuality(splats, splatStride, sid, (float4) (normal, invRadius2));
+}
+
+/*******************************************************************************
+ * Test code only below here.
+ *******************************************************************************/
+
+#if UNIT_TESTS
+
+__kernel void testSmallestEigenvector(
+    __global float *out,
+    float cxx, float cxy, float cxz, float cyy, float cyz, float czz)
+{
+    float3 v = smallestEigenvector(cxx, cxy, cxz, cyy, cyz, czz);
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+}
+
+#endif /* UNIT_TESTS */
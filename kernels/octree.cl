@@ -21,19 +21,17 @@
 /**
  * @file
  *
- * Construction of an octree containing splats.
+ * Construction of octrees containing splats. Several octrees can be built
+ * in a single batch of kernel launches, which amortizes launch overheads
+ * when the individual octrees are small.
  */
 
-/**
- * GPU representation of a splat.
- * Only the position and radius are used in this file, but the full set of information
- * is there for compatibility with other files.
+/* Splats are stored on the device as a structure of arrays: a plane of
+ * position/radius values (position in xyz, radius in w) followed by a plane
+ * of normal/quality values (normal in xyz, quality metric in w). This file
+ * only uses the position/radius plane, so the kernels here take just that
+ * plane and make perfectly coalesced float4 accesses.
  */
-typedef struct
-{
-    float4 positionRadius;   // position in xyz, radius in w
-    float4 normalQuality;    // normal in xyz, quality metric in w
-} Splat;
 
 /**
  * Determine the octree level to use for a box of a given size.  When entered
@@ -135,36 +133,53 @@ inline uint makeCode(int3 xyz)
 }
 
 /**
- * Write splat entries for an octree.
+ * Per-bin constants for @ref writeEntries. A batch of bins is built into a
+ * single forest of octrees, with the keys for bin i biased so that they sort
+ * after all the keys for bin i - 1. This must match the layout of
+ * @c SplatTreeCL::KernelBin on the host.
+ */
+typedef struct
+{
+    int4 bias;        ///< Amount to subtract from global coordinates to get local ones (w unused).
+    uint keyOffset;   ///< Amount added to codes to separate this bin's keys from other bins'.
+    uint firstEntry;  ///< First workitem belonging to this bin.
+    uint firstSplat;  ///< Index in @c splats of the bin's first splat.
+    uint pad;         ///< Padding to match host-side structure layout.
+} BuildBin;
+
+/**
+ * Write splat entries for a batch of octrees.
  *
  * Each splat produces up to 8 "entries", consisting of a cell key/splat ID
  * pair. In fact, each splat must produce exactly 8 entries, and for unwanted
  * slots, it must write a cell code of UINT_MAX.
  *
  * The output arrays are slot-major i.e. of layout [8][numsplats] and splat i
- * writes to slots [j][i] for j in 0..7. The number of splats is given by
- * <code>get_global_size(0)</code>.
+ * writes to slots [j][i] for j in 0..7. The number of splats, summed over all
+ * bins, is given by <code>get_global_size(0)</code>.
  *
- * Each workitem corresponds to a single splat.
+ * Each workitem corresponds to a single splat. The workitems for a bin are
+ * contiguous, and each workitem finds its bin by scanning the (small) bin
+ * table.
  *
- * @param[out] keys        The cell codes for the entries.
+ * @param[out] keys        The cell codes for the entries, biased per bin.
  * @param[out] values      The splat IDs for the entries.
- * @param[in,out] splats   The original splats. On output, radius replaced by 1/radius^2.
- * @param bias             Amount to subtract from global coordinates to get local ones.
+ * @param[in,out] splats   Position/radius plane of the splats. On output, radius replaced by 1/radius^2.
+ * @param bins             Per-bin constants.
+ * @param numBins          Number of bins in the batch.
  * @param levelOffsets     Values added to codes to give sort keys (allocated to hold @a maxShift + 1 values).
  * @param minShift         Minimum bit shift (determines subsampling of grid to give finest level).
  * @param maxShift         Maximum bit shift (determines base level).
- * @param firstSplat       Index of first splat to process within @a splats
  */
 __kernel void writeEntries(
     __global uint *keys,
     __global uint *values,
-    __global Splat *splats,
-    int3 bias,
+    __global float4 *splats,
+    __global const BuildBin *bins,
+    uint numBins,
     __local uint *levelOffsets,
     uint minShift,
-    uint maxShift,
-    uint firstSplat)
+    uint maxShift)
 {
     if (get_local_id(0) == 0)
     {
@@ -182,15 +197,21 @@ __kernel void writeEntries(
 
     uint gid = get_global_id(0);
     uint pos = gid * 8;
-    gid += firstSplat;
+    uint bin = 0;
+    for (uint i = 1; i < numBins; i++)
+        if (gid >= bins[i].firstEntry)
+            bin = i;
+    const int3 bias = bins[bin].bias.xyz;
+    const uint keyOffset = bins[bin].keyOffset;
+    gid = gid - bins[bin].firstEntry + bins[bin].firstSplat;
 
-    float4 positionRadius = splats[gid].positionRadius;
+    float4 positionRadius = splats[gid];
     int3 ilo;
     int shift;
     prepare(&ilo, &shift, minShift, maxShift, positionRadius, bias);
 
     float radius2 = positionRadius.w * positionRadius.w;
-    splats[gid].positionRadius.w = 1.0f / radius2; // replace with form used in mls.cl
+    splats[gid].w = 1.0f / radius2; // replace with form used in mls.cl
     radius2 *= 1.00001f;   // be conservative in deciding intersections
     int3 ofs;
     uint levelOffset = levelOffsets[shift];
@@ -205,7 +226,7 @@ __kernel void writeEntries(
                 // Avoid going outside the octree bounds. ilo was already clamped to >= 0 in
                 // prepare so we don't need to worry about the lower bound
                 isect &= all(addr < bound);
-                key = isect ? key : UINT_MAX;
+                key = isect ? key + keyOffset : UINT_MAX;
 
                 values[pos] = gid;
                 keys[pos] = key;
@@ -279,13 +300,19 @@ __kernel void writeSplatIds(
 }
 
 /**
- * Writes the start array, endpoints and jump commands for one level.
+ * Writes the start array, endpoints and jump commands for one level of every
+ * octree in the batch.
+ *
+ * There is one workitem per code per bin, with the codes for a bin
+ * contiguous.
  *
  * @param[in,out]  start           Start array for previous and current level.
  * @param[out]     commands        Command array in which to write endpoints and jump commands.
  * @param          jumpPos         Jump positions in command array, as written by @ref writeSplatIds.
  * @param          curOffset       Offset added to code to get position in start array on current level.
  * @param          prevOffset      Offset added to parent code to get position in parent start array.
+ * @param          levelSize       Number of codes on the current level of one octree.
+ * @param          stride          Number of start entries for one whole octree.
  *
  * @todo Investigate copying prev to local memory using subset of threads.
  */
@@ -294,12 +321,17 @@ __kernel void writeStart(
     __global int *commands,
     __global const uint *jumpPos,
     uint curOffset,
-    uint prevOffset)
+    uint prevOffset,
+    uint levelSize,
+    uint stride)
 {
-    uint code = get_global_id(0);
-    uint pos = code + curOffset;
+    uint gid = get_global_id(0);
+    uint bin = gid / levelSize;
+    uint code = gid - bin * levelSize;
+    uint base = bin * stride;
+    uint pos = base + curOffset + code;
     int jp = jumpPos[pos];
-    int prev = start[prevOffset + (code >> 3)];
+    int prev = start[base + prevOffset + (code >> 3)];
     if (jp >= 0)
     {
         commands[jp] = prev;
@@ -319,15 +351,21 @@ __kernel void writeStart(
  * @param[out]     commands        Command array in which to write jump commands.
  * @param          jumpPos         Jump positions in command array, as written by @ref writeSplatIds.
  * @param          curOffset       Offset added to code to get position in start array on current level.
+ * @param          levelSize       Number of codes on the current level of one octree.
+ * @param          stride          Number of start entries for one whole octree.
  */
 __kernel void writeStartTop(
     __global int *start,
     __global int *commands,
     __global const uint *jumpPos,
-    uint curOffset)
+    uint curOffset,
+    uint levelSize,
+    uint stride)
 {
-    uint code = get_global_id(0);
-    uint pos = code + curOffset;
+    uint gid = get_global_id(0);
+    uint bin = gid / levelSize;
+    uint code = gid - bin * levelSize;
+    uint pos = bin * stride + curOffset + code;
     int jp = jumpPos[pos];
     if (jp >= 0)
     {
@@ -47,6 +47,8 @@
 #include <vector>
 #include <algorithm>
 #include <numeric>
+#include <limits>
+#include <cassert>
 #include <mpi.h>
 #include "src/misc.h"
 #include "src/clh.h"
@@ -77,6 +79,7 @@
 #include "src/bucket_collector.h"
 #include "src/worker_group_mpi.h"
 #include "src/serialize.h"
+#include "src/diskstats.h"
 #include "src/mlsgpu_core.h"
 
 namespace po = boost::program_options;
@@ -85,19 +88,42 @@ using namespace std;
 template<>
 void sendItem(const MesherGroup::WorkItem &item, MPI_Comm comm, int dest)
 {
-    Serialize::send(item.work, comm, dest);
+    /* An item may carry several small meshes (see @ref MeshBatch), so the
+     * count travels first. Point-to-point ordering keeps it matched with
+     * the per-mesh messages that follow.
+     */
+    std::size_t count = item.works.size();
+    MPI_Send(&count, 1, Serialize::mpi_type_traits<std::size_t>::type(),
+             dest, MLSGPU_TAG_WORK, comm);
+    for (std::size_t i = 0; i < count; i++)
+        Serialize::send(item.works[i], comm, dest);
 }
 
 template<>
 void recvItem(MesherGroup::WorkItem &item, MPI_Comm comm, int dest)
 {
-    Serialize::recv(item.work, item.alloc.get(), comm, dest);
+    std::size_t count;
+    MPI_Recv(&count, 1, Serialize::mpi_type_traits<std::size_t>::type(),
+             dest, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+    item.works.resize(count);
+    /* The payloads are packed back-to-back into the item's allocation, at
+     * the same alignment the sender used, so the total matches sizeItem.
+     */
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        Serialize::recv(item.works[i], static_cast<char *>(item.alloc.get()) + offset, comm, dest);
+        offset += roundUp(item.works[i].mesh.getHostBytes(), sizeof(cl_ulong));
+    }
 }
 
 template<>
 std::size_t sizeItem(const MesherGroup::WorkItem &item)
 {
-    return item.work.mesh.getHostBytes();
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < item.works.size(); i++)
+        bytes += roundUp(item.works[i].mesh.getHostBytes(), sizeof(cl_ulong));
+    return bytes;
 }
 
 typedef SplatSet::FastBlobSetMPI<SplatSet::FileSet> Splats;
@@ -105,6 +131,73 @@ typedef SplatSet::FastBlobSetMPI<SplatSet::FileSet> Splats;
 namespace
 {
 
+/**
+ * Number of work requests each slave keeps outstanding with the scatter
+ * master. With only one, a slave cannot be sent its next batch until it has
+ * finished receiving the previous one, so every batch costs a full request
+ * round trip. With several credits the master can push batches ahead of
+ * need and the latency is hidden. The master and slaves must agree on this
+ * value: @ref Scatter::stop answers exactly this many requests per slave
+ * during shutdown.
+ */
+static const unsigned int SCATTER_CREDITS = 4;
+
+/**
+ * Size in bytes of each one-sided transfer slot exposed by a slave. A slave
+ * exposes @ref SCATTER_CREDITS slots, one per outstanding credit. Batches
+ * whose packed form does not fit in a slot fall back to a two-sided send,
+ * so this only needs to cover the common case.
+ */
+static const std::size_t SCATTER_SLOT_SIZE = 4 * 1024 * 1024;
+
+/**
+ * One-sided communication resources for the scatter. Each slave exposes a
+ * window of @ref SCATTER_CREDITS slots of @ref SCATTER_SLOT_SIZE bytes each,
+ * into which the master puts packed bin batches directly, avoiding the
+ * rendezvous handshake that two-sided sends pay on multi-MB payloads. The
+ * credit message identifies a free slot and the has-work message is reduced
+ * to a doorbell carrying only metadata.
+ *
+ * Construction and destruction are collective over @a comm; ranks that are
+ * not slaves expose an empty window.
+ */
+class ScatterWindow : public boost::noncopyable
+{
+private:
+    char *base;      ///< Locally exposed memory (@c NULL on non-slave ranks)
+    MPI_Win win;
+
+public:
+    ScatterWindow(MPI_Comm comm, bool isSlave);
+    ~ScatterWindow();
+
+    /// Returns the start of the given local slot
+    char *getSlot(unsigned int slot) const { return base + slot * SCATTER_SLOT_SIZE; }
+
+    MPI_Win getWindow() const { return win; }
+};
+
+ScatterWindow::ScatterWindow(MPI_Comm comm, bool isSlave)
+    : base(NULL), win(MPI_WIN_NULL)
+{
+    MPI_Aint bytes = 0;
+    if (isSlave)
+    {
+        bytes = MPI_Aint(SCATTER_CREDITS) * SCATTER_SLOT_SIZE;
+        void *mem;
+        MPI_Alloc_mem(bytes, MPI_INFO_NULL, &mem);
+        base = static_cast<char *>(mem);
+    }
+    MPI_Win_create(base, bytes, 1, MPI_INFO_NULL, comm, &win);
+}
+
+ScatterWindow::~ScatterWindow()
+{
+    MPI_Win_free(&win);
+    if (base != NULL)
+        MPI_Free_mem(base);
+}
+
 /**
  * Function object for doing the GPU work. There is one slave launched
  * on each node that has GPUs.
@@ -117,6 +210,7 @@ private:
     Splats &splats;
     MPI_Comm scatterComm;
     int scatterRoot;
+    ScatterWindow &scatterWindow;
     MPI_Comm gatherComm;
     int gatherRoot;
     MPI_Comm progressComm;
@@ -126,11 +220,11 @@ public:
     Slave(const std::vector<std::pair<cl::Context, cl::Device> > &devices,
           const po::variables_map &vm,
           Splats &splats,
-          MPI_Comm scatterComm, int scatterRoot,
+          MPI_Comm scatterComm, int scatterRoot, ScatterWindow &scatterWindow,
           MPI_Comm gatherComm, int gatherRoot,
           MPI_Comm progressComm, int progressRoot)
         : devices(devices), vm(vm), splats(splats),
-        scatterComm(scatterComm), scatterRoot(scatterRoot),
+        scatterComm(scatterComm), scatterRoot(scatterRoot), scatterWindow(scatterWindow),
         gatherComm(gatherComm), gatherRoot(gatherRoot),
         progressComm(progressComm), progressRoot(progressRoot)
     {
@@ -141,20 +235,39 @@ public:
 
 /**
  * Receives collections of bins from @ref BucketCollector and passes them over MPI.
+ * Each collection travels as a single packed transfer, so the message count
+ * tracks the number of batches (bounded by the splat budget) rather than the
+ * number of bins; the tiny bins from sparse regions share one envelope.
  */
 class Scatter
 {
 private:
     MPI_Comm comm;
+    ScatterWindow &window;
     Timeplot::Worker &tworker;
 
     Statistics::Variable &waitStat;
     Statistics::Variable &sendStat;
+    Statistics::Variable &batchBinsStat;
+    Statistics::Variable &batchBytesStat;
+    Statistics::Counter &putStat;
+    Statistics::Counter &fallbackStat;
+
+    /* The persistent channels are held by shared pointer so that copies of
+     * this functor (e.g. the one stored in BucketCollector) share a single
+     * set of requests.
+     */
+    boost::shared_ptr<Serialize::PersistentRecv<int> > needWork;
+    typedef std::map<int, boost::shared_ptr<Serialize::PersistentSend<std::size_t> > > HasWorkMap;
+    boost::shared_ptr<HasWorkMap> hasWork;
+
+    /// Retrieve the header channel to @a dest, creating it on first contact
+    Serialize::PersistentSend<std::size_t> &hasWorkChannel(int dest) const;
 public:
     typedef void result_type;
 
     /// Constructor
-    Scatter(MPI_Comm comm, Timeplot::Worker &tworker);
+    Scatter(MPI_Comm comm, ScatterWindow &window, Timeplot::Worker &tworker);
 
     /// Send the bins to a slave
     void operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins) const;
@@ -184,6 +297,8 @@ public:
 
     void freeItem(boost::shared_ptr<WorkItem> item)
     {
+        item->works.clear();  // release the event and mesh references
+        item->pinned.reset(); // return the staging block to its pool
         meshBuffer.free(item->alloc);
     }
 
@@ -191,56 +306,99 @@ private:
     CircularBuffer meshBuffer;
 };
 
-Scatter::Scatter(MPI_Comm comm, Timeplot::Worker &tworker) :
+Scatter::Scatter(MPI_Comm comm, ScatterWindow &window, Timeplot::Worker &tworker) :
     comm(comm),
+    window(window),
     tworker(tworker),
     waitStat(Statistics::getStatistic<Statistics::Variable>("scatter.get")),
-    sendStat(Statistics::getStatistic<Statistics::Variable>("scatter.push"))
+    sendStat(Statistics::getStatistic<Statistics::Variable>("scatter.push")),
+    batchBinsStat(Statistics::getStatistic<Statistics::Variable>("scatter.batch.bins")),
+    batchBytesStat(Statistics::getStatistic<Statistics::Variable>("scatter.batch.bytes")),
+    putStat(Statistics::getStatistic<Statistics::Counter>("scatter.rma.put")),
+    fallbackStat(Statistics::getStatistic<Statistics::Counter>("scatter.rma.fallback")),
+    needWork(new Serialize::PersistentRecv<int>(1, comm, MPI_ANY_SOURCE, MLSGPU_TAG_SCATTER_NEED_WORK)),
+    hasWork(new HasWorkMap)
 {
 }
 
+Serialize::PersistentSend<std::size_t> &Scatter::hasWorkChannel(int dest) const
+{
+    boost::shared_ptr<Serialize::PersistentSend<std::size_t> > &channel = (*hasWork)[dest];
+    if (!channel)
+        channel.reset(new Serialize::PersistentSend<std::size_t>(
+            3, comm, dest, MLSGPU_TAG_SCATTER_HAS_WORK));
+    return *channel;
+}
+
 void Scatter::operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins) const
 {
     if (bins.empty())
         return;
 
-    int needsWork;
+    int slot;
     MPI_Status status;
     {
         Timeplot::Action timer("wait", tworker, waitStat);
-        MPI_Recv(&needsWork, 1, MPI_INT, MPI_ANY_SOURCE, MLSGPU_TAG_SCATTER_NEED_WORK, comm, &status);
+        (*needWork)(&slot, &status);
     }
 
     {
         Timeplot::Action timer("send", tworker, sendStat);
-        int dest = status.MPI_SOURCE;
-        std::size_t workSize = bins.size();
-        MPI_Send(&workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(),
-                 dest, MLSGPU_TAG_SCATTER_HAS_WORK, comm);
-        for (std::size_t i = 0; i < bins.size(); i++)
+        const int dest = status.MPI_SOURCE;
+        /* Doorbell: number of bins, packed payload bytes (0 for the
+         * two-sided fallback), and the slot the payload was put into.
+         */
+        std::size_t header[3];
+        header[0] = bins.size();
+        header[2] = slot;
+
+        const std::size_t bytes = Serialize::packSize(bins, comm);
+        batchBinsStat.add(bins.size());
+        batchBytesStat.add(bytes);
+        if (bytes <= SCATTER_SLOT_SIZE)
+        {
+            boost::scoped_array<char> buffer(new char[bytes]);
+            header[1] = Serialize::pack(bins, buffer.get(), bytes, comm);
+            /* A shared lock suffices: slots are owned by one side at a
+             * time, so concurrent accesses never touch the same slot.
+             */
+            MPI_Win_lock(MPI_LOCK_SHARED, dest, 0, window.getWindow());
+            MPI_Put(buffer.get(), header[1], MPI_BYTE, dest,
+                    MPI_Aint(slot) * SCATTER_SLOT_SIZE, header[1], MPI_BYTE,
+                    window.getWindow());
+            MPI_Win_unlock(dest, window.getWindow());
+            hasWorkChannel(dest)(header);
+            putStat.add();
+        }
+        else
         {
-            Serialize::send(bins[i], comm, dest);
+            header[1] = 0;
+            hasWorkChannel(dest)(header);
+            Serialize::send(bins, comm, dest);
+            fallbackStat.add();
         }
     }
 }
 
 void Scatter::stop(std::size_t numSlaves) const
 {
-    for (std::size_t i = 0; i < numSlaves; i++)
+    /* Every outstanding request must be answered, and each slave has
+     * SCATTER_CREDITS of them in flight at shutdown.
+     */
+    for (std::size_t i = 0; i < numSlaves * SCATTER_CREDITS; i++)
     {
-        int needsWork;
+        int slot;
         MPI_Status status;
         {
             Timeplot::Action timer("wait", tworker, waitStat);
-            MPI_Recv(&needsWork, 1, MPI_INT, MPI_ANY_SOURCE, MLSGPU_TAG_SCATTER_NEED_WORK, comm, &status);
+            (*needWork)(&slot, &status);
         }
 
         {
             Timeplot::Action timer("send", tworker, sendStat);
             int dest = status.MPI_SOURCE;
-            std::size_t workSize = 0; // signals shutdown
-            MPI_Send(&workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(),
-                     dest, MLSGPU_TAG_SCATTER_HAS_WORK, comm);
+            std::size_t header[3] = {0, 0, 0}; // zero bins signals shutdown
+            hasWorkChannel(dest)(header);
         }
     }
 }
@@ -252,6 +410,15 @@ void Slave::operator()() const
     Statistics::Variable &popStat = Statistics::getStatistic<Statistics::Variable>("slave.pop");
     Statistics::Variable &recvStat = Statistics::getStatistic<Statistics::Variable>("slave.recv");
 
+    int rank;
+    MPI_Comm_rank(scatterComm, &rank);
+
+    /* Persistent channels for the fixed-shape credit and header messages
+     * exchanged with the master once per batch.
+     */
+    Serialize::PersistentSend<int> needWork(1, scatterComm, scatterRoot, MLSGPU_TAG_SCATTER_NEED_WORK);
+    Serialize::PersistentRecv<std::size_t> hasWork(3, scatterComm, scatterRoot, MLSGPU_TAG_SCATTER_HAS_WORK);
+
     const std::size_t memGather = vm[Option::memGather].as<Capacity>();
 
     GatherGroup gatherGroup(gatherComm, gatherRoot, memGather);
@@ -262,35 +429,90 @@ void Slave::operator()() const
      */
 
     ProgressMPI progress(NULL, splats.numSplats(), progressComm, progressRoot);
-    slaveWorkers.start(splats, splats.getBoundingGrid(), &progress);
+    /* Batch the per-bucket updates per worker thread, so that progress does
+     * not contend on the ProgressMPI mutex or generate extra message traffic.
+     */
+    BatchedProgress batchedProgress(&progress);
+    Grid grid = splats.getBoundingGrid();
+    {
+        double worldOffset[3];
+        splats.getWorldOffset(worldOffset);
+        grid.setWorldOffset(worldOffset);
+    }
+    slaveWorkers.start(splats, grid, &batchedProgress);
     gatherGroup.start();
 
+    /* Post the initial credits, so that the master can pipeline several
+     * batches to us without waiting for us to come back for more. Each
+     * credit names a free window slot that the master may put into.
+     */
+    for (unsigned int i = 0; i < SCATTER_CREDITS; i++)
+    {
+        int slot = i;
+        needWork(&slot);
+    }
+
     bool first = true;
     while (true)
     {
-        int needWork = 1;
-        std::size_t workSize;
+        std::size_t header[3];
         {
             Timeplot::Action timer("pop", tworker, first ? firstPopStat : popStat);
-            MPI_Sendrecv(&needWork, 1, MPI_INT, scatterRoot, MLSGPU_TAG_SCATTER_NEED_WORK,
-                         &workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(), scatterRoot, MLSGPU_TAG_SCATTER_HAS_WORK,
-                         scatterComm, MPI_STATUS_IGNORE);
-            if (workSize == 0)
+            first = false;
+            hasWork(header);
+            if (header[0] == 0)
                 break;
         }
 
-        Statistics::Container::vector<BucketCollector::Bin> bins("mem.BucketCollector.bins", workSize);
+        Statistics::Container::vector<BucketCollector::Bin> bins("mem.BucketCollector.bins", header[0]);
         {
             Timeplot::Action timer("recv", tworker, recvStat);
-            for (std::size_t i = 0; i < bins.size(); i++)
-                Serialize::recv(bins[i], scatterComm, scatterRoot);
+            if (header[1] != 0)
+            {
+                /* The payload was put into our window; a lock on the local
+                 * window makes it visible to direct loads.
+                 */
+                MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, scatterWindow.getWindow());
+                Serialize::unpack(bins, scatterWindow.getSlot(header[2]), header[1], scatterComm);
+                MPI_Win_unlock(rank, scatterWindow.getWindow());
+            }
+            else
+                Serialize::recv(bins, scatterComm, scatterRoot);
         }
+        /* Replace the credit (returning the now-free slot) before
+         * processing, so the next batch is already in flight while this one
+         * runs.
+         */
+        int slot = header[2];
+        needWork(&slot);
+
+        /* Hint the whole batch to the OS up front, so the reads can be
+         * scheduled in file-offset order while the loader works through the
+         * bins sequentially.
+         */
+        BOOST_FOREACH(const BucketCollector::Bin &bin, bins)
+            splats.prefetch(bin.ranges.begin(), bin.ranges.end());
+
         (*slaveWorkers.loader)(bins);
     }
 
+    /* The shutdown message consumed one credit; the master answers the
+     * remaining ones with zeros, which must be drained to balance the
+     * communication.
+     */
+    for (unsigned int i = 1; i < SCATTER_CREDITS; i++)
+    {
+        std::size_t header[3];
+        hasWork(header);
+        assert(header[0] == 0);
+        (void) header;
+    }
+
     slaveWorkers.stop();
     gatherGroup.stop();
+    batchedProgress.flush();
     progress.sync();
+    progress.close();
 
     Statistics::finalizeEventTimes();
 }
@@ -306,35 +528,47 @@ static void doStatistics(const po::variables_map &vm, MPI_Comm comm, int root)
     MPI_Comm_rank(comm, &rank);
     MPI_Comm_size(comm, &size);
 
-    if (rank == root)
+    /* The registries are combined up a binomial tree rather than all being
+     * sent to the root, so the number of messages any one rank handles is
+     * logarithmic in the number of ranks. Each rank folds its children's
+     * partial merges into its own registry before passing the result on.
+     */
+    const unsigned int rel = (rank - root + size) % size;
+    unsigned int mask = 1;
+    while (mask < (unsigned int) size && !(rel & mask))
     {
-        for (int slave = 0; slave < size; slave++)
-            if (slave != root)
-            {
-                MPI_Status status;
-                MPI_Probe(MPI_ANY_SOURCE, MLSGPU_TAG_WORK, comm, &status);
-                int length;
-                MPI_Get_count(&status, MPI_CHAR, &length);
-                boost::scoped_array<char> data(new char[length]);
-                MPI_Recv(data.get(), length, MPI_CHAR, status.MPI_SOURCE, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
-
-                std::string statsStr(data.get(), length);
-                std::istringstream statsStream(statsStr);
-                boost::archive::text_iarchive ia(statsStream);
-                Statistics::Registry slaveRegistry;
-                ia >> slaveRegistry;
-                Statistics::Registry::getInstance().merge(slaveRegistry);
-            }
-        writeStatistics(vm);
+        const unsigned int childRel = rel | mask;
+        if (childRel < (unsigned int) size)
+        {
+            const int child = int((childRel + root) % size);
+            MPI_Status status;
+            MPI_Probe(child, MLSGPU_TAG_WORK, comm, &status);
+            int length;
+            MPI_Get_count(&status, MPI_CHAR, &length);
+            boost::scoped_array<char> data(new char[length]);
+            MPI_Recv(data.get(), length, MPI_CHAR, child, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+
+            std::string statsStr(data.get(), length);
+            std::istringstream statsStream(statsStr);
+            boost::archive::text_iarchive ia(statsStream);
+            Statistics::Registry childRegistry;
+            ia >> childRegistry;
+            Statistics::Registry::getInstance().merge(childRegistry);
+        }
+        mask <<= 1;
     }
+
+    if (rel == 0)
+        writeStatistics(vm);
     else
     {
+        const int parent = int(((rel & ~mask) + root) % size);
         std::ostringstream statsStream;
         boost::archive::text_oarchive oa(statsStream);
         oa << Statistics::Registry::getInstance();
         std::string statsStr = statsStream.str();
         MPI_Send(const_cast<char *>(statsStr.data()), statsStr.length(), MPI_CHAR,
-                 root, MLSGPU_TAG_WORK, comm);
+                 parent, MLSGPU_TAG_WORK, comm);
     }
 }
 
@@ -360,6 +594,7 @@ static std::size_t runResume(
 
         boost::scoped_ptr<FastPly::WriterMPI> writer(new FastPly::WriterMPI);
         setWriterComments(vm, *writer);
+        writer->setNormals(vm.count(Option::normals));
         boost::scoped_ptr<MesherBase> mesher(new OOCMesherMPI(*writer, getNamer(vm, out), comm, root));
         setMesherOptions(vm, *mesher);
 
@@ -403,11 +638,24 @@ static std::size_t run(
     if (rank == root)
         grandTotalTimer.reset(new Statistics::Timer("run.time"));
 
+    /* Each rank governs the disks of its own machine (co-located ranks
+     * sample the same counters, which is redundant but harmless).
+     */
+    boost::scoped_ptr<Diskstats::Governor> ioGovernor;
+    if (vm.count(Option::adaptiveIO))
+        ioGovernor.reset(new Diskstats::Governor(0.5));
+
     /* Work out how many slaves there will be */
     int isSlave = devices.empty() ? 0 : 1;
     vector<int> slaveMask(size);
     MPI_Gather(&isSlave, 1, MPI_INT, &slaveMask[0], 1, MPI_INT, root, comm);
 
+    /* Collective: every rank must participate, with non-slaves exposing an
+     * empty window. Declared here so that it outlives the slave thread and
+     * is freed (collectively) at the end of the run.
+     */
+    ScatterWindow scatterWindow(scatterComm, isSlave != 0);
+
     Splats splats;
     doComputeBlobs(mainWorker, vm, splats,
                    boost::bind(&SplatSet::FastBlobSetMPI<SplatSet::FileSet>::computeBlobs,
@@ -418,12 +666,26 @@ static std::size_t run(
     {
         slaveThread.reset(new boost::thread(Slave(
                     devices, vm, splats,
-                    scatterComm, root, gatherComm, root,
+                    scatterComm, root, scatterWindow, gatherComm, root,
                     progressComm, root)));
     }
 
+    /* Every rank runs a relay in the progress reduction tree, so that
+     * updates are combined on the way up instead of all funnelling into the
+     * root. The root's relay is the master's ProgressMPI instance below.
+     */
+    boost::scoped_ptr<ProgressMPI> progressRelay;
+    boost::scoped_ptr<boost::thread> progressRelayThread;
+    if (rank != root)
+    {
+        progressRelay.reset(new ProgressMPI(NULL, splats.numSplats(), progressComm, root));
+        progressRelayThread.reset(new boost::thread(
+            boost::bind(&ProgressMPI::operator(), progressRelay.get(), (unsigned int) isSlave)));
+    }
+
     boost::scoped_ptr<FastPly::WriterMPI> writer(new FastPly::WriterMPI);
     setWriterComments(vm, *writer);
+    writer->setNormals(vm.count(Option::normals));
     boost::scoped_ptr<MesherBase> mesher(new OOCMesherMPI(*writer, getNamer(vm, out), comm, root));
     setMesherOptions(vm, *mesher);
 
@@ -433,8 +695,14 @@ static std::size_t run(
         const std::size_t maxLoadSplats = getMaxLoadSplats(vm);
         const std::size_t memMesh = vm[Option::memMesh].as<Capacity>();
 
-        const Grid grid = splats.getBoundingGrid();
-        const unsigned int chunkCells = postprocessGrid(vm, grid);
+        Grid grid = splats.getBoundingGrid();
+        {
+            double worldOffset[3];
+            splats.getWorldOffset(worldOffset);
+            grid.setWorldOffset(worldOffset);
+        }
+        const unsigned int chunkCells = postprocessGrid(vm, grid, splats.numSplats());
+        mesher->setChunkGrid(grid, chunkCells);
 
         {
             // Open a scope so that objects will be released before finalization
@@ -442,27 +710,24 @@ static std::size_t run(
 
             MesherGroup mesherGroup(memMesh);
             ReceiverGather<MesherGroup::WorkItem, MesherGroup> receiver("receiver", mesherGroup, gatherComm, numSlaves);
-            Scatter scatter(scatterComm, mainWorker);
+            Scatter scatter(scatterComm, scatterWindow, mainWorker);
             BucketCollector collector(maxLoadSplats, scatter);
 
             initTimer.reset();
 
-            for (unsigned int pass = 0; pass < mesher->numPasses(); pass++)
             {
-                Log::log[Log::info] << "\nPass " << pass + 1 << "/" << mesher->numPasses() << endl;
-                ostringstream passName;
-                passName << "pass" << pass + 1 << ".time";
-                Statistics::Timer timer(passName.str());
+                Statistics::Timer timer("pass1.time");
 
                 ProgressDisplay progress(splats.numSplats(), Log::log[Log::info]);
                 ProgressMPI progressMPI(&progress, splats.numSplats(), progressComm, 0);
 
-                mesherGroup.setInputFunctor(mesher->functor(pass));
+                mesherGroup.setInputFunctor(mesher->functor());
 
                 // Start threads
                 boost::thread receiverThread(boost::ref(receiver));
                 mesherGroup.start();
-                boost::thread progressThread(boost::ref(progressMPI));
+                boost::thread progressThread(boost::bind(
+                    &ProgressMPI::operator(), &progressMPI, (unsigned int) isSlave));
 
                 try
                 {
@@ -476,7 +741,6 @@ static std::size_t run(
                     scatter.stop(numSlaves);
                     receiverThread.join();
                     mesherGroup.stop();
-                    progressMPI.sync();
                     progressThread.interrupt();
                     progressThread.join();
                     throw;
@@ -490,13 +754,14 @@ static std::size_t run(
                 scatter.stop(numSlaves);
                 receiverThread.join();
                 mesherGroup.stop();
-                progressMPI.sync();
                 progressThread.join();
             }
         }
     }
     if (slaveThread)
         slaveThread->join();
+    if (progressRelayThread)
+        progressRelayThread->join();
 
     std::size_t ret = mesher->write(mainWorker, &Log::log[Log::info]);
 
@@ -523,6 +788,10 @@ int main(int argc, char **argv)
     Log::log.setLevel(Log::info);
     po::variables_map vm = processOptions(argc, argv, true);
     setLogLevel(vm);
+    /* Every rank parses the same command line, so this is consistent
+     * across the job without further negotiation.
+     */
+    Serialize::setCompression(vm.count(Option::mpiCompress));
 
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
@@ -533,6 +802,26 @@ int main(int argc, char **argv)
     int totalDevices;
     MPI_Reduce(&numDevices, &totalDevices, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
 
+    if (vm.count(Option::autoParams))
+    {
+        /* Every rank must agree on the derived parameters, so the capability
+         * minima are reduced across the whole job before applying them.
+         * Ranks without devices contribute the identity for MPI_MIN.
+         */
+        unsigned long long caps[3];
+        std::fill(caps, caps + 3, std::numeric_limits<unsigned long long>::max());
+        BOOST_FOREACH(const cl::Device &device, devices)
+        {
+            caps[0] = std::min(caps[0], (unsigned long long) device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>());
+            caps[1] = std::min(caps[1], (unsigned long long) device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>());
+            caps[2] = std::min(caps[2], (unsigned long long) device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>());
+        }
+        unsigned long long minCaps[3];
+        MPI_Allreduce(caps, minCaps, 3, MPI_UNSIGNED_LONG_LONG, MPI_MIN, MPI_COMM_WORLD);
+        setAutoParameters(vm, minCaps[0], minCaps[1], minCaps[2]);
+    }
+    setMemoryBudget(vm, true);
+
     if (rank == 0)
     {
         if (totalDevices == 0)
@@ -593,7 +882,7 @@ int main(int argc, char **argv)
         {
             ostringstream name;
             name << vm[Option::timeplot].as<string>() << "." << rank;
-            Timeplot::init(name.str());
+            Timeplot::init(name.str(), vm.count(Option::timeplotBinary) > 0);
         }
 
         std::size_t filesWritten;
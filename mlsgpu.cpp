@@ -30,6 +30,13 @@
 # define __CL_ENABLE_EXCEPTIONS
 #endif
 
+#if HAVE_AF_UNIX
+# include <sys/socket.h>
+# include <sys/un.h>
+# include <unistd.h>
+# include <cstring>
+# include <cerrno>
+#endif
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
@@ -37,11 +44,17 @@
 #include <boost/thread/thread.hpp>
 #include <boost/progress.hpp>
 #include <boost/ref.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/exception/all.hpp>
+#include <cerrno>
 #include "src/tr1_unordered_map.h"
 #include <iostream>
+#include <sstream>
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <iterator>
 #include <limits>
 #include "src/misc.h"
 #include "src/clh.h"
@@ -60,18 +73,99 @@
 #include "src/provenance.h"
 #include "src/statistics.h"
 #include "src/statistics_cl.h"
+#include "src/statistics_monitor.h"
+#include "src/control_server.h"
 #include "src/work_queue.h"
+#include "src/cancel.h"
 #include "src/workers.h"
 #include "src/progress.h"
 #include "src/mesh_filter.h"
 #include "src/timeplot.h"
 #include "src/bucket_collector.h"
 #include "src/bucket_loader.h"
+#include "src/incremental.h"
+#include "src/planner.h"
+#include "src/diskstats.h"
 #include "src/mlsgpu_core.h"
 
 namespace po = boost::program_options;
 using namespace std;
 
+namespace
+{
+
+/**
+ * Callback for @ref BucketCollector::setCheckpoint. It drains the
+ * asynchronous pipeline, snapshots the mesher state, then restarts the
+ * pipeline so that the bucket walk can continue.
+ */
+class RunCheckpoint
+{
+private:
+    Timeplot::Worker &tworker;
+    MesherBase &mesher;
+    SlaveWorkers &slaveWorkers;
+    MesherGroup &mesherGroup;
+    SplatSet::FileSet &splats;
+    const Grid &grid;
+    const boost::filesystem::path path;
+    ProgressDisplay *progress;    ///< Progress meter for the current pass
+
+public:
+    typedef void result_type;
+
+    RunCheckpoint(
+        Timeplot::Worker &tworker, MesherBase &mesher,
+        SlaveWorkers &slaveWorkers, MesherGroup &mesherGroup,
+        SplatSet::FileSet &splats, const Grid &grid,
+        const boost::filesystem::path &path)
+        : tworker(tworker), mesher(mesher), slaveWorkers(slaveWorkers),
+        mesherGroup(mesherGroup), splats(splats), grid(grid), path(path),
+        progress(NULL)
+    {
+    }
+
+    /// Set the progress meter for the current pass
+    void setProgress(ProgressDisplay *progress) { this->progress = progress; }
+
+    void operator()(ChunkId::gen_type completedGen)
+    {
+        /* Stopping in pipeline order guarantees that every bin flushed so
+         * far has reached the mesher before the snapshot is taken.
+         */
+        slaveWorkers.stop();
+        mesherGroup.stop();
+        mesher.checkpointRun(tworker, path, completedGen, progress->count());
+        mesherGroup.start();
+        slaveWorkers.start(splats, grid, progress);
+        Log::log[Log::info] << "\nCheckpoint written after chunk generation " << completedGen << "\n";
+    }
+};
+
+/**
+ * Describe the pipeline stages to @ref Planner::report, reading the current
+ * totals of the stage statistics. It is called both before and after the
+ * sampled pass so that only the pass's contribution is reported (statistics
+ * accumulate across jobs in daemon mode).
+ */
+static std::vector<Planner::Stage> planStages(std::size_t numDevices, std::size_t deviceThreads)
+{
+    using Planner::statTotal;
+
+    std::vector<Planner::Stage> stages;
+    stages.push_back(Planner::Stage("load",
+        statTotal("bucket.loader.compute")
+        + statTotal("bucket.loader.load")
+        + statTotal("bucket.loader.write"), 1));
+    stages.push_back(Planner::Stage("copy", statTotal("copy.compute"), 1));
+    stages.push_back(Planner::Stage("device", statTotal("device.compute"),
+        numDevices * deviceThreads, Option::deviceThreads, numDevices));
+    stages.push_back(Planner::Stage("mesher", statTotal("mesher.compute"), 1));
+    return stages;
+}
+
+} // anonymous namespace
+
 /**
  * Main execution.
  *
@@ -95,20 +189,29 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
     {
         Statistics::Timer grandTotalTimer("run.time");
 
+        boost::scoped_ptr<Diskstats::Governor> ioGovernor;
+        if (vm.count(Option::adaptiveIO))
+            ioGovernor.reset(new Diskstats::Governor(0.5));
+
         const WriterType writerType = vm[Option::writer].as<Choice<WriterTypeWrapper> >();
         boost::scoped_ptr<FastPly::Writer> writer(new FastPly::Writer(writerType));
         setWriterComments(vm, *writer);
+        writer->setNormals(vm.count(Option::normals));
 
         boost::scoped_ptr<MesherBase> mesher(new OOCMesher(*writer, getNamer(vm, out)));
         setMesherOptions(vm, *mesher);
 
+        boost::filesystem::path resumePath;
         if (vm.count(Option::resume))
+            resumePath = vm[Option::resume].as<std::string>();
+
+        if (!resumePath.empty() && checkpointIsComplete(resumePath))
         {
-            boost::filesystem::path path(vm[Option::resume].as<std::string>());
-            ret = mesher->resume(mainWorker, path, &Log::log[Log::info]);
+            ret = mesher->resume(mainWorker, resumePath, &Log::log[Log::info]);
         }
         else
         {
+            ChunkHashes oldHashes, newHashes;
             {
                 // Open a scope so that objects will be released before finalization
 
@@ -119,30 +222,123 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                 SlaveWorkers slaveWorkers(
                     mainWorker, vm, devices,
                     makeOutputGenerator(mesherGroup));
-                BucketCollector collector(maxLoadSplats, boost::ref(*slaveWorkers.loader));
+                boost::scoped_ptr<Planner::Sampler> planSampler;
+                if (vm.count(Option::plan))
+                    planSampler.reset(new Planner::Sampler(
+                        boost::ref(*slaveWorkers.loader),
+                        vm[Option::planFraction].as<double>()));
+                BucketCollector collector(maxLoadSplats,
+                    planSampler
+                    ? BucketCollector::Functor(boost::ref(*planSampler))
+                    : BucketCollector::Functor(boost::ref(*slaveWorkers.loader)));
+                collector.setBudget(boost::bind(&SlaveWorkers::collectorBudget,
+                                                &slaveWorkers, maxLoadSplats));
 
                 Splats splats;
+                splats.setComputeThreads(vm[Option::bboxThreads].as<int>());
+                if (vm.count(Option::splatCache))
+                    splats.setSplatCache(true);
+                if (vm.count(Option::blobCache))
+                    splats.setBlobCache(vm[Option::blobCache].as<std::string>());
                 doComputeBlobs(mainWorker, vm, splats,
                                boost::bind(&Splats::computeBlobs, &splats, _1, _2, &Log::log[Log::info], true));
                 Grid grid = splats.getBoundingGrid();
-                unsigned int chunkCells = postprocessGrid(vm, grid);
+                {
+                    double worldOffset[3];
+                    splats.getWorldOffset(worldOffset);
+                    grid.setWorldOffset(worldOffset);
+                }
+                if (vm.count(Option::tileBox))
+                    clampGridToTileBox(vm, grid);
+                unsigned int chunkCells = postprocessGrid(vm, grid, splats.numSplats());
+                mesher->setChunkGrid(grid, chunkCells);
+
+                collector.setPrefetch(splats);
+
+                boost::scoped_ptr<boost::filesystem::ofstream> journal;
+                if (vm.count(Option::journal))
+                {
+                    const boost::filesystem::path path(vm[Option::journal].as<string>());
+                    journal.reset(new boost::filesystem::ofstream(path));
+                    if (!*journal)
+                    {
+                        throw boost::enable_error_info(std::ios::failure("Could not open file"))
+                            << boost::errinfo_errno(errno)
+                            << boost::errinfo_file_name(path.string());
+                    }
+                    collector.setJournal(journal.get());
+                }
+                if (vm.count(Option::repair))
+                    collector.setRepair(parseRepairChunks(vm));
+
+                if (vm.count(Option::incremental))
+                {
+                    oldHashes.load(vm[Option::incremental].as<string>());
+                    collector.setIncremental(splats, grid, oldHashes, newHashes, getNamer(vm, out));
+                }
+
+                ProgressMeter::size_type resumeProgress = 0;
+                if (!resumePath.empty())
+                {
+                    const ChunkId::gen_type gen = mesher->resumeRun(mainWorker, resumePath, resumeProgress);
+                    collector.setResume(gen);
+                    Log::log[Log::info] << "Resuming after chunk generation " << gen << "\n";
+                }
+
+                boost::scoped_ptr<RunCheckpoint> runCheckpoint;
+                if (vm.count(Option::checkpointInterval))
+                {
+                    runCheckpoint.reset(new RunCheckpoint(
+                        mainWorker, *mesher, slaveWorkers, mesherGroup, splats, grid,
+                        vm[Option::checkpoint].as<std::string>()));
+                    collector.setCheckpoint(boost::ref(*runCheckpoint),
+                                            vm[Option::checkpointInterval].as<double>());
+                }
 
                 initTimer.reset();
 
-                for (unsigned int pass = 0; pass < mesher->numPasses(); pass++)
+                std::vector<Planner::Stage> planBase;
+                if (planSampler)
+                    planBase = planStages(devices.size(),
+                                          vm[Option::deviceThreads].as<int>());
+                const Timer::timestamp planStart = Timer::currentTime();
+
                 {
-                    Log::log[Log::info] << "\nPass " << pass + 1 << "/" << mesher->numPasses() << endl;
-                    ostringstream passName;
-                    passName << "pass" << pass + 1 << ".time";
-                    Statistics::Timer timer(passName.str());
+                    Statistics::Timer timer("pass1.time");
 
                     ProgressDisplay progress(splats.numSplats(), Log::log[Log::info]);
+                    progress += resumeProgress;
+                    collector.setProgress(&progress);
+                    if (runCheckpoint)
+                        runCheckpoint->setProgress(&progress);
+
+                    mesherGroup.setInputFunctor(mesher->functor());
 
-                    mesherGroup.setInputFunctor(mesher->functor(pass));
+                    boost::scoped_ptr<ControlServer> control;
+                    if (vm.count(Option::control))
+                    {
+                        control.reset(new ControlServer(vm[Option::control].as<string>()));
+                        control->addGroup("copy", *slaveWorkers.copyGroup);
+                        for (std::size_t i = 0; i < slaveWorkers.deviceWorkerGroups.size(); i++)
+                        {
+                            std::ostringstream name;
+                            name << "device" << i;
+                            control->addGroup(name.str(), slaveWorkers.deviceWorkerGroups[i]);
+                        }
+                        control->addGroup("mesher", mesherGroup);
+                        control->setScheduler(slaveWorkers.scheduler.get());
+                    }
 
                     // Start threads
                     slaveWorkers.start(splats, grid, &progress);
                     mesherGroup.start();
+                    /* Served only once the groups are started, since start()
+                     * releases every parked worker and would clobber an
+                     * early command; stopped by the destructor at the end of
+                     * the pass.
+                     */
+                    if (control)
+                        control->start();
 
                     try
                     {
@@ -150,11 +346,24 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                     }
                     catch (...)
                     {
-                        // This can't be handled using unwinding, because that would operate in
-                        // the wrong order
-                        collector.flush();
+                        /* This can't be handled using unwinding, because that would operate in
+                         * the wrong order. Cancelling first turns the stops below from a full
+                         * drain of the pipeline (minutes on a large job) into a join that
+                         * completes in roughly one work item's time; the output is about to
+                         * be abandoned, so there is nothing worth draining for.
+                         */
+                        Cancel::request();
+                        try
+                        {
+                            collector.flush();
+                        }
+                        catch (cancelled &)
+                        {
+                            // the flush fed a cancelled queue; nothing worth keeping
+                        }
                         slaveWorkers.stop();
                         mesherGroup.stop();
+                        Cancel::reset(); // so a daemon can serve its next job
                         throw;
                     }
 
@@ -166,6 +375,17 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                     slaveWorkers.stop();
                     mesherGroup.stop();
                 }
+
+                if (planSampler)
+                {
+                    const double planElapsed = Timer::getElapsed(planStart, Timer::currentTime());
+                    std::vector<Planner::Stage> stages = planStages(
+                        devices.size(), vm[Option::deviceThreads].as<int>());
+                    for (std::size_t i = 0; i < stages.size(); i++)
+                        stages[i].busyTime -= planBase[i].busyTime;
+                    Planner::report(Log::log[Log::info], *planSampler, planElapsed,
+                                    stages, maxLoadSplats);
+                }
             }
 
             if (vm.count(Option::checkpoint))
@@ -173,8 +393,11 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
                 const boost::filesystem::path path(vm[Option::checkpoint].as<std::string>());
                 mesher->checkpoint(mainWorker, path);
             }
-            else
+            else if (!vm.count(Option::plan))
                 ret = mesher->write(mainWorker, &Log::log[Log::info]);
+
+            if (vm.count(Option::incremental))
+                newHashes.save(vm[Option::incremental].as<string>());
         }
     } // ends scope for grandTotalTimer
 
@@ -183,6 +406,172 @@ static std::size_t run(const std::vector<std::pair<cl::Context, cl::Device> > &d
     return ret;
 }
 
+#if HAVE_AF_UNIX
+
+namespace
+{
+
+/// Write all of @a reply to @a fd, ignoring errors (the client may have gone)
+static void daemonReply(int fd, const std::string &reply)
+{
+    std::size_t done = 0;
+    while (done < reply.size())
+    {
+        ssize_t bytes = write(fd, reply.data() + done, reply.size() - done);
+        if (bytes <= 0)
+            return;
+        done += bytes;
+    }
+}
+
+/**
+ * Read one newline-terminated line from @a fd.
+ *
+ * @return Whether a line (possibly terminated by EOF instead of newline) was read.
+ */
+static bool daemonReadLine(int fd, std::string &line)
+{
+    line.clear();
+    char buffer[4096];
+    while (true)
+    {
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes < 0)
+            return false;
+        if (bytes == 0)
+            return !line.empty();
+        for (ssize_t i = 0; i < bytes; i++)
+        {
+            if (buffer[i] == '\n')
+                return true;
+            line += buffer[i];
+        }
+    }
+}
+
+/**
+ * Run one job submitted to the daemon and produce the status line for the
+ * client.
+ *
+ * @param devices  Devices corresponding to the warm contexts.
+ * @param cd       Warm contexts created at daemon startup.
+ * @param line     Whitespace-separated job arguments.
+ * @return A single-line reply: <tt>ok &lt;files&gt;</tt> or an error message.
+ */
+static std::string daemonJob(
+    const std::vector<cl::Device> &devices,
+    const std::vector<std::pair<cl::Context, cl::Device> > &cd,
+    const std::string &line)
+{
+    std::vector<std::string> args;
+    std::istringstream tokens(line);
+    std::copy(std::istream_iterator<std::string>(tokens),
+              std::istream_iterator<std::string>(), std::back_inserter(args));
+
+    try
+    {
+        po::variables_map vm = processOptions(args, false);
+        setAutoParameters(vm, devices);
+        setMemoryBudget(vm, false);
+        validateOptions(vm, false);
+
+        CLH::ResourceUsage totalUsage = resourceUsage(vm);
+        BOOST_FOREACH(const cl::Device &device, devices)
+            validateDevice(device, totalUsage);
+
+        std::size_t filesWritten = run(cd, vm[Option::outputFile].as<string>(), vm);
+        std::ostringstream reply;
+        reply << "ok " << filesWritten;
+        return reply.str();
+    }
+    catch (cl::Error &e)
+    {
+        std::ostringstream reply;
+        reply << "error: OpenCL error in " << e.what() << " (" << e.err() << ")";
+        return reply.str();
+    }
+    catch (std::exception &e)
+    {
+        return std::string("error: ") + e.what();
+    }
+}
+
+/**
+ * Serve jobs submitted over a local socket until told to quit. Each
+ * connection carries one job: a newline-terminated line of command-line
+ * arguments in the same syntax as a normal invocation (excluding the program
+ * name, and with no whitespace within an argument --- use @c --response-file
+ * for awkward paths). The daemon replies with a single status line and closes
+ * the connection. The line @c quit shuts the daemon down.
+ *
+ * The point of the daemon is to amortize startup over many small jobs: the
+ * OpenCL contexts stay warm for the life of the process, compiled kernels hit
+ * the program binary cache after the first job, and jobs sharing a
+ * @c --blob-cache skip the bounding-box pass. Jobs run one at a time, in
+ * arrival order, since they contend for the same devices. Statistics
+ * accumulate across jobs, so per-job statistics output includes earlier jobs.
+ *
+ * @param devices   Devices corresponding to the warm contexts.
+ * @param cd        Warm contexts created at startup.
+ * @param path      Filesystem path for the listening socket.
+ * @return Process exit status.
+ */
+static int runDaemon(
+    const std::vector<cl::Device> &devices,
+    const std::vector<std::pair<cl::Context, cl::Device> > &cd,
+    const std::string &path)
+{
+    sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        cerr << "Socket path `" << path << "' is too long\n";
+        return 1;
+    }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0
+        || bind(listenFd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0
+        || listen(listenFd, 4) < 0)
+    {
+        cerr << "Could not listen on `" << path << "': " << std::strerror(errno) << "\n";
+        if (listenFd >= 0)
+            close(listenFd);
+        return 1;
+    }
+
+    Log::log[Log::info] << "Daemon ready; submit jobs to " << path << "\n";
+    bool quit = false;
+    while (!quit)
+    {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        std::string line;
+        if (daemonReadLine(fd, line))
+        {
+            if (line == "quit")
+            {
+                daemonReply(fd, "ok\n");
+                quit = true;
+            }
+            else
+                daemonReply(fd, daemonJob(devices, cd, line) + "\n");
+        }
+        close(fd);
+    }
+    close(listenFd);
+    unlink(path.c_str());
+    return 0;
+}
+
+} // anonymous namespace
+
+#endif // HAVE_AF_UNIX
+
 int main(int argc, char **argv)
 {
     Log::log.setLevel(Log::info);
@@ -190,6 +579,28 @@ int main(int argc, char **argv)
     po::variables_map vm = processOptions(argc, argv, false);
     setLogLevel(vm);
 
+    /* Pre-staging runs before the job has any GPUs allocated, so it is
+     * dispatched before OpenCL is touched at all.
+     */
+    if (vm.count(Option::preStage))
+    {
+        try
+        {
+            doPreStage(vm);
+        }
+        catch (std::ios::failure &e)
+        {
+            reportException(e);
+            return 1;
+        }
+        catch (std::runtime_error &e)
+        {
+            reportException(e);
+            return 1;
+        }
+        return 0;
+    }
+
     std::vector<cl::Device> devices = CLH::findDevices(vm);
     if (devices.empty())
     {
@@ -197,6 +608,9 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    setAutoParameters(vm, devices);
+    setMemoryBudget(vm, false);
+
     try
     {
         validateOptions(vm, false);
@@ -233,10 +647,29 @@ int main(int argc, char **argv)
     try
     {
         if (vm.count(Option::timeplot))
-            Timeplot::init(vm[Option::timeplot].as<string>());
+            Timeplot::init(vm[Option::timeplot].as<string>(),
+                           vm.count(Option::timeplotBinary) > 0);
+
+        boost::scoped_ptr<Statistics::Monitor> monitor;
+        if (vm.count(Option::statisticsSnapshot))
+            monitor.reset(new Statistics::Monitor(
+                vm[Option::statisticsSnapshot].as<string>(),
+                vm[Option::statisticsSnapshotInterval].as<double>()));
+
+        if (vm.count(Option::daemon))
+        {
+#if HAVE_AF_UNIX
+            return runDaemon(devices, cd, vm[Option::daemon].as<string>());
+#else
+            cerr << "Daemon mode requires local socket support, which is not available\n";
+            return 1;
+#endif
+        }
 
         std::size_t filesWritten = run(cd, vm[Option::outputFile].as<string>(), vm);
-        if (filesWritten == 0)
+        if (vm.count(Option::plan))
+            ; // the planning report replaces the output
+        else if (filesWritten == 0)
             Log::log[Log::warn] << "Warning: no output files written!\n";
         else if (filesWritten == 1)
             Log::log[Log::info] << "1 output file written.\n";
@@ -35,6 +35,9 @@
 #include <vector>
 #include <string>
 #include <list>
+#include <map>
+#include <functional>
+#include <utility>
 #include <boost/multi_array.hpp>
 #include "tr1_unordered_map.h"
 #include "tr1_unordered_set.h"
@@ -72,6 +75,15 @@ private:
      */
     Statistics::Peak *allUsage;
 
+    /**
+     * The statistic aggregating usage across a whole subsystem (e.g. all the
+     * containers belonging to the mesher). Because all the allocators of a
+     * subsystem share one statistic, its peak is a true high watermark of
+     * their concurrent usage, not a sum of individual peaks. It may be
+     * @c NULL, in which case no subsystem tracking is done.
+     */
+    Statistics::Peak *groupUsage;
+
 public:
     /// Underlying allocator type
     typedef BaseAllocator base_type;
@@ -84,19 +96,24 @@ public:
      *                tracking is done.
      * @param allUsage The statistic that will track total memory usage. It is
      *                functionally equivalent to @a usage.
+     * @param groupUsage The statistic that will track usage for the owning
+     *                subsystem, shared between its allocators. It is
+     *                functionally equivalent to @a usage.
      * @param base    The underlying allocator providing the real functionality.
      */
     explicit Allocator(Statistics::Peak *usage = NULL,
                        Statistics::Peak *allUsage = NULL,
+                       Statistics::Peak *groupUsage = NULL,
                        const BaseAllocator &base = BaseAllocator()) throw()
-        : BaseAllocator(base), usage(usage), allUsage(allUsage) {}
+        : BaseAllocator(base), usage(usage), allUsage(allUsage), groupUsage(groupUsage) {}
 
     /// Copy and conversion constructors
     template<typename B>
     Allocator(const Allocator<B> &b) :
         BaseAllocator(static_cast<const B &>(b)),
         usage(b.usage),
-        allUsage(b.allUsage) {}
+        allUsage(b.allUsage),
+        groupUsage(b.groupUsage) {}
 
     /// Interface requirement
     template<typename U> struct rebind
@@ -114,6 +131,8 @@ public:
             *usage += n * sizeof(typename BaseAllocator::value_type);
         if (allUsage != NULL)
             *allUsage += n * sizeof(typename BaseAllocator::value_type);
+        if (groupUsage != NULL)
+            *groupUsage += n * sizeof(typename BaseAllocator::value_type);
         return ans;
     }
 
@@ -128,6 +147,8 @@ public:
             *usage += n * sizeof(typename BaseAllocator::value_type);
         if (allUsage != NULL)
             *allUsage += n * sizeof(typename BaseAllocator::value_type);
+        if (groupUsage != NULL)
+            *groupUsage += n * sizeof(typename BaseAllocator::value_type);
         return ans;
     }
 
@@ -139,6 +160,8 @@ public:
             *usage -= n * sizeof(typename BaseAllocator::value_type);
         if (allUsage != NULL)
             *allUsage -= n * sizeof(typename BaseAllocator::value_type);
+        if (groupUsage != NULL)
+            *groupUsage -= n * sizeof(typename BaseAllocator::value_type);
     }
 
     /// Manually record an allocation that bypassed this allocator
@@ -148,6 +171,8 @@ public:
             *usage += bytes;
         if (allUsage != NULL)
             *allUsage += bytes;
+        if (groupUsage != NULL)
+            *groupUsage += bytes;
     }
 
     /// Manually record a deallocation that matches @ref recordAllocate
@@ -157,6 +182,8 @@ public:
             *usage -= bytes;
         if (allUsage != NULL)
             *allUsage -= bytes;
+        if (groupUsage != NULL)
+            *groupUsage -= bytes;
     }
 
     template<typename A, typename B>
@@ -169,6 +196,7 @@ bool operator==(const Allocator<A> &a, const Allocator<B> &b)
 {
     return a.usage == b.usage
         && a.allUsage == b.allUsage
+        && a.groupUsage == b.groupUsage
         && static_cast<const A &>(a) == static_cast<const B &>(b);
 }
 
@@ -182,6 +210,14 @@ bool operator!=(const Allocator<A> &a, const Allocator<B> &b)
  * Takes a statistic name and generates an allocator that uses a statistic with
  * that name from the default registry, as well as a statistic called @c mem.all
  * from the default registry.
+ *
+ * Names of the form <code>mem.&lt;subsystem&gt;&lt;sep&gt;&lt;detail&gt;</code>
+ * (where the separator is a @c . or @c :) additionally share a statistic
+ * called <code>mem.&lt;subsystem&gt;.all</code> with all other allocators of
+ * the same subsystem. Its peak value in the statistics output is a live high
+ * watermark of the subsystem's concurrent usage, which is more useful for
+ * memory budgeting than the individual peaks (which need not have occurred at
+ * the same time).
  */
 template<typename Alloc>
 Alloc makeAllocator(const std::string &name)
@@ -190,7 +226,20 @@ Alloc makeAllocator(const std::string &name)
     Statistics::Peak &allStat = registry.getStatistic<Statistics::Peak>("mem.all");
     Statistics::Peak &myStat = registry.getStatistic<Statistics::Peak>(name);
 
-    return Alloc(&myStat, &allStat);
+    Statistics::Peak *groupStat = NULL;
+    const std::string prefix = "mem.";
+    if (name.substr(0, prefix.size()) == prefix)
+    {
+        const std::string::size_type sep = name.find_first_of(".:", prefix.size());
+        if (sep != std::string::npos)
+        {
+            const std::string groupName = name.substr(0, sep) + ".all";
+            if (groupName != name) // don't count twice in a stat that is its own group
+                groupStat = &registry.getStatistic<Statistics::Peak>(groupName);
+        }
+    }
+
+    return Alloc(&myStat, &allStat, groupStat);
 }
 
 /**
@@ -245,6 +294,29 @@ public:
         : BaseType(first, last, makeAllocator<Alloc>(allocName)) {}
 };
 
+/**
+ * Wrapper around @c std::map that uses @ref Statistics::Allocator.
+ * @see @ref Statistics::Container
+ */
+template<
+    typename Key,
+    typename T,
+    typename Compare = std::less<Key>,
+    typename Alloc = Allocator<std::allocator<std::pair<const Key, T> > > >
+class map : public std::map<Key, T, Compare, Alloc>
+{
+private:
+    typedef std::map<Key, T, Compare, Alloc> BaseType;
+public:
+    explicit map(const std::string &allocName, const Compare &comp = Compare())
+        : BaseType(comp, makeAllocator<Alloc>(allocName)) {}
+
+    template<typename InputIterator>
+    map(const std::string &allocName, InputIterator first, InputIterator last,
+        const Compare &comp = Compare())
+        : BaseType(first, last, comp, makeAllocator<Alloc>(allocName)) {}
+};
+
 template<typename T, typename Alloc = Allocator<std::allocator<T> > >
 class PODBuffer : public ::PODBuffer<T, Alloc>
 {
@@ -28,27 +28,274 @@
 # include <config.h>
 #endif
 #include <cstddef>
+#include <ios>
+#include <vector>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/exception/all.hpp>
 #include "binary_io.h"
 #include "work_queue.h"
 #include "worker_group.h"
 #include "circular_buffer.h"
 #include "timeplot.h"
+#include "diskstats.h"
 #include "async_io.h"
 
+#if HAVE_IO_URING_QUEUE_INIT
+# include <liburing.h>
+#endif
+
 namespace detail
 {
 
+#if HAVE_IO_URING_QUEUE_INIT
+
+/// Number of writes that may be in flight per worker
+static const unsigned int uringDepth = 256;
+
+/// State for the io_uring backend of @ref AsyncWriterWorker
+struct UringState
+{
+    io_uring ring;
+
+    /// Resources owned by one in-flight write
+    struct Slot
+    {
+        /// Buffer space to free on completion
+        std::vector<CircularBuffer::Allocation> allocs;
+        boost::shared_ptr<BinaryWriter> out; ///< Keeps the file handle alive
+        /// Data ranges, referenced by the SQE; stable until completion
+        std::vector<struct iovec> iov;
+        BinaryWriter::offset_type offset;    ///< Position in the target file
+        std::size_t total;                   ///< Total bytes across @ref iov
+    };
+
+    Slot slots[uringDepth];
+    std::vector<unsigned int> freeSlots;  ///< Indices of unused slots
+};
+
+#else // !HAVE_IO_URING_QUEUE_INIT
+
+/**
+ * Stub definition so that the worker's @c boost::scoped_ptr member can be
+ * destroyed when the backend is not compiled in (the pointer is always null
+ * in that case).
+ */
+struct UringState
+{
+};
+
+#endif // HAVE_IO_URING_QUEUE_INIT
+
+/**
+ * Maximum total bytes in a coalesced run of writes. Big enough to span a
+ * RAID stripe, small enough that the run does not tie up a large share of
+ * the buffer while it waits to be dispatched.
+ */
+static const std::size_t coalesceBytes = 4 * 1024 * 1024;
+
+/// Maximum number of items in a coalesced run of writes
+static const std::size_t coalesceSlices = 64;
+
+AsyncWriterWorker::AsyncWriterWorker(AsyncWriter &owner)
+    : WorkerBase("asyncwriter", 0), owner(owner), pendingOffset(0), pendingBytes(0)
+{
+#if HAVE_IO_URING_QUEUE_INIT
+    boost::scoped_ptr<UringState> state(new UringState);
+    // An init failure just means an old kernel; fall back to blocking writes
+    if (io_uring_queue_init(uringDepth, &state->ring, 0) == 0)
+    {
+        state->freeSlots.reserve(uringDepth);
+        for (unsigned int i = 0; i < uringDepth; i++)
+            state->freeSlots.push_back(i);
+        uring.swap(state);
+    }
+#endif
+}
+
+AsyncWriterWorker::~AsyncWriterWorker()
+{
+#if HAVE_IO_URING_QUEUE_INIT
+    if (uring)
+        io_uring_queue_exit(&uring->ring);
+#endif
+}
+
+void AsyncWriterWorker::reapCompletions(bool wait)
+{
+#if HAVE_IO_URING_QUEUE_INIT
+    bool first = true;
+    while (true)
+    {
+        io_uring_cqe *cqe;
+        int ret;
+        if (wait && first)
+            ret = io_uring_wait_cqe(&uring->ring, &cqe);
+        else
+            ret = io_uring_peek_cqe(&uring->ring, &cqe);
+        if (ret == -EAGAIN)
+            break;
+        else if (ret == -EINTR)
+            continue;
+        else if (ret != 0)
+            throw boost::enable_error_info(std::ios::failure("io_uring_wait_cqe failed"))
+                << boost::errinfo_errno(-ret);
+        first = false;
+
+        UringState::Slot *slot = static_cast<UringState::Slot *>(io_uring_cqe_get_data(cqe));
+        const int res = cqe->res;
+        io_uring_cqe_seen(&uring->ring, cqe);
+
+        std::size_t done;
+        if (res == -EAGAIN || res == -EINTR)
+            done = 0;       // transient: complete the whole write synchronously
+        else if (res < 0)
+        {
+            throw boost::enable_error_info(std::ios::failure("write failed"))
+                << boost::errinfo_errno(-res)
+                << boost::errinfo_file_name(slot->out->filename());
+        }
+        else
+            done = res;
+        if (done < slot->total)
+        {
+            /* Short write: complete the remainder synchronously. writev
+             * itself loops until everything is written, so one call
+             * suffices.
+             */
+            std::vector<BinaryWriter::Slice> rest;
+            std::size_t skip = done;
+            for (std::size_t i = 0; i < slot->iov.size(); i++)
+            {
+                if (skip >= slot->iov[i].iov_len)
+                {
+                    skip -= slot->iov[i].iov_len;
+                    continue;
+                }
+                BinaryWriter::Slice s;
+                s.data = static_cast<const char *>(slot->iov[i].iov_base) + skip;
+                s.size = slot->iov[i].iov_len - skip;
+                skip = 0;
+                rest.push_back(s);
+            }
+            slot->out->writev(&rest[0], rest.size(), slot->offset + done);
+        }
+
+        for (std::size_t i = 0; i < slot->allocs.size(); i++)
+            owner.buffer.free(slot->allocs[i]);
+        slot->allocs.clear();
+        slot->out.reset();
+        uring->freeSlots.push_back(slot - uring->slots);
+    }
+#else
+    (void) wait;
+#endif
+}
+
+void AsyncWriterWorker::flushPending()
+{
+    if (!pendingOut)
+        return;
+
+#if HAVE_IO_URING_QUEUE_INIT
+    const int fd = pendingOut->fileDescriptor();
+    if (uring && fd >= 0)
+    {
+        reapCompletions(false);
+        /* Bound the in-flight writes by the governor's recommendation (the
+         * full ring depth when no governor is running), so a saturated
+         * shared device sees a shallower queue from us.
+         */
+        const unsigned int depth = Diskstats::writeDepth(uringDepth);
+        while (uringDepth - uring->freeSlots.size() >= depth)
+            reapCompletions(true);
+
+        const unsigned int idx = uring->freeSlots.back();
+        uring->freeSlots.pop_back();
+        UringState::Slot &slot = uring->slots[idx];
+        slot.allocs.swap(pendingAllocs);
+        slot.out = pendingOut;
+        slot.iov.clear();
+        for (std::size_t i = 0; i < pendingSlices.size(); i++)
+        {
+            struct iovec v;
+            v.iov_base = const_cast<void *>(pendingSlices[i].data);
+            v.iov_len = pendingSlices[i].size;
+            slot.iov.push_back(v);
+        }
+        slot.offset = pendingOffset;
+        slot.total = pendingBytes;
+
+        // Cannot fail: there are as many SQEs as slots
+        io_uring_sqe *sqe = io_uring_get_sqe(&uring->ring);
+        MLSGPU_ASSERT(sqe != NULL, state_error);
+        io_uring_prep_writev(sqe, fd, &slot.iov[0], slot.iov.size(), slot.offset);
+        io_uring_sqe_set_data(sqe, &slot);
+        int ret = io_uring_submit(&uring->ring);
+        if (ret < 0)
+            throw boost::enable_error_info(std::ios::failure("io_uring_submit failed"))
+                << boost::errinfo_errno(-ret);
+    }
+    else
+#endif
+    {
+        pendingOut->writev(&pendingSlices[0], pendingSlices.size(), pendingOffset);
+        for (std::size_t i = 0; i < pendingAllocs.size(); i++)
+            owner.buffer.free(pendingAllocs[i]);
+        pendingAllocs.clear();
+    }
+
+    pendingOut.reset();
+    pendingSlices.clear();
+    pendingBytes = 0;
+}
+
 void AsyncWriterWorker::operator()(AsyncWriterItem &item)
 {
     Timeplot::Action timer("write", getTimeplotWorker(), owner.getComputeStat());
-    item.out->write(item.get(), item.count, item.offset);
+
+    /* Flush the pending run if the new item does not extend it, or if
+     * extending it would exceed the size bounds.
+     */
+    if (pendingOut
+        && (pendingOut != item.out
+            || pendingOffset + pendingBytes != item.offset
+            || pendingSlices.size() >= coalesceSlices
+            || pendingBytes + item.count > coalesceBytes))
+        flushPending();
+
+    if (!pendingOut)
+    {
+        pendingOut = item.out;
+        pendingOffset = item.offset;
+    }
+    BinaryWriter::Slice slice;
+    slice.data = item.get();
+    slice.size = item.count;
+    pendingSlices.push_back(slice);
+    pendingAllocs.push_back(item.alloc);
+    pendingBytes += item.count;
+    item.inFlight = true; // the run now owns the buffer space and file reference
+
+    /* The latency bound: only hold the run open while further items are
+     * already queued behind it, so an idle writer never sits on deferred
+     * data. When the queue is backed up the run grows to the size bounds.
+     */
+    if (owner.queueDepth() == 0)
+        flushPending();
 }
 
-AsyncWriterWorker::AsyncWriterWorker(AsyncWriter &owner)
-    : WorkerBase("asyncwriter", 0), owner(owner)
+void AsyncWriterWorker::stop()
 {
+    flushPending();
+#if HAVE_IO_URING_QUEUE_INIT
+    if (uring)
+    {
+        while (uring->freeSlots.size() < uringDepth)
+            reapCompletions(true);
+    }
+#endif
 }
 
 } // namespace detail
@@ -78,6 +325,14 @@ void AsyncWriter::push(
 
 void AsyncWriter::freeItem(boost::shared_ptr<AsyncWriterItem> item)
 {
+    if (item->inFlight)
+    {
+        // The worker now owns the buffer space and the file reference; they
+        // are released when the (possibly coalesced) write completes.
+        item->inFlight = false;
+        item->out.reset();
+        return;
+    }
     buffer.free(item->alloc);
     item->out.reset(); // to release the reference
 }
@@ -31,7 +31,9 @@
 # include <config.h>
 #endif
 #include <cstddef>
+#include <vector>
 #include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
 #include "binary_io.h"
 #include "work_queue.h"
 #include "worker_group.h"
@@ -39,7 +41,11 @@
 #include "timeplot.h"
 
 class AsyncWriter;
-namespace detail { class AsyncWriterWorker; }
+namespace detail
+{
+    class AsyncWriterWorker;
+    struct UringState;
+}
 
 /**
  * Wraps an allocation from @ref AsyncWriter::get.
@@ -60,7 +66,16 @@ private:
     std::size_t count;
     /// Position in the file to write (only defined after @ref AsyncWriter::push)
     BinaryWriter::offset_type offset;
+    /**
+     * Whether ownership of the buffer allocation and the file reference has
+     * been transferred to the worker, either into its pending run of
+     * coalescable writes or into an asynchronously submitted write that has
+     * not yet completed.
+     */
+    bool inFlight;
 public:
+    AsyncWriterItem() : count(0), offset(0), inFlight(false) {}
+
     /**
      * Retrieve pointer to the raw data.
      */
@@ -75,10 +90,55 @@ class AsyncWriterWorker : public WorkerBase
 {
 private:
     ::AsyncWriter &owner;
+
+    /**
+     * State for the io_uring backend. It is null when the backend is not
+     * compiled in or the kernel does not support it, in which case writes
+     * fall back to blocking @ref BinaryWriter::write calls.
+     */
+    boost::scoped_ptr<UringState> uring;
+
+    /**
+     * @name Pending run of coalescable writes
+     * Items whose writes target contiguous offsets of the same file are
+     * accumulated here and dispatched as a single vectored write. The run is
+     * flushed when an item fails to extend it, when it reaches a size bound,
+     * and whenever the input queue drains (so no write is ever held back
+     * while the worker is otherwise idle).
+     * @{
+     */
+    /// Buffer space owned by the run, freed once the write completes
+    std::vector<CircularBuffer::Allocation> pendingAllocs;
+    /// Data ranges of the run, in file order
+    std::vector<BinaryWriter::Slice> pendingSlices;
+    /// Target file of the run; null when the run is empty
+    boost::shared_ptr<BinaryWriter> pendingOut;
+    /// Position of the start of the run in the target file
+    BinaryWriter::offset_type pendingOffset;
+    /// Total bytes across @ref pendingSlices
+    std::size_t pendingBytes;
+    /** @} */
+
+    /**
+     * Dispatch the pending run, if any, through io_uring where possible and
+     * otherwise as a blocking vectored write.
+     */
+    void flushPending();
+
+    /**
+     * Process completions of previously submitted writes, freeing their
+     * buffer space. If @a wait is true, blocks until at least one write
+     * completes (there must be at least one in flight).
+     */
+    void reapCompletions(bool wait);
 public:
     explicit AsyncWriterWorker(AsyncWriter &owner);
+    ~AsyncWriterWorker();
 
     void operator()(AsyncWriterItem &item);
+
+    /// Flush the pending run and drain all outstanding asynchronous writes
+    void stop();
 };
 
 } // namespace detail
@@ -89,6 +149,18 @@ public:
  * @ref get to allocate from the buffer, followed by @ref push once the data
  * have been placed in the buffer.
  *
+ * Workers coalesce queued writes that target contiguous offsets of the same
+ * file into a single vectored write, which cuts the syscall count when a
+ * producer emits many small adjacent pieces (such as the per-clump runs of
+ * @ref OOCMesher's chunk output) and presents large sequential requests to
+ * the storage. Coalescing never delays an idle writer: a run is only held
+ * open while further items are already queued behind it.
+ *
+ * When liburing is available and the target writer is backed by a file
+ * descriptor, the workers submit writes through io_uring, so that many
+ * writes can be in flight per thread without copying the data again.
+ * Otherwise each write is a blocking call on the worker thread.
+ *
  * File handles are passed as shared pointers to facilitate automatic closing
  * of the file after it is no longer referenced.
  */
@@ -141,6 +213,7 @@ public:
 
 private:
     typedef WorkerGroup<AsyncWriterItem, detail::AsyncWriterWorker, AsyncWriter> Base;
+    friend class detail::AsyncWriterWorker;
 
     CircularBuffer buffer;
 };
@@ -0,0 +1,152 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Kernel autotuning harness with a persistent per-device cache.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <CL/cl.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+#include "autotune.h"
+#include "errors.h"
+#include "logging.h"
+#include "statistics.h"
+#include "timer.h"
+
+namespace Autotune
+{
+
+/// Replace whitespace so that fields survive the line-based file format
+static std::string sanitize(const std::string &s)
+{
+    std::string ans = s;
+    for (std::size_t i = 0; i < ans.size(); i++)
+        if (std::isspace(static_cast<unsigned char>(ans[i])))
+            ans[i] = '_';
+    return ans;
+}
+
+std::string deviceFingerprint(const cl::Device &device)
+{
+    cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+    std::ostringstream fingerprint;
+    fingerprint << sanitize(platform.getInfo<CL_PLATFORM_NAME>())
+        << '/' << sanitize(device.getInfo<CL_DEVICE_NAME>())
+        << '/' << device.getInfo<CL_DEVICE_VENDOR_ID>()
+        << '/' << sanitize(device.getInfo<CL_DRIVER_VERSION>());
+    return fingerprint.str();
+}
+
+Cache &defaultCache()
+{
+    static Cache *instance = NULL;
+    if (instance == NULL)
+    {
+        boost::filesystem::path path;
+        const char *env = getenv("MLSGPU_TUNE_CACHE");
+        if (env != NULL && env[0])
+            path = env;
+        else
+        {
+            const char *home = getenv("HOME");
+            if (home != NULL && home[0])
+                path = boost::filesystem::path(home) / ".mlsgpu-tune";
+            else
+                path = ".mlsgpu-tune";
+        }
+        instance = new Cache(path);
+    }
+    return *instance;
+}
+
+std::string tune(
+    Cache &cache,
+    const std::string &fingerprint,
+    const std::string &algorithm,
+    const std::vector<std::string> &candidates,
+    const boost::function<double(const std::string &)> &measure)
+{
+    MLSGPU_ASSERT(!candidates.empty(), std::invalid_argument);
+
+    std::string cached;
+    if (cache.lookup(fingerprint, algorithm, cached)
+        && std::count(candidates.begin(), candidates.end(), cached))
+        return cached;
+
+    Timer timer;
+    std::string best;
+    double bestTime = std::numeric_limits<double>::infinity();
+    for (std::size_t i = 0; i < candidates.size(); i++)
+    {
+        try
+        {
+            double t = measure(candidates[i]);
+            Log::log[Log::debug] << "Tuning " << algorithm << ": "
+                << candidates[i] << " took " << t << '\n';
+            if (t < bestTime)
+            {
+                bestTime = t;
+                best = candidates[i];
+            }
+        }
+        catch (cl::Error &e)
+        {
+            Log::log[Log::debug] << "Tuning " << algorithm << ": "
+                << candidates[i] << " failed: " << e.what() << '\n';
+        }
+    }
+    if (best.empty())
+        throw std::runtime_error("No tuning candidate for " + algorithm + " could be run");
+
+    Statistics::getStatistic<Statistics::Variable>("tune." + algorithm + ".time")
+        .add(timer.getElapsed());
+    Log::log[Log::info] << "Tuned " << algorithm << " to " << best << '\n';
+    cache.update(fingerprint, algorithm, best);
+    return best;
+}
+
+std::string tune(
+    const cl::Device &device,
+    const std::string &algorithm,
+    const std::vector<std::string> &candidates,
+    const boost::function<double(const std::string &)> &measure)
+{
+    return tune(defaultCache(), deviceFingerprint(device), algorithm, candidates, measure);
+}
+
+} // namespace Autotune
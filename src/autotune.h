@@ -0,0 +1,111 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Kernel autotuning harness with a persistent per-device cache.
+ */
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <CL/cl.hpp>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/filesystem/path.hpp>
+#include "keyvalue_cache.h"
+
+/**
+ * Support for tuning kernel launch configurations at runtime. Configurations
+ * are opaque strings chosen by the caller (e.g. an encoded work-group size);
+ * the harness sweeps a candidate list with a caller-provided measurement
+ * function, picks the fastest, and remembers the answer in a cache keyed by
+ * device fingerprint so the sweep only happens on first use of a device.
+ */
+namespace Autotune
+{
+
+/**
+ * Identifies a device for tuning purposes. The fingerprint includes the
+ * platform, device name and driver version, so a driver upgrade triggers
+ * re-tuning. It contains no whitespace.
+ */
+std::string deviceFingerprint(const cl::Device &device);
+
+/**
+ * Persistent store of tuning results, keyed by device fingerprint and
+ * algorithm name (see @ref KeyValueCache for file format and concurrency
+ * guarantees).
+ */
+typedef KeyValueCache Cache;
+
+/**
+ * The cache used by the @ref tune overload that takes a device. The backing
+ * file is taken from the @c MLSGPU_TUNE_CACHE environment variable if set,
+ * otherwise <tt>.mlsgpu-tune</tt> in the user's home directory.
+ */
+Cache &defaultCache();
+
+/**
+ * Select the best configuration from @a candidates, consulting @a cache
+ * first. On a cache miss, @a measure is called for each candidate and must
+ * return the time in seconds for that configuration; candidates that throw
+ * @c cl::Error are skipped (e.g. sizes the device cannot support). The
+ * winner is written back to the cache. A cached value that is no longer in
+ * @a candidates is ignored and the sweep re-runs.
+ *
+ * @param cache        Persistent result store.
+ * @param fingerprint  Device fingerprint (see @ref deviceFingerprint).
+ * @param algorithm    Caller-chosen name for the thing being tuned.
+ * @param candidates   Configurations to try. Must be non-empty.
+ * @param measure      Benchmark returning seconds for one configuration.
+ * @return The fastest (or cached) configuration.
+ *
+ * @throw std::runtime_error if every candidate failed to run.
+ */
+std::string tune(
+    Cache &cache,
+    const std::string &fingerprint,
+    const std::string &algorithm,
+    const std::vector<std::string> &candidates,
+    const boost::function<double(const std::string &)> &measure);
+
+/**
+ * Convenience overload using @ref defaultCache and @ref deviceFingerprint.
+ */
+std::string tune(
+    const cl::Device &device,
+    const std::string &algorithm,
+    const std::vector<std::string> &candidates,
+    const boost::function<double(const std::string &)> &measure);
+
+} // namespace Autotune
+
+#endif /* !AUTOTUNE_H */
@@ -28,12 +28,18 @@
 # include <config.h>
 #endif
 
+#if (HAVE_PWRITEV || HAVE_PREADV) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE 1 /* glibc only declares preadv/pwritev with _GNU_SOURCE */
+#endif
 #if (HAVE_PREAD || HAVE_PWRITE) && !defined(_POSIX_C_SOURCE)
 # define _POSIX_C_SOURCE 200809L
 #endif
 #include <cstddef>
+#include <cstring>
+#include <algorithm>
 #include <limits>
 #include <string>
+#include <vector>
 #include <stdexcept>
 #include <fstream>
 #include <cerrno>
@@ -44,9 +50,26 @@
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/positioning.hpp>
 #include <boost/exception/all.hpp>
+#include <boost/smart_ptr/scoped_array.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#if HAVE_COMPRESS2
+# include <zlib.h>
+#endif
+#if HAVE_MADVISE
+# include <sys/mman.h>
+#endif
+#if HAVE_CURL_EASY_INIT
+# include <list>
+# include <sstream>
+# include <curl/curl.h>
+# include <boost/thread/once.hpp>
+#endif
 #include "errors.h"
+#include "allocator.h"
+#include "logging.h"
 #include "binary_io.h"
 
 #if HAVE_OPEN && HAVE_CLOSE && HAVE_PREAD && HAVE_PWRITE
@@ -59,8 +82,13 @@
 
 #if SYSCALL_IO_POSIX
 # include <fcntl.h>
+# include <stdlib.h>
 # include <sys/types.h>
 # include <sys/stat.h>
+# if HAVE_PWRITEV || HAVE_PREADV
+#  include <sys/uio.h>
+#  include <limits.h>
+# endif
 #endif
 
 #if SYSCALL_IO_WIN32
@@ -93,6 +121,30 @@ void BinaryIO::open(const boost::filesystem::path &filename)
     filename_ = filenameStr;
 }
 
+void BinaryIO::openAppend(const boost::filesystem::path &filename)
+{
+    MLSGPU_ASSERT(!isOpen_, state_error);
+
+    std::string filenameStr = filename.string();
+    try
+    {
+        openAppendImpl(filename);
+    }
+    catch (boost::exception &e)
+    {
+        e << boost::errinfo_file_name(filenameStr);
+        throw;
+    }
+    isOpen_ = true;
+    filename_ = filenameStr;
+}
+
+void BinaryIO::openAppendImpl(const boost::filesystem::path &filename)
+{
+    (void) filename;
+    MLSGPU_ASSERT(false, std::invalid_argument);
+}
+
 void BinaryIO::close()
 {
     MLSGPU_ASSERT(isOpen_, state_error);
@@ -133,6 +185,78 @@ std::size_t BinaryReader::read(void *buf, std::size_t count, offset_type offset)
     }
 }
 
+std::size_t BinaryReader::readv(const Slice *slices, std::size_t numSlices, offset_type offset) const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    try
+    {
+        return readvImpl(slices, numSlices, offset);
+    }
+    catch (boost::exception &e)
+    {
+        e << boost::errinfo_file_name(filename());
+        throw;
+    }
+}
+
+std::size_t BinaryReader::readvImpl(const Slice *slices, std::size_t numSlices, offset_type offset) const
+{
+    /* Generic fallback: read large contiguous chunks into a bounce buffer
+     * and distribute them, so the underlying reader still sees a few large
+     * reads rather than one tiny read per slice.
+     */
+    const std::size_t bufferSize = 65536;
+    boost::scoped_array<char> buffer(new char[bufferSize]);
+    std::size_t total = 0;   // bytes successfully scattered so far
+    std::size_t first = 0;   // index of the first incompletely-filled slice
+    std::size_t fill = 0;    // bytes of slice @c first already filled
+
+    while (first < numSlices)
+    {
+        if (fill == slices[first].size)
+        {
+            first++;
+            fill = 0;
+            continue;
+        }
+        if (fill == 0 && slices[first].size >= bufferSize)
+        {
+            // Slice is too big to benefit from buffering: read it directly
+            std::size_t bytes = readImpl(slices[first].data, slices[first].size, offset + total);
+            total += bytes;
+            if (bytes < slices[first].size)
+                return total;
+            first++;
+            continue;
+        }
+
+        // How many bytes the remaining slices want from one bounce read
+        std::size_t wanted = 0;
+        for (std::size_t i = first; i < numSlices && wanted < bufferSize; i++)
+            wanted += slices[i].size - (i == first ? fill : 0);
+        wanted = std::min(wanted, bufferSize);
+
+        std::size_t bytes = readImpl(buffer.get(), wanted, offset + total);
+        total += bytes;
+        std::size_t pos = 0;
+        while (pos < bytes)
+        {
+            std::size_t n = std::min(bytes - pos, slices[first].size - fill);
+            std::memcpy((char *) slices[first].data + fill, buffer.get() + pos, n);
+            pos += n;
+            fill += n;
+            if (fill == slices[first].size)
+            {
+                first++;
+                fill = 0;
+            }
+        }
+        if (bytes < wanted)
+            return total;
+    }
+    return total;
+}
+
 BinaryIO::offset_type BinaryReader::size() const
 {
     MLSGPU_ASSERT(isOpen(), state_error);
@@ -147,6 +271,38 @@ BinaryIO::offset_type BinaryReader::size() const
     }
 }
 
+const char *BinaryReader::data() const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    return dataImpl();
+}
+
+const char *BinaryReader::dataImpl() const
+{
+    return NULL;
+}
+
+void BinaryReader::hintSequential() const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    hintSequentialImpl();
+}
+
+void BinaryReader::hintSequentialImpl() const
+{
+}
+
+int BinaryReader::fileDescriptor() const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    return fileDescriptorImpl();
+}
+
+int BinaryReader::fileDescriptorImpl() const
+{
+    return -1;
+}
+
 std::size_t BinaryWriter::write(const void *buf, std::size_t count, offset_type offset) const
 {
     MLSGPU_ASSERT(isOpen(), state_error);
@@ -161,6 +317,70 @@ std::size_t BinaryWriter::write(const void *buf, std::size_t count, offset_type
     }
 }
 
+std::size_t BinaryWriter::writev(const Slice *slices, std::size_t numSlices, offset_type offset) const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    try
+    {
+        return writevImpl(slices, numSlices, offset);
+    }
+    catch (boost::exception &e)
+    {
+        e << boost::errinfo_file_name(filename());
+        throw;
+    }
+}
+
+std::size_t BinaryWriter::writevImpl(const Slice *slices, std::size_t numSlices, offset_type offset) const
+{
+    /* Generic fallback: pack the slices into a bounce buffer so that the
+     * underlying writer still sees a few large writes rather than one tiny
+     * write per slice.
+     */
+    const std::size_t bufferSize = 65536;
+    boost::scoped_array<char> buffer(new char[bufferSize]);
+    std::size_t total = 0;   // bytes successfully written so far
+    std::size_t used = 0;    // bytes waiting in the buffer
+
+    for (std::size_t i = 0; i < numSlices; i++)
+    {
+        const char *data = (const char *) slices[i].data;
+        std::size_t size = slices[i].size;
+        while (size > 0)
+        {
+            if (used == 0 && size >= bufferSize)
+            {
+                // Slice is too big to benefit from buffering: write it directly
+                std::size_t bytes = writeImpl(data, size, offset + total);
+                total += bytes;
+                if (bytes < size)
+                    return total;
+                data += bytes;
+                size -= bytes;
+            }
+            else
+            {
+                std::size_t n = std::min(size, bufferSize - used);
+                std::memcpy(buffer.get() + used, data, n);
+                used += n;
+                data += n;
+                size -= n;
+                if (used == bufferSize)
+                {
+                    std::size_t bytes = writeImpl(buffer.get(), used, offset + total);
+                    total += bytes;
+                    if (bytes < used)
+                        return total;
+                    used = 0;
+                }
+            }
+        }
+    }
+    if (used > 0)
+        total += writeImpl(buffer.get(), used, offset + total);
+    return total;
+}
+
 void BinaryWriter::resize(offset_type size) const
 {
     MLSGPU_ASSERT(isOpen(), state_error);
@@ -175,6 +395,36 @@ void BinaryWriter::resize(offset_type size) const
     }
 }
 
+void BinaryWriter::preallocate(offset_type size) const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    try
+    {
+        preallocateImpl(size);
+    }
+    catch (boost::exception &e)
+    {
+        e << boost::errinfo_file_name(filename());
+        throw;
+    }
+}
+
+void BinaryWriter::preallocateImpl(offset_type size) const
+{
+    resizeImpl(size);
+}
+
+int BinaryWriter::fileDescriptor() const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    return fileDescriptorImpl();
+}
+
+int BinaryWriter::fileDescriptorImpl() const
+{
+    return -1;
+}
+
 namespace
 {
 
@@ -305,6 +555,10 @@ private:
     virtual void closeImpl();
     virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
     virtual offset_type sizeImpl() const;
+    virtual const char *dataImpl() const;
+#if HAVE_MADVISE
+    virtual void hintSequentialImpl() const;
+#endif
 };
 
 void MmapReader::openImpl(const boost::filesystem::path &path)
@@ -338,13 +592,26 @@ BinaryIO::offset_type MmapReader::sizeImpl() const
     return mapping.size();
 }
 
+const char *MmapReader::dataImpl() const
+{
+    return mapping.data();
+}
+
+#if HAVE_MADVISE
+void MmapReader::hintSequentialImpl() const
+{
+    // Purely advisory: a failure costs only the readahead benefit
+    (void) madvise(const_cast<char *>(mapping.data()), mapping.size(), MADV_SEQUENTIAL);
+}
+#endif
+
 /**
  * Implementation of @ref BinaryReader using low-level operating system calls.
  * This makes it unbuffered (unlike @ref StreamReader).
  */
 class SyscallReader : public BinaryReader
 {
-private:
+protected:
 #if SYSCALL_IO_POSIX
     int fd;
 #endif
@@ -356,6 +623,15 @@ private:
     virtual void closeImpl();
     virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
     virtual offset_type sizeImpl() const;
+#if SYSCALL_IO_POSIX && HAVE_PREADV
+    virtual std::size_t readvImpl(const Slice *slices, std::size_t numSlices, offset_type offset) const;
+#endif
+#if SYSCALL_IO_POSIX && HAVE_POSIX_FADVISE
+    virtual void hintSequentialImpl() const;
+#endif
+#if SYSCALL_IO_POSIX
+    virtual int fileDescriptorImpl() const { return fd; }
+#endif
 
 public:
     virtual ~SyscallReader();
@@ -376,9 +652,19 @@ private:
 #endif
 
     virtual void openImpl(const boost::filesystem::path &path);
+    virtual void openAppendImpl(const boost::filesystem::path &path);
     virtual void closeImpl();
     virtual std::size_t writeImpl(const void *buf, std::size_t count, offset_type offset) const;
     virtual void resizeImpl(offset_type type) const;
+#if SYSCALL_IO_POSIX
+# if HAVE_PWRITEV
+    virtual std::size_t writevImpl(const Slice *slices, std::size_t numSlices, offset_type offset) const;
+# endif
+# if HAVE_POSIX_FALLOCATE
+    virtual void preallocateImpl(offset_type size) const;
+# endif
+    virtual int fileDescriptorImpl() const { return fd; }
+#endif
 
 public:
     virtual ~SyscallWriter();
@@ -418,6 +704,16 @@ void SyscallWriter::openImpl(const boost::filesystem::path &path)
     }
 }
 
+void SyscallWriter::openAppendImpl(const boost::filesystem::path &path)
+{
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0666);
+    if (fd < 0)
+    {
+        throw boost::enable_error_info(std::ios::failure("Could not open file"))
+            << boost::errinfo_errno(errno);
+    }
+}
+
 void SyscallReader::closeImpl()
 {
     if (::close(fd) != 0)
@@ -441,6 +737,14 @@ BinaryIO::offset_type SyscallReader::sizeImpl() const
     return buf.st_size;
 }
 
+#if HAVE_POSIX_FADVISE
+void SyscallReader::hintSequentialImpl() const
+{
+    // Purely advisory: a failure costs only the readahead benefit
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+#endif
+
 std::size_t SyscallReader::readImpl(void *buf, size_t count, offset_type offset) const
 {
     size_t remain = count;
@@ -468,6 +772,74 @@ std::size_t SyscallReader::readImpl(void *buf, size_t count, offset_type offset)
     return count;
 }
 
+#if HAVE_PREADV
+
+std::size_t SyscallReader::readvImpl(const Slice *slices, std::size_t numSlices, offset_type offset) const
+{
+    /* Cap the number of iovecs built per call: IOV_MAX is the hard limit
+     * for preadv, and 1024 keeps the array a sensible size even where
+     * IOV_MAX is enormous.
+     */
+    const std::size_t maxIov = std::min(std::size_t(IOV_MAX), std::size_t(1024));
+    std::vector<struct iovec> iov;
+    iov.reserve(maxIov);
+
+    std::size_t total = 0;  // bytes successfully read so far
+    std::size_t first = 0;  // index of the first incompletely-filled slice
+    std::size_t skip = 0;   // bytes of slice @c first already filled
+    while (first < numSlices)
+    {
+        iov.clear();
+        for (std::size_t i = first; i < numSlices && iov.size() < maxIov; i++)
+        {
+            struct iovec v;
+            v.iov_base = slices[i].data;
+            v.iov_len = slices[i].size;
+            if (i == first)
+            {
+                v.iov_base = (char *) v.iov_base + skip;
+                v.iov_len -= skip;
+            }
+            if (v.iov_len > 0)
+                iov.push_back(v);
+        }
+        if (iov.empty())
+            break;   // only empty slices remain
+
+        ssize_t bytes = ::preadv(fd, &iov[0], iov.size(), offset + total);
+        if (bytes < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            throw boost::enable_error_info(std::ios::failure("read failed"))
+                << boost::errinfo_errno(errno);
+        }
+        else if (bytes == 0)
+        {
+            return total;  // end of file
+        }
+        total += bytes;
+
+        // Advance first/skip past the bytes that were read
+        std::size_t advance = bytes;
+        while (first < numSlices)
+        {
+            std::size_t avail = slices[first].size - skip;
+            if (advance < avail)
+            {
+                skip += advance;
+                break;
+            }
+            advance -= avail;
+            first++;
+            skip = 0;
+        }
+    }
+    return total;
+}
+
+#endif // HAVE_PREADV
+
 std::size_t SyscallWriter::writeImpl(const void *buf, size_t count, offset_type offset) const
 {
     size_t remain = count;
@@ -495,6 +867,74 @@ std::size_t SyscallWriter::writeImpl(const void *buf, size_t count, offset_type
     return count;
 }
 
+#if HAVE_PWRITEV
+
+std::size_t SyscallWriter::writevImpl(const Slice *slices, std::size_t numSlices, offset_type offset) const
+{
+    /* Cap the number of iovecs built per call: IOV_MAX is the hard limit
+     * for pwritev, and 1024 keeps the array a sensible size even where
+     * IOV_MAX is enormous.
+     */
+    const std::size_t maxIov = std::min(std::size_t(IOV_MAX), std::size_t(1024));
+    std::vector<struct iovec> iov;
+    iov.reserve(maxIov);
+
+    std::size_t total = 0;  // bytes successfully written so far
+    std::size_t first = 0;  // index of the first incompletely-written slice
+    std::size_t skip = 0;   // bytes of slice @c first already written
+    while (first < numSlices)
+    {
+        iov.clear();
+        for (std::size_t i = first; i < numSlices && iov.size() < maxIov; i++)
+        {
+            struct iovec v;
+            v.iov_base = const_cast<void *>(slices[i].data);
+            v.iov_len = slices[i].size;
+            if (i == first)
+            {
+                v.iov_base = (char *) v.iov_base + skip;
+                v.iov_len -= skip;
+            }
+            if (v.iov_len > 0)
+                iov.push_back(v);
+        }
+        if (iov.empty())
+            break;   // only empty slices remain
+
+        ssize_t bytes = ::pwritev(fd, &iov[0], iov.size(), offset + total);
+        if (bytes < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            throw boost::enable_error_info(std::ios::failure("write failed"))
+                << boost::errinfo_errno(errno);
+        }
+        else if (bytes == 0)
+        {
+            throw boost::enable_error_info(std::ios::failure("pwritev did not write any bytes"));
+        }
+        total += bytes;
+
+        // Advance first/skip past the bytes that were written
+        std::size_t advance = bytes;
+        while (first < numSlices)
+        {
+            std::size_t avail = slices[first].size - skip;
+            if (advance < avail)
+            {
+                skip += advance;
+                break;
+            }
+            advance -= avail;
+            first++;
+            skip = 0;
+        }
+    }
+    return total;
+}
+
+#endif // HAVE_PWRITEV
+
 void SyscallWriter::resizeImpl(offset_type size) const
 {
     if (ftruncate(fd, size) != 0)
@@ -502,6 +942,151 @@ void SyscallWriter::resizeImpl(offset_type size) const
             << boost::errinfo_errno(errno);
 }
 
+#if HAVE_POSIX_FALLOCATE
+
+void SyscallWriter::preallocateImpl(offset_type size) const
+{
+    if (size == 0)
+    {
+        resizeImpl(size);
+        return;
+    }
+    /* posix_fallocate returns the error rather than setting errno */
+    const int status = posix_fallocate(fd, 0, size);
+    if (status == EOPNOTSUPP || status == EINVAL)
+    {
+        /* The filesystem cannot preallocate; a sparse resize preserves the
+         * semantics, losing only the contiguity hint.
+         */
+        resizeImpl(size);
+    }
+    else if (status != 0)
+        throw boost::enable_error_info(std::ios::failure("posix_fallocate failed"))
+            << boost::errinfo_errno(status);
+}
+
+#endif // HAVE_POSIX_FALLOCATE
+
+#ifdef O_DIRECT
+
+/**
+ * Implementation of @ref BinaryReader that bypasses the page cache using
+ * direct I/O. The sequential multi-terabyte scans through the input files
+ * are never re-read from cache, but would evict every co-tenant's working
+ * set (@ref decache can only advise the kernel after the fact). Direct I/O
+ * requires sector-aligned offsets, lengths and buffers, so reads are staged
+ * through an internal aligned bounce buffer rather than imposing alignment
+ * on callers. If the filesystem does not support direct I/O, the reader
+ * degrades to a plain @ref SyscallReader with a warning.
+ */
+class DirectReader : public SyscallReader
+{
+private:
+    /// Buffer and transfer alignment; satisfies any sector size in practice
+    static const std::size_t ALIGNMENT = 4096;
+    /// Size of the bounce buffer
+    static const std::size_t BUFFER_SIZE = 1024 * 1024;
+
+    bool direct;             ///< Whether the file was opened with @c O_DIRECT
+    char *bounce;            ///< Aligned bounce buffer, allocated on open
+
+    virtual void openImpl(const boost::filesystem::path &path);
+    virtual void closeImpl();
+    virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
+
+public:
+    DirectReader() : direct(false), bounce(NULL) {}
+    virtual ~DirectReader();
+};
+
+DirectReader::~DirectReader()
+{
+    if (isOpen())
+        close();
+}
+
+void DirectReader::openImpl(const boost::filesystem::path &path)
+{
+    fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0)
+    {
+        if (errno != EINVAL)
+            throw boost::enable_error_info(std::ios::failure("Could not open file"))
+                << boost::errinfo_errno(errno);
+        // The filesystem does not support direct I/O
+        Log::log[Log::warn] << "Direct I/O is not supported for "
+            << path.string() << "; falling back to buffered reads\n";
+        SyscallReader::openImpl(path);
+        direct = false;
+        return;
+    }
+    direct = true;
+
+    void *ptr;
+    if (posix_memalign(&ptr, ALIGNMENT, BUFFER_SIZE) != 0)
+    {
+        ::close(fd);
+        throw std::bad_alloc();
+    }
+    bounce = static_cast<char *>(ptr);
+}
+
+void DirectReader::closeImpl()
+{
+    free(bounce);
+    bounce = NULL;
+    SyscallReader::closeImpl();
+}
+
+std::size_t DirectReader::readImpl(void *buf, std::size_t count, offset_type offset) const
+{
+    if (!direct)
+        return SyscallReader::readImpl(buf, count, offset);
+
+    char *out = static_cast<char *>(buf);
+    std::size_t done = 0;
+    while (done < count)
+    {
+        const offset_type cur = offset + done;
+        const offset_type blockStart = cur & ~offset_type(ALIGNMENT - 1);
+        const std::size_t skip = cur - blockStart;
+        const std::size_t wanted = std::min(count - done, BUFFER_SIZE - skip);
+        const std::size_t request = (skip + wanted + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+        std::size_t avail = 0;
+        while (avail < request)
+        {
+            ssize_t bytes = ::pread(fd, bounce + avail, request - avail, blockStart + avail);
+            if (bytes < 0)
+            {
+                if (errno == EAGAIN || errno == EINTR)
+                    continue;
+                throw boost::enable_error_info(std::ios::failure("read failed"))
+                    << boost::errinfo_errno(errno);
+            }
+            else if (bytes == 0)
+                break; // end of file
+            avail += bytes;
+            /* A short read leaves the next transfer unaligned; this can only
+             * happen at the end of the file, where there is nothing further
+             * to read anyway.
+             */
+            if (avail % ALIGNMENT != 0)
+                break;
+        }
+        if (avail <= skip)
+            break; // the read started at or beyond the end of the file
+        const std::size_t use = std::min(wanted, avail - skip);
+        std::memcpy(out + done, bounce + skip, use);
+        done += use;
+        if (use < wanted)
+            break; // end of file
+    }
+    return done;
+}
+
+#endif // O_DIRECT
+
 #endif // SYSCALL_IO_POSIX
 
 #if SYSCALL_IO_WIN32
@@ -538,6 +1123,22 @@ void SyscallWriter::openImpl(const boost::filesystem::path &path)
     }
 }
 
+void SyscallWriter::openAppendImpl(const boost::filesystem::path &path)
+{
+    fd = CreateFile(path.c_str(),
+                    GENERIC_WRITE,
+                    0,
+                    NULL,
+                    OPEN_ALWAYS,
+                    FILE_ATTRIBUTE_NORMAL,
+                    NULL);
+    if (fd == INVALID_HANDLE_VALUE)
+    {
+        throw boost::enable_error_info(std::ios::failure("Could not open file"))
+            << boost::errinfo_errno(GetLastError());
+    }
+}
+
 void SyscallReader::closeImpl()
 {
     if (!CloseHandle(fd))
@@ -650,6 +1251,647 @@ void SyscallWriter::resizeImpl(offset_type size) const
 
 #endif // SYSCALL_IO_WIN32
 
+#if HAVE_COMPRESS2
+
+/// Identifies a compressed container, both at the start of the file and in the footer
+const char compressedMagic[8] = {'m', 'l', 's', 'g', 'p', 'u', 'Z', '1'};
+
+/// Number of logical bytes covered by each independently-compressed block
+const BinaryIO::offset_type compressedBlockSize = 1024 * 1024;
+
+/// One element of the seek index of a compressed container
+struct CompressedIndexEntry
+{
+    BinaryIO::offset_type physOffset;  ///< Byte offset of the compressed block in the container
+    BinaryIO::offset_type compSize;    ///< Compressed size of the block (0 for an all-zero block)
+};
+
+/// Trailer at the very end of a compressed container
+struct CompressedFooter
+{
+    char magic[8];                     ///< Copy of @ref compressedMagic
+    BinaryIO::offset_type blockSize;   ///< Logical bytes per block
+    BinaryIO::offset_type logicalSize; ///< Size of the file the container represents
+    BinaryIO::offset_type indexOffset; ///< Byte offset of the seek index in the container
+};
+
+/**
+ * Implementation of @ref BinaryWriter that stores the logical file in a
+ * block-compressed container. The logical file is divided into fixed-size
+ * blocks which are compressed independently with zlib and appended to the
+ * container in the order they are completed, followed by a seek index (one
+ * @ref CompressedIndexEntry per logical block, in logical order) and a
+ * @ref CompressedFooter. Like the blob cache, all integers are stored in
+ * host byte order, so the container is not portable between architectures.
+ *
+ * The writer operates in one of two modes, selected by whether @ref resize
+ * is called before the first write:
+ * - In @em sized mode the final size is known up front, so blocks are
+ *   flushed as soon as they fill (including a short final block). Each byte
+ *   must be written at most once. @ref FastPly::Writer satisfies both: it
+ *   sizes the file before writing the header, and the vertex and triangle
+ *   ranges it writes are disjoint.
+ * - In @em unsized mode the logical file simply grows to cover the data
+ *   written, so only full-size blocks can be flushed eagerly and the
+ *   trailing partial block is held back until @ref close. This suits
+ *   append-only streams of unknown final length, such as the temporary
+ *   files written by @ref OOCMesher.
+ *
+ * In either mode compression happens on the calling thread, so when writes
+ * are routed through an @ref AsyncWriter the compression overlaps the
+ * computation that produces the data.
+ *
+ * Logical blocks that were never written (holes) get an all-zeros index
+ * entry and occupy no space in the container.
+ */
+class CompressedWriter : public BinaryWriter
+{
+private:
+    /// A block that has not yet been fully written
+    struct Block
+    {
+        /// Uncompressed data (unwritten bytes are zero)
+        Statistics::Container::PODBuffer<char> data;
+        offset_type filled;               ///< Number of bytes written so far
+
+        explicit Block(std::size_t size)
+            : data("mem.CompressedWriter.blocks", size), filled(0)
+        {
+            std::memset(data.data(), 0, size);
+        }
+    };
+
+    boost::scoped_ptr<BinaryWriter> out;  ///< Writer for the physical container
+
+    mutable boost::mutex mutex;           ///< Guards all the mutable state below
+    mutable bool sized;                   ///< Whether @ref resize fixed the final size
+    mutable offset_type logicalSize;      ///< Size set by @ref resize, or high-water mark of writes
+    mutable offset_type physTail;         ///< Append position for the next compressed block
+    /// Partially-written blocks, keyed by block number
+    mutable std::map<offset_type, boost::shared_ptr<Block> > partial;
+    /// Seek index, written out on close
+    mutable std::vector<CompressedIndexEntry> index;
+
+    /// Number of logical bytes covered by block @a blockId (the last block may be short)
+    offset_type blockExtent(offset_type blockId) const;
+
+    /**
+     * Compress a completed block and append it to the container. The append
+     * position and index entry are allocated under the lock, but the
+     * compression and the write of the compressed data proceed concurrently
+     * with other threads.
+     */
+    void flushBlock(offset_type blockId, const Block &block) const;
+
+    virtual void openImpl(const boost::filesystem::path &path);
+    virtual void closeImpl();
+    virtual std::size_t writeImpl(const void *buf, std::size_t count, offset_type offset) const;
+    virtual void resizeImpl(offset_type size) const;
+
+public:
+    CompressedWriter();
+};
+
+/**
+ * Implementation of @ref BinaryReader for containers produced by
+ * @ref CompressedWriter. Each read decompresses the blocks it touches; a
+ * one-block cache makes sequential reads decompress each block only once.
+ */
+class CompressedReader : public BinaryReader
+{
+private:
+    boost::scoped_ptr<BinaryReader> in;   ///< Reader for the physical container
+    offset_type logicalSize;              ///< Size of the logical file
+    offset_type blockSize;                ///< Logical bytes per block
+    std::vector<CompressedIndexEntry> index;  ///< Seek index from the container
+
+    mutable boost::mutex mutex;           ///< Serializes access to the block cache
+    mutable offset_type cachedBlock;      ///< Block number in @ref cache (@c index.size() if none)
+    /// Decompressed data of @ref cachedBlock (@c NULL when closed)
+    mutable boost::scoped_ptr<Statistics::Container::PODBuffer<char> > cache;
+
+    /// Number of logical bytes covered by block @a blockId (the last block may be short)
+    offset_type blockExtent(offset_type blockId) const;
+
+    virtual void openImpl(const boost::filesystem::path &path);
+    virtual void closeImpl();
+    virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
+    virtual offset_type sizeImpl() const;
+
+public:
+    CompressedReader();
+};
+
+CompressedWriter::CompressedWriter()
+    : out(createWriter(SYSCALL_WRITER)), sized(false), logicalSize(0), physTail(0)
+{
+}
+
+BinaryIO::offset_type CompressedWriter::blockExtent(offset_type blockId) const
+{
+    return std::min(compressedBlockSize, logicalSize - blockId * compressedBlockSize);
+}
+
+void CompressedWriter::openImpl(const boost::filesystem::path &path)
+{
+    out->open(path);
+    out->write(compressedMagic, sizeof(compressedMagic), 0);
+    sized = false;
+    logicalSize = 0;
+    physTail = sizeof(compressedMagic);
+    partial.clear();
+    index.clear();
+}
+
+void CompressedWriter::resizeImpl(offset_type size) const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    // The size determines the block layout, so it cannot change once data
+    // have been written
+    MLSGPU_ASSERT(partial.empty() && physTail == sizeof(compressedMagic), state_error);
+
+    sized = true;
+    logicalSize = size;
+    const CompressedIndexEntry hole = {0, 0};
+    index.assign((size + compressedBlockSize - 1) / compressedBlockSize, hole);
+}
+
+void CompressedWriter::flushBlock(offset_type blockId, const Block &block) const
+{
+    const offset_type extent = blockExtent(blockId);
+    uLongf compLen = compressBound(extent);
+    boost::scoped_array<char> comp(new char[compLen]);
+    int status = compress2(
+        reinterpret_cast<Bytef *>(comp.get()), &compLen,
+        reinterpret_cast<const Bytef *>(block.data.data()), extent,
+        Z_BEST_SPEED);
+    // Can only fail due to a too-small output buffer, which compressBound rules out
+    MLSGPU_ASSERT(status == Z_OK, std::length_error);
+
+    offset_type pos;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        pos = physTail;
+        physTail += compLen;
+        index[blockId].physOffset = pos;
+        index[blockId].compSize = compLen;
+    }
+    out->write(comp.get(), compLen, pos);
+}
+
+std::size_t CompressedWriter::writeImpl(const void *buf, std::size_t count, offset_type offset) const
+{
+    if (sized)
+        MLSGPU_ASSERT(offset + count <= logicalSize, std::out_of_range);
+
+    const char *data = (const char *) buf;
+    std::size_t remain = count;
+    while (remain > 0)
+    {
+        const offset_type blockId = offset / compressedBlockSize;
+        const offset_type within = offset - blockId * compressedBlockSize;
+        offset_type extent;
+        boost::shared_ptr<Block> block;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!sized && offset + remain > logicalSize)
+            {
+                /* Unsized files grow to cover the data written. The final
+                 * extent of the last block is unknown until close, so
+                 * blocks are buffered at full size and only flushed eagerly
+                 * once completely filled.
+                 */
+                logicalSize = offset + remain;
+                const CompressedIndexEntry hole = {0, 0};
+                index.resize((logicalSize + compressedBlockSize - 1) / compressedBlockSize, hole);
+            }
+            extent = sized ? blockExtent(blockId) : compressedBlockSize;
+            boost::shared_ptr<Block> &slot = partial[blockId];
+            if (!slot)
+                slot.reset(new Block(extent));
+            block = slot;
+        }
+        const std::size_t n = std::min<offset_type>(remain, extent - within);
+        /* The copy happens outside the lock: writes cover disjoint byte
+         * ranges, so two threads filling the same block cannot overlap.
+         */
+        std::memcpy(block->data.data() + within, data, n);
+
+        bool complete = false;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            block->filled += n;
+            if (block->filled == extent)
+            {
+                partial.erase(blockId);
+                complete = true;
+            }
+        }
+        if (complete)
+            flushBlock(blockId, *block);
+
+        data += n;
+        offset += n;
+        remain -= n;
+    }
+    return count;
+}
+
+void CompressedWriter::closeImpl()
+{
+    /* No other threads may use the writer once close is called, so the
+     * remaining state can be accessed without the lock (flushBlock still
+     * takes it internally).
+     */
+    for (std::map<offset_type, boost::shared_ptr<Block> >::const_iterator
+         i = partial.begin(); i != partial.end(); ++i)
+        flushBlock(i->first, *i->second);
+    partial.clear();
+
+    CompressedFooter footer;
+    std::memcpy(footer.magic, compressedMagic, sizeof(compressedMagic));
+    footer.blockSize = compressedBlockSize;
+    footer.logicalSize = logicalSize;
+    footer.indexOffset = physTail;
+    if (!index.empty())
+        out->write(&index[0], index.size() * sizeof(CompressedIndexEntry), footer.indexOffset);
+    out->write(&footer, sizeof(footer), footer.indexOffset + index.size() * sizeof(CompressedIndexEntry));
+    index.clear();
+    out->close();
+}
+
+CompressedReader::CompressedReader()
+    : in(createReader(SYSCALL_READER)), logicalSize(0), blockSize(0), cachedBlock(0)
+{
+}
+
+BinaryIO::offset_type CompressedReader::blockExtent(offset_type blockId) const
+{
+    return std::min(blockSize, logicalSize - blockId * blockSize);
+}
+
+void CompressedReader::openImpl(const boost::filesystem::path &path)
+{
+    in->open(path);
+    try
+    {
+        CompressedFooter footer;
+        const offset_type total = in->size();
+        if (total < sizeof(compressedMagic) + sizeof(footer)
+            || in->read(&footer, sizeof(footer), total - sizeof(footer)) != sizeof(footer)
+            || std::memcmp(footer.magic, compressedMagic, sizeof(compressedMagic)) != 0)
+        {
+            throw boost::enable_error_info(
+                std::ios::failure("File is not a compressed container"));
+        }
+
+        blockSize = footer.blockSize;
+        logicalSize = footer.logicalSize;
+        const offset_type numBlocks = blockSize == 0
+            ? 0 : (logicalSize + blockSize - 1) / blockSize;
+        if (footer.indexOffset + numBlocks * sizeof(CompressedIndexEntry) + sizeof(footer) != total)
+        {
+            throw boost::enable_error_info(
+                std::ios::failure("Compressed container has a corrupt footer"));
+        }
+
+        index.resize(numBlocks);
+        if (numBlocks > 0)
+        {
+            const std::size_t indexBytes = numBlocks * sizeof(CompressedIndexEntry);
+            if (in->read(&index[0], indexBytes, footer.indexOffset) != indexBytes)
+                throw boost::enable_error_info(
+                    std::ios::failure("Compressed container has a truncated index"));
+        }
+        cache.reset(new Statistics::Container::PODBuffer<char>("mem.CompressedReader.cache", blockSize));
+        cachedBlock = index.size(); // sentinel: nothing cached yet
+    }
+    catch (...)
+    {
+        in->close();
+        throw;
+    }
+}
+
+void CompressedReader::closeImpl()
+{
+    index.clear();
+    cache.reset();
+    in->close();
+}
+
+BinaryIO::offset_type CompressedReader::sizeImpl() const
+{
+    return logicalSize;
+}
+
+std::size_t CompressedReader::readImpl(void *buf, std::size_t count, offset_type offset) const
+{
+    if (offset >= logicalSize)
+        return 0;
+    count = std::min<offset_type>(count, logicalSize - offset);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    char *data = (char *) buf;
+    std::size_t remain = count;
+    while (remain > 0)
+    {
+        const offset_type blockId = offset / blockSize;
+        const offset_type within = offset - blockId * blockSize;
+        const offset_type extent = blockExtent(blockId);
+        const std::size_t n = std::min<offset_type>(remain, extent - within);
+
+        const CompressedIndexEntry &entry = index[blockId];
+        if (entry.compSize == 0)
+        {
+            // Hole: the block was never written, and reads back as zeros
+            std::memset(data, 0, n);
+        }
+        else
+        {
+            if (cachedBlock != blockId)
+            {
+                boost::scoped_array<char> comp(new char[entry.compSize]);
+                if (in->read(comp.get(), entry.compSize, entry.physOffset) != entry.compSize)
+                    throw boost::enable_error_info(
+                        std::ios::failure("Compressed container has a truncated block"));
+                uLongf outLen = extent;
+                int status = uncompress(
+                    reinterpret_cast<Bytef *>(cache->data()), &outLen,
+                    reinterpret_cast<const Bytef *>(comp.get()), entry.compSize);
+                if (status != Z_OK || outLen != extent)
+                    throw boost::enable_error_info(
+                        std::ios::failure("Corrupt block in compressed container"));
+                cachedBlock = blockId;
+            }
+            std::memcpy(data, cache->data() + within, n);
+        }
+
+        data += n;
+        offset += n;
+        remain -= n;
+    }
+    return count;
+}
+
+#endif // HAVE_COMPRESS2
+
+#if HAVE_CURL_EASY_INIT
+
+/// Ensures that @c curl_global_init runs exactly once, before any transfers
+boost::once_flag remoteInitFlag = BOOST_ONCE_INIT;
+
+/// Target of @ref remoteInitFlag
+void remoteInit()
+{
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != 0)
+        throw boost::enable_error_info(
+            std::ios::failure("Could not initialize libcurl"));
+}
+
+/// Number of logical bytes in each cached block of a @ref RemoteReader
+const BinaryIO::offset_type remoteBlockSize = 1024 * 1024;
+
+/// Maximum number of blocks fetched by a single ranged GET
+const std::size_t remoteMaxWindow = 16;
+
+/// Number of blocks held in the cache of a @ref RemoteReader
+const std::size_t remoteMaxCached = 2 * remoteMaxWindow;
+
+/**
+ * Implementation of @ref BinaryReader that streams the file from an object
+ * store or web server using HTTP(S) ranged GET requests. The path passed to
+ * @ref open is interpreted as a URL; the server must report the object size
+ * and honour @c Range headers, which the S3-style stores and ordinary web
+ * servers all do.
+ *
+ * Reads are served from a small cache of fixed-size blocks. A miss fetches a
+ * run of consecutive blocks with a single request; the run length starts at
+ * one block and doubles each time a fetch directly continues the previous
+ * one, up to @ref remoteMaxWindow, so a sequential scan over a high-latency
+ * link amortizes each round trip over a progressively larger transfer while
+ * random probes (such as header parsing) stay cheap. When @ref FileSet's
+ * reader thread drives the scan, the downloads overlap the downstream
+ * computation in the same way local disk reads do.
+ *
+ * Like the other readers, @ref read may be called concurrently; the single
+ * transfer handle and the cache are serialized by an internal mutex.
+ */
+class RemoteReader : public BinaryReader
+{
+private:
+    /// One cached run of bytes, always aligned to @ref remoteBlockSize
+    struct Block
+    {
+        offset_type start;         ///< Offset of the first byte in the logical file
+        std::vector<char> data;    ///< Contents (short only at the end of the file)
+    };
+
+    std::string url;               ///< URL passed to @ref open
+    CURL *curl;                    ///< Transfer handle (serialized by @ref mutex)
+    offset_type fileSize;          ///< Object size reported by the server
+
+    mutable boost::mutex mutex;    ///< Guards the transfer handle and the state below
+    /// Cached blocks, most recently used first
+    mutable std::list<Block> cache;
+    mutable offset_type nextOffset;  ///< Byte just past the previous fetch
+    mutable std::size_t window;      ///< Number of blocks to fetch on the next miss
+
+    /// Receives response data from libcurl; @a userdata is a @c std::vector<char>
+    static std::size_t writeCallback(char *ptr, std::size_t size, std::size_t nmemb, void *userdata);
+
+    /// Find the cached block starting at @a start, or @c cache.end()
+    std::list<Block>::iterator findBlock(offset_type start) const;
+
+    /**
+     * Fetch the run of blocks starting at @a start (which must be aligned to
+     * @ref remoteBlockSize and within the file) and insert them into the
+     * cache, with the block at @a start in front. The caller must hold
+     * @ref mutex.
+     */
+    void fetch(offset_type start) const;
+
+    virtual void openImpl(const boost::filesystem::path &path);
+    virtual void closeImpl();
+    virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const;
+    virtual offset_type sizeImpl() const;
+    virtual void hintSequentialImpl() const;
+
+public:
+    RemoteReader();
+};
+
+RemoteReader::RemoteReader()
+    : curl(NULL), fileSize(0), nextOffset(0), window(1)
+{
+}
+
+std::size_t RemoteReader::writeCallback(char *ptr, std::size_t size, std::size_t nmemb, void *userdata)
+{
+    std::vector<char> *out = static_cast<std::vector<char> *>(userdata);
+    out->insert(out->end(), ptr, ptr + size * nmemb);
+    return size * nmemb;
+}
+
+void RemoteReader::openImpl(const boost::filesystem::path &path)
+{
+    boost::call_once(remoteInitFlag, remoteInit);
+
+    url = path.string();
+    curl = curl_easy_init();
+    if (curl == NULL)
+        throw boost::enable_error_info(
+            std::ios::failure("Could not create a transfer handle"));
+    try
+    {
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        // Timeouts must not raise signals in a multithreaded program
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+
+        // HEAD request to learn the object size up front
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        CURLcode status = curl_easy_perform(curl);
+        if (status != CURLE_OK)
+            throw boost::enable_error_info(
+                std::ios::failure(curl_easy_strerror(status)));
+        curl_off_t length = -1;
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        if (length < 0)
+            throw boost::enable_error_info(
+                std::ios::failure("Server did not report the object size"));
+        fileSize = length;
+
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 0L);
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    }
+    catch (std::exception &)
+    {
+        curl_easy_cleanup(curl);
+        curl = NULL;
+        throw;
+    }
+    nextOffset = 0;
+    window = 1;
+}
+
+void RemoteReader::closeImpl()
+{
+    curl_easy_cleanup(curl);
+    curl = NULL;
+    cache.clear();
+}
+
+std::list<RemoteReader::Block>::iterator RemoteReader::findBlock(offset_type start) const
+{
+    std::list<Block>::iterator pos;
+    for (pos = cache.begin(); pos != cache.end(); ++pos)
+        if (pos->start == start)
+            break;
+    return pos;
+}
+
+void RemoteReader::fetch(offset_type start) const
+{
+    /* Grow the window while fetches continue the previous one, so that a
+     * sequential scan amortizes each round trip over a progressively larger
+     * transfer; a seek resets it so random access fetches only what it needs.
+     */
+    if (start == nextOffset)
+        window = std::min(window * 2, remoteMaxWindow);
+    else
+        window = 1;
+
+    // Stop the run at the first block that is already cached
+    std::size_t blocks = window;
+    for (std::size_t i = 1; i < blocks; i++)
+        if (findBlock(start + i * remoteBlockSize) != cache.end())
+        {
+            blocks = i;
+            break;
+        }
+    const offset_type last = std::min(start + blocks * remoteBlockSize, fileSize) - 1;
+
+    std::vector<char> data;
+    data.reserve(last - start + 1);
+    std::ostringstream range;
+    range << start << '-' << last;
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.str().c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &data);
+    CURLcode status = curl_easy_perform(curl);
+    if (status != CURLE_OK)
+        throw boost::enable_error_info(
+            std::ios::failure(curl_easy_strerror(status)));
+    if (data.size() != last - start + 1)
+        throw boost::enable_error_info(
+            std::ios::failure("Server returned a short or unranged response"));
+    nextOffset = last + 1;
+
+    /* Split the response into blocks. Iterating backwards leaves the block
+     * at @a start in front, where the caller expects it.
+     */
+    for (std::size_t i = blocks; i-- > 0; )
+    {
+        const offset_type blockStart = start + i * remoteBlockSize;
+        if (blockStart > last)
+            continue; // run was clipped at EOF
+        cache.push_front(Block());
+        Block &block = cache.front();
+        block.start = blockStart;
+        const std::size_t extent = std::min<offset_type>(remoteBlockSize, last + 1 - blockStart);
+        block.data.assign(data.begin() + (blockStart - start),
+                          data.begin() + (blockStart - start) + extent);
+    }
+    while (cache.size() > remoteMaxCached)
+        cache.pop_back();
+}
+
+std::size_t RemoteReader::readImpl(void *buf, std::size_t count, offset_type offset) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    if (offset >= fileSize)
+        return 0;
+    count = std::min<offset_type>(count, fileSize - offset);
+
+    char *data = static_cast<char *>(buf);
+    std::size_t remain = count;
+    while (remain > 0)
+    {
+        const offset_type blockStart = offset / remoteBlockSize * remoteBlockSize;
+        std::list<Block>::iterator pos = findBlock(blockStart);
+        if (pos == cache.end())
+            fetch(blockStart);
+        else
+            cache.splice(cache.begin(), cache, pos); // most recently used
+        const Block &block = cache.front();
+
+        const std::size_t within = offset - blockStart;
+        const std::size_t n = std::min(remain, block.data.size() - within);
+        std::memcpy(data, &block.data[within], n);
+        data += n;
+        offset += n;
+        remain -= n;
+    }
+    return count;
+}
+
+BinaryIO::offset_type RemoteReader::sizeImpl() const
+{
+    return fileSize;
+}
+
+void RemoteReader::hintSequentialImpl() const
+{
+    // Open the prefetch window fully rather than ramping it up
+    boost::lock_guard<boost::mutex> lock(mutex);
+    window = remoteMaxWindow;
+}
+
+#endif // HAVE_CURL_EASY_INIT
+
 } // anonymous namespace
 
 BinaryReaderSource::BinaryReaderSource(const BinaryReader &reader)
@@ -699,6 +1941,13 @@ std::map<std::string, ReaderType> ReaderTypeWrapper::getNameMap()
     ans["stream"] = STREAM_READER;
     ans["mmap"] = MMAP_READER;
     ans["syscall"] = SYSCALL_READER;
+    ans["direct"] = DIRECT_READER;
+#if HAVE_COMPRESS2
+    ans["compressed"] = COMPRESSED_READER;
+#endif
+#if HAVE_CURL_EASY_INIT
+    ans["remote"] = REMOTE_READER;
+#endif
     return ans;
 }
 
@@ -707,6 +1956,9 @@ std::map<std::string, WriterType> WriterTypeWrapper::getNameMap()
     std::map<std::string, WriterType> ans;
     ans["stream"] = STREAM_WRITER;
     ans["syscall"] = SYSCALL_WRITER;
+#if HAVE_COMPRESS2
+    ans["compressed"] = COMPRESSED_WRITER;
+#endif
     return ans;
 }
 
@@ -717,6 +1969,18 @@ BinaryReader *createReader(ReaderType type)
     case MMAP_READER:    return new MmapReader;
     case STREAM_READER:  return new StreamReader;
     case SYSCALL_READER: return new SyscallReader;
+    case DIRECT_READER:
+#if SYSCALL_IO_POSIX && defined(O_DIRECT)
+        return new DirectReader;
+#else
+        return new SyscallReader; // no direct I/O support on this platform
+#endif
+#if HAVE_COMPRESS2
+    case COMPRESSED_READER: return new CompressedReader;
+#endif
+#if HAVE_CURL_EASY_INIT
+    case REMOTE_READER: return new RemoteReader;
+#endif
     default:
         MLSGPU_ASSERT(false, std::invalid_argument);
         return NULL;
@@ -729,6 +1993,9 @@ BinaryWriter *createWriter(WriterType type)
     {
     case STREAM_WRITER:  return new StreamWriter;
     case SYSCALL_WRITER: return new SyscallWriter;
+#if HAVE_COMPRESS2
+    case COMPRESSED_WRITER: return new CompressedWriter;
+#endif
     default:
         MLSGPU_ASSERT(false, std::invalid_argument);
         return NULL;
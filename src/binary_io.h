@@ -44,14 +44,29 @@ enum ReaderType
 {
     MMAP_READER,
     STREAM_READER,
-    SYSCALL_READER
+    SYSCALL_READER,
+    /**
+     * Bypasses the page cache using direct I/O, so that large streaming
+     * scans do not evict other working sets. Falls back to plain
+     * unbuffered reads where direct I/O is unsupported.
+     */
+    DIRECT_READER,
+    COMPRESSED_READER,   ///< Reads containers produced by @ref COMPRESSED_WRITER (requires zlib)
+    /**
+     * Streams the file from an object store or web server over HTTP(S) using
+     * ranged GET requests, so that reconstruction can run straight from the
+     * store without a serial staging download (requires libcurl). The
+     * filename is interpreted as a URL.
+     */
+    REMOTE_READER
 };
 
 /// Enumeration of the types of binary writer
 enum WriterType
 {
     STREAM_WRITER,
-    SYSCALL_WRITER
+    SYSCALL_WRITER,
+    COMPRESSED_WRITER    ///< Stores the file in a block-compressed container (requires zlib)
 };
 
 /// Wrapper around @ref ReaderType for use with @ref Choice.
@@ -88,6 +103,18 @@ public:
      */
     void open(const boost::filesystem::path &path);
 
+    /**
+     * Open an existing file, preserving its contents, so that it can be
+     * extended. This is implemented by calling @ref openAppendImpl, which
+     * only some subclasses provide (currently @ref SYSCALL_WRITER); it is
+     * used to continue writing temporary files across checkpoints.
+     *
+     * @throw boost::exception if there was an error opening the file
+     *
+     * @pre The file is not already open, and this class supports appending.
+     */
+    void openAppend(const boost::filesystem::path &path);
+
     /**
      * Close the file. This is implemented by calling @ref closeImpl.
      *
@@ -127,6 +154,13 @@ private:
      */
     virtual void openImpl(const boost::filesystem::path &path) = 0;
 
+    /**
+     * Implements @ref openAppend. The default implementation asserts: it is
+     * a programming error to call @ref openAppend on a class that does not
+     * support it.
+     */
+    virtual void openAppendImpl(const boost::filesystem::path &path);
+
     /**
      * Implements @ref close. It does not need to do any state checks, nor
      * put the filename into exceptions.
@@ -140,6 +174,17 @@ private:
 class BinaryReader : public BinaryIO
 {
 public:
+    /**
+     * One contiguous destination in a vectored read (see @ref readv). It is
+     * an aggregate so that arrays of slices can be built up cheaply on the
+     * stack.
+     */
+    struct Slice
+    {
+        void *data;          ///< Start of the memory
+        std::size_t size;    ///< Number of bytes
+    };
+
     /**
      * Reads up to @a count bytes from the file, starting at @a offset.
      *
@@ -153,6 +198,29 @@ public:
      */
     std::size_t read(void *buf, std::size_t count, offset_type offset) const;
 
+    /**
+     * Reads a contiguous region of the file, starting at @a offset, and
+     * scatters it over a list of memory slices in order. This lets a batch
+     * of nearby sub-ranges be fetched with one request — unwanted bytes
+     * between them can be directed at a shared sink slice — instead of one
+     * read per sub-range. Readers backed by an OS with vectored I/O support
+     * scatter the slices in the kernel; the rest fall back to reading large
+     * chunks into a bounce buffer and distributing them.
+     *
+     * Slices are permitted to overlap (in particular, several sink slices
+     * may share one piece of memory); the contents of overlapping slices
+     * are unspecified.
+     *
+     * @param slices     Destinations to fill, in file order
+     * @param numSlices  Number of elements in @a slices
+     * @param offset     Position in file to start read
+     * @return The number of bytes read.
+     * @throw boost::exception if there was a low-level I/O error
+     *
+     * @pre The file is open.
+     */
+    std::size_t readv(const Slice *slices, std::size_t numSlices, offset_type offset) const;
+
     /**
      * Return the size of the file.
      *
@@ -162,6 +230,40 @@ public:
      */
     offset_type size() const;
 
+    /**
+     * Return a pointer to the whole file contents, if the reader is able to
+     * provide zero-copy access (e.g. @ref MMAP_READER). Readers that copy
+     * data on each @ref read return @c NULL, and the caller must fall back
+     * to @ref read.
+     *
+     * The pointer remains valid until the file is closed, and the memory
+     * must not be modified through it.
+     *
+     * @pre The file is open.
+     */
+    const char *data() const;
+
+    /**
+     * Hint that the file will be read roughly front-to-back. Readers pass
+     * the hint on to the OS (@c posix_fadvise or @c madvise) so that it
+     * reads ahead more aggressively and drops pages behind the read
+     * position. It is only a hint: readers without a suitable primitive
+     * ignore it, and reads in any order remain correct.
+     *
+     * @pre The file is open.
+     */
+    void hintSequential() const;
+
+    /**
+     * Return the POSIX file descriptor backing the reader, for use with
+     * zero-copy transfer interfaces such as @c copy_file_range. Returns -1
+     * if the reader is not backed by a file descriptor, in which case
+     * callers must fall back to @ref read.
+     *
+     * @pre The file is open.
+     */
+    int fileDescriptor() const;
+
 private:
     /**
      * Implements @ref read. It does not need to check whether the file is
@@ -169,11 +271,36 @@ private:
      */
     virtual std::size_t readImpl(void *buf, std::size_t count, offset_type offset) const = 0;
 
+    /**
+     * Implements @ref readv. The default implementation reads runs of
+     * slices through a bounce buffer via @ref readImpl; subclasses with
+     * access to native scatter-gather I/O override it. It does not need to
+     * check that the file is open or put the filename into exceptions.
+     */
+    virtual std::size_t readvImpl(const Slice *slices, std::size_t numSlices, offset_type offset) const;
+
     /**
      * Implements @ref size. It does not need to check whether the file is
      * open or put the filename into exceptions.
      */
     virtual offset_type sizeImpl() const = 0;
+
+    /**
+     * Implements @ref data. The default implementation returns @c NULL;
+     * subclasses that can expose the file contents directly override it.
+     */
+    virtual const char *dataImpl() const;
+
+    /**
+     * Implements @ref hintSequential. The default implementation does
+     * nothing; subclasses with access to an advice primitive override it.
+     */
+    virtual void hintSequentialImpl() const;
+
+    /**
+     * Implements @ref fileDescriptor. The default implementation returns -1.
+     */
+    virtual int fileDescriptorImpl() const;
 };
 
 /**
@@ -182,6 +309,17 @@ private:
 class BinaryWriter : public BinaryIO
 {
 public:
+    /**
+     * One contiguous piece of memory in a vectored write (see @ref writev).
+     * It is an aggregate so that arrays of slices can be built up cheaply on
+     * the stack.
+     */
+    struct Slice
+    {
+        const void *data;    ///< Start of the memory
+        std::size_t size;    ///< Number of bytes
+    };
+
     /**
      * Writes up to @a count bytes from the file, starting at @a offset.
      *
@@ -195,6 +333,24 @@ public:
      */
     std::size_t write(const void *buf, std::size_t count, offset_type offset) const;
 
+    /**
+     * Writes the concatenation of a list of memory slices to the file,
+     * starting at @a offset. This allows interleaved record formats (such as
+     * PLY triangle lists) to be written without first packing them into a
+     * contiguous buffer. Writers backed by an OS with vectored I/O support
+     * gather the slices in the kernel; the rest fall back to packing the
+     * slices into a bounce buffer and calling @ref write.
+     *
+     * @param slices     Slices to write, concatenated in order
+     * @param numSlices  Number of elements in @a slices
+     * @param offset     Position in file to start write
+     * @return The number of bytes written.
+     * @throw boost::exception if there was a low-level I/O error
+     *
+     * @pre The file is open
+     */
+    std::size_t writev(const Slice *slices, std::size_t numSlices, offset_type offset) const;
+
     /**
      * Resize the file to the given size. It is not guaranteed to be possible to
      * shrink a file (this depends on the specific subclass). However, creating a new
@@ -204,6 +360,31 @@ public:
      */
     void resize(offset_type size) const;
 
+    /**
+     * Resize the file to @a size and ask the filesystem to allocate the
+     * extent up front. Callers use this when they are about to fill the
+     * whole file with positioned writes in arbitrary order: allocating the
+     * extent in one request keeps the file contiguous on disk, where
+     * growing it piecemeal from out-of-order writes fragments it.
+     *
+     * This is only a hint. Writers without an allocation primitive (or on
+     * filesystems lacking one) fall back to @ref resize, in which case
+     * regions that are never written simply remain sparse.
+     *
+     * This function is not guaranteed to be thread-safe.
+     */
+    void preallocate(offset_type size) const;
+
+    /**
+     * Return the POSIX file descriptor backing the writer, for use with
+     * asynchronous I/O interfaces. Returns -1 if the writer is not backed
+     * by a file descriptor, in which case callers must fall back to
+     * @ref write.
+     *
+     * @pre The file is open.
+     */
+    int fileDescriptor() const;
+
 private:
     /**
      * Implements @ref write. It does not need to check that the file is open or
@@ -211,11 +392,33 @@ private:
      */
     virtual std::size_t writeImpl(const void *buf, std::size_t count, offset_type offset) const = 0;
 
+    /**
+     * Implements @ref writev. The default implementation packs runs of
+     * slices into a temporary buffer and passes them to @ref writeImpl;
+     * subclasses with access to native scatter-gather I/O override it. It
+     * does not need to check that the file is open or put the filename into
+     * exceptions.
+     */
+    virtual std::size_t writevImpl(const Slice *slices, std::size_t numSlices, offset_type offset) const;
+
+    /**
+     * Implements @ref fileDescriptor. The default implementation returns -1.
+     */
+    virtual int fileDescriptorImpl() const;
+
     /**
      * Implements @ref resize. It does not need to check that the file is open or
      * put the filename into exceptions.
      */
     virtual void resizeImpl(offset_type size) const = 0;
+
+    /**
+     * Implements @ref preallocate. The default implementation just calls
+     * @ref resizeImpl; subclasses with access to an allocation primitive
+     * override it. It does not need to check that the file is open or put
+     * the filename into exceptions.
+     */
+    virtual void preallocateImpl(offset_type size) const;
 };
 
 /**
@@ -28,12 +28,27 @@
 # include <config.h>
 #endif
 #include <cstddef>
+#include <map>
+#include <string>
 #include <boost/filesystem/path.hpp>
 #include <mpi.h>
 #include "binary_io_mpi.h"
+#include "errors.h"
+
+std::map<std::string, std::string> BinaryWriterMPI::defaultHints()
+{
+    std::map<std::string, std::string> hints;
+    hints["romio_cb_write"] = "enable";
+    return hints;
+}
 
 BinaryWriterMPI::BinaryWriterMPI(MPI_Comm comm)
-    : comm(comm)
+    : comm(comm), hints(defaultHints())
+{
+}
+
+BinaryWriterMPI::BinaryWriterMPI(MPI_Comm comm, const std::map<std::string, std::string> &hints)
+    : comm(comm), hints(hints)
 {
 }
 
@@ -45,8 +60,22 @@ BinaryWriterMPI::~BinaryWriterMPI()
 
 void BinaryWriterMPI::openImpl(const boost::filesystem::path &path)
 {
+    MPI_Info info = MPI_INFO_NULL;
+    if (!hints.empty())
+    {
+        MPI_Info_create(&info);
+        for (std::map<std::string, std::string>::const_iterator i = hints.begin();
+             i != hints.end(); ++i)
+        {
+            MPI_Info_set(info,
+                         const_cast<char *>(i->first.c_str()),
+                         const_cast<char *>(i->second.c_str()));
+        }
+    }
     MPI_File_open(comm, const_cast<char *>(path.string().c_str()),
-                  MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &handle);
+                  MPI_MODE_WRONLY | MPI_MODE_CREATE, info, &handle);
+    if (info != MPI_INFO_NULL)
+        MPI_Info_free(&info);
     MPI_File_set_atomicity(handle, false);
 }
 
@@ -61,8 +90,26 @@ std::size_t BinaryWriterMPI::writeImpl(const void *buf, std::size_t count, offse
     return count;
 }
 
+std::size_t BinaryWriterMPI::writeAll(const void *buf, std::size_t count, offset_type offset) const
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    MPI_File_write_at_all(handle, offset, const_cast<void *>(buf), count, MPI_BYTE,
+                          MPI_STATUS_IGNORE);
+    return count;
+}
+
 void BinaryWriterMPI::resizeImpl(offset_type size) const
 {
     MPI_File_set_size(handle, size);
     MPI_File_sync(handle);
 }
+
+void BinaryWriterMPI::preallocateImpl(offset_type size) const
+{
+    /* set_size first: preallocate only ever extends the file, and the
+     * combination gives the same length semantics as resize.
+     */
+    MPI_File_set_size(handle, size);
+    MPI_File_preallocate(handle, size);
+    MPI_File_sync(handle);
+}
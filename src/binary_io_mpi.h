@@ -31,29 +31,73 @@
 # include <config.h>
 #endif
 #include <cstddef>
+#include <map>
+#include <string>
 #include <boost/filesystem/path.hpp>
 #include <mpi.h>
 #include "binary_io.h"
 
 /**
- * Binary writer for MPI. The @ref open, @ref close and @ref resize operations
- * are collective, while writes may be made independently. Atomic mode is not
- * used, so to guarantee consistency it is required that no writes overlap.
+ * Binary writer for MPI. The @ref open, @ref close, @ref resize and
+ * @ref preallocate operations are collective, while writes may be made
+ * independently. Atomic mode is not used, so to guarantee consistency it is
+ * required that no writes overlap.
+ *
+ * Hints are passed to @c MPI_File_open, enabling collective buffering by
+ * default (see @ref defaultHints). Callers with knowledge of the target
+ * filesystem can supply their own map to tune aggregation (e.g.
+ * @c cb_nodes, @c cb_buffer_size, @c striping_factor, @c striping_unit).
  */
 class BinaryWriterMPI : public BinaryWriter
 {
 public:
+    /// Constructor using @ref defaultHints
     explicit BinaryWriterMPI(MPI_Comm comm);
+
+    /**
+     * Constructor with user-specified hints, replacing @ref defaultHints.
+     *
+     * @param comm   Communicator that will be used to open the file.
+     * @param hints  Key/value pairs passed to @c MPI_File_open via @c MPI_Info.
+     */
+    BinaryWriterMPI(MPI_Comm comm, const std::map<std::string, std::string> &hints);
+
     virtual ~BinaryWriterMPI();
 
+    /**
+     * Collective equivalent of @ref write, implemented with
+     * @c MPI_File_write_at_all so that the MPI-IO layer can aggregate the
+     * pieces into large stripe-aligned writes. All ranks in the
+     * communicator must call it the same number of times; a rank with
+     * nothing to contribute passes a zero @a count. The regions written
+     * must not overlap.
+     *
+     * @param buf      Buffer containing the data (ignored if @a count is 0)
+     * @param count    Number of bytes to write
+     * @param offset   Position in file to start write
+     * @return The number of bytes written.
+     *
+     * @pre The file is open.
+     */
+    std::size_t writeAll(const void *buf, std::size_t count, offset_type offset) const;
+
+    /**
+     * Hints used by the single-argument constructor: collective buffering
+     * is requested (@c romio_cb_write = @c enable) and everything else is
+     * left to the MPI-IO implementation.
+     */
+    static std::map<std::string, std::string> defaultHints();
+
 private:
     MPI_Comm comm;    ///< Communicator that will be used to open the file
     MPI_File handle;  ///< File handle when it is open
+    std::map<std::string, std::string> hints;  ///< Hints for @c MPI_File_open
 
     virtual void openImpl(const boost::filesystem::path &path);
     virtual void closeImpl();
     virtual std::size_t writeImpl(const void *buf, std::size_t count, offset_type offset) const;
     virtual void resizeImpl(offset_type size) const;
+    virtual void preallocateImpl(offset_type size) const;
 };
 
 #endif /* BINARY_IO_MPI_H */
@@ -0,0 +1,181 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Demand-paged access to blob files held on remote MPI ranks.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <mpi.h>
+#include <algorithm>
+#include <cstring>
+#include <ios>
+#include "tr1_cstdint.h"
+#include <boost/bind.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "blob_mpi.h"
+#include "errors.h"
+#include "serialize.h"
+#include "statistics.h"
+#include "tags.h"
+#include "thread_name.h"
+
+namespace SplatSet
+{
+
+const std::size_t BlobPageCache::pageSize;
+
+BlobPageCache::BlobPageCache(std::size_t maxPages)
+    : maxPages(maxPages),
+    pages("mem.BlobPageCache::pages"),
+    fetchStat(Statistics::getStatistic<Statistics::Counter>("blob.page.fetches")),
+    hitStat(Statistics::getStatistic<Statistics::Counter>("blob.page.hits"))
+{
+    MLSGPU_ASSERT(maxPages > 0, std::invalid_argument);
+}
+
+const char *BlobPageCache::getPage(
+    MPI_Comm comm, int rank, std::tr1::uint64_t page, std::size_t &size)
+{
+    const Key key(rank, page);
+    map_type::iterator pos = pages.find(key);
+    if (pos != pages.end())
+    {
+        hitStat.add();
+        lru.splice(lru.begin(), lru, pos->second.lruPos);
+        pos->second.lruPos = lru.begin();
+        size = pos->second.size;
+        return &pos->second.data[0];
+    }
+
+    fetchStat.add();
+    std::tr1::uint64_t req[2];
+    req[0] = page * std::tr1::uint64_t(pageSize);
+    req[1] = pageSize;
+    MPI_Send(req, 2, Serialize::mpi_type_traits<std::tr1::uint64_t>::type(),
+             rank, MLSGPU_TAG_BLOB_REQUEST, comm);
+
+    Entry &entry = pages[key];
+    entry.data.resize(pageSize);
+    MPI_Status status;
+    MPI_Recv(&entry.data[0], pageSize, MPI_BYTE,
+             rank, MLSGPU_TAG_BLOB_REPLY, comm, &status);
+    int got;
+    MPI_Get_count(&status, MPI_BYTE, &got);
+    entry.size = got;
+    lru.push_front(key);
+    entry.lruPos = lru.begin();
+
+    while (pages.size() > maxPages)
+    {
+        pages.erase(lru.back());
+        lru.pop_back();
+    }
+    size = entry.size;
+    return &entry.data[0];
+}
+
+BlobServerMPI::BlobServerMPI(MPI_Comm comm, const boost::filesystem::path &path)
+    : comm(comm), path(path)
+{
+    MPI_Comm_rank(comm, &rank);
+}
+
+BlobServerMPI::~BlobServerMPI()
+{
+    if (thread)
+        stop();
+}
+
+void BlobServerMPI::start()
+{
+    MLSGPU_ASSERT(!thread, state_error);
+    thread.reset(new boost::thread(boost::bind(&BlobServerMPI::serve, this)));
+}
+
+void BlobServerMPI::stop()
+{
+    MLSGPU_ASSERT(thread, state_error);
+    std::tr1::uint64_t req[2] = {0, 0};
+    MPI_Send(req, 2, Serialize::mpi_type_traits<std::tr1::uint64_t>::type(),
+             rank, MLSGPU_TAG_BLOB_REQUEST, comm);
+    thread->join();
+    thread.reset();
+}
+
+void BlobServerMPI::serve()
+{
+    thread_set_name("blobserver");
+
+    boost::filesystem::ifstream in(path, std::ios::binary);
+    Statistics::Container::vector<char> buffer("mem.BlobServerMPI::buffer");
+    buffer.resize(BlobPageCache::pageSize);
+
+    while (true)
+    {
+        std::tr1::uint64_t req[2];
+        MPI_Status status;
+        MPI_Recv(req, 2, Serialize::mpi_type_traits<std::tr1::uint64_t>::type(),
+                 MPI_ANY_SOURCE, MLSGPU_TAG_BLOB_REQUEST, comm, &status);
+        if (req[1] == 0)
+            break;
+
+        const std::size_t len = std::min(std::tr1::uint64_t(buffer.size()), req[1]);
+        std::streamsize got = 0;
+        in.clear();
+        in.seekg(std::streamoff(req[0]));
+        if (in)
+        {
+            in.read(&buffer[0], len);
+            got = in.gcount();
+        }
+        MPI_Send(&buffer[0], int(got), MPI_BYTE,
+                 status.MPI_SOURCE, MLSGPU_TAG_BLOB_REPLY, comm);
+    }
+}
+
+RemoteBlobFileReader::RemoteBlobFileReader(MPI_Comm comm, int rank, BlobPageCache &cache)
+    : comm(comm), rank(rank), cache(cache), position(0)
+{
+}
+
+void RemoteBlobFileReader::read(char *buffer, std::size_t bytes)
+{
+    while (bytes > 0)
+    {
+        const std::tr1::uint64_t page = position / BlobPageCache::pageSize;
+        const std::size_t offset = std::size_t(position % BlobPageCache::pageSize);
+        std::size_t pageBytes;
+        const char *data = cache.getPage(comm, rank, page, pageBytes);
+        if (pageBytes <= offset)
+            throw std::ios::failure("Unexpected end of blob file");
+        const std::size_t n = std::min(bytes, pageBytes - offset);
+        std::memcpy(buffer, data + offset, n);
+        buffer += n;
+        bytes -= n;
+        position += n;
+    }
+}
+
+} // namespace SplatSet
@@ -0,0 +1,184 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Demand-paged access to blob files held on remote MPI ranks.
+ *
+ * In an MPI run each rank computes the blobs for its own share of the
+ * splats and keeps them in a node-local temporary file (see
+ * @ref SplatSet::FastBlobSetMPI). Rather than replicating the files or
+ * assuming a shared filesystem, each rank runs a @ref BlobServerMPI that
+ * serves fixed-size pages of its own file on request, and readers pull just
+ * the pages they touch through a bounded LRU cache (@ref BlobPageCache).
+ */
+
+#ifndef BLOB_MPI_H
+#define BLOB_MPI_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <mpi.h>
+#include <cstddef>
+#include <list>
+#include <utility>
+#include "tr1_cstdint.h"
+#include <boost/filesystem/path.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include "splat_set.h"
+#include "allocator.h"
+#include "statistics.h"
+
+namespace SplatSet
+{
+
+/**
+ * Bounded LRU cache of pages fetched from remote blob files. Pages are
+ * @ref pageSize bytes, except possibly the last page of a file. The cache
+ * is keyed on (rank, page number), so a single cache can serve reads from
+ * all the blob files of a set. It is not thread-safe: only one blob stream
+ * may use it at a time, which matches the usage of blob streams elsewhere.
+ */
+class BlobPageCache : public boost::noncopyable
+{
+public:
+    /// Size of a full page, and the transfer unit over MPI
+    static const std::size_t pageSize = 65536;
+
+    /// Constructor. At most @a maxPages pages are retained.
+    explicit BlobPageCache(std::size_t maxPages);
+
+    /**
+     * Return the contents of one page of the blob file owned by @a rank,
+     * fetching it from the owner's @ref BlobServerMPI on a cache miss.
+     *
+     * @param comm       Communicator on which the servers were started.
+     * @param rank       Rank owning the blob file.
+     * @param page       Page number (byte offset divided by @ref pageSize).
+     * @param[out] size  Number of valid bytes in the page. This is less than
+     *                   @ref pageSize only for the final page of the file.
+     * @return A pointer to the page data, valid until the next call.
+     */
+    const char *getPage(MPI_Comm comm, int rank, std::tr1::uint64_t page, std::size_t &size);
+
+private:
+    typedef std::pair<int, std::tr1::uint64_t> Key;
+
+    /// Hash function for @ref Key
+    struct KeyHash
+    {
+        std::size_t operator()(const Key &key) const
+        {
+            return std::tr1::hash<std::tr1::uint64_t>()(
+                (std::tr1::uint64_t(key.first) << 48) ^ key.second);
+        }
+    };
+
+    struct Entry
+    {
+        Statistics::Container::vector<char> data;  ///< Page contents (see @ref size)
+        std::size_t size;                          ///< Valid bytes in @ref data
+        std::list<Key>::iterator lruPos;           ///< Position in @ref lru
+
+        Entry() : data("mem.BlobPageCache::data"), size(0) {}
+    };
+
+    typedef Statistics::Container::unordered_map<Key, Entry, KeyHash> map_type;
+
+    std::size_t maxPages;     ///< Maximum number of retained pages
+    map_type pages;           ///< Cached pages
+    std::list<Key> lru;       ///< Keys in order from most to least recently used
+
+    Statistics::Counter &fetchStat;   ///< Pages fetched over MPI
+    Statistics::Counter &hitStat;     ///< Lookups satisfied from the cache
+};
+
+/**
+ * Server for one rank's blob file. The server runs in its own thread and
+ * answers page requests from @ref BlobPageCache on any rank, so the host
+ * rank can carry on with other (MPI) work; this requires the MPI
+ * implementation to support @c MPI_THREAD_MULTIPLE. Requests are a pair of
+ * unsigned 64-bit values (byte offset and length, the length at most
+ * @ref BlobPageCache::pageSize) with tag @c MLSGPU_TAG_BLOB_REQUEST; the
+ * reply carries the bytes (short at end-of-file) with tag
+ * @c MLSGPU_TAG_BLOB_REPLY. A request with zero length shuts the server
+ * down, and is sent by @ref stop.
+ */
+class BlobServerMPI : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. The server does not accept requests until @ref start is
+     * called.
+     *
+     * @param comm     Communicator to serve. It must not be used for any
+     *                 other traffic with the blob tags.
+     * @param path     File to serve.
+     */
+    BlobServerMPI(MPI_Comm comm, const boost::filesystem::path &path);
+
+    /// Destructor. Calls @ref stop if the server is still running.
+    ~BlobServerMPI();
+
+    /// Start the server thread.
+    void start();
+
+    /**
+     * Shut down the server thread and wait for it. Callers must ensure that
+     * no rank can still issue requests, otherwise that rank will block
+     * forever waiting for a reply.
+     */
+    void stop();
+
+private:
+    /// Thread function: serve requests until told to shut down.
+    void serve();
+
+    MPI_Comm comm;                             ///< Communicator to serve
+    int rank;                                  ///< Own rank in @ref comm
+    boost::filesystem::path path;              ///< File being served
+    boost::scoped_ptr<boost::thread> thread;   ///< Server thread, if running
+};
+
+/**
+ * Implementation of @ref detail::BlobFileReader that reads a file served by
+ * a remote rank's @ref BlobServerMPI, page by page through a
+ * @ref BlobPageCache. The cache must outlive the reader.
+ */
+class RemoteBlobFileReader : public detail::BlobFileReader
+{
+private:
+    MPI_Comm comm;                  ///< Communicator on which the servers run
+    int rank;                       ///< Rank owning the file
+    BlobPageCache &cache;           ///< Cache to read through
+    std::tr1::uint64_t position;    ///< Current read offset in the file
+
+public:
+    RemoteBlobFileReader(MPI_Comm comm, int rank, BlobPageCache &cache);
+    virtual void read(char *buffer, std::size_t bytes);
+};
+
+} // namespace SplatSet
+
+#endif /* !BLOB_MPI_H */
@@ -0,0 +1,157 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Bloom filter over 64-bit keys.
+ */
+
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __STDC_CONSTANT_MACROS
+# define __STDC_CONSTANT_MACROS
+#endif
+
+#include <cstddef>
+#include <string>
+#include "tr1_cstdint.h"
+#include "statistics.h"
+#include "allocator.h"
+
+/**
+ * Bloom filter over 64-bit keys: a compact set approximation which may
+ * report keys that were never added (false positives) but never the
+ * reverse. It is used to skip expensive exact lookups in the common case
+ * where the key is known to be absent.
+ *
+ * The filter must be sized with @ref resize before use; an unsized filter
+ * reports every key as absent, which matches its (empty) content. Sizing
+ * is the caller's problem because a Bloom filter cannot grow in place: to
+ * extend one, call @ref resize and re-add the keys.
+ *
+ * The bit array is a power of two in size and each key sets a small fixed
+ * number of bits derived from a mixed hash, so a query touches at most a
+ * couple of cache lines. At the recommended 10 bits per expected key the
+ * false-positive rate is under 1%.
+ */
+class BloomFilter
+{
+public:
+    typedef std::tr1::uint64_t key_type;
+
+    /**
+     * Constructor. The filter starts unsized (see @ref resize).
+     *
+     * @param allocName  Name to account the memory under (see @ref Statistics::Allocator).
+     */
+    explicit BloomFilter(const std::string &allocName)
+        : words(allocName), mask(0), entries(0) {}
+
+    /**
+     * Allocate (or re-allocate) the bit array for roughly @a expectedEntries
+     * keys at @ref BITS_PER_ENTRY bits each, rounded up to a power of two,
+     * and discard any current content.
+     */
+    void resize(std::size_t expectedEntries)
+    {
+        std::size_t numWords = 1;
+        while (numWords * 64 < expectedEntries * BITS_PER_ENTRY)
+            numWords *= 2;
+        words.assign(numWords, word_type(0));
+        mask = numWords * 64 - 1;
+        entries = 0;
+    }
+
+    /// Number of keys the current array was sized for (0 when unsized)
+    std::size_t capacity() const
+    {
+        return words.empty() ? 0 : (mask + 1) / BITS_PER_ENTRY;
+    }
+
+    /// Number of keys added since the last @ref resize
+    std::size_t size() const { return entries; }
+
+    /// Add a key. @pre the filter has been sized with @ref resize.
+    void add(key_type key)
+    {
+        std::tr1::uint64_t h = mix(key);
+        std::size_t h1 = (std::size_t) h;
+        const std::size_t h2 = (std::size_t) (h >> 32) | 1; // odd, so all probes differ
+        for (int i = 0; i < PROBES; i++)
+        {
+            const std::size_t bit = h1 & mask;
+            words[bit / 64] |= word_type(1) << (bit % 64);
+            h1 += h2;
+        }
+        entries++;
+    }
+
+    /**
+     * Determine whether @a key may have been added. A @c false return is
+     * authoritative; @c true may be a false positive.
+     */
+    bool maybeContains(key_type key) const
+    {
+        if (words.empty())
+            return false;
+        std::tr1::uint64_t h = mix(key);
+        std::size_t h1 = (std::size_t) h;
+        const std::size_t h2 = (std::size_t) (h >> 32) | 1;
+        for (int i = 0; i < PROBES; i++)
+        {
+            const std::size_t bit = h1 & mask;
+            if (!(words[bit / 64] & (word_type(1) << (bit % 64))))
+                return false;
+            h1 += h2;
+        }
+        return true;
+    }
+
+private:
+    typedef std::tr1::uint64_t word_type;
+
+    /// Sizing factor used by @ref resize
+    static const std::size_t BITS_PER_ENTRY = 10;
+    /// Number of bits set/tested per key
+    static const int PROBES = 4;
+
+    /// Finalizer from MurmurHash3 (see also @ref KeyMap)
+    static std::tr1::uint64_t mix(std::tr1::uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= UINT64_C(0xff51afd7ed558ccd);
+        k ^= k >> 33;
+        k *= UINT64_C(0xc4ceb9fe1a85ec53);
+        k ^= k >> 33;
+        return k;
+    }
+
+    Statistics::Container::vector<word_type> words;  ///< The bit array (empty when unsized)
+    std::size_t mask;      ///< Number of bits minus one (valid when sized)
+    std::size_t entries;   ///< Number of keys added since sizing
+};
+
+#endif /* !BLOOM_FILTER_H */
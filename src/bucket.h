@@ -132,6 +132,8 @@ public:
  * @param recursionState Optional parameter indicating recursion statistics
  *                   on entry. This is intended for use when the processing
  *                   callback calls this function again.
+ * @param numThreads Number of threads over which to spread the recursion
+ *                   (see below); 1 recurses serially on the calling thread.
  *
  * @throw DensityError If any single grid cell conservatively intersects more
  *                     than @a maxSplats splats.
@@ -139,6 +141,15 @@ public:
  * @note If any splat falls completely outside of @a region, it is undefined
  * whether it will be passed to the processing function at all.
  *
+ * @note The duplication of boundary splats into neighbouring buckets is
+ * already tight per splat: a splat is entered into exactly the buckets that
+ * its own support cube (position &plusmn; radius) touches, because blobs
+ * (see @ref SplatSet::FastBlobSet) only group splats with identical bucket
+ * coverage. There is no global worst-case-radius margin that an adaptive
+ * scheme could shrink; the only duplicates are splats whose own support
+ * genuinely straddles a border, and the MLS evaluation of each side needs
+ * those.
+ *
  * @see @ref ProcessorType.
  *
  * @internal
@@ -176,6 +187,16 @@ public:
  *     A single splat can be placed into multiple buckets if it straddles
  *     subregion borders.
  * The subregions are then processed recursively.
+ *
+ * When @a numThreads is greater than 1, the subregions are not recursed into
+ * on the calling thread. Instead each becomes an independent task on a shared
+ * pool (see @ref detail::BucketPool): a task walks its own blob stream, and
+ * either spawns further tasks or records its region as a bucket. The calling
+ * thread then replays the completed task tree depth-first, so @a process is
+ * still called serially and with the buckets in exactly the order a serial
+ * run would produce them (callers such as @ref BucketCollector depend on the
+ * walk being deterministic and visiting each chunk contiguously). Only the
+ * top-level pass over the whole input remains serial.
  */
 template<typename Splats>
 void bucket(const Splats &splats,
@@ -186,7 +207,53 @@ void bucket(const Splats &splats,
             Grid::size_type microCells,
             std::size_t maxSplit,
             const typename ProcessorType<Splats>::type &process,
-            const Recursion &recursionState = Recursion());
+            const Recursion &recursionState = Recursion(),
+            std::size_t numThreads = 1);
+
+/**
+ * Variant of @ref bucket that slices the region into slabs along its
+ * dominant (longest) axis and runs the bucketing algorithm once per slab.
+ * The coarse structures (the octrees of counters and the per-subregion blob
+ * ranges) then cover only one slab at a time, so their memory is bounded by
+ * the size of a slab rather than of the whole region.
+ *
+ * For each slab, the blob stream is walked once to collect the splats whose
+ * blobs intersect the slab, and the resulting subset is bucketed over the
+ * slab's sub-grid. A splat that straddles a slab boundary is passed to both
+ * slabs, which is the same guarantee that @ref bucket makes for splats
+ * straddling subregion borders. The extra cost over @ref bucket is one walk
+ * of the blob stream per slab.
+ *
+ * @a slabCells is rounded up to a multiple of the microblock size and of the
+ * (rounded) chunk size, so that slab membership of a blob is exact and output
+ * chunks do not straddle slab boundaries; the chunk coordinates passed to
+ * the processor are consistent with those of an unsliced run. Passing zero
+ * for @a slabCells, or a value at least the extent of the dominant axis,
+ * is equivalent to calling @ref bucket.
+ *
+ * Each slab is bucketed with @a numThreads threads as described for @ref
+ * bucket; the pool is created afresh per slab, so the memory for a slab's
+ * task tree is released before the next slab starts.
+ *
+ * @param splats,region,maxSplats,maxCells,chunkCells,microCells,maxSplit,process,numThreads As for @ref bucket.
+ * @param slabCells  Maximum slab thickness in cells along the dominant axis.
+ *
+ * @pre @a microCells is non-zero if slicing actually takes place.
+ *
+ * @throw DensityError If any single grid cell conservatively intersects more
+ *                     than @a maxSplats splats.
+ */
+template<typename Splats>
+void bucketSlabs(const Splats &splats,
+                 const Grid &region,
+                 std::tr1::uint64_t maxSplats,
+                 Grid::size_type maxCells,
+                 Grid::size_type chunkCells,
+                 Grid::size_type microCells,
+                 std::size_t maxSplit,
+                 Grid::size_type slabCells,
+                 const typename ProcessorType<Splats>::type &process,
+                 std::size_t numThreads = 1);
 
 } // namespace Bucket
 
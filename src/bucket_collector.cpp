@@ -27,22 +27,150 @@
 #if HAVE_CONFIG_H
 # include <config.h>
 #endif
+#include <iterator>
+#include <algorithm>
+#include <ostream>
 #include <boost/function.hpp>
 #include <boost/ref.hpp>
+#include <boost/foreach.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/filesystem/operations.hpp>
 #include "splat_set.h"
 #include "statistics.h"
+#include "errors.h"
 #include "allocator.h"
 #include "timeplot.h"
 #include "chunk_id.h"
 #include "bucket.h"
+#include "decache.h"
+#include "diskstats.h"
+#include "progress.h"
+#include "incremental.h"
 #include "bucket_collector.h"
 
+namespace
+{
+    /// Number of splats to stream per read while hashing a chunk
+    const std::size_t HASH_BUFFER_SPLATS = 64 * 1024;
+
+    /**
+     * Interleave the bits of three coordinates (z major), as in
+     * @ref SplatTree::makeCode but 64-bit. Only the low 21 bits of each
+     * coordinate participate; beyond that the ordering degrades gracefully
+     * to coarse locality rather than failing.
+     */
+    std::tr1::uint64_t mortonCode(
+        std::tr1::uint64_t x, std::tr1::uint64_t y, std::tr1::uint64_t z)
+    {
+        std::tr1::uint64_t ans = 0;
+        for (int shift = 0; shift < 63; shift += 3)
+        {
+            ans += ((x & 1) + ((y & 1) << 1) + ((z & 1) << 2)) << shift;
+            x >>= 1;
+            y >>= 1;
+            z >>= 1;
+        }
+        return ans;
+    }
+
+    /**
+     * Orders bins by chunk generation, then by the Morton code of the lower
+     * corner of their grids. Chunks thus stay in generation order (which
+     * checkpointing and the mesher's chunk buffering rely on) while the bins
+     * within a chunk follow the space-filling curve.
+     */
+    struct BinMortonCompare
+    {
+        Grid::difference_type bias[3];  ///< Subtracted to make coordinates non-negative
+
+        std::tr1::uint64_t key(const BucketCollector::Bin &bin) const
+        {
+            return mortonCode(
+                bin.grid.getExtent(0).first - bias[0],
+                bin.grid.getExtent(1).first - bias[1],
+                bin.grid.getExtent(2).first - bias[2]);
+        }
+
+        bool operator()(const BucketCollector::Bin &a, const BucketCollector::Bin &b) const
+        {
+            if (a.chunkId.gen != b.chunkId.gen)
+                return a.chunkId.gen < b.chunkId.gen;
+            return key(a) < key(b);
+        }
+    };
+}
+
 BucketCollector::BucketCollector(SplatSet::splat_id maxSplats, Functor functor)
     : maxSplats(maxSplats), functor(functor),
-    bins("mem.BucketCollector.bins"), numSplats(0),
+    bins("mem.BucketCollector.bins"), numSplats(0), prefetchSet(NULL),
+    checkpointInterval(0.0), resuming(false), resumeGen(0),
+    journal(NULL), repairing(false),
+    completeBelowGen(0),
+    super(NULL), oldHashes(NULL), newHashes(NULL), progress(NULL),
+    chunkBins("mem.BucketCollector.chunkBins"),
+    hashBuffer("mem.BucketCollector.hashBuffer"),
     binsStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.bins")),
-    splatsStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.splats"))
+    splatsStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.splats")),
+    budgetStat(Statistics::getStatistic<Statistics::Variable>("bucket.collector.budget"))
+{
+}
+
+void BucketCollector::setBudget(const BudgetFunctor &budget)
+{
+    this->budget = budget;
+}
+
+void BucketCollector::setPrefetch(const SplatSet::FileSet &super)
+{
+    if (fetchaheadSupported())
+        prefetchSet = &super;
+}
+
+void BucketCollector::setCheckpoint(const CheckpointFunctor &functor, double interval)
+{
+    MLSGPU_ASSERT(super == NULL, state_error);
+    checkpointFunctor = functor;
+    checkpointInterval = interval;
+    checkpointTimer = Timer();
+}
+
+void BucketCollector::setResume(ChunkId::gen_type lastGen)
+{
+    MLSGPU_ASSERT(super == NULL, state_error);
+    resuming = true;
+    resumeGen = lastGen;
+}
+
+void BucketCollector::setIncremental(
+    const SplatSet::FileSet &super,
+    const Grid &fullGrid,
+    const ChunkHashes &oldHashes,
+    ChunkHashes &newHashes,
+    const boost::function<std::string(const ChunkId &)> &namer)
+{
+    this->super = &super;
+    this->fullGrid = fullGrid;
+    this->oldHashes = &oldHashes;
+    this->newHashes = &newHashes;
+    this->namer = namer;
+    hashBuffer.reserve(HASH_BUFFER_SPLATS);
+}
+
+void BucketCollector::setJournal(std::ostream *journal)
+{
+    this->journal = journal;
+}
+
+void BucketCollector::setRepair(const std::set<boost::array<Grid::size_type, 3> > &chunks)
 {
+    MLSGPU_ASSERT(super == NULL, state_error);
+    repairing = true;
+    repairChunks = chunks;
+}
+
+void BucketCollector::setProgress(ProgressMeter *progress)
+{
+    this->progress = progress;
 }
 
 void BucketCollector::operator()(
@@ -50,29 +178,246 @@ void BucketCollector::operator()(
     const Grid &grid,
     const Bucket::Recursion &recursionState)
 {
-    if (numSplats + splats.numSplats() > maxSplats)
-        flush();
-
     if (recursionState.chunk != curChunkId.coords)
     {
+        if (super != NULL)
+        {
+            finishChunk();
+            completeBelowGen = curChunkId.gen + 1;
+        }
+        else
+        {
+            completeBelowGen = curChunkId.gen + 1;
+            if (checkpointFunctor
+                && !(resuming && curChunkId.gen <= resumeGen)
+                && checkpointTimer.getElapsed() >= checkpointInterval)
+            {
+                /* All bins for generations up to curChunkId.gen have now been
+                 * seen. Push them downstream so that the checkpoint functor can
+                 * drain the pipeline and capture a consistent snapshot.
+                 */
+                flushBins();
+                checkpointFunctor(curChunkId.gen);
+                checkpointTimer = Timer();
+            }
+        }
         curChunkId.gen++;
         curChunkId.coords = recursionState.chunk;
     }
 
-    bins.push_back(Bin());
-    Bin &bin = bins.back();
+    if (resuming && curChunkId.gen <= resumeGen)
+        return;   // bin was fully processed by the run being resumed
+
+    if (repairing && !repairChunks.count(curChunkId.coords))
+    {
+        // the chunk is not being repaired, so its existing output stands
+        Statistics::getStatistic<Statistics::Counter>("bucket.collector.repairSkippedBins").add();
+        Statistics::getStatistic<Statistics::Counter>("bucket.collector.repairSkippedSplats").add(splats.numSplats());
+        return;
+    }
+
+    if (super == NULL)
+    {
+        SplatSet::splat_id target = maxSplats;
+        if (budget)
+        {
+            target = std::min(budget(), maxSplats);
+            budgetStat.add(target);
+        }
+        if (numSplats + splats.numSplats() > target)
+            flushBins();
+    }
+
+    Statistics::Container::vector<Bin> &target = (super != NULL) ? chunkBins : bins;
+    target.push_back(Bin());
+    Bin &bin = target.back();
     bin.ranges = splats;
     bin.grid = grid;
     bin.chunkId = curChunkId;
 
-    numSplats += splats.numSplats();
+    /* Start pulling the bin's data into the filesystem cache while the
+     * walk continues collecting the rest of the batch.
+     */
+    if (prefetchSet != NULL && Diskstats::readAheadAdvisable())
+        prefetchSet->prefetch(bin.ranges.begin(), bin.ranges.end());
+
+    if (super == NULL)
+        numSplats += splats.numSplats();
+}
+
+void BucketCollector::finishChunk()
+{
+    typedef std::pair<SplatSet::splat_id, SplatSet::splat_id> range_type;
+
+    if (chunkBins.empty())
+        return;
+
+    /* Hash the structure of the bins. Content alone is not quite enough:
+     * a change in bucketing parameters changes the set of splats assigned
+     * to each bucket, and hence potentially the output, without necessarily
+     * changing the merged content.
+     */
+    SplatHash hash;
+    Grid::difference_type lo[3] = {0, 0, 0};
+    Grid::difference_type hi[3] = {0, 0, 0};
+    for (std::size_t i = 0; i < chunkBins.size(); i++)
+    {
+        const Bin &bin = chunkBins[i];
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            const Grid::extent_type e = bin.grid.getExtent(j);
+            if (i == 0)
+            {
+                lo[j] = e.first;
+                hi[j] = e.second;
+            }
+            else
+            {
+                lo[j] = std::min(lo[j], e.first);
+                hi[j] = std::max(hi[j], e.second);
+            }
+            hash.append(std::tr1::uint64_t(std::tr1::int64_t(e.first)));
+            hash.append(std::tr1::uint64_t(std::tr1::int64_t(e.second)));
+        }
+        hash.append(bin.ranges.numSplats());
+    }
+
+    /* Merge the ranges so that each splat is read (and hashed) only once,
+     * even if it straddles several bins.
+     */
+    Statistics::Container::vector<range_type> ranges("mem.BucketCollector.ranges");
+    BOOST_FOREACH(const Bin &bin, chunkBins)
+    {
+        Statistics::Container::vector<range_type> tmp("mem.BucketCollector.ranges");
+        SplatSet::merge(bin.ranges.begin(), bin.ranges.end(),
+                        ranges.begin(), ranges.end(), std::back_inserter(tmp));
+        tmp.swap(ranges);
+    }
+
+    /* Hash the content, counting the splats whose centers fall inside the
+     * chunk along the way. The bins tile the chunk, so this count matches
+     * what the device workers would have contributed to the progress meter.
+     */
+    float chunkLo[3], chunkHi[3];
+    for (unsigned int j = 0; j < 3; j++)
+    {
+        const Grid::difference_type base = fullGrid.getExtent(j).first;
+        chunkLo[j] = lo[j] - base;
+        chunkHi[j] = hi[j] - base;
+    }
+    ProgressMeter::size_type insideSplats = 0;
+    {
+        boost::scoped_ptr<SplatSet::SplatStream> splatStream(
+            super->makeSplatStream(ranges.begin(), ranges.end()));
+        const Grid::WorldToVertex toVertex(fullGrid);
+        std::size_t numRead;
+        while ((numRead = splatStream->read(&hashBuffer[0], NULL, HASH_BUFFER_SPLATS)) != 0)
+        {
+            hash.append(&hashBuffer[0], numRead * sizeof(Splat));
+            for (std::size_t i = 0; i < numRead; i++)
+            {
+                float vertex[3];
+                toVertex(hashBuffer[i].position, vertex);
+                bool inside = true;
+                for (unsigned int j = 0; j < 3; j++)
+                    inside = inside && vertex[j] >= chunkLo[j] && vertex[j] < chunkHi[j];
+                insideSplats += inside;
+            }
+        }
+    }
+
+    const ChunkId chunkId = chunkBins.front().chunkId;
+    const ChunkHashes::value_type newHash = hash.get();
+    newHashes->set(chunkId.coords, newHash);
+
+    ChunkHashes::value_type oldHash;
+    const bool skip = oldHashes->find(chunkId.coords, oldHash)
+        && oldHash == newHash
+        && boost::filesystem::exists(boost::filesystem::path(namer(chunkId)));
+    if (skip)
+    {
+        SplatSet::splat_id skippedSplats = 0;
+        BOOST_FOREACH(const Bin &bin, chunkBins)
+            skippedSplats += bin.ranges.numSplats();
+        Statistics::getStatistic<Statistics::Counter>("bucket.collector.skippedChunks").add();
+        Statistics::getStatistic<Statistics::Counter>("bucket.collector.skippedSplats").add(skippedSplats);
+        if (progress != NULL)
+            *progress += insideSplats;
+    }
+    else
+    {
+        BOOST_FOREACH(const Bin &bin, chunkBins)
+        {
+            if (numSplats + bin.ranges.numSplats() > maxSplats)
+                flushBins();
+            bins.push_back(bin);
+            numSplats += bin.ranges.numSplats();
+        }
+    }
+    chunkBins.clear();
 }
 
 void BucketCollector::flush()
+{
+    if (super != NULL)
+        finishChunk();
+    completeBelowGen = curChunkId.gen + 1; // no further bins can arrive
+    flushBins();
+    if (journal != NULL)
+    {
+        *journal << "complete\n";
+        journal->flush();
+    }
+}
+
+void BucketCollector::flushBins()
 {
     if (bins.empty())
         return;
 
+    BinMortonCompare compare;
+    for (unsigned int j = 0; j < 3; j++)
+    {
+        compare.bias[j] = bins[0].grid.getExtent(j).first;
+        for (std::size_t i = 1; i < bins.size(); i++)
+            compare.bias[j] = std::min(compare.bias[j], bins[i].grid.getExtent(j).first);
+    }
+    std::stable_sort(bins.begin(), bins.end(), compare);
+
+    /* The sort leaves each chunk's bins contiguous, so the last bin of a
+     * fully-collected generation is the one whose completion releases the
+     * chunk downstream.
+     */
+    for (std::size_t i = 0; i < bins.size(); i++)
+    {
+        if ((i + 1 == bins.size() || bins[i + 1].chunkId.gen != bins[i].chunkId.gen)
+            && bins[i].chunkId.gen < completeBelowGen)
+            bins[i].chunkClosing = true;
+    }
+
+    if (journal != NULL)
+    {
+        BOOST_FOREACH(const Bin &bin, bins)
+        {
+            *journal << "bin " << bin.chunkId.gen
+                << ' ' << bin.chunkId.coords[0]
+                << ',' << bin.chunkId.coords[1]
+                << ',' << bin.chunkId.coords[2];
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                const Grid::extent_type e = bin.grid.getExtent(j);
+                *journal << ' ' << e.first << ':' << e.second;
+            }
+            *journal << ' ' << bin.ranges.numSplats() << '\n';
+            if (bin.chunkClosing)
+                *journal << "chunk " << bin.chunkId.coords[0]
+                    << ',' << bin.chunkId.coords[1]
+                    << ',' << bin.chunkId.coords[2] << " done\n";
+        }
+        // a crashed run should still leave a usable journal
+        journal->flush();
+    }
+
     binsStat.add(bins.size());
     splatsStat.add(numSplats);
 
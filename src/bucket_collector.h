@@ -31,12 +31,20 @@
 # include <config.h>
 #endif
 #include <boost/function.hpp>
+#include <boost/array.hpp>
+#include <string>
+#include <set>
+#include <iosfwd>
 #include "splat_set.h"
 #include "statistics.h"
 #include "allocator.h"
 #include "timeplot.h"
+#include "timer.h"
 #include "chunk_id.h"
 #include "bucket.h"
+#include "incremental.h"
+
+class ProgressMeter;
 
 /**
  * Receives multiple buckets from @ref Bucket::bucket and accumulates
@@ -44,6 +52,16 @@
  * makes a callback with the collected results.
  *
  * It also assigns generation numbers to chunk IDs.
+ *
+ * In incremental mode (see @ref setIncremental), the bins for each output
+ * chunk are instead held back until the chunk is complete, while a hash of
+ * the splat content is accumulated. If the hash matches the one recorded by
+ * a previous run and that run's output file still exists, the chunk's bins
+ * are discarded and the file is kept, instead of being recomputed.
+ *
+ * A journal of the emitted bins can be recorded (see @ref setJournal), and a
+ * later run can be restricted to recomputing named chunks from that journal
+ * (see @ref setRepair).
  */
 class BucketCollector : public boost::noncopyable
 {
@@ -53,10 +71,26 @@ public:
         SplatSet::SubsetBase ranges;
         ChunkId chunkId;
         Grid grid;
+
+        /**
+         * Whether this is the final bin of a fully-collected chunk.
+         * Downstream stages expedite such bins through their queues (see
+         * @ref WorkQueue::push), since completing one lets the mesher
+         * retire the chunk's buffered state.
+         */
+        bool chunkClosing;
+
+        Bin() : chunkClosing(false) {}
     };
 
     typedef boost::function<void(const Statistics::Container::vector<Bin> &bins)> Functor;
 
+    /**
+     * Functor returning the current target batch size, in splats (see
+     * @ref setBudget).
+     */
+    typedef boost::function<SplatSet::splat_id()> BudgetFunctor;
+
     void operator()(
         const SplatSet::SubsetBase &splats,
         const Grid &grid,
@@ -70,17 +104,185 @@ public:
      */
     BucketCollector(SplatSet::splat_id maxSplats, Functor functor);
 
-    void flush(); ///< Flush any partial bins to the output
+    /**
+     * Enable incremental mode. This must be called before any buckets are
+     * received.
+     *
+     * @param super     Backing store used to stream splat content for hashing.
+     * @param fullGrid  Bounding grid for the whole input.
+     * @param oldHashes Hashes recorded by the previous run (empty on a first run).
+     * @param newHashes Table to populate with the hashes for this run.
+     * @param namer     Generates the output filename for a chunk, used to
+     *                  check that a previous run's output still exists.
+     *
+     * @warning The caller must guarantee that @a super, @a oldHashes and
+     * @a newHashes outlive this object.
+     */
+    void setIncremental(
+        const SplatSet::FileSet &super,
+        const Grid &fullGrid,
+        const ChunkHashes &oldHashes,
+        ChunkHashes &newHashes,
+        const boost::function<std::string(const ChunkId &)> &namer);
+
+    /**
+     * Set a progress meter to be credited with the splats of skipped chunks,
+     * which would otherwise be counted by the device workers. It may be @c
+     * NULL to disable.
+     */
+    void setProgress(ProgressMeter *progress);
+
+    /**
+     * Enable OS readahead hints. As each bin is collected, its splat ranges
+     * are passed to @ref SplatSet::FileSet::prefetch on @a super, so the
+     * kernel can pull the data into the filesystem cache in file-offset
+     * order while up to a full batch of further buckets is still being
+     * walked. By the time the batch is flushed and @ref BucketLoader reads
+     * the splats, most of them are already cached, avoiding the seek storm
+     * that the bucket walk's file order would otherwise cause on spinning
+     * disks.
+     *
+     * @param super  The splat set that will later be read. The caller must
+     *               guarantee that it outlives this object.
+     */
+    void setPrefetch(const SplatSet::FileSet &super);
+
+    /**
+     * Functor invoked to take a mid-run checkpoint (see @ref setCheckpoint).
+     * The argument is the last chunk generation whose bins have all been
+     * passed to the batch functor.
+     */
+    typedef boost::function<void(ChunkId::gen_type)> CheckpointFunctor;
+
+    /**
+     * Arrange for periodic mid-run checkpoints. When at least @a interval
+     * seconds have passed since the previous checkpoint (or since
+     * construction), the next chunk boundary flushes the accumulated bins
+     * and calls @a functor with the generation of the chunk just completed.
+     * The functor is expected to drain the downstream pipeline and snapshot
+     * its state (see @ref MesherBase::checkpointRun) before returning.
+     *
+     * Checkpoints only happen at chunk boundaries because the bucket walk
+     * visits each chunk contiguously: once a boundary is crossed, no further
+     * bins can arrive for earlier generations, so a generation watermark
+     * fully describes the completed work.
+     *
+     * This may not be combined with incremental mode, which batches per
+     * chunk rather than by splat count.
+     */
+    void setCheckpoint(const CheckpointFunctor &functor, double interval);
+
+    /**
+     * Resume after a mid-run checkpoint. Bins for chunk generations up to
+     * and including @a lastGen are discarded instead of being passed to the
+     * functor; the bucket walk is deterministic, so these are exactly the
+     * bins that had been fully processed when the checkpoint was taken.
+     * Skipped bins are not credited to the progress meter, since the
+     * progress they represent is restored separately (see @ref
+     * MesherBase::resumeRun).
+     */
+    void setResume(ChunkId::gen_type lastGen);
+
+    /**
+     * Record the identity of each bin passed downstream to @a journal. Each
+     * bin produces a line giving its chunk generation, chunk coordinates,
+     * grid extents and splat count; a further line marks each chunk whose
+     * bins have all been emitted, and @ref flush appends a trailer marking
+     * the walk complete. The coordinates in the journal are the ones
+     * accepted by @ref setRepair, so a failed or suspect chunk can be named
+     * for recomputation on a later run. The stream is flushed after each
+     * batch so that a crashed run still leaves a usable journal. It must
+     * outlive this object; @c NULL disables journalling.
+     */
+    void setJournal(std::ostream *journal);
+
+    /**
+     * Restrict the run to the named output chunks. Bins belonging to any
+     * other chunk are discarded as they are collected, so only the named
+     * chunks are recomputed; with split output the remaining chunks' files
+     * are untouched and the rewritten files splice into the existing output.
+     * Chunks are named by their coordinates as recorded in the journal (and
+     * used to name split output files). Generation numbers are still
+     * assigned to skipped chunks, so they remain consistent between passes.
+     *
+     * Discarded bins are not credited to the progress meter (computing the
+     * credit would require streaming their splats, defeating the point of a
+     * repair), so the meter is only indicative during a repair run.
+     */
+    void setRepair(const std::set<boost::array<Grid::size_type, 3> > &chunks);
+
+    /**
+     * Set a functor that adapts the batch size at runtime. When set, it is
+     * queried before each batching decision and its return value (clamped to
+     * the @a maxSplats passed to the constructor) replaces @a maxSplats as
+     * the flush threshold. This allows a feedback controller to flush small
+     * batches while the device queues are draining and to accumulate larger
+     * ones under backpressure. It is not used in incremental mode, where
+     * batching is per chunk.
+     */
+    void setBudget(const BudgetFunctor &budget);
+
+    void flush(); ///< Flush any partial bins (and held-back chunk) to the output
 
 private:
     ChunkId curChunkId;           ///< Last-seen chunk ID
     SplatSet::splat_id maxSplats; ///< Limit on splats to pass to @ref functor
     Functor functor;              ///< Callback function
+    BudgetFunctor budget;         ///< Optional runtime batch size (see @ref setBudget)
     Statistics::Container::vector<Bin> bins;  ///< Buffer of splat ranges
     SplatSet::splat_id numSplats; ///< Splats collected in @ref bins
+    const SplatSet::FileSet *prefetchSet; ///< Target of readahead hints (@c NULL to disable)
+
+    CheckpointFunctor checkpointFunctor; ///< Mid-run checkpoint callback (see @ref setCheckpoint)
+    double checkpointInterval;    ///< Minimum seconds between checkpoints
+    Timer checkpointTimer;        ///< Time since the last checkpoint (or construction)
+    bool resuming;                ///< Whether @ref setResume was called
+    ChunkId::gen_type resumeGen;  ///< Last generation to discard when resuming
+
+    std::ostream *journal;        ///< Bin journal (@c NULL to disable; see @ref setJournal)
+    bool repairing;               ///< Whether @ref setRepair was called
+    std::set<boost::array<Grid::size_type, 3> > repairChunks; ///< Chunks to recompute when repairing
+
+    /**
+     * Chunk generations strictly below this have had all their bins
+     * collected, so their final bin can be flagged as chunk-closing (see
+     * @ref Bin::chunkClosing). It is advanced at each chunk boundary and
+     * by @ref flush.
+     */
+    ChunkId::gen_type completeBelowGen;
+
+    /**
+     * @name Incremental mode state
+     * @{
+     */
+    const SplatSet::FileSet *super; ///< Backing store for hashing (@c NULL unless incremental)
+    const ChunkHashes *oldHashes;   ///< Hashes from the previous run
+    ChunkHashes *newHashes;         ///< Hashes accumulated for this run
+    boost::function<std::string(const ChunkId &)> namer; ///< Maps chunk IDs to output filenames
+    Grid fullGrid;                  ///< Bounding grid, used to mirror progress accounting
+    ProgressMeter *progress;        ///< Progress credited with skipped splats (may be @c NULL)
+    Statistics::Container::vector<Bin> chunkBins; ///< Bins held back for the current chunk
+    Statistics::Container::PODBuffer<Splat> hashBuffer; ///< Staging area for streaming splats while hashing
+    /** @} */
 
     Statistics::Variable &binsStat;   ///< Number of bins per flush
     Statistics::Variable &splatsStat; ///< Number of splats per flush
+    Statistics::Variable &budgetStat; ///< Batch sizes chosen by @ref budget
+
+    /**
+     * Pass the accumulated @ref bins to the functor. The bins are first
+     * sorted along a Morton curve (within each chunk), so that consecutive
+     * bins cover adjacent space: they then tend to read adjacent file
+     * ranges and emit to the same chunk, instead of following the zigzag
+     * of the bucket recursion.
+     */
+    void flushBins();
+
+    /**
+     * Hash the held-back chunk and either forward its bins through the
+     * normal path or (if unchanged from the previous run) discard them.
+     */
+    void finishChunk();
 };
 
 #endif /* !BUCKET_COLLECTOR_H */
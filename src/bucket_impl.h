@@ -37,14 +37,22 @@
 #include <boost/numeric/conversion/converter.hpp>
 #include <boost/mem_fn.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/bind.hpp>
 #include <ostream>
 #include <limits>
+#include <vector>
 #include "bucket.h"
 #include "bucket_internal.h"
 #include "statistics.h"
 #include "misc.h"
 #include "logging.h"
 #include "allocator.h"
+#include "thread_name.h"
 
 namespace Bucket
 {
@@ -121,6 +129,21 @@ struct BucketParameters
         maxSplit(maxSplit) {}
 };
 
+template<typename Splats>
+class BucketPool;
+
+template<typename Splats>
+void bucketRecurse(
+    const Splats &splats,
+    const Grid &grid,
+    const BucketParameters &params,
+    Grid::size_type chunkCells,
+    Grid::size_type microCells,
+    const typename ProcessorType<Splats>::type &process,
+    const Recursion &recursionState,
+    BucketPool<typename SplatSet::Traits<Splats>::subset_type> *pool = NULL,
+    typename BucketPool<typename SplatSet::Traits<Splats>::subset_type>::Task *task = NULL);
+
 /**
  * Dynamic state that is updated as part of processing a region.
  */
@@ -189,12 +212,20 @@ public:
         }
     };
 
-    /// Make callbacks to the child regions
+    /**
+     * Make callbacks to the child regions. When @a pool is non-NULL the
+     * children are not recursed into here: each becomes a task on the pool,
+     * attached in order to @a task (or to the pool's root when @a task is
+     * NULL, i.e. at the top level of the recursion), and the buckets are
+     * later emitted by @ref BucketPool::emit.
+     */
     template<typename Splats>
     void doCallbacks(const Splats &splats,
                      const typename ProcessorType<Splats>::type &process,
                      const Recursion &recursionState,
-                     const boost::array<Grid::difference_type, 3> &chunkOffset);
+                     const boost::array<Grid::difference_type, 3> &chunkOffset,
+                     BucketPool<typename SplatSet::Traits<Splats>::subset_type> *pool,
+                     typename BucketPool<typename SplatSet::Traits<Splats>::subset_type>::Task *task);
 
     /**
      * The number of splats that land in a given node.
@@ -276,44 +307,6 @@ private:
     boost::array<Grid::size_type, 3> computeDims(const Grid &grid, Grid::size_type microSize);
 };
 
-template<typename Splats>
-void BucketState::doCallbacks(
-    const Splats &splats,
-    const typename ProcessorType<Splats>::type &process,
-    const Recursion &recursionState,
-    const boost::array<Grid::difference_type, 3> &chunkOffset)
-{
-    std::size_t numRanges = 0;
-    BOOST_FOREACH(Subregion &region, subregions)
-    {
-        numRanges += region.subset.numRanges();
-    }
-    BOOST_FOREACH(Subregion &region, subregions)
-    {
-        // Clip the region to the grid
-        Grid::size_type lower[3], upper[3];
-        region.node.toCells(microSize, lower, upper, grid);
-        Grid childGrid = grid.subGrid(
-            lower[0], upper[0], lower[1], upper[1], lower[2], upper[2]);
-
-        Recursion childRecursion = recursionState;
-        childRecursion.depth++;
-        childRecursion.totalRanges += numRanges;
-        for (unsigned int i = 0; i < 3; i++)
-            childRecursion.chunk[i] += chunkOffset[i];
-
-        region.subset.flush();
-        typename SplatSet::Traits<Splats>::subset_type subset(splats);
-        subset.swap(region.subset);
-        bucketRecurse(subset,
-                      childGrid,
-                      params,
-                      0, 0,
-                      process,
-                      childRecursion);
-    }
-}
-
 class BucketStateSet : public Statistics::Container::multi_array<boost::shared_ptr<BucketState>, 3>
 {
 public:
@@ -422,6 +415,272 @@ bool bucketCallback(const Splats &splats, const Grid &grid,
     return true;
 }
 
+/**
+ * Thread pool that runs the subtrees of the bucket recursion in parallel.
+ *
+ * Each task is one pending call to @ref bucketRecurse on a subregion. A
+ * worker that executes a task either finds that the region is already a
+ * bucket (in which case it just flags the task as a leaf) or runs the
+ * counting and picking passes over the task's own blob stream and attaches a
+ * child task per subregion, pushing each onto the shared stack as it is
+ * created. The stack is popped most-recent-first, which makes the workers
+ * collectively approximate the depth-first order of the serial recursion and
+ * so bounds the number of materialized-but-unemitted subtrees to roughly one
+ * per worker, rather than fanning out breadth-first. This takes the place of
+ * per-thread work-stealing deques; the tasks are far too coarse for
+ * contention on the single stack to matter.
+ *
+ * The processor is @em not called from the workers. After the top level of
+ * the recursion has attached its children to @ref getRoot, the owning thread
+ * calls @ref emit, which replays the task tree depth-first, blocking on each
+ * task in turn and invoking the processor for the leaves. The buckets are
+ * therefore delivered serially and in exactly the order of a serial run,
+ * which downstream consumers rely on (see @ref bucket).
+ *
+ * @param Splats The @em subset type of the set being bucketed, i.e.
+ * <code>SplatSet::Traits<T>::subset_type</code> for the top-level set @c T.
+ */
+template<typename Splats>
+class BucketPool : public boost::noncopyable
+{
+public:
+    /**
+     * A pending subtree of the recursion, together with its result. The
+     * fields other than @ref done are written only by the worker that runs
+     * the task (or its creator, beforehand) and read by the emitting thread
+     * only after observing @ref done under the pool mutex, so they need no
+     * locking of their own.
+     */
+    struct Task
+    {
+        Splats subset;               ///< Splats to process (wraps the shared superset)
+        Grid grid;                   ///< Region covered by this subtree
+        Recursion recursionState;    ///< Recursion statistics on entry
+
+        bool leaf;                   ///< Whether the region is itself a bucket
+        bool done;                   ///< Whether the task has been run (protected by the pool mutex)
+        boost::exception_ptr error;  ///< Exception thrown while running the task, if any
+        boost::ptr_vector<Task> children; ///< Subregion tasks, in emission order
+
+        template<typename Super>
+        Task(const Super &super, const Grid &grid, const Recursion &recursionState)
+            : subset(super), grid(grid), recursionState(recursionState),
+            leaf(false), done(false)
+        {
+        }
+    };
+
+    /**
+     * Constructor. The workers are started immediately; they sleep until
+     * tasks arrive.
+     *
+     * @param splats          Top-level set being bucketed, used only to give the
+     *                        root task a superset to wrap.
+     * @param region          Grid for the root task.
+     * @param params          User parameters, shared by all tasks.
+     * @param process         Processor to invoke for the leaves from @ref emit.
+     * @param recursionState  Recursion statistics for the root task.
+     * @param numThreads      Number of worker threads to start.
+     *
+     * All the references must remain valid until the pool is destroyed.
+     */
+    template<typename Super>
+    BucketPool(const Super &splats,
+               const Grid &region,
+               const BucketParameters &params,
+               const typename ProcessorType<Splats>::type &process,
+               const Recursion &recursionState,
+               std::size_t numThreads)
+        : params(params), process(process),
+        root(splats, region, recursionState),
+        stopping(false)
+    {
+        MLSGPU_ASSERT(numThreads >= 1, std::invalid_argument);
+        workers.reserve(numThreads);
+        for (std::size_t i = 0; i < numThreads; i++)
+            workers.push_back(new boost::thread(boost::bind(&BucketPool<Splats>::worker, this)));
+    }
+
+    /// Destructor. Wakes and joins the workers, discarding unrun tasks.
+    ~BucketPool()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            stopping = true;
+            workCondition.notify_all();
+        }
+        for (std::size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    /**
+     * The task standing in for the top level of the recursion. It is never
+     * run or emitted itself; it exists only so that the top level has
+     * somewhere to attach its children.
+     */
+    Task &getRoot() { return root; }
+
+    /**
+     * Create a subregion task. The task is attached to @a parent, which must
+     * only ever be done from the thread running @a parent (or, for the root,
+     * from the thread that owns the pool); the caller fills in the subset
+     * (typically by swapping in the accumulated ranges) before handing the
+     * task to @ref enqueue.
+     */
+    template<typename Super>
+    Task *addTask(Task &parent, const Super &super,
+                  const Grid &grid, const Recursion &recursionState)
+    {
+        parent.children.push_back(new Task(super, grid, recursionState));
+        return &parent.children.back();
+    }
+
+    /// Make a task created with @ref addTask available to the workers.
+    void enqueue(Task *task)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stack.push_back(task);
+        workCondition.notify_one();
+    }
+
+    /**
+     * Replay the task tree depth-first, calling the processor for each leaf.
+     * This must be called on the thread that owns the pool, after the
+     * top-level call to @ref bucketRecurse has returned. The first exception
+     * thrown by a task (or by the processor) is rethrown; the destructor
+     * then takes care of winding down the remaining workers.
+     */
+    void emit()
+    {
+        for (std::size_t i = 0; i < root.children.size(); i++)
+            emitTask(root.children[i]);
+    }
+
+private:
+    const BucketParameters &params;  ///< User parameters, shared by all tasks
+    const typename ProcessorType<Splats>::type &process; ///< Processor for the leaves
+    Task root;                       ///< See @ref getRoot
+
+    boost::mutex mutex;              ///< Protects @ref stack, @ref stopping and the done flags
+    boost::condition_variable workCondition; ///< Signalled when tasks arrive or on shutdown
+    boost::condition_variable doneCondition; ///< Signalled when a task completes
+    std::vector<Task *> stack;       ///< Pending tasks; popped most-recent-first
+    bool stopping;                   ///< Set by the destructor to terminate the workers
+    boost::ptr_vector<boost::thread> workers; ///< The worker threads
+
+    /// Main loop for each worker thread.
+    void worker()
+    {
+        thread_set_name("bucket");
+        while (true)
+        {
+            Task *task;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (stack.empty() && !stopping)
+                    workCondition.wait(lock);
+                /* On shutdown any tasks still pending are discarded: the
+                 * pool is only destroyed after emit() has returned or
+                 * thrown, so nothing will wait for them.
+                 */
+                if (stopping)
+                    return;
+                task = stack.back();
+                stack.pop_back();
+            }
+
+            try
+            {
+                bucketRecurse(task->subset, task->grid, params,
+                              Grid::size_type(0), Grid::size_type(0),
+                              process, task->recursionState,
+                              this, task);
+            }
+            catch (...)
+            {
+                task->error = boost::current_exception();
+            }
+
+            boost::lock_guard<boost::mutex> lock(mutex);
+            task->done = true;
+            doneCondition.notify_all();
+        }
+    }
+
+    /// Emit the leaves under @a task in depth-first order, waiting as needed.
+    void emitTask(Task &task)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!task.done)
+                doneCondition.wait(lock);
+        }
+        if (task.error)
+            boost::rethrow_exception(task.error);
+        if (task.leaf)
+            bucketCallback(task.subset, task.grid, process, task.recursionState,
+                           boost::true_type());
+        else
+        {
+            for (std::size_t i = 0; i < task.children.size(); i++)
+                emitTask(task.children[i]);
+        }
+    }
+};
+
+template<typename Splats>
+void BucketState::doCallbacks(
+    const Splats &splats,
+    const typename ProcessorType<Splats>::type &process,
+    const Recursion &recursionState,
+    const boost::array<Grid::difference_type, 3> &chunkOffset,
+    BucketPool<typename SplatSet::Traits<Splats>::subset_type> *pool,
+    typename BucketPool<typename SplatSet::Traits<Splats>::subset_type>::Task *task)
+{
+    typedef typename SplatSet::Traits<Splats>::subset_type subset_type;
+
+    std::size_t numRanges = 0;
+    BOOST_FOREACH(Subregion &region, subregions)
+    {
+        numRanges += region.subset.numRanges();
+    }
+    BOOST_FOREACH(Subregion &region, subregions)
+    {
+        // Clip the region to the grid
+        Grid::size_type lower[3], upper[3];
+        region.node.toCells(microSize, lower, upper, grid);
+        Grid childGrid = grid.subGrid(
+            lower[0], upper[0], lower[1], upper[1], lower[2], upper[2]);
+
+        Recursion childRecursion = recursionState;
+        childRecursion.depth++;
+        childRecursion.totalRanges += numRanges;
+        for (unsigned int i = 0; i < 3; i++)
+            childRecursion.chunk[i] += chunkOffset[i];
+
+        region.subset.flush();
+        if (pool != NULL)
+        {
+            typename BucketPool<subset_type>::Task *child = pool->addTask(
+                task != NULL ? *task : pool->getRoot(),
+                splats, childGrid, childRecursion);
+            child->subset.swap(region.subset);
+            pool->enqueue(child);
+        }
+        else
+        {
+            subset_type subset(splats);
+            subset.swap(region.subset);
+            bucketRecurse(subset,
+                          childGrid,
+                          params,
+                          Grid::size_type(0), Grid::size_type(0),
+                          process,
+                          childRecursion);
+        }
+    }
+}
+
 /**
  * Recursive implementation of @ref bucket.
  *
@@ -434,6 +693,13 @@ bool bucketCallback(const Splats &splats, const Grid &grid,
  *                        is disabled (this is always done below the top level).
  * @param microCells      Requested microblock size.
  * @param recursionState  Statistics about what is already held on the stack.
+ * @param pool            Pool on which to run the subtrees in parallel, or
+ *                        @c NULL to recurse serially on the calling thread.
+ * @param task            The pool task being executed, or @c NULL at the top
+ *                        level of the recursion. When non-NULL, a leaf is
+ *                        recorded on the task instead of calling @a process
+ *                        (the pool's emitter makes the call later, in order),
+ *                        and subregions become children of the task.
  */
 template<typename Splats>
 void bucketRecurse(
@@ -443,7 +709,9 @@ void bucketRecurse(
     Grid::size_type chunkCells,
     Grid::size_type microCells,
     const typename ProcessorType<Splats>::type &process,
-    const Recursion &recursionState)
+    const Recursion &recursionState,
+    BucketPool<typename SplatSet::Traits<Splats>::subset_type> *pool,
+    typename BucketPool<typename SplatSet::Traits<Splats>::subset_type>::Task *task)
 {
     Statistics::getStatistic<Statistics::Peak>("bucket.depth.peak") = recursionState.depth;
     Statistics::getStatistic<Statistics::Peak>("bucket.totalRanges.peak") = recursionState.totalRanges;
@@ -453,13 +721,27 @@ void bucketRecurse(
         cellDims[i] = grid.numCells(i);
     Grid::size_type maxCellDim = std::max(std::max(cellDims[0], cellDims[1]), cellDims[2]);
 
+    bool isBucket = false;
     if (splats.maxSplats() <= params.maxSplats
         && (maxCellDim <= params.maxCells)
-        && (chunkCells == 0 || chunkCells >= maxCellDim)
-        && bucketCallback(splats, grid, process, recursionState,
-                          typename SplatSet::Traits<Splats>::is_subset()))
+        && (chunkCells == 0 || chunkCells >= maxCellDim))
+    {
+        if (task != NULL)
+        {
+            /* The processor is called by the pool's emitter once all older
+             * siblings have been emitted, to preserve the serial order.
+             */
+            task->leaf = true;
+            isBucket = true;
+        }
+        else
+            isBucket = bucketCallback(splats, grid, process, recursionState,
+                                      typename SplatSet::Traits<Splats>::is_subset());
+    }
+
+    if (isBucket)
     {
-        // The bucketCallback in the if statement did the work
+        // The leaf handling above did the work
     }
     else if (maxCellDim == 1)
     {
@@ -554,7 +836,8 @@ void bucketRecurse(
             for (chunkCoord[1] = 0; chunkCoord[1] < chunks[1]; chunkCoord[1]++)
                 for (chunkCoord[2] = 0; chunkCoord[2] < chunks[2]; chunkCoord[2]++)
                 {
-                    states(chunkCoord)->doCallbacks(splats, process, recursionState, chunkCoord);
+                    states(chunkCoord)->doCallbacks(splats, process, recursionState, chunkCoord,
+                                                    pool, task);
                 }
     }
 }
@@ -570,10 +853,144 @@ void bucket(const Splats &splats,
             Grid::size_type microCells,
             std::size_t maxSplit,
             const typename ProcessorType<Splats>::type &process,
-            const Recursion &recursionState)
+            const Recursion &recursionState,
+            std::size_t numThreads)
+{
+    detail::BucketParameters params(maxSplats, maxCells, maxSplit);
+    if (numThreads <= 1)
+        detail::bucketRecurse(splats, region, params, chunkCells, microCells, process, recursionState);
+    else
+    {
+        typedef typename SplatSet::Traits<Splats>::subset_type subset_type;
+        detail::BucketPool<subset_type> pool(splats, region, params, process,
+                                             recursionState, numThreads);
+        detail::bucketRecurse(splats, region, params, chunkCells, microCells, process,
+                              recursionState, &pool);
+        pool.emit();
+    }
+}
+
+template<typename Splats>
+void bucketSlabs(const Splats &splats,
+                 const Grid &region,
+                 std::tr1::uint64_t maxSplats,
+                 Grid::size_type maxCells,
+                 Grid::size_type chunkCells,
+                 Grid::size_type microCells,
+                 std::size_t maxSplit,
+                 Grid::size_type slabCells,
+                 const typename ProcessorType<Splats>::type &process,
+                 std::size_t numThreads)
 {
+    // Slice along the axis with the most cells
+    unsigned int axis = 0;
+    for (unsigned int i = 1; i < 3; i++)
+        if (region.numCells(i) > region.numCells(axis))
+            axis = i;
+    const Grid::size_type axisCells = region.numCells(axis);
+
+    if (slabCells == 0 || slabCells >= axisCells)
+    {
+        bucket(splats, region, maxSplats, maxCells, chunkCells, microCells, maxSplit, process,
+               Recursion(), numThreads);
+        return;
+    }
+    MLSGPU_ASSERT(microCells > 0, std::invalid_argument); // slicing needs an explicit microblock size
+
+    /* Mirror the chunk rounding done by bucketRecurse, and round the slab
+     * thickness up to a multiple of the result. Slab boundaries then
+     * coincide with both microblock and chunk boundaries, so slab membership
+     * of a blob is exact and the chunk grids of all slabs line up with those
+     * of an unsliced run.
+     */
+    Grid::size_type alignCells = microCells;
+    if (chunkCells > 0)
+    {
+        if (chunkCells > maxCells)
+        {
+            Grid::size_type grain = maxCells / microCells * microCells;
+            if (grain == 0)
+                grain = microCells;
+            alignCells = divUp(chunkCells, grain) * grain;
+        }
+        else
+            alignCells = divUp(chunkCells, microCells) * microCells;
+    }
+    slabCells = roundUp(slabCells, alignCells);
+    if (slabCells >= axisCells)
+    {
+        bucket(splats, region, maxSplats, maxCells, chunkCells, microCells, maxSplit, process,
+               Recursion(), numThreads);
+        return;
+    }
+
+    const Grid::size_type walkSize = microCells;
+    const Grid::size_type numSlabs = divUp(axisCells, slabCells);
     detail::BucketParameters params(maxSplats, maxCells, maxSplit);
-    detail::bucketRecurse(splats, region, params, chunkCells, microCells, process, recursionState);
+    Statistics::getStatistic<Statistics::Counter>("bucket.slabs").add(numSlabs);
+
+    for (Grid::size_type slab = 0; slab < numSlabs; slab++)
+    {
+        const Grid::size_type slabStart = slab * slabCells;
+        const Grid::size_type slabEnd = std::min(axisCells, slabStart + slabCells);
+
+        /* Collect the splats whose blobs intersect the slab. Each slab walks
+         * the full blob stream, but only the ranges for the current slab are
+         * ever held in memory.
+         */
+        typename SplatSet::Traits<Splats>::subset_type subset(splats);
+        {
+            boost::scoped_ptr<SplatSet::BlobStream> blobs(splats.makeBlobStream(region, walkSize));
+            while (!blobs->empty())
+            {
+                const SplatSet::BlobInfo blob = **blobs;
+                const Grid::difference_type lowerCell
+                    = blob.lower[axis] * Grid::difference_type(walkSize);
+                const Grid::difference_type upperCell
+                    = (blob.upper[axis] + 1) * Grid::difference_type(walkSize) - 1;
+                if (lowerCell < Grid::difference_type(slabEnd)
+                    && upperCell >= Grid::difference_type(slabStart))
+                    subset.addBlob(blob);
+                ++*blobs;
+            }
+        }
+        subset.flush();
+        if (subset.maxSplats() == 0)
+            continue;
+
+        Grid::difference_type lower[3], upper[3];
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            lower[i] = 0;
+            upper[i] = region.numCells(i);
+        }
+        lower[axis] = slabStart;
+        upper[axis] = slabEnd;
+        const Grid slabGrid = region.subGrid(
+            lower[0], upper[0], lower[1], upper[1], lower[2], upper[2]);
+
+        /* Keep the chunk coordinates consistent with an unsliced run. The
+         * pre-rounded chunk size is passed down so that the recursion does
+         * not re-round it differently, and slabCells is a multiple of it.
+         */
+        Recursion recursionState;
+        if (chunkCells > 0)
+            recursionState.chunk[axis] = slabStart / alignCells;
+        if (numThreads <= 1)
+            detail::bucketRecurse(subset, slabGrid, params,
+                                  chunkCells > 0 ? alignCells : Grid::size_type(0),
+                                  microCells, process, recursionState);
+        else
+        {
+            typedef typename SplatSet::Traits<Splats>::subset_type subset_type;
+            detail::BucketPool<subset_type> pool(subset, slabGrid, params, process,
+                                                 recursionState, numThreads);
+            detail::bucketRecurse(subset, slabGrid, params,
+                                  chunkCells > 0 ? alignCells : Grid::size_type(0),
+                                  microCells, process, recursionState, &pool);
+            pool.emit();
+        }
+    }
 }
 
 } // namespace Bucket
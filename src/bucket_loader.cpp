@@ -29,13 +29,21 @@
 
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/smart_ptr/make_shared.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 #include <cassert>
+#include <cmath>
+#include "tr1_cstdint.h"
 #include "workers.h"
 #include "grid.h"
+#include "progress.h"
 #include "statistics.h"
 #include "splat_set.h"
 #include "timeplot.h"
+#include "thread_name.h"
+#include "errors.h"
+#include "cancel.h"
 #include "bucket_loader.h"
 
 BucketLoader::BucketLoader(
@@ -44,13 +52,20 @@ BucketLoader::BucketLoader(
     maxItemSplats(maxItemSplats),
     outGroup(outGroup),
     tworker(tworker),
-    super(NULL),
-    splatBuffer("mem.BucketLoader.splatBuffer"),
+    thinLimit(0),
+    progress(NULL),
+    drainTworker("loader.drain"),
     computeStat(Statistics::getStatistic<Statistics::Variable>("bucket.loader.compute")),
     loadStat(Statistics::getStatistic<Statistics::Variable>("bucket.loader.load")),
-    writeStat(Statistics::getStatistic<Statistics::Variable>("bucket.loader.write"))
+    writeStat(Statistics::getStatistic<Statistics::Variable>("bucket.loader.write")),
+    thinnedStat(Statistics::getStatistic<Statistics::Counter>("bucket.loader.thinned"))
 {
-    splatBuffer.reserve(maxItemSplats);
+}
+
+BucketLoader::~BucketLoader()
+{
+    if (drainThreadHandle)
+        stop();
 }
 
 void BucketLoader::operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins)
@@ -58,7 +73,7 @@ void BucketLoader::operator()(const Statistics::Container::vector<BucketCollecto
     if (bins.empty())
         return;
 
-    Statistics::Container::vector<range_type> ranges("mem.BucketLoader.ranges");
+    boost::shared_ptr<Batch> batch = boost::make_shared<Batch>();
     {
         Timeplot::Action timer("compute", tworker, computeStat);
         /* Compute merged ranges */
@@ -66,26 +81,94 @@ void BucketLoader::operator()(const Statistics::Container::vector<BucketCollecto
         {
             Statistics::Container::vector<range_type> tmp("mem.BucketLoader.ranges");
             SplatSet::merge(bin.ranges.begin(), bin.ranges.end(),
-                            ranges.begin(), ranges.end(), std::back_inserter(tmp));
-            tmp.swap(ranges);
+                            batch->ranges.begin(), batch->ranges.end(), std::back_inserter(tmp));
+            tmp.swap(batch->ranges);
         }
+        batch->bins.assign(bins.begin(), bins.end());
     }
 
+    std::size_t totalSplats = 0;
+    BOOST_FOREACH(const range_type &range, batch->ranges)
+        totalSplats += range.second - range.first;
+    assert(totalSplats <= maxItemSplats);
+
+    /* The merged ranges are read once into a single shared batch. The bins
+     * reference spans of this batch rather than taking their own copies, so
+     * splats shared between overlapping bins are stored only once.
+     */
+    batch->batch = outGroup.allocateBatch(tworker, totalSplats);
     {
         Timeplot::Action timer("load", tworker, loadStat);
-        boost::scoped_ptr<SplatSet::SplatStream> splatStream(super->makeSplatStream(ranges.begin(), ranges.end()));
-        float invSpacing = 1.0f / fullGrid.getSpacing();
-        std::size_t numRead = splatStream->read(&splatBuffer[0], NULL, maxItemSplats);
-        for (std::size_t i = 0; i < numRead; i++)
+        const range_type *firstRange = batch->ranges.empty() ? NULL : &batch->ranges[0];
+        boost::scoped_ptr<SplatSet::SplatStream> splatStream(makeSplatStream(firstRange, firstRange + batch->ranges.size()));
+        /* The conversion is validated once for the whole batch rather than
+         * per splat (see @ref Grid::WorldToVertex).
+         */
+        const Grid::WorldToVertex toVertex(fullGrid);
+        const float invSpacing = toVertex.getInvSpacing();
+        batch->numRead = splatStream->read(batch->batch.get(), NULL, totalSplats);
+        for (std::size_t i = 0; i < batch->numRead; i++)
         {
-            Splat &splat = splatBuffer[i];
+            Splat &splat = batch->batch.get()[i];
             /* Transform the splats into the grid's coordinate system */
-            fullGrid.worldToVertex(splat.position, splat.position);
+            toVertex(splat.position, splat.position);
             splat.radius *= invSpacing;
         }
     }
 
-    // Now process each bin, copying the relevant subset to the device
+    /* Hand over to the drain thread, which thins the batch, carves it into
+     * per-bin spans and pushes the work items downstream. Those pushes can
+     * block on downstream capacity; doing them here would leave the input
+     * device idle until the batch drained.
+     */
+    drainQueue.push(batch);
+}
+
+void BucketLoader::drainBatch(const Batch &loaded)
+{
+    const Statistics::Container::vector<BucketCollector::Bin> &bins = loaded.bins;
+    const Statistics::Container::vector<range_type> &ranges = loaded.ranges;
+    const boost::shared_ptr<Splat> &batch = loaded.batch;
+    const std::size_t numRead = loaded.numRead;
+
+    /* Optionally thin out over-sampled regions. The decision is made over
+     * the whole shared batch rather than per bin, so that bins which share
+     * splats agree on which ones survive and no cracks open on bin borders
+     * within a batch (see @ref setThinning for the cross-batch caveat).
+     * Splats were just transformed to grid coordinates, so the micro-cells
+     * are simply the unit cells of the grid.
+     */
+    Statistics::Container::vector<char> keep("mem.BucketLoader.thinKeep");
+    if (thinLimit > 0)
+    {
+        Timeplot::Action timer("compute", drainTworker, computeStat);
+        keep.resize(numRead, 1);
+        Statistics::Container::unordered_map<std::tr1::uint64_t, unsigned int> counts("mem.BucketLoader.thinCounts");
+        unsigned long long numThinned = 0;
+        for (std::size_t i = 0; i < numRead; i++)
+        {
+            const Splat &splat = batch.get()[i];
+            /* Pack the cell coordinates into a hash key, 21 bits per axis.
+             * Grids over 2^21 cells per axis wrap around, which merely
+             * merges distant cells and so can only make thinning less
+             * aggressive than requested.
+             */
+            std::tr1::uint64_t key = 0;
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                std::tr1::int64_t cell = std::tr1::int64_t(std::floor(splat.position[j]));
+                key = (key << 21) | (std::tr1::uint64_t(cell) & 0x1FFFFF);
+            }
+            if (++counts[key] > thinLimit)
+            {
+                keep[i] = 0;
+                numThinned++;
+            }
+        }
+        thinnedStat.add(numThinned);
+    }
+
+    // Now process each bin, pointing it at its spans of the batch
     BOOST_FOREACH(const BucketCollector::Bin &bin, bins)
     {
         /* We transformed splats from world space into fullGrid space, so we need to
@@ -101,16 +184,15 @@ void BucketLoader::operator()(const Statistics::Container::vector<BucketCollecto
             subGrid.setExtent(i, low, high);
         }
 
-        boost::shared_ptr<CopyGroup::WorkItem> item = outGroup.get(tworker, bin.ranges.numSplats());
-        item->chunkId = bin.chunkId;
-        item->grid = subGrid;
-
-        Timeplot::Action timer("write", tworker, writeStat);
-        timer.setValue(bin.ranges.numSplats() * sizeof(Splat));
-
+        /* Determine the bin's spans of the batch, splitting runs around any
+         * splats removed by thinning. The surviving count must be known
+         * before requesting the work item, so the spans are built first.
+         */
+        Statistics::Container::vector<CopyGroup::WorkItem::Span> spans("mem.BucketLoader.spans");
+        std::size_t keptSplats = 0;
+        ProgressMeter::size_type thinnedInside = 0;
         Statistics::Container::vector<range_type>::const_iterator p = ranges.begin();
         std::size_t pos = 0;
-        Splat *splatPtr = (Splat *) item->getSplats();
         for (SplatSet::SubsetBase::const_iterator q = bin.ranges.begin(); q != bin.ranges.end(); ++q)
         {
             while (p->second < q->second)
@@ -119,16 +201,99 @@ void BucketLoader::operator()(const Statistics::Container::vector<BucketCollecto
                 ++p;
             }
             assert(p->first <= q->first && p->second >= q->second);
-            std::memcpy(splatPtr, &splatBuffer[pos + (q->first - p->first)],
-                   (q->second - q->first) * sizeof(Splat));
-            splatPtr += q->second - q->first;
+            const std::size_t first = pos + std::size_t(q->first - p->first);
+            const std::size_t last = first + std::size_t(q->second - q->first);
+            std::size_t runStart = first;
+            if (!keep.empty())
+                for (std::size_t i = first; i < last; i++)
+                {
+                    if (!keep[i])
+                    {
+                        if (i > runStart)
+                        {
+                            spans.push_back(CopyGroup::WorkItem::Span(runStart, i - runStart));
+                            keptSplats += i - runStart;
+                        }
+                        runStart = i + 1;
+                        /* The copy workers account each splat to the progress
+                         * meter with the bin it is inside; thinned-out splats
+                         * never reach them, so account for those here using
+                         * the same test.
+                         */
+                        const Splat &splat = batch.get()[i];
+                        bool inside = true;
+                        for (unsigned int j = 0; j < 3; j++)
+                        {
+                            Grid::extent_type e = subGrid.getExtent(j);
+                            float pj = splat.position[j];
+                            inside = inside && pj >= e.first && pj < e.second;
+                        }
+                        thinnedInside += inside;
+                    }
+                }
+            if (last > runStart)
+            {
+                spans.push_back(CopyGroup::WorkItem::Span(runStart, last - runStart));
+                keptSplats += last - runStart;
+            }
+        }
+
+        if (keptSplats > 0)
+        {
+            boost::shared_ptr<CopyGroup::WorkItem> item = outGroup.get(drainTworker, keptSplats);
+            item->chunkId = bin.chunkId;
+            item->grid = subGrid;
+            item->batch = batch;
+            item->spans.assign(spans.begin(), spans.end());
+            item->chunkClosing = bin.chunkClosing;
+
+            Timeplot::Action timer("write", drainTworker, writeStat);
+            timer.setValue(keptSplats * sizeof(Splat));
+            outGroup.push(drainTworker, item, bin.chunkClosing);
+        }
+        if (progress != NULL && thinnedInside > 0)
+            *progress += thinnedInside;
+    }
+}
+
+void BucketLoader::drainThread()
+{
+    thread_set_name("loader.drain");
+    try
+    {
+        while (true)
+        {
+            boost::shared_ptr<Batch> batch = drainQueue.pop(&drainTworker);
+            if (!batch)
+                break;
+            drainBatch(*batch);
         }
-        outGroup.push(tworker, item);
+    }
+    catch (cancelled &)
+    {
+        // fast abort: the remaining batches would only feed discarded output
     }
 }
 
-void BucketLoader::start(const Splats &super, const Grid &fullGrid)
+void BucketLoader::start(const StreamFactory &makeSplatStream, const Grid &fullGrid)
 {
+    MLSGPU_ASSERT(!drainThreadHandle, state_error);
     this->fullGrid = fullGrid;
-    this->super = &super;
+    this->makeSplatStream = makeSplatStream;
+    drainThreadHandle.reset(new boost::thread(boost::bind(&BucketLoader::drainThread, this)));
+}
+
+void BucketLoader::stop()
+{
+    MLSGPU_ASSERT(drainThreadHandle, state_error);
+    try
+    {
+        drainQueue.push(boost::shared_ptr<Batch>());
+    }
+    catch (cancelled &)
+    {
+        // the drain thread exits through the token instead of the sentinel
+    }
+    drainThreadHandle->join();
+    drainThreadHandle.reset();
 }
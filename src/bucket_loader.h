@@ -31,51 +31,162 @@
 # include <config.h>
 #endif
 #include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
 #include <utility>
 #include <cstring>
 #include <cstddef>
 #include "grid.h"
 #include "bucket_collector.h"
 #include "allocator.h"
+#include "work_queue.h"
+#include "timeplot.h"
 
 class CopyGroup;
-namespace SplatSet { class FileSet; }
-namespace Statistics { class Variable; }
-namespace Timeplot { class Worker; }
+class ProgressMeter;
+struct Splat;
+namespace Statistics { class Counter; class Variable; }
 
 /**
  * Load buckets from disk and pass to the device. It is expected to be fed by a
  * @ref BucketCollector, either directly or over a network.
+ *
+ * Loading is double-buffered internally: the functor (the issue side) merges
+ * ranges and reads the splats for a batch, then hands the loaded batch to a
+ * drain thread which does the thinning, builds the per-bin spans and pushes
+ * the work items to @ref CopyGroup. The pushes can block waiting for
+ * downstream capacity, so splitting them off lets the next batch's reads be
+ * in flight while the previous batch drains, keeping the input device busy.
  */
 class BucketLoader : public boost::noncopyable
 {
 private:
-    typedef SplatSet::FileSet Splats;
     typedef std::pair<SplatSet::splat_id, SplatSet::splat_id> range_type;
 
 public:
     typedef void result_type;
 
+    /**
+     * Factory producing a splat stream over a sequence of merged ranges.
+     * The loader only ever touches the splat set through this signature, so
+     * it is indifferent to where the splats live (see @ref start).
+     */
+    typedef boost::function<SplatSet::SplatStream *(const range_type *, const range_type *)> StreamFactory;
+
     BucketLoader(std::size_t maxItemSplats, CopyGroup &outGroup, Timeplot::Worker &tworker);
 
-    /// Prepares for a pass
-    void start(const Splats &super, const Grid &fullGrid);
+    /// Joins the drain thread if @ref stop was not called
+    ~BucketLoader();
+
+    /**
+     * Prepares for a pass and starts the drain thread. The splat set may be
+     * any model of the subsettable concept: on-disk files for the
+     * stand-alone tools, or an in-memory @ref SplatSet::SequenceSet when
+     * reconstruction is embedded in another application (see @ref
+     * Reconstruct::run). Only its range splat streams are used. The set
+     * must outlive the pass.
+     */
+    template<typename Splats>
+    void start(const Splats &super, const Grid &fullGrid)
+    {
+        start(StreamFactory(boost::bind(&BucketLoader::makeRangeStream<Splats>, &super, _1, _2)), fullGrid);
+    }
+
+    /// Type-erased version of @ref start for callers with their own stream source
+    void start(const StreamFactory &makeSplatStream, const Grid &fullGrid);
+
+    /**
+     * Flushes any batch still draining and joins the drain thread. This must
+     * be called after the last call to the functor and before stopping
+     * @ref CopyGroup.
+     */
+    void stop();
+
+    /**
+     * Sets a cap on the number of splats retained per unit grid cell
+     * (0, the default, retains everything). Overlapping scan passes can
+     * leave some regions with many times more samples than are needed to
+     * define the surface; thinning discards the excess before it is copied
+     * to the device, so that work tracks surface area rather than scan
+     * redundancy. Splats are kept in splat ID order, so the result is
+     * deterministic for a given input and batch division. Bins loaded in
+     * the same batch see identical decisions for shared splats; splats on
+     * the border between two batches may be judged independently, which
+     * can in rare cases leave a small crack in heavily over-scanned areas.
+     */
+    void setThinning(unsigned int thinLimit) { this->thinLimit = thinLimit; }
+
+    /**
+     * Sets a progress display that will be updated by the number of
+     * thinned-out splats, which would otherwise be counted by the copy
+     * workers. It must be called before the first call to the functor.
+     */
+    void setProgress(ProgressMeter *progress) { this->progress = progress; }
 
     /// Callback for @ref BucketCollector
     void operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins);
 private:
+    /**
+     * A fully loaded batch, passed from the issue side to the drain thread.
+     * The bins are copied because @ref BucketCollector reuses its own
+     * storage as soon as the functor returns.
+     */
+    struct Batch
+    {
+        Statistics::Container::vector<BucketCollector::Bin> bins;
+        Statistics::Container::vector<range_type> ranges;  ///< Merged ranges covering the bins
+        boost::shared_ptr<Splat> batch;                    ///< The loaded splats
+        std::size_t numRead;                               ///< Number of splats in @ref batch
+
+        Batch() :
+            bins("mem.BucketLoader.bins"),
+            ranges("mem.BucketLoader.ranges"),
+            numRead(0) {}
+    };
+
+    /**
+     * Thins, splits into per-bin spans and pushes one batch downstream.
+     * Runs on the drain thread.
+     */
+    void drainBatch(const Batch &batch);
+
+    /// Thread function: pops batches from @ref drainQueue until stopped
+    void drainThread();
+
+    /// Adapter binding @ref StreamFactory to a concrete splat set type
+    template<typename Splats>
+    static SplatSet::SplatStream *makeRangeStream(
+        const Splats *super, const range_type *firstRange, const range_type *lastRange)
+    {
+        return super->makeSplatStream(firstRange, lastRange);
+    }
+
     const std::size_t maxItemSplats;
     CopyGroup &outGroup;
     Grid fullGrid;
     Timeplot::Worker &tworker;
 
-    const Splats *super;
-    /// Temporary storage for loading combined ranges before turning back into individual buckets
-    Statistics::Container::PODBuffer<Splat> splatBuffer;
+    StreamFactory makeSplatStream;  ///< Stream factory bound to the current splat set
+    unsigned int thinLimit;    ///< Cap on splats per cell (0 for no thinning)
+    ProgressMeter *progress;   ///< Progress display for thinned-out splats
+
+    /**
+     * Loaded batches awaiting the drain thread. A null pointer is pushed by
+     * @ref stop to terminate the thread. The queue is unbounded, but the
+     * issue side cannot run far ahead because @c CopyGroup::allocateBatch
+     * blocks until the drained batches release their buffer space.
+     */
+    WorkQueue<boost::shared_ptr<Batch> > drainQueue;
+    boost::scoped_ptr<boost::thread> drainThreadHandle;  ///< Drain thread, while a pass is active
+    Timeplot::Worker drainTworker;                       ///< Timeplot worker for the drain thread
 
     Statistics::Variable &computeStat;
     Statistics::Variable &loadStat;
     Statistics::Variable &writeStat;
+    Statistics::Counter &thinnedStat;
 };
 
 #endif /* !COARSE_BUCKET_H */
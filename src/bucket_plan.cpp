@@ -0,0 +1,139 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Persistable record of a bucket decomposition, for reuse across runs.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <iomanip>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <boost/filesystem/fstream.hpp>
+#include "bucket_plan.h"
+#include "logging.h"
+
+namespace Bucket
+{
+
+namespace
+{
+    /// First token of the file, to reject files that are not plans at all
+    const char * const planMagic = "mlsgpu-bucket-plan";
+    /// Format version, to reject plans written by an incompatible build
+    const unsigned int planVersion = 1;
+}
+
+void Plan::clear()
+{
+    leaves.clear();
+    splats = 0;
+}
+
+void Plan::addLeaf(const Grid &grid, std::tr1::uint64_t numSplats)
+{
+    Leaf leaf;
+    const float *ref = grid.getReference();
+    const double spacing = grid.getSpacing();
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const std::pair<int, int> extent = grid.getExtent(i);
+        leaf.worldLower[i] = double(ref[i]) + spacing * extent.first;
+        leaf.worldUpper[i] = double(ref[i]) + spacing * extent.second;
+    }
+    leaf.numSplats = numSplats;
+    leaves.push_back(leaf);
+}
+
+void Plan::save(std::ostream &out) const
+{
+    out << planMagic << ' ' << planVersion << '\n';
+    out << splats << ' ' << leaves.size() << '\n';
+    out << std::setprecision(std::numeric_limits<double>::digits10 + 2);
+    for (std::size_t i = 0; i < leaves.size(); i++)
+    {
+        const Leaf &leaf = leaves[i];
+        for (unsigned int j = 0; j < 3; j++)
+            out << leaf.worldLower[j] << ' ';
+        for (unsigned int j = 0; j < 3; j++)
+            out << leaf.worldUpper[j] << ' ';
+        out << leaf.numSplats << '\n';
+    }
+}
+
+void Plan::save(const boost::filesystem::path &path) const
+{
+    boost::filesystem::ofstream out(path);
+    save(out);
+    if (!out)
+        Log::log[Log::warn] << "Warning: could not write bucket plan "
+            << path.string() << '\n';
+}
+
+bool Plan::load(std::istream &in)
+{
+    clear();
+
+    std::string magic;
+    unsigned int version;
+    std::size_t numLeaves;
+    if (!(in >> magic >> version) || magic != planMagic || version != planVersion)
+        return false;
+    if (!(in >> splats >> numLeaves))
+    {
+        clear();
+        return false;
+    }
+
+    leaves.reserve(numLeaves);
+    for (std::size_t i = 0; i < numLeaves; i++)
+    {
+        Leaf leaf;
+        for (unsigned int j = 0; j < 3; j++)
+            in >> leaf.worldLower[j];
+        for (unsigned int j = 0; j < 3; j++)
+            in >> leaf.worldUpper[j];
+        in >> leaf.numSplats;
+        if (!in)
+        {
+            clear();
+            return false;
+        }
+        leaves.push_back(leaf);
+    }
+    return true;
+}
+
+bool Plan::load(const boost::filesystem::path &path)
+{
+    boost::filesystem::ifstream in(path);
+    if (!in)
+        return false;
+    return load(in);
+}
+
+} // namespace Bucket
@@ -0,0 +1,194 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Persistable record of a bucket decomposition, for reuse across runs.
+ */
+
+#ifndef BUCKET_PLAN_H
+#define BUCKET_PLAN_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+#include "tr1_cstdint.h"
+#include <boost/array.hpp>
+#include <boost/filesystem/path.hpp>
+#include "grid.h"
+#include "bucket.h"
+
+namespace Bucket
+{
+
+/**
+ * The leaves of a bucket decomposition, in a form that can be saved to disk
+ * and reapplied to a later run over the same input at a different grid
+ * resolution. Each leaf is stored as a world-space box (so it is independent
+ * of the grid spacing) together with the number of splats it received. The
+ * total splat count of the input is stored as a fingerprint so that a stale
+ * plan for a different input is rejected on load.
+ *
+ * A plan is recorded by wrapping the processor callback in a
+ * @ref PlanRecorder and replayed with @ref bucketPlan, which revalidates each
+ * leaf against the new parameters and refines the ones that no longer fit
+ * (see @ref bucketPlan for the details and caveats).
+ */
+class Plan
+{
+public:
+    /// A single leaf of the recorded decomposition
+    struct Leaf
+    {
+        double worldLower[3];          ///< World coordinates of the lower corner
+        double worldUpper[3];          ///< World coordinates of the upper corner
+        std::tr1::uint64_t numSplats;  ///< Number of splats passed to the processor
+    };
+
+    Plan() : splats(0) {}
+
+    /// Remove all leaves and reset the fingerprint to zero.
+    void clear();
+
+    /// True if there are no leaves.
+    bool empty() const { return leaves.empty(); }
+
+    /// Number of recorded leaves.
+    std::size_t numLeaves() const { return leaves.size(); }
+
+    /// Retrieve one leaf.
+    const Leaf &getLeaf(std::size_t idx) const { return leaves[idx]; }
+
+    /**
+     * Record one leaf. The world-space box is computed from the extents of
+     * @a grid.
+     *
+     * @param grid       The grid passed to the processor for this bucket.
+     * @param numSplats  The number of splats passed with it.
+     */
+    void addLeaf(const Grid &grid, std::tr1::uint64_t numSplats);
+
+    /// Set the input fingerprint (total splat count of the set).
+    void setNumSplats(std::tr1::uint64_t numSplats) { splats = numSplats; }
+
+    /// Retrieve the input fingerprint.
+    std::tr1::uint64_t getNumSplats() const { return splats; }
+
+    /**
+     * Write the plan as versioned text. On an I/O error a warning is logged,
+     * matching the soft-failure behaviour of the tuning cache: a plan is an
+     * optimization, not data.
+     */
+    void save(std::ostream &out) const;
+
+    /// Overload that writes to a file.
+    void save(const boost::filesystem::path &path) const;
+
+    /**
+     * Read back a plan written by @ref save. A missing file, an I/O error, a
+     * version mismatch or malformed content all simply leave the plan empty.
+     *
+     * @return @c true if a complete plan was read.
+     */
+    bool load(std::istream &in);
+
+    /// Overload that reads from a file.
+    bool load(const boost::filesystem::path &path);
+
+private:
+    std::vector<Leaf> leaves;    ///< The recorded leaves
+    std::tr1::uint64_t splats;   ///< Total splat count of the recorded input
+};
+
+/**
+ * Processor adapter that records each bucket into a @ref Plan before
+ * forwarding it to the real processor. It is copyable (as required by
+ * @c boost::function), with all copies appending to the same plan; the
+ * bucketing functions make their callbacks serially so no locking is needed.
+ */
+template<typename Splats>
+class PlanRecorder
+{
+public:
+    typedef void result_type;
+
+    PlanRecorder(Plan &plan, const typename ProcessorType<Splats>::type &process)
+        : plan(&plan), process(process)
+    {
+    }
+
+    void operator()(
+        const typename SplatSet::Traits<Splats>::subset_type &splats,
+        const Grid &grid,
+        const Recursion &recursionState) const;
+
+private:
+    Plan *plan;                                   ///< Plan to append to
+    typename ProcessorType<Splats>::type process; ///< Wrapped processor
+};
+
+/**
+ * Replay a recorded decomposition instead of doing the full coarse walk of
+ * @ref bucket. The blob stream is walked @em once, assigning each blob to
+ * every recorded leaf whose box it intersects (in the new grid); each leaf
+ * subset is then passed through @ref detail::bucketRecurse, which hands a
+ * leaf that still satisfies @a maxSplats and @a maxCells straight to the
+ * processor and recursively refines one that does not (e.g. because the new
+ * resolution is finer). Blobs that intersect no leaf — possible at the
+ * fringes when a smoothing parameter changed — are collected and bucketed
+ * over the whole region afterwards, so no splat is ever dropped.
+ *
+ * Leaf boundaries are snapped to the nearest cell boundary of the new grid.
+ * Adjacent leaves share their boundary planes in world space, so they snap
+ * consistently and the replayed leaves do not overlap, preserving the
+ * non-overlap guarantee of @ref bucket. Chunking is not supported: the chunk
+ * alignment of an output split depends on the recursion in a way a plan does
+ * not capture, so callers must fall back to @ref bucketSlabs when
+ * @a chunkCells would be non-zero.
+ *
+ * @param splats,region,maxSplats,maxCells,maxSplit,process As for @ref bucket.
+ * @param plan       The decomposition to replay.
+ * @param microCells The microblock size, used both as the granularity of the
+ *                   blob walk and for any refinement recursion. Must be
+ *                   non-zero.
+ *
+ * @throw DensityError If refinement of a leaf fails as for @ref bucket.
+ *
+ * @pre @a plan was recorded from the same input (see @ref Plan::getNumSplats).
+ */
+template<typename Splats>
+void bucketPlan(const Splats &splats,
+                const Grid &region,
+                const Plan &plan,
+                std::tr1::uint64_t maxSplats,
+                Grid::size_type maxCells,
+                Grid::size_type microCells,
+                std::size_t maxSplit,
+                const typename ProcessorType<Splats>::type &process);
+
+} // namespace Bucket
+
+#include "bucket_plan_impl.h"
+
+#endif /* !BUCKET_PLAN_H */
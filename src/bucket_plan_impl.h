@@ -0,0 +1,240 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Template implementation of @ref bucket_plan.h. Do not include this
+ * directly: it is included by the header.
+ */
+
+#ifndef BUCKET_PLAN_IMPL_H
+#define BUCKET_PLAN_IMPL_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+#include "tr1_cstdint.h"
+#include <boost/array.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include "bucket.h"
+#include "bucket_plan.h"
+#include "errors.h"
+#include "misc.h"
+#include "statistics.h"
+
+namespace Bucket
+{
+
+template<typename Splats>
+void PlanRecorder<Splats>::operator()(
+    const typename SplatSet::Traits<Splats>::subset_type &splats,
+    const Grid &grid,
+    const Recursion &recursionState) const
+{
+    plan->addLeaf(grid, splats.maxSplats());
+    process(splats, grid, recursionState);
+}
+
+namespace detail
+{
+
+/// A @ref Bucket::Plan leaf resolved to cell coordinates of a specific grid
+struct PlanLeafBox
+{
+    Grid::difference_type lower[3];  ///< Lower cell corner (inclusive)
+    Grid::difference_type upper[3];  ///< Upper cell corner (exclusive)
+
+    /// True if clamping to the grid left no cells
+    bool empty() const
+    {
+        return lower[0] >= upper[0] || lower[1] >= upper[1] || lower[2] >= upper[2];
+    }
+};
+
+/**
+ * Convert a recorded leaf to cell coordinates of @a grid, snapping each
+ * boundary plane to the nearest cell boundary and clamping to the grid.
+ * Snapping to nearest (rather than rounding outwards) keeps leaves that
+ * shared a boundary plane in world space disjoint in cell space.
+ */
+inline void planLeafToBox(const Plan::Leaf &leaf, const Grid &grid, PlanLeafBox &box)
+{
+    const float *ref = grid.getReference();
+    const double spacing = grid.getSpacing();
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const double bias = double(ref[i]) + spacing * grid.getExtent(i).first;
+        Grid::difference_type lower = Grid::difference_type(
+            std::floor((leaf.worldLower[i] - bias) / spacing + 0.5));
+        Grid::difference_type upper = Grid::difference_type(
+            std::floor((leaf.worldUpper[i] - bias) / spacing + 0.5));
+        const Grid::difference_type limit = grid.numCells(i);
+        box.lower[i] = std::min(std::max(lower, Grid::difference_type(0)), limit);
+        box.upper[i] = std::min(std::max(upper, Grid::difference_type(0)), limit);
+    }
+}
+
+} // namespace detail
+
+template<typename Splats>
+void bucketPlan(const Splats &splats,
+                const Grid &region,
+                const Plan &plan,
+                std::tr1::uint64_t maxSplats,
+                Grid::size_type maxCells,
+                Grid::size_type microCells,
+                std::size_t maxSplit,
+                const typename ProcessorType<Splats>::type &process)
+{
+    MLSGPU_ASSERT(microCells > 0, std::invalid_argument);
+    MLSGPU_ASSERT(!plan.empty(), std::invalid_argument);
+
+    const std::size_t numLeaves = plan.numLeaves();
+    const Grid::size_type walkSize = microCells;
+    const detail::BucketParameters params(maxSplats, maxCells, maxSplit);
+    Statistics::getStatistic<Statistics::Counter>("bucket.plan.leaves").add(numLeaves);
+
+    /* Resolve the recorded leaves against the new grid and index them by the
+     * microblocks they cover, so that blob assignment below is a hash lookup
+     * rather than a search over leaves.
+     */
+    std::vector<detail::PlanLeafBox> boxes(numLeaves);
+    typedef Statistics::Container::unordered_map<
+        detail::HashCoord::arg_type,
+        std::vector<std::tr1::uint32_t>,
+        detail::HashCoord> micro_index_type;
+    micro_index_type microIndex("mem.bucketPlan.microIndex");
+    for (std::size_t i = 0; i < numLeaves; i++)
+    {
+        detail::PlanLeafBox &box = boxes[i];
+        detail::planLeafToBox(plan.getLeaf(i), region, box);
+        if (box.empty())
+            continue;
+        detail::Node::size_type mLower[3], mUpper[3];
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            mLower[j] = detail::Node::size_type(box.lower[j]) / walkSize;
+            mUpper[j] = detail::Node::size_type(box.upper[j] - 1) / walkSize;
+        }
+        detail::HashCoord::arg_type coord;
+        for (coord[0] = mLower[0]; coord[0] <= mUpper[0]; coord[0]++)
+            for (coord[1] = mLower[1]; coord[1] <= mUpper[1]; coord[1]++)
+                for (coord[2] = mLower[2]; coord[2] <= mUpper[2]; coord[2]++)
+                    microIndex[coord].push_back(i);
+    }
+
+    /* Walk the blob stream once, assigning each blob to every leaf whose box
+     * it touches. The stamps prevent a blob spanning several microblocks of
+     * one leaf from being added to it more than once (the same trick as the
+     * per-node mask in the in-core bucketing). Blobs that touch no leaf are
+     * kept aside and handled at the end.
+     */
+    std::vector<SplatSet::SubsetBase> subsets(numLeaves);
+    std::vector<std::tr1::uint64_t> stamps(numLeaves, std::tr1::uint64_t(-1));
+    SplatSet::SubsetBase leftover;
+    std::tr1::uint64_t blobId = 0;
+    {
+        boost::scoped_ptr<SplatSet::BlobStream> blobs(splats.makeBlobStream(region, walkSize));
+        while (!blobs->empty())
+        {
+            const SplatSet::BlobInfo blob = **blobs;
+            bool hit = false;
+            detail::HashCoord::arg_type coord;
+            boost::array<Grid::difference_type, 3> lo, hi;
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                lo[i] = std::max(blob.lower[i], Grid::difference_type(0));
+                hi[i] = std::min(blob.upper[i],
+                                 Grid::difference_type(divUp(region.numCells(i), walkSize)) - 1);
+            }
+            for (coord[0] = lo[0]; Grid::difference_type(coord[0]) <= hi[0]; coord[0]++)
+                for (coord[1] = lo[1]; Grid::difference_type(coord[1]) <= hi[1]; coord[1]++)
+                    for (coord[2] = lo[2]; Grid::difference_type(coord[2]) <= hi[2]; coord[2]++)
+                    {
+                        micro_index_type::const_iterator pos = microIndex.find(coord);
+                        if (pos == microIndex.end())
+                            continue;
+                        hit = true;
+                        for (std::size_t j = 0; j < pos->second.size(); j++)
+                        {
+                            const std::tr1::uint32_t leaf = pos->second[j];
+                            if (stamps[leaf] != blobId)
+                            {
+                                stamps[leaf] = blobId;
+                                subsets[leaf].addBlob(blob);
+                            }
+                        }
+                    }
+            if (!hit)
+                leftover.addBlob(blob);
+            ++*blobs;
+            blobId++;
+        }
+    }
+
+    /* Revalidate each leaf. A leaf that still fits the parameters goes
+     * straight to the processor from inside bucketRecurse; one that does not
+     * (typically because the new grid is finer) is subdivided there instead.
+     */
+    for (std::size_t i = 0; i < numLeaves; i++)
+    {
+        subsets[i].flush();
+        if (subsets[i].maxSplats() == 0)
+            continue;
+
+        const detail::PlanLeafBox &box = boxes[i];
+        const Grid leafGrid = region.subGrid(
+            box.lower[0], box.upper[0],
+            box.lower[1], box.upper[1],
+            box.lower[2], box.upper[2]);
+        const Grid::size_type maxDim = std::max(std::max(
+            leafGrid.numCells(0), leafGrid.numCells(1)), leafGrid.numCells(2));
+        if (subsets[i].maxSplats() > maxSplats || maxDim > maxCells)
+            Statistics::getStatistic<Statistics::Counter>("bucket.plan.refined").add(1);
+
+        typename SplatSet::Traits<Splats>::subset_type subset(splats);
+        subset.swap(subsets[i]);
+        detail::bucketRecurse(subset, leafGrid, params, 0, microCells,
+                              process, Recursion());
+    }
+
+    /* Catch-all for blobs outside every recorded leaf, which can happen at
+     * the fringes if a parameter affecting blob extents (e.g. the smoothing
+     * factor) changed since recording. This is normally empty.
+     */
+    leftover.flush();
+    if (leftover.maxSplats() > 0)
+    {
+        Statistics::getStatistic<Statistics::Counter>("bucket.plan.missed").add(leftover.maxSplats());
+        typename SplatSet::Traits<Splats>::subset_type subset(splats);
+        subset.swap(leftover);
+        detail::bucketRecurse(subset, region, params, 0, microCells,
+                              process, Recursion());
+    }
+}
+
+} // namespace Bucket
+
+#endif /* !BUCKET_PLAN_IMPL_H */
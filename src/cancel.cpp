@@ -0,0 +1,110 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Cooperative fast-abort cancellation for the pipeline.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <vector>
+#include <utility>
+#include <boost/thread/locks.hpp>
+#include "cancel.h"
+
+namespace Cancel
+{
+
+namespace
+{
+
+/**
+ * Whether the run has been cancelled. Declared volatile rather than guarded
+ * by a lock for the benefit of the hot unlocked reads in @ref isRequested;
+ * the transition itself is rare, and any waiter that could miss it is woken
+ * through @ref waitersMutex below.
+ */
+static volatile bool requested = false;
+
+/// Protects @ref waiters
+static boost::mutex waitersMutex;
+
+/// Condition variables (with their wait mutexes) to wake on @ref request
+static std::vector<std::pair<boost::mutex *, boost::condition_variable *> > waiters;
+
+} // anonymous namespace
+
+void request()
+{
+    boost::lock_guard<boost::mutex> lock(waitersMutex);
+    requested = true;
+    for (std::size_t i = 0; i < waiters.size(); i++)
+    {
+        /* Taking the wait mutex (and immediately dropping it) guarantees
+         * that a waiter which tested the token before we set it has either
+         * reached its wait, or will retest before doing so; notifying
+         * without it could fire in that window and be lost.
+         */
+        {
+            boost::lock_guard<boost::mutex> waitLock(*waiters[i].first);
+        }
+        waiters[i].second->notify_all();
+    }
+}
+
+bool isRequested()
+{
+    return requested;
+}
+
+void check()
+{
+    if (requested)
+        throw cancelled();
+}
+
+void reset()
+{
+    boost::lock_guard<boost::mutex> lock(waitersMutex);
+    requested = false;
+}
+
+void registerWaiter(boost::mutex &mutex, boost::condition_variable &condition)
+{
+    boost::lock_guard<boost::mutex> lock(waitersMutex);
+    waiters.push_back(std::make_pair(&mutex, &condition));
+}
+
+void unregisterWaiter(boost::condition_variable &condition)
+{
+    boost::lock_guard<boost::mutex> lock(waitersMutex);
+    for (std::size_t i = 0; i < waiters.size(); i++)
+        if (waiters[i].second == &condition)
+        {
+            waiters.erase(waiters.begin() + i);
+            return;
+        }
+}
+
+} // namespace Cancel
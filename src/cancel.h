@@ -0,0 +1,96 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Cooperative fast-abort cancellation for the pipeline.
+ */
+
+#ifndef MLSGPU_CANCEL_H
+#define MLSGPU_CANCEL_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdexcept>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/**
+ * Exception thrown out of blocking pipeline primitives once the run has been
+ * cancelled. It deliberately derives from @c std::runtime_error so that
+ * catch-all handlers which merely report and abort continue to work, but
+ * code that wants to unwind quietly can catch it by name.
+ */
+class cancelled : public std::runtime_error
+{
+public:
+    cancelled() : std::runtime_error("operation cancelled") {}
+};
+
+/**
+ * Process-wide cancellation token. When a run fails, tearing it down in an
+ * orderly fashion means draining queues and flushing buffers whose output is
+ * about to be thrown away; on large jobs that wastes minutes of wall time
+ * before the failure surfaces. Calling @ref request instead makes the
+ * blocking pipeline primitives (@ref WorkQueue, @ref CircularBufferBase)
+ * throw @ref cancelled, and @ref WorkerGroup threads check the token between
+ * items, so the existing stop/join shutdown completes in roughly one
+ * work item's time instead of a full drain. No further device work is
+ * submitted after the token is seen; work already enqueued is left to the
+ * OpenCL runtime to discard when the context is torn down.
+ *
+ * Cancellation is sticky until @ref reset, which the error path calls once
+ * the worker threads are joined so that a daemon can serve its next job.
+ */
+namespace Cancel
+{
+
+/// Marks the run as cancelled and wakes every registered waiter
+void request();
+
+/// Whether @ref request has been called since the last @ref reset
+bool isRequested();
+
+/// Throws @ref cancelled if the run has been cancelled
+void check();
+
+/// Clears the token; only safe once no thread is relying on it to unwind
+void reset();
+
+/**
+ * Register a condition variable that blocking code waits on, so that
+ * @ref request can wake it. The waiting side must re-test
+ * @ref isRequested in its wait loop under @a mutex — the same mutex it
+ * waits with, which @ref request briefly acquires to close the race
+ * between that test and the wait.
+ *
+ * The pair must stay valid until @ref unregisterWaiter.
+ */
+void registerWaiter(boost::mutex &mutex, boost::condition_variable &condition);
+
+/// Removes a registration made with @ref registerWaiter
+void unregisterWaiter(boost::condition_variable &condition);
+
+} // namespace Cancel
+
+#endif /* !MLSGPU_CANCEL_H */
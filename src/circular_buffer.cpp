@@ -34,22 +34,34 @@
 #include <cassert>
 #include <limits>
 #include <string>
-#include <list>
+#include <map>
 #include <boost/noncopyable.hpp>
 #include <boost/thread/locks.hpp>
 #include "statistics.h"
 #include "allocator.h"
 #include "errors.h"
+#include "logging.h"
+#include "misc.h"
+#include "numa.h"
 #include "timeplot.h"
+#include "cancel.h"
 #include "circular_buffer.h"
 
+#if HAVE_HUGEPAGE_MMAP || HAVE_MLOCK
+# include <sys/mman.h>
+#endif
+#if HAVE_MLOCK
+# include <cstring>
+# include <cerrno>
+#endif
+
 std::size_t CircularBufferBase::Allocation::get() const
 {
-    return *point;
+    return point->first;
 }
 
 CircularBufferBase::Allocation::Allocation(
-    Statistics::Container::list<std::size_t>::iterator point)
+    Statistics::Container::map<std::size_t, std::size_t>::iterator point)
     : point(point)
 {
 }
@@ -60,9 +72,62 @@ CircularBufferBase::Allocation::Allocation()
 }
 
 CircularBufferBase::CircularBufferBase(const std::string &name, std::size_t size)
-    : bufferSize(size), firstFree(0), allocPoints(name)
+    : bufferSize(size), firstFree(0), allocations(name), allocated(0)
 {
     MLSGPU_ASSERT(size > 0, std::invalid_argument);
+    Cancel::registerWaiter(mutex, spaceCondition);
+}
+
+CircularBufferBase::~CircularBufferBase()
+{
+    Cancel::unregisterWaiter(spaceCondition);
+}
+
+std::size_t CircularBufferBase::tryAllocate(std::size_t n) const
+{
+    typedef Statistics::Container::map<std::size_t, std::size_t>::const_iterator iterator;
+
+    if (allocations.empty())
+        return 0;
+
+    /* Walk the holes between live allocations in ring order, starting from
+     * firstFree: when frees happen in allocation order this degenerates to
+     * the classic ring, keeping FIFO locality for the consumers.
+     */
+    std::size_t holeStart = firstFree;
+    iterator next = allocations.lower_bound(holeStart);
+    if (next != allocations.begin())
+    {
+        iterator prev = next;
+        --prev;
+        if (prev->first + prev->second > holeStart)
+            holeStart = prev->first + prev->second; // firstFree is inside a live allocation
+    }
+    while (true)
+    {
+        const std::size_t holeEnd = (next == allocations.end()) ? bufferSize : next->first;
+        if (holeEnd - holeStart >= n)
+            return holeStart;
+        if (next == allocations.end())
+            break;
+        holeStart = next->first + next->second;
+        ++next;
+    }
+
+    // Wrap around and try the holes before firstFree
+    holeStart = 0;
+    next = allocations.begin();
+    while (holeStart < firstFree)
+    {
+        const std::size_t holeEnd = (next == allocations.end()) ? bufferSize : next->first;
+        if (holeEnd - holeStart >= n)
+            return holeStart;
+        if (next == allocations.end())
+            break;
+        holeStart = next->first + next->second;
+        ++next;
+    }
+    return bufferSize;
 }
 
 CircularBufferBase::Allocation CircularBufferBase::allocate(
@@ -77,45 +142,38 @@ CircularBufferBase::Allocation CircularBufferBase::allocate(
 
     boost::lock_guard<boost::mutex> allocLock(allocMutex);
     boost::unique_lock<boost::mutex> lock(mutex);
-    std::size_t pos = bufferSize; // sentinel invalid value
-
-retry:
-    if (allocPoints.empty())
-        pos = 0;
-    else
-    {
-        std::size_t end = allocPoints.front();
-        if (firstFree <= end)
-        {
-            if (end - firstFree >= n)
-                pos = firstFree;
-        }
-        else
-        {
-            if (bufferSize - firstFree >= n)
-                pos = firstFree;
-            else if (end >= n)
-                pos = 0;
-        }
-    }
-
+    std::size_t pos = tryAllocate(n);
     if (pos == bufferSize)
     {
-        spaceCondition.wait(lock);
-        goto retry;
+        /* Tag the blocked portion so that the enclosing action only
+         * accounts for the bookkeeping.
+         */
+        Timeplot::WaitAction wait(Timeplot::WAIT_MEMORY, tworker);
+        do
+        {
+            /* On a cancelled run the consumers that would free space may
+             * already be gone, so waiting further could block forever.
+             */
+            Cancel::check();
+            spaceCondition.wait(lock);
+            pos = tryAllocate(n);
+        } while (pos == bufferSize);
     }
 
     firstFree = pos + n;
-    return Allocation(allocPoints.insert(allocPoints.end(), pos));
+    allocated += n;
+    return Allocation(allocations.insert(std::make_pair(pos, n)).first);
 }
 
 void CircularBufferBase::free(const Allocation &alloc)
 {
     boost::lock_guard<boost::mutex> lock(mutex);
-    bool first = allocPoints.begin() == alloc.point;
-    allocPoints.erase(alloc.point);
-    if (first)
-        spaceCondition.notify_one();
+    allocated -= alloc.point->second;
+    allocations.erase(alloc.point);
+    /* allocMutex serializes allocators, so at most one thread can be
+     * waiting; any free may create the hole it needs.
+     */
+    spaceCondition.notify_one();
 }
 
 std::size_t CircularBufferBase::size() const
@@ -125,12 +183,8 @@ std::size_t CircularBufferBase::size() const
 
 std::size_t CircularBufferBase::unallocated()
 {
-    if (allocPoints.empty())
-        return bufferSize;
-    else if (allocPoints.front() >= firstFree)
-        return allocPoints.front() - firstFree;
-    else
-        return bufferSize - firstFree + allocPoints.front();
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return bufferSize - allocated;
 }
 
 void *CircularBuffer::Allocation::get() const
@@ -163,16 +217,79 @@ void CircularBuffer::free(const Allocation &alloc)
     CircularBufferBase::free(alloc.base);
 }
 
-CircularBuffer::CircularBuffer(const std::string &name, std::size_t size)
+bool CircularBuffer::lockMemory = false;
+
+void CircularBuffer::setLockMemory(bool lock)
+{
+    CircularBuffer::lockMemory = lock;
+}
+
+CircularBuffer::CircularBuffer(const std::string &name, std::size_t size, int numaNode)
     :
     CircularBufferBase(name, size),
     allocator(Statistics::makeAllocator<Statistics::Allocator<std::allocator<char> > >(name)),
-    buffer(NULL)
+    buffer(NULL),
+    mappedSize(0)
 {
-    buffer = allocator.allocate(size);
+#if HAVE_HUGEPAGE_MMAP
+    /* Back large buffers with 2MiB huge pages to reduce TLB pressure on the
+     * high-bandwidth copy paths. MAP_HUGETLB requires pages to have been
+     * explicitly reserved by the administrator, so on failure fall back to
+     * an ordinary mapping with MADV_HUGEPAGE, which allows the kernel to
+     * supply transparent huge pages without any reservation.
+     */
+    const std::size_t hugePageSize = 2 * 1024 * 1024;
+    if (size >= hugePageSize)
+    {
+        const std::size_t rounded = roundUp(size, hugePageSize);
+        void *ptr = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED)
+        {
+            ptr = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr != MAP_FAILED)
+                madvise(ptr, rounded, MADV_HUGEPAGE); // advisory: failure is harmless
+        }
+        else
+            Log::log[Log::debug] << "Using reserved huge pages for " << name << '\n';
+        if (ptr != MAP_FAILED)
+        {
+            buffer = static_cast<char *>(ptr);
+            mappedSize = rounded;
+            allocator.recordAllocate(mappedSize);
+        }
+    }
+#endif
+    if (buffer == NULL)
+        buffer = allocator.allocate(size);
+    numaBindMemory(buffer, size, numaNode);
+#if HAVE_MLOCK
+    if (lockMemory)
+    {
+        /* Explicitly reserved huge pages are already unswappable, but
+         * locking them anyway is harmless and keeps this unconditional.
+         * No matching munlock is needed: unmapping or freeing the memory
+         * releases the lock.
+         */
+        if (mlock(buffer, mappedSize != 0 ? mappedSize : size) != 0)
+            Log::log[Log::warn] << "Could not lock " << name << " into memory: "
+                << std::strerror(errno) << '\n';
+        else
+            Log::log[Log::debug] << "Locked " << name << " into memory\n";
+    }
+#endif
 }
 
 CircularBuffer::~CircularBuffer()
 {
+#if HAVE_HUGEPAGE_MMAP
+    if (mappedSize != 0)
+    {
+        munmap(buffer, mappedSize);
+        allocator.recordDeallocate(mappedSize);
+        return;
+    }
+#endif
     allocator.deallocate(buffer, size());
 }
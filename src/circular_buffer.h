@@ -34,7 +34,7 @@
 #include <cstddef>
 #include <utility>
 #include <string>
-#include <list>
+#include <map>
 #include <boost/noncopyable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/condition_variable.hpp>
@@ -49,11 +49,14 @@
  * contiguous pool. For a memory-backed buffer, use @ref CircularBuffer.
  *
  * Allocations are made with @ref allocate; these will block until sufficient
- * memory is available. The memory must later be returned with @ref free. It is
- * not required to free memory in the same order as allocations, but it should
- * be done roughly in this order for best performance. The intended use case is
- * multiple producers allocating memory to pass data to multiple consumers,
- * which free the memory.
+ * memory is available. The memory must later be returned with @ref free.
+ * Memory may be freed in any order: space is reclaimed as soon as it is
+ * freed, with adjacent free regions implicitly coalescing, so one
+ * long-lived allocation does not pin the space freed after it. Freeing
+ * roughly in allocation order still gives the best locality, since new
+ * allocations are placed after the most recent one when possible. The
+ * intended use case is multiple producers allocating memory to pass data to
+ * multiple consumers, which free the memory.
  */
 class CircularBufferBase : public boost::noncopyable
 {
@@ -78,12 +81,28 @@ private:
 
     /**
      * First free position. It is legal for this to be anything in the range
-     * [0, @ref bufferSize]. The two end-points are equivalent.
+     * [0, @ref bufferSize]. The two end-points are equivalent. This is only
+     * a hint for placement: @ref tryAllocate starts its search here so that
+     * allocations and in-order frees behave like a classic ring.
      */
     std::size_t firstFree;
 
-    /// Start positions of all live allocations.
-    Statistics::Container::list<std::size_t> allocPoints;
+    /// Live allocations: start position to number of elements, ordered by position.
+    Statistics::Container::map<std::size_t, std::size_t> allocations;
+
+    /// Total number of currently allocated elements
+    std::size_t allocated;
+
+    /**
+     * Find a position for an allocation of @a n elements, searching the
+     * holes between live allocations in ring order starting from @ref
+     * firstFree. Does not modify any state.
+     *
+     * @return The position, or @ref bufferSize if no hole is big enough.
+     *
+     * @pre The caller holds @ref mutex.
+     */
+    std::size_t tryAllocate(std::size_t n) const;
 
 public:
     /**
@@ -96,13 +115,13 @@ public:
         friend class CircularBufferBase;
     private:
         /**
-         * Iterator into @ref CircularBufferBase::allocPoints to be removed
+         * Iterator into @ref CircularBufferBase::allocations to be removed
          * on free.
          */
-        Statistics::Container::list<std::size_t>::iterator point;
+        Statistics::Container::map<std::size_t, std::size_t>::iterator point;
 
         /// Constructor used by @ref CircularBufferBase::allocate
-        explicit Allocation(Statistics::Container::list<std::size_t>::iterator point);
+        explicit Allocation(Statistics::Container::map<std::size_t, std::size_t>::iterator point);
     public:
         /// Creates an invalid allocation
         Allocation();
@@ -121,6 +140,9 @@ public:
      */
     explicit CircularBufferBase(const std::string &name, std::size_t size);
 
+    /// Destructor
+    ~CircularBufferBase();
+
     /// Return number of elements in the buffer
     std::size_t size() const;
 
@@ -139,6 +161,9 @@ public:
      * @param n              Number of items to allocate.
      * @param stat           Statistic to which the waiting time will be recorded (may be @c NULL).
      *
+     * @throw cancelled if the run is cancelled (see @ref Cancel) before
+     * space becomes available.
+     *
      * @pre 0 &lt; @a n &lt; @ref size().
      */
     Allocation allocate(Timeplot::Worker &tworker, std::size_t n, Statistics::Variable *stat = NULL);
@@ -163,10 +188,19 @@ public:
 class CircularBuffer : protected CircularBufferBase
 {
 private:
-    /// Allocator used to allocate and free @ref buffer
+    /// Allocator used to allocate and free @ref buffer (and for statistics)
     Statistics::Allocator<std::allocator<char> > allocator;
     /// Memory backing the buffer
     char *buffer;
+    /**
+     * Number of bytes obtained with @c mmap, or zero if @ref buffer was
+     * obtained from @ref allocator instead. It may exceed @ref size() due
+     * to rounding up to a huge page boundary.
+     */
+    std::size_t mappedSize;
+
+    /// Whether new buffers are locked into RAM (see @ref setLockMemory)
+    static bool lockMemory;
 public:
     /**
      * Information about an allocation from @ref allocate
@@ -231,15 +265,38 @@ public:
      */
     void free(const Allocation &alloc);
 
+    /**
+     * Requests that the backing memory of subsequently-constructed buffers
+     * be locked into RAM with @c mlock. The circular buffers sit on the
+     * latency-critical copy and meshing paths, and under memory pressure
+     * from co-tenant jobs the kernel may otherwise page parts of them out,
+     * turning cheap buffer accesses into major faults. The buffer sizes are
+     * set by the memory budget, so the amount locked is already bounded.
+     *
+     * Only takes effect where the OS supports @c mlock. A failure to lock
+     * (typically @c RLIMIT_MEMLOCK) is reported as a warning and the buffer
+     * is used unlocked.
+     */
+    static void setLockMemory(bool lock);
+
     /**
      * Constructor.
      *
+     * Where the OS supports it, buffers of at least 2MiB are backed by huge
+     * pages to reduce TLB pressure: first with explicitly reserved huge
+     * pages, then falling back to transparent huge pages, then to an
+     * ordinary heap allocation. When one of the mapping paths is taken the
+     * buffer is page-aligned; otherwise it has the alignment of
+     * @c operator @c new.
+     *
      * @param name      Buffer name used for memory statistic.
      * @param size      Bytes of storage to reserve.
+     * @param numaNode  NUMA node to which the backing memory is bound, or
+     *                  negative (the default) to leave placement to the OS.
      *
      * @pre @a size &gt; 0
      */
-    CircularBuffer(const std::string &name, std::size_t size);
+    CircularBuffer(const std::string &name, std::size_t size, int numaNode = -1);
 
     /// Destructor
     ~CircularBuffer();
@@ -0,0 +1,199 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref ClassifyCL.
+ */
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <CL/cl.hpp>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+#include <utility>
+#include <map>
+#include <string>
+#include "tr1_cstdint.h"
+#include "classify_cl.h"
+#include "splat.h"
+#include "grid.h"
+#include "clh.h"
+#include "errors.h"
+#include "misc.h"
+#include "statistics.h"
+#include "statistics_cl.h"
+
+const ClassifyCL::code_type ClassifyCL::BAD_CODE;
+
+void ClassifyCL::validateDevice(const cl::Device &device)
+{
+    /* Only base OpenCL 1.1 functionality (global atomics) is used, so any
+     * device that passes the generic checks will do.
+     */
+    (void) device;
+}
+
+CLH::ResourceUsage ClassifyCL::resourceUsage(
+    const cl::Device &device,
+    std::size_t maxSplats,
+    std::size_t maxMicroblocks)
+{
+    (void) device;
+    MLSGPU_ASSERT(1 <= maxSplats && maxSplats <= MAX_SPLATS, std::length_error);
+    MLSGPU_ASSERT(1 <= maxMicroblocks, std::length_error);
+
+    CLH::ResourceUsage ans;
+
+    // Keep this up to date with the actual allocations in the constructor
+
+    // splats = cl::Buffer(context, CL_MEM_READ_ONLY, maxSplats * sizeof(Splat));
+    ans.addBuffer("splats", maxSplats * sizeof(Splat));
+    // counts = cl::Buffer(context, CL_MEM_READ_WRITE, maxMicroblocks * sizeof(code_type));
+    ans.addBuffer("counts", maxMicroblocks * sizeof(code_type));
+    // codes = cl::Buffer(context, CL_MEM_WRITE_ONLY, maxSplats * sizeof(code_type));
+    ans.addBuffer("codes", maxSplats * sizeof(code_type));
+
+    return ans;
+}
+
+ClassifyCL::ClassifyCL(const cl::Context &context, const cl::Device &device,
+                       std::size_t maxSplats, std::size_t maxMicroblocks)
+    :
+    maxSplats(maxSplats), maxMicroblocks(maxMicroblocks),
+    lastSplats(0),
+    classifyKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.classify.classifySplats.time")),
+    fillKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.classify.fill.time"))
+{
+    MLSGPU_ASSERT(1 <= maxSplats && maxSplats <= MAX_SPLATS, std::length_error);
+    MLSGPU_ASSERT(1 <= maxMicroblocks, std::length_error);
+    (void) device;
+
+    for (unsigned int i = 0; i < 3; i++)
+        dims[i] = 0;
+
+    // If this section is modified, remember to update resourceUsage above
+    splats = cl::Buffer(context, CL_MEM_READ_ONLY, maxSplats * sizeof(Splat));
+    counts = cl::Buffer(context, CL_MEM_READ_WRITE, maxMicroblocks * sizeof(code_type));
+    codes = cl::Buffer(context, CL_MEM_WRITE_ONLY, maxSplats * sizeof(code_type));
+
+    std::map<std::string, std::string> defines;
+    cl::Program program = CLH::build(context, "kernels/classify.cl", defines);
+    classifyKernel = cl::Kernel(program, "classifySplats");
+    fillKernel = cl::Kernel(program, "fill");
+}
+
+void ClassifyCL::reset(
+    const cl::CommandQueue &queue,
+    const Grid::size_type dims[3],
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    const std::size_t total = std::size_t(dims[0]) * dims[1] * dims[2];
+    MLSGPU_ASSERT(1 <= total && total <= maxMicroblocks, std::length_error);
+    for (unsigned int i = 0; i < 3; i++)
+        this->dims[i] = dims[i];
+
+    fillKernel.setArg(0, counts);
+    fillKernel.setArg(1, (cl_uint) 0);
+    CLH::enqueueNDRangeKernel(queue,
+                              fillKernel,
+                              cl::NullRange,
+                              cl::NDRange(total),
+                              cl::NullRange,
+                              events, event, &fillKernelTime);
+}
+
+void ClassifyCL::enqueueClassify(
+    const cl::CommandQueue &queue,
+    const Splat *splats,
+    std::size_t numSplats,
+    const Grid &grid,
+    Grid::size_type microSize,
+    const std::vector<cl::Event> *events,
+    cl::Event *uploadEvent,
+    cl::Event *event)
+{
+    MLSGPU_ASSERT(1 <= numSplats && numSplats <= maxSplats, std::length_error);
+    MLSGPU_ASSERT(microSize > 0, std::invalid_argument);
+    for (unsigned int i = 0; i < 3; i++)
+        MLSGPU_ASSERT(divUp(grid.numCells(i), microSize) == dims[i], std::invalid_argument);
+
+    cl::Event wroteSplats;
+    queue.enqueueWriteBuffer(this->splats, CL_FALSE, 0, numSplats * sizeof(Splat),
+                             splats, events, &wroteSplats);
+    if (uploadEvent != NULL)
+        *uploadEvent = wroteSplats;
+    lastSplats = numSplats;
+
+    const float *ref = grid.getReference();
+    cl_float3 ref3 = {{ ref[0], ref[1], ref[2] }};
+    cl_int3 cellBias = {{ grid.getExtent(0).first, grid.getExtent(1).first, grid.getExtent(2).first }};
+    cl_int3 dims3 = {{ (cl_int) dims[0], (cl_int) dims[1], (cl_int) dims[2] }};
+
+    classifyKernel.setArg(0, counts);
+    classifyKernel.setArg(1, codes);
+    classifyKernel.setArg(2, this->splats);
+    classifyKernel.setArg(3, ref3);
+    classifyKernel.setArg(4, (cl_float) (1.0f / grid.getSpacing()));
+    classifyKernel.setArg(5, cellBias);
+    classifyKernel.setArg(6, (cl_int) microSize);
+    classifyKernel.setArg(7, dims3);
+
+    std::vector<cl::Event> wait(1, wroteSplats);
+    CLH::enqueueNDRangeKernel(queue,
+                              classifyKernel,
+                              cl::NullRange,
+                              cl::NDRange(numSplats),
+                              cl::NullRange,
+                              &wait, event, &classifyKernelTime);
+}
+
+void ClassifyCL::readHistogram(
+    const cl::CommandQueue &queue,
+    std::vector<count_entry> &counts) const
+{
+    const std::size_t total = std::size_t(dims[0]) * dims[1] * dims[2];
+    MLSGPU_ASSERT(total > 0, state_error);
+
+    std::vector<code_type> raw(total);
+    queue.enqueueReadBuffer(this->counts, CL_TRUE, 0, total * sizeof(code_type), &raw[0]);
+
+    counts.clear();
+    for (std::size_t i = 0; i < total; i++)
+        if (raw[i] != 0)
+            counts.push_back(count_entry(i, raw[i]));
+}
+
+void ClassifyCL::readCodes(
+    const cl::CommandQueue &queue,
+    std::vector<code_type> &codes) const
+{
+    MLSGPU_ASSERT(lastSplats > 0, state_error);
+    codes.resize(lastSplats);
+    queue.enqueueReadBuffer(this->codes, CL_TRUE, 0, lastSplats * sizeof(code_type), &codes[0]);
+}
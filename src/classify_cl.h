@@ -0,0 +1,200 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * GPU engine for classifying splats into microblocks.
+ */
+
+#ifndef CLASSIFY_CL_H
+#define CLASSIFY_CL_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <CL/cl.hpp>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include "tr1_cstdint.h"
+#include "clh.h"
+#include "grid.h"
+#include "splat.h"
+#include "statistics.h"
+
+/**
+ * Computes the counting pass of the bucketing algorithm on a device. Splat
+ * batches are streamed to the device, a kernel classifies each splat into the
+ * microblocks it touches (with exactly the rounding that
+ * @c SplatSet::detail::SplatToBuckets uses on the host), and a compact
+ * histogram of per-microblock counts is returned. The kernel also emits a
+ * Morton cell code per splat, compatible with the codes used by the octree
+ * build in @c kernels/octree.cl.
+ *
+ * The counting pass is the most regular, data-parallel work the host does,
+ * and it runs while the devices would otherwise be idle, so offloading it is
+ * almost free. Use of this class is optional: the host-side counting in
+ * @ref Bucket remains the fallback, and results are identical.
+ *
+ * The counts for several batches of splats accumulate until @ref reset is
+ * called, so a region larger than @a maxSplats can be classified in pieces.
+ */
+class ClassifyCL : public boost::noncopyable
+{
+public:
+    /// Type used for cell codes and counts
+    typedef std::tr1::uint32_t code_type;
+
+    /// A microblock index (z-major linearization) with its splat count
+    typedef std::pair<std::size_t, code_type> count_entry;
+
+    /**
+     * Code emitted for a splat that covers more than one microblock (such a
+     * splat is counted in each of them), or that lies entirely outside the
+     * region (such a splat is not counted at all).
+     */
+    static const code_type BAD_CODE = 0xFFFFFFFFu;
+
+    enum
+    {
+        /**
+         * Maximum legal value for @a maxSplats passed to the constructor.
+         * This just needs to be indexable by @ref code_type with room for
+         * @ref BAD_CODE as a sentinel.
+         */
+        MAX_SPLATS = 0x7FFFFFFF
+    };
+
+    /**
+     * Checks whether the device can support this class at all.
+     *
+     * @throw CLH::invalid_device if the device is unsuitable.
+     */
+    static void validateDevice(const cl::Device &device);
+
+    /**
+     * Estimates the resources used by a single instance.
+     *
+     * @param device          Device on which the instance will be used.
+     * @param maxSplats       As for the constructor.
+     * @param maxMicroblocks  As for the constructor.
+     */
+    static CLH::ResourceUsage resourceUsage(
+        const cl::Device &device,
+        std::size_t maxSplats,
+        std::size_t maxMicroblocks);
+
+    /**
+     * Constructor. This allocates the maximum-sized buffers; see
+     * @ref resourceUsage.
+     *
+     * @param context         Context used to create buffers and kernels.
+     * @param device          Device the instance will run on.
+     * @param maxSplats       Maximum splats in one call to @ref enqueueClassify.
+     * @param maxMicroblocks  Maximum total microblocks in the region
+     *                        (the driver bounds this by @a maxSplit).
+     */
+    ClassifyCL(const cl::Context &context, const cl::Device &device,
+               std::size_t maxSplats, std::size_t maxMicroblocks);
+
+    /**
+     * Zero the histogram, starting a new region.
+     *
+     * @param queue           Queue in which to enqueue the work.
+     * @param dims            Size of the new region in microblocks.
+     * @param events          Events to wait for (or @c NULL).
+     * @param event           Event signaled on completion (or @c NULL).
+     *
+     * @pre The product of @a dims does not exceed @a maxMicroblocks.
+     */
+    void reset(const cl::CommandQueue &queue,
+               const Grid::size_type dims[3],
+               const std::vector<cl::Event> *events = NULL,
+               cl::Event *event = NULL);
+
+    /**
+     * Classify a batch of splats, accumulating their counts into the
+     * histogram. The splats are copied, so the caller may reuse the storage
+     * once @a uploadEvent is signaled.
+     *
+     * @param queue           Queue in which to enqueue the work.
+     * @param splats          Batch of splats. All must be finite.
+     * @param numSplats       Number of splats in the batch.
+     * @param grid            Sub-grid over which bucketing is being done.
+     * @param microSize       Side length of a microblock in cells.
+     * @param events          Events to wait for (or @c NULL).
+     * @param uploadEvent     Event signaled when @a splats may be reused (or @c NULL).
+     * @param event           Event signaled on completion (or @c NULL).
+     *
+     * @pre @a numSplats does not exceed @a maxSplats, and @ref reset was
+     * called with the dimensions implied by @a grid and @a microSize.
+     */
+    void enqueueClassify(const cl::CommandQueue &queue,
+                         const Splat *splats,
+                         std::size_t numSplats,
+                         const Grid &grid,
+                         Grid::size_type microSize,
+                         const std::vector<cl::Event> *events = NULL,
+                         cl::Event *uploadEvent = NULL,
+                         cl::Event *event = NULL);
+
+    /**
+     * Retrieve the histogram, compacted to just the non-empty microblocks.
+     * This blocks until all prior work in @a queue completes.
+     *
+     * @param      queue     Queue in which to enqueue the readback.
+     * @param[out] counts    Index and count for each non-empty microblock,
+     *                       in increasing index order.
+     */
+    void readHistogram(const cl::CommandQueue &queue,
+                       std::vector<count_entry> &counts) const;
+
+    /**
+     * Retrieve the cell codes for the most recent batch. This blocks until
+     * all prior work in @a queue completes.
+     *
+     * @param      queue     Queue in which to enqueue the readback.
+     * @param[out] codes     One code per splat of the last batch (see @ref BAD_CODE).
+     */
+    void readCodes(const cl::CommandQueue &queue,
+                   std::vector<code_type> &codes) const;
+
+private:
+    std::size_t maxSplats;       ///< Maximum splats per batch
+    std::size_t maxMicroblocks;  ///< Maximum histogram size
+
+    Grid::size_type dims[3];     ///< Region size set by the last @ref reset
+    std::size_t lastSplats;      ///< Batch size of the last @ref enqueueClassify
+
+    cl::Buffer splats;           ///< Staging buffer for one batch of splats
+    cl::Buffer counts;           ///< Per-microblock histogram
+    cl::Buffer codes;            ///< Per-splat cell codes
+
+    cl::Kernel classifyKernel;   ///< Kernel compiled from @c classifySplats
+    cl::Kernel fillKernel;       ///< Kernel compiled from @c fill
+
+    Statistics::Variable &classifyKernelTime; ///< Statistic for time spent in @ref classifyKernel
+    Statistics::Variable &fillKernelTime;     ///< Statistic for time spent in @ref fillKernel
+};
+
+#endif /* !CLASSIFY_CL_H */
@@ -31,6 +31,8 @@
 #endif
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/next_prior.hpp>
 #include <CL/cl.hpp>
@@ -43,8 +45,15 @@
 #include <map>
 #include <set>
 #include <cstdlib>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <cctype>
+#include "tr1_cstdint.h"
 #include "clh.h"
+#include "timeplot.h"
 #include "logging.h"
+#include "numa.h"
 #include "statistics.h"
 #include "statistics_cl.h"
 
@@ -99,6 +108,76 @@ MemoryMapping::~MemoryMapping()
 
 } // namespace detail
 
+struct PinnedMemoryPool::Block
+{
+    cl::Buffer buffer;    ///< Buffer created with @c CL_MEM_ALLOC_HOST_PTR
+    void *ptr;            ///< Host pointer, mapped for the block's lifetime
+    std::size_t bytes;    ///< Size class (the allocated size, not the requested size)
+};
+
+PinnedMemoryPool::PinnedMemoryPool(
+    const std::string &name, const cl::Context &context, const cl::Device &device)
+    : allocator(Statistics::makeAllocator<Statistics::Allocator<std::allocator<char> > >(name)),
+    context(context),
+    queue(context, device, 0)
+{
+}
+
+PinnedMemoryPool::~PinnedMemoryPool()
+{
+    for (std::map<std::size_t, std::vector<Block *> >::const_iterator i = freeBlocks.begin();
+         i != freeBlocks.end(); ++i)
+        for (std::size_t j = 0; j < i->second.size(); j++)
+            queue.enqueueUnmapMemObject(i->second[j]->buffer, i->second[j]->ptr);
+    queue.finish();
+    for (std::map<std::size_t, std::vector<Block *> >::const_iterator i = freeBlocks.begin();
+         i != freeBlocks.end(); ++i)
+        for (std::size_t j = 0; j < i->second.size(); j++)
+        {
+            allocator.recordDeallocate(i->second[j]->bytes);
+            delete i->second[j];
+        }
+}
+
+PinnedMemoryPool::Allocation PinnedMemoryPool::allocate(std::size_t bytes)
+{
+    std::size_t rounded = 1;
+    while (rounded < bytes)
+        rounded *= 2;
+
+    Block *block = NULL;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        std::vector<Block *> &free = freeBlocks[rounded];
+        if (!free.empty())
+        {
+            block = free.back();
+            free.pop_back();
+        }
+    }
+    if (block == NULL)
+    {
+        /* Pinning and mapping is exactly what the pool exists to avoid, but
+         * misses only happen while growing to the high-water mark.
+         */
+        Block fresh;
+        fresh.buffer = cl::Buffer(context, CL_MEM_ALLOC_HOST_PTR, rounded);
+        fresh.ptr = queue.enqueueMapBuffer(
+            fresh.buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, rounded);
+        fresh.bytes = rounded;
+        allocator.recordAllocate(rounded);
+        block = new Block(fresh);
+    }
+    return Allocation(boost::shared_ptr<void>(
+        block->ptr, boost::bind(&PinnedMemoryPool::release, this, block)));
+}
+
+void PinnedMemoryPool::release(Block *block)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    freeBlocks[block->bytes].push_back(block);
+}
+
 ResourceUsage ResourceUsage::operator+(const ResourceUsage &b) const
 {
     ResourceUsage out;
@@ -167,13 +246,155 @@ namespace detail
 const std::map<std::string, std::string> &getSourceMap();
 }
 
+namespace
+{
+
+/// Whether cooperative device sharing was requested (see @ref DeviceShare)
+bool shareEnabled = false;
+
+/// Registry of shares created so far, keyed by lock filename
+std::map<std::string, DeviceShare *> shares;
+
+/// Protects @ref shareEnabled and @ref shares
+boost::mutex sharesMutex;
+
+/**
+ * Compute the well-known arbitration file for a device. All cooperating
+ * instances must agree on the name, so it is derived from the device name
+ * and the device's position among same-named devices in its platform's
+ * enumeration order (which is stable on one machine), and placed in the
+ * system-wide temporary directory rather than the per-job @c --tmp-dir.
+ */
+static boost::filesystem::path sharePath(const cl::Device &device)
+{
+    const std::string name = device.getInfo<CL_DEVICE_NAME>();
+    unsigned int index = 0;
+
+    cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+    std::vector<cl::Device> devices;
+    platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+    BOOST_FOREACH(const cl::Device &d, devices)
+    {
+        if (d() == device())
+            break;
+        if (d.getInfo<CL_DEVICE_NAME>() == name)
+            index++;
+    }
+
+    std::ostringstream leaf;
+    leaf << "mlsgpu-device-";
+    for (std::string::size_type i = 0; i < name.size(); i++)
+        leaf << (std::isalnum(static_cast<unsigned char>(name[i])) ? name[i] : '_');
+    leaf << '-' << index << ".lock";
+    return boost::filesystem::temp_directory_path() / leaf.str();
+}
+
+} // anonymous namespace
+
+DeviceShare::DeviceShare(const cl::Device &device)
+{
+    const boost::filesystem::path path = sharePath(device);
+    /* Touch the file without truncating it, in case another instance
+     * already holds the lock.
+     */
+    boost::filesystem::ofstream touch(path, std::ios::app);
+    touch.close();
+    boost::interprocess::file_lock(path.string().c_str()).swap(fileLock);
+}
+
+void DeviceShare::setEnabled(bool enable)
+{
+    boost::lock_guard<boost::mutex> lock(sharesMutex);
+    shareEnabled = enable;
+}
+
+DeviceShare *DeviceShare::get(const cl::Device &device)
+{
+    boost::lock_guard<boost::mutex> lock(sharesMutex);
+    if (!shareEnabled)
+        return NULL;
+    const std::string key = sharePath(device).string();
+    DeviceShare *&share = shares[key];
+    if (share == NULL)
+        share = new DeviceShare(device);  // lives until process exit
+    return share;
+}
+
+bool DeviceShare::busy(const cl::Device &device)
+{
+    DeviceShare *share = get(device);
+    if (share == NULL)
+        return false;
+    if (share->fileLock.try_lock())
+    {
+        share->fileLock.unlock();
+        return false;
+    }
+    return true;
+}
+
+DeviceShare::Turn::Turn(DeviceShare *share, Timeplot::Worker &tworker)
+    : share(share)
+{
+    if (share != NULL)
+    {
+        Timeplot::Action action("wait", tworker,
+            Statistics::getStatistic<Statistics::Variable>("device.coop.wait"));
+        share->threadMutex.lock();
+        share->fileLock.lock();
+    }
+}
+
+DeviceShare::Turn::~Turn()
+{
+    if (share != NULL)
+    {
+        share->fileLock.unlock();
+        share->threadMutex.unlock();
+    }
+}
+
 void addOptions(boost::program_options::options_description &desc)
 {
     desc.add_options()
         (Option::device, boost::program_options::value<std::vector<std::string> >()->composing(),
                          "OpenCL device name")
         (Option::cpu,    "Use all CPU devices")
-        (Option::gpu,    "Use all GPU devices");
+        (Option::gpu,    "Use all GPU devices")
+        (Option::coop,   "Take turns with other cooperating instances sharing a device")
+        (Option::mathMode, boost::program_options::value<std::string>()->default_value("strict"),
+                         "Kernel math accuracy tier (strict | fused | fast)");
+}
+
+/// Tier applied by @ref build (see @ref setMathMode)
+static MathMode mathMode = MATH_STRICT;
+
+MathMode parseMathMode(const std::string &name)
+{
+    if (name == "strict")
+        return MATH_STRICT;
+    else if (name == "fused")
+        return MATH_FUSED;
+    else if (name == "fast")
+        return MATH_FAST;
+    else
+        throw std::invalid_argument("Invalid --" + std::string(Option::mathMode) + " value `" + name + "'");
+}
+
+void setMathMode(MathMode mode)
+{
+    mathMode = mode;
+}
+
+/// Compiler options corresponding to the current math tier
+static std::string mathModeOptions()
+{
+    switch (mathMode)
+    {
+    case MATH_FUSED:  return " -cl-mad-enable -cl-no-signed-zeros";
+    case MATH_FAST:   return " -cl-fast-relaxed-math";
+    default:          return "";
+    }
 }
 
 /**
@@ -192,6 +413,13 @@ std::vector<cl::Device> findDevices(const boost::program_options::variables_map
 {
     std::vector<cl::Device> ans;
 
+    DeviceShare::setEnabled(vm.count(Option::coop));
+    /* Applied here because this is the common entry point that sees the
+     * parsed options before any kernels are built.
+     */
+    if (vm.count(Option::mathMode))
+        setMathMode(parseMathMode(vm[Option::mathMode].as<std::string>()));
+
     // Parse device names
     std::vector<std::string> deviceNames;
     if (vm.count(Option::device))
@@ -282,6 +510,21 @@ std::vector<cl::Device> findDevices(const boost::program_options::variables_map
         }
     }
 
+    /* In cooperative mode, report which of the chosen devices already have
+     * a co-tenant, so it is visible up front which jobs will be taking
+     * turns.
+     */
+    if (vm.count(Option::coop))
+    {
+        BOOST_FOREACH(const cl::Device &device, ans)
+        {
+            if (DeviceShare::busy(device))
+                Log::log[Log::info]
+                    << "Device " << device.getInfo<CL_DEVICE_NAME>()
+                    << " is in use by another cooperating instance; turns will be shared\n";
+        }
+    }
+
     return ans;
 }
 
@@ -301,6 +544,209 @@ cl::Context makeContext(const cl::Device &device)
     return cl::Context(devices, props, contextCallback);
 }
 
+/* Vendor extensions reporting the PCIe location of a device. These are
+ * defined locally because the vendor headers that declare them need not be
+ * installed; the extension string is checked before they are used.
+ */
+#ifndef CL_DEVICE_PCI_BUS_ID_NV
+# define CL_DEVICE_PCI_BUS_ID_NV      0x4008
+#endif
+#ifndef CL_DEVICE_PCI_SLOT_ID_NV
+# define CL_DEVICE_PCI_SLOT_ID_NV     0x4009
+#endif
+#ifndef CL_DEVICE_PCI_DOMAIN_ID_NV
+# define CL_DEVICE_PCI_DOMAIN_ID_NV   0x400A
+#endif
+#ifndef CL_DEVICE_TOPOLOGY_AMD
+# define CL_DEVICE_TOPOLOGY_AMD       0x4037
+# define CL_DEVICE_TOPOLOGY_TYPE_PCIE_AMD 1
+typedef union
+{
+    struct { cl_uint type; cl_uint data[5]; } raw;
+    struct { cl_uint type; cl_char unused[17]; cl_char bus; cl_char device; cl_char function; } pcie;
+} cl_device_topology_amd;
+#endif
+
+int deviceNumaNode(const cl::Device &device)
+{
+    const std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+    if (extensions.find("cl_nv_device_attribute_query") != std::string::npos)
+    {
+        cl_uint domain = 0, bus = 0, slot = 0;
+        // The domain query is newer than the other two, so it may fail
+        device.getInfo(CL_DEVICE_PCI_DOMAIN_ID_NV, &domain);
+        if (device.getInfo(CL_DEVICE_PCI_BUS_ID_NV, &bus) == CL_SUCCESS
+            && device.getInfo(CL_DEVICE_PCI_SLOT_ID_NV, &slot) == CL_SUCCESS)
+        {
+            /* The slot ID packs the PCI device number with the function in
+             * the low three bits.
+             */
+            return numaNodeOfPci(domain, bus, slot >> 3, slot & 0x7);
+        }
+    }
+    if (extensions.find("cl_amd_device_attribute_query") != std::string::npos)
+    {
+        cl_device_topology_amd topology;
+        if (device.getInfo(CL_DEVICE_TOPOLOGY_AMD, &topology) == CL_SUCCESS
+            && topology.raw.type == CL_DEVICE_TOPOLOGY_TYPE_PCIE_AMD)
+        {
+            return numaNodeOfPci(0, (unsigned char) topology.pcie.bus,
+                                 (unsigned char) topology.pcie.device,
+                                 (unsigned char) topology.pcie.function);
+        }
+    }
+    return -1;
+}
+
+/**
+ * Determine the directory used to cache compiled program binaries. An empty
+ * path means that caching is disabled. The @c MLSGPU_CL_CACHE_DIR environment
+ * variable overrides the default of <code>$HOME/.cache/mlsgpu/cl</code>.
+ */
+static boost::filesystem::path programCacheDir()
+{
+    const char *env = std::getenv("MLSGPU_CL_CACHE_DIR");
+    if (env != NULL)
+        return boost::filesystem::path(env); // empty value disables the cache
+    const char *home = std::getenv("HOME");
+    if (home == NULL || *home == '\0')
+        return boost::filesystem::path();
+    return boost::filesystem::path(home) / ".cache" / "mlsgpu" / "cl";
+}
+
+/**
+ * Build the string that uniquely identifies a compiled program. It captures
+ * the preprocessed source, the build options and the device and driver, so a
+ * driver upgrade or source change invalidates old cache entries. The full key
+ * is stored in the cache file and compared on load, so hash collisions in the
+ * file name are harmless.
+ */
+static std::string programCacheKey(
+    const cl::Device &device,
+    const std::string &header, const std::string &source,
+    const std::string &options)
+{
+    std::ostringstream key;
+    key << device.getInfo<CL_DEVICE_NAME>() << '\0'
+        << device.getInfo<CL_DEVICE_VENDOR>() << '\0'
+        << device.getInfo<CL_DRIVER_VERSION>() << '\0'
+        << device.getInfo<CL_DEVICE_VERSION>() << '\0'
+        << options << '\0'
+        << header << '\0'
+        << source;
+    return key.str();
+}
+
+/// FNV-1a hash, used only to generate cache file names.
+static std::tr1::uint64_t hashString(const std::string &s)
+{
+    std::tr1::uint64_t h = UINT64_C(0xcbf29ce484222325);
+    for (std::size_t i = 0; i < s.size(); i++)
+    {
+        h ^= (unsigned char) s[i];
+        h *= UINT64_C(0x100000001b3);
+    }
+    return h;
+}
+
+/// Compute the cache file path for a key, or an empty path if caching is disabled.
+static boost::filesystem::path programCachePath(const std::string &key)
+{
+    boost::filesystem::path dir = programCacheDir();
+    if (dir.empty())
+        return dir;
+    std::ostringstream name;
+    name << std::hex << hashString(key) << ".bin";
+    return dir / name.str();
+}
+
+/**
+ * Attempt to load a previously compiled program from the binary cache.
+ * Returns an unbuilt program holding the cached binary, or @c NULL-like
+ * (default-constructed) program on any failure; failures are not errors,
+ * they merely force a recompile.
+ */
+static cl::Program loadCachedProgram(
+    const cl::Context &context, const cl::Device &device,
+    const boost::filesystem::path &path, const std::string &key)
+{
+    try
+    {
+        boost::filesystem::ifstream in(path, std::ios::binary);
+        if (!in)
+            return cl::Program();
+
+        std::tr1::uint64_t keySize, binarySize;
+        in.read(reinterpret_cast<char *>(&keySize), sizeof(keySize));
+        if (!in || keySize != key.size())
+            return cl::Program();
+        std::vector<char> fileKey(keySize);
+        in.read(&fileKey[0], keySize);
+        if (!in || !std::equal(fileKey.begin(), fileKey.end(), key.begin()))
+            return cl::Program();
+        in.read(reinterpret_cast<char *>(&binarySize), sizeof(binarySize));
+        if (!in || binarySize == 0)
+            return cl::Program();
+        std::vector<char> binary(binarySize);
+        in.read(&binary[0], binarySize);
+        if (!in)
+            return cl::Program();
+
+        cl::Program::Binaries binaries(1, std::make_pair((const void *) &binary[0], (::size_t) binarySize));
+        std::vector<cl::Device> devices(1, device);
+        return cl::Program(context, devices, binaries);
+    }
+    catch (std::exception &)
+    {
+        return cl::Program();
+    }
+}
+
+/**
+ * Store a built program's binary in the cache. Failures are silently
+ * ignored apart from a debug-level log message. The binary is written to a
+ * temporary file and renamed into place so that concurrent processes never
+ * observe a partial entry.
+ */
+static void saveCachedProgram(
+    const cl::Program &program,
+    const boost::filesystem::path &path, const std::string &key)
+{
+    try
+    {
+        std::vector< ::size_t> sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+        if (sizes.size() != 1 || sizes[0] == 0)
+            return;
+        std::vector<char> binary(sizes[0]);
+        std::vector<char *> binaryPtrs(1, &binary[0]);
+        clGetProgramInfo(program(), CL_PROGRAM_BINARIES,
+                         sizeof(char *), &binaryPtrs[0], NULL);
+
+        boost::filesystem::create_directories(path.parent_path());
+        boost::filesystem::path tmpPath = path;
+        tmpPath += ".tmp";
+        {
+            boost::filesystem::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            const std::tr1::uint64_t keySize = key.size();
+            const std::tr1::uint64_t binarySize = binary.size();
+            out.write(reinterpret_cast<const char *>(&keySize), sizeof(keySize));
+            out.write(key.data(), keySize);
+            out.write(reinterpret_cast<const char *>(&binarySize), sizeof(binarySize));
+            out.write(&binary[0], binarySize);
+            if (!out)
+            {
+                boost::filesystem::remove(tmpPath);
+                return;
+            }
+        }
+        boost::filesystem::rename(tmpPath, path);
+    }
+    catch (std::exception &e)
+    {
+        Log::log[Log::debug] << "Could not cache program binary: " << e.what() << '\n';
+    }
+}
+
 cl::Program build(const cl::Context &context, const std::vector<cl::Device> &devices,
                   const std::string &filename, const std::map<std::string, std::string> &defines,
                   const std::string &options)
@@ -310,6 +756,11 @@ cl::Program build(const cl::Context &context, const std::vector<cl::Device> &dev
         throw std::invalid_argument("No such program " + filename);
     const std::string &source = sourceMap.find(filename)->second;
 
+    /* The math tier participates in the cache key below through the
+     * options, so switching tiers cannot pick up a stale binary.
+     */
+    const std::string fullOptions = options + mathModeOptions();
+
     std::ostringstream s;
     for (std::map<std::string, std::string>::const_iterator i = defines.begin(); i != defines.end(); i++)
     {
@@ -317,6 +768,37 @@ cl::Program build(const cl::Context &context, const std::vector<cl::Device> &dev
     }
     s << "#line 1 \"" << filename << "\"\n";
     const std::string header = s.str();
+
+    /* Look for a cached binary before compiling from source. The cache is
+     * only used for single-device builds, which is the only case mlsgpu
+     * generates (one context per device).
+     */
+    std::string cacheKey;
+    boost::filesystem::path cachePath;
+    if (devices.size() == 1)
+    {
+        cacheKey = programCacheKey(devices[0], header, source, fullOptions);
+        cachePath = programCachePath(cacheKey);
+        if (!cachePath.empty())
+        {
+            cl::Program cached = loadCachedProgram(context, devices[0], cachePath, cacheKey);
+            if (cached() != NULL)
+            {
+                try
+                {
+                    cached.build(devices, fullOptions.c_str());
+                    Statistics::getStatistic<Statistics::Counter>("kernel.cache.hit").add();
+                    return cached;
+                }
+                catch (cl::Error &e)
+                {
+                    // Stale or corrupt binary: fall through to a source build
+                }
+            }
+            Statistics::getStatistic<Statistics::Counter>("kernel.cache.miss").add();
+        }
+    }
+
     cl::Program::Sources sources(2);
     sources[0] = std::make_pair(header.data(), header.length());
     sources[1] = std::make_pair(source.data(), source.length());
@@ -324,7 +806,9 @@ cl::Program build(const cl::Context &context, const std::vector<cl::Device> &dev
 
     try
     {
-        program.build(devices, options.c_str());
+        program.build(devices, fullOptions.c_str());
+        if (!cachePath.empty())
+            saveCachedProgram(program, cachePath, cacheKey);
     }
     catch (cl::Error &e)
     {
@@ -474,11 +958,16 @@ cl_int enqueueNDRangeKernel(
             return enqueueMarkerWithWaitList(queue, events, event);
         }
 
+    /* Only materialize an event for the statistic when event timing is
+     * actually enabled: otherwise every kernel launch pays for an event
+     * object that is never examined, which is measurable host overhead
+     * on small launches.
+     */
     cl::Event myEvent;
-    if (stat != NULL && event == NULL)
+    if (stat != NULL && event == NULL && Statistics::isEventTimingEnabled())
         event = &myEvent;
     int ret = queue.enqueueNDRangeKernel(kernel, offset, global, local, events, event);
-    if (stat != NULL && ret == CL_SUCCESS)
+    if (stat != NULL && ret == CL_SUCCESS && event != NULL)
         Statistics::timeEvent(*event, *stat);
     return ret;
 }
@@ -543,6 +1032,9 @@ cl_int enqueueNDRangeKernelSplit(
         extraOffset[i] = origOffset[i] + main[i];
     }
 
+    // As in enqueueNDRangeKernel, skip the events when nobody will use them
+    const bool needEvents = (event != NULL)
+        || (stat != NULL && Statistics::isEventTimingEnabled());
     std::vector<cl::Event> wait;
     for (std::size_t mask = 0; mask < (1U << dims); mask++)
     {
@@ -568,18 +1060,21 @@ cl_int enqueueNDRangeKernelSplit(
         }
         if (use)
         {
-            wait.push_back(cl::Event());
+            if (needEvents)
+                wait.push_back(cl::Event());
             queue.enqueueNDRangeKernel(kernel,
                                        makeNDRange(dims, curOffset),
                                        makeNDRange(dims, curGlobal),
                                        makeNDRange(dims, curLocal),
-                                       events, &wait.back());
+                                       events, needEvents ? &wait.back() : NULL);
         }
     }
 
     if (stat != NULL)
         Statistics::timeEvents(wait, *stat);
-    return enqueueMarkerWithWaitList(queue, &wait, event);
+    if (event != NULL)
+        return enqueueMarkerWithWaitList(queue, &wait, event);
+    return CL_SUCCESS;
 }
 
 } // namespace CLH
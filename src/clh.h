@@ -32,6 +32,9 @@
 #include "tr1_unordered_map.h"
 #include <boost/program_options.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
 #include <vector>
 #include <string>
 #include <map>
@@ -44,6 +47,11 @@ namespace Statistics
     class Registry;
 }
 
+namespace Timeplot
+{
+    class Worker;
+}
+
 /// OpenCL helper functions
 namespace CLH
 {
@@ -241,6 +249,83 @@ public:
     }
 };
 
+/**
+ * Pool of recycled pinned memory blocks for staging device-to-host transfers.
+ * @ref PinnedMemory suits a long-lived buffer of fixed size; this class
+ * instead serves a stream of short-lived allocations of varying size without
+ * paying for pinning and mapping on each one. Requests are rounded up to a
+ * power of two and free blocks are recycled within their size class, so once
+ * the pool has warmed up an allocation is just a free-list operation.
+ *
+ * Blocks are only handed back to the driver when the pool is destroyed, so
+ * the pinned memory held grows to the high-water mark of simultaneous
+ * allocations (at most double the requested bytes, due to the rounding) and
+ * stays there. The pool does not bound this itself; callers are expected to
+ * limit the allocations they have in flight.
+ *
+ * The pool is thread-safe, and must outlive all allocations made from it.
+ */
+class PinnedMemoryPool : public boost::noncopyable
+{
+public:
+    /**
+     * Handle to an allocated block. Handles are copyable; the block returns
+     * to the pool's free list when the last handle referencing it is
+     * destroyed or reset.
+     */
+    class Allocation
+    {
+        friend class PinnedMemoryPool;
+    private:
+        boost::shared_ptr<void> ptr;
+
+        explicit Allocation(const boost::shared_ptr<void> &ptr) : ptr(ptr) {}
+    public:
+        Allocation() {}
+
+        /// Returns the mapped host pointer (@c NULL for an empty handle)
+        void *get() const { return ptr.get(); }
+
+        /// Drops the reference, returning the block if this was the last handle
+        void reset() { ptr.reset(); }
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param name     Name for the statistic recording the pinned memory held.
+     * @param context  Context in which to create the blocks.
+     * @param device   Device with which the blocks will be used.
+     */
+    PinnedMemoryPool(const std::string &name, const cl::Context &context, const cl::Device &device);
+
+    /**
+     * Destructor.
+     *
+     * @pre No allocations are outstanding.
+     */
+    ~PinnedMemoryPool();
+
+    /**
+     * Obtains a block of at least @a bytes bytes, recycling a free block of
+     * the same size class if there is one.
+     */
+    Allocation allocate(std::size_t bytes);
+
+private:
+    struct Block;
+
+    /// Returns a block to the free list (the deleter for @ref Allocation)
+    void release(Block *block);
+
+    Statistics::Allocator<std::allocator<char> > allocator; ///< Records the pinned memory held
+    cl::Context context;          ///< Context in which blocks are created
+    cl::CommandQueue queue;       ///< Queue used to map and unmap blocks
+    boost::mutex mutex;           ///< Protects @ref freeBlocks
+    /// Free blocks, keyed by size class
+    std::map<std::size_t, std::vector<Block *> > freeBlocks;
+};
+
 /**
  * Represents the resources required or consumed by an algorithm class.
  */
@@ -303,14 +388,115 @@ public:
     void addStatistics(Statistics::Registry &registry, const std::string &prefix);
 };
 
+/**
+ * Cross-process turn-taking for a device shared between several cooperating
+ * mlsgpu instances. When several jobs are packed onto one device their
+ * submission bursts interleave and each job roughly doubles the other's
+ * per-bin latency. In cooperative mode (see @ref Option::coop) each instance
+ * takes a turn on the device for the duration of one work item, arbitrated
+ * through an advisory lock on a well-known file in the system temporary
+ * directory, so the bursts run back to back instead of interleaved.
+ *
+ * File locks are held per process, not per thread, so a turn also serializes
+ * the submission threads of a single instance; cooperative mode therefore
+ * trades some intra-process overlap for inter-process fairness and should
+ * only be enabled when devices are actually shared.
+ */
+class DeviceShare : public boost::noncopyable
+{
+public:
+    /**
+     * Scoped ownership of one turn on the device. Waiting time is recorded
+     * against the @c device.coop.wait statistic. A @c NULL share (cooperative
+     * mode disabled) makes the turn a no-op.
+     */
+    class Turn : public boost::noncopyable
+    {
+    private:
+        DeviceShare *share;
+    public:
+        Turn(DeviceShare *share, Timeplot::Worker &tworker);
+        ~Turn();
+    };
+
+    /**
+     * Retrieve the share object for a device, creating it on first use. The
+     * same object is returned for every query on one device, so all worker
+     * groups for a device arbitrate through one lock. Returns @c NULL when
+     * cooperative mode is not enabled.
+     */
+    static DeviceShare *get(const cl::Device &device);
+
+    /**
+     * Whether another process currently holds a turn on the device. This is
+     * a momentary observation for reporting; it must not be used to decide
+     * whether taking a turn would block.
+     */
+    static bool busy(const cl::Device &device);
+
+    /// Enable or disable cooperative mode (called from @ref findDevices).
+    static void setEnabled(bool enable);
+
+private:
+    explicit DeviceShare(const cl::Device &device);
+
+    /**
+     * Serializes turns between the threads of this process, since the file
+     * lock only arbitrates between processes.
+     */
+    boost::mutex threadMutex;
+    boost::interprocess::file_lock fileLock;  ///< Inter-process arbitration
+
+    friend class Turn;
+};
+
 /// Option names for OpenCL options
 namespace Option
 {
 const char * const device = "cl-device";
 const char * const gpu = "cl-gpu";
 const char * const cpu = "cl-cpu";
+const char * const coop = "cl-coop";
+const char * const mathMode = "cl-math";
 } // namespace Option
 
+/**
+ * Accuracy tiers for kernel math, applied as compiler options in
+ * @ref build. The tiers trade floating-point strictness for speed:
+ * - @c MATH_STRICT: no relaxation (the default). Results are reproducible
+ *   across drivers to within the OpenCL conformance requirements.
+ * - @c MATH_FUSED: permits multiply-add contraction and ignores the sign
+ *   of zero (<tt>-cl-mad-enable -cl-no-signed-zeros</tt>). Rounding of
+ *   individual operations is otherwise unchanged.
+ * - @c MATH_FAST: full relaxed math (<tt>-cl-fast-relaxed-math</tt>),
+ *   which additionally allows reassociation and reduced-precision
+ *   (typically native) transcendentals.
+ *
+ * The faster tiers perturb the fitted surface slightly, so they should
+ * only be adopted after validating the output against a strict
+ * reconstruction (see @c utils/validate_math.py).
+ */
+enum MathMode
+{
+    MATH_STRICT,
+    MATH_FUSED,
+    MATH_FAST
+};
+
+/**
+ * Parse a tier name from the command line.
+ *
+ * @throw std::invalid_argument if @a name is not a known tier.
+ */
+MathMode parseMathMode(const std::string &name);
+
+/**
+ * Set the accuracy tier applied to subsequent calls to @ref build. The
+ * default is @ref MATH_STRICT. @ref findDevices applies the value of
+ * @ref Option::mathMode, so explicit calls are only needed in tests.
+ */
+void setMathMode(MathMode mode);
+
 /**
  * Append program options for selecting an OpenCL device.
  *
@@ -338,6 +524,17 @@ std::vector<cl::Device> findDevices(const boost::program_options::variables_map
  */
 cl::Context makeContext(const cl::Device &device);
 
+/**
+ * NUMA node holding the PCIe root that a device hangs off, so that host-side
+ * threads and buffers feeding the device can be placed on the same socket.
+ * The location is queried through the NVIDIA and AMD device attribute
+ * extensions and mapped to a node by the OS.
+ *
+ * @return The node number, or negative if the device's location could not be
+ * determined (no extension, not a PCIe device, or no NUMA support).
+ */
+int deviceNumaNode(const cl::Device &device);
+
 /**
  * Build a program for potentially multiple devices.
  *
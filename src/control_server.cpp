@@ -0,0 +1,300 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Local socket through which a running job accepts live tuning commands.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <boost/thread/locks.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#if HAVE_AF_UNIX
+# include <sys/socket.h>
+# include <sys/un.h>
+# include <poll.h>
+# include <unistd.h>
+#endif
+#include "control_server.h"
+#include "errors.h"
+#include "statistics.h"
+#include "logging.h"
+#include "thread_name.h"
+
+namespace
+{
+
+/**
+ * Write a statistics snapshot for the @c snapshot command. Failure is
+ * reported to the client rather than the log, so errors are swallowed here.
+ *
+ * @return Whether the snapshot was written.
+ */
+static bool writeSnapshot(const std::string &filename)
+{
+    const boost::filesystem::path target(filename);
+    const boost::filesystem::path tmp(filename + ".tmp");
+    try
+    {
+        {
+            boost::filesystem::ofstream out(tmp);
+            if (!out)
+                throw std::ios::failure("Could not open snapshot file");
+            out.exceptions(std::ios::failbit | std::ios::badbit);
+            out.precision(15);
+            out << Statistics::Registry::getInstance();
+        }
+        // Atomic replacement, as in Statistics::Monitor::writeSnapshot
+        boost::filesystem::rename(tmp, target);
+        return true;
+    }
+    catch (std::exception &e)
+    {
+        return false;
+    }
+}
+
+} // anonymous namespace
+
+ControlServer::ControlServer(const std::string &path)
+    : path(path), listenFd(-1), scheduler(NULL), stopping(false)
+{
+#if HAVE_AF_UNIX
+    sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Socket path `" + path + "' is too long");
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0
+        || bind(listenFd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0
+        || listen(listenFd, 4) < 0)
+    {
+        const std::string reason = std::strerror(errno);
+        if (listenFd >= 0)
+            close(listenFd);
+        listenFd = -1;
+        throw std::runtime_error("Could not listen on `" + path + "': " + reason);
+    }
+#else
+    throw std::runtime_error("--control requires local socket support, which is not available");
+#endif
+}
+
+ControlServer::~ControlServer()
+{
+    stop();
+#if HAVE_AF_UNIX
+    if (listenFd >= 0)
+    {
+        close(listenFd);
+        unlink(path.c_str());
+    }
+#endif
+}
+
+void ControlServer::addGroup(const std::string &name, ElasticGroup &group)
+{
+    MLSGPU_ASSERT(!thread, state_error);
+    groups.push_back(std::make_pair(name, &group));
+}
+
+void ControlServer::setScheduler(ElasticScheduler *scheduler)
+{
+    MLSGPU_ASSERT(!thread, state_error);
+    this->scheduler = scheduler;
+}
+
+void ControlServer::start()
+{
+    MLSGPU_ASSERT(!thread, state_error);
+    stopping = false;
+    thread.reset(new boost::thread(boost::bind(&ControlServer::run, this)));
+    Log::log[Log::info] << "Accepting control commands on " << path << "\n";
+}
+
+void ControlServer::stop()
+{
+    if (!thread)
+        return;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = true;
+    }
+    thread->join();
+    thread.reset();
+}
+
+std::string ControlServer::handleCommand(const std::string &line)
+{
+    std::istringstream tokens(line);
+    std::string cmd;
+    tokens >> cmd;
+
+    if (cmd == "status")
+    {
+        std::ostringstream reply;
+        reply << "ok";
+        for (std::size_t i = 0; i < groups.size(); i++)
+        {
+            ElasticGroup &group = *groups[i].second;
+            reply << ' ' << groups[i].first << '='
+                << group.getActiveWorkers() << '/'
+                << group.maxActiveWorkers() << '/'
+                << group.queueDepth();
+        }
+        return reply.str();
+    }
+    else if (cmd == "threads")
+    {
+        std::string name;
+        std::size_t count;
+        if (!(tokens >> name >> count))
+            return "error: usage: threads <group> <count>";
+        for (std::size_t i = 0; i < groups.size(); i++)
+            if (groups[i].first == name)
+            {
+                groups[i].second->setActiveWorkers(count);
+                std::ostringstream reply;
+                reply << "ok " << groups[i].second->getActiveWorkers();
+                return reply.str();
+            }
+        return "error: no group called `" + name + "'";
+    }
+    else if (cmd == "balance")
+    {
+        std::string state;
+        tokens >> state;
+        if (state != "on" && state != "off")
+            return "error: usage: balance on|off";
+        if (scheduler == NULL)
+            return "error: no elastic scheduler in this run";
+        scheduler->setEnabled(state == "on");
+        return "ok";
+    }
+    else if (cmd == "snapshot")
+    {
+        std::string filename;
+        if (!(tokens >> filename))
+            return "error: usage: snapshot <path>";
+        if (!writeSnapshot(filename))
+            return "error: could not write `" + filename + "'";
+        return "ok";
+    }
+    else
+        return "error: unknown command `" + cmd + "'";
+}
+
+#if HAVE_AF_UNIX
+
+void ControlServer::run()
+{
+    thread_set_name("control");
+    while (true)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (stopping)
+                return;
+        }
+
+        /* Wait with a timeout rather than blocking, so that stop() is
+         * honoured promptly even when no client ever connects.
+         */
+        pollfd pfd;
+        pfd.fd = listenFd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 500) <= 0)
+            continue;
+        const int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        /* The connection persists until the client closes it, one reply
+         * line per command line.
+         */
+        std::string line;
+        bool open = true;
+        while (open)
+        {
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                if (stopping)
+                    break;
+            }
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 500) <= 0)
+                continue;
+
+            char buffer[4096];
+            const ssize_t bytes = read(fd, buffer, sizeof(buffer));
+            if (bytes <= 0)
+                break;
+            for (ssize_t i = 0; i < bytes; i++)
+            {
+                if (buffer[i] != '\n')
+                    line += buffer[i];
+                else
+                {
+                    const std::string reply = handleCommand(line) + "\n";
+                    line.clear();
+                    std::size_t done = 0;
+                    while (done < reply.size())
+                    {
+                        const ssize_t sent = write(fd, reply.data() + done, reply.size() - done);
+                        if (sent <= 0)
+                        {
+                            open = false;
+                            break;
+                        }
+                        done += sent;
+                    }
+                    if (!open)
+                        break;
+                }
+            }
+        }
+        close(fd);
+    }
+}
+
+#else // !HAVE_AF_UNIX
+
+void ControlServer::run()
+{
+    // Unreachable: the constructor throws without local socket support
+}
+
+#endif // !HAVE_AF_UNIX
@@ -0,0 +1,124 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Local socket through which a running job accepts live tuning commands.
+ */
+
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include "worker_group.h"
+
+/**
+ * Serves tuning commands on a local socket while the pipeline runs, so that
+ * a mis-tuned long job can be corrected in place instead of being killed and
+ * restarted. Clients connect to the socket (e.g. with <tt>socat -
+ * UNIX-CONNECT:path</tt>) and send newline-terminated commands, each of
+ * which is answered with one <tt>ok</tt> or <tt>error</tt> line:
+ *
+ * - <tt>status</tt>: report each registered group as
+ *   <tt>name=active/max/queued</tt>.
+ * - <tt>threads &lt;group&gt; &lt;count&gt;</tt>: permit @a count workers of
+ *   the named group to take new items. The change takes effect at item
+ *   boundaries and is clamped as described for
+ *   @ref ElasticGroup::setActiveWorkers. If the elastic scheduler is
+ *   running it will override the setting at its next rebalance, so issue
+ *   <tt>balance off</tt> first to tune by hand.
+ * - <tt>balance on|off</tt>: resume or suspend the elastic scheduler's
+ *   rebalancing (see @ref ElasticScheduler::setEnabled).
+ * - <tt>snapshot &lt;path&gt;</tt>: write a statistics snapshot to @a path
+ *   on demand, whether or not periodic snapshots were requested. The file
+ *   is replaced atomically, like those of @ref Statistics::Monitor.
+ *
+ * Only existing worker threads are throttled or released; nothing here
+ * creates threads or resizes buffers, so every command is safe against a
+ * pipeline in full flight. The server thread holds no locks while a command
+ * runs and each command is a few atomic reads and writes, so a slow or
+ * stuck client cannot stall the pipeline.
+ *
+ * The groups must be registered before @ref start and must outlive the
+ * server. Without local socket support in the build the constructor throws.
+ */
+class ControlServer : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. This creates the listening socket but does not yet serve
+     * commands.
+     *
+     * @param path Filesystem path for the socket.
+     * @throw std::runtime_error if the socket could not be created, or if
+     * the platform has no local socket support.
+     */
+    explicit ControlServer(const std::string &path);
+
+    /// Destructor. Implicitly calls @ref stop and removes the socket.
+    ~ControlServer();
+
+    /**
+     * Register a group for the @c status and @c threads commands.
+     * @pre The server has not been started.
+     */
+    void addGroup(const std::string &name, ElasticGroup &group);
+
+    /**
+     * Attach the scheduler controlled by the @c balance command. May be
+     * NULL (the default), in which case the command reports an error.
+     * @pre The server has not been started.
+     */
+    void setScheduler(ElasticScheduler *scheduler);
+
+    /// Start the serving thread.
+    void start();
+
+    /// Signal the serving thread to shut down and wait for it.
+    void stop();
+
+private:
+    const std::string path;               ///< Socket path, for removal on shutdown
+    int listenFd;                         ///< Listening socket
+    std::vector<std::pair<std::string, ElasticGroup *> > groups; ///< Registered groups
+    ElasticScheduler *scheduler;          ///< Scheduler for @c balance, or NULL
+
+    bool stopping;                        ///< Set by @ref stop to terminate the thread
+    boost::mutex mutex;                   ///< Protects @ref stopping
+    boost::scoped_ptr<boost::thread> thread; ///< The serving thread (NULL when not running)
+
+    /// Thread function: accepts connections and serves their commands
+    void run();
+
+    /// Produce the reply line (without newline) for one command line
+    std::string handleCommand(const std::string &line);
+};
+
+#endif /* !CONTROL_SERVER_H */
@@ -21,7 +21,8 @@
 /**
  * @file
  *
- * OS-specific utilities to remove a file from the OS cache.
+ * OS-specific utilities to remove a file from the OS cache, or to request
+ * that part of one be brought into it.
  */
 
 #if HAVE_CONFIG_H
@@ -75,6 +76,21 @@ void decache(const std::string &filename)
     }
 }
 
+bool fetchaheadSupported()
+{
+    return true;
+}
+
+void fetchahead(const std::string &filename,
+                std::tr1::uint64_t offset, std::tr1::uint64_t length)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return; // just a hint, so do not report errors
+    posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
 #else /* !HAVE_POSIX_FADVISE */
 
 #include <fstream>
@@ -95,4 +111,17 @@ void decache(const std::string &filename)
     }
 }
 
+bool fetchaheadSupported()
+{
+    return false;
+}
+
+void fetchahead(const std::string &filename,
+                std::tr1::uint64_t offset, std::tr1::uint64_t length)
+{
+    (void) filename;
+    (void) offset;
+    (void) length;
+}
+
 #endif
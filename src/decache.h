@@ -21,7 +21,8 @@
 /**
  * @file
  *
- * OS-specific utilities to remove a file from the OS cache.
+ * OS-specific utilities to remove a file from the OS cache, or to request
+ * that part of one be brought into it.
  */
 
 #ifndef DECACHE_H
@@ -31,6 +32,7 @@
 # include <config.h>
 #endif
 #include <string>
+#include "tr1_cstdint.h"
 
 /**
  * Indicates whether this build supports the decaching functionality. If it is
@@ -45,4 +47,21 @@ bool decacheSupported();
  */
 void decache(const std::string &filename);
 
+/**
+ * Indicates whether this build supports readahead hints. If it is not
+ * supported, calling @ref fetchahead is still legal but will be a no-op.
+ */
+bool fetchaheadSupported();
+
+/**
+ * Hint to the OS that a byte range of a file will be read soon, so that it
+ * can start reading it into the filesystem cache in the background.
+ *
+ * This is purely an optimization hint: failures (including a file that
+ * cannot be opened, perhaps because it was removed) are silently ignored,
+ * since the subsequent real read will report any genuine error.
+ */
+void fetchahead(const std::string &filename,
+                std::tr1::uint64_t offset, std::tr1::uint64_t length);
+
 #endif /* !DECACHE_H */
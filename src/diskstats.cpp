@@ -33,10 +33,18 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <algorithm>
 #include <boost/foreach.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
 #include "diskstats.h"
 #include "logging.h"
 #include "statistics.h"
+#include "thread_name.h"
+#include "errors.h"
 
 namespace Diskstats
 {
@@ -80,6 +88,34 @@ void initialize(const std::vector<std::string> &disknames)
     }
 }
 
+std::vector<std::string> autoDetect()
+{
+    std::vector<std::string> ans;
+    try
+    {
+        const boost::filesystem::path base("/sys/block");
+        for (boost::filesystem::directory_iterator i(base), end; i != end; ++i)
+        {
+            const std::string name = i->path().filename().string();
+            // Skip pseudo-devices that do not correspond to real storage
+            if (name.compare(0, 4, "loop") == 0
+                || name.compare(0, 3, "ram") == 0
+                || name.compare(0, 4, "zram") == 0
+                || name.compare(0, 2, "sr") == 0
+                || name.compare(0, 2, "fd") == 0)
+                continue;
+            if (getSectorSize(name) > 0 && !getStats(name).empty())
+                ans.push_back(name);
+        }
+    }
+    catch (boost::filesystem::filesystem_error &e)
+    {
+        // No sysfs: treated the same as finding no devices
+    }
+    std::sort(ans.begin(), ans.end());
+    return ans;
+}
+
 Snapshot snapshot()
 {
     Snapshot ans;
@@ -94,6 +130,11 @@ Snapshot snapshot()
             ans.bytesWritten += sectorSize * fields[6];
             ans.readRequests += fields[0];
             ans.writeRequests += fields[4];
+            if (fields.size() > 9)
+            {
+                ans.inFlight += fields[8];
+                ans.ioTicks += fields[9];
+            }
         }
     }
     return ans;
@@ -106,6 +147,8 @@ Snapshot operator-(const Snapshot &a, const Snapshot &b)
     ans.bytesWritten = a.bytesWritten - b.bytesWritten;
     ans.readRequests = a.readRequests - b.readRequests;
     ans.writeRequests = a.writeRequests - b.writeRequests;
+    ans.inFlight = a.inFlight; // instantaneous, not cumulative
+    ans.ioTicks = a.ioTicks - b.ioTicks;
     return ans;
 }
 
@@ -116,6 +159,143 @@ void saveStatistics(const Snapshot &snap, const std::string &prefix)
     registry.getStatistic<Statistics::Variable>(prefix + ".bytesWritten").add(snap.bytesWritten);
     registry.getStatistic<Statistics::Variable>(prefix + ".readRequests").add(snap.readRequests);
     registry.getStatistic<Statistics::Variable>(prefix + ".writeRequests").add(snap.writeRequests);
+    registry.getStatistic<Statistics::Variable>(prefix + ".ioTicks").add(snap.ioTicks);
+}
+
+namespace
+{
+
+/**
+ * Recommendations published by the @ref Governor. They default to being
+ * permissive so that consumers can query them whether or not a governor is
+ * running.
+ */
+struct Recommend
+{
+    boost::mutex mutex;
+    unsigned int depth;     ///< Write depth bound (0 means unlimited)
+    bool readAhead;         ///< Whether readahead hints are advisable
+
+    Recommend() : depth(0), readAhead(true) {}
+};
+
+Recommend &recommend()
+{
+    static Recommend instance;
+    return instance;
+}
+
+/// Utilization above which the devices are considered saturated
+const double utilHigh = 0.95;
+/// Utilization below which there is idle capacity worth using
+const double utilLow = 0.7;
+/// Write depth to start from when a governor begins adjusting
+const unsigned int depthStart = 8;
+/// Upper bound on the adjusted write depth
+const unsigned int depthMax = 256;
+
+} // anonymous namespace
+
+unsigned int writeDepth(unsigned int maxDepth)
+{
+    Recommend &r = recommend();
+    boost::lock_guard<boost::mutex> lock(r.mutex);
+    if (r.depth == 0)
+        return maxDepth;
+    return std::min(std::max(r.depth, 1U), maxDepth);
+}
+
+bool readAheadAdvisable()
+{
+    Recommend &r = recommend();
+    boost::lock_guard<boost::mutex> lock(r.mutex);
+    return r.readAhead;
+}
+
+Governor::Governor(double interval)
+    : interval(interval), stopping(false)
+{
+    MLSGPU_ASSERT(interval > 0.0, std::invalid_argument);
+    if (disknames.empty())
+        initialize(autoDetect());
+    thread = boost::thread(boost::bind(&Governor::run, this));
+}
+
+Governor::~Governor()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = true;
+    }
+    stopCondition.notify_one();
+    thread.join();
+
+    // Restore the permissive defaults for any later unguarded I/O
+    Recommend &r = recommend();
+    boost::lock_guard<boost::mutex> lock(r.mutex);
+    r.depth = 0;
+    r.readAhead = true;
+}
+
+void Governor::run()
+{
+    thread_set_name("iogovernor");
+    if (disknames.empty())
+        return; // nothing to sample; leave the recommendations permissive
+
+    Statistics::Variable &depthStat =
+        Statistics::getStatistic<Statistics::Variable>("disk.governor.depth");
+    Statistics::Variable &utilStat =
+        Statistics::getStatistic<Statistics::Variable>("disk.governor.util");
+
+    const boost::posix_time::time_duration sleepTime =
+        boost::posix_time::milliseconds(long(interval * 1000.0));
+
+    unsigned int depth = depthStart;
+    Snapshot prev = snapshot();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!stopping)
+    {
+        stopCondition.timed_wait(lock, sleepTime);
+        if (stopping)
+            break;
+        lock.unlock();
+
+        const Snapshot cur = snapshot();
+        const Snapshot delta = cur - prev;
+        prev = cur;
+        /* Fraction of the interval during which at least one device had I/O
+         * in progress. With several devices this is an average, so a single
+         * saturated device in a mostly-idle array reads as moderate
+         * utilization and only throttles once it dominates.
+         */
+        const double util = double(delta.ioTicks)
+            / (interval * 1000.0 * disknames.size());
+
+        bool readAhead = true;
+        if (util >= utilHigh && delta.inFlight > (long long) depth)
+        {
+            /* The devices are saturated with a deeper queue than we are
+             * contributing: multiplicative backoff, and stop adding
+             * readahead pressure of our own.
+             */
+            depth = std::max(depth / 2, 1U);
+            readAhead = false;
+        }
+        else if (util <= utilLow)
+            depth = std::min(depth + 1, depthMax);
+
+        {
+            Recommend &r = recommend();
+            boost::lock_guard<boost::mutex> rlock(r.mutex);
+            r.depth = depth;
+            r.readAhead = readAhead;
+        }
+        depthStat.add(depth);
+        utilStat.add(util);
+
+        lock.lock();
+    }
 }
 
 } // namespace Diskstats
@@ -27,8 +27,15 @@
 #ifndef DISKSTATS_H
 #define DISKSTATS_H
 
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
 #include <vector>
 #include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 namespace Diskstats
 {
@@ -39,16 +46,93 @@ struct Snapshot
     long long bytesWritten;
     long long readRequests;
     long long writeRequests;
+    /**
+     * Requests in flight at the moment of the snapshot. Unlike the other
+     * fields this is instantaneous rather than cumulative, so @ref
+     * operator- passes through the newer value instead of subtracting.
+     */
+    long long inFlight;
+    /// Cumulative milliseconds during which the devices had I/O in progress
+    long long ioTicks;
 };
 
 void initialize(const std::vector<std::string> &disknames);
 
+/**
+ * Enumerate the block devices of the machine, excluding pseudo-devices
+ * (loopback, ramdisks and the like). Returns an empty list on platforms
+ * without sysfs.
+ */
+std::vector<std::string> autoDetect();
+
 Snapshot snapshot();
 
 Snapshot operator -(const Snapshot &a, const Snapshot &b);
 
 void saveStatistics(const Snapshot &snap, const std::string &prefix);
 
+/**
+ * Background thread that closes the loop from the sampled block-device
+ * counters to the I/O issued by this process. Every interval it computes
+ * the device utilization and queue depth over the last interval and adjusts
+ * two published recommendations:
+ *
+ * - @ref writeDepth, consulted by @ref AsyncWriter to bound the number of
+ *   asynchronous writes in flight;
+ * - @ref readAheadAdvisable, consulted before issuing readahead hints (see
+ *   @ref BucketCollector::setPrefetch).
+ *
+ * The depth ramps up additively while the devices have idle capacity and
+ * halves when they saturate with a deeper queue than this process is
+ * allowed, so a single configuration behaves sensibly on hardware ranging
+ * from idle NVMe arrays to shared spinning disks. Without a running
+ * governor the recommendations are permissive (full depth, readahead on),
+ * so consumers may query them unconditionally.
+ *
+ * The thread is started by the constructor and stopped by the destructor.
+ * If @ref initialize was not called, the devices from @ref autoDetect are
+ * used; if no devices can be found the governor leaves the recommendations
+ * permissive.
+ */
+class Governor : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. This starts the background thread.
+     *
+     * @param interval   Time between samples, in seconds.
+     * @pre @a interval &gt; 0.
+     */
+    explicit Governor(double interval);
+
+    /// Destructor. Signals the thread to shut down and waits for it.
+    ~Governor();
+
+private:
+    const double interval;        ///< Seconds between samples
+
+    bool stopping;                ///< Set by the destructor to terminate the thread
+    boost::mutex mutex;           ///< Protects @ref stopping
+    boost::condition_variable stopCondition;  ///< Signalled when @ref stopping is set
+    boost::thread thread;         ///< The background thread
+
+    /// Thread function: samples and adjusts every @ref interval seconds
+    void run();
+};
+
+/**
+ * Recommended bound on asynchronous writes in flight, clamped to
+ * [1, @a maxDepth]. Returns @a maxDepth when no @ref Governor is running.
+ */
+unsigned int writeDepth(unsigned int maxDepth);
+
+/**
+ * Whether issuing readahead hints is currently advisable. Readahead adds
+ * queue pressure, so it is withdrawn while a device is saturated. Returns
+ * true when no @ref Governor is running.
+ */
+bool readAheadAdvisable();
+
 } // namespace Diskstats
 
 #endif /* DISKSTATS_H */
@@ -37,6 +37,7 @@
 #include <string>
 #include <iterator>
 #include <sstream>
+#include <iomanip>
 #include <istream>
 #include <cstdlib>
 #include "tr1_cstdint.h"
@@ -47,17 +48,25 @@
 #include <cerrno>
 #include <memory>
 #include <locale>
+#include <vector>
+#include <boost/smart_ptr/scoped_array.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/system/error_code.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/foreach.hpp>
 #include <boost/exception/all.hpp>
 #include <boost/bind.hpp>
 #include <boost/iostreams/stream.hpp>
+#include <boost/thread/once.hpp>
 #include "fast_ply.h"
 #include "splat.h"
 #include "errors.h"
 #include "binary_io.h"
+#include "keyvalue_cache.h"
+#include "statistics.h"
+#include "misc.h"
 
 namespace FastPly
 {
@@ -190,6 +199,9 @@ void Reader::readHeader(std::istream &in)
         vertexSize = 0;
         size_type elements = 0;
         bool haveProperty[numProperties] = {};
+        std::fill(fieldIsDouble, fieldIsDouble + numProperties, false);
+        ascii = false;
+        asciiTokens = 0;
 
         std::string line = getHeaderLine(in);
         if (line != "ply")
@@ -213,7 +225,7 @@ void Reader::readHeader(std::istream &in)
                     throw boost::enable_error_info(FormatError("Malformed format line"));
 
                 if (tokens[1] == "ascii")
-                    throw boost::enable_error_info(FormatError("PLY ASCII format not supported"));
+                    ascii = true;
                 else if (tokens[1] == "binary_big_endian")
                 {
                     if (!cpuBigEndian())
@@ -300,14 +312,17 @@ void Reader::readHeader(std::istream &in)
                         {
                             if (haveProperty[i])
                                 throw boost::enable_error_info(FormatError("Duplicate property " + name));
-                            if (valueType != FLOAT32)
-                                throw boost::enable_error_info(FormatError("Property " + name + " must be FLOAT32"));
+                            if (valueType != FLOAT32 && valueType != FLOAT64)
+                                throw boost::enable_error_info(FormatError("Property " + name + " must be FLOAT32 or FLOAT64"));
                             haveProperty[i] = true;
                             offsets[i] = vertexSize;
+                            fieldIsDouble[i] = (valueType == FLOAT64);
+                            asciiIndex[i] = asciiTokens;
                             break;
                         }
                     }
                     vertexSize += fieldSize(valueType);
+                    asciiTokens++;
                 }
             }
         }
@@ -322,6 +337,11 @@ void Reader::readHeader(std::istream &in)
             if (!haveProperty[i])
                 throw boost::enable_error_info(FormatError(std::string("Property ") + propertyNames[i] + " not found"));
 
+        denseLayout = (vertexSize == numProperties * sizeof(float));
+        for (unsigned int i = 0; i < numProperties; i++)
+            if (fieldIsDouble[i] || offsets[i] != i * sizeof(float))
+                denseLayout = false;
+
         headerSize = in.tellg();
     }
     catch (boost::exception &e)
@@ -331,52 +351,630 @@ void Reader::readHeader(std::istream &in)
     }
 }
 
+/**
+ * Load a single vertex field, converting from FLOAT64 to @c float if
+ * necessary.
+ */
+static inline float loadField(const char *buffer, Reader::size_type offset, bool isDouble)
+{
+    if (isDouble)
+    {
+        double v;
+        std::memcpy(&v, buffer + offset, sizeof(double));
+        return float(v);
+    }
+    else
+    {
+        float v;
+        std::memcpy(&v, buffer + offset, sizeof(float));
+        return v;
+    }
+}
+
+/**
+ * Load a single vertex field at full precision. Position fields go through
+ * this so that the decode offset can be subtracted before narrowing to
+ * @c float (see @ref Reader::setOffset).
+ */
+static inline double loadFieldRaw(const char *buffer, Reader::size_type offset, bool isDouble)
+{
+    if (isDouble)
+    {
+        double v;
+        std::memcpy(&v, buffer + offset, sizeof(double));
+        return v;
+    }
+    else
+    {
+        float v;
+        std::memcpy(&v, buffer + offset, sizeof(float));
+        return v;
+    }
+}
+
+void Reader::setOffset(const double offset[3])
+{
+    std::copy(offset, offset + 3, this->offset);
+    hasOffset = offset[0] != 0.0 || offset[1] != 0.0 || offset[2] != 0.0;
+}
+
 Splat Reader::decode(const char *buffer, std::size_t offset) const
 {
     buffer += offset * getVertexSize();
 
     Splat ans;
-    std::memcpy(&ans.position[0], buffer + offsets[X], sizeof(float));
-    std::memcpy(&ans.position[1], buffer + offsets[Y], sizeof(float));
-    std::memcpy(&ans.position[2], buffer + offsets[Z], sizeof(float));
-    std::memcpy(&ans.radius,      buffer + offsets[RADIUS], sizeof(float));
-    std::memcpy(&ans.normal[0],   buffer + offsets[NX], sizeof(float));
-    std::memcpy(&ans.normal[1],   buffer + offsets[NY], sizeof(float));
-    std::memcpy(&ans.normal[2],   buffer + offsets[NZ], sizeof(float));
+    ans.position[0] = float(loadFieldRaw(buffer, offsets[X], fieldIsDouble[X]) - this->offset[0]);
+    ans.position[1] = float(loadFieldRaw(buffer, offsets[Y], fieldIsDouble[Y]) - this->offset[1]);
+    ans.position[2] = float(loadFieldRaw(buffer, offsets[Z], fieldIsDouble[Z]) - this->offset[2]);
+    ans.radius      = loadField(buffer, offsets[RADIUS], fieldIsDouble[RADIUS]);
+    ans.normal[0]   = loadField(buffer, offsets[NX], fieldIsDouble[NX]);
+    ans.normal[1]   = loadField(buffer, offsets[NY], fieldIsDouble[NY]);
+    ans.normal[2]   = loadField(buffer, offsets[NZ], fieldIsDouble[NZ]);
     ans.radius = std::min(ans.radius, maxRadius);
     ans.radius *= smooth;
     ans.quality = 1.0 / (ans.radius * ans.radius);
     return ans;
 }
 
+void Reader::decodeBatch(const char *buffer, std::size_t offset, std::size_t count, Splat *out) const
+{
+    const size_type vertexSize = getVertexSize();
+    buffer += offset * vertexSize;
+    if (denseLayout && !hasOffset)
+    {
+        /* The field offsets are compile-time constants here, so the loop is
+         * branch-free and the compiler is able to unroll and vectorize it.
+         */
+        for (std::size_t i = 0; i < count; i++, buffer += numProperties * sizeof(float))
+        {
+            float v[numProperties];
+            std::memcpy(v, buffer, sizeof(v));
+            Splat &ans = out[i];
+            ans.position[0] = v[0];
+            ans.position[1] = v[1];
+            ans.position[2] = v[2];
+            ans.normal[0] = v[3];
+            ans.normal[1] = v[4];
+            ans.normal[2] = v[5];
+            ans.radius = std::min(v[6], maxRadius) * smooth;
+            ans.quality = 1.0 / (ans.radius * ans.radius);
+        }
+    }
+    else if (denseLayout)
+    {
+        for (std::size_t i = 0; i < count; i++, buffer += numProperties * sizeof(float))
+        {
+            float v[numProperties];
+            std::memcpy(v, buffer, sizeof(v));
+            Splat &ans = out[i];
+            ans.position[0] = float(v[0] - this->offset[0]);
+            ans.position[1] = float(v[1] - this->offset[1]);
+            ans.position[2] = float(v[2] - this->offset[2]);
+            ans.normal[0] = v[3];
+            ans.normal[1] = v[4];
+            ans.normal[2] = v[5];
+            ans.radius = std::min(v[6], maxRadius) * smooth;
+            ans.quality = 1.0 / (ans.radius * ans.radius);
+        }
+    }
+    else
+    {
+        for (std::size_t i = 0; i < count; i++, buffer += vertexSize)
+        {
+            Splat &ans = out[i];
+            ans.position[0] = float(loadFieldRaw(buffer, offsets[X], fieldIsDouble[X]) - this->offset[0]);
+            ans.position[1] = float(loadFieldRaw(buffer, offsets[Y], fieldIsDouble[Y]) - this->offset[1]);
+            ans.position[2] = float(loadFieldRaw(buffer, offsets[Z], fieldIsDouble[Z]) - this->offset[2]);
+            ans.radius      = loadField(buffer, offsets[RADIUS], fieldIsDouble[RADIUS]);
+            ans.normal[0]   = loadField(buffer, offsets[NX], fieldIsDouble[NX]);
+            ans.normal[1]   = loadField(buffer, offsets[NY], fieldIsDouble[NY]);
+            ans.normal[2]   = loadField(buffer, offsets[NZ], fieldIsDouble[NZ]);
+            ans.radius = std::min(ans.radius, maxRadius);
+            ans.radius *= smooth;
+            ans.quality = 1.0 / (ans.radius * ans.radius);
+        }
+    }
+}
+
+namespace
+{
+
+static KeyValueCache *headerCacheInstance = NULL;
+static boost::once_flag headerCacheOnce = BOOST_ONCE_INIT;
+
+static void makeHeaderCache()
+{
+    boost::filesystem::path path;
+    const char *env = getenv("MLSGPU_HEADER_CACHE");
+    if (env != NULL && env[0])
+        path = env;
+    else
+    {
+        const char *home = getenv("HOME");
+        if (home != NULL && home[0])
+            path = boost::filesystem::path(home) / ".mlsgpu-headers";
+        else
+            path = ".mlsgpu-headers";
+    }
+    headerCacheInstance = new KeyValueCache(path);
+}
+
+/**
+ * Persistent cache of parsed PLY headers. The backing file is taken from the
+ * @c MLSGPU_HEADER_CACHE environment variable if set, otherwise
+ * <tt>.mlsgpu-headers</tt> in the user's home directory. Initialization is
+ * thread-safe because readers are constructed in parallel at startup.
+ */
+static KeyValueCache &headerCache()
+{
+    boost::call_once(headerCacheOnce, makeHeaderCache);
+    return *headerCacheInstance;
+}
+
+/**
+ * Identity of the file at @a path for header-cache purposes, combining its
+ * size and modification time. Returns an empty string if the file cannot be
+ * examined, in which case the cache must be bypassed.
+ */
+static std::string headerIdentity(const boost::filesystem::path &path)
+{
+    try
+    {
+        std::ostringstream id;
+        id << "ply-header:" << boost::filesystem::file_size(path)
+            << ':' << boost::filesystem::last_write_time(path);
+        return id.str();
+    }
+    catch (boost::filesystem::filesystem_error &e)
+    {
+        return std::string();
+    }
+}
+
+} // anonymous namespace
+
+std::string Reader::encodeHeader() const
+{
+    std::ostringstream value;
+    value << "1:" << headerSize << ':' << vertexSize << ':' << vertexCount;
+    for (unsigned int i = 0; i < numProperties; i++)
+        value << ':' << offsets[i] << ':' << int(fieldIsDouble[i]);
+    value << ':' << int(denseLayout);
+    return value.str();
+}
+
+bool Reader::decodeHeader(const std::string &value)
+{
+    std::istringstream in(value);
+    char sep;
+    int version;
+    if (!(in >> version >> sep >> headerSize >> sep >> vertexSize >> sep >> vertexCount)
+        || version != 1)
+        return false;
+    for (unsigned int i = 0; i < numProperties; i++)
+    {
+        int isDouble;
+        if (!(in >> sep >> offsets[i] >> sep >> isDouble))
+            return false;
+        fieldIsDouble[i] = isDouble;
+        if (offsets[i] + (fieldIsDouble[i] ? sizeof(double) : sizeof(float)) > vertexSize)
+            return false;
+    }
+    int dense;
+    if (!(in >> sep >> dense))
+        return false;
+    denseLayout = dense;
+    return vertexSize > 0;
+}
+
 Reader::Reader(
     ReaderType readerType,
     const boost::filesystem::path &path,
     float smooth, float maxRadius)
-    : readerFactory(boost::bind(createReader, readerType)), path(path), smooth(smooth), maxRadius(maxRadius)
+    : readerFactory(boost::bind(createReader, readerType)), path(path), smooth(smooth), maxRadius(maxRadius),
+    hasOffset(false), dataPath(path), removeDataPath(false)
 {
+    std::fill(offset, offset + 3, 0.0);
+    /* A hit in the header cache avoids opening the file entirely, which is
+     * the dominant startup cost with many small files on networked storage.
+     * The identity check makes a stale entry harmless, and Handle re-checks
+     * the file size against the header when the data is first opened.
+     * ASCII files are never stored in the cache, so a hit always describes a
+     * binary file that needs no conversion.
+     */
+    const std::string identity = headerIdentity(path);
+    std::string cached;
+    if (!identity.empty() && headerCache().lookup(path.string(), identity, cached)
+        && decodeHeader(cached))
+    {
+        Statistics::getStatistic<Statistics::Counter>("files.headers.hits").add();
+        return;
+    }
+
     boost::scoped_ptr<BinaryReader> reader(readerFactory());
     reader->open(path);
     boost::iostreams::stream<BinaryReaderSource> in(*reader);
     readHeader(in);
+    if (ascii)
+        convertAscii(*reader);
+    else if (!identity.empty())
+    {
+        headerCache().update(path.string(), identity, encodeHeader());
+        Statistics::getStatistic<Statistics::Counter>("files.headers.misses").add();
+    }
 }
 
 Reader::Reader(
     boost::function<BinaryReader *()> readerFactory,
     const boost::filesystem::path &path,
     float smooth, float maxRadius)
-    : readerFactory(readerFactory), path(path), smooth(smooth), maxRadius(maxRadius)
+    : readerFactory(readerFactory), path(path), smooth(smooth), maxRadius(maxRadius),
+    hasOffset(false), dataPath(path), removeDataPath(false)
 {
+    std::fill(offset, offset + 3, 0.0);
     boost::scoped_ptr<BinaryReader> reader(readerFactory());
     reader->open(path);
     boost::iostreams::stream<BinaryReaderSource> in(*reader);
     readHeader(in);
+    if (ascii)
+        convertAscii(*reader);
+}
+
+Reader::~Reader()
+{
+    if (removeDataPath)
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(dataPath, ec); // best effort; ignore errors
+    }
+}
+
+/**
+ * Parse a decimal floating-point token in [@a start, @a end). The fast path
+ * accumulates the mantissa in an integer and scales by a power of ten, which
+ * is far cheaper than @c strtod and accurate to well under a @c float ULP;
+ * anything it cannot handle (infinities, NaNs, oversized exponents) falls
+ * back to @c strtod.
+ *
+ * @retval @c true if the whole token was consumed and @a out was set.
+ * @retval @c false if the token is not a number.
+ */
+static bool parseAsciiFloat(const char *start, const char *end, float &out)
+{
+    // Exactly representable powers of ten for scaling the mantissa
+    static const double pow10Table[23] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *p = start;
+    bool negative = false;
+    if (p != end && (*p == '+' || *p == '-'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+
+    std::tr1::uint64_t mantissa = 0;
+    int digits = 0;    // mantissa digits accumulated
+    int exp10 = 0;     // power of ten to apply to the mantissa
+    bool any = false;
+    while (p != end && *p >= '0' && *p <= '9')
+    {
+        any = true;
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0)
+                digits++;
+        }
+        else
+            exp10++; // excess precision: drop the digit, keep the magnitude
+        p++;
+    }
+    if (p != end && *p == '.')
+    {
+        p++;
+        while (p != end && *p >= '0' && *p <= '9')
+        {
+            any = true;
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0)
+                    digits++;
+                exp10--;
+            }
+            p++;
+        }
+    }
+    if (any && p != end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        bool expNegative = false;
+        if (p != end && (*p == '+' || *p == '-'))
+        {
+            expNegative = (*p == '-');
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9')
+            any = false;
+        int e = 0;
+        while (p != end && *p >= '0' && *p <= '9')
+        {
+            if (e < 10000)
+                e = e * 10 + (*p - '0');
+            p++;
+        }
+        exp10 += expNegative ? -e : e;
+    }
+
+    if (any && p == end && exp10 >= -22 && exp10 <= 22)
+    {
+        double value = double(mantissa);
+        if (exp10 >= 0)
+            value *= pow10Table[exp10];
+        else
+            value /= pow10Table[-exp10];
+        out = float(negative ? -value : value);
+        return true;
+    }
+
+    /* Fallback for inf/nan, huge exponents and anything else unusual */
+    const std::string token(start, end);
+    char *tail = NULL;
+    double value = std::strtod(token.c_str(), &tail);
+    if (tail != token.c_str() + token.size() || token.empty())
+        return false;
+    out = float(value);
+    return true;
+}
+
+/**
+ * Parse one ASCII vertex line into packed fields.
+ *
+ * @param p,end      The line, excluding the terminating newline.
+ * @param numTokens  Expected number of tokens on the line.
+ * @param slotOf     For each token, the output field to fill, or -1 to skip.
+ * @param out        Output fields.
+ * @retval @c true if the line parsed cleanly.
+ * @retval @c false if a token is malformed or the token count is wrong.
+ */
+static bool parseAsciiLine(const char *p, const char *end,
+                           unsigned int numTokens, const int *slotOf, float *out)
+{
+    for (unsigned int t = 0; t < numTokens; t++)
+    {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+        const char *tokenStart = p;
+        while (p != end && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+        if (p == tokenStart)
+            return false; // too few tokens
+        const int slot = slotOf[t];
+        if (slot >= 0 && !parseAsciiFloat(tokenStart, p, out[slot]))
+            return false;
+    }
+    while (p != end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p == end;
+}
+
+/**
+ * Name of the converted copy of an ASCII file within the cache directory.
+ * The source identity is part of the hashed key, so a change to the source
+ * simply misses the cache rather than matching a stale copy.
+ */
+static std::string asciiCacheName(const std::string &key)
+{
+    // FNV-1a
+    std::tr1::uint64_t h = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < key.size(); i++)
+    {
+        h ^= (unsigned char) key[i];
+        h *= 1099511628211ULL;
+    }
+    std::ostringstream name;
+    name << "ascii-" << std::hex << h << ".bin";
+    return name.str();
+}
+
+void Reader::convertAsciiData(BinaryReader &src, std::ostream &out)
+{
+    const std::size_t chunkSize = 4 * 1024 * 1024;
+    const size_type fileSize = src.size();
+
+    /* Map each token on a vertex line to the field it populates */
+    std::vector<int> slotOf(asciiTokens, -1);
+    for (unsigned int i = 0; i < numProperties; i++)
+        slotOf[asciiIndex[i]] = i;
+
+    std::vector<char> text;      // carried partial line plus the current chunk
+    std::vector<std::pair<std::size_t, std::size_t> > lines;
+    std::vector<float> fields;
+    size_type offset = headerSize;
+    size_type done = 0;
+    while (done < vertexCount)
+    {
+        const std::size_t carry = text.size();
+        const std::size_t wanted = offset < fileSize ?
+            std::size_t(std::min<size_type>(chunkSize, fileSize - offset)) : 0;
+        text.resize(carry + wanted);
+        const std::size_t bytes = wanted ? src.read(&text[carry], wanted, offset) : 0;
+        offset += bytes;
+        text.resize(carry + bytes);
+        const bool atEof = (bytes == 0 || offset >= fileSize);
+        if (bytes == 0 && text.empty())
+            throw boost::enable_error_info(FormatError("End of file before all vertices were read"))
+                << boost::errinfo_file_name(path.string());
+
+        /* Parse up to the last complete line; at EOF an unterminated final
+         * line counts as complete.
+         */
+        std::size_t bodyEnd = text.size();
+        if (!atEof)
+        {
+            while (bodyEnd > 0 && text[bodyEnd - 1] != '\n')
+                bodyEnd--;
+            if (bodyEnd == 0)
+                continue; // no complete line yet; read more
+        }
+
+        lines.clear();
+        std::size_t lineStart = 0;
+        for (std::size_t i = 0; i < bodyEnd && done + lines.size() < vertexCount; i++)
+        {
+            if (text[i] == '\n')
+            {
+                if (i > lineStart) // ignore blank lines
+                    lines.push_back(std::make_pair(lineStart, i));
+                lineStart = i + 1;
+            }
+        }
+        if (atEof && lineStart < bodyEnd && done + lines.size() < vertexCount)
+            lines.push_back(std::make_pair(lineStart, bodyEnd));
+
+        const std::size_t numLines = lines.size();
+        fields.resize(numLines * numProperties);
+        const char *textPtr = text.empty() ? NULL : &text[0];
+        const std::pair<std::size_t, std::size_t> *linePtr = numLines ? &lines[0] : NULL;
+        float *fieldPtr = fields.empty() ? NULL : &fields[0];
+        const int *slotPtr = &slotOf[0];
+        const unsigned int numTokens = asciiTokens;
+        bool bad = false;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if (numLines > 4096) reduction(||:bad) shared(numLines, textPtr, linePtr, fieldPtr, slotPtr, numTokens) default(none)
+#endif
+        for (std::size_t i = 0; i < numLines; i++)
+        {
+            bad = bad || !parseAsciiLine(textPtr + linePtr[i].first, textPtr + linePtr[i].second,
+                                         numTokens, slotPtr, fieldPtr + i * numProperties);
+        }
+        if (bad)
+        {
+            /* Rare path: rescan serially for a useful message */
+            for (std::size_t i = 0; i < numLines; i++)
+            {
+                float dummy[numProperties];
+                if (!parseAsciiLine(textPtr + lines[i].first, textPtr + lines[i].second,
+                                    numTokens, slotPtr, dummy))
+                {
+                    std::ostringstream msg;
+                    msg << "Malformed vertex " << done + i + 1 << " in ASCII PLY file";
+                    throw boost::enable_error_info(FormatError(msg.str()))
+                        << boost::errinfo_file_name(path.string());
+                }
+            }
+        }
+
+        if (numLines > 0)
+            out.write(reinterpret_cast<const char *>(fieldPtr),
+                      std::streamsize(numLines * numProperties * sizeof(float)));
+        if (!out)
+            throw boost::enable_error_info(std::ios::failure("Could not write converted ASCII data"));
+        done += numLines;
+
+        if (atEof && done < vertexCount)
+            throw boost::enable_error_info(FormatError("End of file before all vertices were read"))
+                << boost::errinfo_file_name(path.string());
+        text.erase(text.begin(), text.begin() + bodyEnd);
+    }
+}
+
+void Reader::convertAscii(BinaryReader &src)
+{
+    Statistics::Timer timer("files.ascii.time");
+
+    /* Reuse a previous conversion if a cache directory is configured and the
+     * source file is unchanged. The converted copy holds raw vertex records
+     * with no header, so smoothing options (applied at decode time) do not
+     * invalidate it.
+     */
+    boost::filesystem::path outPath;
+    bool persistent = false;
+    const char *cacheDir = getenv("MLSGPU_ASCII_CACHE");
+    const std::string identity = headerIdentity(path);
+    if (cacheDir != NULL && cacheDir[0] && !identity.empty())
+    {
+        outPath = boost::filesystem::path(cacheDir)
+            / asciiCacheName(path.string() + ':' + identity);
+        try
+        {
+            if (boost::filesystem::file_size(outPath) == vertexCount * (numProperties * sizeof(float)))
+            {
+                Statistics::getStatistic<Statistics::Counter>("files.ascii.reuse").add();
+                persistent = true;
+            }
+        }
+        catch (boost::filesystem::filesystem_error &e)
+        {
+            // No usable copy; convert below
+        }
+    }
+
+    if (!persistent && !outPath.empty())
+    {
+        /* Write-then-rename so that concurrent processes and interrupted
+         * runs never see a partial copy.
+         */
+        try
+        {
+            const boost::filesystem::path tmpPath
+                = outPath.string() + boost::filesystem::unique_path(".%%%%-%%%%").string();
+            boost::filesystem::ofstream out(tmpPath, std::ios::binary);
+            if (!out)
+                throw boost::enable_error_info(std::ios::failure("Could not open cache file"))
+                    << boost::errinfo_file_name(tmpPath.string());
+            convertAsciiData(src, out);
+            out.close();
+            boost::filesystem::rename(tmpPath, outPath);
+            Statistics::getStatistic<Statistics::Counter>("files.ascii.convert").add();
+            persistent = true;
+        }
+        catch (boost::filesystem::filesystem_error &e)
+        {
+            outPath.clear(); // cache not writable; fall back to a temporary file
+        }
+        catch (std::ios::failure &e)
+        {
+            outPath.clear(); // cache not writable; fall back to a temporary file
+        }
+    }
+
+    if (!persistent)
+    {
+        boost::filesystem::ofstream out;
+        createTmpFile(outPath, out);
+        convertAsciiData(src, out);
+        out.close();
+        if (!out)
+            throw boost::enable_error_info(std::ios::failure("Could not write converted ASCII data"))
+                << boost::errinfo_file_name(outPath.string());
+        Statistics::getStatistic<Statistics::Counter>("files.ascii.convert").add();
+    }
+
+    /* All further access goes through the converted copy, which is a plain
+     * uncompressed file regardless of the source file's reader type.
+     */
+    dataPath = outPath;
+    removeDataPath = !persistent;
+    readerFactory = boost::bind(createReader, SYSCALL_READER);
+    headerSize = 0;
+    vertexSize = numProperties * sizeof(float);
+    for (unsigned int i = 0; i < numProperties; i++)
+    {
+        offsets[i] = i * sizeof(float);
+        fieldIsDouble[i] = false;
+    }
+    denseLayout = true;
 }
 
 Reader::Handle::Handle(const Reader &owner)
     : owner(owner), reader(owner.readerFactory())
 {
-    reader->open(owner.path);
+    reader->open(owner.dataPath);
     if ((reader->size() - owner.getHeaderSize()) / owner.getVertexSize() < owner.size())
         throw boost::enable_error_info(std::ios::failure("File is too small to contain all its vertices"))
             << boost::errinfo_file_name(owner.path.string());
@@ -390,6 +988,64 @@ void Reader::Handle::readRaw(size_type first, size_type last, char *buffer) cons
     reader->read(buffer, (last - first) * vertexSize, owner.getHeaderSize() + first * vertexSize);
 }
 
+void Reader::Handle::readRawBatch(const size_type *firsts, const size_type *lasts,
+                                  std::size_t numRanges, char *buffer) const
+{
+    MLSGPU_ASSERT(numRanges > 0, std::invalid_argument);
+    MLSGPU_ASSERT(buffer != NULL, std::invalid_argument);
+    if (numRanges == 1)
+    {
+        readRaw(firsts[0], lasts[0], buffer);
+        return;
+    }
+
+    const std::size_t vertexSize = owner.getVertexSize();
+    /* One slice per range plus one per gap. The gap slices all point at the
+     * same sink, whose contents are discarded (overlapping destinations are
+     * explicitly permitted by readv).
+     */
+    std::vector<BinaryReader::Slice> slices;
+    slices.reserve(2 * numRanges - 1);
+    size_type maxGap = 0;
+    for (std::size_t i = 0; i + 1 < numRanges; i++)
+    {
+        MLSGPU_ASSERT(firsts[i] <= lasts[i] && lasts[i] <= firsts[i + 1], std::invalid_argument);
+        maxGap = std::max(maxGap, firsts[i + 1] - lasts[i]);
+    }
+    MLSGPU_ASSERT(firsts[numRanges - 1] <= lasts[numRanges - 1], std::invalid_argument);
+    boost::scoped_array<char> sink(maxGap > 0 ? new char[maxGap * vertexSize] : NULL);
+
+    char *out = buffer;
+    for (std::size_t i = 0; i < numRanges; i++)
+    {
+        if (i > 0 && firsts[i] > lasts[i - 1])
+        {
+            BinaryReader::Slice gap;
+            gap.data = sink.get();
+            gap.size = (firsts[i] - lasts[i - 1]) * vertexSize;
+            slices.push_back(gap);
+        }
+        BinaryReader::Slice payload;
+        payload.data = out;
+        payload.size = (lasts[i] - firsts[i]) * vertexSize;
+        out += payload.size;
+        if (payload.size > 0)
+            slices.push_back(payload);
+    }
+    reader->readv(&slices[0], slices.size(),
+                  owner.getHeaderSize() + firsts[0] * vertexSize);
+}
+
+const char *Reader::Handle::dataRaw(size_type first, size_type last) const
+{
+    MLSGPU_ASSERT(first <= last && last <= owner.size(), std::out_of_range);
+    (void) last;
+    const char *base = reader->data();
+    if (base == NULL)
+        return NULL;
+    return base + owner.getHeaderSize() + first * owner.getVertexSize();
+}
+
 
 bool Writer::isOpen() const
 {
@@ -414,11 +1070,18 @@ void Writer::setNumTriangles(size_type numTriangles)
     this->numTriangles = numTriangles;
 }
 
+void Writer::setNormals(bool normals)
+{
+    MLSGPU_ASSERT(!isOpen(), state_error);
+    this->normals = normals;
+}
+
 Writer::Writer(WriterType writerType) :
     writeVerticesTime(Statistics::getStatistic<Statistics::Variable>("writer.writeVertices.time")),
     writeTrianglesTime(Statistics::getStatistic<Statistics::Variable>("writer.writeTriangles.time")),
     handleFactory(InternalFactory(writerType)),
-    comments(), numVertices(0), numTriangles(0)
+    comments(), numVertices(0), numTriangles(0), normals(false),
+    deferredCounts(false)
 {
 }
 
@@ -426,7 +1089,8 @@ Writer::Writer(boost::function<boost::shared_ptr<BinaryWriter>()> handleFactory)
     writeVerticesTime(Statistics::getStatistic<Statistics::Variable>("writer.writeVertices.time")),
     writeTrianglesTime(Statistics::getStatistic<Statistics::Variable>("writer.writeTriangles.time")),
     handleFactory(handleFactory),
-    comments(), numVertices(0), numTriangles(0)
+    comments(), numVertices(0), numTriangles(0), normals(false),
+    deferredCounts(false)
 {
 }
 
@@ -440,6 +1104,9 @@ Writer::size_type Writer::getNumTriangles() const
     return numTriangles;
 }
 
+/// Digits reserved for a count field written by @ref Writer::openDeferred
+static const int countFieldWidth = 20; // enough for the largest uint64
+
 std::string Writer::makeHeader()
 {
     std::ostringstream out;
@@ -458,11 +1125,36 @@ std::string Writer::makeHeader()
         out << "comment " << s << '\n';
     }
 
-    out << "element vertex " << numVertices << '\n'
+    out << "element vertex ";
+    if (deferredCounts)
+    {
+        /* Zero-pad the count to a fixed width so that the real value can be
+         * patched in by close() without moving the rest of the header.
+         */
+        vertexCountOffset = BinaryWriter::offset_type(out.tellp());
+        out << std::setw(countFieldWidth) << std::setfill('0') << numVertices
+            << std::setfill(' ');
+    }
+    else
+        out << numVertices;
+    out << '\n'
         << "property float32 x\n"
         << "property float32 y\n"
-        << "property float32 z\n"
-        << "element face " << numTriangles << '\n'
+        << "property float32 z\n";
+    if (normals)
+        out << "property float32 nx\n"
+            << "property float32 ny\n"
+            << "property float32 nz\n";
+    out << "element face ";
+    if (deferredCounts)
+    {
+        triangleCountOffset = BinaryWriter::offset_type(out.tellp());
+        out << std::setw(countFieldWidth) << std::setfill('0') << numTriangles
+            << std::setfill(' ');
+    }
+    else
+        out << numTriangles;
+    out << '\n'
         << "property list uint8 uint32 vertex_indices\n"
         << "comment padding:";
     /* Use a comment to pad the header to a multiple of 4 bytes, so that the
@@ -483,19 +1175,100 @@ std::string Writer::makeHeader()
 void Writer::open(const std::string &filename)
 {
     MLSGPU_ASSERT(!isOpen(), state_error);
+    deferredCounts = false;
     handle = handleFactory();
     handle->open(filename);
 
     std::string header = makeHeader();
-    handle->resize(header.size() + getNumVertices() * vertexSize + getNumTriangles() * triangleSize);
+    /* The vertices and triangles land at computed offsets in whatever order
+     * the writer threads produce them, so ask for the whole extent up front
+     * to keep the file contiguous on disk.
+     */
+    handle->preallocate(header.size() + getNumVertices() * vertexBytes() + getNumTriangles() * triangleSize);
+    handle->write(header.data(), header.size(), 0);
+    vertexStart = header.size();
+    triangleStart = vertexStart + getNumVertices() * vertexBytes();
+}
+
+void Writer::openDeferred(const std::string &filename)
+{
+    MLSGPU_ASSERT(!isOpen(), state_error);
+    deferredCounts = true;
+    numVertices = 0;
+    numTriangles = 0;
+    handle = handleFactory();
+    handle->open(filename);
+
+    /* No preallocation: the final size is unknown, and the appends are
+     * sequential so the filesystem's delayed allocation handles layout.
+     */
+    const std::string header = makeHeader();
     handle->write(header.data(), header.size(), 0);
     vertexStart = header.size();
-    triangleStart = vertexStart + getNumVertices() * vertexSize;
+    triangleStart = 0;     // sentinel: set by the first appendTriangles
+    appendOffset = vertexStart;
+}
+
+Writer::size_type Writer::appendVertices(size_type count, const float *data)
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    MLSGPU_ASSERT(deferredCounts, state_error);
+    MLSGPU_ASSERT(triangleStart == 0, state_error);
+    Statistics::Timer timer(writeVerticesTime);
+    handle->write(data, count * vertexBytes(), appendOffset);
+    appendOffset += count * vertexBytes();
+    const size_type first = numVertices;
+    numVertices += count;
+    return first;
+}
+
+void Writer::appendTriangles(size_type count, const std::tr1::uint32_t *data)
+{
+    MLSGPU_ASSERT(isOpen(), state_error);
+    MLSGPU_ASSERT(deferredCounts, state_error);
+    if (triangleStart == 0)
+        triangleStart = appendOffset;
+    Statistics::Timer timer(writeTrianglesTime);
+
+    // Interleave the count bytes and indices through a bounce buffer
+    const size_type blockTriangles = 4096;
+    std::vector<std::tr1::uint8_t> buffer(std::size_t(std::min(count, blockTriangles)) * triangleSize);
+    while (count > 0)
+    {
+        const size_type n = std::min(count, blockTriangles);
+        for (size_type i = 0; i < n; i++)
+        {
+            buffer[i * triangleSize] = 3;
+            std::memcpy(&buffer[i * triangleSize + 1], data + i * 3, 3 * sizeof(std::tr1::uint32_t));
+        }
+        handle->write(&buffer[0], std::size_t(n) * triangleSize, appendOffset);
+        appendOffset += n * triangleSize;
+        numTriangles += n;
+        data += n * 3;
+        count -= n;
+    }
 }
 
 void Writer::close()
 {
     MLSGPU_ASSERT(isOpen(), state_error);
+    if (deferredCounts)
+    {
+        /* Patch the real counts into the fixed-width fields reserved by
+         * openDeferred. Streaming mode does not go through an AsyncWriter,
+         * so all the appends have already reached the handle.
+         */
+        std::ostringstream field;
+        field.imbue(std::locale::classic());
+        field << std::setw(countFieldWidth) << std::setfill('0') << numVertices
+              << std::setw(countFieldWidth) << numTriangles;
+        const std::string fields = field.str();
+        handle->write(fields.data(), countFieldWidth, vertexCountOffset);
+        handle->write(fields.data() + countFieldWidth, countFieldWidth, triangleCountOffset);
+        deferredCounts = false;
+        numVertices = 0;
+        numTriangles = 0;
+    }
     // Note: the handle is not closed, because it may still be accessed by an AsyncWriter
     handle.reset();
 }
@@ -505,7 +1278,7 @@ void Writer::writeVertices(size_type first, size_type count, const float *data)
     MLSGPU_ASSERT(isOpen(), state_error);
     MLSGPU_ASSERT(first + count <= getNumVertices() && first <= std::numeric_limits<size_type>::max() - count, std::out_of_range);
     Statistics::Timer timer(writeVerticesTime);
-    handle->write(data, count * vertexSize, vertexStart + first * vertexSize);
+    handle->write(data, count * vertexBytes(), vertexStart + first * vertexBytes());
 }
 
 void Writer::writeVertices(
@@ -516,7 +1289,7 @@ void Writer::writeVertices(
 {
     MLSGPU_ASSERT(isOpen(), state_error);
     MLSGPU_ASSERT(first + count <= getNumVertices() && first <= std::numeric_limits<size_type>::max() - count, std::out_of_range);
-    async.push(tworker, data, handle, count * vertexSize, vertexStart + first * vertexSize);
+    async.push(tworker, data, handle, count * vertexBytes(), vertexStart + first * vertexBytes());
 }
 
 void Writer::writeTrianglesRaw(size_type first, size_type count, const std::tr1::uint8_t *data)
@@ -545,18 +1318,26 @@ void Writer::writeTriangles(size_type first, size_type count, const std::tr1::ui
 
     Statistics::Timer timer(writeTrianglesTime);
     BinaryWriter::offset_type pos = triangleStart + first * triangleSize;
+    /* Each triangle is a vertex count byte followed by the three indices.
+     * Instead of interleaving them into a bounce buffer, describe the
+     * output as alternating slices and let the writer gather them (with
+     * pwritev where available). The count byte is the same for every
+     * triangle, so one static byte serves all the slices.
+     */
+    static const std::tr1::uint8_t countByte = 3;
     while (count > 0)
     {
-        const unsigned int bufferTriangles = 8192;
-        char buffer[bufferTriangles * triangleSize];
-        char *ptr = buffer;
+        const unsigned int bufferTriangles = 512;
+        BinaryWriter::Slice slices[bufferTriangles * 2];
         unsigned int triangles = std::min(size_type(bufferTriangles), count);
-        for (unsigned int i = 0; i < triangles; i++, ptr += triangleSize, data += 3)
+        for (unsigned int i = 0; i < triangles; i++, data += 3)
         {
-            ptr[0] = 3;
-            std::memcpy(ptr + 1, data, 3 * sizeof(data[0]));
+            slices[2 * i].data = &countByte;
+            slices[2 * i].size = sizeof(countByte);
+            slices[2 * i + 1].data = data;
+            slices[2 * i + 1].size = 3 * sizeof(data[0]);
         }
-        pos += handle->write(buffer, ptr - buffer, pos);
+        pos += handle->writev(slices, triangles * 2, pos);
         count -= triangles;
     }
 }
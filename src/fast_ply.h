@@ -82,12 +82,20 @@ public:
 /**
  * Base class for quickly reading a subset of PLY files.
  * It only supports the following:
- * - Binary files, endianness matching the host.
+ * - Binary files with endianness matching the host, or ASCII files.
  * - Only the "vertex" element is loaded.
  * - The "vertex" element must be the first element in the file.
- * - The x, y, z, nx, ny, nz, radius elements must all be present and FLOAT32.
+ * - The x, y, z, nx, ny, nz, radius elements must all be present and either
+ *   FLOAT32 or FLOAT64 (FLOAT64 values are converted to @c float on decode).
  * - The vertex element must not contain any lists.
  *
+ * ASCII files are not read in place: the constructor converts the vertex
+ * element to a packed binary file once, and all subsequent access goes
+ * through that copy with the normal binary machinery. The copy is a
+ * temporary file removed on destruction, unless the @c MLSGPU_ASCII_CACHE
+ * environment variable names a directory, in which case it is kept there and
+ * reused by later runs while the source file is unchanged.
+ *
  * An instance of this class just holds the metadata, but no OS resources or
  * buffers. To actually read the data, one creates a @ref Handle,
  * at which point the file is opened.
@@ -131,6 +139,45 @@ public:
          */
         void readRaw(size_type first, size_type last, char *buffer) const;
 
+        /**
+         * Batched form of @ref readRaw for several disjoint vertex ranges.
+         * The ranges are packed tightly into @a buffer in order, and the
+         * whole batch is issued as a single vectored read (see @ref
+         * BinaryReader::readv) where the platform supports it: the file
+         * bytes between the ranges are fetched but discarded, so batching
+         * is only worthwhile when the gaps are small relative to the
+         * payload — the caller is responsible for that policy.
+         *
+         * @param firsts,lasts    Parallel arrays delimiting the ranges.
+         * @param numRanges       Number of ranges in the batch.
+         * @param buffer          Output buffer for the concatenated ranges.
+         *
+         * @pre
+         * - @a numRanges is positive.
+         * - The ranges are valid (as for @ref readRaw), ascending and
+         *   non-overlapping.
+         * - @a buffer is not @c NULL and can hold the sum of the range
+         *   sizes.
+         */
+        void readRawBatch(const size_type *firsts, const size_type *lasts,
+                          std::size_t numRanges, char *buffer) const;
+
+        /**
+         * Zero-copy read access. If the underlying @ref BinaryReader exposes
+         * the file contents directly (see @ref BinaryReader::data), returns a
+         * pointer to the raw data for the requested vertices, in the same form
+         * that @ref readRaw would have produced. Otherwise returns @c NULL and
+         * the caller must fall back to @ref readRaw.
+         *
+         * The pointer remains valid for the lifetime of the handle.
+         *
+         * @param first,last      %Range of vertices to access.
+         * @return A pointer to the data, or @c NULL.
+         *
+         * @pre @a first &lt;= @a last &lt;= @ref size().
+         */
+        const char *dataRaw(size_type first, size_type last) const;
+
         /**
          * Convenience wrapper around @ref Reader::decode.
          *
@@ -167,12 +214,74 @@ public:
      */
     Splat decode(const char *buffer, std::size_t offset) const;
 
+    /**
+     * Extract a contiguous run of splats from the raw buffer representation.
+     * This is equivalent to calling @ref decode for each of the @a count
+     * splats starting at @a offset, but the decode loop is specialized at
+     * runtime on the field layout found in the header: the common layout of
+     * seven tightly-packed FLOAT32 fields in canonical order gets a branch-free
+     * loop with compile-time field offsets, while other layouts (including
+     * FLOAT64 fields) go through a generic loop with the per-field dispatch
+     * hoisted out of the inner copies.
+     *
+     * @param buffer     A buffer returned by @ref Handle::readRaw
+     * @param offset     The number of the first splat within the buffer
+     * @param count      The number of splats to decode
+     * @param out        Output array of at least @a count splats
+     */
+    void decodeBatch(const char *buffer, std::size_t offset, std::size_t count, Splat *out) const;
+
     /// Number of vertices in the file
     size_type size() const { return vertexCount; }
 
     /// Number of bytes per vertex
     size_type getVertexSize() const { return vertexSize; }
 
+    /// Number of bytes from the beginning of the data file to the first vertex
+    size_type getHeaderSize() const { return headerSize; }
+
+    /**
+     * Whether the vertex consists of exactly the seven FLOAT32 properties in
+     * canonical order (x, y, z, nx, ny, nz, radius), tightly packed. This is
+     * the layout our own tools emit, and bodies of such files can be
+     * concatenated by raw byte copies.
+     */
+    bool isDenseLayout() const { return denseLayout; }
+
+    /**
+     * File actually holding the binary vertex data. This differs from
+     * @ref getPath for ASCII files, which are converted to a packed binary
+     * copy when opened; @ref getHeaderSize and @ref getVertexSize always
+     * describe this file.
+     */
+    const boost::filesystem::path &getDataPath() const { return dataPath; }
+
+    /// Path to the file
+    const boost::filesystem::path &getPath() const { return path; }
+
+    /// Scale factor applied to radii as they're read
+    float getSmooth() const { return smooth; }
+
+    /// Cap for radius (prior to scaling by the smoothing factor)
+    float getMaxRadius() const { return maxRadius; }
+
+    /**
+     * Set a translation that is subtracted from splat positions as they are
+     * decoded, rebasing the file on a local coordinate frame. The
+     * subtraction happens in double precision before the narrowing to @c
+     * float, so FLOAT64 inputs with large coordinate magnitudes (e.g.
+     * georeferenced clouds in UTM coordinates) keep their full relative
+     * precision without a separate preprocessing translation of the input.
+     * ASCII inputs are converted to FLOAT32 when the file is opened, before
+     * the offset can be applied, so they do not regain precision this way.
+     *
+     * This must not be called while decoding is in progress.
+     */
+    void setOffset(const double offset[3]);
+
+    /// Retrieve the translation set by @ref setOffset (default zero).
+    const double *getOffset() const { return offset; }
+
     /**
      * Construct from a file.
      *
@@ -201,6 +310,9 @@ public:
         const boost::filesystem::path &path,
         float smooth, float maxRadius);
 
+    /// Destructor. Removes the converted copy of an ASCII file if it was temporary.
+    ~Reader();
+
 private:
     /// Factory to generate file handles for low-level file access
     boost::function<BinaryReader *()> readerFactory;
@@ -214,6 +326,12 @@ private:
     /// Radius limit
     float maxRadius;
 
+    /// Translation subtracted from positions on decode (see @ref setOffset)
+    double offset[3];
+
+    /// Whether @ref offset has any non-zero component
+    bool hasOffset;
+
     /// The properties found in the file.
     enum Property
     {
@@ -226,6 +344,33 @@ private:
     size_type vertexSize;              ///< Bytes per vertex
     size_type vertexCount;             ///< Number of vertices
     size_type offsets[numProperties];  ///< Byte offsets of each property within a vertex
+    bool fieldIsDouble[numProperties]; ///< Whether each property is FLOAT64 rather than FLOAT32
+
+    /**
+     * Whether all properties are FLOAT32 and tightly packed in canonical
+     * order (x, y, z, nx, ny, nz, radius) with nothing else in the vertex.
+     * This is the common case emitted by our own tools, and @ref decodeBatch
+     * has a fast path for it.
+     */
+    bool denseLayout;
+
+    /// Whether the file is ASCII and must be converted before reading
+    bool ascii;
+
+    /// Number of scalar properties per vertex line in an ASCII file
+    unsigned int asciiTokens;
+
+    /// Token index of each property within an ASCII vertex line
+    unsigned int asciiIndex[numProperties];
+
+    /**
+     * File actually holding the binary vertex data. For binary files this is
+     * just @ref path; for ASCII files it names the converted copy.
+     */
+    boost::filesystem::path dataPath;
+
+    /// Whether @ref dataPath is a temporary file to remove on destruction
+    bool removeDataPath;
 
     /**
      * Does the heavy lifting of parsing the header. This is called by
@@ -234,8 +379,40 @@ private:
      */
     void readHeader(std::istream &in);
 
-    /// Return the number of bytes from the beginning of the file to the first vertex
-    size_type getHeaderSize() const { return headerSize; }
+    /**
+     * Convert the vertex element of an ASCII file to packed FLOAT32 fields
+     * in canonical order, and redirect data access to the converted file.
+     * On return the metadata fields all describe the converted file, and
+     * @ref readerFactory produces plain file readers for it (the source
+     * file's reader type does not necessarily suit a freshly written
+     * uncompressed file).
+     *
+     * @param src  Open reader for the source file, positioned anywhere.
+     * @throw FormatError if a vertex line is malformed or the file is truncated.
+     * @throw std::ios::failure if the converted file cannot be written.
+     */
+    void convertAscii(BinaryReader &src);
+
+    /**
+     * Inner loop of @ref convertAscii: stream the vertex lines of @a src,
+     * parse them in parallel and write packed records to @a out.
+     */
+    void convertAsciiData(BinaryReader &src, std::ostream &out);
+
+    /**
+     * Encode the parsed header fields as a string for the persistent
+     * header cache.
+     */
+    std::string encodeHeader() const;
+
+    /**
+     * Inverse of @ref encodeHeader.
+     *
+     * @retval @c true if @a value was parsed and the header fields set.
+     * @retval @c false if @a value is malformed (e.g. from an older
+     * version); the caller must parse the file header instead.
+     */
+    bool decodeHeader(const std::string &value);
 };
 
 /**
@@ -256,10 +433,17 @@ private:
  * The requirement for knowing the number of vertices and indices up front is a
  * limitation of the PLY format. If it is not possible to know this up front, you
  * will need to dump the vertices and indices to raw temporary files and stitch
- * it all together later.
+ * it all together later, or use the streaming mode (@ref openDeferred), which
+ * reserves fixed-width count fields in the header and patches them on close.
  *
  * The final phase (writing of vertices and indices) is thread-safe, provided
  * that each thread is writing to a disjoint section of the file.
+ *
+ * Constructing the writer with @ref COMPRESSED_WRITER stores the PLY data in
+ * a block-compressed container instead of a plain file. The result is not
+ * readable by standard PLY tools, but can be read back (e.g. as input to a
+ * further run) with @ref COMPRESSED_READER, and the compression overlaps the
+ * reconstruction because it runs on the writing threads.
  */
 class Writer
 {
@@ -290,12 +474,74 @@ public:
      */
     void setNumTriangles(size_type numTriangles);
 
+    /**
+     * Enables or disables per-vertex normals in the output. When enabled,
+     * the vertex element carries @c nx, @c ny, @c nz properties after the
+     * position, and the @c data passed to @ref writeVertices must hold six
+     * floats per vertex (position followed by normal). The default is
+     * disabled.
+     *
+     * @pre @ref open has not yet been successfully called.
+     */
+    void setNormals(bool normals);
+
+    /// Retrieve the value set with @ref setNormals.
+    bool getNormals() const { return normals; }
+
+    /**
+     * Number of bytes per vertex in the file: @ref vertexSize, doubled when
+     * normals are enabled (see @ref setNormals).
+     */
+    size_type vertexBytes() const { return normals ? 2 * vertexSize : vertexSize; }
+
     /**
      * Create the file and write the header.
      * @pre @ref open has not yet been successfully called.
      */
     void open(const std::string &filename);
 
+    /**
+     * Create the file in streaming mode, without knowing the counts up
+     * front. A provisional header is written whose count fields are
+     * zero-padded to a fixed width, so patching in the real values later
+     * does not move the data. Vertices are then appended with
+     * @ref appendVertices and triangles with @ref appendTriangles (all
+     * vertices must precede the first triangle, as the PLY layout
+     * requires), and @ref close seeks back and patches the counts.
+     *
+     * Unlike @ref open this does not preallocate the file, and the append
+     * functions are not thread-safe, since there is a single append
+     * position rather than caller-computed offsets. The writer's handle
+     * must support positional rewrites of already-written bytes, so this
+     * mode must not be used with @ref COMPRESSED_WRITER (flushed blocks
+     * cannot be rewritten).
+     *
+     * @pre @ref open has not yet been successfully called.
+     */
+    void openDeferred(const std::string &filename);
+
+    /**
+     * Append vertices in streaming mode (see @ref openDeferred).
+     *
+     * @param count          Number of vertices to append.
+     * @param data           Array of <code>float[3]</code> values, or
+     *                       <code>float[6]</code> when normals are enabled.
+     * @return The index of the first vertex appended, for use in
+     *         triangle indices.
+     * @pre The file was opened with @ref openDeferred and no triangle has
+     *      been appended yet.
+     */
+    size_type appendVertices(size_type count, const float *data);
+
+    /**
+     * Append triangles in streaming mode (see @ref openDeferred).
+     *
+     * @param count          Number of triangles to append.
+     * @param data           Array of 3 vertex indices per triangle.
+     * @pre The file was opened with @ref openDeferred.
+     */
+    void appendTriangles(size_type count, const std::tr1::uint32_t *data);
+
     /**
      * Prepare to write another file. This will usually cause the old file
      * to be closed, but if it has been used with the asynchronous write
@@ -307,7 +553,9 @@ public:
      * Write a range of vertices.
      * @param first          Index of first vertex to write.
      * @param count          Number of vertices to write.
-     * @param data           Array of <code>float[3]</code> values.
+     * @param data           Array of <code>float[3]</code> values, or
+     *                       <code>float[6]</code> when normals are enabled
+     *                       (see @ref setNormals).
      * @pre @a first + @a count <= @a numVertices.
      */
     void writeVertices(size_type first, size_type count, const float *data);
@@ -369,7 +617,7 @@ public:
     size_type getNumVertices() const;  ///< Return the number of vertices
     size_type getNumTriangles() const; ///< Return the number of triangles
 
-    /// Bytes per vertex
+    /// Bytes per vertex position (see @ref vertexBytes for the on-disk size)
     static const size_type vertexSize = 3 * sizeof(float);
     /// Bytes per triangle
     static const size_type triangleSize = 1 + 3 * sizeof(std::tr1::uint32_t);
@@ -407,6 +655,12 @@ private:
     std::vector<std::string> comments;
     size_type numVertices;              ///< Number of vertices (defaults to zero)
     size_type numTriangles;             ///< Number of triangles (defaults to zero)
+    bool normals;                       ///< Whether vertices carry normals (see @ref setNormals)
+
+    bool deferredCounts;                ///< Whether the file was opened with @ref openDeferred
+    BinaryWriter::offset_type vertexCountOffset;    ///< Offset of the vertex count field in the header
+    BinaryWriter::offset_type triangleCountOffset;  ///< Offset of the triangle count field in the header
+    BinaryWriter::offset_type appendOffset;         ///< Next write position in streaming mode
 
 protected:
     /// File handle (non-NULL if the file is open)
@@ -69,13 +69,16 @@ void WriterMPI::open(const std::string &filename, MPI_Comm comm, int root)
     setNumVertices(sizes[1]);
     setNumTriangles(sizes[2]);
 
-    handle = boost::make_shared<BinaryWriterMPI>(comm);
+    boost::shared_ptr<BinaryWriterMPI> mpiHandle = boost::make_shared<BinaryWriterMPI>(comm);
+    handle = mpiHandle;
     handle->open(filename);
-    handle->resize(sizes[0] + getNumVertices() * vertexSize + getNumTriangles() * triangleSize);
-    if (rank == root)
-        handle->write(header.data(), header.size(), 0);
+    handle->preallocate(sizes[0] + getNumVertices() * vertexBytes() + getNumTriangles() * triangleSize);
+    /* Collective even though only the root contributes data: keeping the
+     * call matched across ranks lets the collective buffering layer run.
+     */
+    mpiHandle->writeAll(header.data(), rank == root ? header.size() : 0, 0);
     vertexStart = sizes[0];
-    triangleStart = vertexStart + getNumVertices() * vertexSize;
+    triangleStart = vertexStart + getNumVertices() * vertexBytes();
 }
 
 } // namespace FastPly
@@ -40,6 +40,7 @@ Grid::Grid()
     {
         reference[i] = 0.0f;
         extents[i] = extent_type(0, 1);
+        worldOffset[i] = 0.0;
     }
     spacing = 0.0f;
 }
@@ -54,6 +55,7 @@ Grid::Grid(const float ref[3], const float spacing,
     setExtent(0, xLow, xHigh);
     setExtent(1, yLow, yHigh);
     setExtent(2, zLow, zHigh);
+    std::fill(worldOffset, worldOffset + 3, 0.0);
 }
 
 void Grid::setReference(const float ref[3])
@@ -89,6 +91,16 @@ const Grid::extent_type &Grid::getExtent(unsigned int axis) const
     return extents[axis];
 }
 
+void Grid::setWorldOffset(const double offset[3])
+{
+    std::copy(offset, offset + 3, worldOffset);
+}
+
+const double *Grid::getWorldOffset() const
+{
+    return worldOffset;
+}
+
 void Grid::getVertex(difference_type x, difference_type y, difference_type z, float vertex[3]) const
 {
     vertex[0] = reference[0] + spacing * (x + extents[0].first);
@@ -128,6 +140,28 @@ void Grid::worldToCell(const float world[3], difference_type out[3]) const
     }
 }
 
+Grid::WorldToVertex::WorldToVertex(const Grid &grid)
+{
+    MLSGPU_ASSERT(grid.getSpacing() > 0.0f, std::invalid_argument);
+    invSpacing = 1.0f / grid.getSpacing();
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        reference[i] = grid.getReference()[i];
+        bias[i] = grid.getExtent(i).first;
+    }
+}
+
+Grid::WorldToCell::WorldToCell(const Grid &grid)
+{
+    MLSGPU_ASSERT(grid.getSpacing() > 0.0f, std::invalid_argument);
+    invSpacing = 1.0f / grid.getSpacing();
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        reference[i] = grid.getReference()[i];
+        bias[i] = grid.getExtent(i).first;
+    }
+}
+
 Grid::size_type Grid::numVertices(unsigned int axis) const
 {
     return numCells(axis) + 1;
@@ -31,6 +31,7 @@
 # include <config.h>
 #endif
 #include <utility>
+#include <cmath>
 #include "tr1_cstdint.h"
 #include <boost/numeric/conversion/converter.hpp>
 
@@ -112,6 +113,20 @@ public:
      */
     const extent_type &getExtent(unsigned int axis) const;
 
+    /**
+     * Set the translation between the grid's coordinate system and the
+     * coordinate system of the original input (e.g. a georeferenced frame
+     * that the input was rebased out of to keep single-precision accuracy).
+     * It is deliberately not applied by the coordinate transformations in
+     * this class, which all operate in the rebased system; it is carried
+     * along so that the transformation which emits the final vertices can
+     * map them back to the original frame.
+     */
+    void setWorldOffset(const double offset[3]);
+
+    /// Retrieve the translation set by @ref setWorldOffset (default zero).
+    const double *getWorldOffset() const;
+
     /**
      * Turn a grid-indexed vertex position into world coordinates.
      * Note that (0, 0, 0) need not correspond to the reference point.
@@ -162,6 +177,70 @@ public:
      */
     void worldToCell(const float world[3], difference_type out[3]) const;
 
+    /**
+     * Precomputed form of @ref worldToVertex for per-splat loops. The grid
+     * parameters are captured and validated once at construction, so each
+     * application is a few inline multiply-adds with no function call and no
+     * revalidation. The results are identical to @ref worldToVertex.
+     *
+     * @pre The grid's spacing is positive.
+     */
+    class WorldToVertex
+    {
+    public:
+        explicit WorldToVertex(const Grid &grid);
+
+        /// Apply the conversion. @a world and @a out may be the same.
+        void operator()(const float world[3], float out[3]) const
+        {
+            for (unsigned int i = 0; i < 3; i++)
+                out[i] = (world[i] - reference[i]) * invSpacing - bias[i];
+        }
+
+        /// Reciprocal of the grid spacing, for scaling radii in the same loop
+        float getInvSpacing() const { return invSpacing; }
+
+    private:
+        float reference[3];   ///< Grid reference point
+        float bias[3];        ///< Low extents, pre-converted to float
+        float invSpacing;     ///< Reciprocal of the grid spacing
+    };
+
+    /**
+     * Precomputed, unchecked form of @ref worldToCell for per-splat loops.
+     * The grid parameters are captured and validated once at construction,
+     * and the per-element finiteness and overflow checks of
+     * @ref worldToCell are elided entirely: the caller must establish, for
+     * a whole batch at a time, that the coordinates are finite and that
+     * their cells fit in @ref difference_type after the extent bias (splat
+     * streams already discard non-finite splats, and a bounding grid
+     * computed from the input covers it by construction). Within that
+     * domain the results are identical to @ref worldToCell, including its
+     * invariance to changes in the extents.
+     *
+     * @pre The grid's spacing is positive.
+     */
+    class WorldToCell
+    {
+    public:
+        explicit WorldToCell(const Grid &grid);
+
+        /// Apply the conversion.
+        void operator()(const float world[3], difference_type out[3]) const
+        {
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                float raw = (world[i] - reference[i]) * invSpacing;
+                out[i] = difference_type(std::floor(raw)) - bias[i];
+            }
+        }
+
+    private:
+        float reference[3];        ///< Grid reference point
+        difference_type bias[3];   ///< Low extents
+        float invSpacing;          ///< Reciprocal of the grid spacing
+    };
+
     /**
      * Create a new grid that has the same reference point and spacing
      * as this one, but different extents. The extents are specified
@@ -181,6 +260,7 @@ private:
     float reference[3];              ///< Reference point
     float spacing;                   ///< Spacing between samples
     extent_type extents[3];          ///< Axis extents
+    double worldOffset[3];           ///< Translation back to the original frame (see @ref setWorldOffset)
 };
 
 #endif /* !GRID_H */
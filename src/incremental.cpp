@@ -0,0 +1,128 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Support for incremental reconstruction, in which output chunks whose
+ * input splats are unchanged since a previous run are not recomputed.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include <cerrno>
+#include <ios>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/exception/all.hpp>
+#include "tr1_cstdint.h"
+#include "logging.h"
+#include "incremental.h"
+
+SplatHash::SplatHash() : hash(UINT64_C(0xcbf29ce484222325))
+{
+}
+
+void SplatHash::append(const void *data, std::size_t bytes)
+{
+    const std::tr1::uint8_t *p = static_cast<const std::tr1::uint8_t *>(data);
+    value_type h = hash;
+    for (std::size_t i = 0; i < bytes; i++)
+    {
+        h ^= p[i];
+        h *= UINT64_C(0x100000001b3);
+    }
+    hash = h;
+}
+
+void SplatHash::append(std::tr1::uint64_t value)
+{
+    std::tr1::uint8_t bytes[8];
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        bytes[i] = value & 0xFF;
+        value >>= 8;
+    }
+    append(bytes, sizeof(bytes));
+}
+
+void ChunkHashes::load(const boost::filesystem::path &path)
+{
+    if (!boost::filesystem::exists(path))
+    {
+        Log::log[Log::info] << "No incremental state at " << path.string()
+            << ": all chunks will be processed.\n";
+        return;
+    }
+
+    try
+    {
+        boost::filesystem::ifstream in(path);
+        if (!in)
+            throw std::ios::failure("Could not open file");
+        boost::archive::text_iarchive archive(in);
+        archive >> *this;
+        in.close();
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(path.string());
+    }
+}
+
+void ChunkHashes::save(const boost::filesystem::path &path) const
+{
+    try
+    {
+        boost::filesystem::ofstream out(path);
+        if (!out)
+            throw std::ios::failure("Could not open file");
+        boost::archive::text_oarchive archive(out);
+        archive << *this;
+        out.close();
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(path.string());
+    }
+}
+
+void ChunkHashes::set(const key_type &coords, value_type hash)
+{
+    entries[coords] = hash;
+}
+
+bool ChunkHashes::find(const key_type &coords, value_type &hash) const
+{
+    std::map<key_type, value_type>::const_iterator pos = entries.find(coords);
+    if (pos == entries.end())
+        return false;
+    hash = pos->second;
+    return true;
+}
@@ -0,0 +1,152 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Support for incremental reconstruction, in which output chunks whose
+ * input splats are unchanged since a previous run are not recomputed.
+ */
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <map>
+#include <cstddef>
+#include <boost/array.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/serialization/serialization.hpp>
+#include <boost/serialization/split_member.hpp>
+#include "tr1_cstdint.h"
+#include "grid.h"
+
+/**
+ * Incrementally computed hash over splat content. It is a straightforward
+ * FNV-1a hash over the raw bytes, which is cheap enough to compute at
+ * streaming rates. It is not cryptographic: a user who needs protection
+ * against adversarial inputs should not use incremental mode.
+ */
+class SplatHash
+{
+public:
+    typedef std::tr1::uint64_t value_type;
+
+    SplatHash();
+
+    /// Fold a range of raw bytes into the hash.
+    void append(const void *data, std::size_t bytes);
+
+    /// Fold a single integral value into the hash.
+    void append(std::tr1::uint64_t value);
+
+    /// Retrieve the current hash value.
+    value_type get() const { return hash; }
+
+private:
+    value_type hash;
+};
+
+/**
+ * Table of per-chunk content hashes, persisted between runs to support
+ * incremental reconstruction. Each output chunk (identified by its chunk
+ * coordinates, which are stable across runs) maps to a hash of the splats
+ * that contributed to it. A chunk whose hash is unchanged from the previous
+ * run produced the same output file, so the file can be kept rather than
+ * recomputed.
+ */
+class ChunkHashes
+{
+    friend class boost::serialization::access;
+public:
+    typedef boost::array<Grid::size_type, 3> key_type;
+    typedef SplatHash::value_type value_type;
+
+    /**
+     * Load the table written by a previous run. A missing file is not an
+     * error: the table is simply left empty, which causes every chunk to be
+     * processed from scratch.
+     *
+     * @throw std::ios::failure if the file exists but could not be read.
+     */
+    void load(const boost::filesystem::path &path);
+
+    /**
+     * Write the table for use by the next run.
+     *
+     * @throw std::ios::failure if the file could not be written.
+     */
+    void save(const boost::filesystem::path &path) const;
+
+    /// Record the hash for a chunk, replacing any previous value.
+    void set(const key_type &coords, value_type hash);
+
+    /**
+     * Look up the hash for a chunk.
+     *
+     * @param      coords Chunk coordinates to look up.
+     * @param[out] hash   Hash recorded for the chunk, if present.
+     * @return Whether an entry for @a coords was found.
+     */
+    bool find(const key_type &coords, value_type &hash) const;
+
+    /// Number of chunks in the table.
+    std::size_t size() const { return entries.size(); }
+
+private:
+    std::map<key_type, value_type> entries;
+
+    template<typename Archive>
+    void save(Archive &ar, const unsigned int) const
+    {
+        std::size_t count = entries.size();
+        ar << count;
+        for (std::map<key_type, value_type>::const_iterator i = entries.begin();
+             i != entries.end(); ++i)
+        {
+            for (unsigned int j = 0; j < 3; j++)
+                ar << i->first[j];
+            ar << i->second;
+        }
+    }
+
+    template<typename Archive>
+    void load(Archive &ar, const unsigned int)
+    {
+        entries.clear();
+        std::size_t count;
+        ar >> count;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            key_type key;
+            value_type value;
+            for (unsigned int j = 0; j < 3; j++)
+                ar >> key[j];
+            ar >> value;
+            entries[key] = value;
+        }
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+#endif /* !INCREMENTAL_H */
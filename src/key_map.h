@@ -0,0 +1,307 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Flat open-addressing hash map from 64-bit keys to POD values.
+ */
+
+#ifndef KEY_MAP_H
+#define KEY_MAP_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __STDC_CONSTANT_MACROS
+# define __STDC_CONSTANT_MACROS
+#endif
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <iterator>
+#include "tr1_cstdint.h"
+#include "pod_buffer.h"
+#include "allocator.h"
+#include "errors.h"
+
+/**
+ * Hash map from 64-bit keys to POD values, stored flat in a single
+ * power-of-two array with linear probing. Compared to
+ * @ref Statistics::Container::unordered_map it makes no per-entry
+ * allocations and resolves most lookups with a single cache line, at the
+ * cost of supporting only a small part of the map interface: insertion,
+ * iteration, @ref swap and wholesale destruction (there is no erase).
+ *
+ * An unoccupied slot is marked with a reserved key; a genuine entry with
+ * that key is held out of the table in a dedicated member, so the full key
+ * space remains usable. Values must be POD: they are moved with @c memcpy
+ * and are not destroyed individually.
+ *
+ * The memory is accounted to a @ref Statistics::Allocator under the name
+ * given at construction, like the other mesher containers.
+ */
+template<typename Value>
+class KeyMap
+{
+public:
+    typedef std::tr1::uint64_t key_type;
+    typedef Value mapped_type;
+    typedef std::size_t size_type;
+
+    /// A key/value slot. Exposed for iteration.
+    struct Entry
+    {
+        key_type key;
+        Value value;
+    };
+
+    /**
+     * Forward iterator over the entries, in unspecified order.
+     */
+    class const_iterator : public std::iterator<std::forward_iterator_tag, const Entry>
+    {
+        friend class KeyMap<Value>;
+    private:
+        const Entry *cur;       ///< Current slot (NULL for the special entry or end)
+        const Entry *last;      ///< One past the final slot of the table
+        const Entry *special;   ///< Out-of-table entry still to visit (NULL if none)
+
+        /**
+         * Advance @ref cur to the next occupied slot; at the end of the
+         * table, fall through to the special entry (if any) and finally to
+         * the NULL end state.
+         */
+        void skip()
+        {
+            while (cur != last && cur->key == EMPTY_KEY)
+                ++cur;
+            if (cur == last)
+            {
+                cur = special;
+                last = (cur != NULL) ? cur + 1 : NULL;
+                special = NULL;
+            }
+        }
+
+        const_iterator(const Entry *first, const Entry *last, const Entry *special)
+            : cur(first), last(last), special(special)
+        {
+            skip();
+        }
+
+    public:
+        const_iterator() : cur(NULL), last(NULL), special(NULL) {}
+
+        const Entry &operator*() const { return *cur; }
+        const Entry *operator->() const { return cur; }
+
+        const_iterator &operator++()
+        {
+            ++cur;
+            skip();
+            return *this;
+        }
+
+        bool operator==(const const_iterator &o) const { return cur == o.cur; }
+        bool operator!=(const const_iterator &o) const { return cur != o.cur; }
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param allocName  Name to account the memory under (see @ref Statistics::Allocator).
+     */
+    explicit KeyMap(const std::string &allocName)
+        : allocName(allocName), table(allocName), mask(0), size_(0), hasSpecial(false)
+    {
+        specialEntry.key = EMPTY_KEY;
+    }
+
+    KeyMap(const KeyMap &other)
+        : allocName(other.allocName), table(other.allocName),
+        mask(other.mask), size_(other.size_),
+        specialEntry(other.specialEntry), hasSpecial(other.hasSpecial)
+    {
+        if (other.mask != 0)
+        {
+            table.reserve(other.mask + 1, false);
+            std::memcpy(table.data(), other.table.data(), (other.mask + 1) * sizeof(Entry));
+        }
+    }
+
+    KeyMap &operator=(const KeyMap &other)
+    {
+        KeyMap tmp(other);
+        swap(tmp);
+        return *this;
+    }
+
+    size_type size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    /**
+     * Insert @a value under @a key unless the key is already present.
+     *
+     * @return A pointer to the value stored under @a key (whether new or
+     * pre-existing), and whether a new entry was created — the same protocol
+     * as @c map::insert, with the pointer standing in for the iterator.
+     */
+    std::pair<Value *, bool> insert(key_type key, const Value &value)
+    {
+        if (key == EMPTY_KEY)
+        {
+            if (!hasSpecial)
+            {
+                specialEntry.value = value;
+                hasSpecial = true;
+                size_++;
+                return std::make_pair(&specialEntry.value, true);
+            }
+            return std::make_pair(&specialEntry.value, false);
+        }
+
+        /* Grow at 2/3 load, counting the out-of-table entry out. */
+        if ((size_ - hasSpecial + 1) * 3 > (mask + 1) * 2)
+            grow();
+
+        size_type pos = hash(key) & mask;
+        while (table[pos].key != EMPTY_KEY)
+        {
+            if (table[pos].key == key)
+                return std::make_pair(&table[pos].value, false);
+            pos = (pos + 1) & mask;
+        }
+        table[pos].key = key;
+        table[pos].value = value;
+        size_++;
+        return std::make_pair(&table[pos].value, true);
+    }
+
+    /// Retrieve a pointer to the value stored under @a key, or @c NULL.
+    const Value *find(key_type key) const
+    {
+        if (key == EMPTY_KEY)
+            return hasSpecial ? &specialEntry.value : NULL;
+        if (mask == 0)
+            return NULL;
+        size_type pos = hash(key) & mask;
+        while (table[pos].key != EMPTY_KEY)
+        {
+            if (table[pos].key == key)
+                return &table[pos].value;
+            pos = (pos + 1) & mask;
+        }
+        return NULL;
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(
+            table.data(), table.data() + (mask ? mask + 1 : 0),
+            hasSpecial ? &specialEntry : NULL);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator();
+    }
+
+    void swap(KeyMap &other)
+    {
+        table.swap(other.table);
+        std::swap(allocName, other.allocName);
+        std::swap(mask, other.mask);
+        std::swap(size_, other.size_);
+        std::swap(specialEntry, other.specialEntry);
+        std::swap(hasSpecial, other.hasSpecial);
+    }
+
+    /// Remove all entries. The table memory is retained; @ref swap with an
+    /// empty map to release it as well.
+    void clear()
+    {
+        if (mask != 0)
+            for (size_type i = 0; i <= mask; i++)
+                table[i].key = EMPTY_KEY;
+        size_ = 0;
+        hasSpecial = false;
+    }
+
+private:
+    /// Key marking unoccupied slots (see the class documentation)
+    static const key_type EMPTY_KEY = UINT64_C(0xFFFFFFFFFFFFFFFF);
+
+    /// Initial number of slots on first insertion
+    static const size_type INITIAL_SLOTS = 64;
+
+    /// Finalizer from MurmurHash3: mixes all input bits into the low bits
+    static key_type hash(key_type k)
+    {
+        k ^= k >> 33;
+        k *= UINT64_C(0xff51afd7ed558ccd);
+        k ^= k >> 33;
+        k *= UINT64_C(0xc4ceb9fe1a85ec53);
+        k ^= k >> 33;
+        return k;
+    }
+
+    /// Double the table (or create it) and reinsert the resident entries
+    void grow()
+    {
+        const size_type oldSlots = mask ? mask + 1 : 0;
+        const size_type newSlots = oldSlots ? oldSlots * 2 : INITIAL_SLOTS;
+        const size_type newMask = newSlots - 1;
+
+        Statistics::Container::PODBuffer<Entry> newTable(allocName, newSlots);
+        for (size_type i = 0; i < newSlots; i++)
+            newTable[i].key = EMPTY_KEY;
+        for (size_type i = 0; i < oldSlots; i++)
+        {
+            if (table[i].key == EMPTY_KEY)
+                continue;
+            size_type pos = hash(table[i].key) & newMask;
+            while (newTable[pos].key != EMPTY_KEY)
+                pos = (pos + 1) & newMask;
+            newTable[pos] = table[i];
+        }
+        table.swap(newTable);
+        mask = newMask;
+    }
+
+    std::string allocName;    ///< Allocation name, needed to create grown tables
+    Statistics::Container::PODBuffer<Entry> table;  ///< The slots (mask + 1 of them when non-empty)
+    size_type mask;           ///< Number of slots minus one, or 0 for an unallocated table
+    size_type size_;          ///< Number of entries, including the special one
+    Entry specialEntry;       ///< Holds the entry whose key is @ref EMPTY_KEY
+    bool hasSpecial;          ///< Whether @ref specialEntry is occupied
+};
+
+/// Swap two maps in constant time
+template<typename Value>
+inline void swap(KeyMap<Value> &a, KeyMap<Value> &b)
+{
+    a.swap(b);
+}
+
+#endif /* !KEY_MAP_H */
@@ -0,0 +1,139 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Persistent string key-value store backed by an append-only text file.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cctype>
+#include <sstream>
+#include <string>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread/locks.hpp>
+#include "keyvalue_cache.h"
+#include "logging.h"
+
+namespace
+{
+
+/**
+ * Escape whitespace and the escape character itself as %XX, so that a field
+ * survives the whitespace-separated line format.
+ */
+static std::string escapeField(const std::string &s)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string ans;
+    ans.reserve(s.size());
+    for (std::size_t i = 0; i < s.size(); i++)
+    {
+        const unsigned char c = s[i];
+        if (c == '%' || std::isspace(c) || !std::isprint(c))
+        {
+            ans += '%';
+            ans += hex[c >> 4];
+            ans += hex[c & 0xf];
+        }
+        else
+            ans += c;
+    }
+    return ans;
+}
+
+/// Inverse of @ref escapeField. Malformed escapes are passed through as-is.
+static std::string unescapeField(const std::string &s)
+{
+    std::string ans;
+    ans.reserve(s.size());
+    for (std::size_t i = 0; i < s.size(); i++)
+    {
+        if (s[i] == '%' && i + 2 < s.size()
+            && std::isxdigit(static_cast<unsigned char>(s[i + 1]))
+            && std::isxdigit(static_cast<unsigned char>(s[i + 2])))
+        {
+            const int hi = std::isdigit(static_cast<unsigned char>(s[i + 1]))
+                ? s[i + 1] - '0' : std::toupper(s[i + 1]) - 'A' + 10;
+            const int lo = std::isdigit(static_cast<unsigned char>(s[i + 2]))
+                ? s[i + 2] - '0' : std::toupper(s[i + 2]) - 'A' + 10;
+            ans += char(hi * 16 + lo);
+            i += 2;
+        }
+        else
+            ans += s[i];
+    }
+    return ans;
+}
+
+} // anonymous namespace
+
+KeyValueCache::KeyValueCache(const boost::filesystem::path &path)
+    : path(path), loaded(false)
+{
+}
+
+void KeyValueCache::load()
+{
+    boost::filesystem::ifstream in(path);
+    std::string line;
+    while (getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string key, field, value;
+        if (fields >> key >> field >> value)
+            entries[std::make_pair(unescapeField(key), unescapeField(field))]
+                = unescapeField(value);
+    }
+    loaded = true;
+}
+
+bool KeyValueCache::lookup(const std::string &key, const std::string &field,
+                           std::string &value)
+{
+    boost::lock_guard<boost::mutex> guard(mutex);
+    if (!loaded)
+        load();
+    map_type::const_iterator pos = entries.find(std::make_pair(key, field));
+    if (pos == entries.end())
+        return false;
+    value = pos->second;
+    return true;
+}
+
+void KeyValueCache::update(const std::string &key, const std::string &field,
+                           const std::string &value)
+{
+    boost::lock_guard<boost::mutex> guard(mutex);
+    if (!loaded)
+        load();
+    entries[std::make_pair(key, field)] = value;
+
+    boost::filesystem::ofstream out(path, std::ios::app);
+    out << escapeField(key) << ' ' << escapeField(field) << ' '
+        << escapeField(value) << '\n';
+    if (!out)
+        Log::log[Log::warn] << "Warning: could not write cache "
+            << path.string() << '\n';
+}
@@ -0,0 +1,93 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Persistent string key-value store backed by an append-only text file.
+ */
+
+#ifndef KEYVALUE_CACHE_H
+#define KEYVALUE_CACHE_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <map>
+#include <string>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/filesystem/path.hpp>
+
+/**
+ * Persistent store of string values, backed by a text file with one
+ * key/field/value record per line. Records are addressed by a two-part key
+ * (a key plus a field name), and all parts are escaped so that they may
+ * contain whitespace. The file is read lazily on first query and updates are
+ * appended, so concurrent processes may write duplicate records but never
+ * corrupt each other (the last record for a key wins). A missing or
+ * unwritable file is not an error; the values simply have to be recomputed.
+ *
+ * This class is thread-safe.
+ */
+class KeyValueCache : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param path   File backing the cache. It need not exist yet.
+     */
+    explicit KeyValueCache(const boost::filesystem::path &path);
+
+    /**
+     * Look up a previously stored value.
+     *
+     * @param      key    Major key (e.g. a device fingerprint or filename).
+     * @param      field  Minor key naming the value within the major key.
+     * @param[out] value  The stored value, on success.
+     * @retval @c true if a record was found and @a value was written.
+     * @retval @c false otherwise.
+     */
+    bool lookup(const std::string &key, const std::string &field,
+                std::string &value);
+
+    /**
+     * Record a value, both in memory and in the backing file. Failure to
+     * write the file is logged but not fatal.
+     */
+    void update(const std::string &key, const std::string &field,
+                const std::string &value);
+
+private:
+    typedef std::map<std::pair<std::string, std::string>, std::string> map_type;
+
+    const boost::filesystem::path path;  ///< Backing file
+    boost::mutex mutex;                  ///< Protects @ref entries and @ref loaded
+    map_type entries;                    ///< In-memory copy of the records
+    bool loaded;                         ///< Whether the file has been parsed yet
+
+    /// Parse the backing file into @ref entries. Caller must hold @ref mutex.
+    void load();
+};
+
+#endif /* !KEYVALUE_CACHE_H */
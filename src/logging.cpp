@@ -24,12 +24,28 @@
  * Information logging support.
  */
 
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
 #include <ostream>
 #include <iostream>
+#include <streambuf>
+#include <string>
 #include <cassert>
 #include <boost/iostreams/device/null.hpp>
 #include <boost/iostreams/stream.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
+#include <boost/smart_ptr/make_shared.hpp>
+#include <boost/bind.hpp>
 #include "logging.h"
+#include "work_queue.h"
+#include "thread_name.h"
 
 using namespace std;
 
@@ -39,6 +55,160 @@ namespace Log
 namespace detail
 {
 
+namespace
+{
+
+/// One queued write: text destined for a specific stream.
+struct Record
+{
+    std::ostream *out;  ///< Target stream (@c NULL for a flush marker)
+    std::string text;   ///< Text to write
+    bool *done;         ///< For flush markers: set when the marker is reached
+};
+
+/**
+ * Set once the writer's destructor has run. After that point records are
+ * written synchronously, so that messages produced during static destruction
+ * (when only one thread should remain) are not lost.
+ */
+bool writerStopped = false;
+
+/**
+ * Background thread that owns all writes to the log streams. Producers hand
+ * over complete records with a lock-free queue push, so even heavy debug
+ * output does not serialize the worker threads on terminal or file I/O.
+ */
+class Writer
+{
+private:
+    LowContentionWorkQueue<boost::shared_ptr<Record> > queue;
+    boost::mutex flushMutex;            ///< Protects waking of flushers
+    boost::condition_variable flushCondition;
+    boost::thread thread;
+
+    /// Thread procedure: drain records until stopped.
+    void run()
+    {
+        thread_set_name("log");
+        while (boost::shared_ptr<Record> record = queue.pop())
+        {
+            if (record->out == NULL)
+            {
+                boost::lock_guard<boost::mutex> lock(flushMutex);
+                *record->done = true;
+                flushCondition.notify_all();
+            }
+            else
+                *record->out << record->text;
+        }
+    }
+
+public:
+    /* The queue must ignore cancellation: a cancelled run is reported
+     * through the log while it is torn down.
+     */
+    Writer() : queue(false), thread(boost::bind(&Writer::run, this))
+    {
+    }
+
+    ~Writer()
+    {
+        queue.stop();
+        thread.join();
+        writerStopped = true;
+    }
+
+    void write(std::ostream &out, const std::string &text)
+    {
+        boost::shared_ptr<Record> record = boost::make_shared<Record>();
+        record->out = &out;
+        record->text = text;
+        record->done = NULL;
+        queue.push(record);
+    }
+
+    void flush()
+    {
+        bool done = false;
+        boost::shared_ptr<Record> record = boost::make_shared<Record>();
+        record->out = NULL;
+        record->done = &done;
+        queue.push(record);
+        boost::unique_lock<boost::mutex> lock(flushMutex);
+        while (!done)
+            flushCondition.wait(lock);
+    }
+};
+
+Writer &getWriter()
+{
+    static Writer writer;
+    return writer;
+}
+
+/**
+ * Stream buffer that accumulates characters in a per-thread line buffer and
+ * queues each complete line to the background writer.
+ */
+class AsyncBuf : public std::streambuf
+{
+private:
+    std::ostream &target;  ///< Stream the writer thread will write to
+    std::string line;      ///< Partial line accumulated by this thread
+
+protected:
+    virtual int_type overflow(int_type c)
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            const char ch = traits_type::to_char_type(c);
+            line += ch;
+            if (ch == '\n')
+            {
+                asyncWrite(target, line);
+                line.clear();
+            }
+        }
+        return traits_type::not_eof(c);
+    }
+
+    virtual int sync()
+    {
+        if (!line.empty())
+        {
+            asyncWrite(target, line);
+            line.clear();
+        }
+        return 0;
+    }
+
+public:
+    explicit AsyncBuf(std::ostream &target) : target(target)
+    {
+    }
+
+    ~AsyncBuf()
+    {
+        sync();
+    }
+};
+
+/// Per-thread asynchronous stream wrapping @c std::cerr.
+struct ThreadStream
+{
+    AsyncBuf buf;
+    std::ostream stream;
+
+    explicit ThreadStream(std::ostream &target) : buf(target), stream(&buf)
+    {
+    }
+};
+
+/// Per-thread streams, destroyed (flushing any partial line) on thread exit.
+boost::thread_specific_ptr<ThreadStream> threadStream;
+
+} // anonymous namespace
+
 LogArray::LogArray(Level minLevel) : minLevel(minLevel) {}
 
 ostream &LogArray::operator[](Level level)
@@ -46,7 +216,15 @@ ostream &LogArray::operator[](Level level)
     static boost::iostreams::null_sink nullSink;
     static boost::iostreams::stream<boost::iostreams::null_sink> nullStream(nullSink);
     if (level >= minLevel)
-        return cerr;
+    {
+        ThreadStream *ts = threadStream.get();
+        if (ts == NULL)
+        {
+            ts = new ThreadStream(cerr);
+            threadStream.reset(ts);
+        }
+        return ts->stream;
+    }
     else
         return nullStream;
 }
@@ -58,6 +236,20 @@ void LogArray::setLevel(Level minLevel)
 
 } // namespace detail
 
+void asyncWrite(std::ostream &out, const std::string &text)
+{
+    if (detail::writerStopped)
+        out << text;
+    else
+        detail::getWriter().write(out, text);
+}
+
+void asyncFlush()
+{
+    if (!detail::writerStopped)
+        detail::getWriter().flush();
+}
+
 detail::LogArray log;
 
 } // namespace Log
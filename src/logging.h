@@ -28,6 +28,7 @@
 #define MINIMLS_LOGGING_H
 
 #include <iosfwd>
+#include <string>
 
 namespace Log
 {
@@ -50,6 +51,17 @@ private:
 public:
     explicit LogArray(Level minLevel = warn);
     void setLevel(Level minLevel);
+
+    /**
+     * Obtain a stream for messages at @a level. Messages below the current
+     * level are discarded. Enabled messages are gathered in a per-thread
+     * buffer and handed to a background writer thread one line at a time, so
+     * producing a message costs the caller only in-memory formatting and a
+     * lock-free queue push; the actual write to the terminal happens
+     * asynchronously. Lines from different threads can therefore no longer
+     * interleave mid-line, but a message only becomes visible once its
+     * terminating newline has been written.
+     */
     std::ostream &operator[](Level level);
 };
 
@@ -57,6 +69,27 @@ public:
 
 extern detail::LogArray log;
 
+/**
+ * Queue @a text to be written to @a out by the background writer thread.
+ * Records for the same stream are written in the order they were queued from
+ * any one thread. This is used internally by @ref detail::LogArray, and by
+ * other writers of diagnostic streams (such as @ref Timeplot) that want to
+ * keep file I/O off their callers' threads. The caller must ensure that @a
+ * out remains valid until the writer thread shuts down during static
+ * destruction (streams with static storage duration qualify).
+ *
+ * This function is thread-safe. After the writer thread has shut down it
+ * degrades to writing synchronously.
+ */
+void asyncWrite(std::ostream &out, const std::string &text);
+
+/**
+ * Block until every record queued by @ref asyncWrite (or via @ref log)
+ * before this call has been written. Note that this does not flush any
+ * partial line buffered by the calling thread.
+ */
+void asyncFlush();
+
 } // namespace Log
 
 #endif /* MINIMLS_LOGGING_H */
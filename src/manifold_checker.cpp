@@ -0,0 +1,139 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Streaming verification that the output mesh is edge-manifold.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <CL/cl.h>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <boost/array.hpp>
+#include "tr1_cstdint.h"
+#include "manifold_checker.h"
+#include "mesh.h"
+#include "statistics.h"
+#include "logging.h"
+
+ManifoldChecker::ManifoldChecker()
+    : externalEdges("mem.manifold.externalEdges"),
+    localEdges("mem.manifold.localEdges")
+{
+}
+
+void ManifoldChecker::countEdge(EdgeCount &count, bool forward)
+{
+    std::tr1::uint16_t &c = forward ? count.forward : count.backward;
+    if (c != std::numeric_limits<std::tr1::uint16_t>::max())
+        c++;
+}
+
+void ManifoldChecker::classifyEdge(const EdgeCount &count, Summary &summary)
+{
+    unsigned int total = count.forward + count.backward;
+    if (total > 2 || count.forward > 1 || count.backward > 1)
+        summary.nonManifoldEdges++;
+    else if (total == 1)
+        summary.boundaryEdges++;
+}
+
+void ManifoldChecker::add(const HostKeyMesh &mesh)
+{
+    const std::size_t numInternal = mesh.numInternalVertices();
+
+    localEdges.clear();
+    for (std::size_t i = 0; i < mesh.numTriangles(); i++)
+    {
+        const boost::array<cl_uint, 3> &triangle = mesh.triangles[i];
+        if (triangle[0] == triangle[1]
+            || triangle[1] == triangle[2]
+            || triangle[2] == triangle[0])
+        {
+            localSummary.degenerateTriangles++;
+            continue;
+        }
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            const cl_uint u = triangle[j];
+            const cl_uint v = triangle[(j + 1) % 3];
+            if (u >= numInternal && v >= numInternal)
+            {
+                const cl_ulong ku = mesh.vertexKeys[u - numInternal];
+                const cl_ulong kv = mesh.vertexKeys[v - numInternal];
+                external_edge_type edge(std::min(ku, kv), std::max(ku, kv));
+                countEdge(externalEdges[edge], ku < kv);
+            }
+            else
+            {
+                const std::tr1::uint64_t edge =
+                    (std::tr1::uint64_t(std::min(u, v)) << 32) | std::max(u, v);
+                countEdge(localEdges[edge], u < v);
+            }
+        }
+    }
+
+    /* Edges with an internal endpoint cannot recur in a later block, so they
+     * can be classified now and the per-block memory reclaimed.
+     */
+    for (local_edge_map_type::const_iterator i = localEdges.begin(); i != localEdges.end(); ++i)
+        classifyEdge(i->second, localSummary);
+}
+
+ManifoldChecker::Summary ManifoldChecker::summarize() const
+{
+    Summary summary = localSummary;
+    for (external_edge_map_type::const_iterator i = externalEdges.begin();
+         i != externalEdges.end(); ++i)
+        classifyEdge(i->second, summary);
+    return summary;
+}
+
+void ManifoldChecker::report() const
+{
+    const Summary summary = summarize();
+    Statistics::getStatistic<Statistics::Counter>("manifold.edges.nonmanifold")
+        .add(summary.nonManifoldEdges);
+    Statistics::getStatistic<Statistics::Counter>("manifold.edges.boundary")
+        .add(summary.boundaryEdges);
+    Statistics::getStatistic<Statistics::Counter>("manifold.triangles.degenerate")
+        .add(summary.degenerateTriangles);
+    if (summary.nonManifoldEdges > 0 || summary.degenerateTriangles > 0)
+    {
+        Log::log[Log::warn] << "Warning: output is not manifold: "
+            << summary.nonManifoldEdges << " non-manifold edge(s), "
+            << summary.degenerateTriangles << " degenerate triangle(s)\n";
+    }
+    else
+    {
+        Log::log[Log::info] << "Output is edge-manifold with "
+            << summary.boundaryEdges << " boundary edge(s)\n";
+    }
+}
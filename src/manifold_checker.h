@@ -0,0 +1,140 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Streaming verification that the output mesh is edge-manifold.
+ */
+
+#ifndef MANIFOLD_CHECKER_H
+#define MANIFOLD_CHECKER_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <CL/cl.h>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include <boost/functional/hash.hpp>
+#include "tr1_cstdint.h"
+#include "mesh.h"
+#include "allocator.h"
+
+/**
+ * Streaming check that a mesh assembled from blocks is an oriented manifold
+ * with boundary, along its edges. Blocks are fed in one at a time as they
+ * come off the device, so the check runs at pipeline speed instead of
+ * requiring the whole mesh to be loaded afterwards (contrast
+ * @c extras/plymanifold.cpp).
+ *
+ * Edges whose endpoints are both internal to a block, or that join an
+ * internal vertex to an external one, can only occur within that block and
+ * are checked immediately using block-local indices. Edges joining two
+ * external vertices may be shared between blocks and chunks; their use
+ * counts are accumulated by welded vertex key and reconciled in @ref
+ * report.
+ *
+ * The check covers edge conditions only: every undirected edge must be used
+ * by at most two triangles, and when used twice the uses must traverse it
+ * in opposite directions (consistent orientation). Degenerate triangles
+ * (with a repeated vertex) are also detected. The stricter vertex condition
+ * (the triangles around each vertex forming a single fan) is not checked,
+ * as it cannot be evaluated without global per-vertex state.
+ *
+ * When several ranks each run a checker (as in the MPI binary), reported
+ * violations are always genuine, but an edge whose two uses land on
+ * different ranks is indistinguishable from a boundary edge, so boundary
+ * counts are per-rank approximations and duplicated uses split across ranks
+ * go undetected.
+ *
+ * This class is not thread-safe.
+ */
+class ManifoldChecker : public boost::noncopyable
+{
+public:
+    /// Aggregated results of the check
+    struct Summary
+    {
+        std::tr1::uint64_t nonManifoldEdges;     ///< Edges over-used or inconsistently oriented
+        std::tr1::uint64_t boundaryEdges;        ///< Edges used by exactly one triangle
+        std::tr1::uint64_t degenerateTriangles;  ///< Triangles with a repeated vertex
+
+        Summary() : nonManifoldEdges(0), boundaryEdges(0), degenerateTriangles(0) {}
+    };
+
+    ManifoldChecker();
+
+    /**
+     * Accumulate the edges of one block of output. Only the triangles and
+     * vertex keys of @a mesh are examined; the vertex positions need not be
+     * valid yet.
+     */
+    void add(const HostKeyMesh &mesh);
+
+    /**
+     * Reconcile the edges shared between blocks and compute the results.
+     * This may be called at any point, but the results are only final once
+     * all blocks have been added.
+     */
+    Summary summarize() const;
+
+    /**
+     * Call @ref summarize, record the results in statistics
+     * (<tt>manifold.*</tt>) and log a warning if the mesh failed the check.
+     */
+    void report() const;
+
+private:
+    /// Saturating use counts for an undirected edge, one per direction
+    struct EdgeCount
+    {
+        std::tr1::uint16_t forward;    ///< Uses from lower to higher endpoint
+        std::tr1::uint16_t backward;   ///< Uses from higher to lower endpoint
+
+        EdgeCount() : forward(0), backward(0) {}
+    };
+
+    /// Undirected edge between two external vertices, lower key first
+    typedef std::pair<cl_ulong, cl_ulong> external_edge_type;
+    typedef Statistics::Container::unordered_map<
+        external_edge_type, EdgeCount, boost::hash<external_edge_type> > external_edge_map_type;
+    /// Block-local edges, packed as (lower index << 32) | higher index
+    typedef Statistics::Container::unordered_map<std::tr1::uint64_t, EdgeCount> local_edge_map_type;
+
+    /// Record one directed use of an edge, saturating the counters
+    static void countEdge(EdgeCount &count, bool forward);
+    /// Classify one fully-counted edge into @a summary
+    static void classifyEdge(const EdgeCount &count, Summary &summary);
+
+    /// Use counts for edges between external vertices, across all blocks
+    external_edge_map_type externalEdges;
+    /// Use counts for the current block's other edges (cleared per block)
+    local_edge_map_type localEdges;
+    /// Results already determined from completed blocks
+    Summary localSummary;
+};
+
+#endif /* !MANIFOLD_CHECKER_H */
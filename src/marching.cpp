@@ -38,15 +38,70 @@
 #include <cassert>
 #include <cmath>
 #include <limits>
+#include <map>
+#include <string>
+#include <boost/lexical_cast.hpp>
 #include "tr1_cstdint.h"
 #include "clh.h"
 #include "marching.h"
 #include "grid.h"
 #include "errors.h"
+#include "logging.h"
 #include "statistics.h"
 #include "statistics_cl.h"
+#include "timer.h"
 #include "misc.h"
 
+bool Marching::distanceHalf = false;
+
+void Marching::setDistanceHalf(bool enable)
+{
+    distanceHalf = enable;
+}
+
+bool Marching::getDistanceHalf()
+{
+    return distanceHalf;
+}
+
+namespace
+{
+
+/**
+ * Pick the image format for the signed distance images, honouring
+ * @ref Marching::setDistanceHalf but falling back to single precision if
+ * the device cannot do read-write half-precision images.
+ *
+ * Neither format is in the minimum set an OpenCL implementation must
+ * provide, so the fallback is checked as well, turning an otherwise obscure
+ * failure from @c clCreateImage2D into a meaningful error.
+ *
+ * @throw CLH::invalid_device if no suitable format is supported.
+ */
+static cl::ImageFormat chooseDistanceFormat(const cl::Context &context, const cl::Device &device)
+{
+    std::vector<cl::ImageFormat> formats;
+    context.getSupportedImageFormats(CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D, &formats);
+
+    if (Marching::getDistanceHalf())
+    {
+        for (std::size_t i = 0; i < formats.size(); i++)
+            if (formats[i].image_channel_order == CL_R
+                && formats[i].image_channel_data_type == CL_HALF_FLOAT)
+                return formats[i];
+        Log::log[Log::warn]
+            << "Half-precision images are not supported by the device; "
+            << "using single precision for the distance field\n";
+    }
+    for (std::size_t i = 0; i < formats.size(); i++)
+        if (formats[i].image_channel_order == CL_R
+            && formats[i].image_channel_data_type == CL_FLOAT)
+            return formats[i];
+    throw CLH::invalid_device(device, "single-channel floating-point images are not supported");
+}
+
+} // anonymous namespace
+
 const unsigned char Marching::edgeIndices[NUM_EDGES][2] =
 {
     {0, 1},
@@ -285,8 +340,10 @@ CLH::ResourceUsage Marching::resourceUsage(
     CLH::ResourceUsage ans;
     // Keep this in sync with the actual allocations below
 
-    // image = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT), imageWidth, imageHeight * (maxSwathe + 1));
-    ans.addImage("distances", imageWidth, imageHeight * (maxSwathe + 1), sizeof(cl_float));
+    // images[i] = cl::Image2D(context, CL_MEM_READ_WRITE, chooseDistanceFormat(context, device), imageWidth, imageHeight * (maxSwathe + 1));
+    const std::size_t distanceBytes = distanceHalf ? sizeof(cl_half) : sizeof(cl_float);
+    for (int i = 0; i < 2; i++)
+        ans.addImage("distances", imageWidth, imageHeight * (maxSwathe + 1), distanceBytes);
 
     // cells = cl::Buffer(context, CL_MEM_READ_WRITE, swatheCells * sizeof(cl_uint3));
     ans.addBuffer("cells", swatheCells * sizeof(cl_uint3));
@@ -294,6 +351,16 @@ CLH::ResourceUsage Marching::resourceUsage(
     // numOccupied = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
     ans.addBuffer("numOccupied", sizeof(cl_uint));
 
+    const std::tr1::uint64_t maxTiles =
+        divUp(maxWidth - 1, Grid::size_type(TILE_SIZE))
+        * divUp(maxHeight - 1, Grid::size_type(TILE_SIZE))
+        * maxSwathe;
+    // tiles = cl::Buffer(context, CL_MEM_READ_WRITE, maxTiles * sizeof(cl_uint3));
+    ans.addBuffer("tiles", maxTiles * sizeof(cl_uint3));
+
+    // numTiles = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    ans.addBuffer("numTiles", sizeof(cl_uint));
+
     // viHistogram = cl::Buffer(context, CL_MEM_READ_WRITE, maxDepth * sizeof(cl_uint2));
     ans.addBuffer("viHistogram", maxDepth * sizeof(cl_uint2));
 
@@ -339,6 +406,7 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
                    const Grid::size_type alignment[3])
 :
     maxWidth(maxWidth), maxHeight(maxHeight), maxDepth(maxDepth),
+    genTilesKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.marching.genTiles.time")),
     genOccupiedKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.marching.genOccupied.time")),
     generateElementsKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.marching.generateElements.time")),
     countUniqueVerticesKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.marching.countUniqueVertices.time")),
@@ -350,6 +418,7 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     overflowStat(Statistics::getStatistic<Statistics::Counter>("marching.overflow")),
     nonemptyStat(Statistics::getStatistic<Statistics::Variable>("marching.slices.nonempty")),
     shipoutsStat(Statistics::getStatistic<Statistics::Variable>("marching.shipouts")),
+    swatheStat(Statistics::getStatistic<Statistics::Variable>("marching.swathe.slices")),
     scanUint(context, device, clogs::TYPE_UINT),
     scanElements(context, device, clogs::Type(clogs::TYPE_UINT, 2)),
     sortVertices(context, device, clogs::TYPE_ULONG, clogs::Type(clogs::TYPE_FLOAT, 4)),
@@ -365,6 +434,12 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     Grid::size_type imageWidth = roundUp(maxWidth, alignment[0]);
     Grid::size_type imageHeight = roundUp(maxHeight, alignment[1]);
     this->maxSwathe = std::min(maxSwathe, maxDepth) / alignment[2] * alignment[2];
+    swatheBudget = this->maxSwathe;
+    sliceVertices = 0.0;
+    sliceIndices = 0.0;
+    timeSlice = 0.0;
+    timeSliceBudget = this->maxSwathe;
+    sliceRate = 0.0;
 
     scanUint.setEventCallback(
         &Statistics::timeEventCallback,
@@ -377,8 +452,10 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
         &Statistics::getStatistic<Statistics::Variable>("kernel.marching.sortVertices.time"));
 
     makeTables(context);
-    image = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT),
-                        imageWidth, imageHeight * (maxSwathe + 1));
+    const cl::ImageFormat distanceFormat = chooseDistanceFormat(context, device);
+    for (int i = 0; i < 2; i++)
+        images[i] = cl::Image2D(context, CL_MEM_READ_WRITE, distanceFormat,
+                                imageWidth, imageHeight * (maxSwathe + 1));
     zStride = imageHeight;
 
     const std::size_t sliceCells = (maxWidth - 1) * (maxHeight - 1);
@@ -387,9 +464,16 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     vertexSpace = meshCells * MAX_CELL_VERTICES;
     indexSpace = meshCells * MAX_CELL_INDICES;
 
+    const std::size_t maxTiles =
+        divUp(maxWidth - 1, Grid::size_type(TILE_SIZE))
+        * divUp(maxHeight - 1, Grid::size_type(TILE_SIZE))
+        * maxSwathe;
+
     // If these are updated, also update deviceMemory
     cells = cl::Buffer(context, CL_MEM_READ_WRITE, swatheCells * sizeof(cl_uint3));
     numOccupied = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    tiles = cl::Buffer(context, CL_MEM_READ_WRITE, maxTiles * sizeof(cl_uint3));
+    numTiles = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
     viHistogram = cl::Buffer(context, CL_MEM_READ_WRITE, maxDepth * sizeof(cl_uint2));
     viCount = cl::Buffer(context, CL_MEM_READ_WRITE, swatheCells * sizeof(cl_uint2));
     vertexUnique = cl::Buffer(context, CL_MEM_READ_WRITE, (vertexSpace + 1) * sizeof(cl_uint));
@@ -404,7 +488,35 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     firstExternal = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
     sortVertices.setTemporaryBuffers(weldedVertices, weldedVertexKeys);
 
-    cl::Program program = CLH::build(context, std::vector<cl::Device>(1, device), "kernels/marching.cl");
+    /* Decide whether the compacted vertex keys can be read back in 32-bit
+     * block-relative form. The .1 fixed-point coordinates within a block are
+     * at most 2 * (dimension - 1), so count the bits needed per axis and use
+     * the compact form whenever the three fields fit in 32 bits together.
+     */
+    const Grid::size_type maxCoord[3] =
+    {
+        2 * (maxWidth - 1), 2 * (maxHeight - 1), 2 * (maxDepth - 1)
+    };
+    unsigned int totalKeyBits = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        compactKeyBits[i] = 1;
+        while ((Grid::size_type(1) << compactKeyBits[i]) <= maxCoord[i])
+            compactKeyBits[i]++;
+        totalKeyBits += compactKeyBits[i];
+    }
+    compactKeys = totalKeyBits <= 32;
+
+    std::map<std::string, std::string> defines;
+    if (compactKeys)
+    {
+        defines["COMPACT_KEYS"] = "1";
+        defines["COMPACT_KEY_X_BITS"] = boost::lexical_cast<std::string>(compactKeyBits[0]);
+        defines["COMPACT_KEY_Y_BITS"] = boost::lexical_cast<std::string>(compactKeyBits[1]);
+    }
+
+    cl::Program program = CLH::build(context, std::vector<cl::Device>(1, device), "kernels/marching.cl", defines);
+    genTilesKernel = cl::Kernel(program, "genTiles");
     genOccupiedKernel = cl::Kernel(program, "genOccupied");
     generateElementsKernel = cl::Kernel(program, "generateElements");
     countUniqueVerticesKernel = cl::Kernel(program, "countUniqueVertices");
@@ -413,18 +525,22 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     copySliceKernel = cl::Kernel(program, "copySlice");
 
     // Set up kernel arguments that never change.
+    genTilesKernel.setArg(0, tiles);
+    genTilesKernel.setArg(1, numTiles);
+
     genOccupiedKernel.setArg(0, cells);
     genOccupiedKernel.setArg(1, viCount);
     genOccupiedKernel.setArg(2, numOccupied);
     genOccupiedKernel.setArg(3, viHistogram);
     genOccupiedKernel.setArg(7, countTable);
+    genOccupiedKernel.setArg(8, tiles);
+    genOccupiedKernel.setArg(9, numTiles);
 
     generateElementsKernel.setArg(0, unweldedVertices);
     generateElementsKernel.setArg(1, unweldedVertexKeys);
     generateElementsKernel.setArg(2, indices);
     generateElementsKernel.setArg(3, viCount);
     generateElementsKernel.setArg(4, cells);
-    generateElementsKernel.setArg(5, image);
     generateElementsKernel.setArg(6, startTable);
     generateElementsKernel.setArg(7, dataTable);
     generateElementsKernel.setArg(8, keyTable);
@@ -439,14 +555,51 @@ Marching::Marching(const cl::Context &context, const cl::Device &device,
     compactVerticesKernel.setArg(4, vertexUnique);
     compactVerticesKernel.setArg(5, unweldedVertices);
     compactVerticesKernel.setArg(6, unweldedVertexKeys);
+    setScaleBias(1.0f, 0.0f, 0.0f, 0.0f);
 
     reindexKernel.setArg(0, indices);
     reindexKernel.setArg(1, indexRemap);
 }
 
+void Marching::setScaleBias(float scale, float x, float y, float z)
+{
+    cl_float4 scaleBias;
+    scaleBias.s[0] = x;
+    scaleBias.s[1] = y;
+    scaleBias.s[2] = z;
+    scaleBias.s[3] = scale;
+    compactVerticesKernel.setArg(9, scaleBias);
+}
+
+void Marching::setScaleBias(const Grid &grid)
+{
+    cl_float4 scaleBias;
+    grid.getVertex(0, 0, 0, scaleBias.s);
+    /* Fold the world offset of a rebased input back into the bias, so the
+     * emitted vertices land in the original (e.g. georeferenced) frame.
+     * The offset has whole-unit components, so the only rounding is the
+     * final narrowing to float that an unrebased run would have anyway.
+     */
+    const double *worldOffset = grid.getWorldOffset();
+    for (unsigned int i = 0; i < 3; i++)
+        scaleBias.s[i] = float(scaleBias.s[i] + worldOffset[i]);
+    scaleBias.s[3] = grid.getSpacing();
+    compactVerticesKernel.setArg(9, scaleBias);
+}
+
+void Marching::setTimeSlice(double seconds)
+{
+    MLSGPU_ASSERT(seconds >= 0.0, std::invalid_argument);
+    timeSlice = seconds;
+    // Start from one slice and let the measurements grow the budget
+    timeSliceBudget = (timeSlice > 0.0) ? 1 : maxSwathe;
+    sliceRate = 0.0;
+}
+
 void Marching::copySlice(
     const cl::CommandQueue &queue,
-    const cl::Image2D &image,
+    const cl::Image2D &srcImage,
+    const cl::Image2D &trgImage,
     Grid::size_type src,
     Grid::size_type trg,
     const ImageParams &params,
@@ -467,7 +620,7 @@ void Marching::copySlice(
     try
     {
         cl::Event last;
-        queue.enqueueCopyImage(image, image, srcOrigin, trgOrigin, region, events, &last);
+        queue.enqueueCopyImage(srcImage, trgImage, srcOrigin, trgOrigin, region, events, &last);
         Statistics::timeEvent(last, copySliceTime);
         if (event != NULL)
             *event = last;
@@ -483,8 +636,8 @@ void Marching::copySlice(
         offset.s[0] = (cl_int) trgOrigin[0] - (cl_int) srcOrigin[0];
         offset.s[1] = (cl_int) trgOrigin[1] - (cl_int) srcOrigin[1];
 
-        copySliceKernel.setArg(0, image);
-        copySliceKernel.setArg(1, image);
+        copySliceKernel.setArg(0, srcImage);
+        copySliceKernel.setArg(1, trgImage);
         copySliceKernel.setArg(2, offset);
         CLH::enqueueNDRangeKernelSplit(
             queue,
@@ -497,19 +650,26 @@ void Marching::copySlice(
     }
 }
 
-std::size_t Marching::generateCells(
+void Marching::startGenerateCells(
     const cl::CommandQueue &queue,
+    const cl::Image2D &image,
     const Swathe &swathe,
-    const std::vector<cl::Event> *events)
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
 {
     const std::size_t viOffset = swathe.zFirst * sizeof(cl_uint2);
     const std::size_t viSize = (swathe.zLast - swathe.zFirst) * sizeof(cl_uint2);
     cl::Event last, last2;
 
+    cl::Event last3;
+
     readback->compacted = 0;
     queue.enqueueWriteBuffer(numOccupied, CL_FALSE, 0, sizeof(cl_uint),
                              &readback->compacted, events, &last);
     Statistics::timeEvent(last, zeroTime);
+    queue.enqueueWriteBuffer(numTiles, CL_FALSE, 0, sizeof(cl_uint),
+                             &readback->compacted, events, &last3);
+    Statistics::timeEvent(last3, zeroTime);
 
     std::memset(viReadback.get() + swathe.zFirst, 0, viSize);
     queue.enqueueWriteBuffer(viHistogram, CL_FALSE,
@@ -517,39 +677,86 @@ std::size_t Marching::generateCells(
                              viReadback.get() + swathe.zFirst, events, &last2);
     Statistics::timeEvent(last2, zeroTime);
 
-    std::vector<cl::Event> wait(2);
+    std::vector<cl::Event> wait(3);
     wait[0] = last;
     wait[1] = last2;
+    wait[2] = last3;
+
+    const Grid::size_type tilesX = divUp(swathe.width - 1, Grid::size_type(TILE_SIZE));
+    const Grid::size_type tilesY = divUp(swathe.height - 1, Grid::size_type(TILE_SIZE));
+    const std::size_t tileSlots = std::size_t(tilesX) * tilesY * (swathe.zLast - swathe.zFirst);
+
+    cl_uint2 cellsDim;
+    cellsDim.s[0] = swathe.width - 1;
+    cellsDim.s[1] = swathe.height - 1;
 
+    /* Coarse pass: find the tiles whose samples straddle the isosurface.
+     * The NDRange is padded up to whole tiles; out-of-range work-items
+     * contribute nothing to the occupancy test.
+     */
+    genTilesKernel.setArg(2, image);
+    genTilesKernel.setArg(3, swathe.zStride);
+    genTilesKernel.setArg(4, swathe.zBias);
+    genTilesKernel.setArg(5, cellsDim);
+    genTilesKernel.setArg(6, (cl_uint) swathe.zFirst);
+    CLH::enqueueNDRangeKernel(
+        queue,
+        genTilesKernel,
+        cl::NullRange,
+        cl::NDRange(tilesX * TILE_SIZE, tilesY * TILE_SIZE, swathe.zLast - swathe.zFirst),
+        cl::NDRange(TILE_SIZE, TILE_SIZE, 1),
+        &wait, &last, &genTilesKernelTime);
+
+    wait.resize(1);
+    wait[0] = last;
+
+    /* Fine pass: classify only the cells of candidate tiles. One work-group
+     * is launched per tile slot; groups beyond the compacted tile count exit
+     * immediately, which avoids a host round-trip to size the launch.
+     */
     genOccupiedKernel.setArg(4, image);
     genOccupiedKernel.setArg(5, swathe.zStride);
     genOccupiedKernel.setArg(6, swathe.zBias);
-    // TODO: round image size up to multiple of local work group size,
-    // to avoid extra splits; will only work if combined with NaN padding
-    // though, and also requires the generator to respect the padding.
-    CLH::enqueueNDRangeKernelSplit(
+    genOccupiedKernel.setArg(10, cellsDim);
+    CLH::enqueueNDRangeKernel(
         queue,
         genOccupiedKernel,
-        cl::NDRange(0, 0, swathe.zFirst),
-        cl::NDRange(swathe.width - 1, swathe.height - 1, swathe.zLast - swathe.zFirst),
-        cl::NDRange(16, 16, 1),
+        cl::NullRange,
+        cl::NDRange(tileSlots * (TILE_SIZE * TILE_SIZE)),
+        cl::NDRange(TILE_SIZE * TILE_SIZE),
         &wait, &last, &genOccupiedKernelTime);
 
-    wait.resize(1);
     wait[0] = last;
 
+    std::vector<cl::Event> reads(2);
     queue.enqueueReadBuffer(viHistogram, CL_FALSE, viOffset, viSize,
-                            viReadback.get() + swathe.zFirst, &wait, &last);
-    Statistics::timeEvent(last, readbackTime);
+                            viReadback.get() + swathe.zFirst, &wait, &reads[0]);
+    Statistics::timeEvent(reads[0], readbackTime);
     queue.enqueueReadBuffer(numOccupied, CL_FALSE, 0, sizeof(cl_uint),
                             &readback->compacted,
-                            &wait, &last);
-    Statistics::timeEvent(last, readbackTime);
-    queue.finish();
+                            &wait, &reads[1]);
+    Statistics::timeEvent(reads[1], readbackTime);
+    CLH::enqueueMarkerWithWaitList(queue, &reads, event);
+    queue.flush();
+}
 
+std::size_t Marching::finishGenerateCells(cl::Event &event)
+{
+    event.wait();
     return readback->compacted;
 }
 
+std::size_t Marching::generateCells(
+    const cl::CommandQueue &queue,
+    const cl::Image2D &image,
+    const Swathe &swathe,
+    const std::vector<cl::Event> *events)
+{
+    cl::Event event;
+    startGenerateCells(queue, image, swathe, events, &event);
+    return finishGenerateCells(event);
+}
+
 void Marching::shipOut(const cl::CommandQueue &queue,
                        const cl_uint3 &keyOffset,
                        const cl_uint2 &sizes,
@@ -584,8 +791,10 @@ void Marching::shipOut(const cl::CommandQueue &queue,
     wait[0] = last;
 
     // Start this readback - but we don't immediately need the result.
+    std::vector<cl::Event> reads(2);
     queue.enqueueReadBuffer(vertexUnique, CL_FALSE, sizes.s[0] * sizeof(cl_uint), sizeof(cl_uint),
-                            &readback->numWelded, &wait, NULL);
+                            &readback->numWelded, &wait, &reads[0]);
+    Statistics::timeEvent(reads[0], readbackTime);
 
     // TODO: should we be sorting key/value pairs? The values are going to end up moving
     // twice, and most of them will be eliminated entirely! However, sorting them does
@@ -606,7 +815,8 @@ void Marching::shipOut(const cl::CommandQueue &queue,
     wait[0] = last;
 
     queue.enqueueReadBuffer(firstExternal, CL_FALSE, 0, sizeof(cl_uint),
-                            &readback->firstExternal, &wait, NULL);
+                            &readback->firstExternal, &wait, &reads[1]);
+    Statistics::timeEvent(reads[1], readbackTime);
 
     CLH::enqueueNDRangeKernel(queue,
                               reindexKernel,
@@ -614,12 +824,22 @@ void Marching::shipOut(const cl::CommandQueue &queue,
                               cl::NDRange(sizes.s[1]),
                               cl::NullRange,
                               &wait, &last, &reindexKernelTime);
-    queue.finish(); // wait for readback of numWelded and firstExternal (TODO: overkill)
+
+    /* Only the size readbacks are needed to build the output mesh
+     * descriptor; waiting on their events (rather than a queue finish)
+     * lets the reindex kernel keep running while the host resumes.
+     */
+    queue.flush();
+    cl::Event::waitForEvents(reads);
 
     DeviceKeyMesh outputMesh; // TODO: store buffers in this instead of copying references
     outputMesh.vertices = weldedVertices;
     outputMesh.vertexKeys = weldedVertexKeys;
     outputMesh.triangles = indices;
+    outputMesh.compactKeys = compactKeys;
+    outputMesh.keyBase = keyOffsetL;
+    outputMesh.compactKeyBits[0] = compactKeyBits[0];
+    outputMesh.compactKeyBits[1] = compactKeyBits[1];
     outputMesh.assign(readback->numWelded, sizes.s[1] / 3, readback->firstExternal);
     output(queue, outputMesh, NULL, event);
 }
@@ -627,19 +847,25 @@ void Marching::shipOut(const cl::CommandQueue &queue,
 Grid::size_type Marching::addSlices(
     const cl::CommandQueue &queue,
     const OutputFunctor &output,
+    const cl::Image2D &image,
     const Swathe &swathe,
     const cl_uint3 &keyOffset,
     std::size_t localSize,
     cl_uint2 &offsets, cl_uint &zTop,
     const std::vector<cl::Event> *events,
-    cl::Event *event)
+    cl::Event *event,
+    cl::Event *cellsEvent)
 {
     std::vector<cl::Event> wait;
     cl::Event last;
     Grid::size_type shipOuts = 0;
     cl_uint3 top = { {2 * (swathe.width - 1), 2 * (swathe.height - 1), 2 * zTop} };
 
-    std::size_t compacted = generateCells(queue, swathe, events);
+    std::size_t compacted;
+    if (cellsEvent != NULL)
+        compacted = finishGenerateCells(*cellsEvent);
+    else
+        compacted = generateCells(queue, image, swathe, events);
 
     if (compacted > 0)
     {
@@ -691,7 +917,7 @@ Grid::size_type Marching::addSlices(
                 subSwathe.zLast = subLast;
                 shipOuts += addSlices(
                     queue, output,
-                    subSwathe, keyOffset, localSize,
+                    image, subSwathe, keyOffset, localSize,
                     offsets, zTop,
                     &wait, &last);
                 wait.resize(1);
@@ -742,6 +968,50 @@ Grid::size_type Marching::addSlices(
     return shipOuts;
 }
 
+void Marching::updateSwatheBudget(const Swathe &chunk)
+{
+    const Grid::size_type slices = chunk.zLast - chunk.zFirst;
+    swatheStat.add(slices);
+    if (slices == 0)
+        return;
+
+    cl_uint2 counts = {{ 0, 0 }};
+    for (Grid::size_type i = chunk.zFirst; i < chunk.zLast; i++)
+        for (int j = 0; j < 2; j++)
+            counts.s[j] += viReadback[i].s[j];
+
+    /* Exponentially weighted so that the budget tracks the geometry as the
+     * sweep moves through the bin, without over-reacting to a single chunk.
+     */
+    const double alpha = 0.25;
+    sliceVertices += alpha * (double(counts.s[0]) / slices - sliceVertices);
+    sliceIndices += alpha * (double(counts.s[1]) / slices - sliceIndices);
+
+    double limit = double(maxSwathe);
+    if (sliceVertices > 0.0)
+        limit = std::min(limit, vertexSpace / (2.0 * sliceVertices));
+    if (sliceIndices > 0.0)
+        limit = std::min(limit, indexSpace / (2.0 * sliceIndices));
+    swatheBudget = std::min(maxSwathe, std::max(Grid::size_type(1), Grid::size_type(limit)));
+}
+
+void Marching::updateTimeSliceBudget(Grid::size_type slices, double elapsed)
+{
+    if (slices == 0 || elapsed <= 0.0)
+        return;
+
+    /* The wall time includes host-side overheads and any queued
+     * predecessors, which can only make the estimate conservative
+     * (smaller chunks).
+     */
+    const double alpha = 0.25;
+    const double rate = slices / elapsed;
+    sliceRate = (sliceRate > 0.0) ? sliceRate + alpha * (rate - sliceRate) : rate;
+
+    const double limit = timeSlice * sliceRate;
+    timeSliceBudget = std::min(maxSwathe, std::max(Grid::size_type(1), Grid::size_type(limit)));
+}
+
 void Marching::generate(
     const cl::CommandQueue &queue,
     Generator &generator,
@@ -779,36 +1049,119 @@ void Marching::generate(
     generateElementsKernel.setArg(11, keyOffset);
     generateElementsKernel.setArg(13, CLH_LOCAL(NUM_EDGES * wgsCompacted * sizeof(cl_float3)));
 
+    /* The swathes are processed through a ring of two images so that the
+     * generator and the marching kernels can both stay resident: while the
+     * host blocks on the classification readback for the current swathe, the
+     * device is already computing the next swathe's distance field into the
+     * other image. All ordering is expressed through events; the only
+     * host-side wait per swathe is for the readback itself.
+     */
+    unsigned int cur = 0;               // ring slot holding the current swathe
+    cl::Event genEvent;                 // generator completion for the current swathe
+    cl::Event prevRead;                 // completion of reads from the previous swathe
+    bool havePrevRead = false;
+
+    swathe.zFirst = 0;
+    swathe.zLast = std::min(depth, maxSwathe) - 1;
+    swathe.zBias = cl_int(swathe.zStride);
+    generator.enqueue(queue, images[cur], swathe, &wait, &genEvent);
+
     Grid::size_type shipOuts = 0;
     for (Grid::size_type z = 0; z < depth; z += maxSwathe)
     {
-        swathe.zFirst = z;
-        swathe.zLast = std::min(depth, z + maxSwathe) - 1;
-        swathe.zBias = (1 - cl_int(z)) * cl_int(swathe.zStride);
+        generateElementsKernel.setArg(5, images[cur]);
         generateElementsKernel.setArg(10, swathe.zBias);
 
-        if (z != 0)
+        wait.clear();
+        wait.push_back(genEvent);
+        if (havePrevRead)
+            wait.push_back(prevRead);   // classification reuses cells/viCount
+        cl::Event cellsEvent;
+        const cl::Event imageReady = genEvent; // generator completion for images[cur]
+
+        /* Process the swathe in occupancy-sized chunks. The first chunk's
+         * classification is kicked off immediately so that it overlaps the
+         * generator for the next swathe; any further chunks (dense geometry
+         * only) classify themselves inside addSlices. Sizing the chunks from
+         * the running occupancy estimate avoids classifying a full-height
+         * swathe that is doomed to be re-classified piecewise after
+         * overflowing the mesh buffers, while sparse geometry still gets
+         * full-height launches.
+         */
+        Swathe chunk = swathe;
+        chunk.zLast = std::min(swathe.zLast, swathe.zFirst + std::min(swatheBudget, timeSliceBudget));
+        startGenerateCells(queue, images[cur], chunk, &wait, &cellsEvent);
+
+        const Grid::size_type zNext = z + maxSwathe;
+        Swathe nextSwathe = swathe;
+        if (zNext < depth)
         {
-            // Copy end of previous range to start of current one
-            copySlice(queue, image, maxSwathe, 0, swathe, &wait, &last);
+            const unsigned int nxt = cur ^ 1;
+            nextSwathe.zFirst = zNext;
+            nextSwathe.zLast = std::min(depth, zNext + maxSwathe) - 1;
+            nextSwathe.zBias = (1 - cl_int(zNext)) * cl_int(swathe.zStride);
+
+            // Copy end of current range to start of the next one
+            wait.clear();
+            wait.push_back(genEvent);
+            if (havePrevRead)
+                wait.push_back(prevRead); // previous swathe read from images[nxt]
+            copySlice(queue, images[cur], images[nxt], maxSwathe, 0, nextSwathe, &wait, &last);
             wait.resize(1);
             wait[0] = last;
-        }
-        generator.enqueue(queue, image, swathe, &wait, &last);
-        wait.resize(1);
-        wait[0] = last;
+            generator.enqueue(queue, images[nxt], nextSwathe, &wait, &genEvent);
 
-        if (z > 0)
-            swathe.zFirst--; // Use the copied previous slice as well
+            nextSwathe.zFirst--; // Use the copied previous slice as well
+        }
 
+        wait.clear();
+        Timer chunkTimer;
         shipOuts += addSlices(
             queue, output,
-            swathe, keyOffset,
+            images[cur], chunk, keyOffset,
             wgsCompacted,
             offsets, zTop,
-            &wait, &last);
+            &wait, &last, &cellsEvent);
+        if (timeSlice > 0.0)
+        {
+            /* Wait for the chunk so that the watchdog timer restarts and the
+             * display can schedule, and so that the measurement covers the
+             * chunk's kernels rather than a growing queue of them.
+             */
+            last.wait();
+            updateTimeSliceBudget(chunk.zLast - chunk.zFirst, chunkTimer.getElapsed());
+        }
+        updateSwatheBudget(chunk);
+        prevRead = last;
+        havePrevRead = true;
+
+        while (chunk.zLast < swathe.zLast)
+        {
+            chunk.zFirst = chunk.zLast;
+            chunk.zLast = std::min(swathe.zLast, chunk.zFirst + std::min(swatheBudget, timeSliceBudget));
+            wait.clear();
+            wait.push_back(imageReady);
+            wait.push_back(prevRead);
+            chunkTimer = Timer();
+            shipOuts += addSlices(
+                queue, output,
+                images[cur], chunk, keyOffset,
+                wgsCompacted,
+                offsets, zTop,
+                &wait, &last);
+            if (timeSlice > 0.0)
+            {
+                last.wait();
+                updateTimeSliceBudget(chunk.zLast - chunk.zFirst, chunkTimer.getElapsed());
+            }
+            updateSwatheBudget(chunk);
+            prevRead = last;
+        }
         wait.resize(1);
         wait[0] = last;
+
+        swathe = nextSwathe;
+        cur ^= 1;
     }
 
     if (offsets.s[0] > 0)
@@ -102,6 +102,14 @@ public:
         NUM_CUBES = 256        ///< Number of possible vertex codes for a cube (2^vertices)
     };
     enum
+    {
+        /**
+         * Cells along each side of a tile in the coarse occupancy pass.
+         * This must match @c TILE_X and @c TILE_Y in @c marching.cl.
+         */
+        TILE_SIZE = 16
+    };
+    enum
     {
         NUM_EDGES = 19         ///< Number of edges in each cube
     };
@@ -285,11 +293,63 @@ private:
      */
     Grid::size_type maxWidth, maxHeight, maxDepth;
 
+    /**
+     * Whether @ref compactVerticesKernel emits 32-bit block-relative vertex
+     * keys instead of global 64-bit keys. This is enabled when the .1
+     * fixed-point coordinates for the block dimensions fit in 32 bits in
+     * total, which halves the size of the key readback; the host re-expands
+     * the keys with @ref HostKeyMesh::expandKeys. When the block is too
+     * large, the old 64-bit path is used.
+     */
+    bool compactKeys;
+
+    /**
+     * Bits in the X, Y and Z fields of a compact vertex key. Only meaningful
+     * when @ref compactKeys is true.
+     */
+    unsigned int compactKeyBits[3];
+
     /**
      * The number of slices to process in one go.
      */
     Grid::size_type maxSwathe;
 
+    /**
+     * Adaptive slice budget for classification and triangle generation.
+     * Each generated swathe is processed in chunks of at most this many
+     * slices; @ref updateSwatheBudget adjusts it from the measured per-slice
+     * occupancy so that a chunk is expected to fit the mesh buffers (avoiding
+     * a doomed full-height classification pass in dense regions) while
+     * staying at full height in sparse ones. Always in [1, @ref maxSwathe].
+     */
+    Grid::size_type swatheBudget;
+
+    /**
+     * Exponential moving averages of the per-slice vertex and index counts,
+     * feeding @ref swatheBudget. Zero until the first chunk is measured.
+     */
+    double sliceVertices, sliceIndices;
+
+    /**
+     * Per-chunk time budget in seconds (see @ref setTimeSlice). Zero (the
+     * default) disables time slicing.
+     */
+    double timeSlice;
+
+    /**
+     * Additional slice cap applied to each chunk in time-sliced mode,
+     * adapted by @ref updateTimeSliceBudget so that a chunk's kernel
+     * launches are expected to fit @ref timeSlice. Always in
+     * [1, @ref maxSwathe]; equal to @ref maxSwathe when slicing is disabled.
+     */
+    Grid::size_type timeSliceBudget;
+
+    /**
+     * Exponential moving average of slices processed per second, feeding
+     * @ref timeSliceBudget. Zero until the first chunk is measured.
+     */
+    double sliceRate;
+
     /**
      * Space allocated to hold intermediate vertices and indices.
      */
@@ -346,6 +406,18 @@ private:
      */
     cl::Buffer numOccupied;
 
+    /**
+     * Buffer of uint3 values, indexed by compacted tile ID. They are the
+     * coordinates of tiles that might intersect the isosurface (x and y in
+     * tile units, z an absolute slice index), written by @ref genTiles.
+     */
+    cl::Buffer tiles;
+
+    /**
+     * Buffer containing 1 uint, the number of candidate tiles in @ref tiles.
+     */
+    cl::Buffer numTiles;
+
     /**
      * Number of vertices and indices produced for each slice. Each element
      * is a uint2, and is indexed relative to the local volume.
@@ -404,9 +476,18 @@ private:
     cl::Buffer firstExternal;
 
     /**
-     * The image holding slices of the signed distance function.
+     * Ring of images holding slices of the signed distance function. While
+     * the marching kernels consume one image, the generator fills the other,
+     * so the two stages stay resident on the device without host
+     * synchronisation between swathes.
+     */
+    cl::Image2D images[2];
+
+    /**
+     * Whether the distance images use half-precision storage. See
+     * @ref setDistanceHalf.
      */
-    cl::Image2D image;
+    static bool distanceHalf;
 
     /**
      * The number of y steps between slices in the backing image.
@@ -421,6 +502,7 @@ private:
     cl::Buffer tmpVertexKeys, tmpVertices;
     /** @} */
 
+    cl::Kernel genTilesKernel;              ///< Kernel compiled from @ref genTiles.
     cl::Kernel genOccupiedKernel;           ///< Kernel compiled from @ref genOccupied.
     cl::Kernel generateElementsKernel;      ///< Kernel compiled from @ref generateElements.
     cl::Kernel countUniqueVerticesKernel;   ///< Kernel compiled from @ref countUniqueVertices.
@@ -433,6 +515,7 @@ private:
      * @{
      * Statistics measuring time spent in kernels with corresponding names.
      */
+    Statistics::Variable &genTilesKernelTime;
     Statistics::Variable &genOccupiedKernelTime;
     Statistics::Variable &generateElementsKernelTime;
     Statistics::Variable &countUniqueVerticesKernelTime;
@@ -447,6 +530,7 @@ private:
     Statistics::Counter &overflowStat;      ///< Number of swathe splits
     Statistics::Variable &nonemptyStat;     ///< Number of @ref addSlices calls that add geometry
     Statistics::Variable &shipoutsStat;     ///< Number of calls to @ref shipOut per bin
+    Statistics::Variable &swatheStat;       ///< Slices per processed swathe chunk
 
     clogs::Scan scanUint;                   ///< Scanner to scan @c cl_uint values.
     clogs::Scan scanElements;               ///< Scanner to scan @ref viCount.
@@ -512,6 +596,22 @@ public:
         std::size_t meshMemory,
         const Grid::size_type alignment[3]);
 
+    /**
+     * Select half-precision storage for the signed distance images. The
+     * generator still computes distances in single precision; they are
+     * converted on write and on read by the image hardware, halving the
+     * memory and bandwidth of the largest device allocation. It affects
+     * instances constructed (and estimates made with @ref resourceUsage)
+     * after the call, so it should be set once at startup.
+     *
+     * If the device does not support half-precision images, construction
+     * silently falls back to single precision (with a warning).
+     */
+    static void setDistanceHalf(bool enable);
+
+    /// Returns the value last set with @ref setDistanceHalf
+    static bool getDistanceHalf();
+
     /**
      * The function type to pass to @ref generate for receiving output data.
      * When invoked, this function must enqueue commands to retrieve the data
@@ -567,6 +667,37 @@ public:
              std::size_t meshMemory,
              const Grid::size_type alignment[3]);
 
+    /**
+     * Set a scale-and-bias that transforms the output vertices from grid to
+     * world coordinates: each vertex @a v is replaced by
+     * <code>v * scale + (x, y, z)</code>. The transform is fused into the
+     * vertex welding kernel, so it does not cost a separate pass over the
+     * vertex buffer. The default is the identity transform.
+     *
+     * This must not be called while @ref generate is in progress.
+     */
+    void setScaleBias(float scale, float x, float y, float z);
+
+    /**
+     * Set the scale and bias from a grid, such that grid coordinates are
+     * transformed to world coordinates.
+     *
+     * @see @ref setScaleBias(float, float, float, float)
+     */
+    void setScaleBias(const Grid &grid);
+
+    /**
+     * Bound each processed chunk to roughly @a seconds of device time.
+     * Swathes are then subdivided into chunks of few enough slices that
+     * their kernel launches are expected to fit the budget (measured as the
+     * chunks are processed), and the host waits for each chunk, so that a
+     * display GPU with a driver watchdog gets regular opportunities to
+     * schedule other work. Zero (the default) disables slicing.
+     *
+     * This must not be called while @ref generate is in progress.
+     */
+    void setTimeSlice(double seconds);
+
     /**
      * Generate an isosurface.
      *
@@ -577,7 +708,9 @@ public:
      *
      * The region that is processed is assumed to be at an offset of @a
      * keyOffset within some larger grid. To accommodate this, vertex keys for
-     * external vertices are offset by @a keyOffset. The output vertices are
+     * external vertices are offset by @a keyOffset (when @ref compactKeys is
+     * in effect the offset instead travels out-of-band in the output mesh,
+     * and is applied by @ref HostKeyMesh::expandKeys). The output vertices are
      * also transformed into the global grid coordinate systems using the formula
      * \f$v_{\text{out}} = v_{\text{in}} - \text{keyOffset}.\f$
      * The interpolation is done in a way that guarantees invariance, provided that the
@@ -609,10 +742,11 @@ public:
 
 private:
     /**
-     * Copy one slice of the image to another.
+     * Copy one slice of an image to another image (or the same one).
      *
      * @param queue           Command queue to use for enqueuing work.
-     * @param image           Image to operate on.
+     * @param srcImage        Image to copy from.
+     * @param trgImage        Image to copy to.
      * @param zSrc            Slice number for source.
      * @param zTrg            Slice number for target.
      * @param params          Image parameters.
@@ -624,13 +758,43 @@ private:
      */
     void copySlice(
         const cl::CommandQueue &queue,
-        const cl::Image2D &image,
+        const cl::Image2D &srcImage,
+        const cl::Image2D &trgImage,
         Grid::size_type zSrc,
         Grid::size_type zTrg,
         const ImageParams &params,
         const std::vector<cl::Event> *events,
         cl::Event *event);
 
+    /**
+     * Enqueue the classification work of @ref generateCells without waiting
+     * for the results. The readbacks of the occupied-cell count and the
+     * per-slice histogram are enqueued asynchronously; @a event is signalled
+     * once they have landed, after which @ref finishGenerateCells may be
+     * called. This split allows the caller to enqueue further device work
+     * (such as generating the next swathe's distance field) before blocking.
+     *
+     * @param queue           Command queue to use for enqueuing work.
+     * @param image           Image holding the samples for the swathe.
+     * @param swathe          Swathe of data to process
+     * @param events          Events to wait for before starting (may be @c NULL).
+     * @param[out] event      Event signalled when the readbacks complete.
+     */
+    void startGenerateCells(
+        const cl::CommandQueue &queue,
+        const cl::Image2D &image,
+        const Swathe &swathe,
+        const std::vector<cl::Event> *events,
+        cl::Event *event);
+
+    /**
+     * Wait for the readbacks enqueued by @ref startGenerateCells.
+     *
+     * @param event           Event returned by @ref startGenerateCells.
+     * @return The number of cells that need further processing.
+     */
+    std::size_t finishGenerateCells(cl::Event &event);
+
     /**
      * Determine which cells in a slice need to be processed further,
      * and produce per-cell counts of vertices and indices.
@@ -642,6 +806,7 @@ private:
      * cell, and @ref numOccupied contains the number of cells.
      *
      * @param queue           Command queue to use for enqueuing work.
+     * @param image           Image holding the samples for the swathe.
      * @param swathe          Swathe of data to process
      * @param events          Events to wait for before starting (may be @c NULL).
      *
@@ -652,6 +817,7 @@ private:
      */
     std::size_t generateCells(
         const cl::CommandQueue &queue,
+        const cl::Image2D &image,
         const Swathe &swathe,
         const std::vector<cl::Event> *events);
 
@@ -691,6 +857,7 @@ private:
      *
      * @param queue           Command queue to use for enqueuing work.
      * @param output          Passed to @ref shipOut.
+     * @param image           Image holding the samples for the swathe.
      * @param swathe          The range of slices to process.
      * @param keyOffset       Passed to @ref shipOut.
      * @param localSize       Work group size, matching the dynamic local memory allocation.
@@ -698,6 +865,10 @@ private:
      * @param[in,out] zTop    Z value for corners at top of last shipped-out data
      * @param events          Events to wait for before starting (may be @c NULL).
      * @param[out] event      Event signalled on completion (may be @c NULL).
+     * @param cellsEvent      If non-NULL, the classification for the swathe
+     *                        was already enqueued with @ref startGenerateCells
+     *                        and this is its event; @a events must then cover
+     *                        the same dependencies that were passed to it.
      *
      * @pre
      * - All kernel arguments for @ref generateElements have been set, except for
@@ -706,12 +877,31 @@ private:
     Grid::size_type addSlices(
         const cl::CommandQueue &queue,
         const OutputFunctor &output,
+        const cl::Image2D &image,
         const Swathe &swathe,
         const cl_uint3 &keyOffset,
         std::size_t localSize,
         cl_uint2 &offsets, cl_uint &zTop,
         const std::vector<cl::Event> *events,
-        cl::Event *event);
+        cl::Event *event,
+        cl::Event *cellsEvent = NULL);
+
+    /**
+     * Fold the measured occupancy of a processed chunk into the per-slice
+     * estimates and recompute @ref swatheBudget. The chunk's entries of @ref
+     * viReadback must be valid (i.e. @ref addSlices has completed on it).
+     * The budget is sized so that a chunk of average density half-fills the
+     * mesh buffers, leaving headroom for variance before the exact
+     * histogram-driven subdivision in @ref addSlices has to kick in.
+     */
+    void updateSwatheBudget(const Swathe &chunk);
+
+    /**
+     * Fold a processed chunk's measured wall time into @ref sliceRate and
+     * recompute @ref timeSliceBudget. Only called in time-sliced mode,
+     * after waiting for the chunk's work to complete.
+     */
+    void updateTimeSliceBudget(Grid::size_type slices, double elapsed);
 };
 
 #endif /* !MARCHING_H */
@@ -35,6 +35,7 @@
 #include <CL/cl.hpp>
 #include <vector>
 #include "mesh.h"
+#include "marching.h"
 #include "clh.h"
 #include "errors.h"
 #include "tr1_cstdint.h"
@@ -44,12 +45,14 @@ DeviceKeyMesh::DeviceKeyMesh(
     : MeshSizes(sizes),
     vertices(context, flags, sizes.numVertices() ? sizes.numVertices() * (3 * sizeof(cl_float)) : 1),
     triangles(context, flags, sizes.numTriangles() ? sizes.numTriangles() * (3 * sizeof(cl_uint)) : 1),
-    vertexKeys(context, flags, sizes.numVertices() ? sizes.numVertices() * sizeof(cl_ulong) : 1)
+    vertexKeys(context, flags, sizes.numVertices() ? sizes.numVertices() * sizeof(cl_ulong) : 1),
+    compactKeys(false), keyBase(0)
 {
+    compactKeyBits[0] = compactKeyBits[1] = 0;
 }
 
 HostKeyMesh::HostKeyMesh(void *ptr, const MeshSizes &sizes)
-    : MeshSizes(sizes)
+    : MeshSizes(sizes), compactKeys(false), keyBase(0)
 {
     std::tr1::uintptr_t ptrInt = reinterpret_cast<std::tr1::uintptr_t>(ptr);
     MLSGPU_ASSERT(ptrInt % sizeof(cl_ulong) == 0, std::invalid_argument);
@@ -57,6 +60,32 @@ HostKeyMesh::HostKeyMesh(void *ptr, const MeshSizes &sizes)
     vertexKeys = reinterpret_cast<cl_ulong *>(ptr);
     vertices = reinterpret_cast<boost::array<cl_float, 3> *>(vertexKeys + numExternalVertices());
     triangles = reinterpret_cast<boost::array<cl_uint, 3> *>(vertices + numVertices());
+    compactKeyBits[0] = compactKeyBits[1] = 0;
+}
+
+void HostKeyMesh::expandKeys()
+{
+    if (!compactKeys)
+        return;
+
+    const unsigned int xBits = compactKeyBits[0];
+    const unsigned int yBits = compactKeyBits[1];
+    const cl_uint *in = reinterpret_cast<const cl_uint *>(vertexKeys);
+    /* Backwards so that the 8-byte stores never overwrite 4-byte loads that
+     * are still to come.
+     */
+    for (std::size_t i = numExternalVertices(); i-- > 0; )
+    {
+        const cl_uint packed = in[i];
+        const cl_ulong x = packed & ((cl_uint(1) << xBits) - 1);
+        const cl_ulong y = (packed >> xBits) & ((cl_uint(1) << yBits) - 1);
+        const cl_ulong z = packed >> (xBits + yBits);
+        vertexKeys[i] =
+            ((z << (2 * Marching::KEY_AXIS_BITS))
+             | (y << Marching::KEY_AXIS_BITS)
+             | x) + keyBase;
+    }
+    compactKeys = false;
 }
 
 void enqueueReadMesh(const cl::CommandQueue &queue,
@@ -81,10 +110,15 @@ void enqueueReadMesh(const cl::CommandQueue &queue,
 
     if (vertexKeysEvent != NULL)
     {
+        const std::size_t keySize = dMesh.compactKeys ? sizeof(cl_uint) : sizeof(cl_ulong);
+        hMesh.compactKeys = dMesh.compactKeys;
+        hMesh.keyBase = dMesh.keyBase;
+        hMesh.compactKeyBits[0] = dMesh.compactKeyBits[0];
+        hMesh.compactKeyBits[1] = dMesh.compactKeyBits[1];
         CLH::enqueueReadBuffer(queue,
                                dMesh.vertexKeys, CL_FALSE,
-                               dMesh.numInternalVertices() * sizeof(cl_ulong),
-                               dMesh.numExternalVertices() * sizeof(cl_ulong),
+                               dMesh.numInternalVertices() * keySize,
+                               dMesh.numExternalVertices() * keySize,
                                hMesh.vertexKeys,
                                events, vertexKeysEvent);
         queue.flush();
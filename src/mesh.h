@@ -114,7 +114,19 @@ struct DeviceKeyMesh : public MeshSizes
      */
     cl::Buffer vertexKeys;                 ///< Vertex keys
 
-    DeviceKeyMesh() {}
+    /**
+     * If true, @ref vertexKeys holds 32-bit block-relative keys (@c cl_uint)
+     * rather than global 64-bit keys. See @ref HostKeyMesh::expandKeys for
+     * the layout and how to recover global keys.
+     */
+    bool compactKeys;
+    cl_ulong keyBase;                      ///< Offset to add to expanded keys (only meaningful if @ref compactKeys)
+    unsigned int compactKeyBits[2];        ///< Bits in the X and Y axis fields of a compact key
+
+    DeviceKeyMesh() : compactKeys(false), keyBase(0)
+    {
+        compactKeyBits[0] = compactKeyBits[1] = 0;
+    }
 
     /**
      * Constructor. The buffers are allocated with just enough space to hold
@@ -136,8 +148,21 @@ struct HostKeyMesh : public MeshSizes
     boost::array<cl_uint, 3> *triangles;
     cl_ulong *vertexKeys;
 
+    /**
+     * If true, the key storage currently holds 32-bit block-relative keys
+     * (read back from a @ref DeviceKeyMesh with compact keys) and @ref
+     * expandKeys must be called before @ref vertexKeys is interpreted.
+     */
+    bool compactKeys;
+    cl_ulong keyBase;                      ///< Offset to add to expanded keys (only meaningful if @ref compactKeys)
+    unsigned int compactKeyBits[2];        ///< Bits in the X and Y axis fields of a compact key
+
     HostKeyMesh() :
-        vertices(NULL), triangles(NULL), vertexKeys(NULL) {}
+        vertices(NULL), triangles(NULL), vertexKeys(NULL),
+        compactKeys(false), keyBase(0)
+    {
+        compactKeyBits[0] = compactKeyBits[1] = 0;
+    }
 
     /**
      * Construct from an existing pool of memory.
@@ -145,6 +170,23 @@ struct HostKeyMesh : public MeshSizes
      * @pre @a ptr is @c cl_ulong aligned.
      */
     HostKeyMesh(void *ptr, const MeshSizes &sizes);
+
+    /**
+     * Rewrite compact 32-bit keys as global 64-bit keys, in place.
+     *
+     * A compact key packs the three .1 fixed-point axis fields of a
+     * block-relative vertex key into @ref compactKeyBits[0] bits for X,
+     * @ref compactKeyBits[1] bits for Y and the remaining high bits for Z.
+     * Expansion redistributes the fields into the 64-bit lanes used by @c
+     * marching.cl and adds @ref keyBase to translate to global coordinates.
+     * The expansion runs backwards so that it can operate in place: the key
+     * storage is always allocated at @c cl_ulong size (see @ref
+     * MeshSizes::getHostBytes), with compact keys occupying the front half.
+     *
+     * A no-op if @ref compactKeys is false, so it is safe to call
+     * unconditionally before consuming @ref vertexKeys.
+     */
+    void expandKeys();
 };
 
 /**
@@ -153,6 +195,14 @@ struct HostKeyMesh : public MeshSizes
  * corresponding event (if you want the transfer but don't care about the
  * event, you will need to pass one anyway).
  *
+ * Vertices duplicated within the block have already been welded on the
+ * device (see @ref Marching), so the transfer and the host-side welding in
+ * @ref MesherBase::add only deal with external vertices, which may be
+ * shared with other blocks. Keys are transferred only for those external
+ * vertices. If @a dMesh holds compact keys they are transferred in their
+ * 32-bit form (halving the transfer) and @a hMesh is flagged so that @ref
+ * HostKeyMesh::expandKeys can recover the global keys later.
+ *
  * For each transferred property, the corresponding element of @a hMesh
  * are discarded. Properties that are not transferred as preserved in @a
  * hMesh.
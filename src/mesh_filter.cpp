@@ -65,6 +65,20 @@ void MeshFilterChain::operator()(
     output(queue, *inMesh, events, event);
 }
 
+void MeshFilterChain::addFilter(const boost::shared_ptr<ScaleBiasFilter> &filter)
+{
+    if (tailScaleBias)
+    {
+        const cl_float4 sb = filter->getScaleBias();
+        tailScaleBias->postScaleBias(sb.s[3], sb.s[0], sb.s[1], sb.s[2]);
+    }
+    else
+    {
+        filters.push_back(boost::bind(&ScaleBiasFilter::operator(), filter, _1, _2, _3, _4, _5));
+        tailScaleBias = filter;
+    }
+}
+
 ScaleBiasFilter::ScaleBiasFilter(const cl::Context &context)
     : kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.scaleBias.time"))
 {
@@ -89,6 +103,15 @@ void ScaleBiasFilter::setScaleBias(const Grid &grid)
     kernel.setArg(1, scaleBias);
 }
 
+void ScaleBiasFilter::postScaleBias(float scale, float x, float y, float z)
+{
+    scaleBias.s[0] = scale * scaleBias.s[0] + x;
+    scaleBias.s[1] = scale * scaleBias.s[1] + y;
+    scaleBias.s[2] = scale * scaleBias.s[2] + z;
+    scaleBias.s[3] *= scale;
+    kernel.setArg(1, scaleBias);
+}
+
 void ScaleBiasFilter::operator()(
     const cl::CommandQueue &queue,
     const DeviceKeyMesh &inMesh,
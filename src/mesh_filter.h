@@ -34,12 +34,14 @@
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 #include <boost/ref.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
 #include <vector>
 #include "mesh.h"
 #include "marching.h"
 #include "statistics.h"
 
 class Grid;
+class ScaleBiasFilter;
 
 /**
  * Function for accepting a mesh and transforming it in some way (on the
@@ -65,6 +67,14 @@ typedef boost::function<
 /**
  * Combine several filters with an output functor to create a composite output
  * functor that can be used with @ref Marching.
+ *
+ * The filters run on the device, between mesh generation and the readback
+ * done by the output functor, so adding a filter costs device rather than
+ * host memory bandwidth. Each filter is nevertheless a full pass over the
+ * mesh; to keep the number of passes minimal, consecutive affine vertex
+ * transforms added through the @ref ScaleBiasFilter overload of
+ * @ref addFilter are fused into a single kernel pass by composing their
+ * parameters.
  */
 class MeshFilterChain
 {
@@ -72,6 +82,13 @@ private:
     std::vector<MeshFilter> filters;
     Marching::OutputFunctor output;
 
+    /**
+     * The tail of @ref filters when it is a fusible scale-and-bias pass
+     * (NULL otherwise). Another scale-and-bias filter appended while this is
+     * set is folded into it instead of adding a pass.
+     */
+    boost::shared_ptr<ScaleBiasFilter> tailScaleBias;
+
 public:
     typedef void result_type;
 
@@ -104,8 +121,20 @@ public:
     void addFilter(const MeshFilter &filter)
     {
         filters.push_back(filter);
+        tailScaleBias.reset();
     }
 
+    /**
+     * Append a scale-and-bias filter to the end. If the current tail of the
+     * chain is also a scale-and-bias filter, the two are fused: the tail's
+     * parameters are updated to the composition (see
+     * @ref ScaleBiasFilter::postScaleBias) and @a filter itself is not added,
+     * so the chain still makes a single pass. The parameters are taken at
+     * the time of this call; later changes to @a filter have no effect on a
+     * fused chain.
+     */
+    void addFilter(const boost::shared_ptr<ScaleBiasFilter> &filter);
+
     /**
      * Output functor suitable for use as @ref Marching::OutputFunctor. It applies each of
      * the filters in turn, passing the last output to the output functor provided to the
@@ -158,6 +187,17 @@ public:
      */
     void setScaleBias(const Grid &grid);
 
+    /**
+     * Compose a further scale-and-bias to be applied @em after the current
+     * one, leaving a single transform (and hence a single kernel pass) that
+     * is equivalent to the sequence. This is how @ref MeshFilterChain fuses
+     * adjacent scale-and-bias filters.
+     */
+    void postScaleBias(float scale, float x, float y, float z);
+
+    /// Retrieve the current parameters (scale in w, bias in xyz).
+    cl_float4 getScaleBias() const { return scaleBias; }
+
     /// Filter operation (see @ref MeshFilter).
     void operator()(
         const cl::CommandQueue &queue,
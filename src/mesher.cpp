@@ -43,8 +43,9 @@
 #include <boost/ref.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/exception_ptr.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
-#include <boost/smart_ptr/scoped_array.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
 #include <boost/system/error_code.hpp>
@@ -59,8 +60,10 @@
 #include "tr1_unordered_map.h"
 #include <cassert>
 #include <cstdlib>
+#include <cmath>
 #include <utility>
 #include <iterator>
+#include <algorithm>
 #include <map>
 #include <string>
 #include <ostream>
@@ -77,6 +80,7 @@
 #include "misc.h"
 #include "circular_buffer.h"
 #include "binary_io.h"
+#include "vcache.h"
 
 std::map<std::string, MesherType> MesherTypeWrapper::getNameMap()
 {
@@ -95,6 +99,161 @@ std::string ChunkNamer::operator()(const ChunkId &chunkId) const
     return nameStream.str();
 }
 
+void ShardedChunkNamer::ensureDirectory(const std::string &dir) const
+{
+    boost::unique_lock<boost::mutex> lock(shared->mutex);
+    if (shared->created.insert(dir).second)
+    {
+        /* create_directories is idempotent, so concurrent creation of the
+         * same directory by another process (e.g. an MPI peer) is harmless.
+         */
+        boost::filesystem::create_directories(boost::filesystem::path(dir));
+    }
+}
+
+std::string ShardedChunkNamer::operator()(const ChunkId &chunkId) const
+{
+    const boost::filesystem::path base(baseName);
+    const std::string leaf = base.filename().string();
+
+    std::ostringstream dirStream;
+    dirStream << baseName << ".chunks";
+    for (unsigned int i = 0; i < 2; i++)
+        dirStream << '/' << std::setw(4) << std::setfill('0') << chunkId.coords[i];
+    const std::string dir = dirStream.str();
+    ensureDirectory(dir);
+
+    std::ostringstream nameStream;
+    nameStream << dir << '/' << leaf;
+    for (unsigned int i = 0; i < 3; i++)
+        nameStream << '_' << std::setw(4) << std::setfill('0') << chunkId.coords[i];
+    nameStream << ".ply";
+    return nameStream.str();
+}
+
+/// Magic bytes introducing each frame on a chunk stream (see @ref MesherBase::setChunkStream)
+static const char chunkStreamMagic[8] = {'m', 'l', 's', 'g', 'p', 'u', 'C', '1'};
+
+void MesherBase::streamChunk(const std::string &filename)
+{
+    if (chunkStreamPath.empty())
+        return;
+
+    try
+    {
+        if (!chunkStreamOut)
+        {
+            /* Lazy open: when the path is a FIFO this blocks until the
+             * consumer attaches, which should not happen before there is
+             * anything to send.
+             */
+            chunkStreamOut.reset(new boost::filesystem::ofstream(
+                chunkStreamPath, std::ios::out | std::ios::binary));
+            if (!*chunkStreamOut)
+                throw std::ios::failure("Could not open chunk stream");
+        }
+
+        boost::scoped_ptr<BinaryReader> in(createReader(chunkStreamReaderType));
+        in->open(filename);
+        in->hintSequential();
+
+        const std::tr1::uint32_t nameLen = filename.size();
+        const std::tr1::uint64_t payloadLen = in->size();
+        chunkStreamOut->write(chunkStreamMagic, sizeof(chunkStreamMagic));
+        chunkStreamOut->write(reinterpret_cast<const char *>(&nameLen), sizeof(nameLen));
+        chunkStreamOut->write(filename.data(), nameLen);
+        chunkStreamOut->write(reinterpret_cast<const char *>(&payloadLen), sizeof(payloadLen));
+
+        /* The chunk was written moments ago, so these reads are normally
+         * served from the page cache rather than costing a disk round trip.
+         */
+        const std::size_t bufferSize = 4 * 1024 * 1024;
+        Statistics::Container::PODBuffer<char> buffer("mem.MesherBase::streamChunk", bufferSize);
+        std::tr1::uint64_t offset = 0;
+        while (offset < payloadLen)
+        {
+            const std::size_t n = in->read(buffer.data(), bufferSize, offset);
+            if (n == 0)
+                throw std::ios::failure("Output file shrank while being streamed");
+            chunkStreamOut->write(buffer.data(), n);
+            offset += n;
+        }
+        /* Flush per chunk: the whole point is that the consumer sees each
+         * chunk as soon as it is finalized.
+         */
+        chunkStreamOut->flush();
+        if (!*chunkStreamOut)
+            throw std::ios::failure("Could not write to chunk stream");
+        Statistics::getStatistic<Statistics::Counter>("mesher.streamed.chunks").add();
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_file_name(chunkStreamPath)
+            << boost::errinfo_errno(errno);
+    }
+}
+
+void MesherBase::manifestChunk(
+    const ChunkId &chunkId, const std::string &filename,
+    std::tr1::uint64_t numVertices, std::tr1::uint64_t numTriangles)
+{
+    if (chunkManifestPath.empty())
+        return;
+    MLSGPU_ASSERT(haveChunkGrid, state_error);
+
+    try
+    {
+        if (!chunkManifestOut)
+        {
+            chunkManifestOut.reset(new boost::filesystem::ofstream(chunkManifestPath));
+            if (!*chunkManifestOut)
+                throw std::ios::failure("Could not open chunk manifest");
+            chunkManifestOut->precision(std::numeric_limits<float>::digits10 + 2);
+        }
+
+        /* The bounds are the chunk's nominal cell range, which the vertices
+         * cannot escape (cells on the boundary belong to exactly one chunk,
+         * and welding snaps shared vertices to the same position).
+         */
+        float lower[3], upper[3];
+        Grid::difference_type lo[3], hi[3];
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            const Grid::size_type numCells = chunkGrid.numCells(i);
+            Grid::size_type loCell = 0;
+            Grid::size_type hiCell = numCells;
+            if (chunkCells != 0)
+            {
+                loCell = std::min(chunkId.coords[i] * chunkCells, numCells);
+                hiCell = std::min(loCell + chunkCells, numCells);
+            }
+            lo[i] = loCell;
+            hi[i] = hiCell;
+        }
+        chunkGrid.getVertex(lo[0], lo[1], lo[2], lower);
+        chunkGrid.getVertex(hi[0], hi[1], hi[2], upper);
+
+        *chunkManifestOut
+            << lower[0] << ' ' << lower[1] << ' ' << lower[2] << ' '
+            << upper[0] << ' ' << upper[1] << ' ' << upper[2] << ' '
+            << numVertices << ' ' << numTriangles << ' '
+            << filename << '\n';
+        /* Flush per line, so that the manifest covers every chunk written so
+         * far even if the run is later interrupted.
+         */
+        chunkManifestOut->flush();
+        if (!*chunkManifestOut)
+            throw std::ios::failure("Could not write to chunk manifest");
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_file_name(chunkManifestPath)
+            << boost::errinfo_errno(errno);
+    }
+}
+
 
 OOCMesher::TmpWriterItem::TmpWriterItem()
     : vertices("mem.OOCMesher::TmpWriterItem::vertices"),
@@ -108,48 +267,83 @@ void OOCMesher::TmpWriterWorker::operator()(TmpWriterItem &item)
 {
     Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
     typedef std::pair<std::size_t, std::size_t> range;
-    BOOST_FOREACH(const range &r, item.vertexRanges)
-    {
-        verticesFile.write(reinterpret_cast<char *>(&item.vertices[r.first]),
-                           (r.second - r.first) * sizeof(vertex_type));
-    }
-    BOOST_FOREACH(const range &r, item.triangleRanges)
+    try
     {
-        trianglesFile.write(reinterpret_cast<char *>(&item.triangles[r.first]),
-                            (r.second - r.first) * sizeof(triangle_type));
+        BOOST_FOREACH(const range &r, item.vertexRanges)
+        {
+            const std::size_t bytes = (r.second - r.first) * sizeof(vertex_type);
+            owner.verticesFile->write(&item.vertices[r.first], bytes, owner.verticesOffset);
+            owner.verticesOffset += bytes;
+        }
+        BOOST_FOREACH(const range &r, item.triangleRanges)
+        {
+            const std::size_t bytes = (r.second - r.first) * sizeof(triangle_type);
+            owner.trianglesFile->write(&item.triangles[r.first], bytes, owner.trianglesOffset);
+            owner.trianglesOffset += bytes;
+        }
     }
-    if (!verticesFile || !trianglesFile)
+    catch (std::exception &e)
     {
         Log::log[Log::error] << "Failed while writing temporary files: "
-            << boost::system::errc::make_error_code((boost::system::errc::errc_t) errno).message() << std::endl;
+            << e.what() << std::endl;
         std::exit(1);
     }
 }
 
 OOCMesher::TmpWriterWorkerGroup::TmpWriterWorkerGroup(std::size_t slots)
     : WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>("tmpwriter", 1),
+    verticesOffset(0), trianglesOffset(0), compressed(false),
     itemAllocator("mem.OOCMesher::TmpWriterWorkerGroup::itemAllocator", slots)
 {
-    addWorker(new TmpWriterWorker(*this, verticesFile, trianglesFile));
+    addWorker(new TmpWriterWorker(*this));
     for (std::size_t i = 0; i < itemAllocator.size(); i++)
         itemPool.push_back(boost::make_shared<TmpWriterItem>());
 }
 
-void OOCMesher::TmpWriterWorkerGroup::start()
+void OOCMesher::TmpWriterWorkerGroup::start(bool compressed)
+{
+#if HAVE_COMPRESS2
+    this->compressed = compressed;
+#else
+    (void) compressed;
+    this->compressed = false;
+#endif
+    const WriterType writerType = this->compressed ? COMPRESSED_WRITER : SYSCALL_WRITER;
+    createTmpPath(verticesPath);
+    verticesFile.reset(createWriter(writerType));
+    verticesFile->open(verticesPath);
+    createTmpPath(trianglesPath);
+    trianglesFile.reset(createWriter(writerType));
+    trianglesFile->open(trianglesPath);
+    verticesOffset = 0;
+    trianglesOffset = 0;
+    WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>::start();
+}
+
+void OOCMesher::TmpWriterWorkerGroup::startAppend()
 {
-    createTmpFile(verticesPath, verticesFile);
-    createTmpFile(trianglesPath, trianglesFile);
+    MLSGPU_ASSERT(!verticesPath.empty() && !trianglesPath.empty(), state_error);
+    MLSGPU_ASSERT(!compressed, state_error);
+    verticesFile.reset(createWriter(SYSCALL_WRITER));
+    verticesFile->openAppend(verticesPath);
+    trianglesFile.reset(createWriter(SYSCALL_WRITER));
+    trianglesFile->openAppend(trianglesPath);
+    verticesOffset = boost::filesystem::file_size(verticesPath);
+    trianglesOffset = boost::filesystem::file_size(trianglesPath);
     WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>::start();
 }
 
 void OOCMesher::TmpWriterWorkerGroup::stopPostJoin()
 {
-    verticesFile.close();
-    trianglesFile.close();
-    if (!verticesFile || !trianglesFile)
+    try
+    {
+        verticesFile->close();
+        trianglesFile->close();
+    }
+    catch (std::exception &e)
     {
         Log::log[Log::error] << "Failed while writing temporary files: "
-            << boost::system::errc::make_error_code((boost::system::errc::errc_t) errno).message() << std::endl;
+            << e.what() << std::endl;
         std::exit(1);
     }
 }
@@ -185,7 +379,12 @@ OOCMesher::OOCMesher(FastPly::Writer &writer, const Namer &namer)
     tmpNextTriangle("mem.OOCMesher::tmpNextTriangle"),
     clumps("mem.OOCMesher::clumps"),
     clumpIdMap("mem.OOCMesher::clumpIdMap"),
+    keysTmpEntries(0),
+    residentKeyEntries(0),
+    touchCounter(0),
     retainFiles(false),
+    runCheckpointed(false),
+    resumedRun(false),
     tmpWriter(reorderSlots),
     chunks("mem.OOCMesher::chunks")
 {
@@ -214,6 +413,16 @@ OOCMesher::~OOCMesher()
             if (ec)
                 Log::log[Log::warn] << "Could not delete " << trianglesTmpPath.string() << ": " << ec.message() << std::endl;
         }
+        if (!keysPath.empty())
+        {
+            keysRead.reset();
+            if (keysFile.is_open())
+                keysFile.close();
+            boost::system::error_code ec;
+            remove(keysPath, ec);
+            if (ec)
+                Log::log[Log::warn] << "Could not delete " << keysPath.string() << ": " << ec.message() << std::endl;
+        }
     }
 }
 
@@ -225,6 +434,21 @@ void OOCMesher::computeLocalComponents(
 {
     nodes.clear();
     nodes.resize(numVertices);
+#if defined(_OPENMP) && HAVE_SYNC_BUILTINS
+    /* Each thread welds a static shard of the triangles into the shared
+     * structure using the lock-free merge. The implicit barrier at the end of
+     * the loop makes the structure quiescent, after which the sizes are exact
+     * and the serial functions may be used again.
+     */
+#pragma omp parallel for schedule(static) if (numTriangles > 16384)
+    for (std::size_t i = 0; i < numTriangles; i++)
+    {
+        // Only need to use two edges in the union-find tree, since the
+        // third will be redundant.
+        for (unsigned int j = 0; j < 2; j++)
+            UnionFind::mergeConcurrent(nodes, triangles[i][j], triangles[i][j + 1]);
+    }
+#else
     for (std::size_t i = 0; i < numTriangles; i++)
     {
         // Only need to use two edges in the union-find tree, since the
@@ -232,6 +456,7 @@ void OOCMesher::computeLocalComponents(
         for (unsigned int j = 0; j < 2; j++)
             UnionFind::merge(nodes, triangles[i][j], triangles[i][j + 1]);
     }
+#endif
 }
 
 void OOCMesher::updateGlobalClumps(
@@ -290,12 +515,12 @@ void OOCMesher::updateClumpKeyMap(
         cl_ulong key = keys[i];
         clump_id cid = clumpId[i + numInternalVertices];
 
-        std::pair<Statistics::Container::unordered_map<cl_ulong, clump_id>::const_iterator, bool> added;
-        added = clumpIdMap.insert(std::make_pair(key, cid));
+        std::pair<clump_id *, bool> added;
+        added = clumpIdMap.insert(key, cid);
         if (!added.second)
         {
             // Unified two external vertices. Also need to unify their clumps.
-            clump_id cid2 = added.first->second;
+            clump_id cid2 = *added.first;
             UnionFind::merge(clumps, cid, cid2);
             // They will both have counted the common vertex, so we need to
             // subtract it.
@@ -340,6 +565,154 @@ void OOCMesher::flushBuffer(Timeplot::Worker &tworker)
     reorderBuffer.reset();
 }
 
+void OOCMesher::spillVertexIdMap(Chunk &chunk)
+{
+    if (chunk.vertexIdMap.empty())
+        return;
+
+    if (keysPath.empty())
+        createTmpFile(keysPath, keysFile);
+
+    std::vector<KeyMapEntry> entries;
+    entries.reserve(chunk.vertexIdMap.size());
+    for (Chunk::vertex_id_map_type::const_iterator i = chunk.vertexIdMap.begin();
+         i != chunk.vertexIdMap.end(); ++i)
+    {
+        KeyMapEntry e;
+        e.key = i->key;
+        e.vertexId = i->value;
+        entries.push_back(e);
+    }
+    std::sort(entries.begin(), entries.end());
+
+    keysFile.write(reinterpret_cast<const char *>(&entries[0]),
+                   entries.size() * sizeof(KeyMapEntry));
+    keysFile.flush();
+    if (!keysFile)
+    {
+        Log::log[Log::error] << "Failed while writing temporary files: "
+            << boost::system::errc::make_error_code((boost::system::errc::errc_t) errno).message() << std::endl;
+        std::exit(1);
+    }
+
+    chunk.spilledRuns.push_back(std::make_pair(
+            keysTmpEntries, (std::tr1::uint64_t) entries.size()));
+    keysTmpEntries += entries.size();
+    residentKeyEntries -= chunk.vertexIdMap.size();
+    // swap rather than clear, to return the bucket memory as well
+    Chunk::vertex_id_map_type empty("mem.mesher.vertexIdMap");
+    chunk.vertexIdMap.swap(empty);
+
+    if (!keysRead)
+    {
+        keysRead.reset(createReader(SYSCALL_READER));
+        keysRead->open(keysPath);
+    }
+
+    /* Record the spilled keys in the chunk's Bloom filter. The filter cannot
+     * grow in place, so when it fills up it is resized and rebuilt from the
+     * older runs on disk; the doubling makes this rare, and the re-read is
+     * sequential.
+     */
+    if (chunk.spilledFilter.size() + entries.size() > chunk.spilledFilter.capacity())
+    {
+        chunk.spilledFilter.resize(2 * (chunk.spilledFilter.size() + entries.size()));
+        std::vector<KeyMapEntry> buffer;
+        for (std::size_t r = 0; r + 1 < chunk.spilledRuns.size(); r++)
+        {
+            const std::pair<std::tr1::uint64_t, std::tr1::uint64_t> &run = chunk.spilledRuns[r];
+            for (std::tr1::uint64_t ofs = 0; ofs < run.second; ofs += REBUILD_BUFFER_ENTRIES)
+            {
+                const std::size_t n = (std::size_t) std::min(
+                    run.second - ofs, (std::tr1::uint64_t) REBUILD_BUFFER_ENTRIES);
+                buffer.resize(n);
+                keysRead->read(&buffer[0], n * sizeof(KeyMapEntry),
+                               (run.first + ofs) * sizeof(KeyMapEntry));
+                for (std::size_t j = 0; j < n; j++)
+                    chunk.spilledFilter.add(buffer[j].key);
+            }
+        }
+    }
+    for (std::size_t i = 0; i < entries.size(); i++)
+        chunk.spilledFilter.add(entries[i].key);
+
+    Statistics::getStatistic<Statistics::Counter>("mesher.keymap.spills").add();
+}
+
+bool OOCMesher::findSpilledKey(const Chunk &chunk, cl_ulong key, std::tr1::uint32_t &vertexId)
+{
+    // Search the most recent run first, since keys cluster in time
+    for (std::size_t r = chunk.spilledRuns.size(); r > 0; r--)
+    {
+        const std::pair<std::tr1::uint64_t, std::tr1::uint64_t> &run = chunk.spilledRuns[r - 1];
+        std::tr1::uint64_t lo = 0;
+        std::tr1::uint64_t hi = run.second;
+        while (lo < hi)
+        {
+            const std::tr1::uint64_t mid = lo + (hi - lo) / 2;
+            KeyMapEntry entry;
+            keysRead->read(&entry, sizeof(entry), (run.first + mid) * sizeof(KeyMapEntry));
+            if (entry.key == key)
+            {
+                vertexId = entry.vertexId;
+                return true;
+            }
+            else if (entry.key < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+    return false;
+}
+
+std::pair<std::tr1::uint32_t, bool> OOCMesher::addExternalVertexKey(Chunk &chunk, cl_ulong key)
+{
+    std::pair<std::tr1::uint32_t *, bool> added;
+    added = chunk.vertexIdMap.insert(
+        key, (std::tr1::uint32_t) ~chunk.numExternalVertices);
+    if (added.second)
+    {
+        residentKeyEntries++;
+        std::tr1::uint32_t spilled;
+        // The filter rejects most fresh keys without touching the disk
+        if (!chunk.spilledRuns.empty()
+            && chunk.spilledFilter.maybeContains(key)
+            && findSpilledKey(chunk, key, spilled))
+        {
+            // The key was already assigned an ID before the map was spilled.
+            // Cache it in the resident map so repeats do not hit the disk again.
+            *added.first = spilled;
+            return std::make_pair(spilled, false);
+        }
+        return std::make_pair(*added.first, true);
+    }
+    return std::make_pair(*added.first, false);
+}
+
+void OOCMesher::trimKeyMaps(const Chunk &active)
+{
+    /* Estimate of the in-memory cost of one hash table entry. The flat
+     * table keeps its load factor above 1/3 (it doubles at 2/3), so two
+     * slots per entry is a representative figure.
+     */
+    const std::size_t entryCost = 2 * sizeof(Chunk::vertex_id_map_type::Entry);
+    while (residentKeyEntries * entryCost > getKeyMapCapacity())
+    {
+        Chunk *lru = NULL;
+        for (std::size_t i = 0; i < chunks.size(); i++)
+        {
+            Chunk &c = chunks[i];
+            if (&c != &active && !c.vertexIdMap.empty()
+                && (lru == NULL || c.lastTouched < lru->lastTouched))
+                lru = &c;
+        }
+        if (lru == NULL)
+            break;      // only the active chunk is still resident
+        spillVertexIdMap(*lru);
+    }
+}
+
 void OOCMesher::updateLocalClumps(
     Chunk &chunk,
     const Statistics::Container::PODBuffer<clump_id> &globalClumpId,
@@ -400,10 +773,8 @@ void OOCMesher::updateLocalClumps(
             if (std::size_t(vid) >= numInternalVertices)
             {
                 // external vertex
-                std::pair<Chunk::vertex_id_map_type::iterator, bool> added;
-                added = chunk.vertexIdMap.insert(
-                    std::make_pair(mesh.vertexKeys[vid - numInternalVertices],
-                                   (std::tr1::uint32_t) ~chunk.numExternalVertices));
+                std::pair<std::tr1::uint32_t, bool> added;
+                added = addExternalVertexKey(chunk, mesh.vertexKeys[vid - numInternalVertices]);
                 if (added.second)
                 {
                     chunk.numExternalVertices++;
@@ -411,7 +782,7 @@ void OOCMesher::updateLocalClumps(
                 }
                 else
                     elide = true;
-                tmpVertexLabel[vid] = added.first->second;
+                tmpVertexLabel[vid] = added.first;
             }
             else
             {
@@ -450,6 +821,7 @@ void OOCMesher::add(MesherWork &work, Timeplot::Worker &tworker)
         chunks.resize(work.chunkId.gen + 1);
     Chunk &chunk = chunks[work.chunkId.gen];
     chunk.chunkId = work.chunkId;
+    chunk.lastTouched = ++touchCounter;
 
     HostKeyMesh &mesh = work.mesh;
 
@@ -461,22 +833,32 @@ void OOCMesher::add(MesherWork &work, Timeplot::Worker &tworker)
 
     if (work.hasEvents)
         work.vertexKeysEvent.wait();
+    mesh.expandKeys();
     updateClumpKeyMap(mesh.numVertices(), mesh.numExternalVertices(), mesh.vertexKeys, tmpClumpId);
+    if (getCheckManifold())
+        manifoldChecker.add(mesh);
 
     if (work.hasEvents)
         work.verticesEvent.wait();
     updateLocalClumps(chunk, tmpClumpId, oldClumps, clumps.size(), mesh, tworker);
+
+    trimKeyMaps(chunk);
 }
 
-MesherBase::InputFunctor OOCMesher::functor(unsigned int pass)
+MesherBase::InputFunctor OOCMesher::functor()
 {
-    /* only one pass, so ignore it */
-    (void) pass;
-    assert(pass == 0);
-
-    writtenVerticesTmp = 0;
-    writtenTrianglesTmp = 0;
-    tmpWriter.start();
+    if (resumedRun)
+    {
+        // The temporary files already hold the data recovered by resumeRun,
+        // so extend them rather than starting over.
+        tmpWriter.startAppend();
+    }
+    else
+    {
+        writtenVerticesTmp = 0;
+        writtenTrianglesTmp = 0;
+        tmpWriter.start(getTmpCompressed());
+    }
 
     return boost::bind(&OOCMesher::add, this, _1, _2);
 }
@@ -486,6 +868,14 @@ void OOCMesher::finalize(Timeplot::Worker &tworker)
     flushBuffer(tworker);
     if (tmpWriter.running())
         tmpWriter.stop();
+    if (getCheckManifold())
+        manifoldChecker.report();
+}
+
+void OOCMesher::flattenClumps()
+{
+    for (clump_id i = 0; i < (clump_id) clumps.size(); i++)
+        UnionFind::findRoot(clumps, i);
 }
 
 void OOCMesher::getStatistics(
@@ -580,7 +970,7 @@ std::size_t OOCMesher::getAsyncMem(std::tr1::uint64_t thresholdVertices) const
             if (clumps[cid].vertices >= thresholdVertices)
             {
                 const std::size_t vertices = cc.numInternalVertices + cc.numExternalVertices;
-                asyncMem = std::max(asyncMem, vertices * FastPly::Writer::vertexSize);
+                asyncMem = std::max(asyncMem, vertices * getWriter().vertexBytes());
                 asyncMem = std::max(asyncMem, cc.numTriangles * FastPly::Writer::triangleSize);
             }
         }
@@ -596,6 +986,12 @@ void OOCMesher::rewriteTriangles(
     const triangle_type *inTriangles,
     std::tr1::uint8_t *outTriangles)
 {
+    /* This loop is deliberately scalar. The external-vertex case is a
+     * data-dependent table lookup, which cannot be expressed as a vector
+     * gather on the SSE2 baseline this project targets, and the loop streams
+     * its input once and packs the output records in the same pass, so with
+     * the threads below it already runs close to memory bandwidth.
+     */
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static)
 #endif
@@ -690,16 +1086,31 @@ void OOCMesher::writeChunkVertices(
              */
             if (numVertices > 0)
             {
-                boost::shared_ptr<AsyncWriterItem> item = asyncWriter.get(
-                    tworker, numVertices * sizeof(vertex_type));
+                const char *mapped = verticesTmpRead.data();
+                if (mapped != NULL)
                 {
-                    Statistics::Timer timer(readVerticesStat);
-                    verticesTmpRead.read(
-                        item->get(),
-                        numVertices * sizeof(vertex_type),
-                        cc.firstVertex * sizeof(vertex_type));
+                    /* Zero-copy: write straight out of the mapping. The
+                     * writer uses positioned writes, so this is safe
+                     * alongside the asynchronous triangle writes.
+                     */
+                    getWriter().writeVertices(
+                        startVertex[j], numVertices,
+                        reinterpret_cast<const float *>(
+                            mapped + cc.firstVertex * sizeof(vertex_type)));
+                }
+                else
+                {
+                    boost::shared_ptr<AsyncWriterItem> item = asyncWriter.get(
+                        tworker, numVertices * sizeof(vertex_type));
+                    {
+                        Statistics::Timer timer(readVerticesStat);
+                        verticesTmpRead.read(
+                            item->get(),
+                            numVertices * sizeof(vertex_type),
+                            cc.firstVertex * sizeof(vertex_type));
+                    }
+                    getWriter().writeVertices(tworker, startVertex[j], numVertices, item, asyncWriter);
                 }
-                getWriter().writeVertices(tworker, startVertex[j], numVertices, item, asyncWriter);
             }
             // Yes, numTriangles. That's easier to make add up to the total
             // than vertices (which share), and still a good indicator
@@ -722,12 +1133,20 @@ void OOCMesher::writeChunkTriangles(
     const std::tr1::uint32_t *externalRemap,
     Statistics::Container::PODBuffer<triangle_type> &triangles,
     ProgressMeter *progress,
-    std::size_t firstClump, std::size_t lastClump)
+    std::size_t firstClump, std::size_t lastClump,
+    const float *positions,
+    float *normalSums)
 {
     Statistics::Timer trianglesTimer("finalize.triangles.time");
     Statistics::Variable &readTrianglesStat = Statistics::getStatistic<Statistics::Variable>("write.readTriangles.time");
+    Statistics::Variable &vcacheStat = Statistics::getStatistic<Statistics::Variable>("finalize.vcache.time");
     std::tr1::uint32_t externalBoundary = ~chunkExternal;
 
+    // Scratch space for vertex-cache reordering, reused across clumps
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> vcacheIndices("mem.OOCMesher::vcacheIndices");
+    Statistics::Container::PODBuffer<std::tr1::uint32_t> vcacheOrder("mem.OOCMesher::vcacheOrder");
+    Statistics::Container::PODBuffer<std::tr1::uint8_t> vcacheRecords("mem.OOCMesher::vcacheRecords");
+
     // Now write out the triangles
     for (std::size_t j = firstClump; j < lastClump; j++)
     {
@@ -735,23 +1154,97 @@ void OOCMesher::writeChunkTriangles(
         clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
         if (clumps[cid].vertices >= thresholdVertices)
         {
-            triangles.reserve(cc.numTriangles, false);
             boost::shared_ptr<AsyncWriterItem> item = asyncWriter.get(
                 tworker, cc.numTriangles * FastPly::Writer::triangleSize);
             std::tr1::uint8_t *raw = reinterpret_cast<std::tr1::uint8_t *>(item->get());
+
+            // Rewrite directly out of the mapping when there is one
+            const char *mapped = trianglesTmpRead.data();
+            const triangle_type *src;
+            if (mapped != NULL)
             {
-                Statistics::Timer timer(readTrianglesStat);
-                trianglesTmpRead.read(
-                    triangles.data(),
-                    cc.numTriangles * sizeof(triangle_type),
-                    cc.firstTriangle * sizeof(triangle_type));
+                src = reinterpret_cast<const triangle_type *>(
+                    mapped + cc.firstTriangle * sizeof(triangle_type));
+            }
+            else
+            {
+                triangles.reserve(cc.numTriangles, false);
+                {
+                    Statistics::Timer timer(readTrianglesStat);
+                    trianglesTmpRead.read(
+                        triangles.data(),
+                        cc.numTriangles * sizeof(triangle_type),
+                        cc.firstTriangle * sizeof(triangle_type));
+                }
+                src = triangles.data();
             }
 
             rewriteTriangles(
                 cc.numTriangles,
                 externalBoundary, externalRemap,
                 startVertex[j],
-                triangles.data(), raw);
+                src, raw);
+
+            if (getVertexCacheOrder())
+            {
+                /* Re-emit the clump's triangles in a cache-aware order. The
+                 * reorder is per clump, which is where the vertex reuse is:
+                 * clumps are connected components, so triangles of different
+                 * clumps share (at most) a few external vertices. The clump's
+                 * extent in the output file is unchanged, so the positioned
+                 * writes are unaffected.
+                 */
+                Statistics::Timer timer(vcacheStat);
+                vcacheIndices.reserve(cc.numTriangles * 3, false);
+                vcacheOrder.reserve(cc.numTriangles, false);
+                vcacheRecords.reserve(cc.numTriangles * FastPly::Writer::triangleSize, false);
+                for (std::size_t i = 0; i < cc.numTriangles; i++)
+                    std::memcpy(
+                        vcacheIndices.data() + i * 3,
+                        raw + i * FastPly::Writer::triangleSize + 1,
+                        3 * sizeof(std::tr1::uint32_t));
+                VCache::optimizeTriangleOrder(
+                    vcacheIndices.data(), cc.numTriangles, vcacheOrder.data());
+                std::memcpy(vcacheRecords.data(), raw,
+                            cc.numTriangles * FastPly::Writer::triangleSize);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+                for (std::size_t i = 0; i < cc.numTriangles; i++)
+                    std::memcpy(
+                        raw + i * FastPly::Writer::triangleSize,
+                        vcacheRecords.data() + vcacheOrder[i] * std::size_t(FastPly::Writer::triangleSize),
+                        FastPly::Writer::triangleSize);
+            }
+
+            if (normalSums != NULL)
+            {
+                /* Accumulate area-weighted face normals from the rewritten
+                 * indices: the cross product of two edges has magnitude
+                 * twice the triangle's area, so summing the raw cross
+                 * products weights each face by its area.
+                 */
+                for (std::size_t i = 0; i < cc.numTriangles; i++)
+                {
+                    std::tr1::uint32_t idx[3];
+                    std::memcpy(idx, raw + i * FastPly::Writer::triangleSize + 1, sizeof(idx));
+                    const float *a = positions + idx[0] * 3;
+                    const float *b = positions + idx[1] * 3;
+                    const float *c = positions + idx[2] * 3;
+                    float e1[3], e2[3], n[3];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        e1[k] = b[k] - a[k];
+                        e2[k] = c[k] - a[k];
+                    }
+                    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+                    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+                    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+                    for (int v = 0; v < 3; v++)
+                        for (int k = 0; k < 3; k++)
+                            normalSums[idx[v] * 3 + k] += n[k];
+                }
+            }
 
             getWriter().writeTrianglesRaw(tworker, startTriangle[j], cc.numTriangles, item, asyncWriter);
             if (progress != NULL)
@@ -760,6 +1253,133 @@ void OOCMesher::writeChunkTriangles(
     }
 }
 
+void OOCMesher::writeChunkNormals(
+    Timeplot::Worker &tworker,
+    BinaryReader &verticesTmpRead,
+    BinaryReader &trianglesTmpRead,
+    AsyncWriter &asyncWriter,
+    const Chunk &chunk,
+    std::tr1::uint64_t chunkVertices,
+    std::tr1::uint64_t thresholdVertices,
+    std::size_t chunkExternal,
+    const std::tr1::uint32_t *startVertex,
+    const FastPly::Writer::size_type *startTriangle,
+    const std::tr1::uint32_t *externalRemap,
+    Statistics::Container::PODBuffer<triangle_type> &triangles,
+    ProgressMeter *progress)
+{
+    MLSGPU_ASSERT(getWriter().getNormals(), state_error);
+
+    Statistics::Variable &readVerticesStat = Statistics::getStatistic<Statistics::Variable>("write.readVertices.time");
+
+    /* Load the chunk's vertex positions, indexed by final vertex index. They
+     * are needed twice: once by the triangle pass to compute face normals and
+     * again to interleave the positions with the normals in the output.
+     */
+    Statistics::Container::PODBuffer<float> positions("mem.OOCMesher::positions");
+    positions.reserve(chunkVertices * 3, false);
+    for (std::size_t j = 0; j < chunk.clumps.size(); j++)
+    {
+        const Chunk::Clump &cc = chunk.clumps[j];
+        clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
+        if (clumps[cid].vertices >= thresholdVertices)
+        {
+            std::size_t numVertices = cc.numInternalVertices + cc.numExternalVertices;
+            if (numVertices > 0)
+            {
+                float *dst = positions.data() + startVertex[j] * 3;
+                const char *mapped = verticesTmpRead.data();
+                if (mapped != NULL)
+                {
+                    std::memcpy(dst,
+                                mapped + cc.firstVertex * sizeof(vertex_type),
+                                numVertices * sizeof(vertex_type));
+                }
+                else
+                {
+                    Statistics::Timer timer(readVerticesStat);
+                    verticesTmpRead.read(
+                        dst,
+                        numVertices * sizeof(vertex_type),
+                        cc.firstVertex * sizeof(vertex_type));
+                }
+            }
+        }
+    }
+
+    /* The triangle pass writes the faces and accumulates the area-weighted
+     * face normal of each written triangle onto its vertices.
+     */
+    Statistics::Container::PODBuffer<float> normalSums("mem.OOCMesher::normalSums");
+    normalSums.reserve(chunkVertices * 3, false);
+    std::memset(normalSums.data(), 0, chunkVertices * 3 * sizeof(float));
+    writeChunkTriangles(
+        tworker, trianglesTmpRead, asyncWriter, chunk,
+        thresholdVertices, chunkExternal,
+        startVertex, startTriangle, externalRemap,
+        triangles, progress,
+        0, chunk.clumps.size(),
+        positions.data(), normalSums.data());
+
+    // Normalize and interleave with the positions
+    Statistics::Timer timer("finalize.vertices.time");
+    for (std::size_t j = 0; j < chunk.clumps.size(); j++)
+    {
+        const Chunk::Clump &cc = chunk.clumps[j];
+        clump_id cid = UnionFind::findRoot(clumps, cc.globalId);
+        if (clumps[cid].vertices >= thresholdVertices)
+        {
+            std::size_t numVertices = cc.numInternalVertices + cc.numExternalVertices;
+            if (numVertices > 0)
+            {
+                boost::shared_ptr<AsyncWriterItem> item = asyncWriter.get(
+                    tworker, numVertices * 6 * sizeof(float));
+                float *out = reinterpret_cast<float *>(item->get());
+                for (std::size_t v = 0; v < numVertices; v++)
+                {
+                    const std::size_t idx = startVertex[j] + v;
+                    const float *p = positions.data() + idx * 3;
+                    const float *n = normalSums.data() + idx * 3;
+                    float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    // Isolated vertices have no incident area: leave them zero
+                    float scale = (len > 0.0f) ? 1.0f / len : 0.0f;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        out[v * 6 + k] = p[k];
+                        out[v * 6 + 3 + k] = n[k] * scale;
+                    }
+                }
+                getWriter().writeVertices(tworker, startVertex[j], numVertices, item, asyncWriter);
+            }
+            if (progress != NULL)
+                *progress += cc.numTriangles;
+        }
+    }
+}
+
+void OOCMesher::writeChunkVerticesThread(
+    Timeplot::Worker &tworker,
+    BinaryReader &verticesTmpRead,
+    AsyncWriter &asyncWriter,
+    const Chunk &chunk,
+    std::tr1::uint64_t thresholdVertices,
+    const std::tr1::uint32_t *startVertex,
+    ProgressMeter *progress,
+    boost::exception_ptr &error)
+{
+    try
+    {
+        writeChunkVertices(
+            tworker, verticesTmpRead, asyncWriter, chunk,
+            thresholdVertices, startVertex, progress,
+            0, chunk.clumps.size());
+    }
+    catch (...)
+    {
+        error = boost::current_exception();
+    }
+}
+
 std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressStream)
 {
     std::size_t outputFiles = 0;
@@ -769,10 +1389,41 @@ std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressSt
 
     finalize(tworker);
 
-    boost::scoped_ptr<BinaryReader> verticesTmpRead(createReader(SYSCALL_READER));
-    verticesTmpRead->open(tmpWriter.getVerticesPath());
-    boost::scoped_ptr<BinaryReader> trianglesTmpRead(createReader(SYSCALL_READER));
-    trianglesTmpRead->open(tmpWriter.getTrianglesPath());
+    /* Map the temporary files where possible, so that the vertex data are
+     * written straight from the page cache and the triangle index rewrite
+     * reads directly from the mapping, instead of every clump being copied
+     * through a buffered read first. Compressed temporary files cannot be
+     * mapped, and mapping fails outright when the files exceed the address
+     * space (32-bit builds) or are empty; fall back to buffered reads.
+     */
+    boost::scoped_ptr<BinaryReader> verticesTmpRead;
+    boost::scoped_ptr<BinaryReader> trianglesTmpRead;
+    if (tmpWriter.getReaderType() == SYSCALL_READER)
+    {
+        try
+        {
+            boost::scoped_ptr<BinaryReader> vr(createReader(MMAP_READER));
+            boost::scoped_ptr<BinaryReader> tr(createReader(MMAP_READER));
+            vr->open(tmpWriter.getVerticesPath());
+            tr->open(tmpWriter.getTrianglesPath());
+            verticesTmpRead.swap(vr);
+            trianglesTmpRead.swap(tr);
+        }
+        catch (std::exception &e)
+        {
+            Log::log[Log::debug] << "Could not map temporary files ("
+                << e.what() << "); falling back to buffered reads\n";
+        }
+    }
+    if (!verticesTmpRead)
+    {
+        verticesTmpRead.reset(createReader(tmpWriter.getReaderType()));
+        trianglesTmpRead.reset(createReader(tmpWriter.getReaderType()));
+        verticesTmpRead->open(tmpWriter.getVerticesPath());
+        trianglesTmpRead->open(tmpWriter.getTrianglesPath());
+    }
+    verticesTmpRead->hintSequential();
+    trianglesTmpRead->hintSequential();
 
     std::tr1::uint64_t thresholdVertices;
     clump_id keptComponents;
@@ -800,9 +1451,13 @@ std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressSt
     Statistics::Container::PODBuffer<FastPly::Writer::size_type> startTriangle("mem.OOCMesher::startTriangle");
     Statistics::Container::PODBuffer<triangle_type> triangles("mem.OOCMesher::triangles");
 
-    AsyncWriter asyncWriter(1, asyncMem * 2); // * 2 to allow overlapping
+    // * 4: the vertex and triangle passes each keep up to two items in flight
+    AsyncWriter asyncWriter(1, asyncMem * 4);
     asyncWriter.start();
 
+    // Worker for the thread running the vertex pass of each chunk
+    Timeplot::Worker vertexTworker("vertexwriter");
+
     for (std::size_t i = 0; i < chunks.size(); i++)
     {
         const Chunk &chunk = chunks[i];
@@ -824,17 +1479,55 @@ std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressSt
                     chunk, thresholdVertices, chunkExternal,
                     startVertex, startTriangle, externalRemap);
 
-                writeChunkVertices(
-                    tworker, *verticesTmpRead, asyncWriter, chunk,
-                    thresholdVertices, startVertex.data(), progress.get(),
-                    0, chunk.clumps.size());
-
-                writeChunkTriangles(
-                    tworker, *trianglesTmpRead, asyncWriter, chunk,
-                    thresholdVertices, chunkExternal,
-                    startVertex.data(), startTriangle.data(), externalRemap.data(),
-                    triangles, progress.get(),
-                    0, chunk.clumps.size());
+                if (writer.getNormals())
+                {
+                    /* Normals couple the two passes together (each triangle
+                     * contributes to its vertices), so they run as
+                     * cooperative serial passes instead.
+                     */
+                    writeChunkNormals(
+                        tworker, *verticesTmpRead, *trianglesTmpRead,
+                        asyncWriter, chunk,
+                        chunkVertices, thresholdVertices, chunkExternal,
+                        startVertex.data(), startTriangle.data(), externalRemap.data(),
+                        triangles, progress.get());
+                }
+                else
+                {
+                    /* The vertex and triangle passes read separate temporary
+                     * files and write disjoint regions of the output file, and
+                     * the async writer is safe for multiple producers, so the
+                     * two passes run concurrently. The triangle pass is the
+                     * heavier one (it also rewrites indices), so it stays on
+                     * this thread.
+                     */
+                    boost::exception_ptr verticesError;
+                    boost::thread verticesThread(boost::bind(
+                        &OOCMesher::writeChunkVerticesThread, this,
+                        boost::ref(vertexTworker), boost::ref(*verticesTmpRead),
+                        boost::ref(asyncWriter), boost::cref(chunk),
+                        thresholdVertices, startVertex.data(), progress.get(),
+                        boost::ref(verticesError)));
+
+                    try
+                    {
+                        writeChunkTriangles(
+                            tworker, *trianglesTmpRead, asyncWriter, chunk,
+                            thresholdVertices, chunkExternal,
+                            startVertex.data(), startTriangle.data(), externalRemap.data(),
+                            triangles, progress.get(),
+                            0, chunk.clumps.size());
+                    }
+                    catch (...)
+                    {
+                        verticesThread.join();
+                        throw;
+                    }
+
+                    verticesThread.join();
+                    if (verticesError)
+                        boost::rethrow_exception(verticesError);
+                }
 
                 writer.close();
             }
@@ -844,10 +1537,27 @@ std::size_t OOCMesher::write(Timeplot::Worker &tworker, std::ostream *progressSt
                     << boost::errinfo_file_name(filename)
                     << boost::errinfo_errno(errno);
             }
+
+            if (!getChunkStream().empty())
+            {
+                /* The triangle writes go through the async writer, so drain
+                 * it to guarantee the file is complete before it is handed
+                 * to the consumer; it restarts for the next chunk.
+                 */
+                asyncWriter.stop();
+                streamChunk(filename);
+                asyncWriter.start();
+            }
+            manifestChunk(chunk.chunkId, filename, chunkVertices, chunkTriangles);
         }
     }
     asyncWriter.stop();
     Statistics::getStatistic<Statistics::Counter>("output.files").add(outputFiles);
+    /* Once the output is safely written, the temporary files that were being
+     * retained for the benefit of a mid-run checkpoint can be reclaimed.
+     */
+    if (runCheckpointed)
+        retainFiles = false;
     return outputFiles;
 }
 
@@ -862,6 +1572,8 @@ void OOCMesher::checkpoint(Timeplot::Worker &tworker, const boost::filesystem::p
         if (!dump)
             throw std::ios::failure("Could not open file");
         boost::archive::text_oarchive archive(dump);
+        const bool complete = true;
+        archive << complete;
         archive << *this;
         dump.close();
     }
@@ -885,6 +1597,10 @@ std::size_t OOCMesher::resume(
         if (!dump)
             throw std::ios::failure("Could not open file");
         boost::archive::text_iarchive archive(dump);
+        bool complete;
+        archive >> complete;
+        if (!complete)
+            throw std::ios::failure("Checkpoint is a mid-run snapshot: use resumeRun");
         archive >> *this;
         dump.close();
     }
@@ -897,6 +1613,121 @@ std::size_t OOCMesher::resume(
     return write(tworker, progressStream);
 }
 
+void OOCMesher::checkpointRun(
+    Timeplot::Worker &tworker,
+    const boost::filesystem::path &path,
+    ChunkId::gen_type completedGen,
+    ProgressMeter::size_type progress)
+{
+    MLSGPU_ASSERT(tmpWriter.running(), state_error);
+    retainFiles = true;
+    runCheckpointed = true;
+
+    /* Push any buffered geometry out and close the temporary files, so that
+     * everything the snapshot references is complete on disk.
+     */
+    flushBuffer(tworker);
+    tmpWriter.stop();
+
+    const boost::filesystem::path newPath(path.string() + ".new");
+    try
+    {
+        boost::filesystem::ofstream dump(newPath);
+        if (!dump)
+            throw std::ios::failure("Could not open file");
+        boost::archive::text_oarchive archive(dump);
+        const bool complete = false;
+        archive << complete;
+        archive << completedGen;
+        archive << progress;
+        archive << writtenVerticesTmp;
+        archive << writtenTrianglesTmp;
+        archive << clumpIdMap;
+        archive << *this;
+        dump.close();
+        if (!dump)
+            throw std::ios::failure("Could not write checkpoint");
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(newPath.string());
+    }
+    boost::filesystem::rename(newPath, path);
+
+    tmpWriter.startAppend();
+}
+
+ChunkId::gen_type OOCMesher::resumeRun(
+    Timeplot::Worker &tworker,
+    const boost::filesystem::path &path,
+    ProgressMeter::size_type &progress)
+{
+    (void) tworker;
+    MLSGPU_ASSERT(!tmpWriter.running(), state_error);
+    retainFiles = true;
+    runCheckpointed = true;
+    resumedRun = true;
+
+    ChunkId::gen_type completedGen;
+    try
+    {
+        boost::filesystem::ifstream dump(path);
+        if (!dump)
+            throw std::ios::failure("Could not open file");
+        boost::archive::text_iarchive archive(dump);
+        bool complete;
+        archive >> complete;
+        if (complete)
+            throw std::ios::failure("Checkpoint is not a mid-run snapshot: use resume");
+        archive >> completedGen;
+        archive >> progress;
+        archive >> writtenVerticesTmp;
+        archive >> writtenTrianglesTmp;
+        archive >> clumpIdMap;
+        archive >> *this;
+        dump.close();
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(path.string());
+    }
+
+    /* The previous run may have appended more data after taking the
+     * snapshot. Cut the temporary files back so that the next append
+     * continues exactly where the snapshot left off.
+     */
+    boost::filesystem::resize_file(tmpWriter.getVerticesPath(),
+                                   writtenVerticesTmp * sizeof(vertex_type));
+    boost::filesystem::resize_file(tmpWriter.getTrianglesPath(),
+                                   writtenTrianglesTmp * sizeof(triangle_type));
+
+    return completedGen;
+}
+
+bool checkpointIsComplete(const boost::filesystem::path &path)
+{
+    bool complete;
+    try
+    {
+        boost::filesystem::ifstream dump(path);
+        if (!dump)
+            throw std::ios::failure("Could not open file");
+        boost::archive::text_iarchive archive(dump);
+        archive >> complete;
+    }
+    catch (std::ios::failure &e)
+    {
+        throw boost::enable_error_info(e)
+            << boost::errinfo_errno(errno)
+            << boost::errinfo_file_name(path.string());
+    }
+    return complete;
+}
+
 namespace
 {
 
@@ -921,8 +1752,8 @@ public:
     {
         MesherWork work;
 
-        boost::scoped_array<char> buffer(new char[mesh.getHostBytes()]);
-        work.mesh = HostKeyMesh(buffer.get(), mesh);
+        Statistics::Container::PODBuffer<char> buffer("mem.DeviceMesher.buffer", mesh.getHostBytes());
+        work.mesh = HostKeyMesh(buffer.data(), mesh);
         std::vector<cl::Event> wait(3);
         enqueueReadMesh(queue, mesh, work.mesh, events, &wait[0], &wait[1], &wait[2]);
         CLH::enqueueMarkerWithWaitList(queue, &wait, event);
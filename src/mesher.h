@@ -48,6 +48,7 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/optional.hpp>
+#include <boost/exception_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/archive/text_oarchive.hpp>
@@ -58,6 +59,8 @@
 #include <boost/serialization/vector.hpp>
 #include "tr1_unordered_map.h"
 #include "tr1_unordered_set.h"
+#include "key_map.h"
+#include "bloom_filter.h"
 #include "marching.h"
 #include "fast_ply.h"
 #include "union_find.h"
@@ -69,6 +72,7 @@
 #include "circular_buffer.h"
 #include "chunk_id.h"
 #include "progress.h"
+#include "manifold_checker.h"
 
 class TestTmpWriterWorkerGroup;
 
@@ -83,6 +87,74 @@ inline void serialize(Archive &ar, Statistics::Container::vector<T, Alloc> &v, c
     ar & boost::serialization::base_object<std::vector<T, Alloc> >(v);
 }
 
+template<typename Archive, typename Key, typename T, typename Hash, typename Pred, typename Alloc>
+inline void save(Archive &ar, const Statistics::Container::unordered_map<Key, T, Hash, Pred, Alloc> &m, const unsigned int)
+{
+    std::size_t size = m.size();
+    ar << size;
+    for (typename std::tr1::unordered_map<Key, T, Hash, Pred, Alloc>::const_iterator i = m.begin(); i != m.end(); ++i)
+    {
+        ar << i->first;
+        ar << i->second;
+    }
+}
+
+template<typename Archive, typename Key, typename T, typename Hash, typename Pred, typename Alloc>
+inline void load(Archive &ar, Statistics::Container::unordered_map<Key, T, Hash, Pred, Alloc> &m, const unsigned int)
+{
+    std::size_t size;
+    ar >> size;
+    m.clear();
+    for (std::size_t i = 0; i < size; i++)
+    {
+        Key key;
+        T value;
+        ar >> key;
+        ar >> value;
+        m.insert(std::make_pair(key, value));
+    }
+}
+
+template<typename Archive, typename Key, typename T, typename Hash, typename Pred, typename Alloc>
+inline void serialize(Archive &ar, Statistics::Container::unordered_map<Key, T, Hash, Pred, Alloc> &m, const unsigned int version)
+{
+    boost::serialization::split_free(ar, m, version);
+}
+
+template<typename Archive, typename T>
+inline void save(Archive &ar, const KeyMap<T> &m, const unsigned int)
+{
+    std::size_t size = m.size();
+    ar << size;
+    for (typename KeyMap<T>::const_iterator i = m.begin(); i != m.end(); ++i)
+    {
+        ar << i->key;
+        ar << i->value;
+    }
+}
+
+template<typename Archive, typename T>
+inline void load(Archive &ar, KeyMap<T> &m, const unsigned int)
+{
+    std::size_t size;
+    ar >> size;
+    m.clear();
+    for (std::size_t i = 0; i < size; i++)
+    {
+        typename KeyMap<T>::key_type key;
+        T value;
+        ar >> key;
+        ar >> value;
+        m.insert(key, value);
+    }
+}
+
+template<typename Archive, typename T>
+inline void serialize(Archive &ar, KeyMap<T> &m, const unsigned int version)
+{
+    boost::serialization::split_free(ar, m, version);
+}
+
 template<typename Archive>
 inline void save(Archive &ar, const boost::filesystem::path &path, const unsigned int)
 {
@@ -178,6 +250,49 @@ public:
     ChunkNamer(const std::string &baseName) : baseName(baseName) {}
 };
 
+/**
+ * Model of @ref MesherBase::Namer that shards the chunks across a directory
+ * hierarchy. With a flat layout, filesystems such as ext4 and NFS slow down
+ * on per-file metadata operations once a directory holds hundreds of
+ * thousands of entries. This namer places each chunk in a two-level
+ * subdirectory derived from the chunk coordinates:
+ * <i>base</i><code>.chunks/</code><i>XXXX</i><code>/</code><i>YYYY</i><code>/</code><i>leaf</i><code>_</code><i>XXXX</i><code>_</code><i>YYYY</i><code>_</code><i>ZZZZ</i><code>.ply</code>,
+ * where @a leaf is the filename portion of @a base. The leaf filenames match
+ * those produced by @ref ChunkNamer, so the hierarchy can later be flattened
+ * without renaming.
+ *
+ * Directories are created on first use and remembered, so metadata
+ * operations remain O(1) per chunk regardless of the chunk count. The
+ * record of created directories is shared between copies, so the namer may
+ * be copied freely (e.g. into a @c boost::function).
+ */
+class ShardedChunkNamer
+{
+private:
+    /// State shared between copies of the namer
+    struct Shared
+    {
+        boost::mutex mutex;                       ///< Protects @ref created
+        std::tr1::unordered_set<std::string> created;  ///< Directories already created
+    };
+
+    std::string baseName;
+    boost::shared_ptr<Shared> shared;
+
+    /**
+     * Create @a dir (and any missing parents) unless a previous call has
+     * already done so.
+     */
+    void ensureDirectory(const std::string &dir) const;
+
+public:
+    typedef std::string result_type;
+    std::string operator()(const ChunkId &chunkId) const;
+
+    ShardedChunkNamer(const std::string &baseName)
+        : baseName(baseName), shared(new Shared) {}
+};
+
 /**
  * Abstract base class for output collectors for @ref Marching. This class
  * only captures the host side of the process. It needs to be wrapped in
@@ -187,15 +302,16 @@ public:
  * The basic procedure for using one of these classes is:
  * -# Instantiate it.
  * -# Call @ref setPruneThreshold.
- * -# Call @ref numPasses to determine how many passes are required.
- * -# For each pass, call @ref functor to obtain a functor, then
- *    make as many calls to @ref Marching::generate as desired using this
- *    functor. Each call should set @a keyOffset so that vertex keys line up.
- *    Each pass must generate exactly the same geometry, but the blocks may
- *    be generated in different order within each chunk (chunks must be in
- *    order).
+ * -# Call @ref functor to obtain a functor, then make as many calls to
+ *    @ref Marching::generate as desired using this functor. Each call
+ *    should set @a keyOffset so that vertex keys line up. Blocks may be
+ *    generated in any order within each chunk (chunks must be in order).
  * -# Call @ref write.
  *
+ * The device output is consumed in a single pass: anything needed to
+ * complete the output is spilled to temporary storage rather than
+ * requiring the expensive MLS and marching work to be re-run.
+ *
  * @warning The functor is @em not required to be thread-safe. The caller must
  * serialize calls if necessary (@ref MesherGroup only uses one thread).
  */
@@ -227,14 +343,16 @@ public:
      * @param namer          Callback function to assign names to output files.
      */
     MesherBase(FastPly::Writer &writer, const Namer &namer)
-        : pruneThreshold(0.0), reorderCapacity(4 * 1024 * 1024), writer(writer), namer(namer) {}
+        : pruneThreshold(0.0), reorderCapacity(4 * 1024 * 1024),
+        keyMapCapacity(1024U * 1024 * 1024), checkManifold(false),
+        tmpCompressed(true), vertexCacheOrder(false),
+        chunkStreamReaderType(SYSCALL_READER),
+        chunkCells(0), haveChunkGrid(false),
+        writer(writer), namer(namer) {}
 
     /// Virtual destructor to allow destruction via base class pointer
     virtual ~MesherBase() {}
 
-    /// Number of passes required.
-    virtual unsigned int numPasses() const = 0;
-
     /**
      * Sets the lower bound on component size. All components that are
      * smaller will be pruned from the output, if supported by the mesher
@@ -257,20 +375,133 @@ public:
     std::size_t getReorderCapacity() const { return reorderCapacity; }
 
     /**
-     * Retrieves a functor that will accept data in a specific pass.
-     * Multi-pass classes may do finalization on a previous pass before
-     * returning the functor, so this function should only be called for
-     * pass @a pass once pass @a pass - 1 has completed. It must also
-     * only be called once per pass.
+     * Sets the memory (in bytes) to use for in-memory vertex welding maps,
+     * if the mesher type has them. When the limit is exceeded, maps are
+     * spilled to sorted runs in a temporary file (see @ref OOCMesher).
+     */
+    void setKeyMapCapacity(std::size_t bytes) { keyMapCapacity = bytes; }
+
+    /// Retrieve the value set with @ref setKeyMapCapacity.
+    std::size_t getKeyMapCapacity() const { return keyMapCapacity; }
+
+    /**
+     * Enables or disables streaming verification that the output is
+     * edge-manifold (see @ref ManifoldChecker), if supported by the mesher
+     * type. The default is disabled.
+     */
+    void setCheckManifold(bool check) { checkManifold = check; }
+
+    /// Retrieve the value set with @ref setCheckManifold.
+    bool getCheckManifold() const { return checkManifold; }
+
+    /**
+     * Enables or disables block compression of the temporary files, if the
+     * mesher type spills to temporary files. Compression trades otherwise
+     * idle CPU time for roughly half the scratch I/O volume, which helps
+     * when scratch bandwidth rather than CPU bounds the final write phase.
+     * The default is enabled; it only takes effect when zlib support was
+     * compiled in, and it must be disabled for checkpointed runs because
+     * the checkpoint protocol truncates and appends to the raw files.
+     */
+    void setTmpCompressed(bool compressed) { tmpCompressed = compressed; }
+
+    /// Retrieve the value set with @ref setTmpCompressed.
+    bool getTmpCompressed() const { return tmpCompressed; }
+
+    /**
+     * Enables or disables reordering of each output chunk's triangles for
+     * GPU vertex-cache locality (see @ref VCache), if supported by the
+     * mesher type. This makes the output render-ready without a separate
+     * optimization pass, at a modest CPU cost during the final write. The
+     * default is disabled.
+     */
+    void setVertexCacheOrder(bool reorder) { vertexCacheOrder = reorder; }
+
+    /// Retrieve the value set with @ref setVertexCacheOrder.
+    bool getVertexCacheOrder() const { return vertexCacheOrder; }
+
+    /**
+     * Sets a path (typically a named pipe) down which each output chunk is
+     * streamed as soon as it is finalized, so that downstream processing
+     * (tiling, simplification) can start on the first chunk instead of
+     * waiting for the whole write phase. Each chunk is sent as one frame:
+     * the magic bytes <code>"mlsgpuC1"</code>, a @c uint32 length of the
+     * chunk's output filename, the filename, a @c uint64 payload size, and
+     * then the payload, which is the chunk as a complete PLY file. The
+     * integers are in host byte order, as the stream is intended for a
+     * consumer on the same machine (a socket consumer can attach to the
+     * FIFO through a relay such as @c socat).
+     *
+     * The stream is opened lazily when the first chunk completes, so a FIFO
+     * consumer is not needed before there is anything to read.
+     *
+     * @param path        FIFO or file to stream the chunks to.
+     * @param readerType  Reader class able to read back files produced by
+     *                    the output writer (@ref COMPRESSED_READER when the
+     *                    writer is @ref COMPRESSED_WRITER, so that the
+     *                    payload is expanded back to PLY).
+     */
+    void setChunkStream(const std::string &path, ReaderType readerType = SYSCALL_READER)
+    {
+        chunkStreamPath = path;
+        chunkStreamReaderType = readerType;
+    }
+
+    /// Retrieve the path set with @ref setChunkStream (empty when disabled).
+    const std::string &getChunkStream() const { return chunkStreamPath; }
+
+    /**
+     * Sets a file to receive an index of the output chunks. One line is
+     * appended per non-empty chunk as it is finalized, containing the
+     * world-space bounds of the chunk (in the same coordinate frame as the
+     * output vertices), its vertex and triangle counts, and its filename:
+     * <pre>
+     * minX minY minZ maxX maxY maxZ vertices triangles filename
+     * </pre>
+     * The filename comes last because it may contain spaces. A spatial
+     * query over a large split output can then be answered from this one
+     * file instead of opening every chunk's header.
+     *
+     * The bounds are the nominal cell range of the chunk rather than a
+     * tight bound on its geometry, so they are valid (if slightly
+     * conservative) for culling. Computing them requires the bounding grid,
+     * which must be supplied with @ref setChunkGrid before @ref write.
+     *
+     * @param path   File to write the manifest to (replaced, not appended).
+     */
+    void setChunkManifest(const std::string &path) { chunkManifestPath = path; }
+
+    /// Retrieve the path set with @ref setChunkManifest (empty when disabled).
+    const std::string &getChunkManifest() const { return chunkManifestPath; }
+
+    /**
+     * Supplies the bounding grid and chunk size used to compute manifest
+     * bounds (see @ref setChunkManifest). The chunk with coordinates
+     * (x,y,z) covers cells [x&middot;@a chunkCells, (x+1)&middot;@a
+     * chunkCells) of @a grid along the first axis (clamped to the grid),
+     * and similarly for the others.
+     *
+     * @param grid        The bounding grid passed to the bucketer.
+     * @param chunkCells  Cells per chunk along each axis, or 0 if the
+     *                    output is not split (the whole grid is one chunk).
+     */
+    void setChunkGrid(const Grid &grid, Grid::size_type chunkCells)
+    {
+        chunkGrid = grid;
+        this->chunkCells = chunkCells;
+        haveChunkGrid = true;
+    }
+
+    /**
+     * Retrieves a functor that will accept the device output. It must only
+     * be called once per run.
      *
      * The functor might perform file I/O (depending on the subclass), in which
      * case it may throw any of the exceptions documented for @ref write.
      *
-     * @pre @a pass is less than @ref numPasses().
-     *
      * @warning The returned functor is @em not required to be thread-safe.
      */
-    virtual InputFunctor functor(unsigned int pass) = 0;
+    virtual InputFunctor functor() = 0;
 
     /**
      * Instead of calling @ref write, one may instead call this function. It will
@@ -293,6 +524,52 @@ public:
     virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
                                std::ostream *progressStream = NULL) = 0;
 
+    /**
+     * Snapshot the partially-built state in the middle of a reconstruction,
+     * so that a later run can pick up from this point instead of starting
+     * over (see @ref resumeRun). Unlike @ref checkpoint, which can only be
+     * called once all the geometry has been received, this may be called
+     * repeatedly while input is still arriving, provided that the caller has
+     * drained the pipeline: every block for generations up to and including
+     * @a completedGen must have been delivered to the input functor, and no
+     * blocks for later generations may have been. On return the mesher is
+     * ready to accept further input.
+     *
+     * The file is written to a temporary name and atomically renamed over
+     * @a path, so an existing checkpoint is not damaged if this fails
+     * part-way.
+     *
+     * @param tworker        Timeplot worker for the current thread.
+     * @param path           File to serialize the state to.
+     * @param completedGen   Last chunk generation fully delivered.
+     * @param progress       Progress recorded so far, returned by @ref
+     *                       resumeRun so the meter can be restarted from the
+     *                       same point.
+     * @throw std::ios_base::failure on I/O failure.
+     */
+    virtual void checkpointRun(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                               ChunkId::gen_type completedGen,
+                               ProgressMeter::size_type progress) = 0;
+
+    /**
+     * Reload state saved by @ref checkpointRun, prior to re-running the
+     * reconstruction. The caller must arrange for chunk generations up to
+     * and including the returned value to be skipped (see @ref
+     * BucketCollector::setResume) and may then feed the remaining input
+     * through the usual @ref functor / @ref write sequence.
+     *
+     * This must be called before @ref functor.
+     *
+     * @param tworker        Timeplot worker for the current thread.
+     * @param path           Checkpoint file written by @ref checkpointRun.
+     * @param[out] progress  Progress that had been recorded at checkpoint time.
+     * @return The last chunk generation captured by the checkpoint.
+     * @throw std::ios_base::failure on I/O failure, or if @a path was written
+     * by @ref checkpoint rather than @ref checkpointRun.
+     */
+    virtual ChunkId::gen_type resumeRun(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                                        ProgressMeter::size_type &progress) = 0;
+
     /**
      * Performs any final file I/O.
      *
@@ -309,11 +586,60 @@ protected:
     FastPly::Writer &getWriter() const { return writer; }
     std::string getOutputName(const ChunkId &id) const { return namer(id); }
 
+    /**
+     * Send one finalized output file down the chunk stream (see
+     * @ref setChunkStream). Does nothing when no stream is configured.
+     * The caller must ensure that all writes to @a filename, including
+     * asynchronous ones, have completed.
+     *
+     * @throw std::ios_base::failure if the stream could not be opened or written.
+     */
+    void streamChunk(const std::string &filename);
+
+    /**
+     * Append one line for a finalized output chunk to the manifest (see
+     * @ref setChunkManifest). Does nothing when no manifest is configured.
+     * The grid must have been supplied with @ref setChunkGrid.
+     *
+     * @param chunkId       ID of the chunk, for its cell coordinates.
+     * @param filename      Name of the output file the chunk was written to.
+     * @param numVertices   Number of vertices written to the chunk.
+     * @param numTriangles  Number of triangles written to the chunk.
+     *
+     * @throw std::ios_base::failure if the manifest could not be opened or written.
+     */
+    void manifestChunk(const ChunkId &chunkId, const std::string &filename,
+                       std::tr1::uint64_t numVertices, std::tr1::uint64_t numTriangles);
+
 private:
     /// Threshold set by @ref setPruneThreshold
     double pruneThreshold;
     /// Capacity set by @ref setReorderCapacity
     std::size_t reorderCapacity;
+    /// Capacity set by @ref setKeyMapCapacity
+    std::size_t keyMapCapacity;
+    /// Flag set by @ref setCheckManifold
+    bool checkManifold;
+    /// Flag set by @ref setTmpCompressed
+    bool tmpCompressed;
+    /// Flag set by @ref setVertexCacheOrder
+    bool vertexCacheOrder;
+    /// Path set by @ref setChunkStream (empty when streaming is disabled)
+    std::string chunkStreamPath;
+    /// Reader class set by @ref setChunkStream for reading back output files
+    ReaderType chunkStreamReaderType;
+    /// Chunk stream, opened lazily by @ref streamChunk
+    boost::scoped_ptr<boost::filesystem::ofstream> chunkStreamOut;
+    /// Path set by @ref setChunkManifest (empty when the manifest is disabled)
+    std::string chunkManifestPath;
+    /// Manifest file, opened lazily by @ref manifestChunk
+    boost::scoped_ptr<boost::filesystem::ofstream> chunkManifestOut;
+    /// Grid set by @ref setChunkGrid, for computing manifest bounds
+    Grid chunkGrid;
+    /// Cells per chunk set by @ref setChunkGrid (0 for an unsplit output)
+    Grid::size_type chunkCells;
+    /// Whether @ref setChunkGrid has been called
+    bool haveChunkGrid;
 
     FastPly::Writer &writer;       ///< Writer for output files
     const Namer namer;             ///< Output file namer
@@ -349,6 +675,15 @@ private:
  * External vertices are entered into a hash table that maps their keys to
  * their (global) chunk ID, and a chunk-local hash table that maps it to the
  * triangle index used to encode it.
+ *
+ * Note that all key sorting and welding happens incrementally while the
+ * device pipeline is still producing blocks: keys are welded against the
+ * hash tables as each block arrives, and welding maps that outgrow @ref
+ * setKeyMapCapacity are sorted at the moment they are spilled (see @ref
+ * spillKeyMap). By the time @ref write runs there is no key workload left
+ * to accelerate — in particular nothing that could be offloaded to the
+ * device sorts used by @ref Marching — and the write phase is bounded by
+ * the output filesystem rather than the CPU.
  */
 class OOCMesher : public MesherBase
 {
@@ -430,7 +765,7 @@ protected:
             }
         };
 
-        typedef Statistics::Container::unordered_map<cl_ulong, std::tr1::uint32_t> vertex_id_map_type;
+        typedef KeyMap<std::tr1::uint32_t> vertex_id_map_type;
 
         /// ID for this chunk, used to generate the filename
         ChunkId chunkId;
@@ -443,13 +778,34 @@ protected:
         /// Number of distinct external vertices in this chunk
         std::size_t numExternalVertices;
 
+        /**
+         * Sorted runs of welding-map entries spilled to the keys temporary
+         * file, as (offset in entries, number of entries) pairs. See
+         * @ref OOCMesher::spillVertexIdMap.
+         */
+        Statistics::Container::vector<std::pair<std::tr1::uint64_t, std::tr1::uint64_t> > spilledRuns;
+
+        /**
+         * Bloom filter over the keys in all of @ref spilledRuns. A key that
+         * misses here has definitely never been spilled, letting
+         * @ref OOCMesher::addExternalVertexKey skip the disk search for
+         * fresh keys.
+         */
+        BloomFilter spilledFilter;
+
+        /// Sequence number of the last @ref OOCMesher::add that touched this chunk
+        std::tr1::uint64_t lastTouched;
+
         /// Constructor
         explicit Chunk(const ChunkId chunkId = ChunkId())
             : chunkId(chunkId),
             clumps("mem.mesher.chunk.clumps"),
             bufferedClumps("mem.mesher.chunk.bufferedClumps"),
             vertexIdMap("mem.mesher.vertexIdMap"),
-            numExternalVertices(0) {}
+            numExternalVertices(0),
+            spilledRuns("mem.mesher.chunk.spilledRuns"),
+            spilledFilter("mem.mesher.chunk.spilledFilter"),
+            lastTouched(0) {}
 
         template<typename Archive>
         void serialize(Archive &ar, const unsigned int)
@@ -457,7 +813,7 @@ protected:
             ar & chunkId;
             ar & clumps;
             ar & numExternalVertices;
-            // bufferedClumps and vertexIdMap are not needed
+            // bufferedClumps, vertexIdMap and spilledRuns are not needed
         }
     };
 
@@ -542,12 +898,9 @@ protected:
     {
     private:
         TmpWriterWorkerGroup &owner;   ///< Owning worker group
-        std::ostream &verticesFile;    ///< File for temporary vertices
-        std::ostream &trianglesFile;   ///< File for temporary triangles
     public:
-        TmpWriterWorker(TmpWriterWorkerGroup &owner, std::ostream &verticesFile, std::ostream &trianglesFile)
-            : WorkerBase("tmpwriter", 0),
-            owner(owner), verticesFile(verticesFile), trianglesFile(trianglesFile) {}
+        explicit TmpWriterWorker(TmpWriterWorkerGroup &owner)
+            : WorkerBase("tmpwriter", 0), owner(owner) {}
         void operator()(TmpWriterItem &item);
     };
 
@@ -557,21 +910,33 @@ protected:
      * handle their removal once no longer needed. It does, however, close the
      * files when the group is stopped.
      *
+     * The files can optionally be stored in block-compressed containers (see
+     * @ref CompressedWriter), trading CPU time on the writer thread for
+     * scratch I/O volume. Compressed files do not support @ref startAppend,
+     * so compression must not be used on checkpointed runs.
+     *
      * Errors while writing the temporary files immediately terminate the program.
      */
     class TmpWriterWorkerGroup : public WorkerGroup<TmpWriterItem, TmpWriterWorker, TmpWriterWorkerGroup>
     {
+        friend class TmpWriterWorker;
         friend class ::TestTmpWriterWorkerGroup;
         friend class boost::serialization::access;
     private:
-        /// File to which vertices are written
-        boost::filesystem::ofstream verticesFile;
-        /// File to which triangles are written
-        boost::filesystem::ofstream trianglesFile;
+        /// File to which vertices are written (not open until the group is started)
+        boost::scoped_ptr<BinaryWriter> verticesFile;
+        /// File to which triangles are written (not open until the group is started)
+        boost::scoped_ptr<BinaryWriter> trianglesFile;
         /// Filename for @ref verticesFile
         boost::filesystem::path verticesPath;
         /// Filename for @ref trianglesFile
         boost::filesystem::path trianglesPath;
+        /// Append position in @ref verticesFile (logical bytes)
+        BinaryIO::offset_type verticesOffset;
+        /// Append position in @ref trianglesFile (logical bytes)
+        BinaryIO::offset_type trianglesOffset;
+        /// Whether the temporary files are block-compressed containers
+        bool compressed;
 
         /// Allocator for items
         CircularBufferBase itemAllocator;
@@ -583,6 +948,7 @@ protected:
         {
             ar & verticesPath;
             ar & trianglesPath;
+            ar & compressed;
         }
     public:
         /**
@@ -594,8 +960,24 @@ protected:
          * @copydoc WorkerGroup::start
          *
          * This also handles opening the temporary files.
+         *
+         * @param compressed  If true (and zlib support was compiled in),
+         *                    store the temporary files in block-compressed
+         *                    containers.
+         */
+        void start(bool compressed = false);
+
+        /**
+         * Variant of @ref start that reopens the existing temporary files
+         * for appending, instead of creating new ones. This is used after a
+         * mid-run checkpoint (which closes the files so that they are
+         * complete on disk) and when resuming from one. The files are always
+         * raw in this case (see the class documentation).
+         *
+         * @pre @ref start has been called previously, or the paths have been
+         * restored by deserialization.
          */
-        void start();
+        void startAppend();
 
         /**
          * Close the temporary files. This should not be called directly (it is called
@@ -617,6 +999,12 @@ protected:
          * not been called this will return an empty path.
          */
         const boost::filesystem::path &getTrianglesPath() const { return trianglesPath; }
+
+        /**
+         * Get the reader type to use to read the temporary files back,
+         * which depends on whether they were compressed.
+         */
+        ReaderType getReaderType() const { return compressed ? COMPRESSED_READER : SYSCALL_READER; }
     };
 
     // Needed to enable the curiously recursive template pattern
@@ -657,10 +1045,81 @@ private:
 
     Statistics::Container::vector<Clump> clumps;  ///< All clumps seen so far
 
-    typedef Statistics::Container::unordered_map<cl_ulong, clump_id> clump_id_map_type;
+    /// Edge-manifold verification, used only if @ref setCheckManifold enabled it
+    ManifoldChecker manifoldChecker;
+
+    typedef KeyMap<clump_id> clump_id_map_type;
     /// Maps external vertex keys to global clump IDs
     clump_id_map_type clumpIdMap;
 
+    /**
+     * On-disk representation of one entry of @ref Chunk::vertexIdMap when it
+     * has been spilled to the keys temporary file.
+     */
+    struct KeyMapEntry
+    {
+        cl_ulong key;                  ///< External vertex key
+        std::tr1::uint32_t vertexId;   ///< Bit-inverted external vertex index
+
+        bool operator<(const KeyMapEntry &b) const { return key < b.key; }
+    };
+
+    /// Entries read per I/O when rebuilding a @ref Chunk::spilledFilter
+    static const std::size_t REBUILD_BUFFER_ENTRIES = 4096;
+
+    /// Path to the keys temporary file (empty until first spill)
+    boost::filesystem::path keysPath;
+    /// Append-only stream for the keys temporary file
+    boost::filesystem::ofstream keysFile;
+    /// Reader over the keys temporary file, for binary searching spilled runs
+    boost::scoped_ptr<BinaryReader> keysRead;
+    /// Number of entries written to the keys temporary file
+    std::tr1::uint64_t keysTmpEntries;
+    /// Number of entries currently resident across all @ref Chunk::vertexIdMap instances
+    std::size_t residentKeyEntries;
+    /// Sequence number for @ref Chunk::lastTouched
+    std::tr1::uint64_t touchCounter;
+
+    /**
+     * Write @a chunk's welding map to the keys temporary file as a sorted run
+     * and release the in-memory map. Future lookups for the spilled entries
+     * binary search the run (see @ref findSpilledKey); new keys for the chunk
+     * accumulate in a fresh in-memory map which may later be spilled as
+     * another run. The spilled keys are also recorded in
+     * @ref Chunk::spilledFilter so that keys never seen before can bypass
+     * the search.
+     */
+    void spillVertexIdMap(Chunk &chunk);
+
+    /**
+     * Look up @a key in the sorted runs that @a chunk has spilled to the keys
+     * temporary file, most recent run first.
+     *
+     * @param chunk          Chunk whose runs to search.
+     * @param key            External vertex key to find.
+     * @param[out] vertexId  Bit-inverted external vertex index, if found.
+     * @return Whether the key was found.
+     */
+    bool findSpilledKey(const Chunk &chunk, cl_ulong key, std::tr1::uint32_t &vertexId);
+
+    /**
+     * Record an external vertex key in @a chunk's welding map, checking the
+     * resident map and then any spilled runs for an existing entry.
+     *
+     * @param chunk          Chunk to update.
+     * @param key            External vertex key.
+     * @return The bit-inverted external vertex index for the key, and whether
+     *         the key was newly added.
+     */
+    std::pair<std::tr1::uint32_t, bool> addExternalVertexKey(Chunk &chunk, cl_ulong key);
+
+    /**
+     * Spill least-recently-touched welding maps until the resident entries fit
+     * in @ref MesherBase::getKeyMapCapacity. The active chunk is never
+     * spilled.
+     */
+    void trimKeyMaps(const Chunk &active);
+
     /**
      * Identifies components with a local set of triangles, and
      * returns a union-find tree for them.
@@ -752,6 +1211,21 @@ protected:
     /// If set to true, will not delete the temporary files
     bool retainFiles;
 
+    /**
+     * Whether a mid-run checkpoint has been taken or resumed (see @ref
+     * checkpointRun). While true, @ref retainFiles is kept set so that a
+     * failure leaves the temporary files behind for the checkpoint to reuse;
+     * a successful @ref write clears it again so that they are reclaimed.
+     */
+    bool runCheckpointed;
+
+    /**
+     * Whether this mesher was reloaded by @ref resumeRun, in which case
+     * @ref functor must append to the existing temporary files rather than
+     * starting fresh ones.
+     */
+    bool resumedRun;
+
     /// Writer for temporary data
     TmpWriterWorkerGroup tmpWriter;
 
@@ -767,6 +1241,13 @@ protected:
      */
     void finalize(Timeplot::Worker &tworker);
 
+    /**
+     * Collapse every parent chain in the clump union-find to a single hop,
+     * so that subsequent @c findRoot calls are one lookup each. This is only
+     * useful once welding is complete and the clump structure is final.
+     */
+    void flattenClumps();
+
     /**
      * Compute the number of components, vertices and triangles retained overall,
      * and update statistics. If @a record is true (the default), the statistics
@@ -857,6 +1338,11 @@ protected:
     /**
      * Transfer clumps from the vertices temporary file to the output file.
      *
+     * If @a verticesTmpRead exposes the file contents through
+     * @ref BinaryReader::data (a memory-mapped reader), the clumps are
+     * written to the output directly from the mapping, without being copied
+     * through @a asyncWriter.
+     *
      * @param tworker           Worker to pass to @ref AsyncWriter::get
      * @param verticesTmpRead   Reader for the vertices temporary file
      * @param asyncWriter       Asynchronous writer to schedule through
@@ -881,9 +1367,40 @@ protected:
         ProgressMeter *progress,
         std::size_t firstClump, std::size_t lastClump);
 
+    /**
+     * Thread entry point that runs @ref writeChunkVertices over all clumps of
+     * a chunk. It allows @ref write to overlap the vertex pass with the
+     * triangle pass, which use separate temporary files and disjoint regions
+     * of the output file. Any exception is captured into @a error for the
+     * spawning thread to rethrow after joining.
+     *
+     * @param tworker           Worker for recording the thread's actions
+     * @param verticesTmpRead   Reader for the vertices temporary file
+     * @param asyncWriter       Asynchronous writer to schedule through
+     * @param chunk             Output chunk to write
+     * @param thresholdVertices Threshold for retaining components (see @ref getStatistics)
+     * @param startVertex       Position (in vertices) to start writing each clump (see @ref writeChunkPrepare)
+     * @param progress          If non-NULL, updated with the number of triangles processed
+     * @param[out] error        Set to the exception thrown, if any
+     */
+    void writeChunkVerticesThread(
+        Timeplot::Worker &tworker,
+        BinaryReader &verticesTmpRead,
+        AsyncWriter &asyncWriter,
+        const Chunk &chunk,
+        std::tr1::uint64_t thresholdVertices,
+        const std::tr1::uint32_t *startVertex,
+        ProgressMeter *progress,
+        boost::exception_ptr &error);
+
     /**
      * Transfer clumps from the triangles temporary file to the output file.
      *
+     * If @a trianglesTmpRead exposes the file contents through
+     * @ref BinaryReader::data (a memory-mapped reader), the index rewrite
+     * reads each clump directly from the mapping and @a triangles is left
+     * untouched.
+     *
      * @param tworker           Worker to pass to @ref AsyncWriter::get
      * @param trianglesTmpRead  Reader for the triangles temporary file
      * @param asyncWriter       Asynchronous writer to schedule through
@@ -899,6 +1416,12 @@ protected:
      * @param[in,out] triangles Temporary buffer the callee may use to hold data
      * @param progress          If non-NULL, updated with the number of triangles written
      * @param firstClump, lastClump Range of clumps to process
+     * @param positions         If normals are being accumulated, the chunk's
+     *                          vertex positions indexed by final vertex index
+     *                          (see @ref writeChunkNormals)
+     * @param[in,out] normalSums If non-NULL, each written triangle's
+     *                          area-weighted face normal is added to the
+     *                          entries of its three vertices
      *
      * @pre @ref finalize has been called
      */
@@ -914,7 +1437,51 @@ protected:
         const std::tr1::uint32_t *externalRemap,
         Statistics::Container::PODBuffer<triangle_type> &triangles,
         ProgressMeter *progress,
-        std::size_t firstClump, std::size_t lastClump);
+        std::size_t firstClump, std::size_t lastClump,
+        const float *positions = NULL,
+        float *normalSums = NULL);
+
+    /**
+     * Write one output chunk with per-vertex normals (see
+     * @ref FastPly::Writer::setNormals). Normals require the vertex and
+     * triangle passes to cooperate — each triangle contributes its
+     * area-weighted face normal to its three vertices — so instead of the
+     * two concurrent streaming passes used by the plain path, the chunk's
+     * vertex positions are held in memory while the triangles are written,
+     * and the vertices (with the accumulated, normalized normals
+     * interleaved) follow in a final pass. The extra memory is transient
+     * and proportional to the largest chunk, not to the whole mesh.
+     *
+     * @param tworker           Worker to pass to @ref AsyncWriter::get
+     * @param verticesTmpRead   Reader for the vertices temporary file
+     * @param trianglesTmpRead  Reader for the triangles temporary file
+     * @param asyncWriter       Asynchronous writer to schedule through
+     * @param chunk             Output chunk to write
+     * @param chunkVertices     Number of vertices in the output chunk (see @ref getChunkStatistics)
+     * @param thresholdVertices Threshold for retaining components (see @ref getStatistics)
+     * @param chunkExternal     Total number of external vertices for the chunk (see @ref getChunkStatistics)
+     * @param startVertex       Position (in vertices) to start writing each clump (see @ref writeChunkPrepare)
+     * @param startTriangle     Position (in triangles) to start writing each clump
+     * @param externalRemap     Maps external vertex indices to final indices
+     * @param[in,out] triangles Temporary buffer the callee may use to hold data
+     * @param progress          If non-NULL, updated with twice the number of triangles written
+     *
+     * @pre @ref finalize has been called, and the writer has normals enabled.
+     */
+    void writeChunkNormals(
+        Timeplot::Worker &tworker,
+        BinaryReader &verticesTmpRead,
+        BinaryReader &trianglesTmpRead,
+        AsyncWriter &asyncWriter,
+        const Chunk &chunk,
+        std::tr1::uint64_t chunkVertices,
+        std::tr1::uint64_t thresholdVertices,
+        std::size_t chunkExternal,
+        const std::tr1::uint32_t *startVertex,
+        const FastPly::Writer::size_type *startTriangle,
+        const std::tr1::uint32_t *externalRemap,
+        Statistics::Container::PODBuffer<triangle_type> &triangles,
+        ProgressMeter *progress);
 
 public:
     /**
@@ -924,14 +1491,29 @@ public:
 
     ~OOCMesher();
 
-    virtual unsigned int numPasses() const { return 1; }
-    virtual InputFunctor functor(unsigned int pass);
+    virtual InputFunctor functor();
     virtual std::size_t write(Timeplot::Worker &tworker, std::ostream *progressStream = NULL);
     virtual void checkpoint(Timeplot::Worker &tworker, const boost::filesystem::path &path);
     virtual std::size_t resume(Timeplot::Worker &tworker, const boost::filesystem::path &path,
                                std::ostream *progressStream = NULL);
+    virtual void checkpointRun(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                               ChunkId::gen_type completedGen,
+                               ProgressMeter::size_type progress);
+    virtual ChunkId::gen_type resumeRun(Timeplot::Worker &tworker, const boost::filesystem::path &path,
+                                        ProgressMeter::size_type &progress);
 };
 
+/**
+ * Determine whether a checkpoint file describes a completed reconstruction
+ * (written by @ref MesherBase::checkpoint, so only @ref MesherBase::resume is
+ * needed) or a mid-run snapshot (written by @ref MesherBase::checkpointRun,
+ * requiring the reconstruction pipeline to be re-run with
+ * @ref MesherBase::resumeRun).
+ *
+ * @throw std::ios_base::failure if the file could not be read.
+ */
+bool checkpointIsComplete(const boost::filesystem::path &path);
+
 /**
  * Creates an adapter between @ref MesherBase::InputFunctor and @ref Marching::OutputFunctor
  * that reads the mesh from the device to the host synchronously.
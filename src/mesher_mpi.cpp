@@ -36,6 +36,8 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/scoped_array.hpp>
 #include <boost/exception/all.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread/thread.hpp>
 #include "statistics.h"
 #include "allocator.h"
@@ -65,6 +67,15 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
     finalize(tworker);
     if (rank == root)
     {
+        /* Flatten the clump union-find before it is serialized. Welding on
+         * the gather rank leaves parent chains behind; collapsing every
+         * chain to a single hop here means each of the many findRoot calls
+         * in the write loops below is one lookup on every rank, instead of
+         * each rank separately re-walking (and re-compressing) the same
+         * chains after the broadcast.
+         */
+        flattenClumps();
+
         std::ostringstream dump;
         boost::archive::text_oarchive archive(dump);
         archive << *this;
@@ -81,9 +92,9 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
         archive >> *this;
     }
 
-    boost::scoped_ptr<BinaryReader> verticesTmpRead(createReader(SYSCALL_READER));
+    boost::scoped_ptr<BinaryReader> verticesTmpRead(createReader(tmpWriter.getReaderType()));
     verticesTmpRead->open(tmpWriter.getVerticesPath());
-    boost::scoped_ptr<BinaryReader> trianglesTmpRead(createReader(SYSCALL_READER));
+    boost::scoped_ptr<BinaryReader> trianglesTmpRead(createReader(tmpWriter.getReaderType()));
     trianglesTmpRead->open(tmpWriter.getTrianglesPath());
 
     std::tr1::uint64_t thresholdVertices;
@@ -104,8 +115,12 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
             progressDisplay.reset(new ProgressDisplay(2 * keptTriangles, *progressStream));
         }
         progress.reset(new ProgressMPI(progressDisplay.get(), 2 * keptTriangles, comm, root));
-        if (rank == root)
-            progressThread.reset(new boost::thread(boost::ref(*progress)));
+        /* Every rank runs a relay in the progress reduction tree, with one
+         * local producer: the writing code below. The root's relay is the
+         * one that feeds the display.
+         */
+        progressThread.reset(new boost::thread(
+            boost::bind(&ProgressMPI::operator(), progress.get(), 1U)));
     }
 
     /* Maps from an linear enumeration of all external vertices of a chunk to
@@ -120,7 +135,9 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
     Statistics::Container::PODBuffer<FastPly::Writer::size_type> startTriangle("mem.OOCMesher::startTriangle");
     Statistics::Container::PODBuffer<triangle_type> triangles("mem.OOCMesher::triangles");
 
-    AsyncWriter asyncWriter(1, asyncMem * 2); // * 2 to allow overlapping
+    // * 4: the vertex and triangle passes each keep up to two items in flight
+    AsyncWriter asyncWriter(1, asyncMem * 4);
+    Timeplot::Worker vertexTworker("vertexwriter");
 
     /* When there are many chunks, we can simplify partition over chunks, and avoid worrying
      * about interference between output files. When there aren't enough chunks we have to
@@ -131,7 +148,11 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
      * to be complex logic to create a communicator for each subset of processes that share
      * access to a file, and to sequence the operations to avoid stalls.
      */
-    bool perChunk = (chunks.size() >= (std::size_t) size);
+    /* Normals force the per-chunk scheme: in the clump-partitioned scheme a
+     * rank only sees some of the triangles incident on a shared vertex, so
+     * it cannot accumulate that vertex's normal locally.
+     */
+    bool perChunk = (chunks.size() >= (std::size_t) size) || writer.getNormals();
     std::size_t firstChunk, lastChunk;
 
     if (perChunk)
@@ -184,17 +205,68 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
                     last = mulDiv(chunk.clumps.size(), rank + 1, size);
                 }
 
-                writeChunkVertices(
-                    tworker, *verticesTmpRead, asyncWriter, chunk,
-                    thresholdVertices, startVertex.data(), progress.get(),
-                    first, last);
+                if (perChunk && writer.getNormals())
+                {
+                    /* Normals couple the vertex and triangle passes (each
+                     * triangle contributes to its vertices), so they run as
+                     * cooperative serial passes instead.
+                     */
+                    writeChunkNormals(
+                        tworker, *verticesTmpRead, *trianglesTmpRead,
+                        asyncWriter, chunk,
+                        chunkVertices, thresholdVertices, chunkExternal,
+                        startVertex.data(), startTriangle.data(), externalRemap.data(),
+                        triangles, progress.get());
+                }
+                else if (perChunk)
+                {
+                    /* As in OOCMesher::write, overlap the vertex and triangle
+                     * passes on separate threads: they read separate temporary
+                     * files and write disjoint regions of the output. This
+                     * roughly halves the per-chunk wall time of the serial
+                     * writeback tail. In the clump-partitioned path below the
+                     * ranks already share each chunk, so it stays serial.
+                     */
+                    boost::exception_ptr verticesError;
+                    boost::thread verticesThread(boost::bind(
+                        &OOCMesherMPI::writeChunkVerticesThread, this,
+                        boost::ref(vertexTworker), boost::ref(*verticesTmpRead),
+                        boost::ref(asyncWriter), boost::cref(chunk),
+                        thresholdVertices, startVertex.data(), progress.get(),
+                        boost::ref(verticesError)));
 
-                writeChunkTriangles(
-                    tworker, *trianglesTmpRead, asyncWriter, chunk,
-                    thresholdVertices, chunkExternal,
-                    startVertex.data(), startTriangle.data(), externalRemap.data(),
-                    triangles, progress.get(),
-                    first, last);
+                    try
+                    {
+                        writeChunkTriangles(
+                            tworker, *trianglesTmpRead, asyncWriter, chunk,
+                            thresholdVertices, chunkExternal,
+                            startVertex.data(), startTriangle.data(), externalRemap.data(),
+                            triangles, progress.get(),
+                            first, last);
+                    }
+                    catch (...)
+                    {
+                        verticesThread.join();
+                        throw;
+                    }
+                    verticesThread.join();
+                    if (verticesError)
+                        boost::rethrow_exception(verticesError);
+                }
+                else
+                {
+                    writeChunkVertices(
+                        tworker, *verticesTmpRead, asyncWriter, chunk,
+                        thresholdVertices, startVertex.data(), progress.get(),
+                        first, last);
+
+                    writeChunkTriangles(
+                        tworker, *trianglesTmpRead, asyncWriter, chunk,
+                        thresholdVertices, chunkExternal,
+                        startVertex.data(), startTriangle.data(), externalRemap.data(),
+                        triangles, progress.get(),
+                        first, last);
+                }
 
                 writer.close();
                 if (!perChunk)
@@ -206,13 +278,37 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
                     << boost::errinfo_file_name(filename)
                     << boost::errinfo_errno(errno);
             }
+
+            if (!getChunkStream().empty())
+            {
+                if (perChunk)
+                {
+                    /* Drain the async writer so the file is complete before
+                     * it is handed over; each rank streams the chunks it
+                     * wrote, to the stream path on its own node.
+                     */
+                    asyncWriter.stop();
+                    streamChunk(filename);
+                    asyncWriter.start();
+                }
+                else if (rank == root)
+                {
+                    /* The collective close above completed every rank's
+                     * writes, so the root can stream the whole file.
+                     */
+                    streamChunk(filename);
+                }
+            }
         }
     }
 
     if (perChunk)
         asyncWriter.stop();
     if (progress)
+    {
         progress->sync();
+        progress->close();
+    }
 
     if (perChunk)
     {
@@ -222,10 +318,26 @@ std::size_t OOCMesherMPI::write(Timeplot::Worker &tworker, std::ostream *progres
                    MPI_SUM, root, comm);
         outputFiles = totalOutputFiles;
     }
-    if (rank == root)
-    {
+    if (progressThread)
         progressThread->join();
+    if (rank == root)
         Statistics::getStatistic<Statistics::Counter>("output.files").add(outputFiles);
+
+    if (rank == root && !getChunkManifest().empty())
+    {
+        /* In the per-chunk scheme most of the chunks were written by other
+         * ranks, so the manifest cannot be emitted incrementally inside the
+         * loop above. Every rank holds the full welded state after the
+         * broadcast, so the root enumerates all the chunks here instead.
+         */
+        for (std::size_t i = 0; i < chunks.size(); i++)
+        {
+            const Chunk &chunk = chunks[i];
+            std::tr1::uint64_t chunkVertices, chunkTriangles, chunkExternal;
+            getChunkStatistics(thresholdVertices, chunk, chunkVertices, chunkTriangles, chunkExternal);
+            if (chunkTriangles > 0)
+                manifestChunk(chunk.chunkId, getOutputName(chunk.chunkId), chunkVertices, chunkTriangles);
+        }
     }
 
     // To ensure that the timer gives useful information
@@ -35,11 +35,19 @@
 #include <string>
 #include <errno.h>
 #include <climits>
+#include <vector>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/exception/all.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
 
-static boost::filesystem::path tmpFileDir;
+/// Directories over which temporary files are striped (empty to use the system default)
+static std::vector<boost::filesystem::path> tmpFileDirs;
+/// Index into @ref tmpFileDirs of the directory to use for the next temporary file
+static std::size_t tmpFileDirNext = 0;
+/// Protects @ref tmpFileDirs and @ref tmpFileDirNext
+static boost::mutex tmpFileDirsMutex;
 
 DownDivider::DownDivider(std::tr1::uint32_t d)
 {
@@ -73,13 +81,60 @@ DownDivider::DownDivider(std::tr1::uint32_t d)
     }
 }
 
-void createTmpFile(boost::filesystem::path &path, boost::filesystem::ofstream &out)
+std::tr1::uint16_t floatToHalf(float x)
+{
+    const std::tr1::uint32_t bits = floatToBits(x);
+    const std::tr1::uint16_t sign = (bits >> 16) & 0x8000U;
+    const std::tr1::int32_t exponent = int((bits >> 23) & 0xFFU) - 127;
+    std::tr1::uint32_t mantissa = bits & 0x7FFFFFU;
+
+    if (exponent == 128)                  // infinity or NaN
+        return sign | 0x7C00U | (mantissa != 0 ? 0x200U | (mantissa >> 13) : 0);
+    if (exponent > 15)                    // too large: round to infinity
+        return sign | 0x7C00U;
+
+    mantissa |= 0x800000U;                // make the leading 1 explicit
+    /* Shift so that 10 mantissa bits remain; values below the normal range
+     * shift further, producing a denormal (or zero).
+     */
+    int shift = 13;
+    if (exponent < -14)
+        shift += -14 - exponent;
+    if (shift > 24)
+        return sign;                      // rounds to zero even after the halfway rule
+    const std::tr1::uint32_t half = std::tr1::uint32_t(1) << (shift - 1);
+    const std::tr1::uint32_t rest = mantissa & ((half << 1) - 1);
+    mantissa >>= shift;
+    if (rest > half || (rest == half && (mantissa & 1)))
+        mantissa++;                       // round to nearest, ties to even
+    // A mantissa overflow here carries into the exponent, which is exactly right
+    std::tr1::uint32_t ans = mantissa;
+    if (exponent >= -14)
+        ans += std::tr1::uint32_t(exponent + 14) << 10; // mantissa MSB supplies +1
+    return sign | std::tr1::uint16_t(ans);
+}
+
+void createTmpPath(boost::filesystem::path &path)
 {
-    path = tmpFileDir;
+    {
+        boost::lock_guard<boost::mutex> lock(tmpFileDirsMutex);
+        if (!tmpFileDirs.empty())
+        {
+            path = tmpFileDirs[tmpFileDirNext];
+            tmpFileDirNext = (tmpFileDirNext + 1) % tmpFileDirs.size();
+        }
+        else
+            path.clear();
+    }
     if (path.empty())
         path = boost::filesystem::temp_directory_path();
     boost::filesystem::path name = boost::filesystem::unique_path("mlsgpu-tmp-%%%%-%%%%-%%%%-%%%%");
     path /= name; // appends
+}
+
+void createTmpFile(boost::filesystem::path &path, boost::filesystem::ofstream &out)
+{
+    createTmpPath(path);
     out.open(path, std::ios::binary);
     if (!out)
     {
@@ -92,5 +147,14 @@ void createTmpFile(boost::filesystem::path &path, boost::filesystem::ofstream &o
 
 void setTmpFileDir(const boost::filesystem::path &path)
 {
-    tmpFileDir = path;
+    boost::lock_guard<boost::mutex> lock(tmpFileDirsMutex);
+    tmpFileDirs.assign(1, path);
+    tmpFileDirNext = 0;
+}
+
+void setTmpFileDirs(const std::vector<boost::filesystem::path> &paths)
+{
+    boost::lock_guard<boost::mutex> lock(tmpFileDirsMutex);
+    tmpFileDirs = paths;
+    tmpFileDirNext = 0;
 }
@@ -36,6 +36,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <limits>
+#include <vector>
 #include "tr1_cstdint.h"
 #include <cstring>
 #include <stdexcept>
@@ -193,22 +194,56 @@ static inline std::tr1::uint32_t floatToBits(float x)
 }
 
 /**
- * Create and open a temporary file. If @ref setTmpFileDir has been called, that
- * directory is used, otherwise it uses the @c boost::filesystem default. The
+ * Convert a single-precision value to the bits of an IEEE 754 half-precision
+ * (binary16) value, rounding to nearest-even. Values too large for a half
+ * become infinities, denormal results are supported, and NaNs stay NaNs. The
+ * result matches what @c vload_half on an OpenCL device will reconstruct.
+ */
+std::tr1::uint16_t floatToHalf(float x);
+
+/**
+ * Create and open a temporary file. If @ref setTmpFileDir or @ref
+ * setTmpFileDirs has been called, the configured directories are used in
+ * round-robin order (so that successive temporary files are striped across
+ * scratch devices), otherwise it uses the @c boost::filesystem default. The
  * file is opened for output in binary mode.
  *
+ * This function is thread-safe.
+ *
  * @param[out] path      The path to the temporary file.
  * @param[out] out       The open temporary file.
  * @throw std::ios::failure if the file could not be opened (with boost error
  * info on the filename and errno)
  *
- * @see @ref setTmpFileDir
+ * @see @ref setTmpFileDir, @ref setTmpFileDirs
  */
 void createTmpFile(boost::filesystem::path &path, boost::filesystem::ofstream &out);
 
+/**
+ * Pick a name for a new temporary file, using the same directory rotation as
+ * @ref createTmpFile, but do not open (or create) it. This is used when the
+ * file will be opened through an interface other than @c
+ * boost::filesystem::ofstream, such as @ref BinaryWriter.
+ *
+ * This function is thread-safe.
+ *
+ * @param[out] path      The path to use for the temporary file.
+ *
+ * @see @ref setTmpFileDir, @ref setTmpFileDirs
+ */
+void createTmpPath(boost::filesystem::path &path);
+
 /**
  * Set the directory to use for temporary files created by @ref createTmpFile.
  */
 void setTmpFileDir(const boost::filesystem::path &tmpFileDir);
 
+/**
+ * Set several directories for temporary files created by @ref createTmpFile.
+ * The directories are used in round-robin order, which spreads the temporary
+ * I/O load when they are backed by separate devices. Passing an empty vector
+ * reverts to the @c boost::filesystem default.
+ */
+void setTmpFileDirs(const std::vector<boost::filesystem::path> &tmpFileDirs);
+
 #endif /* MLSGPU_MISC_H */
@@ -33,14 +33,19 @@
 #endif
 
 #include <CL/cl.hpp>
+#include <cstdio>
 #include <stdexcept>
 #include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
 #include <boost/math/constants/constants.hpp>
 #include "errors.h"
 #include "mls.h"
 #include "clh.h"
 #include "misc.h"
 #include "statistics.h"
+#include "autotune.h"
+#include "timer.h"
 
 std::map<std::string, MlsShape> MlsShapeWrapper::getNameMap()
 {
@@ -50,32 +55,199 @@ std::map<std::string, MlsShape> MlsShapeWrapper::getNameMap()
     return ans;
 }
 
-const Grid::size_type MlsFunctor::wgs[3] = {8, 8, 8};
-const int MlsFunctor::subsamplingMin = 3; // must be at least log2 of highest wgs
+const Grid::size_type MlsFunctor::maxWgs[3] = {8, 8, 8};
+const Grid::size_type MlsFunctor::fillWgs[2] = {16, 16};
+const Grid::size_type MlsFunctor::classifyWgs = 64;
+const int MlsFunctor::subsamplingMin = 3; // must be at least log2 of highest maxWgs
 
-MlsFunctor::MlsFunctor(const cl::Context &context, MlsShape shape)
-    : kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.processCorners.time"))
+MlsFunctor::MlsFunctor(const cl::Context &context, MlsShape shape, bool halfNormals)
+    : context(context),
+    halfNormals(halfNormals),
+    cellsCapacity(0),
+    kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.processCorners.time")),
+    persistentTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.processCornersPersistent.time")),
+    fillTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.fillCorners.time")),
+    classifyTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.classifyCells.time")),
+    occupiedStat(Statistics::getStatistic<Statistics::Variable>("kernel.mls.cells.occupied")),
+    timeSlice(0.0),
+    cellRate(0.0)
 {
+    init(shape, tuneConfig(context, shape));
+}
+
+MlsFunctor::MlsFunctor(const cl::Context &context, MlsShape shape, const std::string &config)
+    : context(context),
+    halfNormals(false),
+    cellsCapacity(0),
+    kernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.processCorners.time")),
+    persistentTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.processCornersPersistent.time")),
+    fillTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.fillCorners.time")),
+    classifyTime(Statistics::getStatistic<Statistics::Variable>("kernel.mls.classifyCells.time")),
+    occupiedStat(Statistics::getStatistic<Statistics::Variable>("kernel.mls.cells.occupied")),
+    timeSlice(0.0),
+    cellRate(0.0)
+{
+    init(shape, config);
+}
+
+void MlsFunctor::init(MlsShape shape, const std::string &config)
+{
+    unsigned int x, y, z, bucket;
+    int fields = sscanf(config.c_str(), "%ux%ux%u/%u", &x, &y, &z, &bucket);
+    MLSGPU_ASSERT(fields == 4, std::invalid_argument);
+    wgs[0] = x;
+    wgs[1] = y;
+    wgs[2] = z;
+    maxBucket = bucket;
+    persistentGroups = 0;
+
     // These would ideally be static assertions, but C++ doesn't allow that
-    MLSGPU_ASSERT((1U << subsamplingMin) >= *std::max_element(wgs, wgs + 3), std::length_error);
+    MLSGPU_ASSERT((1U << subsamplingMin) >= *std::max_element(maxWgs, maxWgs + 3), std::length_error);
+    for (int i = 0; i < 3; i++)
+        MLSGPU_ASSERT(wgs[i] > 0 && wgs[i] <= maxWgs[i], std::invalid_argument);
+    // The kernel requires a full bucket of cooperating work items
+    MLSGPU_ASSERT(wgs[0] * wgs[1] * wgs[2] >= maxBucket, std::invalid_argument);
 
     std::map<std::string, std::string> defines;
     defines["WGS_X"] = boost::lexical_cast<std::string>(wgs[0]);
     defines["WGS_Y"] = boost::lexical_cast<std::string>(wgs[1]);
     defines["WGS_Z"] = boost::lexical_cast<std::string>(wgs[2]);
+    defines["MAX_BUCKET"] = boost::lexical_cast<std::string>(maxBucket);
+    defines["FILL_WGS_X"] = boost::lexical_cast<std::string>(fillWgs[0]);
+    defines["FILL_WGS_Y"] = boost::lexical_cast<std::string>(fillWgs[1]);
+    defines["CLASSIFY_WGS"] = boost::lexical_cast<std::string>(classifyWgs);
     defines["FIT_SPHERE"] = shape == MLS_SHAPE_SPHERE ? "1" : "0";
     defines["FIT_PLANE"] = shape == MLS_SHAPE_PLANE ? "1" : "0";
+    defines["HALF_NORMALS"] = halfNormals ? "1" : "0";
+    defines["KERNEL_STATS"] = Statistics::isKernelCountersEnabled() ? "1" : "0";
 
     cl::Program program = CLH::build(context, "kernels/mls.cl", defines);
     kernel = cl::Kernel(program, "processCorners");
+    persistentKernel = cl::Kernel(program, "processCornersPersistent");
+    fillKernel = cl::Kernel(program, "fillCorners");
+    classifyKernel = cl::Kernel(program, "classifyCells");
+    numCells = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+
+    if (Statistics::isKernelCountersEnabled())
+    {
+        // The order must match the STATS_* slot assignments in mls.cl
+        std::vector<std::string> names;
+        names.push_back("kernel.mls.cells.exact");
+        names.push_back("kernel.mls.cells.persistent");
+        names.push_back("kernel.mls.cells.classified");
+        kernelCounters.reset(new Statistics::KernelCounters(context, names));
+        // The counter buffer is the trailing argument of each counting kernel
+        kernel.setArg(13, kernelCounters->getBuffer());
+        persistentKernel.setArg(13, kernelCounters->getBuffer());
+        classifyKernel.setArg(7, kernelCounters->getBuffer());
+    }
 
     setBoundaryLimit(1.0f);
 }
 
+double MlsFunctor::benchmark(const cl::Context &context, MlsShape shape,
+                             const std::string &config)
+{
+    MlsFunctor functor(context, shape, config);
+    /* Pin the exact-sized launch path so that the tuning measurement is not
+     * diluted by the persistent-threads dispatch overhead model, which does
+     * not depend on the configuration being tuned.
+     */
+    functor.persistentGroups = 1;
+
+    /* Synthetic workload: a fully-occupied swathe in which every cell's
+     * bucket chain starts at command 0 and lists every splat. The splats are
+     * scattered with large radii so the fitting math runs over real data.
+     */
+    const Grid::size_type width = 128;
+    const Grid::size_type height = 128;
+    const Grid::size_type depth = 32;
+    const unsigned int shift = subsamplingMin;
+    const unsigned int numSplats = 320;
+
+    // Two-plane layout: position/radius plane then normal/quality plane
+    std::vector<cl_float> hSplats(numSplats * 8);
+    for (unsigned int i = 0; i < numSplats; i++)
+    {
+        const float radius = 256.0f;
+        hSplats[i * 4 + 0] = (i * 37) % width;
+        hSplats[i * 4 + 1] = (i * 53) % height;
+        hSplats[i * 4 + 2] = (i * 11) % depth;
+        hSplats[i * 4 + 3] = 1.0f / (radius * radius);
+        hSplats[(numSplats + i) * 4 + 0] = 0.0f;
+        hSplats[(numSplats + i) * 4 + 1] = 0.0f;
+        hSplats[(numSplats + i) * 4 + 2] = 1.0f;
+        hSplats[(numSplats + i) * 4 + 3] = 1.0f;
+    }
+
+    std::vector<cl_int> hCommands(numSplats + 2);
+    hCommands[0] = numSplats + 1;          // end of the splat run
+    for (unsigned int i = 0; i < numSplats; i++)
+        hCommands[i + 1] = i;
+    hCommands[numSplats + 1] = -1;         // no further chain
+
+    // Codes use interleaved 7-bit coordinates, shifted down by 3 * shift
+    const std::size_t startSize = std::size_t(1) << (21 - 3 * shift);
+    std::vector<cl_int> hStart(startSize, 0);
+
+    const cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+    cl::CommandQueue queue(context, device);
+    cl::Buffer splats(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                      hSplats.size() * sizeof(cl_float), &hSplats[0]);
+    cl::Buffer commands(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        hCommands.size() * sizeof(cl_int), &hCommands[0]);
+    cl::Buffer start(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                     hStart.size() * sizeof(cl_int), &hStart[0]);
+    cl::Image2D image(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT),
+                      width, height * depth + height);
+
+    const Grid::difference_type offset[3] = {0, 0, 0};
+    functor.set(offset, splats, numSplats, commands, start, 0, shift);
+
+    Marching::Swathe swathe;
+    swathe.width = width;
+    swathe.height = height;
+    swathe.zFirst = 0;
+    swathe.zLast = depth - 1;
+    swathe.zStride = height;
+    swathe.zBias = 0;
+
+    functor.enqueue(queue, image, swathe, NULL, NULL); // warm-up
+    queue.finish();
+
+    const unsigned int passes = 3;
+    Timer timer;
+    for (unsigned int i = 0; i < passes; i++)
+        functor.enqueue(queue, image, swathe, NULL, NULL);
+    queue.finish();
+    return timer.getElapsed() / passes;
+}
+
+std::string MlsFunctor::tuneConfig(const cl::Context &context, MlsShape shape)
+{
+    const cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+
+    std::vector<std::string> candidates;
+    candidates.push_back("8x8x8/256");     // the historical fixed configuration
+    candidates.push_back("8x8x4/256");
+    candidates.push_back("8x4x8/256");
+    candidates.push_back("4x8x8/256");
+    candidates.push_back("8x8x8/128");
+    candidates.push_back("8x8x4/128");
+    candidates.push_back("8x4x4/128");
+    candidates.push_back("4x8x4/128");
+
+    const std::string algorithm = (shape == MLS_SHAPE_SPHERE) ? "mls.sphere" : "mls.plane";
+    return Autotune::tune(device, algorithm, candidates,
+                          boost::bind(&MlsFunctor::benchmark, boost::cref(context), shape, _1));
+}
+
 void MlsFunctor::set(const Grid::difference_type offset[3],
                      const cl::Buffer &splats,
+                     std::size_t splatStride,
                      const cl::Buffer &commands,
                      const cl::Buffer &start,
+                     cl_uint startBase,
                      unsigned int subsamplingShift)
 {
     cl_int3 offset3 = {{ offset[0], offset[1], offset[2] }};
@@ -83,14 +255,29 @@ void MlsFunctor::set(const Grid::difference_type offset[3],
     kernel.setArg(1, splats);
     kernel.setArg(2, commands);
     kernel.setArg(3, start);
-    kernel.setArg(4, 3 * subsamplingShift);
-    kernel.setArg(5, offset3);
+    kernel.setArg(4, startBase);
+    kernel.setArg(5, 3 * subsamplingShift);
+    kernel.setArg(6, offset3);
+    kernel.setArg(12, (cl_uint) splatStride);
+
+    persistentKernel.setArg(1, splats);
+    persistentKernel.setArg(2, commands);
+    persistentKernel.setArg(3, start);
+    persistentKernel.setArg(4, startBase);
+    persistentKernel.setArg(5, 3 * subsamplingShift);
+    persistentKernel.setArg(6, offset3);
+    persistentKernel.setArg(12, (cl_uint) splatStride);
+
+    classifyKernel.setArg(2, start);
+    classifyKernel.setArg(3, startBase);
+    classifyKernel.setArg(4, 3 * subsamplingShift);
 }
 
 void MlsFunctor::set(const Grid::difference_type offset[3],
-                     const SplatTreeCL &tree, unsigned int subsamplingShift)
+                     const SplatTreeCL &tree, std::size_t bin, unsigned int subsamplingShift)
 {
-    set(offset, tree.getSplats(), tree.getCommands(), tree.getStart(), subsamplingShift);
+    set(offset, tree.getSplats(), tree.getSplatStride(), tree.getCommands(), tree.getStart(),
+        tree.getStartBase(bin), subsamplingShift);
 }
 
 const Grid::size_type *MlsFunctor::alignment() const
@@ -114,10 +301,6 @@ void MlsFunctor::enqueue(
     MLSGPU_ASSERT(distance.getImageInfo<CL_IMAGE_WIDTH>() >= width, std::length_error);
     MLSGPU_ASSERT(distance.getImageInfo<CL_IMAGE_HEIGHT>() >= swathe.zStride * (swathe.zLast + 1) + swathe.zBias, std::length_error);
 
-    kernel.setArg(0, distance);
-    kernel.setArg(6, cl_uint(swathe.zStride));
-    kernel.setArg(7, cl_int(swathe.zBias));
-
     const std::size_t wgs3 = wgs[0] * wgs[1] * wgs[2];
     const std::size_t blocks[3] =
     {
@@ -125,13 +308,177 @@ void MlsFunctor::enqueue(
         height / wgs[1],
         divUp(swathe.zLast - swathe.zFirst + 1, wgs[2])
     };
+    const std::size_t numBlocks = blocks[0] * blocks[1] * blocks[2];
+    // The cell list packs block coordinates into 10-bit fields
+    for (int i = 0; i < 3; i++)
+        MLSGPU_ASSERT(blocks[i] <= 1024, std::length_error);
+
+    if (cellsCapacity < numBlocks)
+    {
+        cells = cl::Buffer(context, CL_MEM_READ_WRITE, numBlocks * sizeof(cl_uint));
+        cellsCapacity = numBlocks;
+    }
+
+    /* Classify the cells of the swathe, compacting the occupied ones into
+     * the cell list.
+     */
+    const cl_uint zero = 0;
+    cl::Event zeroEvent, classifyEvent, fillEvent;
+    queue.enqueueWriteBuffer(numCells, CL_FALSE, 0, sizeof(cl_uint), &zero,
+                             events, &zeroEvent);
 
+    cl_uint3 blocks3 = {{ cl_uint(blocks[0]), cl_uint(blocks[1]), cl_uint(blocks[2]) }};
+    classifyKernel.setArg(0, cells);
+    classifyKernel.setArg(1, numCells);
+    classifyKernel.setArg(5, blocks3);
+    classifyKernel.setArg(6, cl_uint(swathe.zFirst / wgs[2]));
+    std::vector<cl::Event> waitZero(1, zeroEvent);
     CLH::enqueueNDRangeKernel(queue,
-                              kernel,
-                              cl::NDRange(0, 0, swathe.zFirst),
-                              cl::NDRange(wgs3 * blocks[0], blocks[1], blocks[2]),
-                              cl::NDRange(wgs3, 1, 1),
-                              events, event, &kernelTime);
+                              classifyKernel,
+                              cl::NullRange,
+                              cl::NDRange(roundUp(numBlocks, std::size_t(classifyWgs))),
+                              cl::NDRange(classifyWgs),
+                              &waitZero, &classifyEvent, &classifyTime);
+
+    /* Pre-fill the swathe with NaN. The MLS kernel only revisits the corners
+     * of occupied cells, so everything else keeps this value.
+     */
+    const std::size_t firstRow = swathe.zFirst * std::size_t(swathe.zStride) + swathe.zBias;
+    const std::size_t lastRow = swathe.zLast * std::size_t(swathe.zStride) + swathe.zBias + height - 1;
+    fillKernel.setArg(0, distance);
+    fillKernel.setArg(1, cl_uint(width));
+    fillKernel.setArg(2, cl_uint(lastRow));
+    CLH::enqueueNDRangeKernel(queue,
+                              fillKernel,
+                              cl::NDRange(0, firstRow),
+                              cl::NDRange(roundUp(std::size_t(width), std::size_t(fillWgs[0])),
+                                          roundUp(lastRow - firstRow + 1, std::size_t(fillWgs[1]))),
+                              cl::NDRange(fillWgs[0], fillWgs[1]),
+                              events, &fillEvent, &fillTime);
+
+    if (persistentGroups == 0)
+    {
+        /* A handful of workgroups per compute unit is enough to cover
+         * latency; beyond that more groups just dilute the cell queue.
+         */
+        const cl::Device device = queue.getInfo<CL_QUEUE_DEVICE>();
+        persistentGroups = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * std::size_t(8);
+    }
+
+    if (numBlocks <= persistentGroups * 4)
+    {
+        /* Low-occupancy swathe: even if every candidate cell were occupied
+         * it would barely fill the device, and the synchronous readback
+         * below would cost more than the launch. Launch a fixed grid of
+         * persistent workgroups that strides over the cell queue, reading
+         * its length on the device. Sparse fringe bins hit this path for
+         * nearly every swathe, so the long sparse-region tail of a run no
+         * longer serializes the host against the device.
+         */
+        persistentKernel.setArg(0, distance);
+        persistentKernel.setArg(7, cl_uint(swathe.zStride));
+        persistentKernel.setArg(8, cl_int(swathe.zBias));
+        persistentKernel.setArg(10, cells);
+        persistentKernel.setArg(11, numCells);
+
+        std::vector<cl::Event> wait;
+        wait.push_back(classifyEvent); // no readback, so order against the classify explicitly
+        wait.push_back(fillEvent);
+        const std::size_t groups = std::min(numBlocks, persistentGroups);
+        CLH::enqueueNDRangeKernel(queue,
+                                  persistentKernel,
+                                  cl::NullRange,
+                                  cl::NDRange(wgs3 * groups),
+                                  cl::NDRange(wgs3),
+                                  &wait, event, &persistentTime);
+        return;
+    }
+
+    /* Retrieve the number of occupied cells to size the MLS launch. This is
+     * a tiny synchronous transfer; the other device threads keep the device
+     * busy while we wait for it.
+     */
+    cl_uint occupied = 0;
+    std::vector<cl::Event> waitClassify(1, classifyEvent);
+    queue.enqueueReadBuffer(numCells, CL_TRUE, 0, sizeof(cl_uint), &occupied,
+                            &waitClassify, NULL);
+    occupiedStat.add(double(occupied) / numBlocks);
+
+    kernel.setArg(0, distance);
+    kernel.setArg(7, cl_uint(swathe.zStride));
+    kernel.setArg(8, cl_int(swathe.zBias));
+    kernel.setArg(10, cells);
+
+    std::vector<cl::Event> waitFill(1, fillEvent);
+    if (occupied > 0)
+    {
+        if (timeSlice > 0.0)
+        {
+            /* Time-sliced mode (see @ref setTimeSlice): process the cell
+             * list in chunks sized so that each launch is expected to fit
+             * the budget, waiting for each chunk so that the watchdog timer
+             * restarts and the display gets a chance to schedule. The first
+             * chunk is one device-filling pass, from which the cell rate is
+             * seeded.
+             */
+            cl_uint first = 0;
+            while (first < occupied)
+            {
+                double target = double(persistentGroups);
+                if (cellRate > 0.0)
+                    target = std::max(target, timeSlice * cellRate);
+                const cl_uint chunk = cl_uint(std::min(double(occupied - first), target));
+
+                kernel.setArg(11, first);
+                cl::Event chunkEvent;
+                Timer chunkTimer;
+                CLH::enqueueNDRangeKernel(queue,
+                                          kernel,
+                                          cl::NullRange,
+                                          cl::NDRange(wgs3 * chunk),
+                                          cl::NDRange(wgs3),
+                                          &waitFill, &chunkEvent, &kernelTime);
+                chunkEvent.wait();
+                /* The wall time includes any queued predecessors, which can
+                 * only make the estimate conservative (smaller chunks).
+                 */
+                const double elapsed = chunkTimer.getElapsed();
+                if (elapsed > 0.0)
+                {
+                    const double alpha = 0.25;
+                    const double rate = chunk / elapsed;
+                    cellRate = (cellRate > 0.0) ? cellRate + alpha * (rate - cellRate) : rate;
+                }
+                if (event != NULL)
+                    *event = chunkEvent;
+                first += chunk;
+            }
+        }
+        else
+        {
+            kernel.setArg(11, cl_uint(0));
+            CLH::enqueueNDRangeKernel(queue,
+                                      kernel,
+                                      cl::NullRange,
+                                      cl::NDRange(wgs3 * occupied),
+                                      cl::NDRange(wgs3),
+                                      &waitFill, event, &kernelTime);
+        }
+    }
+    else if (event != NULL)
+        *event = fillEvent;
+}
+
+void MlsFunctor::flushCounters(const cl::CommandQueue &queue)
+{
+    if (kernelCounters)
+        kernelCounters->flush(queue);
+}
+
+void MlsFunctor::setTimeSlice(double seconds)
+{
+    MLSGPU_ASSERT(seconds >= 0.0, std::invalid_argument);
+    timeSlice = seconds;
 }
 
 void MlsFunctor::setBoundaryLimit(float limit)
@@ -140,5 +487,6 @@ void MlsFunctor::setBoundaryLimit(float limit)
     // uniform distribution of samples and a straight boundary
     const float boundaryScale = (sqrt(6.0f) * 512) / (693 * boost::math::constants::pi<float>());
     const float gamma = boundaryScale * limit;
-    kernel.setArg(8, 1.0f - gamma * gamma);
+    kernel.setArg(9, 1.0f - gamma * gamma);
+    persistentKernel.setArg(9, 1.0f - gamma * gamma);
 }
@@ -35,11 +35,13 @@
 #include <cstddef>
 #include <map>
 #include <string>
+#include <boost/scoped_ptr.hpp>
 #include "grid.h"
 #include "splat_tree_cl.h"
 #include "marching.h"
 #include "clh.h"
 #include "statistics.h"
+#include "statistics_cl.h"
 
 class TestMls;
 
@@ -81,16 +83,115 @@ class MlsFunctor : public Marching::Generator
 private:
     friend class TestMls;
 
+    /**
+     * Context used to construct the object, used for lazily allocating
+     * @ref cells.
+     */
+    cl::Context context;
+
+    /**
+     * Whether the splat buffer's normal/quality plane holds half4 values
+     * (see @ref DeviceWorkerGroupBase::WorkItem). It selects the kernel
+     * variant to compile.
+     */
+    bool halfNormals;
+
     /**
      * Kernel generated from @ref processCorners.
      */
     cl::Kernel kernel;
 
+    /**
+     * Kernel generated from @ref processCornersPersistent. It is used in
+     * place of @ref kernel for low-occupancy swathes, where it avoids the
+     * synchronous readback of the occupied-cell count (see @ref enqueue).
+     */
+    cl::Kernel persistentKernel;
+
+    /**
+     * Kernel generated from @ref fillCorners. It pre-fills a swathe of the
+     * distance image with NaN so that @ref kernel need only visit occupied
+     * cells.
+     */
+    cl::Kernel fillKernel;
+
+    /**
+     * Kernel generated from @ref classifyCells. It compacts the occupied
+     * cells of a swathe into @ref cells.
+     */
+    cl::Kernel classifyKernel;
+
+    /**
+     * Compacted list of occupied cells written by @ref classifyKernel. It is
+     * (re)allocated lazily by @ref enqueue, since the required size depends
+     * on the swathe geometry.
+     */
+    cl::Buffer cells;
+
+    /// Number of elements that @ref cells has space for
+    std::size_t cellsCapacity;
+
+    /// Single counter giving the number of elements written to @ref cells
+    cl::Buffer numCells;
+
     /**
      * Measures device time spent in @ref kernel.
      */
     Statistics::Variable &kernelTime;
 
+    /// Measures device time spent in @ref persistentKernel
+    Statistics::Variable &persistentTime;
+
+    /// Measures device time spent in @ref fillKernel
+    Statistics::Variable &fillTime;
+
+    /// Measures device time spent in @ref classifyKernel
+    Statistics::Variable &classifyTime;
+
+    /// Records the fraction of cells per swathe that survive classification
+    Statistics::Variable &occupiedStat;
+
+    /**
+     * Device-resident workload counters updated by the kernels (see
+     * @c KERNEL_STATS in @c kernels/mls.cl). It is allocated by @ref init
+     * only when @ref Statistics::isKernelCountersEnabled, and is read back
+     * by @ref flushCounters.
+     */
+    boost::scoped_ptr<Statistics::KernelCounters> kernelCounters;
+
+    /**
+     * Work group size for @ref kernel, chosen by the autotuner. Each entry
+     * is at most the corresponding entry of @ref maxWgs.
+     */
+    Grid::size_type wgs[3];
+
+    /**
+     * Number of splat IDs cooperatively loaded per batch by @ref kernel
+     * (the kernel's @c MAX_BUCKET), chosen by the autotuner.
+     */
+    unsigned int maxBucket;
+
+    /**
+     * Size of the fixed workgroup grid launched for @ref persistentKernel.
+     * It is derived from the device's compute unit count on first use of
+     * @ref enqueue (zero means not yet computed), and also acts as the
+     * occupancy threshold below which the persistent path is taken.
+     */
+    std::size_t persistentGroups;
+
+    /**
+     * Per-launch time budget in seconds (see @ref setTimeSlice). Zero (the
+     * default) disables time slicing.
+     */
+    double timeSlice;
+
+    /**
+     * Exponential moving average of occupied cells processed per second by
+     * @ref kernel, used to size time-sliced launches. Zero until the first
+     * chunk has been measured.
+     */
+    double cellRate;
+
     /**
      * Specify the parameters. This is a private variant that
      * does not require the buffers to be stored in a @ref SplatTreeCL, and
@@ -98,14 +199,58 @@ private:
      */
     void set(const Grid::difference_type offset[3],
              const cl::Buffer &splats,
+             std::size_t splatStride,
              const cl::Buffer &commands,
              const cl::Buffer &start,
+             cl_uint startBase,
              unsigned int subsamplingShift);
+
+    /**
+     * Second-phase constructor: parses @a config (see @ref tuneConfig),
+     * compiles the kernels and allocates the fixed buffers.
+     */
+    void init(MlsShape shape, const std::string &config);
+
+    /**
+     * Constructor with an explicit configuration, used while tuning.
+     */
+    MlsFunctor(const cl::Context &context, MlsShape shape, const std::string &config);
+
+    /**
+     * Time one configuration on a synthetic workload. Used as the
+     * measurement callback for @ref Autotune::tune.
+     *
+     * @return Time in seconds for one slice-sized launch.
+     */
+    static double benchmark(const cl::Context &context, MlsShape shape,
+                            const std::string &config);
+
+    /**
+     * Determine the launch configuration for this device, sweeping the
+     * candidates on first use and consulting the tuning cache thereafter.
+     * The configuration is encoded as
+     * <i>X</i><code>x</code><i>Y</i><code>x</code><i>Z</i><code>/</code><i>B</i>
+     * giving @ref wgs and @ref maxBucket.
+     */
+    static std::string tuneConfig(const cl::Context &context, MlsShape shape);
+
 public:
     /**
-     * Work group size for @ref kernel.
+     * Upper bound on each element of @ref wgs, used where a conservative
+     * alignment is needed before the device-specific value is known. It is
+     * tied to @ref subsamplingMin.
+     */
+    static const Grid::size_type maxWgs[3];
+
+    /**
+     * Work group size for @ref fillKernel.
+     */
+    static const Grid::size_type fillWgs[2];
+
+    /**
+     * Work group size for @ref classifyKernel.
      */
-    static const Grid::size_type wgs[3];
+    static const Grid::size_type classifyWgs;
 
     /**
      * Minimum subsampling for corresponding octree.
@@ -113,11 +258,17 @@ public:
     static const int subsamplingMin;
 
     /**
-     * Constructor. It compiles the kernel, so it can throw a compilation error.
-     * @param context   The context in which the function operates.
-     * @param shape     The shape to fit to the data.
+     * Constructor. It compiles the kernel, so it can throw a compilation
+     * error. On first use of a device it also sweeps the launch
+     * configurations (see @ref tuneConfig), which may take a few seconds;
+     * afterwards the choice comes from the tuning cache.
+     *
+     * @param context      The context in which the function operates.
+     * @param shape        The shape to fit to the data.
+     * @param halfNormals  Whether the normal/quality plane of the splat
+     *                     buffers is quantized to half precision.
      */
-    MlsFunctor(const cl::Context &context, MlsShape shape);
+    MlsFunctor(const cl::Context &context, MlsShape shape, bool halfNormals = false);
 
     /**
      * Specify the parameters. This must be called before using this object as a functor.
@@ -127,18 +278,29 @@ public:
      * than @a size in each dimension.
      *
      * @param offset           Offset between world coordinates and region-relative coordinates.
-     * @param tree             Octree containing input splats.
+     * @param tree             Octree(s) containing input splats.
+     * @param bin              Index of the bin within @a tree to sample from.
      * @param subsamplingShift Subsampling shift passed when building @a tree.
      *
      * @pre
-     * - @a tree was constructed with the same @a offset and @a subsamplingShift.
+     * - Bin @a bin of @a tree was constructed with the same @a offset and
+     *   @a subsamplingShift.
      */
     void set(const Grid::difference_type offset[3],
-             const SplatTreeCL &tree, unsigned int subsamplingShift);
+             const SplatTreeCL &tree, std::size_t bin, unsigned int subsamplingShift);
 
     virtual const Grid::size_type *alignment() const;
 
     /**
+     * This enqueues an occupancy prepass that compacts the list of cells
+     * with nearby splats, fills the swathe with NaN, and then runs the MLS
+     * kernel over the occupied cells only. For large swathes the MLS launch
+     * is sized from the occupied-cell count, which requires a small
+     * synchronous transfer, so the call may block briefly. Small swathes
+     * instead take a persistent-threads path which reads the count on the
+     * device and needs no readback at all, so the long sparse-region tail
+     * of a run does not serialize the host against the device.
+     *
      * @pre The tree passed to @ref set was constructed with dimensions at least
      * equal to @a size rounded up to multiples of @ref wgs.
      */
@@ -161,6 +323,26 @@ public:
                     const std::vector<cl::Event> *events,
                     cl::Event *event) const;
 
+    /**
+     * Bound each MLS launch to roughly @a seconds of device time. The
+     * occupied-cell list is then processed in chunks sized from the measured
+     * cell rate, with the host waiting for each chunk, so that a display GPU
+     * with a driver watchdog gets regular opportunities to schedule other
+     * work. Zero (the default) disables slicing. The waits serialize the
+     * host against the device, so this should only be enabled where the
+     * watchdog makes it necessary.
+     */
+    void setTimeSlice(double seconds);
+
+    /**
+     * Read back the device-side workload counters and credit them to their
+     * statistics (see @ref Statistics::KernelCounters::flush). This is
+     * intended to be called once per bin, at a point where the host is about
+     * to wait for the queue anyway. If the counters are not enabled it is a
+     * no-op.
+     */
+    void flushCounters(const cl::CommandQueue &queue);
+
     /**
      * Sets the tuning factor for boundary clipping.
      * A value of 1 is theoretically "correct" and is the default, but in
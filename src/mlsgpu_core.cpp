@@ -38,8 +38,14 @@
 #include <boost/exception/all.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include <boost/ref.hpp>
+#include <boost/bind/bind.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <memory>
 #include <string>
 #include <iterator>
@@ -50,7 +56,12 @@
 #include <sstream>
 #include <cstdlib>
 #include <cassert>
+#include <cmath>
 #include <limits>
+#include <boost/tr1/cmath.hpp>
+#if HAVE_SYSCONF
+# include <unistd.h>
+#endif
 #include "mlsgpu_core.h"
 #include "options.h"
 #include "mls.h"
@@ -65,8 +76,11 @@
 #include "splat_tree_cl.h"
 #include "workers.h"
 #include "bucket.h"
+#include "bucket_plan.h"
 #include "splat_set.h"
 #include "decache.h"
+#include "numa.h"
+#include "thread_name.h"
 
 namespace po = boost::program_options;
 
@@ -77,7 +91,8 @@ static void addCommonOptions(po::options_description &opts)
         ("quiet,q",               "Do not show informational messages")
         (Option::debug,           "Show debug messages")
         (Option::responseFile,    po::value<std::string>(), "Read options from file")
-        (Option::tmpDir,          po::value<std::string>(), "Directory to store temporary files");
+        (Option::tmpDir,          po::value<std::vector<std::string> >()->composing(),
+                                  "Directory to store temporary files (repeat to stripe across devices)");
 }
 
 static void addFitOptions(po::options_description &opts)
@@ -99,27 +114,63 @@ static void addStatisticsOptions(po::options_description &opts)
         (Option::statistics,                          "Print information about internal statistics")
         (Option::statisticsFile, po::value<std::string>(), "Direct statistics to file instead of stdout (implies --statistics)")
         (Option::statisticsCL,                             "Collect timings for OpenCL commands")
-        (Option::timeplot, po::value<std::string>(),       "Write timing data to file");
+        (Option::statisticsKernels,                        "Collect per-kernel workload counters on the device")
+        (Option::statisticsCounters,                       "Collect hardware performance counters per worker thread (Linux only)")
+        (Option::statisticsSnapshot, po::value<std::string>(), "Periodically write a statistics snapshot to file during the run")
+        (Option::statisticsSnapshotInterval, po::value<double>()->default_value(10.0), "Seconds between statistics snapshots")
+        (Option::timeplot, po::value<std::string>(),       "Write timing data to file")
+        (Option::timeplotBinary,                           "Write timing data in a compact binary format");
     opts.add(statistics);
 }
 
-static void addAdvancedOptions(po::options_description &opts)
+static void addAdvancedOptions(po::options_description &opts, bool isMPI)
 {
     po::options_description advanced("Advanced options");
     advanced.add_options()
         (Option::levels,       po::value<int>()->default_value(6), "Levels in octree")
         (Option::subsampling,  po::value<int>()->default_value(3), "Subsampling of octree")
         (Option::maxSplit,     po::value<int>()->default_value(1024 * 1024 * 1024), "Maximum fan-out in partitioning")
+        (Option::slabCells,    po::value<int>()->default_value(0), "Slice the volume into slabs of this many cells for bucketing (0 for no slicing)")
+        (Option::bucketPlan,   po::value<std::string>(), "File for persisting the bucket decomposition across multi-resolution runs")
+        (Option::halfDistance, "Store the signed distance field in half precision to halve its bandwidth")
+        (Option::halfSplats,   "Quantize splat normals and quality to half precision for staging and upload")
+        (Option::thinSplats,   po::value<int>()->default_value(0), "Keep at most this many splats per grid cell in over-scanned regions (0 to keep all)")
         (Option::leafCells,    po::value<int>()->default_value(63), "Leaf size for initial histogram")
         (Option::deviceThreads, po::value<int>()->default_value(1), "Number of threads per device for submitting OpenCL work")
-        (Option::reader,       po::value<Choice<ReaderTypeWrapper> >()->default_value(SYSCALL_READER), "File reader class (syscall | stream | mmap)")
-        (Option::writer,       po::value<Choice<WriterTypeWrapper> >()->default_value(SYSCALL_WRITER), "File writer class (syscall | stream)")
+        (Option::devicePipeline, po::value<int>()->default_value(2), "Octree builds kept in flight per device thread to overlap with MLS")
+        (Option::deviceControl, po::value<std::string>(), "File listing the device indices allowed to take new work, polled during the run")
+        (Option::autoParams,   "Derive memory and thread options from device and host capabilities")
+        (Option::reader,       po::value<Choice<ReaderTypeWrapper> >()->default_value(SYSCALL_READER), "File reader class (syscall | direct | stream | mmap | compressed | remote)")
+        (Option::writer,       po::value<Choice<WriterTypeWrapper> >()->default_value(SYSCALL_WRITER), "File writer class (syscall | stream | compressed)")
 #ifdef _OPENMP
         (Option::ompThreads,   po::value<int>(), "Number of threads for OpenMP")
 #endif
         (Option::decache,      "Try to evict input files from OS cache for benchmarking")
+        (Option::bboxThreads,  po::value<int>()->default_value(1), "Number of concurrent input streams for the bounding box pass")
+        (Option::bucketThreads, po::value<int>()->default_value(1), "Number of threads for the bucketing walk")
+        (Option::splatCache,   "Cache decoded splats on disk during the bounding box pass")
+        (Option::blobCache,    po::value<std::string>(), "Directory for persisting bounding box data across runs")
         (Option::checkpoint,   po::value<std::string>(), "Checkpoint state prior to writing output")
-        (Option::resume,       po::value<std::string>(), "Restart from checkpoint");
+        (Option::checkpointInterval, po::value<double>(), "Seconds between mid-run checkpoints (requires --checkpoint)")
+        (Option::resume,       po::value<std::string>(), "Restart from checkpoint")
+        (Option::incremental,  po::value<std::string>(), "State file for reusing unchanged output chunks across runs")
+        (Option::plan,         "Rehearse on a sample of the buckets and predict the full run instead of producing output")
+        (Option::planFraction, po::value<double>()->default_value(0.05), "Fraction of buckets to process with --plan")
+        (Option::journal,      po::value<std::string>(), "Record the identity of each processed bin to this file")
+        (Option::repair,       po::value<std::vector<std::string> >()->composing(), "Recompute only the named output chunk (x,y,z; may be repeated)")
+        (Option::tileBox,      po::value<std::string>(), "Reconstruct only this box (x0,y0,z0,x1,y1,z1 in input units), for tiled or region-of-interest runs")
+        (Option::adaptiveIO,   "Adapt write concurrency and readahead to live block-device load")
+        (Option::timeSlice,    po::value<double>(), "Bound each device kernel launch to roughly this many milliseconds (for display GPUs with watchdog timers)")
+        (Option::checkManifold, "Verify that the output is edge-manifold during welding")
+        (Option::vertexCache,  "Reorder output triangles for GPU vertex-cache locality");
+    if (isMPI)
+        advanced.add_options()
+            (Option::mpiCompress, "Compress large MPI payloads, trading CPU for interconnect bandwidth");
+    else
+        advanced.add_options()
+            (Option::daemon,   po::value<std::string>(), "Stay resident and accept jobs on this local socket")
+            (Option::preStage, "Read the inputs once to warm the filesystem cache, then exit")
+            (Option::control,  po::value<std::string>(), "Accept live tuning commands on this local socket during the run");
     opts.add(advanced);
 }
 
@@ -127,11 +178,14 @@ static void addMemoryOptions(po::options_description &opts, bool isMPI)
 {
     po::options_description memory("Advanced memory options");
     memory.add_options()
+        (Option::memHost,         po::value<Capacity>(), "Total memory for the host-side pools, divided between the individual --mem-* pools")
         (Option::memLoadSplats,   po::value<Capacity>()->default_value(256 * 1024 * 1024), "Memory for bucket merging")
         (Option::memHostSplats,   po::value<Capacity>()->default_value(512 * 1024 * 1024), "Memory for splats on the CPU")
         (Option::memBucketSplats, po::value<Capacity>()->default_value(64 * 1024 * 1024),  "Memory for splats in a single bucket")
         (Option::memMesh,         po::value<Capacity>()->default_value(512 * 1024 * 1024),  "Memory for raw mesh data on the CPU")
-        (Option::memReorder,      po::value<Capacity>()->default_value(2U * 1024 * 1024 * 1024), "Memory for processed mesh data on the CPU");
+        (Option::memReorder,      po::value<Capacity>()->default_value(2U * 1024 * 1024 * 1024), "Memory for processed mesh data on the CPU")
+        (Option::memKeyMap,       po::value<Capacity>()->default_value(1024U * 1024 * 1024), "Memory for vertex welding maps before spilling to disk")
+        (Option::lockMemory,      "Lock the pipeline buffers into RAM so that memory pressure from other jobs cannot page them out");
     if (isMPI)
         memory.add_options()
             (Option::memGather,   po::value<Capacity>()->default_value(512 * 1024 * 1024),  "Memory for buffering raw mesh data on the slaves");
@@ -144,22 +198,33 @@ void usage(std::ostream &o, const po::options_description desc)
     o << desc;
 }
 
-po::variables_map processOptions(int argc, char **argv, bool isMPI)
+/**
+ * Build the full option descriptions shared by the overloads of
+ * @ref processOptions.
+ *
+ * @param[out] desc        Visible options, for @ref usage.
+ * @param[out] all         Visible plus hidden options, for parsing.
+ * @param[out] positional  Positional option bindings.
+ * @param isMPI            Whether MPI-related options are expected.
+ */
+static void addAllOptions(po::options_description &desc, po::options_description &all,
+                          po::positional_options_description &positional, bool isMPI)
 {
-    // TODO: replace cerr with thrown exception
-    po::positional_options_description positional;
     positional.add(Option::inputFile, -1);
 
-    po::options_description desc("General options");
     addCommonOptions(desc);
     addFitOptions(desc);
     addStatisticsOptions(desc);
-    addAdvancedOptions(desc);
+    addAdvancedOptions(desc, isMPI);
     addMemoryOptions(desc, isMPI);
     desc.add_options()
-        ("output-file,o",   po::value<std::string>()->required(), "output file")
+        ("output-file,o",   po::value<std::string>(), "output file")
         (Option::split,     "split output across multiple files")
-        (Option::splitSize, po::value<Capacity>()->default_value(100 * 1024 * 1024), "approximate size of output chunks");
+        (Option::splitSize, po::value<Capacity>()->default_value(100 * 1024 * 1024), "approximate size of output chunks (if not given, chosen from the input density and --mem-reorder)")
+        (Option::splitDirs, "shard split output files across subdirectories")
+        (Option::chunkStream, po::value<std::string>(), "stream each finished output chunk to this FIFO as it completes")
+        (Option::chunkManifest, po::value<std::string>(), "write an index of the output chunks (bounds, sizes and filenames) to this file")
+        (Option::normals,   "emit per-vertex normals in the output files");
 
     po::options_description clopts("OpenCL options");
     CLH::addOptions(clopts);
@@ -169,81 +234,135 @@ po::variables_map processOptions(int argc, char **argv, bool isMPI)
     hidden.add_options()
         (Option::inputFile, po::value<std::vector<std::string> >()->composing(), "input files");
 
-    po::options_description all("All options");
     all.add(desc);
     all.add(hidden);
+}
 
-    try
+/**
+ * Parse a pre-split argument list (excluding the program name) and apply the
+ * option side effects. Errors are reported by letting @c po::error propagate;
+ * the overloads of @ref processOptions decide whether that is fatal.
+ */
+static po::variables_map processOptionsImpl(const std::vector<std::string> &args, bool isMPI)
+{
+    po::options_description desc("General options");
+    po::options_description all("All options");
+    po::positional_options_description positional;
+    addAllOptions(desc, all, positional, isMPI);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(args)
+              .style(po::command_line_style::default_style & ~po::command_line_style::allow_guessing)
+              .options(all)
+              .positional(positional)
+              .run(), vm);
+    if (vm.count(Option::responseFile))
     {
-        po::variables_map vm;
-        po::store(po::command_line_parser(argc, argv)
-                  .style(po::command_line_style::default_style & ~po::command_line_style::allow_guessing)
-                  .options(all)
-                  .positional(positional)
-                  .run(), vm);
-        if (vm.count(Option::responseFile))
+        const std::string &fname = vm[Option::responseFile].as<std::string>();
+        std::ifstream in(fname.c_str());
+        if (!in)
         {
-            const std::string &fname = vm[Option::responseFile].as<std::string>();
-            std::ifstream in(fname.c_str());
-            if (!in)
-            {
-                Log::log[Log::warn] << "Could not open `" << fname << "', ignoring\n";
-            }
-            else
+            Log::log[Log::warn] << "Could not open `" << fname << "', ignoring\n";
+        }
+        else
+        {
+            std::vector<std::string> args;
+            std::copy(std::istream_iterator<std::string>(in),
+                      std::istream_iterator<std::string>(), std::back_inserter(args));
+            if (in.bad())
             {
-                std::vector<std::string> args;
-                std::copy(std::istream_iterator<std::string>(in),
-                          std::istream_iterator<std::string>(), std::back_inserter(args));
-                if (in.bad())
-                {
-                    Log::log[Log::warn] << "Error while reading from `" << fname << "'\n";
-                }
-                in.close();
-                po::store(po::command_line_parser(args)
-                          .style(po::command_line_style::default_style & ~po::command_line_style::allow_guessing)
-                          .options(all)
-                          .positional(positional)
-                          .run(), vm);
+                Log::log[Log::warn] << "Error while reading from `" << fname << "'\n";
             }
+            in.close();
+            po::store(po::command_line_parser(args)
+                      .style(po::command_line_style::default_style & ~po::command_line_style::allow_guessing)
+                      .options(all)
+                      .positional(positional)
+                      .run(), vm);
         }
+    }
+
+    po::notify(vm);
 
-        po::notify(vm);
+    if (vm.count(Option::statisticsCL))
+    {
+        Statistics::enableEventTiming();
+    }
+    if (vm.count(Option::statisticsKernels))
+    {
+        Statistics::enableKernelCounters();
+    }
+    if (vm.count(Option::statisticsCounters))
+    {
+        ThreadCounters::setEnabled(true);
+    }
+    if (vm.count(Option::halfDistance))
+    {
+        Marching::setDistanceHalf(true);
+    }
+    if (vm.count(Option::tmpDir))
+    {
+        const std::vector<std::string> &dirs = vm[Option::tmpDir].as<std::vector<std::string> >();
+        setTmpFileDirs(std::vector<boost::filesystem::path>(dirs.begin(), dirs.end()));
+    }
+
+#ifdef _OPENMP
+    int ompThreads;
+    if (vm.count(Option::ompThreads))
+        ompThreads = vm[Option::ompThreads].as<int>();
+    else
+    {
+        // Subtract one to avoid starving reader/writer threads
+        ompThreads = boost::thread::hardware_concurrency() - 1;
+    }
+    if (ompThreads <= 0)
+        ompThreads = 1;
+    omp_set_num_threads(ompThreads);
+#endif
+
+    return vm;
+}
+
+po::variables_map processOptions(int argc, char **argv, bool isMPI)
+{
+    // TODO: replace cerr with thrown exception
+    const std::vector<std::string> args(argv + 1, argv + argc);
+
+    po::options_description desc("General options");
+    po::options_description all("All options");
+    po::positional_options_description positional;
+    addAllOptions(desc, all, positional, isMPI);
+
+    try
+    {
+        po::variables_map vm = processOptionsImpl(args, isMPI);
 
         if (vm.count(Option::help))
         {
             usage(std::cout, desc);
             std::exit(0);
         }
-        /* Using ->required() on the option gives an unhelpful message */
+        /* Using ->required() on the options gives unhelpful messages, and in
+         * daemon mode the input and output are named per job rather than on
+         * the daemon's own command line.
+         */
+        if (!isMPI && vm.count(Option::daemon))
+            return vm;
         if (!vm.count(Option::inputFile))
         {
             std::cerr << "At least one input file must be specified.\n\n";
             usage(std::cerr, desc);
             std::exit(1);
         }
-
-        if (vm.count(Option::statisticsCL))
-        {
-            Statistics::enableEventTiming();
-        }
-        if (vm.count(Option::tmpDir))
-        {
-            setTmpFileDir(vm[Option::tmpDir].as<std::string>());
-        }
-
-#ifdef _OPENMP
-        int ompThreads;
-        if (vm.count(Option::ompThreads))
-            ompThreads = vm[Option::ompThreads].as<int>();
-        else
+        // A pre-staging run reads the inputs but produces nothing
+        if (vm.count(Option::preStage))
+            return vm;
+        if (!vm.count(Option::outputFile))
         {
-            // Subtract one to avoid starving reader/writer threads
-            ompThreads = boost::thread::hardware_concurrency() - 1;
+            std::cerr << "An output file must be specified.\n\n";
+            usage(std::cerr, desc);
+            std::exit(1);
         }
-        if (ompThreads <= 0)
-            ompThreads = 1;
-        omp_set_num_threads(ompThreads);
-#endif
 
         return vm;
     }
@@ -255,6 +374,31 @@ po::variables_map processOptions(int argc, char **argv, bool isMPI)
     }
 }
 
+po::variables_map processOptions(const std::vector<std::string> &args, bool isMPI)
+{
+    try
+    {
+        po::variables_map vm = processOptionsImpl(args, isMPI);
+
+        if (vm.count(Option::help))
+            throw invalid_option("--help is not available here");
+        if (vm.count(Option::daemon))
+            throw invalid_option("--daemon cannot be nested");
+        if (vm.count(Option::preStage))
+            throw invalid_option("--pre-stage is not available here");
+        if (!vm.count(Option::inputFile))
+            throw invalid_option("At least one input file must be specified");
+        if (!vm.count(Option::outputFile))
+            throw invalid_option("An output file must be specified");
+
+        return vm;
+    }
+    catch (po::error &e)
+    {
+        throw invalid_option(e.what());
+    }
+}
+
 /**
  * Translate the command-line options back into the form they would be given
  * on the command line.
@@ -395,6 +539,233 @@ static std::size_t getMaxBucketSplats(const po::variables_map &vm)
     return mem / sizeof(Splat);
 }
 
+/**
+ * Total physical memory on the host, or 0 if it cannot be determined.
+ */
+static std::size_t hostMemory()
+{
+#if HAVE_SYSCONF && defined(_SC_PHYS_PAGES)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && pageSize > 0)
+        return std::size_t(pages) * std::size_t(pageSize);
+#endif
+    return 0;
+}
+
+/**
+ * Replace the default value of an option. Values the user gave explicitly are
+ * left alone, and the replacement still counts as a default so that it can
+ * itself be replaced by a later call.
+ */
+static void overrideDefault(po::variables_map &vm, const char *name, const boost::any &value)
+{
+    po::variables_map::iterator pos = vm.find(name);
+    assert(pos != vm.end());
+    if (pos->second.defaulted())
+        pos->second = po::variable_value(value, true);
+}
+
+void setAutoParameters(po::variables_map &vm,
+                       std::size_t deviceMemory, std::size_t deviceMaxAlloc,
+                       unsigned int computeUnits)
+{
+    if (!vm.count(Option::autoParams))
+        return;
+
+    /* Extra submission threads only pay off when there are enough compute
+     * units to overlap several octree builds with MLS evaluation.
+     */
+    overrideDefault(vm, Option::deviceThreads,
+                    int(std::min(4U, 1U + computeUnits / 16)));
+
+    /* Pick the largest bucket size whose device-side structures fit
+     * comfortably, reusing the same estimate that @ref validateDevice checks
+     * against. Larger buckets amortize octree construction over more splats.
+     */
+    if (vm[Option::memBucketSplats].defaulted())
+    {
+        for (std::tr1::uint64_t candidate = 512 * 1024 * 1024;
+             candidate >= 16 * 1024 * 1024; candidate >>= 1)
+        {
+            overrideDefault(vm, Option::memBucketSplats, Capacity(candidate));
+            CLH::ResourceUsage usage = resourceUsage(vm);
+            if (usage.getTotalMemory() <= deviceMemory / 10 * 7
+                && usage.getMaxMemory() <= deviceMaxAlloc)
+                break;
+        }
+    }
+
+    /* The host-side pools scale with the bucket size so that enough batches
+     * are in flight to hide load latency, but are capped to a fraction of
+     * physical memory to leave room for the mesher and OS caches.
+     */
+    const std::tr1::uint64_t bucket = vm[Option::memBucketSplats].as<Capacity>();
+    const std::size_t ram = hostMemory();
+    std::tr1::uint64_t load = bucket * 4;
+    std::tr1::uint64_t host = bucket * 8;
+    if (ram != 0)
+    {
+        load = std::min(load, std::tr1::uint64_t(ram / 16));
+        host = std::min(host, std::tr1::uint64_t(ram / 8));
+        overrideDefault(vm, Option::memReorder, Capacity(ram / 4));
+    }
+    load = std::max(load, bucket);
+    host = std::max(host, load);
+    overrideDefault(vm, Option::memLoadSplats, Capacity(load));
+    overrideDefault(vm, Option::memHostSplats, Capacity(host));
+
+    /* Make sure the mesher queue can hold at least one maximal block, which
+     * validateOptions would otherwise reject when --levels is raised.
+     */
+    const std::tr1::uint64_t memMesh = vm[Option::memMesh].as<Capacity>();
+    overrideDefault(vm, Option::memMesh,
+                    Capacity(std::max(memMesh, std::tr1::uint64_t(getMeshHostMemory(vm)))));
+
+    Log::log[Log::info]
+        << "Auto-configured parameters:"
+        << " --" << Option::deviceThreads << '=' << vm[Option::deviceThreads].as<int>()
+        << " --" << Option::memBucketSplats << '=' << vm[Option::memBucketSplats].as<Capacity>()
+        << " --" << Option::memLoadSplats << '=' << vm[Option::memLoadSplats].as<Capacity>()
+        << " --" << Option::memHostSplats << '=' << vm[Option::memHostSplats].as<Capacity>()
+        << "\n";
+}
+
+void setAutoParameters(po::variables_map &vm, const std::vector<cl::Device> &devices)
+{
+    if (!vm.count(Option::autoParams) || devices.empty())
+        return;
+
+    std::size_t deviceMemory = std::numeric_limits<std::size_t>::max();
+    std::size_t deviceMaxAlloc = std::numeric_limits<std::size_t>::max();
+    unsigned int computeUnits = std::numeric_limits<unsigned int>::max();
+    BOOST_FOREACH(const cl::Device &device, devices)
+    {
+        deviceMemory = std::min(deviceMemory,
+                                std::size_t(device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>()));
+        deviceMaxAlloc = std::min(deviceMaxAlloc,
+                                  std::size_t(device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>()));
+        computeUnits = std::min(computeUnits,
+                                (unsigned int) device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>());
+    }
+    setAutoParameters(vm, deviceMemory, deviceMaxAlloc, computeUnits);
+}
+
+void setMemoryBudget(po::variables_map &vm, bool isMPI)
+{
+    if (!vm.count(Option::memHost))
+        return;
+
+    std::vector<const char *> pools;
+    pools.push_back(Option::memLoadSplats);
+    pools.push_back(Option::memHostSplats);
+    pools.push_back(Option::memMesh);
+    pools.push_back(Option::memReorder);
+    pools.push_back(Option::memKeyMap);
+    if (isMPI)
+        pools.push_back(Option::memGather);
+
+    /* Explicit pool sizes come off the top of the budget; the remainder is
+     * shared between the defaulted pools in proportion to their current
+     * default values (the compiled-in defaults, or what setAutoParameters
+     * derived from them), so the budget scales the balance rather than
+     * replacing it.
+     */
+    std::tr1::uint64_t budget = vm[Option::memHost].as<Capacity>();
+    std::tr1::uint64_t weight = 0;
+    BOOST_FOREACH(const char *name, pools)
+    {
+        const std::tr1::uint64_t value = vm[name].as<Capacity>();
+        if (vm.find(name)->second.defaulted())
+            weight += value;
+        else
+            budget -= std::min(budget, value);
+    }
+
+    if (weight != 0)
+    {
+        BOOST_FOREACH(const char *name, pools)
+        {
+            if (vm.find(name)->second.defaulted())
+            {
+                const std::tr1::uint64_t value = vm[name].as<Capacity>();
+                /* Via double to avoid overflowing the intermediate product */
+                std::tr1::uint64_t share =
+                    std::tr1::uint64_t(double(budget) * double(value) / double(weight));
+                overrideDefault(vm, name, Capacity(share));
+            }
+        }
+    }
+
+    /* Enforce the floors that validateOptions will check, in the same way
+     * as setAutoParameters. A budget too small even for the floors is left
+     * for validateOptions to report.
+     */
+    const std::tr1::uint64_t bucket = vm[Option::memBucketSplats].as<Capacity>();
+    overrideDefault(vm, Option::memLoadSplats,
+                    Capacity(std::max(std::tr1::uint64_t(vm[Option::memLoadSplats].as<Capacity>()), bucket)));
+    overrideDefault(vm, Option::memHostSplats,
+                    Capacity(std::max(std::tr1::uint64_t(vm[Option::memHostSplats].as<Capacity>()),
+                                      std::tr1::uint64_t(vm[Option::memLoadSplats].as<Capacity>()))));
+    const std::tr1::uint64_t meshFloor = getMeshHostMemory(vm);
+    overrideDefault(vm, Option::memMesh,
+                    Capacity(std::max(std::tr1::uint64_t(vm[Option::memMesh].as<Capacity>()), meshFloor)));
+    if (isMPI)
+        overrideDefault(vm, Option::memGather,
+                        Capacity(std::max(std::tr1::uint64_t(vm[Option::memGather].as<Capacity>()), meshFloor)));
+
+    Log::log[Log::info] << "Memory budget:";
+    BOOST_FOREACH(const char *name, pools)
+        Log::log[Log::info] << " --" << name << '=' << vm[name].as<Capacity>();
+    Log::log[Log::info] << "\n";
+
+    /* The pool sizes above bound what --lock-memory will pin, so it is
+     * applied here, once the budget is finalized and before any of the
+     * buffers are constructed.
+     */
+    CircularBuffer::setLockMemory(vm.count(Option::lockMemory) != 0);
+}
+
+/**
+ * Parse the box given with --tile-box into its two corners.
+ *
+ * @throw invalid_option if the value is malformed or empty on some axis.
+ */
+static void parseTileBox(const po::variables_map &vm, double boxMin[3], double boxMax[3])
+{
+    const std::string &value = vm[Option::tileBox].as<std::string>();
+    double fields[6];
+    std::istringstream in(value);
+    bool ok = true;
+    for (unsigned int i = 0; i < 6 && ok; i++)
+    {
+        if (i > 0)
+        {
+            char sep = '\0';
+            in >> sep;
+            ok = bool(in) && sep == ',';
+        }
+        if (ok)
+        {
+            in >> fields[i];
+            ok = bool(in);
+        }
+    }
+    if (ok)
+        ok = in.get() == std::char_traits<char>::eof();
+    if (!ok)
+        throw invalid_option(std::string("Value of --") + Option::tileBox
+                             + " must be six comma-separated coordinates: " + value);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        boxMin[i] = fields[i];
+        boxMax[i] = fields[i + 3];
+        if (!(boxMin[i] < boxMax[i]))
+            throw invalid_option(std::string("Value of --") + Option::tileBox
+                                 + " must have positive extent on every axis");
+    }
+}
+
 void validateOptions(const po::variables_map &vm, bool isMPI)
 {
     const int levels = vm[Option::levels].as<int>();
@@ -431,20 +802,129 @@ void validateOptions(const po::variables_map &vm, bool isMPI)
     if (maxHostSplats < maxBucketSplats)
         throw invalid_option(std::string("Value of --") + Option::memHostSplats
                              + " must be at least that of --" + Option::memBucketSplats);
+    if (maxHostSplats < maxLoadSplats)
+        throw invalid_option(std::string("Value of --") + Option::memHostSplats
+                             + " must be at least that of --" + Option::memLoadSplats);
     if (maxSplit < 8)
         throw invalid_option(std::string("Value of --") + Option::maxSplit + " must be at least 8");
+    if (vm[Option::slabCells].as<int>() < 0)
+        throw invalid_option(std::string("Value of --") + Option::slabCells + " must be non-negative");
+    if (vm[Option::thinSplats].as<int>() < 0)
+        throw invalid_option(std::string("Value of --") + Option::thinSplats + " must be non-negative");
     if (subsampling > Marching::MAX_DIMENSION_LOG2 + 1 - levels)
         throw invalid_option(std::string("Sum of --") + Option::subsampling
                              + " and --" + Option::levels + " is too large");
     const std::size_t treeVerts = std::size_t(1) << (subsampling + levels - 1);
-    if (treeVerts < MlsFunctor::wgs[0] || treeVerts < MlsFunctor::wgs[1])
+    if (treeVerts < MlsFunctor::maxWgs[0] || treeVerts < MlsFunctor::maxWgs[1])
         throw invalid_option(std::string("Sum of --") + Option::subsampling
                              + " and --" + Option::levels + " is too small");
 
     if (deviceThreads < 1)
         throw invalid_option(std::string("Value of --") + Option::deviceThreads + " must be at least 1");
+    if (vm[Option::bboxThreads].as<int>() < 1)
+        throw invalid_option(std::string("Value of --") + Option::bboxThreads + " must be at least 1");
+    if (vm[Option::bucketThreads].as<int>() < 1)
+        throw invalid_option(std::string("Value of --") + Option::bucketThreads + " must be at least 1");
+    if (vm[Option::devicePipeline].as<int>() < 1)
+        throw invalid_option(std::string("Value of --") + Option::devicePipeline + " must be at least 1");
     if (!(pruneThreshold >= 0.0 && pruneThreshold <= 1.0))
         throw invalid_option(std::string("Value of --") + Option::fitPrune + " must be in [0, 1]");
+    if (!(vm[Option::statisticsSnapshotInterval].as<double>() > 0.0))
+        throw invalid_option(std::string("Value of --") + Option::statisticsSnapshotInterval + " must be positive");
+    if (vm.count(Option::timeSlice) && !(vm[Option::timeSlice].as<double>() > 0.0))
+        throw invalid_option(std::string("Value of --") + Option::timeSlice + " must be positive");
+
+    if (vm.count(Option::checkpointInterval))
+    {
+        if (!(vm[Option::checkpointInterval].as<double>() > 0.0))
+            throw invalid_option(std::string("Value of --") + Option::checkpointInterval + " must be positive");
+        if (!vm.count(Option::checkpoint))
+            throw invalid_option(std::string("Option --") + Option::checkpointInterval
+                                 + " requires --" + Option::checkpoint);
+        if (isMPI)
+            throw invalid_option(std::string("Option --") + Option::checkpointInterval
+                                 + " is not supported with MPI");
+        if (vm.count(Option::incremental))
+            throw invalid_option(std::string("Option --") + Option::checkpointInterval
+                                 + " is not supported with --" + Option::incremental);
+    }
+    if (vm.count(Option::plan))
+    {
+        const double planFraction = vm[Option::planFraction].as<double>();
+        if (!(planFraction > 0.0 && planFraction <= 1.0))
+            throw invalid_option(std::string("Value of --") + Option::planFraction + " must be in (0, 1]");
+        if (isMPI)
+            throw invalid_option(std::string("Option --") + Option::plan
+                                 + " is not supported with MPI");
+        if (vm.count(Option::resume))
+            throw invalid_option(std::string("Option --") + Option::plan
+                                 + " is not supported with --" + Option::resume);
+        if (vm.count(Option::checkpoint))
+            throw invalid_option(std::string("Option --") + Option::plan
+                                 + " is not supported with --" + Option::checkpoint);
+        if (vm.count(Option::incremental))
+            throw invalid_option(std::string("Option --") + Option::plan
+                                 + " is not supported with --" + Option::incremental);
+    }
+    if (vm.count(Option::repair))
+    {
+        parseRepairChunks(vm); // throws invalid_option on malformed values
+        if (!vm.count(Option::split))
+            throw invalid_option(std::string("Option --") + Option::repair
+                                 + " requires --" + Option::split);
+        if (isMPI)
+            throw invalid_option(std::string("Option --") + Option::repair
+                                 + " is not supported with MPI");
+        if (vm.count(Option::resume))
+            throw invalid_option(std::string("Option --") + Option::repair
+                                 + " is not supported with --" + Option::resume);
+        if (vm.count(Option::checkpoint))
+            throw invalid_option(std::string("Option --") + Option::repair
+                                 + " is not supported with --" + Option::checkpoint);
+        if (vm.count(Option::incremental))
+            throw invalid_option(std::string("Option --") + Option::repair
+                                 + " is not supported with --" + Option::incremental);
+        if (vm.count(Option::plan))
+            throw invalid_option(std::string("Option --") + Option::repair
+                                 + " is not supported with --" + Option::plan);
+    }
+    if (vm.count(Option::tileBox))
+    {
+        double boxMin[3], boxMax[3];
+        parseTileBox(vm, boxMin, boxMax); // throws invalid_option on malformed values
+        if (isMPI)
+            throw invalid_option(std::string("Option --") + Option::tileBox
+                                 + " is not supported with MPI");
+        if (vm.count(Option::incremental))
+            throw invalid_option(std::string("Option --") + Option::tileBox
+                                 + " is not supported with --" + Option::incremental);
+    }
+    /* The manifest bounds are computed from the bounding grid, which is not
+     * recorded in a checkpoint, so a resumed run cannot produce them.
+     */
+    if (vm.count(Option::chunkManifest) && vm.count(Option::resume))
+        throw invalid_option(std::string("Option --") + Option::chunkManifest
+                             + " is not supported with --" + Option::resume);
+    if (vm.count(Option::resume) && vm.count(Option::incremental))
+        throw invalid_option(std::string("Option --") + Option::resume
+                             + " is not supported with --" + Option::incremental);
+    if (vm.count(Option::splitDirs) && !vm.count(Option::split))
+        throw invalid_option(std::string("Option --") + Option::splitDirs
+                             + " requires --" + Option::split);
+
+    if (vm.count(Option::incremental))
+    {
+        if (!vm.count(Option::split))
+            throw invalid_option(std::string("Option --") + Option::incremental
+                                 + " requires --" + Option::split);
+        if (isMPI)
+            throw invalid_option(std::string("Option --") + Option::incremental
+                                 + " is not supported with MPI");
+        if (pruneThreshold > 0.0)
+            Log::log[Log::warn] << "Warning: --" << Option::fitPrune
+                << " measures components globally and may give different results with --"
+                << Option::incremental << ".\n";
+    }
 
     if (memMesh < getMeshHostMemory(vm))
         throw invalid_option(std::string("Value of --") + Option::memMesh + " is too small");
@@ -479,7 +959,9 @@ CLH::ResourceUsage resourceUsage(const po::variables_map &vm)
     CLH::ResourceUsage totalUsage = DeviceWorkerGroup::resourceUsage(
         deviceThreads, deviceSpare, cl::Device(),
         maxBucketSplats, maxCells,
-        getMeshMemory(vm), levels);
+        getMeshMemory(vm), levels,
+        vm[Option::devicePipeline].as<int>(),
+        vm.count(Option::halfSplats));
     return totalUsage;
 }
 
@@ -517,6 +999,79 @@ void validateDevice(const cl::Device &device, const CLH::ResourceUsage &totalUsa
     }
 }
 
+namespace
+{
+
+/**
+ * Shared state for the @ref prepareInputs worker threads. Threads pull file
+ * indices from @ref next so that a few slow files (e.g. with cold caches) do
+ * not serialize the scan; the first exception stops the pool and is rethrown
+ * by the caller.
+ */
+struct PrepareInputsState
+{
+    const std::vector<boost::filesystem::path> &paths;
+    std::vector<FastPly::Reader *> &readers;   ///< Output, indexed like @ref paths
+    const ReaderType readerType;
+    const bool doDecache;
+    const float smooth;
+    const float maxRadius;
+
+    boost::mutex mutex;          ///< Protects @ref next and @ref error
+    std::size_t next;            ///< Next index in @ref paths to process
+    boost::exception_ptr error;  ///< First failure, if any
+
+    PrepareInputsState(
+        const std::vector<boost::filesystem::path> &paths,
+        std::vector<FastPly::Reader *> &readers,
+        ReaderType readerType, bool doDecache,
+        float smooth, float maxRadius)
+        : paths(paths), readers(readers), readerType(readerType),
+        doDecache(doDecache), smooth(smooth), maxRadius(maxRadius),
+        next(0)
+    {
+    }
+};
+
+static void prepareInputsThread(PrepareInputsState *state)
+{
+    while (true)
+    {
+        std::size_t idx;
+        {
+            boost::lock_guard<boost::mutex> guard(state->mutex);
+            if (state->error || state->next >= state->paths.size())
+                return;
+            idx = state->next++;
+        }
+        try
+        {
+            const boost::filesystem::path &path = state->paths[idx];
+            if (state->doDecache)
+                decache(path.string());
+            std::auto_ptr<FastPly::Reader> reader(new FastPly::Reader(
+                state->readerType, path.string(), state->smooth, state->maxRadius));
+            if (reader->size() > SplatSet::FileSet::maxFileSplats)
+            {
+                std::ostringstream msg;
+                msg << "Too many samples in " << path << " ("
+                    << reader->size() << " > " << SplatSet::FileSet::maxFileSplats << ")";
+                throw std::runtime_error(msg.str());
+            }
+            state->readers[idx] = reader.release();
+        }
+        catch (...)
+        {
+            boost::lock_guard<boost::mutex> guard(state->mutex);
+            if (!state->error)
+                state->error = boost::current_exception();
+            return;
+        }
+    }
+}
+
+} // anonymous namespace
+
 void prepareInputs(SplatSet::FileSet &files, const po::variables_map &vm, float smooth, float maxRadius)
 {
     const std::vector<std::string> &names = vm[Option::inputFile].as<std::vector<std::string> >();
@@ -545,24 +1100,71 @@ void prepareInputs(SplatSet::FileSet &files, const po::variables_map &vm, float
         msg << "Too many input files (" << paths.size() << " > " << SplatSet::FileSet::maxFiles << ")";
         throw std::runtime_error(msg.str());
     }
-    std::tr1::uint64_t totalSplats = 0;
-    std::tr1::uint64_t totalBytes = 0;
-    BOOST_FOREACH(const boost::filesystem::path &path, paths)
+    /* Opening a reader parses only the header (often satisfied from the
+     * persistent header cache), so the work per file is tiny but
+     * latency-bound. A small thread pool overlaps those latencies; readers
+     * are stored by index so the files keep their command-line order.
+     */
+    std::vector<FastPly::Reader *> readers(paths.size(), (FastPly::Reader *) NULL);
+    PrepareInputsState state(paths, readers, readerType,
+                             vm.count(Option::decache) != 0, smooth, maxRadius);
+    const std::size_t numThreads = std::min<std::size_t>(16, paths.size());
+    if (numThreads <= 1)
+        prepareInputsThread(&state);
+    else
     {
-        if (vm.count(Option::decache))
-            decache(path.string());
-        std::auto_ptr<FastPly::Reader> reader(new FastPly::Reader(readerType, path.string(), smooth, maxRadius));
-        if (reader->size() > SplatSet::FileSet::maxFileSplats)
+        boost::ptr_vector<boost::thread> workers;
+        workers.reserve(numThreads);
+        for (std::size_t i = 0; i < numThreads; i++)
+            workers.push_back(new boost::thread(prepareInputsThread, &state));
+        for (std::size_t i = 0; i < numThreads; i++)
+            workers[i].join();
+    }
+    if (state.error)
+    {
+        for (std::size_t i = 0; i < readers.size(); i++)
+            delete readers[i];
+        boost::rethrow_exception(state.error);
+    }
+
+    /* Rebase the inputs on a per-run local frame anchored near the data.
+     * Georeferenced clouds (e.g. UTM coordinates) have magnitudes that
+     * squander most of a float's precision, and the whole pipeline works in
+     * single precision. The offset is subtracted in double precision as
+     * splats are decoded (see @ref FastPly::Reader::setOffset) and added
+     * back when the final vertices are emitted (see
+     * @ref Marching::setScaleBias), so this is transparent apart from
+     * removing the need to pre-translate the input. Whole units are exactly
+     * representable, so the round trip introduces no rounding beyond the
+     * conversion of the output to float.
+     */
+    double offset[3] = {0.0, 0.0, 0.0};
+    for (std::size_t i = 0; i < readers.size(); i++)
+        if (readers[i]->size() > 0)
         {
-            std::ostringstream msg;
-            msg << "Too many samples in " << path << " ("
-                << reader->size() << " > " << SplatSet::FileSet::maxFileSplats << ")";
-            throw std::runtime_error(msg.str());
+            Splat first;
+            FastPly::Reader::Handle handle(*readers[i]);
+            handle.read(0, 1, &first);
+            bool finite = true;
+            for (unsigned int j = 0; j < 3; j++)
+                finite = finite && (std::tr1::isfinite)(first.position[j]);
+            if (finite)
+                for (unsigned int j = 0; j < 3; j++)
+                    offset[j] = std::floor(double(first.position[j]));
+            break;
         }
-        totalSplats += reader->size();
-        totalBytes += reader->size() * reader->getVertexSize();
-        files.addFile(reader.get());
-        reader.release();
+    if (offset[0] != 0.0 || offset[1] != 0.0 || offset[2] != 0.0)
+        Log::log[Log::debug] << "Rebasing input on local frame at ("
+            << offset[0] << ", " << offset[1] << ", " << offset[2] << ")\n";
+
+    std::tr1::uint64_t totalSplats = 0;
+    std::tr1::uint64_t totalBytes = 0;
+    for (std::size_t i = 0; i < readers.size(); i++)
+    {
+        readers[i]->setOffset(offset);
+        totalSplats += readers[i]->size();
+        totalBytes += readers[i]->size() * readers[i]->getVertexSize();
+        files.addFile(readers[i]);
     }
 
     Statistics::getStatistic<Statistics::Counter>("files.scans").add(paths.size());
@@ -587,14 +1189,9 @@ void reportException(std::exception &e)
 void doComputeBlobs(
     Timeplot::Worker &tworker,
     const po::variables_map &vm,
-    SplatSet::FileSet &splats,
     boost::function<void(float, unsigned int)> computeBlobs)
 {
     const float spacing = vm[Option::fitGrid].as<double>();
-    const float smooth = vm[Option::fitSmooth].as<double>();
-    const float maxRadius = vm.count(Option::maxRadius)
-        ? vm[Option::maxRadius].as<double>() : std::numeric_limits<float>::infinity();
-
     const int subsampling = vm[Option::subsampling].as<int>();
     const int levels = vm[Option::levels].as<int>();
     const unsigned int leafCells = vm[Option::leafCells].as<int>();
@@ -602,7 +1199,6 @@ void doComputeBlobs(
     const unsigned int blockCells = block - 1;
     const unsigned int microCells = std::min(leafCells, blockCells);
 
-    prepareInputs(splats, vm, smooth, maxRadius);
     try
     {
         Timeplot::Action timer("bbox", tworker, "bbox.time");
@@ -614,7 +1210,52 @@ void doComputeBlobs(
     }
 }
 
-unsigned int postprocessGrid(const po::variables_map &vm, const Grid &grid)
+void doComputeBlobs(
+    Timeplot::Worker &tworker,
+    const po::variables_map &vm,
+    SplatSet::FileSet &splats,
+    boost::function<void(float, unsigned int)> computeBlobs)
+{
+    const float smooth = vm[Option::fitSmooth].as<double>();
+    const float maxRadius = vm.count(Option::maxRadius)
+        ? vm[Option::maxRadius].as<double>() : std::numeric_limits<float>::infinity();
+
+    prepareInputs(splats, vm, smooth, maxRadius);
+    doComputeBlobs(tworker, vm, computeBlobs);
+}
+
+void doPreStage(const po::variables_map &vm)
+{
+    const float smooth = vm[Option::fitSmooth].as<double>();
+    const float maxRadius = vm.count(Option::maxRadius)
+        ? vm[Option::maxRadius].as<double>() : std::numeric_limits<float>::infinity();
+
+    SplatSet::FileSet splats;
+    prepareInputs(splats, vm, smooth, maxRadius);
+
+    /* Stream every splat once and discard it. This touches exactly the file
+     * ranges the bounding-box pass will read, in the same order, so the
+     * kernel's readahead and page cache are warmed for the real job. The
+     * decode cost is immaterial next to the cold-storage reads this is
+     * hiding in queue-wait time.
+     */
+    Statistics::Timer timer("prestage.time");
+    const std::size_t bufferSize = 1 << 16;
+    Statistics::Container::vector<Splat> buffer("mem.preStage.buffer", bufferSize);
+    boost::scoped_ptr<SplatSet::SplatStream> splatStream(splats.makeSplatStream());
+    std::tr1::uint64_t nSplats = 0;
+    while (true)
+    {
+        const std::size_t n = splatStream->read(&buffer[0], NULL, bufferSize);
+        if (n == 0)
+            break;
+        nSplats += n;
+    }
+    Log::log[Log::info] << "Pre-staged " << nSplats << " splats\n";
+}
+
+unsigned int postprocessGrid(const po::variables_map &vm, const Grid &grid,
+                             SplatSet::splat_id numSplats)
 {
     for (unsigned int i = 0; i < 3; i++)
     {
@@ -630,10 +1271,31 @@ unsigned int postprocessGrid(const po::variables_map &vm, const Grid &grid)
     }
 
     const bool split = vm.count(Option::split);
-    const unsigned int splitSize = vm[Option::splitSize].as<Capacity>();
     unsigned int chunkCells = 0;
     if (split)
     {
+        std::tr1::uint64_t splitSize = vm[Option::splitSize].as<Capacity>();
+        if (vm[Option::splitSize].defaulted())
+        {
+            /* No explicit size, so pick one from a memory model rather than
+             * making the user rerun the job to fix the granularity. A splat
+             * is roughly one surface sample at the reconstruction
+             * resolution, so numSplats is an upper estimate of the output
+             * vertex count and 38 bytes per vertex (see below) an upper
+             * estimate of the total output size. Aim for a moderate number
+             * of chunks of that total, bounded above by the --mem-reorder
+             * pool: the write phase of @ref OOCMesher reorders a chunk at a
+             * time in that pool, so leave it several chunks of slack.
+             */
+            const std::tr1::uint64_t estBytes = std::tr1::uint64_t(numSplats) * 38;
+            const std::tr1::uint64_t memReorder = vm[Option::memReorder].as<Capacity>();
+            splitSize = estBytes / 256;
+            splitSize = std::min(splitSize, memReorder / 8);
+            splitSize = std::max(splitSize, std::tr1::uint64_t(1024 * 1024));
+            Log::log[Log::info]
+                << "Automatic --" << Option::splitSize << '=' << splitSize << "\n";
+        }
+
         /* Determine a chunk size from splitSize. We assume that a chunk will be
          * sliced by an axis-aligned plane. This plane will cut each vertical and
          * each diagonal edge ones, thus generating 2x^2 vertices. We then
@@ -644,8 +1306,6 @@ unsigned int postprocessGrid(const po::variables_map &vm, const Grid &grid)
          * A manifold with genus 0 has two triangles per vertex; vertices take
          * 12 bytes (3 floats) and triangles take 13 (count plus 3 uints in
          * PLY), giving 38 bytes per vertex. So there are 760x^2 bytes.
-         *
-         * TODO: move this function to mlsgpu_core.
          */
         chunkCells = (unsigned int) ceil(sqrt(splitSize / 760.0));
         if (chunkCells == 0) chunkCells = 1;
@@ -653,10 +1313,11 @@ unsigned int postprocessGrid(const po::variables_map &vm, const Grid &grid)
     return chunkCells;
 }
 
-void doBucket(
+template<typename Splats>
+static void doBucketImpl(
     Timeplot::Worker &tworker,
     const po::variables_map &vm,
-    const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
+    const Splats &splats,
     const Grid &grid,
     Grid::size_type chunkCells,
     BucketCollector &collector)
@@ -672,9 +1333,63 @@ void doBucket(
     const unsigned int block = 1U << (levels + subsampling - 1);
     const unsigned int blockCells = block - 1;
     const unsigned int microCells = std::min(leafCells, blockCells);
+    const Grid::size_type slabCells = vm[Option::slabCells].as<int>();
+    const std::size_t bucketThreads = vm[Option::bucketThreads].as<int>();
+
+    /* When rerunning a site at several resolutions the recursive
+     * decomposition barely changes, so optionally persist it and replay it
+     * on subsequent runs. The plan does not capture chunk alignment, so it
+     * is skipped when output splitting is active; a plan recorded from a
+     * different input (or an unreadable file) is discarded and re-recorded.
+     */
+    if (vm.count(Option::bucketPlan) && chunkCells == 0)
+    {
+        const boost::filesystem::path planPath(vm[Option::bucketPlan].as<std::string>());
+        Bucket::Plan plan;
+        if (plan.load(planPath) && plan.getNumSplats() == splats.numSplats())
+        {
+            Bucket::bucketPlan(splats, grid, plan, maxBucketSplats, blockCells,
+                               microCells, maxSplit, boost::ref(collector));
+        }
+        else
+        {
+            plan.clear();
+            plan.setNumSplats(splats.numSplats());
+            Bucket::PlanRecorder<Splats> recorder(plan, boost::ref(collector));
+            Bucket::bucketSlabs(splats, grid, maxBucketSplats, blockCells, chunkCells,
+                                microCells, maxSplit, slabCells, recorder, bucketThreads);
+            plan.save(planPath);
+        }
+        return;
+    }
+    else if (vm.count(Option::bucketPlan))
+        Log::log[Log::warn] << "Warning: --" << Option::bucketPlan
+            << " is ignored when --" << Option::split << " is used\n";
+
+    Bucket::bucketSlabs(splats, grid, maxBucketSplats, blockCells, chunkCells, microCells, maxSplit,
+                        slabCells, boost::ref(collector), bucketThreads);
+}
+
+void doBucket(
+    Timeplot::Worker &tworker,
+    const po::variables_map &vm,
+    const SplatSet::FastBlobSet<SplatSet::FileSet> &splats,
+    const Grid &grid,
+    Grid::size_type chunkCells,
+    BucketCollector &collector)
+{
+    doBucketImpl(tworker, vm, splats, grid, chunkCells, collector);
+}
 
-    Bucket::bucket(splats, grid, maxBucketSplats, blockCells, chunkCells, microCells, maxSplit,
-                   boost::ref(collector));
+void doBucket(
+    Timeplot::Worker &tworker,
+    const po::variables_map &vm,
+    const SplatSet::FastBlobSet<SplatSet::SequenceSet<const Splat *> > &splats,
+    const Grid &grid,
+    Grid::size_type chunkCells,
+    BucketCollector &collector)
+{
+    doBucketImpl(tworker, vm, splats, grid, chunkCells, collector);
 }
 
 void setWriterComments(const po::variables_map &vm, FastPly::Writer &writer)
@@ -688,17 +1403,91 @@ MesherBase::Namer getNamer(const po::variables_map &vm, const std::string &out)
 {
     const bool split = vm.count(Option::split);
     if (split)
-        return ChunkNamer(out);
+    {
+        if (vm.count(Option::splitDirs))
+            return ShardedChunkNamer(out);
+        else
+            return ChunkNamer(out);
+    }
     else
         return TrivialNamer(out);
 }
 
+std::set<boost::array<Grid::size_type, 3> > parseRepairChunks(const po::variables_map &vm)
+{
+    std::set<boost::array<Grid::size_type, 3> > ans;
+    const std::vector<std::string> &values = vm[Option::repair].as<std::vector<std::string> >();
+    BOOST_FOREACH(const std::string &value, values)
+    {
+        boost::array<Grid::size_type, 3> coords;
+        std::istringstream in(value);
+        char sep1 = '\0', sep2 = '\0';
+        in >> coords[0] >> sep1 >> coords[1] >> sep2 >> coords[2];
+        if (!in || sep1 != ',' || sep2 != ',' || in.get() != std::char_traits<char>::eof())
+            throw invalid_option(std::string("Value of --") + Option::repair
+                                 + " must be a comma-separated coordinate triple: " + value);
+        ans.insert(coords);
+    }
+    return ans;
+}
+
+void clampGridToTileBox(const po::variables_map &vm, Grid &grid)
+{
+    double boxMin[3], boxMax[3];
+    parseTileBox(vm, boxMin, boxMax);
+
+    /* Must match the value passed to computeBlobs (see doComputeBlobs):
+     * keeping the lower extents multiples of it preserves the blob stream
+     * fast path over the clamped grid.
+     */
+    const int subsampling = vm[Option::subsampling].as<int>();
+    const int levels = vm[Option::levels].as<int>();
+    const unsigned int leafCells = vm[Option::leafCells].as<int>();
+    const unsigned int blockCells = (1U << (levels + subsampling - 1)) - 1;
+    const unsigned int microCells = std::min(leafCells, blockCells);
+
+    const float spacing = grid.getSpacing();
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        // The box is given in the frame of the input files
+        const double lo = boxMin[i] - grid.getWorldOffset()[i];
+        const double hi = boxMax[i] - grid.getWorldOffset()[i];
+        Grid::difference_type lower = Grid::RoundDown::convert(float(lo / spacing));
+        Grid::difference_type upper = Grid::RoundUp::convert(float(hi / spacing));
+        lower = divDown(lower, microCells) * microCells;
+        lower = std::max(lower, grid.getExtent(i).first);
+        upper = std::min(upper, grid.getExtent(i).second);
+        if (lower >= upper)
+            throw std::runtime_error("The box given with --tile-box does not intersect the input");
+        grid.setExtent(i, lower, upper);
+    }
+}
+
 void setMesherOptions(const po::variables_map &vm, MesherBase &mesher)
 {
     const double pruneThreshold = vm[Option::fitPrune].as<double>();
     const std::size_t memReorder = vm[Option::memReorder].as<Capacity>();
+    const std::size_t memKeyMap = vm[Option::memKeyMap].as<Capacity>();
     mesher.setPruneThreshold(pruneThreshold);
     mesher.setReorderCapacity(memReorder);
+    mesher.setKeyMapCapacity(memKeyMap);
+    mesher.setCheckManifold(vm.count(Option::checkManifold));
+    mesher.setVertexCacheOrder(vm.count(Option::vertexCache));
+    /* Compressed temporary files cannot be truncated and appended to, which
+     * the checkpoint protocol requires.
+     */
+    mesher.setTmpCompressed(!vm.count(Option::checkpoint) && !vm.count(Option::resume));
+    if (vm.count(Option::chunkStream))
+    {
+        /* Compressed output files must be expanded back to PLY before they
+         * are handed to the consumer.
+         */
+        const WriterType writerType = vm[Option::writer].as<Choice<WriterTypeWrapper> >();
+        mesher.setChunkStream(vm[Option::chunkStream].as<std::string>(),
+                              writerType == COMPRESSED_WRITER ? COMPRESSED_READER : SYSCALL_READER);
+    }
+    if (vm.count(Option::chunkManifest))
+        mesher.setChunkManifest(vm[Option::chunkManifest].as<std::string>());
 }
 
 SlaveWorkers::SlaveWorkers(
@@ -713,6 +1502,8 @@ SlaveWorkers::SlaveWorkers(
     const unsigned int numDeviceThreads = vm[Option::deviceThreads].as<int>();
     const float boundaryLimit = vm[Option::fitBoundaryLimit].as<double>();
     const MlsShape shape = vm[Option::fitShape].as<Choice<MlsShapeWrapper> >();
+    const double timeSlice = vm.count(Option::timeSlice)
+        ? vm[Option::timeSlice].as<double>() * 1e-3 : 0.0;
     const std::size_t deviceSpare = getDeviceWorkerGroupSpare(vm);
 
     const std::size_t maxBucketSplats = getMaxBucketSplats(vm);
@@ -722,6 +1513,29 @@ SlaveWorkers::SlaveWorkers(
     const unsigned int block = 1U << (levels + subsampling - 1);
     const unsigned int blockCells = block - 1;
 
+    /* On multi-socket machines, keep the reader thread, the copy worker and
+     * the buffers between them together on node 0 so that the hot copy path
+     * never crosses sockets, and place each device worker group on the node
+     * holding its device's PCIe root so that staging buffers and the threads
+     * filling them sit next to the link they feed. Devices whose location
+     * cannot be determined are spread round-robin over the nodes. On
+     * single-node machines (or without libnuma) the node is negative and
+     * placement is left to the OS.
+     */
+    const int numaNodes = numaNodeCount();
+    const int hostNode = numaNodes > 1 ? 0 : -1;
+
+    /* Splats are gathered straight into device-visible memory when every
+     * device shares DRAM with the host (e.g. an APU), skipping the separate
+     * upload. It must be all devices, because the copy worker gathers into
+     * whichever device it will target.
+     */
+    bool zeroCopy = !devices.empty();
+    for (std::size_t i = 0; i < devices.size(); i++)
+        zeroCopy = zeroCopy && devices[i].second.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+    if (zeroCopy)
+        Log::log[Log::info] << "Shared-memory devices detected: using zero-copy splat upload.\n";
+
     std::vector<DeviceWorkerGroup *> deviceWorkerGroupPtrs;
     for (std::size_t i = 0; i < devices.size(); i++)
     {
@@ -732,28 +1546,136 @@ SlaveWorkers::SlaveWorkers(
             maxBucketSplats, blockCells,
             getMeshMemory(vm),
             levels, subsampling,
-            boundaryLimit, shape);
+            vm[Option::devicePipeline].as<int>(),
+            boundaryLimit, shape, timeSlice, zeroCopy,
+            vm.count(Option::halfSplats));
+        if (numaNodes > 1)
+        {
+            int node = CLH::deviceNumaNode(devices[i].second);
+            if (node >= 0)
+            {
+                Log::log[Log::debug] << "Device "
+                    << devices[i].second.getInfo<CL_DEVICE_NAME>()
+                    << " is attached to NUMA node " << node << "\n";
+            }
+            else
+                node = int(i) % numaNodes;
+            dwg->setNumaNode(node);
+        }
         deviceWorkerGroups.push_back(dwg);
         deviceWorkerGroupPtrs.push_back(dwg);
     }
-    copyGroup.reset(new CopyGroup(deviceWorkerGroupPtrs, maxHostSplats));
+    copyGroup.reset(new CopyGroup(deviceWorkerGroupPtrs, maxHostSplats, hostNode));
     loader.reset(new BucketLoader(maxLoadSplats, *copyGroup, tworker));
+    loader->setThinning(vm[Option::thinSplats].as<int>());
+
+    /* The copy worker is registered alongside the device groups so that its
+     * core is accounted for in the budget; being a single serial worker it
+     * always keeps exactly that one slot.
+     */
+    const std::size_t cores = boost::thread::hardware_concurrency();
+    if (cores != 0)
+    {
+        scheduler.reset(new ElasticScheduler(cores));
+        scheduler->addGroup(*copyGroup);
+        for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
+            scheduler->addGroup(deviceWorkerGroups[i]);
+    }
+
+    if (vm.count(Option::deviceControl))
+        deviceControlPath = vm[Option::deviceControl].as<std::string>();
 }
 
-void SlaveWorkers::start(SplatSet::FileSet &splats, const Grid &grid, ProgressMeter *progress)
+void SlaveWorkers::applyDeviceControl()
 {
+    /* An absent or unreadable file is not an error: the scheduler removes
+     * it (or has not created it yet), which means every device is ours.
+     */
+    std::set<std::size_t> allowed;
+    bool haveFile = false;
+    try
+    {
+        boost::filesystem::ifstream in(deviceControlPath);
+        if (in)
+        {
+            haveFile = true;
+            std::size_t idx;
+            while (in >> idx)
+                allowed.insert(idx);
+        }
+    }
+    catch (std::exception &e)
+    {
+        haveFile = false;
+    }
+
     for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
-        deviceWorkerGroups[i].setProgress(progress);
+        deviceWorkerGroups[i].setAdmitting(!haveFile || allowed.count(i));
+}
 
-    loader->start(splats, grid);
+void SlaveWorkers::deviceControlLoop()
+{
+    thread_set_name("devctl");
+    while (true)
+    {
+        applyDeviceControl();
+        // sleep is an interruption point, so stop() does not wait out the poll
+        boost::this_thread::sleep(boost::posix_time::seconds(5));
+    }
+}
+
+void SlaveWorkers::prepareSplats(SplatSet::FileSet &splats, boost::true_type)
+{
+    if (numaNodeCount() > 1)
+        splats.setNumaNode(0); // same node as the copy worker
+}
+
+void SlaveWorkers::startCommon(const Grid &grid)
+{
     copyGroup->start();
     for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
         deviceWorkerGroups[i].start(grid);
+    if (scheduler)
+        scheduler->start();
+    if (!deviceControlPath.empty())
+        deviceControlThread.reset(new boost::thread(
+            boost::bind(&SlaveWorkers::deviceControlLoop, this)));
 }
 
 void SlaveWorkers::stop()
 {
+    /* Stopped first so that a detach cannot race with teardown, and so the
+     * next start() begins from the file's current state.
+     */
+    if (deviceControlThread)
+    {
+        deviceControlThread->interrupt();
+        deviceControlThread->join();
+        deviceControlThread.reset();
+    }
+    loader->stop();
+    if (scheduler)
+        scheduler->stop();
     copyGroup->stop();
     for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
         deviceWorkerGroups[i].stop();
 }
+
+SplatSet::splat_id SlaveWorkers::collectorBudget(SplatSet::splat_id maxSplats)
+{
+    std::size_t capacity = 0;
+    std::size_t spare = 0;
+    std::size_t minSplats = 0;
+    for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
+    {
+        capacity += deviceWorkerGroups[i].getPoolSplats();
+        spare += deviceWorkerGroups[i].unallocated();
+        minSplats = std::max(minSplats, deviceWorkerGroups[i].getMaxItemSplats());
+    }
+    if (capacity == 0 || minSplats >= maxSplats)
+        return maxSplats;
+
+    // Spare capacity indicates the devices are draining faster than we feed them
+    const double busy = 1.0 - double(spare) / double(capacity);
+    return minSplats + SplatSet::splat_id(busy * (maxSplats - minSplats));
+}
@@ -34,10 +34,15 @@
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/filesystem/path.hpp>
 #include <ostream>
 #include <exception>
 #include <vector>
+#include <set>
 #include <utility>
+#include <boost/array.hpp>
+#include <boost/type_traits/is_base_of.hpp>
 #include "splat_set.h"
 #include "workers.h"
 #include "bucket.h"
@@ -71,30 +76,69 @@ namespace Option
     const char * const inputFile = "input-file";
     const char * const outputFile = "output-file";
     const char * const split = "split";
+    const char * const checkManifold = "check-manifold";
+    const char * const vertexCache = "vertex-cache";
     const char * const splitSize = "split-size";
+    const char * const splitDirs = "split-dirs";
+    const char * const chunkStream = "chunk-stream";
+    const char * const chunkManifest = "chunk-manifest";
+    const char * const normals = "normals";
 
     const char * const statistics = "statistics";
     const char * const statisticsFile = "statistics-file";
     const char * const statisticsCL = "statistics-cl";
+    const char * const statisticsKernels = "statistics-kernels";
+    const char * const statisticsCounters = "statistics-counters";
+    const char * const statisticsSnapshot = "statistics-snapshot";
+    const char * const statisticsSnapshotInterval = "statistics-snapshot-interval";
     const char * const timeplot = "timeplot";
+    const char * const timeplotBinary = "timeplot-binary";
 
     const char * const maxSplit = "max-split";
+    const char * const slabCells = "slab-cells";
+    const char * const bucketPlan = "bucket-plan";
+    const char * const halfDistance = "half-distance";
+    const char * const halfSplats = "half-splats";
+    const char * const thinSplats = "thin-splats";
     const char * const levels = "levels";
     const char * const subsampling = "subsampling";
     const char * const leafCells = "leaf-cells";
     const char * const deviceThreads = "device-threads";
+    const char * const devicePipeline = "device-pipeline";
+    const char * const deviceControl = "device-control";
+    const char * const autoParams = "auto-params";
     const char * const reader = "reader";
     const char * const writer = "writer";
     const char * const ompThreads = "omp-threads";
     const char * const decache = "decache";
+    const char * const bboxThreads = "bbox-threads";
+    const char * const bucketThreads = "bucket-threads";
+    const char * const splatCache = "splat-cache";
+    const char * const blobCache = "blob-cache";
     const char * const checkpoint = "checkpoint";
+    const char * const checkpointInterval = "checkpoint-interval";
     const char * const resume = "resume";
+    const char * const incremental = "incremental";
+    const char * const plan = "plan";
+    const char * const planFraction = "plan-fraction";
+    const char * const journal = "journal";
+    const char * const repair = "repair";
+    const char * const tileBox = "tile-box";
+    const char * const adaptiveIO = "io-adapt";
+    const char * const timeSlice = "time-slice";
 
+    const char * const daemon = "daemon";
+    const char * const preStage = "pre-stage";
+    const char * const control = "control";
+    const char * const mpiCompress = "mpi-compress";
+    const char * const memHost = "mem-host";
     const char * const memLoadSplats = "mem-load-splats";
     const char * const memHostSplats = "mem-host-splats";
     const char * const memBucketSplats = "mem-bucket-splats";
     const char * const memMesh = "mem-mesh";
     const char * const memReorder = "mem-reorder";
+    const char * const memKeyMap = "mem-key-map";
+    const char * const lockMemory = "lock-memory";
     const char * const memGather = "mem-gather";
 };
 
@@ -108,6 +152,17 @@ void usage(std::ostream &o, const boost::program_options::options_description de
  */
 boost::program_options::variables_map processOptions(int argc, char **argv, bool isMPI);
 
+/**
+ * Process a pre-split argument list (excluding the program name) to produce
+ * command-line options. Unlike the @c argv overload this reports problems by
+ * throwing rather than printing usage information and exiting, so a resident
+ * process can reject a bad job without dying. An input and output file are
+ * required, and @c --help and @c --daemon are rejected.
+ *
+ * @throw invalid_option if the arguments could not be parsed or are incomplete.
+ */
+boost::program_options::variables_map processOptions(const std::vector<std::string> &args, bool isMPI);
+
 /**
  * Write the statistics to the statistics output.
  *
@@ -125,6 +180,50 @@ void writeStatistics(const boost::program_options::variables_map &vm, bool force
  */
 void validateOptions(const boost::program_options::variables_map &vm, bool isMPI);
 
+/**
+ * Derive defaults for the memory and threading options from the capabilities
+ * of the devices and the host, when --auto-params was given. Only options the
+ * user left at their defaults are touched, so explicit settings always win.
+ * The capabilities passed in must be the minima over every device that will
+ * participate in the run, so that the derived values fit the weakest device.
+ *
+ * This must be called before @ref validateOptions or @ref resourceUsage.
+ *
+ * @param vm              Command-line options (updated in place).
+ * @param deviceMemory    Smallest @c CL_DEVICE_GLOBAL_MEM_SIZE over the devices.
+ * @param deviceMaxAlloc  Smallest @c CL_DEVICE_MAX_MEM_ALLOC_SIZE over the devices.
+ * @param computeUnits    Smallest @c CL_DEVICE_MAX_COMPUTE_UNITS over the devices.
+ */
+void setAutoParameters(boost::program_options::variables_map &vm,
+                       std::size_t deviceMemory, std::size_t deviceMaxAlloc,
+                       unsigned int computeUnits);
+
+/**
+ * Overload of @ref setAutoParameters that reduces the capabilities over a
+ * list of devices. It is suitable when all the devices for the run are
+ * locally visible; MPI drivers must reduce the capabilities across the job
+ * themselves and use the scalar overload.
+ */
+void setAutoParameters(boost::program_options::variables_map &vm,
+                       const std::vector<cl::Device> &devices);
+
+/**
+ * Divide the total budget given by --mem-host between the host-side memory
+ * pools. Does nothing if --mem-host was not given. Pools the user sized
+ * explicitly keep their values and are taken off the top of the budget; the
+ * remainder is split between the other pools in proportion to their default
+ * sizes, so the relative balance of the pools follows the hand-tuned
+ * defaults at any scale. The pools are all allocated up front, so the split
+ * is fixed for the whole run.
+ *
+ * This must be called after @ref setAutoParameters (so that the budget wins
+ * over auto-derived pool sizes) and before @ref validateOptions.
+ *
+ * @param vm     Command-line options (updated in place).
+ * @param isMPI  Whether the --mem-gather pool exists to be included.
+ */
+void setMemoryBudget(boost::program_options::variables_map &vm, bool isMPI);
+
 /**
  * Set the logging level based on the command-line options.
  */
@@ -162,6 +261,21 @@ void prepareInputs(SplatSet::FileSet &files, const boost::program_options::varia
  */
 void reportException(std::exception &e);
 
+/**
+ * Compute the blobs for a splat set that is already populated, deriving the
+ * spacing and bucket size from the command-line options.
+ *
+ * @param tworker          Worker to attribute time for bounding box calculation
+ * @param vm               Command-line options
+ * @param computeBlobs     Callback to do the low-level computation
+ *
+ * @throw std::runtime_error if there are no splats.
+ */
+void doComputeBlobs(
+    Timeplot::Worker &tworker,
+    const boost::program_options::variables_map &vm,
+    boost::function<void(float, unsigned int)> computeBlobs);
+
 /**
  * Load the inputs and compute the blobs and chunk size.
  *
@@ -180,15 +294,35 @@ void doComputeBlobs(
     boost::function<void(float, unsigned int)> computeBlobs);
 
 /**
- * Validate the grid size and compute the chunk size.
+ * Implementation of <tt>--pre-stage</tt>: read the input splats once and
+ * discard them, warming the filesystem cache with exactly the ranges the
+ * bounding-box pass will read. A scheduler can run this on the target node
+ * while the job is still waiting for its GPUs, so the cold-storage latency
+ * overlaps queue wait instead of run time. It deliberately touches no
+ * OpenCL state.
+ *
+ * @throw boost::exception   if there was a problem reading the files.
+ * @throw std::runtime_error if there are too many files.
+ */
+void doPreStage(const boost::program_options::variables_map &vm);
+
+/**
+ * Validate the grid size and compute the chunk size. When @ref Option::split
+ * is given without an explicit @ref Option::splitSize, the chunk size is
+ * chosen automatically from @a numSplats (as an estimate of the output
+ * density) and the @ref Option::memReorder budget that bounds the mesher
+ * write phase.
+ *
  * @param vm               Command-line options
  * @param grid             Bounding box grid
+ * @param numSplats        Number of splats in the input
  * @return Chunk size for output, in cells
  * @throw std::runtime_error if the grid is too large
  */
 unsigned int postprocessGrid(
     const boost::program_options::variables_map &vm,
-    const Grid &grid);
+    const Grid &grid,
+    SplatSet::splat_id numSplats);
 
 /**
  * An all-in-one helper to call @ref Bucket::bucket with appropriate parameters.
@@ -208,6 +342,18 @@ void doBucket(
     Grid::size_type chunkCells,
     BucketCollector &collector);
 
+/**
+ * Overload of @ref doBucket for the in-memory splat sets used when
+ * reconstruction is embedded as a library (see @ref Reconstruct::run).
+ */
+void doBucket(
+    Timeplot::Worker &tworker,
+    const boost::program_options::variables_map &vm,
+    const SplatSet::FastBlobSet<SplatSet::SequenceSet<const Splat *> > &splats,
+    const Grid &grid,
+    Grid::size_type chunkCells,
+    BucketCollector &collector);
+
 /**
  * Set comments on the writer showing provenance of the file.
  */
@@ -223,6 +369,47 @@ void setMesherOptions(const boost::program_options::variables_map &vm, MesherBas
  */
 MesherBase::Namer getNamer(const boost::program_options::variables_map &vm, const std::string &out);
 
+/**
+ * Parse the chunk coordinates given with --repair. Each occurrence of the
+ * option names one output chunk as a comma-separated coordinate triple, as
+ * recorded in the bin journal (see @ref BucketCollector::setJournal).
+ *
+ * @throw invalid_option if a value is not a well-formed coordinate triple.
+ */
+std::set<boost::array<Grid::size_type, 3> > parseRepairChunks(
+    const boost::program_options::variables_map &vm);
+
+/**
+ * Shrink a bounding grid to the box given with --tile-box, for splitting one
+ * site across machines that share no MPI fabric. The box is given in the
+ * coordinates of the input files; since bounding grids are anchored at the
+ * world origin (see @ref SplatSet::FastBlobSet::getBoundingGrid), every job
+ * run with the same --fit-grid sees cell and vertex positions in exactly the
+ * same places, regardless of which box it was given. Abutting or overlapping
+ * tiles therefore produce bitwise-identical geometry where their cells
+ * coincide, which is what allows their outputs to be welded back together
+ * afterwards (see utils/tile.py and the plyweld tool).
+ *
+ * The lower extents are rounded down to a multiple of the microblock size so
+ * that the blob data from the bounding box pass remains usable (see @ref
+ * SplatSet::FastBlobSet::makeBlobStream); the resulting overlap between
+ * neighbouring tiles yields exact duplicate triangles, which the weld
+ * removes. The grid must already have its world offset set, as the box is
+ * interpreted in the un-rebased frame.
+ *
+ * The same option serves region-of-interest runs (one building out of a
+ * city-scale scan), and the input I/O then scales with the region rather
+ * than the site: the bucket walk clips each blob to the clamped grid and
+ * drops the ones that fall outside, so the loader fetches only the byte
+ * ranges of the buckets that intersect the box, and only intersecting
+ * chunks are emitted. The one whole-input read left is the bounding box
+ * pass that builds the blob index; give repeated runs a @c --blob-cache
+ * and that disappears too.
+ *
+ * @throw std::runtime_error if the box does not intersect the grid.
+ */
+void clampGridToTileBox(const boost::program_options::variables_map &vm, Grid &grid);
+
 /**
  * Collects together the workers that run on the slave side in MPI, without
  * using any MPI-specific code.
@@ -235,15 +422,90 @@ public:
     boost::scoped_ptr<CopyGroup> copyGroup;
     boost::scoped_ptr<BucketLoader> loader;
 
+    /**
+     * Shifts worker-thread slots between the groups as load moves through
+     * the pipeline, so that oversubscribed hosts keep their cores on
+     * whichever stage has the deepest backlog. It is NULL when the core
+     * count is unknown; @ref ElasticScheduler::start is itself a no-op when
+     * the cores cover every worker.
+     */
+    boost::scoped_ptr<ElasticScheduler> scheduler;
+
+    /**
+     * Honour a <tt>--device-control</tt> file: the file holds the
+     * whitespace-separated indices (in @ref CLH::findDevices order) of the
+     * devices allowed to take new work, and is re-read periodically by a
+     * monitor thread while the workers run. Devices missing from the list
+     * are detached (see @ref DeviceWorkerGroup::setAdmitting) so a farm
+     * scheduler can reclaim a GPU mid-job and hand it back later; an
+     * absent or unreadable file leaves every device attached.
+     *
+     * OpenCL fixes the platform's device enumeration at startup, so only
+     * devices selected for the run can come and go; a GPU that did not
+     * exist when the job started cannot join it.
+     */
+    void applyDeviceControl();
+
     SlaveWorkers(
         Timeplot::Worker &tworker,
         const boost::program_options::variables_map &vm,
         const std::vector<std::pair<cl::Context, cl::Device> > &devices,
         const DeviceWorkerGroup::OutputGenerator &outputGenerator);
 
-    void start(SplatSet::FileSet &splats, const Grid &grid, ProgressMeter *progress);
+    /**
+     * Starts a pass over @a splats. The splat set may be any model of the
+     * subsettable concept: the stand-alone tools pass file-backed sets,
+     * while @ref Reconstruct::run passes an in-memory set. File-backed sets
+     * have their readers pinned to NUMA node 0, alongside the copy worker;
+     * other sets have no placement hook. The set must remain valid until
+     * @ref stop.
+     */
+    template<typename Splats>
+    void start(Splats &splats, const Grid &grid, ProgressMeter *progress)
+    {
+        for (std::size_t i = 0; i < deviceWorkerGroups.size(); i++)
+            deviceWorkerGroups[i].setProgress(progress);
+        prepareSplats(splats, typename boost::is_base_of<SplatSet::FileSet, Splats>::type());
+        loader->setProgress(progress);
+        loader->start(splats, grid);
+        startCommon(grid);
+    }
 
     void stop();
+
+    /**
+     * Compute a batch size for @ref BucketCollector::setBudget based on the
+     * current occupancy of the device queues. While the devices have plenty
+     * of spare queue capacity the budget shrinks towards a single bucket, so
+     * that work reaches the GPUs without waiting for a full batch to
+     * accumulate; as the queues fill up it grows towards @a maxSplats to
+     * amortize the per-batch loading overhead. The optimal bucket size
+     * itself cannot change at runtime because the device buffers are sized
+     * for it up front.
+     *
+     * @param maxSplats Upper limit on the returned budget.
+     */
+    SplatSet::splat_id collectorBudget(SplatSet::splat_id maxSplats);
+
+private:
+    /// NUMA placement hook for @ref start: file readers share node 0 with the copy worker
+    void prepareSplats(SplatSet::FileSet &splats, boost::true_type);
+
+    /// Placement hook for splat sets with nothing to place
+    template<typename Splats>
+    void prepareSplats(Splats &, boost::false_type) {}
+
+    /// Starts everything downstream of the loader, shared by all @ref start instantiations
+    void startCommon(const Grid &grid);
+
+    /// Path given with <tt>--device-control</tt> (empty when absent)
+    boost::filesystem::path deviceControlPath;
+
+    /// Monitor thread re-reading @ref deviceControlPath (NULL when not running)
+    boost::scoped_ptr<boost::thread> deviceControlThread;
+
+    /// Thread procedure: apply the control file until interrupted
+    void deviceControlLoop();
 };
 
 #endif /* !MLSGPU_CORE_H */
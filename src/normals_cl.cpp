@@ -0,0 +1,144 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref NormalsCL.
+ */
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <CL/cl.hpp>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <string>
+#include "normals_cl.h"
+#include "splat_tree_cl.h"
+#include "grid.h"
+#include "clh.h"
+#include "errors.h"
+#include "statistics.h"
+#include "statistics_cl.h"
+
+void NormalsCL::validateDevice(const cl::Device &device)
+{
+    /* Only base OpenCL 1.1 functionality is used, so any device that passes
+     * the generic checks will do.
+     */
+    (void) device;
+}
+
+CLH::ResourceUsage NormalsCL::resourceUsage(const cl::Device &device)
+{
+    (void) device;
+
+    /* The estimation works in place on the caller's splats buffer and reads
+     * the octree buffers owned by a SplatTreeCL, so there are no allocations
+     * of its own to account for.
+     */
+    return CLH::ResourceUsage();
+}
+
+NormalsCL::NormalsCL(const cl::Context &context, const cl::Device &device, bool halfNormals)
+    :
+    prepareKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.normals.prepareSplats.time")),
+    estimateKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.normals.estimateNormals.time"))
+{
+    (void) device;
+
+    std::map<std::string, std::string> defines;
+    defines["HALF_NORMALS"] = halfNormals ? "1" : "0";
+    cl::Program program = CLH::build(context, "kernels/normals.cl", defines);
+    prepareKernel = cl::Kernel(program, "prepareSplats");
+    estimateKernel = cl::Kernel(program, "estimateNormals");
+}
+
+void NormalsCL::enqueuePrepare(
+    const cl::CommandQueue &queue,
+    const cl::Buffer &splats,
+    std::size_t splatStride,
+    std::size_t firstSplat,
+    std::size_t numSplats,
+    float searchRadius,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    MLSGPU_ASSERT(numSplats >= 1, std::length_error);
+    MLSGPU_ASSERT(firstSplat + numSplats <= splatStride, std::out_of_range);
+    MLSGPU_ASSERT(searchRadius > 0.0f, std::invalid_argument);
+
+    prepareKernel.setArg(0, splats);
+    prepareKernel.setArg(1, (cl_uint) splatStride);
+    prepareKernel.setArg(2, (cl_uint) firstSplat);
+    prepareKernel.setArg(3, (cl_float) searchRadius);
+    CLH::enqueueNDRangeKernel(queue,
+                              prepareKernel,
+                              cl::NullRange,
+                              cl::NDRange(numSplats),
+                              cl::NullRange,
+                              events, event, &prepareKernelTime);
+}
+
+void NormalsCL::enqueueEstimate(
+    const cl::CommandQueue &queue,
+    const cl::Buffer &splats,
+    const SplatTreeCL &tree,
+    std::size_t bin,
+    std::size_t firstSplat,
+    std::size_t numSplats,
+    const Grid::difference_type offset[3],
+    unsigned int subsamplingShift,
+    const float viewpoint[3],
+    float radiusScale,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    MLSGPU_ASSERT(numSplats >= 1, std::length_error);
+    MLSGPU_ASSERT(bin < tree.getMaxBatch(), std::out_of_range);
+    MLSGPU_ASSERT(radiusScale > 0.0f, std::invalid_argument);
+
+    cl_int3 offset3 = {{ (cl_int) offset[0], (cl_int) offset[1], (cl_int) offset[2] }};
+    cl_float3 viewpoint3 = {{ viewpoint[0], viewpoint[1], viewpoint[2] }};
+
+    estimateKernel.setArg(0, splats);
+    estimateKernel.setArg(1, (cl_uint) tree.getSplatStride());
+    estimateKernel.setArg(2, tree.getCommands());
+    estimateKernel.setArg(3, tree.getStart());
+    estimateKernel.setArg(4, (cl_uint) tree.getStartBase(bin));
+    estimateKernel.setArg(5, (cl_uint) (3 * subsamplingShift));
+    estimateKernel.setArg(6, (cl_uint) firstSplat);
+    estimateKernel.setArg(7, offset3);
+    estimateKernel.setArg(8, viewpoint3);
+    estimateKernel.setArg(9, (cl_float) radiusScale);
+    CLH::enqueueNDRangeKernel(queue,
+                              estimateKernel,
+                              cl::NullRange,
+                              cl::NDRange(numSplats),
+                              cl::NullRange,
+                              events, event, &estimateKernelTime);
+}
@@ -0,0 +1,168 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * GPU engine for estimating normals and radii for raw point clouds.
+ */
+
+#ifndef NORMALS_CL_H
+#define NORMALS_CL_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <CL/cl.hpp>
+#include <cstddef>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include "clh.h"
+#include "grid.h"
+#include "splat_tree_cl.h"
+#include "statistics.h"
+
+/**
+ * Turns raw splats (positions only) into the full form that the MLS kernels
+ * require, by estimating a normal and a radius for each one on the device.
+ * Neighbourhoods are found with the same octree that MLS traversal uses
+ * (@ref SplatTreeCL), so no separate spatial structure is needed; the normal
+ * is a weighted PCA plane fit over the neighbourhood and the radius follows
+ * from the local sample density.
+ *
+ * The octree build indexes each splat by its radius, which does not exist
+ * yet for raw input, so the stage runs as a three-step protocol around the
+ * build:
+ *
+ * -# @ref enqueuePrepare assigns a uniform provisional search radius to the
+ *    bin's splats (positions must already be in grid coordinates).
+ * -# The caller builds the octree over them with
+ *    @ref SplatTreeCL::enqueueBuild as usual.
+ * -# @ref enqueueEstimate rewrites the normals and radii in place, leaving
+ *    the splats in exactly the state MLS expects, so the same octree can be
+ *    reused for the MLS pass without rebuilding.
+ *
+ * This makes it a fused, per-bin pre-pass: a device worker that receives
+ * raw splats inserts steps 1 and 3 around its existing octree build and the
+ * rest of the pipeline is unchanged.
+ */
+class NormalsCL : public boost::noncopyable
+{
+public:
+    /**
+     * Checks whether the device can support this class at all.
+     *
+     * @throw CLH::invalid_device if the device is unsuitable.
+     */
+    static void validateDevice(const cl::Device &device);
+
+    /**
+     * Estimates the resources used by a single instance.
+     *
+     * @param device          Device on which the instance will be used.
+     */
+    static CLH::ResourceUsage resourceUsage(const cl::Device &device);
+
+    /**
+     * Constructor.
+     *
+     * @param context         Context used to create kernels.
+     * @param device          Device the instance will run on.
+     * @param halfNormals     Whether the normal/quality plane of the splat
+     *                        buffers is quantized to half precision; it must
+     *                        match the layout used by the MLS kernels.
+     */
+    NormalsCL(const cl::Context &context, const cl::Device &device, bool halfNormals = false);
+
+    /**
+     * Assign the provisional search radius to a bin's splats, ahead of the
+     * octree build. Positions must already be in grid coordinates; nothing
+     * else need be valid.
+     *
+     * @param queue           Queue in which to enqueue the work.
+     * @param splats          Buffer of splats in the two-plane layout, shared
+     *                        with the octree build.
+     * @param splatStride     Offset (in float4 elements) in @a splats from the
+     *                        position/radius plane to the normal/quality plane.
+     * @param firstSplat      Index of the bin's first splat.
+     * @param numSplats       Number of splats in the bin.
+     * @param searchRadius    Neighbourhood search radius, in grid units.
+     * @param events          Events to wait for (or @c NULL).
+     * @param event           Event signaled on completion (or @c NULL).
+     */
+    void enqueuePrepare(const cl::CommandQueue &queue,
+                        const cl::Buffer &splats,
+                        std::size_t splatStride,
+                        std::size_t firstSplat,
+                        std::size_t numSplats,
+                        float searchRadius,
+                        const std::vector<cl::Event> *events = NULL,
+                        cl::Event *event = NULL);
+
+    /**
+     * Estimate normals and radii for a bin's splats, in place, using the
+     * octree built over them. On completion the radius field holds the
+     * inverse squared radius, as the MLS kernels expect.
+     *
+     * @param queue           Queue in which to enqueue the work.
+     * @param splats          Buffer of splats passed to the octree build. The
+     *                        plane stride is taken from @a tree.
+     * @param tree            Octree built over the bin (after @ref enqueuePrepare).
+     * @param bin             Index of the bin within the tree's last batched build.
+     * @param firstSplat      Index of the bin's first splat.
+     * @param numSplats       Number of splats in the bin.
+     * @param offset          Offset of the octree within the overall grid,
+     *                        as passed to the build.
+     * @param subsamplingShift Subsampling shift, as passed to the build.
+     * @param viewpoint       Point (in grid coordinates) towards which normals
+     *                        are oriented, e.g. the scanner position.
+     * @param radiusScale     Output radius as a multiple of the estimated
+     *                        sample spacing.
+     * @param events          Events to wait for (or @c NULL); must include or
+     *                        follow the octree build.
+     * @param event           Event signaled on completion (or @c NULL).
+     *
+     * @pre @a bin is less than the number of bins in the tree's last build,
+     * and the bin's splats were prepared by @ref enqueuePrepare before the
+     * build.
+     */
+    void enqueueEstimate(const cl::CommandQueue &queue,
+                         const cl::Buffer &splats,
+                         const SplatTreeCL &tree,
+                         std::size_t bin,
+                         std::size_t firstSplat,
+                         std::size_t numSplats,
+                         const Grid::difference_type offset[3],
+                         unsigned int subsamplingShift,
+                         const float viewpoint[3],
+                         float radiusScale,
+                         const std::vector<cl::Event> *events = NULL,
+                         cl::Event *event = NULL);
+
+private:
+    cl::Kernel prepareKernel;    ///< Kernel compiled from @c prepareSplats
+    cl::Kernel estimateKernel;   ///< Kernel compiled from @c estimateNormals
+
+    Statistics::Variable &prepareKernelTime;  ///< Statistic for time spent in @ref prepareKernel
+    Statistics::Variable &estimateKernelTime; ///< Statistic for time spent in @ref estimateKernel
+};
+
+#endif /* !NORMALS_CL_H */
@@ -0,0 +1,146 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * OS-specific utilities to place threads and memory on NUMA nodes.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include "numa.h"
+
+#if HAVE_NUMA_AVAILABLE
+
+#include <numa.h>
+
+namespace
+{
+
+/**
+ * Runtime support check, evaluated once. @c numa_available must be called
+ * before any other libnuma function.
+ */
+bool haveNuma()
+{
+    static const bool available = numa_available() >= 0;
+    return available;
+}
+
+} // anonymous namespace
+
+bool numaSupported()
+{
+    return haveNuma();
+}
+
+int numaNodeCount()
+{
+    if (!haveNuma())
+        return 1;
+    return numa_max_node() + 1;
+}
+
+void numaBindThread(int node)
+{
+    if (node < 0 || !haveNuma())
+        return;
+    numa_run_on_node(node); // failure is harmless, so not checked
+}
+
+void numaBindMemory(void *ptr, std::size_t size, int node)
+{
+    if (node < 0 || ptr == NULL || size == 0 || !haveNuma())
+        return;
+
+    // The binding operates on pages, so trim the range to page boundaries
+    const std::size_t page = numa_pagesize();
+    char *first = static_cast<char *>(ptr);
+    char *last = first + size;
+    first += (page - reinterpret_cast<std::size_t>(first) % page) % page;
+    last -= reinterpret_cast<std::size_t>(last) % page;
+    if (first < last)
+        numa_tonode_memory(first, last - first, node);
+}
+
+int numaNodeOfPci(unsigned int domain, unsigned int bus, unsigned int dev, unsigned int function)
+{
+    if (!haveNuma())
+        return -1;
+
+    /* Sysfs exposes the node of each PCI function directly. The file holds
+     * -1 on single-node machines or when the kernel does not know.
+     */
+    std::ostringstream path;
+    path << "/sys/bus/pci/devices/"
+        << std::hex << std::setfill('0')
+        << std::setw(4) << domain << ':'
+        << std::setw(2) << bus << ':'
+        << std::setw(2) << dev << '.' << function
+        << "/numa_node";
+    std::ifstream in(path.str().c_str());
+    int node = -1;
+    in >> node;
+    if (!in || node > numa_max_node())
+        return -1;
+    return node;
+}
+
+#else /* !HAVE_NUMA_AVAILABLE */
+
+bool numaSupported()
+{
+    return false;
+}
+
+int numaNodeCount()
+{
+    return 1;
+}
+
+void numaBindThread(int node)
+{
+    (void) node;
+}
+
+void numaBindMemory(void *ptr, std::size_t size, int node)
+{
+    (void) ptr;
+    (void) size;
+    (void) node;
+}
+
+int numaNodeOfPci(unsigned int domain, unsigned int bus, unsigned int dev, unsigned int function)
+{
+    (void) domain;
+    (void) bus;
+    (void) dev;
+    (void) function;
+    return -1;
+}
+
+#endif
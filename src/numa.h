@@ -0,0 +1,83 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * OS-specific utilities to place threads and memory on NUMA nodes.
+ *
+ * All the functions in this file are best-effort hints: on builds or
+ * machines without NUMA support they silently do nothing, and failures
+ * to apply a placement are ignored rather than reported. Callers must
+ * therefore not rely on placement for correctness.
+ */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+
+/**
+ * Indicates whether this build and machine support NUMA placement. If not,
+ * the other functions in this file are still legal to call but are no-ops.
+ */
+bool numaSupported();
+
+/**
+ * Number of NUMA nodes on the machine. Returns 1 when NUMA placement is
+ * not supported.
+ */
+int numaNodeCount();
+
+/**
+ * Restrict the calling thread to run on CPUs of the given node. A negative
+ * @a node (or an unsupported build) leaves the thread placement alone.
+ */
+void numaBindThread(int node);
+
+/**
+ * Bind the memory policy for an address range so that its pages are
+ * allocated on the given node. Only whole pages within the range are
+ * affected. A negative @a node (or an unsupported build) leaves the
+ * policy alone.
+ *
+ * @param ptr        Start of the range (need not be page-aligned).
+ * @param size       Length of the range in bytes.
+ * @param node       Target node, or negative for no binding.
+ */
+void numaBindMemory(void *ptr, std::size_t size, int node);
+
+/**
+ * NUMA node closest to a PCIe function, as reported by the OS. This allows
+ * threads and buffers that feed a device to be placed on the socket holding
+ * the device's PCIe root, rather than obliviously.
+ *
+ * @param domain     PCI domain number.
+ * @param bus        PCI bus number within the domain.
+ * @param dev        PCI device number on the bus.
+ * @param function   PCI function number of the device.
+ * @return The node number, or negative if it could not be determined.
+ */
+int numaNodeOfPci(unsigned int domain, unsigned int bus, unsigned int dev, unsigned int function);
+
+#endif /* !NUMA_H */
@@ -0,0 +1,194 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Sampling-based planning mode that rehearses a run on a subset of buckets.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <ostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include "planner.h"
+#include "splat.h"
+#include "statistics.h"
+#include "errors.h"
+
+namespace Planner
+{
+
+Sampler::Sampler(const BucketCollector::Functor &out, double fraction)
+    : out(out), fraction(fraction), accum(0.0),
+    totalSplats(0), keptSplats(0), totalBins(0), keptBins(0),
+    kept("mem.Planner::Sampler::kept")
+{
+    MLSGPU_ASSERT(fraction > 0.0, std::invalid_argument);
+}
+
+void Sampler::operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins)
+{
+    kept.clear();
+    for (std::size_t i = 0; i < bins.size(); i++)
+    {
+        const SplatSet::splat_id binSplats = bins[i].ranges.numSplats();
+        totalBins++;
+        totalSplats += binSplats;
+        accum += fraction;
+        if (accum >= 1.0)
+        {
+            accum -= 1.0;
+            keptBins++;
+            keptSplats += binSplats;
+            kept.push_back(bins[i]);
+        }
+    }
+    if (!kept.empty())
+        out(kept);
+}
+
+double statTotal(const std::string &name)
+{
+    const Statistics::Variable &stat = Statistics::getStatistic<Statistics::Variable>(name);
+    if (stat.getNumSamples() == 0)
+        return 0.0;
+    return stat.getMean() * stat.getNumSamples();
+}
+
+/// Render a time in seconds in a human-friendly unit
+static std::string prettyTime(double seconds)
+{
+    std::ostringstream o;
+    o << std::fixed << std::setprecision(1);
+    if (seconds >= 3600.0)
+        o << seconds / 3600.0 << "h";
+    else if (seconds >= 60.0)
+        o << seconds / 60.0 << "m";
+    else
+        o << seconds << "s";
+    return o.str();
+}
+
+void report(std::ostream &o, const Sampler &sampler, double elapsed,
+            const std::vector<Stage> &stages, std::size_t maxLoadSplats)
+{
+    o << "\nPlanning report\n";
+    o << "===============\n";
+    if (sampler.getKeptSplats() == 0 || elapsed <= 0.0)
+    {
+        o << "The sample was empty: no buckets were forwarded to the pipeline.\n";
+        o << "Increase --plan-fraction and re-run.\n";
+        return;
+    }
+
+    const double scale = double(sampler.getTotalSplats()) / sampler.getKeptSplats();
+    const double rate = sampler.getKeptSplats() / elapsed;
+    const double predicted = elapsed * scale;
+
+    o << "Sampled " << sampler.getKeptBins() << " of " << sampler.getTotalBins()
+        << " buckets (" << sampler.getKeptSplats() << " of " << sampler.getTotalSplats()
+        << " splats) in " << prettyTime(elapsed) << ".\n";
+    o << "Throughput: " << std::size_t(rate) << " splats/s.\n";
+    o << "Predicted bucket/device pass: " << prettyTime(predicted) << ".\n";
+    const double bboxTime = statTotal("bbox.time");
+    if (bboxTime > 0.0)
+        o << "Measured bounding box pass:   " << prettyTime(bboxTime) << ".\n";
+    o << "Writing the output is not rehearsed and is excluded from the prediction.\n";
+
+    /* Per-stage utilization. The stage with the largest scaled busy time per
+     * worker bounds the throughput of the full run; the wall-scaled
+     * prediction above additionally includes time where every stage was
+     * idle (pipeline fill/drain and bucket-walk stalls).
+     */
+    std::size_t bottleneck = 0;
+    double bottleneckTime = 0.0;
+    o << "\nStage utilization over the sampled pass:\n";
+    for (std::size_t i = 0; i < stages.size(); i++)
+    {
+        const double busyWorkers = stages[i].busyTime / elapsed;
+        const double stageTime = stages[i].busyTime * scale / stages[i].workers;
+        o << "  " << std::left << std::setw(10) << stages[i].name << std::right
+            << std::fixed << std::setprecision(2)
+            << busyWorkers << " of " << stages[i].workers << " workers busy"
+            << "; limits the full pass to " << prettyTime(stageTime) << "\n";
+        if (stageTime > bottleneckTime)
+        {
+            bottleneckTime = stageTime;
+            bottleneck = i;
+        }
+    }
+    if (bottleneckTime > 0.0)
+        o << "Bottleneck stage: " << stages[bottleneck].name << ".\n";
+
+    o << "\nSuggestions:\n";
+    bool suggested = false;
+
+    /* A stage whose workers were mostly idle has more queue slots (and the
+     * device buffers that back them) than the pipeline can use; one spare
+     * worker is kept to absorb bursts.
+     */
+    for (std::size_t i = 0; i < stages.size(); i++)
+        if (stages[i].option != NULL && stages[i].workers > 1)
+        {
+            const std::size_t needed = std::size_t(std::ceil(stages[i].busyTime / elapsed)) + 1;
+            if (needed < stages[i].workers)
+            {
+                const std::size_t value = (needed + stages[i].optionUnit - 1) / stages[i].optionUnit;
+                o << "  --" << stages[i].option << "=" << value
+                    << " (stage " << stages[i].name << " kept "
+                    << std::fixed << std::setprecision(2) << stages[i].busyTime / elapsed
+                    << " of " << stages[i].workers << " workers busy)\n";
+                suggested = true;
+            }
+        }
+
+    /* Size batches to cover a few seconds of pipeline throughput: smaller
+     * batches pay the per-batch load overhead more often, while larger ones
+     * just delay the first work reaching the devices.
+     */
+    const double targetBatchSeconds = 5.0;
+    const std::size_t targetSplats = std::size_t(rate * targetBatchSeconds);
+    if (targetSplats > 0
+        && (targetSplats > 2 * maxLoadSplats || 2 * targetSplats < maxLoadSplats))
+    {
+        o << "  --mem-load-splats=" << targetSplats * sizeof(Splat)
+            << " (batches currently hold " << prettyTime(maxLoadSplats / rate)
+            << " of work; ~" << prettyTime(targetBatchSeconds) << " is a good target)\n";
+        suggested = true;
+    }
+
+    if (!suggested)
+        o << "  none; the configuration matches the measured throughput.\n";
+
+    if (elapsed < 5.0 || sampler.getKeptBins() < 10)
+        o << "\nWarning: the sample is small (" << sampler.getKeptBins()
+            << " buckets over " << prettyTime(elapsed)
+            << "); predictions may be unreliable. Increase --plan-fraction.\n";
+}
+
+} // namespace Planner
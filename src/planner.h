@@ -0,0 +1,161 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Sampling-based planning mode that rehearses a run on a subset of buckets.
+ */
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <boost/noncopyable.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "splat_set.h"
+#include "bucket_collector.h"
+#include "statistics.h"
+
+/**
+ * Support for rehearsal runs. A mis-sized configuration (batch sizes, queue
+ * capacities, thread counts) is normally only discovered hours into a run.
+ * In planning mode the bucket walk runs in full, but only a deterministic
+ * fraction of the buckets is forwarded through the real device and mesher
+ * pipeline (see @ref Sampler); the per-stage throughputs measured on this
+ * sample are then scaled up to predict the full run and to suggest
+ * configuration changes (see @ref report).
+ */
+namespace Planner
+{
+
+/**
+ * Forwards a deterministic fraction of collected bins to the downstream
+ * pipeline and discards the rest. It sits between @ref BucketCollector and
+ * @ref BucketLoader, so the kept buckets travel exactly the path they would
+ * in a real run. Selection uses error diffusion (keep a bin whenever the
+ * accumulated fraction crosses one), which spreads the sample evenly over
+ * the bucket walk rather than favouring any one region of the input.
+ */
+class Sampler : public boost::noncopyable
+{
+public:
+    typedef void result_type;
+
+    /**
+     * Constructor.
+     *
+     * @param out       Downstream functor receiving the kept bins.
+     * @param fraction  Fraction of bins to keep. Values of 1 or more keep
+     *                  every bin.
+     *
+     * @pre @a fraction is positive.
+     */
+    Sampler(const BucketCollector::Functor &out, double fraction);
+
+    /// Receives batches of bins from @ref BucketCollector.
+    void operator()(const Statistics::Container::vector<BucketCollector::Bin> &bins);
+
+    SplatSet::splat_id getTotalSplats() const { return totalSplats; }
+    SplatSet::splat_id getKeptSplats() const { return keptSplats; }
+    std::size_t getTotalBins() const { return totalBins; }
+    std::size_t getKeptBins() const { return keptBins; }
+
+private:
+    BucketCollector::Functor out;   ///< Downstream pipeline
+    double fraction;                ///< Fraction of bins to keep
+    double accum;                   ///< Error-diffusion accumulator
+
+    SplatSet::splat_id totalSplats; ///< Splats in all bins seen
+    SplatSet::splat_id keptSplats;  ///< Splats in the bins forwarded
+    std::size_t totalBins;          ///< Bins seen
+    std::size_t keptBins;           ///< Bins forwarded
+
+    /// Reused buffer for the kept portion of each batch
+    Statistics::Container::vector<BucketCollector::Bin> kept;
+};
+
+/**
+ * Describes one pipeline stage to @ref report: the busy time its workers
+ * accumulated during the sampled pass and the number of workers that can
+ * run it concurrently.
+ */
+struct Stage
+{
+    std::string name;       ///< Human-readable stage name
+    double busyTime;        ///< Total worker-busy seconds during the sample
+    std::size_t workers;    ///< Concurrent workers available to the stage
+
+    /**
+     * Command-line option controlling @ref workers, or @c NULL if the
+     * stage's concurrency is fixed. When the sample shows that fewer
+     * workers would suffice, the report suggests a value for this option.
+     */
+    const char *option;
+
+    /**
+     * Number of workers contributed per unit of @ref option (e.g. the
+     * number of devices for a per-device thread count). Ignored when
+     * @ref option is @c NULL.
+     */
+    std::size_t optionUnit;
+
+    Stage(const std::string &name, double busyTime, std::size_t workers,
+          const char *option = NULL, std::size_t optionUnit = 1)
+        : name(name), busyTime(busyTime), workers(workers),
+        option(option), optionUnit(optionUnit) {}
+};
+
+/**
+ * Total time accumulated by a @ref Statistics::Variable, in seconds. Unknown
+ * names report zero rather than failing, so callers can name statistics for
+ * stages that did not run.
+ */
+double statTotal(const std::string &name);
+
+/**
+ * Write the rehearsal report: the measured sample, the predicted time for
+ * the full bucket/device pass, the per-stage utilization, and suggested
+ * option values. The caller supplies per-stage busy times as deltas over
+ * the sampled pass only (statistics accumulate for the life of the process,
+ * so in daemon mode earlier jobs must be subtracted out).
+ *
+ * The prediction covers the bucket/device pass: the bounding box pass has
+ * already run in full by the time the sample is taken and is reported as
+ * measured, while writing the output is not rehearsed at all.
+ *
+ * @param o             Stream for the report.
+ * @param sampler       The sampler used for the pass, for the sample counts.
+ * @param elapsed       Wall time of the sampled pass, in seconds.
+ * @param stages        Pipeline stages in order.
+ * @param maxLoadSplats Current batch size, in splats, for the batch size
+ *                      suggestion.
+ */
+void report(std::ostream &o, const Sampler &sampler, double elapsed,
+            const std::vector<Stage> &stages, std::size_t maxLoadSplats);
+
+} // namespace Planner
+
+#endif /* !PLANNER_H */
@@ -32,6 +32,7 @@
 #endif
 #include <memory>
 #include <cstdlib>
+#include <algorithm>
 #include <boost/noncopyable.hpp>
 #include <string>
 #include "errors.h"
@@ -101,6 +102,14 @@ public:
         }
     }
 
+    /// Exchange buffers (and allocators) in constant time
+    void swap(PODBuffer &other)
+    {
+        std::swap(allocator_, other.allocator_);
+        std::swap(data_, other.data_);
+        std::swap(capacity_, other.capacity_);
+    }
+
     explicit PODBuffer(Allocator allocator = Allocator())
         : allocator_(allocator), data_(NULL), capacity_(0) {}
 
@@ -95,3 +95,60 @@ ProgressDisplay::size_type ProgressDisplay::expected_count() const
 {
     return total;
 }
+
+BatchedProgress::ThreadState::ThreadState()
+    : unsent(0), lastFlush(Timer::currentTime())
+{
+}
+
+void BatchedProgress::noCleanup(ThreadState *)
+{
+}
+
+BatchedProgress::BatchedProgress(ProgressMeter *parent, double interval, size_type threshold)
+    : parent(parent), interval(interval), threshold(threshold), tls(noCleanup)
+{
+}
+
+BatchedProgress::~BatchedProgress()
+{
+    flush();
+    for (std::size_t i = 0; i < states.size(); i++)
+        delete states[i];
+}
+
+void BatchedProgress::operator+=(size_type increment)
+{
+    ThreadState *state = tls.get();
+    if (state == NULL)
+    {
+        state = new ThreadState();
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            states.push_back(state);
+        }
+        tls.reset(state);
+    }
+
+    state->unsent += increment;
+    const Timer::timestamp now = Timer::currentTime();
+    if (state->unsent >= threshold || Timer::getElapsed(state->lastFlush, now) >= interval)
+    {
+        const size_type amount = state->unsent;
+        state->unsent = 0;
+        state->lastFlush = now;
+        *parent += amount;
+    }
+}
+
+void BatchedProgress::flush()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    for (std::size_t i = 0; i < states.size(); i++)
+        if (states[i]->unsent > 0)
+        {
+            const size_type amount = states[i]->unsent;
+            states[i]->unsent = 0;
+            *parent += amount;
+        }
+}
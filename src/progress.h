@@ -34,9 +34,12 @@
 #include <ostream>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 #include "tr1_cstdint.h"
 #include <boost/noncopyable.hpp>
+#include "timer.h"
 
 /**
  * An abstraction of a progress meter. It supports large integral progress values.
@@ -106,4 +109,68 @@ private:
     void updateNextTic();
 };
 
+/**
+ * Decorator that batches updates to another progress meter. Each thread
+ * accumulates increments in a thread-local counter, which is forwarded to
+ * the parent only when it reaches a size threshold or when a time interval
+ * has elapsed since the thread last forwarded. The common case is thus an
+ * unsynchronized add and a clock read, so very fine-grained updates from
+ * hot loops do not contend on the parent's mutex (or, for @ref
+ * ProgressMPI, generate message traffic).
+ *
+ * The meter may be updated from any number of threads. The batched amounts
+ * are only approximately ordered, so the parent's count lags the true
+ * count by at most the threshold times the number of threads. Call @ref
+ * flush once the producing threads have been quiesced to push the
+ * remainder; the destructor also does so.
+ */
+class BatchedProgress : public ProgressMeter, public boost::noncopyable
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param parent     Progress meter that receives the batched updates.
+     * @param interval   Maximum time (in seconds) a thread will hold back updates.
+     * @param threshold  Maximum amount a thread will hold back.
+     */
+    explicit BatchedProgress(ProgressMeter *parent,
+                             double interval = 0.1,
+                             size_type threshold = 1024 * 1024);
+
+    /// Destructor. Implicitly calls @ref flush.
+    virtual ~BatchedProgress();
+
+    virtual void operator+=(size_type increment);
+
+    /**
+     * Forward all unsent updates to the parent. This is not safe to call
+     * concurrently with updates from other threads.
+     */
+    void flush();
+
+private:
+    /// Per-thread unsent count and the time it was last forwarded
+    struct ThreadState
+    {
+        size_type unsent;           ///< Amount not yet forwarded to the parent
+        Timer::timestamp lastFlush; ///< Time at which the thread last forwarded
+
+        ThreadState();
+    };
+
+    /// Cleanup function for @ref tls: ownership is held by @ref states
+    static void noCleanup(ThreadState *);
+
+    ProgressMeter * const parent;  ///< Meter receiving the batched updates
+    const double interval;         ///< Maximum holdback time in seconds
+    const size_type threshold;     ///< Maximum holdback amount
+
+    boost::mutex mutex;            ///< Protects @ref states
+    std::vector<ThreadState *> states;  ///< All thread states, for @ref flush
+
+    /// Fast-path accessor for the calling thread's state
+    boost::thread_specific_ptr<ThreadState> tls;
+};
+
 #endif /* !PROGRESS_H */
@@ -35,9 +35,33 @@
 #include "progress.h"
 #include "progress_mpi.h"
 
+namespace
+{
+    /// Message value used by @ref ProgressMPI::close (increments are non-negative)
+    const long long closeSentinel = -1;
+}
+
+const unsigned int ProgressMPI::BRANCH;
+
 ProgressMPI::ProgressMPI(ProgressMeter *parent, size_type total, MPI_Comm comm, int root)
     : parent(parent), comm(comm), root(root), total(total), thresh(total / 1000), unsent(0)
 {
+    int size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    /* The tree is laid out over ranks relative to the root, with each node
+     * having up to BRANCH children.
+     */
+    const unsigned int rel = (rank - root + size) % size;
+    if (rel == 0)
+        parentRank = -1;
+    else
+        parentRank = int(((rel - 1) / BRANCH + root) % size);
+    numChildren = 0;
+    for (unsigned int i = 1; i <= BRANCH; i++)
+        if (rel * BRANCH + i < (unsigned int) size)
+            numChildren++;
 }
 
 void ProgressMPI::operator+=(size_type inc)
@@ -45,15 +69,15 @@ void ProgressMPI::operator+=(size_type inc)
     boost::lock_guard<boost::mutex> lock(mutex);
     unsent += inc;
     if (unsent > thresh)
-        syncUnlocked();
+        syncUnlocked(rank);
 }
 
-void ProgressMPI::syncUnlocked()
+void ProgressMPI::syncUnlocked(int dest)
 {
     if (unsent != 0)
     {
         long long buf = unsent;
-        MPI_Bsend(&buf, 1, MPI_LONG_LONG, root, MLSGPU_TAG_PROGRESS, comm);
+        MPI_Bsend(&buf, 1, MPI_LONG_LONG, dest, MLSGPU_TAG_PROGRESS, comm);
         unsent = 0;
     }
 }
@@ -61,14 +85,21 @@ void ProgressMPI::syncUnlocked()
 void ProgressMPI::sync()
 {
     boost::lock_guard<boost::mutex> lock(mutex);
-    syncUnlocked();
+    syncUnlocked(rank);
+}
+
+void ProgressMPI::close()
+{
+    long long buf = closeSentinel;
+    MPI_Bsend(&buf, 1, MPI_LONG_LONG, rank, MLSGPU_TAG_PROGRESS, comm);
 }
 
-void ProgressMPI::operator()() const
+void ProgressMPI::operator()(unsigned int localProducers)
 {
-    size_type current = 0;
+    const unsigned int expected = numChildren + localProducers;
+    unsigned int closed = 0;
     const boost::posix_time::time_duration sleepTime = boost::posix_time::milliseconds(500);
-    while (current < total)
+    while (closed < expected)
     {
         long long update;
         MPI_Request request;
@@ -80,7 +111,33 @@ void ProgressMPI::operator()() const
             boost::this_thread::sleep(sleepTime);
             MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
         }
-        current += update;
-        *parent += update;
+        if (update == closeSentinel)
+            closed++;
+        else if (parentRank < 0)
+            *parent += update;
+        else
+        {
+            /* Aggregate into the shared batch so that child updates and
+             * local producer updates are combined before moving up a level.
+             */
+            boost::lock_guard<boost::mutex> lock(mutex);
+            unsent += update;
+            if (unsent > thresh)
+                syncUnlocked(parentRank);
+        }
+    }
+    if (parentRank >= 0)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            syncUnlocked(parentRank);
+        }
+        /* All local producers and children have closed, and their updates
+         * have been flushed, so the parent can now be released. The flush
+         * above precedes this send, so the parent cannot terminate before
+         * the last updates arrive.
+         */
+        long long buf = closeSentinel;
+        MPI_Bsend(&buf, 1, MPI_LONG_LONG, parentRank, MLSGPU_TAG_PROGRESS, comm);
     }
 }
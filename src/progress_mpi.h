@@ -42,11 +42,25 @@
  * root. To save bandwidth, updates are sent only when @ref sync is called or
  * when the unsent updates amount to at least 0.1%.
  *
- * To reduce CPU load on the root when using a busy-wait implementation of MPI
- * (e.g. OpenMPI), the communicator is polled on an interval.
+ * To keep the root from becoming a message hotspot at high rank counts, the
+ * updates are not sent straight to the root. The ranks are arranged in a
+ * tree, and every rank runs a relay (@c operator()) which aggregates updates
+ * from its own producers and from its children before batching them to its
+ * parent, so traffic into any one rank scales with the tree fan-out rather
+ * than the number of ranks.
+ *
+ * An instance can play two roles (possibly both at once):
+ *  - A @em producer is updated with @c += and @c ++; the batched updates are
+ *    sent to the relay on the producer's own rank. After the final @ref sync,
+ *    @ref close tells the local relay that this producer is finished.
+ *  - A @em relay runs @c operator(), typically in a separate thread. Each
+ *    rank must run exactly one relay. It terminates once it has received a
+ *    close notification from every local producer and every child relay, at
+ *    which point it flushes and notifies its own parent (or returns, on the
+ *    root).
  *
- * The root process must also call @c operator() to receive the updates. This
- * will typically be done in a separate thread.
+ * To reduce CPU load when using a busy-wait implementation of MPI
+ * (e.g. OpenMPI), the communicator is polled on an interval.
  *
  * The constructor and destructor are local operations. In fact, there is no
  * requirement for a 1-to-1 mapping of instances to processes.
@@ -54,6 +68,9 @@
 class ProgressMPI : public ProgressMeter, public boost::noncopyable
 {
 public:
+    /// Fan-out of the reduction tree
+    static const unsigned int BRANCH = 8;
+
     /**
      * Constructor. It is legal for @a total to be different to the capacity of
      * the parent meter. The @a total is the total amount that this meter will
@@ -74,27 +91,41 @@ public:
     virtual void operator+=(size_type inc);
 
     /**
-     * Send all unsent updates to the root.
+     * Send all unsent updates to the local relay.
      */
     void sync();
 
     /**
-     * Run the receive code. This will return when the capacity has been reached.
+     * Notify the local relay that this producer will make no further updates.
+     * It must be called exactly once, after the final @ref sync.
      */
-    void operator()() const;
+    void close();
+
+    /**
+     * Run the relay. This will return once close notifications have been
+     * received from @a localProducers local producers and from every child
+     * rank in the tree.
+     *
+     * @param localProducers Number of producer instances on this rank.
+     */
+    void operator()(unsigned int localProducers);
 
 private:
     /// Like @ref sync but the caller locks
-    void syncUnlocked();
+    void syncUnlocked(int dest);
 
     ProgressMeter * const parent; ///< Parent progress meter (well-defined only on root)
     MPI_Comm comm;
     const int root;
 
+    int rank;                     ///< Own rank in @ref comm
+    int parentRank;               ///< Next hop towards the root (-1 on the root itself)
+    unsigned int numChildren;     ///< Number of child ranks in the tree
+
     const size_type total;        ///< Expected total progress
     const size_type thresh;       ///< Minimum progress before sending updates
 
-    size_type unsent;             ///< Unsent increment amount (on slaves)
+    size_type unsent;             ///< Unsent increment amount
     boost::mutex mutex;           ///< Mutex protecting @ref unsent
 };
 
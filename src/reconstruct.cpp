@@ -0,0 +1,135 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of the embeddable reconstruction driver.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <boost/program_options.hpp>
+#include <boost/ref.hpp>
+#include <boost/bind.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <vector>
+#include <utility>
+#include <ostream>
+#include "splat.h"
+#include "splat_set.h"
+#include "grid.h"
+#include "options.h"
+#include "mesher.h"
+#include "workers.h"
+#include "bucket_collector.h"
+#include "bucket_loader.h"
+#include "progress.h"
+#include "statistics.h"
+#include "timeplot.h"
+#include "cancel.h"
+#include "mlsgpu_core.h"
+#include "reconstruct.h"
+
+namespace po = boost::program_options;
+
+std::size_t Reconstruct::run(
+    Timeplot::Worker &tworker,
+    const po::variables_map &vm,
+    const std::vector<std::pair<cl::Context, cl::Device> > &devices,
+    const Splat *firstSplat, const Splat *lastSplat,
+    MesherBase &mesher,
+    std::ostream *progressStream)
+{
+    typedef SplatSet::FastBlobSet<SplatSet::SequenceSet<const Splat *> > Splats;
+
+    const std::size_t maxLoadSplats = getMaxLoadSplats(vm);
+    const std::size_t memMesh = vm[Option::memMesh].as<Capacity>();
+
+    setMesherOptions(vm, mesher);
+
+    MesherGroup mesherGroup(memMesh);
+    SlaveWorkers slaveWorkers(tworker, vm, devices, makeOutputGenerator(mesherGroup));
+    BucketCollector collector(maxLoadSplats, boost::ref(*slaveWorkers.loader));
+    collector.setBudget(boost::bind(&SlaveWorkers::collectorBudget,
+                                    &slaveWorkers, maxLoadSplats));
+
+    Splats splats;
+    splats.reset(firstSplat, lastSplat);
+    doComputeBlobs(tworker, vm,
+                   boost::bind(&Splats::computeBlobs, &splats, _1, _2, progressStream, true));
+    Grid grid = splats.getBoundingGrid();
+    if (vm.count(Option::tileBox))
+        clampGridToTileBox(vm, grid);
+    const unsigned int chunkCells = postprocessGrid(vm, grid, splats.numSplats());
+    mesher.setChunkGrid(grid, chunkCells);
+
+    {
+        Statistics::Timer timer("pass1.time");
+
+        boost::scoped_ptr<ProgressDisplay> progress;
+        if (progressStream != NULL)
+            progress.reset(new ProgressDisplay(splats.numSplats(), *progressStream));
+        collector.setProgress(progress.get());
+
+        mesherGroup.setInputFunctor(mesher.functor());
+
+        slaveWorkers.start(splats, grid, progress.get());
+        mesherGroup.start();
+
+        try
+        {
+            doBucket(tworker, vm, splats, grid, chunkCells, collector);
+        }
+        catch (...)
+        {
+            /* See the matching block in the stand-alone tool: cancelling
+             * first turns the stops below from a full drain of the pipeline
+             * into a quick join, and resetting afterwards lets the host
+             * process run its next job.
+             */
+            Cancel::request();
+            try
+            {
+                collector.flush();
+            }
+            catch (cancelled &)
+            {
+                // the flush fed a cancelled queue; nothing worth keeping
+            }
+            slaveWorkers.stop();
+            mesherGroup.stop();
+            Cancel::reset();
+            throw;
+        }
+
+        collector.flush();
+        slaveWorkers.stop();
+        mesherGroup.stop();
+    }
+
+    return mesher.write(tworker, progressStream);
+}
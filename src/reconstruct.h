@@ -0,0 +1,101 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * In-process driver for embedding reconstruction in another application.
+ */
+
+#ifndef RECONSTRUCT_H
+#define RECONSTRUCT_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <boost/program_options.hpp>
+#include <vector>
+#include <utility>
+#include <ostream>
+#include <cstddef>
+#include <CL/cl.hpp>
+#include "splat.h"
+#include "mesher.h"
+#include "timeplot.h"
+
+/**
+ * Driver for applications that embed reconstruction rather than invoking the
+ * stand-alone tool. The splats are taken from memory and the output is
+ * delivered to a caller-supplied @ref MesherBase, so neither side of the job
+ * pays a PLY serialization round trip.
+ */
+namespace Reconstruct
+{
+
+/**
+ * Run one reconstruction over splats that are already in memory.
+ *
+ * The options are interpreted exactly as for the stand-alone tool; build
+ * them with @ref processOptions over mlsgpu-style arguments and check them
+ * with @ref validateOptions. Input and output file options are ignored,
+ * since the splats come from @a firstSplat and the meshes go to @a mesher.
+ *
+ * The splats are wrapped in a @ref SplatSet::SequenceSet, so they must be
+ * contiguous in memory and must not be modified until this function
+ * returns; non-finite splats are skipped. Options that only make sense for
+ * file-backed sets (the splat and blob caches, readahead) have no effect.
+ *
+ * The mesher is used exactly as by the stand-alone tool: its functor
+ * receives the device output, then @ref MesherBase::write is called to
+ * finalize. A subclass that keeps the mesh in memory therefore never
+ * touches the output path at all; mesher options from @a vm (pruning,
+ * manifold checking and so on) are applied to it before the run.
+ *
+ * The pipeline is shut down and the cancellation token reset before an
+ * exception propagates, so a resident process can run further jobs after a
+ * failure.
+ *
+ * @param tworker         Timeplot worker for the calling thread
+ * @param vm              Options from @ref processOptions
+ * @param devices         OpenCL devices to use (see @ref CLH::findDevices)
+ * @param firstSplat,lastSplat  The input splats
+ * @param mesher          Sink for the output meshes
+ * @param progressStream  If non-NULL, identifies where to write progress meters
+ * @return The result of @ref MesherBase::write on @a mesher.
+ *
+ * @throw std::runtime_error if there are no finite splats or the bounding
+ * box is too large, or on any of the failures the stand-alone tool reports.
+ */
+std::size_t run(
+    Timeplot::Worker &tworker,
+    const boost::program_options::variables_map &vm,
+    const std::vector<std::pair<cl::Context, cl::Device> > &devices,
+    const Splat *firstSplat, const Splat *lastSplat,
+    MesherBase &mesher,
+    std::ostream *progressStream = NULL);
+
+} // namespace Reconstruct
+
+#endif /* !RECONSTRUCT_H */
@@ -33,12 +33,22 @@
 #endif
 #include <mpi.h>
 #include <cassert>
+#include <cstring>
+#include <ios>
+#include <boost/smart_ptr/scoped_array.hpp>
+#if HAVE_COMPRESS2
+# include <zlib.h>
+#endif
+#include "tr1_cstdint.h"
 #include "grid.h"
 #include "bucket.h"
 #include "tags.h"
 #include "serialize.h"
 #include "mesher.h"
 #include "mesh.h"
+#include "logging.h"
+#include "statistics.h"
+#include "errors.h"
 
 namespace
 {
@@ -49,6 +59,7 @@ struct RawGrid
     float reference[3];
     float spacing;
     Grid::difference_type extents[6]; // x-lo, x-hi, y-lo, y-hi, z-lo, z-hi
+    double worldOffset[3];
 };
 
 static MPI_Datatype gridType; ///< MPI datatype representing @ref RawGrid
@@ -56,18 +67,19 @@ static MPI_Datatype gridType; ///< MPI datatype representing @ref RawGrid
 /// Create @ref gridType
 static void registerGridType()
 {
-    int lengths[5] = {1, 3, 1, 6, 1};
-    MPI_Aint displacements[5] =
+    int lengths[6] = {1, 3, 1, 6, 3, 1};
+    MPI_Aint displacements[6] =
     {
         0,
         offsetof(RawGrid, reference),
         offsetof(RawGrid, spacing),
         offsetof(RawGrid, extents),
+        offsetof(RawGrid, worldOffset),
         sizeof(RawGrid)
     };
-    MPI_Datatype types[5] = { MPI_LB, MPI_FLOAT, MPI_FLOAT, Serialize::mpi_type_traits<Grid::difference_type>::type(), MPI_UB };
+    MPI_Datatype types[6] = { MPI_LB, MPI_FLOAT, MPI_FLOAT, Serialize::mpi_type_traits<Grid::difference_type>::type(), MPI_DOUBLE, MPI_UB };
 
-    MPI_Type_create_struct(5, lengths, displacements, types, &gridType);
+    MPI_Type_create_struct(6, lengths, displacements, types, &gridType);
     MPI_Type_set_name(gridType, const_cast<char *>("RawGrid"));
     MPI_Type_commit(&gridType);
 }
@@ -141,6 +153,73 @@ static void registerChunkIdType()
     MPI_Type_commit(&chunkIdType);
 }
 
+/**
+ * Scalar fields of a @ref MesherWork, so that they can travel in a single
+ * message ahead of the bulk mesh data.
+ */
+struct MesherWorkHeader
+{
+    ChunkIdPod chunkId;
+    std::size_t sizes[3];  // vertices, triangles, internal vertices
+};
+
+static MPI_Datatype mesherWorkHeaderType; ///< MPI datatype representing @ref MesherWorkHeader
+
+/// Create @ref mesherWorkHeaderType. @ref chunkIdType must already exist.
+static void registerMesherWorkHeaderType()
+{
+    int lengths[4] = {1, 1, 3, 1};
+    MPI_Aint displacements[4] =
+    {
+        0,
+        offsetof(MesherWorkHeader, chunkId),
+        offsetof(MesherWorkHeader, sizes),
+        sizeof(MesherWorkHeader)
+    };
+    MPI_Datatype types[4] =
+    {
+        MPI_LB,
+        chunkIdType,
+        Serialize::mpi_type_traits<std::size_t>::type(),
+        MPI_UB
+    };
+
+    MPI_Type_create_struct(4, lengths, displacements, types, &mesherWorkHeaderType);
+    MPI_Type_set_name(mesherWorkHeaderType, const_cast<char *>("MesherWorkHeader"));
+    MPI_Type_commit(&mesherWorkHeaderType);
+}
+
+/**
+ * Create a derived datatype addressing the three mesh arrays of @a mesh in
+ * place (with absolute displacements, for use with @c MPI_BOTTOM). This
+ * allows the whole payload to travel as a single message directly from/to
+ * the mesh's backing memory, without a staging copy. The caller must free
+ * the type after use.
+ */
+static MPI_Datatype makeMeshPayloadType(const HostKeyMesh &mesh)
+{
+    int lengths[3];
+    MPI_Aint displacements[3];
+    MPI_Datatype types[3] =
+    {
+        Serialize::mpi_type_traits<cl_ulong>::type(),
+        Serialize::mpi_type_traits<cl_float>::type(),
+        Serialize::mpi_type_traits<cl_uint>::type()
+    };
+
+    lengths[0] = mesh.numExternalVertices();
+    lengths[1] = 3 * mesh.numVertices();
+    lengths[2] = 3 * mesh.numTriangles();
+    MPI_Get_address(mesh.vertexKeys, &displacements[0]);
+    MPI_Get_address(mesh.vertices, &displacements[1]);
+    MPI_Get_address(mesh.triangles, &displacements[2]);
+
+    MPI_Datatype ans;
+    MPI_Type_create_struct(3, lengths, displacements, types, &ans);
+    MPI_Type_commit(&ans);
+    return ans;
+}
+
 static MPI_Datatype splatType; ///< MPI datatype representing @ref Splat
 
 static void registerSplatType()
@@ -179,9 +258,19 @@ class Access
 public:
     static void send(const SplatSet::SubsetBase &subset, MPI_Comm comm, int dest);
     static void recv(SplatSet::SubsetBase &subset, MPI_Comm comm, int source);
+
+    /// Number of bytes @ref pack will need for @a subset
+    static int packSize(const SplatSet::SubsetBase &subset, MPI_Comm comm);
+    /// Append @a subset to a buffer being assembled with @c MPI_Pack
+    static void pack(const SplatSet::SubsetBase &subset,
+                     void *buffer, int bufSize, int *position, MPI_Comm comm);
+    /// Counterpart to @ref pack
+    static void unpack(SplatSet::SubsetBase &subset,
+                       const void *buffer, int bufSize, int *position, MPI_Comm comm);
 };
 
-void send(const Grid &grid, MPI_Comm comm, int dest)
+/// Convert a @ref Grid to its wire representation
+static RawGrid makeRawGrid(const Grid &grid)
 {
     RawGrid raw;
     raw.spacing = grid.getSpacing();
@@ -190,8 +279,25 @@ void send(const Grid &grid, MPI_Comm comm, int dest)
         raw.reference[i] = grid.getReference()[i];
         raw.extents[2 * i] = grid.getExtent(i).first;
         raw.extents[2 * i + 1] = grid.getExtent(i).second;
+        raw.worldOffset[i] = grid.getWorldOffset()[i];
     }
+    return raw;
+}
 
+/// Counterpart to @ref makeRawGrid
+static Grid makeGrid(const RawGrid &raw)
+{
+    Grid grid(raw.reference, raw.spacing,
+              raw.extents[0], raw.extents[1],
+              raw.extents[2], raw.extents[3],
+              raw.extents[4], raw.extents[5]);
+    grid.setWorldOffset(raw.worldOffset);
+    return grid;
+}
+
+void send(const Grid &grid, MPI_Comm comm, int dest)
+{
+    RawGrid raw = makeRawGrid(grid);
     MPI_Send(&raw, 1, gridType, dest, MLSGPU_TAG_WORK, comm);
 }
 
@@ -199,11 +305,7 @@ void recv(Grid &grid, MPI_Comm comm, int source)
 {
     RawGrid raw;
     MPI_Recv(&raw, 1, gridType, source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
-
-    grid = Grid(raw.reference, raw.spacing,
-                raw.extents[0], raw.extents[1],
-                raw.extents[2], raw.extents[3],
-                raw.extents[4], raw.extents[5]);
+    grid = makeGrid(raw);
 }
 
 void send(const ChunkIdPod &chunkId, MPI_Comm comm, int dest)
@@ -236,8 +338,8 @@ void Access::send(const SplatSet::SubsetBase &subset, MPI_Comm comm, int dest)
     metadata.nSplats = subset.nSplats;
     metadata.nRanges = subset.nRanges;
     MPI_Send(&metadata, 1, subsetMetadataType, dest, MLSGPU_TAG_WORK, comm);
-    MPI_Send(const_cast<std::tr1::uint32_t *>(&subset.splatRanges[0]),
-             subset.splatRanges.size(), mpi_type_traits<std::tr1::uint32_t>::type(),
+    MPI_Send(const_cast<std::tr1::uint8_t *>(&subset.splatRanges[0]),
+             subset.splatRanges.size(), mpi_type_traits<std::tr1::uint8_t>::type(),
              dest, MLSGPU_TAG_WORK, comm);
 }
 
@@ -251,10 +353,51 @@ void Access::recv(SplatSet::SubsetBase &subset, MPI_Comm comm, int source)
     subset.prev = metadata.prev;
     subset.nSplats = metadata.nSplats;
     subset.nRanges = metadata.nRanges;
-    MPI_Recv(&subset.splatRanges[0], metadata.size, mpi_type_traits<std::tr1::uint32_t>::type(),
+    MPI_Recv(&subset.splatRanges[0], metadata.size, mpi_type_traits<std::tr1::uint8_t>::type(),
              source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
 }
 
+int Access::packSize(const SplatSet::SubsetBase &subset, MPI_Comm comm)
+{
+    int metadataSize, rangesSize;
+    MPI_Pack_size(1, subsetMetadataType, comm, &metadataSize);
+    MPI_Pack_size(subset.splatRanges.size(), mpi_type_traits<std::tr1::uint8_t>::type(),
+                  comm, &rangesSize);
+    return metadataSize + rangesSize;
+}
+
+void Access::pack(const SplatSet::SubsetBase &subset,
+                  void *buffer, int bufSize, int *position, MPI_Comm comm)
+{
+    SubsetMetadata metadata;
+    metadata.size = subset.splatRanges.size();
+    metadata.first = subset.first;
+    metadata.last = subset.last;
+    metadata.prev = subset.prev;
+    metadata.nSplats = subset.nSplats;
+    metadata.nRanges = subset.nRanges;
+    MPI_Pack(&metadata, 1, subsetMetadataType, buffer, bufSize, position, comm);
+    MPI_Pack(const_cast<std::tr1::uint8_t *>(&subset.splatRanges[0]),
+             subset.splatRanges.size(), mpi_type_traits<std::tr1::uint8_t>::type(),
+             buffer, bufSize, position, comm);
+}
+
+void Access::unpack(SplatSet::SubsetBase &subset,
+                    const void *buffer, int bufSize, int *position, MPI_Comm comm)
+{
+    SubsetMetadata metadata;
+    MPI_Unpack(const_cast<void *>(buffer), bufSize, position, &metadata, 1,
+               subsetMetadataType, comm);
+    subset.splatRanges.resize(metadata.size);
+    subset.first = metadata.first;
+    subset.last = metadata.last;
+    subset.prev = metadata.prev;
+    subset.nSplats = metadata.nSplats;
+    subset.nRanges = metadata.nRanges;
+    MPI_Unpack(const_cast<void *>(buffer), bufSize, position, &subset.splatRanges[0],
+               metadata.size, mpi_type_traits<std::tr1::uint8_t>::type(), comm);
+}
+
 void send(const BucketCollector::Bin &bin, MPI_Comm comm, int dest)
 {
     send(bin.ranges, comm, dest);
@@ -269,32 +412,231 @@ void recv(BucketCollector::Bin &bin, MPI_Comm comm, int source)
     recv(bin.grid, comm, source);
 }
 
-void send(const MesherWork &work, MPI_Comm comm, int dest)
+std::size_t packSize(const Statistics::Container::vector<BucketCollector::Bin> &bins, MPI_Comm comm)
 {
-    std::size_t sizes[3] =
+    int chunkIdSize, gridSize;
+    MPI_Pack_size(1, chunkIdType, comm, &chunkIdSize);
+    MPI_Pack_size(1, gridType, comm, &gridSize);
+
+    std::size_t bufSize = 0;
+    for (std::size_t i = 0; i < bins.size(); i++)
+        bufSize += Access::packSize(bins[i].ranges, comm) + chunkIdSize + gridSize;
+    return bufSize;
+}
+
+std::size_t pack(const Statistics::Container::vector<BucketCollector::Bin> &bins,
+                 void *buffer, std::size_t bufSize, MPI_Comm comm)
+{
+    int position = 0;
+    for (std::size_t i = 0; i < bins.size(); i++)
     {
-        work.mesh.numVertices(),
-        work.mesh.numTriangles(),
-        work.mesh.numInternalVertices()
-    };
+        Access::pack(bins[i].ranges, buffer, bufSize, &position, comm);
+        MPI_Pack(const_cast<ChunkIdPod *>(static_cast<const ChunkIdPod *>(&bins[i].chunkId)),
+                 1, chunkIdType, buffer, bufSize, &position, comm);
+        RawGrid raw = makeRawGrid(bins[i].grid);
+        MPI_Pack(&raw, 1, gridType, buffer, bufSize, &position, comm);
+    }
+    return position;
+}
 
-    send(work.chunkId, comm, dest);
-    MPI_Send(&sizes, 3, mpi_type_traits<std::size_t>::type(), dest, MLSGPU_TAG_WORK, comm);
+void unpack(Statistics::Container::vector<BucketCollector::Bin> &bins,
+            const void *buffer, std::size_t bufSize, MPI_Comm comm)
+{
+    int position = 0;
+    for (std::size_t i = 0; i < bins.size(); i++)
+    {
+        Access::unpack(bins[i].ranges, buffer, bufSize, &position, comm);
+        MPI_Unpack(const_cast<void *>(buffer), bufSize, &position,
+                   static_cast<ChunkIdPod *>(&bins[i].chunkId), 1, chunkIdType, comm);
+        RawGrid raw;
+        MPI_Unpack(const_cast<void *>(buffer), bufSize, &position, &raw, 1, gridType, comm);
+        bins[i].grid = makeGrid(raw);
+    }
+}
 
-    if (work.hasEvents)
-        work.trianglesEvent.wait();
-    MPI_Send(const_cast<cl_uint *>(&work.mesh.triangles[0][0]), 3 * work.mesh.numTriangles(),
-             mpi_type_traits<cl_uint>::type(), dest, MLSGPU_TAG_WORK, comm);
+void send(const Statistics::Container::vector<BucketCollector::Bin> &bins, MPI_Comm comm, int dest)
+{
+    const std::size_t bufSize = packSize(bins, comm);
+    boost::scoped_array<char> buffer(new char[bufSize]);
+    const std::size_t position = pack(bins, buffer.get(), bufSize, comm);
+    MPI_Send(buffer.get(), position, MPI_PACKED, dest, MLSGPU_TAG_WORK, comm);
+}
 
-    if (work.hasEvents)
-        work.vertexKeysEvent.wait();
-    MPI_Send(const_cast<cl_ulong *>(&work.mesh.vertexKeys[0]), work.mesh.numExternalVertices(),
-             mpi_type_traits<cl_ulong>::type(), dest, MLSGPU_TAG_WORK, comm);
+void recv(Statistics::Container::vector<BucketCollector::Bin> &bins, MPI_Comm comm, int source)
+{
+    MPI_Status status;
+    MPI_Probe(source, MLSGPU_TAG_WORK, comm, &status);
+    int bufSize;
+    MPI_Get_count(&status, MPI_PACKED, &bufSize);
+
+    boost::scoped_array<char> buffer(new char[bufSize]);
+    MPI_Recv(buffer.get(), bufSize, MPI_PACKED, status.MPI_SOURCE, MLSGPU_TAG_WORK,
+             comm, MPI_STATUS_IGNORE);
+
+    unpack(bins, buffer.get(), bufSize, comm);
+}
+
+/// Whether @ref setCompression enabled payload compression
+static bool compressPayloads = false;
+
+void setCompression(bool enable)
+{
+#if HAVE_COMPRESS2
+    compressPayloads = enable;
+#else
+    if (enable)
+        Log::log[Log::warn]
+            << "Warning: payload compression requires zlib support; sending raw\n";
+    compressPayloads = false;
+#endif
+}
+
+#if HAVE_COMPRESS2
+
+/**
+ * Extract the payload arrays of a mesh for compression. The order matches
+ * @ref makeMeshPayloadType.
+ */
+static void meshPayloadParts(const HostKeyMesh &mesh, const void *parts[3], std::size_t bytes[3])
+{
+    parts[0] = mesh.vertexKeys;
+    bytes[0] = mesh.numExternalVertices() * sizeof(cl_ulong);
+    parts[1] = mesh.vertices;
+    bytes[1] = 3 * mesh.numVertices() * sizeof(cl_float);
+    parts[2] = mesh.triangles;
+    bytes[2] = 3 * mesh.numTriangles() * sizeof(cl_uint);
+}
+
+/**
+ * Send the mesh payload as a single compressed message. The message holds
+ * three 64-bit compressed byte counts followed by the three zlib streams
+ * back-to-back; the uncompressed sizes travel in the preceding
+ * @ref MesherWorkHeader. An empty array is recorded as a zero count with no
+ * stream.
+ */
+static void sendCompressedPayload(const HostKeyMesh &mesh, MPI_Comm comm, int dest)
+{
+    const void *parts[3];
+    std::size_t bytes[3];
+    meshPayloadParts(mesh, parts, bytes);
+
+    const std::size_t headerBytes = 3 * sizeof(std::tr1::uint64_t);
+    std::size_t bufSize = headerBytes;
+    std::size_t rawBytes = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        bufSize += compressBound(bytes[i]);
+        rawBytes += bytes[i];
+    }
+
+    boost::scoped_array<char> buffer(new char[bufSize]);
+    std::tr1::uint64_t compBytes[3];
+    std::size_t position = headerBytes;
+    for (int i = 0; i < 3; i++)
+    {
+        compBytes[i] = 0;
+        if (bytes[i] != 0)
+        {
+            uLongf outLen = bufSize - position;
+            int status = compress2(
+                reinterpret_cast<Bytef *>(buffer.get() + position), &outLen,
+                reinterpret_cast<const Bytef *>(parts[i]), bytes[i],
+                Z_BEST_SPEED);
+            // Can only fail due to a too-small output buffer, which compressBound rules out
+            MLSGPU_ASSERT(status == Z_OK, std::length_error);
+            compBytes[i] = outLen;
+            position += outLen;
+        }
+    }
+    std::memcpy(buffer.get(), compBytes, headerBytes);
+
+    Statistics::getStatistic<Statistics::Counter>("serialize.compress.raw").add(rawBytes);
+    Statistics::getStatistic<Statistics::Counter>("serialize.compress.sent").add(position);
+    MPI_Send(buffer.get(), position, MPI_BYTE, dest, MLSGPU_TAG_WORK, comm);
+}
+
+/// Receive and decompress a payload sent by @ref sendCompressedPayload
+static void recvCompressedPayload(const HostKeyMesh &mesh, MPI_Comm comm, int source)
+{
+    const void *parts[3];
+    std::size_t bytes[3];
+    meshPayloadParts(mesh, parts, bytes);
+
+    MPI_Status status;
+    MPI_Probe(source, MLSGPU_TAG_WORK, comm, &status);
+    int bufSize;
+    MPI_Get_count(&status, MPI_BYTE, &bufSize);
+
+    boost::scoped_array<char> buffer(new char[bufSize]);
+    MPI_Recv(buffer.get(), bufSize, MPI_BYTE, status.MPI_SOURCE, MLSGPU_TAG_WORK,
+             comm, MPI_STATUS_IGNORE);
+
+    const std::size_t headerBytes = 3 * sizeof(std::tr1::uint64_t);
+    std::tr1::uint64_t compBytes[3];
+    if (std::size_t(bufSize) < headerBytes)
+        throw std::ios::failure("Truncated compressed mesh payload");
+    std::memcpy(compBytes, buffer.get(), headerBytes);
+
+    std::size_t position = headerBytes;
+    for (int i = 0; i < 3; i++)
+    {
+        if (compBytes[i] > std::size_t(bufSize) - position)
+            throw std::ios::failure("Truncated compressed mesh payload");
+        if (bytes[i] != 0)
+        {
+            uLongf outLen = bytes[i];
+            int zstatus = uncompress(
+                reinterpret_cast<Bytef *>(const_cast<void *>(parts[i])), &outLen,
+                reinterpret_cast<const Bytef *>(buffer.get() + position), compBytes[i]);
+            if (zstatus != Z_OK || outLen != bytes[i])
+                throw std::ios::failure("Corrupt compressed mesh payload");
+        }
+        position += compBytes[i];
+    }
+}
+
+#endif // HAVE_COMPRESS2
+
+void send(const MesherWork &work, MPI_Comm comm, int dest)
+{
+    MesherWorkHeader header;
+    header.chunkId = work.chunkId;
+    header.sizes[0] = work.mesh.numVertices();
+    header.sizes[1] = work.mesh.numTriangles();
+    header.sizes[2] = work.mesh.numInternalVertices();
+    MPI_Send(&header, 1, mesherWorkHeaderType, dest, MLSGPU_TAG_WORK, comm);
 
     if (work.hasEvents)
+    {
+        work.vertexKeysEvent.wait();
         work.verticesEvent.wait();
-    MPI_Send(const_cast<cl_float *>(&work.mesh.vertices[0][0]), 3 * work.mesh.numVertices(),
-             mpi_type_traits<cl_float>::type(), dest, MLSGPU_TAG_WORK, comm);
+        work.trianglesEvent.wait();
+    }
+
+    /* Keys must be global before they hit the wire: the receiver knows
+     * nothing about the sending device's compact key layout. The expansion
+     * happens in place; only the flag lives in the (shallow) copy.
+     */
+    HostKeyMesh mesh = work.mesh;
+    mesh.expandKeys();
+
+#if HAVE_COMPRESS2
+    if (compressPayloads)
+    {
+        /* Compression happens here on the sending worker thread, so it
+         * overlaps with the device work producing the next mesh.
+         */
+        sendCompressedPayload(mesh, comm, dest);
+        return;
+    }
+#endif
+
+    /* The three arrays travel as one message, addressed in place so that
+     * there is no staging copy on either side.
+     */
+    MPI_Datatype payloadType = makeMeshPayloadType(mesh);
+    MPI_Send(MPI_BOTTOM, 1, payloadType, dest, MLSGPU_TAG_WORK, comm);
+    MPI_Type_free(&payloadType);
 }
 
 void recv(MesherWork &work, void *ptr, MPI_Comm comm, int source)
@@ -305,18 +647,23 @@ void recv(MesherWork &work, void *ptr, MPI_Comm comm, int source)
     work.trianglesEvent = cl::Event();
     work.vertexKeysEvent = cl::Event();
 
-    recv(work.chunkId, comm, source);
-    std::size_t sizes[3];
-    MPI_Recv(&sizes, 3, mpi_type_traits<std::size_t>::type(),
-             source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+    MesherWorkHeader header;
+    MPI_Recv(&header, 1, mesherWorkHeaderType, source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+    static_cast<ChunkIdPod &>(work.chunkId) = header.chunkId;
+
+    work.mesh = HostKeyMesh(ptr, MeshSizes(header.sizes[0], header.sizes[1], header.sizes[2]));
+
+#if HAVE_COMPRESS2
+    if (compressPayloads)
+    {
+        recvCompressedPayload(work.mesh, comm, source);
+        return;
+    }
+#endif
 
-    work.mesh = HostKeyMesh(ptr, MeshSizes(sizes[0], sizes[1], sizes[2]));
-    MPI_Recv(&work.mesh.triangles[0][0], 3 * work.mesh.numTriangles(),
-             mpi_type_traits<cl_uint>::type(), source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
-    MPI_Recv(&work.mesh.vertexKeys[0], work.mesh.numExternalVertices(),
-             mpi_type_traits<cl_ulong>::type(), source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
-    MPI_Recv(&work.mesh.vertices[0][0], 3 * work.mesh.numVertices(),
-             mpi_type_traits<cl_float>::type(), source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+    MPI_Datatype payloadType = makeMeshPayloadType(work.mesh);
+    MPI_Recv(MPI_BOTTOM, 1, payloadType, source, MLSGPU_TAG_WORK, comm, MPI_STATUS_IGNORE);
+    MPI_Type_free(&payloadType);
 }
 
 void broadcast(std::string &str, MPI_Comm comm, int root)
@@ -343,6 +690,7 @@ void init()
     registerGridType();
     registerSubsetMetadataType();
     registerChunkIdType();
+    registerMesherWorkHeaderType();
     registerSplatType();
 }
 
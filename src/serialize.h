@@ -31,6 +31,10 @@
 # include <config.h>
 #endif
 #include <mpi.h>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <boost/noncopyable.hpp>
 #include "bucket_collector.h"
 
 /* Forward declaration */
@@ -137,6 +141,13 @@ public:
     static MPI_Datatype type() { return MPI_CHAR; }
 };
 
+template<>
+class mpi_type_traits<unsigned char>
+{
+public:
+    static MPI_Datatype type() { return MPI_UNSIGNED_CHAR; }
+};
+
 template<>
 class mpi_type_traits<wchar_t>
 {
@@ -144,6 +155,103 @@ public:
     static MPI_Datatype type() { return MPI_WCHAR; }
 };
 
+/**
+ * Persistent-request channel for repeatedly sending a fixed-shape message to
+ * one destination. The count, datatype, destination and tag are fixed when
+ * the channel is constructed (one channel per connection), so the MPI library
+ * can set the transfer up once and merely restart it per message, instead of
+ * rebuilding it from scratch on every send. Sends are blocking standard-mode,
+ * like the plain @c send functions.
+ *
+ * This only pays off for the small fixed envelopes that are exchanged for
+ * every work item; variable-size payloads still go through the ordinary
+ * @c send functions.
+ */
+template<typename T>
+class PersistentSend : public boost::noncopyable
+{
+private:
+    std::vector<T> buffer;    ///< Registered message buffer
+    MPI_Request req;          ///< The persistent request
+
+public:
+    /**
+     * Constructor.
+     * @param count  Number of values per message.
+     * @param comm   Communicator to send on.
+     * @param dest   Destination for all messages on this channel.
+     * @param tag    Tag for all messages on this channel.
+     */
+    PersistentSend(std::size_t count, MPI_Comm comm, int dest, int tag)
+        : buffer(count)
+    {
+        MPI_Send_init(&buffer[0], count, mpi_type_traits<T>::type(), dest, tag, comm, &req);
+    }
+
+    ~PersistentSend()
+    {
+        MPI_Request_free(&req);
+    }
+
+    /**
+     * Send one message. Blocks until the values may be reused, like
+     * @c MPI_Send.
+     *
+     * @param values  The values to send; must hold the count given at construction.
+     */
+    void operator()(const T *values)
+    {
+        std::copy(values, values + buffer.size(), buffer.begin());
+        MPI_Start(&req);
+        MPI_Wait(&req, MPI_STATUS_IGNORE);
+    }
+};
+
+/**
+ * Receiving counterpart to @ref PersistentSend. The source may be
+ * @c MPI_ANY_SOURCE, in which case the sender of each message is reported
+ * through the status argument.
+ */
+template<typename T>
+class PersistentRecv : public boost::noncopyable
+{
+private:
+    std::vector<T> buffer;    ///< Registered message buffer
+    MPI_Request req;          ///< The persistent request
+
+public:
+    /**
+     * Constructor.
+     * @param count   Number of values per message.
+     * @param comm    Communicator to receive on.
+     * @param source  Source for all messages on this channel (may be @c MPI_ANY_SOURCE).
+     * @param tag     Tag for all messages on this channel.
+     */
+    PersistentRecv(std::size_t count, MPI_Comm comm, int source, int tag)
+        : buffer(count)
+    {
+        MPI_Recv_init(&buffer[0], count, mpi_type_traits<T>::type(), source, tag, comm, &req);
+    }
+
+    ~PersistentRecv()
+    {
+        MPI_Request_free(&req);
+    }
+
+    /**
+     * Receive one message, blocking until it arrives.
+     *
+     * @param[out] values  Receives the values; must hold the count given at construction.
+     * @param[out] status  If non-NULL, receives the message status.
+     */
+    void operator()(T *values, MPI_Status *status = NULL)
+    {
+        MPI_Start(&req);
+        MPI_Wait(&req, status != NULL ? status : MPI_STATUS_IGNORE);
+        std::copy(buffer.begin(), buffer.end(), values);
+    }
+};
+
 void send(const Grid &grid, MPI_Comm comm, int dest);
 void recv(Grid &grid, MPI_Comm comm, int source);
 
@@ -159,6 +267,41 @@ void recv(SplatSet::SubsetBase &subset, MPI_Comm comm, int source);
 void send(const BucketCollector::Bin &bin, MPI_Comm comm, int dest);
 void recv(BucketCollector::Bin &bin, MPI_Comm comm, int source);
 
+/**
+ * Number of bytes needed by @ref pack for a batch of bins.
+ */
+std::size_t packSize(const Statistics::Container::vector<BucketCollector::Bin> &bins, MPI_Comm comm);
+
+/**
+ * Pack a batch of bins into a caller-provided buffer of at least
+ * @ref packSize bytes, for transmission by means other than @c send
+ * (e.g. one-sided RMA).
+ *
+ * @return The number of bytes actually packed.
+ */
+std::size_t pack(const Statistics::Container::vector<BucketCollector::Bin> &bins,
+                 void *buffer, std::size_t bufSize, MPI_Comm comm);
+
+/**
+ * Inverse of @ref pack. The vector must already be sized to the number of
+ * bins in the batch, which is communicated out of band.
+ */
+void unpack(Statistics::Container::vector<BucketCollector::Bin> &bins,
+            const void *buffer, std::size_t bufSize, MPI_Comm comm);
+
+/**
+ * Send a whole batch of bins as a single packed message, rather than
+ * several small messages per bin. This keeps the wire cost of a batch at
+ * one message regardless of the number of bins it contains.
+ */
+void send(const Statistics::Container::vector<BucketCollector::Bin> &bins, MPI_Comm comm, int dest);
+/**
+ * Receive a batch of bins sent with the batch form of @c send. The vector
+ * must already be sized to the number of bins in the batch, which is
+ * communicated out of band.
+ */
+void recv(Statistics::Container::vector<BucketCollector::Bin> &bins, MPI_Comm comm, int source);
+
 void send(const MesherWork &work, MPI_Comm comm, int dest);
 /**
  * Receive @ref MesherWork. The number of bytes required must have already
@@ -167,6 +310,19 @@ void send(const MesherWork &work, MPI_Comm comm, int dest);
  */
 void recv(MesherWork &work, void *ptr, MPI_Comm comm, int source);
 
+/**
+ * Enable or disable compression of large message payloads (currently the
+ * mesh data of @ref MesherWork). Compression runs on the sending worker
+ * thread, trading spare CPU for effective interconnect bandwidth, which
+ * pays off on Ethernet-class interconnects. Every rank must use the same
+ * setting, so it should be driven from the (identical) command line on all
+ * ranks before any data is sent.
+ *
+ * It only takes effect when zlib support was compiled in; otherwise a
+ * warning is logged and payloads travel raw.
+ */
+void setCompression(bool enable);
+
 /**
  * Broadcast a string to all ranks (like @c MPI_Bcast).
  */
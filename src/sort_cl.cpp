@@ -0,0 +1,90 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Implementation of @ref KeyValueSort.
+ */
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <CL/cl.hpp>
+#include <cstddef>
+#include <vector>
+#include <clogs/clogs.h>
+#include "sort_cl.h"
+
+KeyValueSort::~KeyValueSort()
+{
+}
+
+namespace
+{
+
+/**
+ * Backend that wraps @c clogs::Radixsort. clogs autotunes its work-group
+ * sizes on first use and caches the results per device, so no further
+ * tuning is done here.
+ */
+class ClogsSort : public KeyValueSort
+{
+private:
+    clogs::Radixsort sort;
+
+public:
+    ClogsSort(const cl::Context &context, const cl::Device &device)
+        : sort(context, device, clogs::TYPE_UINT, clogs::TYPE_INT)
+    {
+    }
+
+    virtual void setTemporaryBuffers(const cl::Buffer &keys, const cl::Buffer &values)
+    {
+        sort.setTemporaryBuffers(keys, values);
+    }
+
+    virtual void setEventCallback(
+        void (CL_CALLBACK *callback)(const cl::Event &event, void *userData),
+        void *userData)
+    {
+        sort.setEventCallback(callback, userData);
+    }
+
+    virtual void enqueue(const cl::CommandQueue &queue,
+                         const cl::Buffer &keys, const cl::Buffer &values,
+                         std::size_t elements, unsigned int keyBits,
+                         const std::vector<cl::Event> *events,
+                         cl::Event *event)
+    {
+        sort.enqueue(queue, keys, values, elements, keyBits, events, event);
+    }
+};
+
+} // anonymous namespace
+
+KeyValueSort *KeyValueSort::create(const cl::Context &context, const cl::Device &device)
+{
+    return new ClogsSort(context, device);
+}
@@ -0,0 +1,94 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Pluggable key-value sort backend for use on OpenCL devices.
+ */
+
+#ifndef SORT_CL_H
+#define SORT_CL_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <CL/cl.hpp>
+#include <cstddef>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+/**
+ * Abstract interface for sorting 32-bit unsigned keys with 32-bit signed
+ * values on an OpenCL device. The sort is the dominant cost of the octree
+ * build, so the backend is pluggable: @ref create returns the best
+ * implementation available for the device, and sorts tuned for specific
+ * hardware can be slotted in without touching @ref SplatTreeCL.
+ *
+ * Implementations are not required to be stable, and may only be used
+ * from one thread at a time.
+ */
+class KeyValueSort : public boost::noncopyable
+{
+public:
+    virtual ~KeyValueSort();
+
+    /**
+     * Provide pre-allocated scratch memory for the sort. Each buffer must be
+     * at least as large as the corresponding key/value buffer passed to
+     * @ref enqueue. Backends that do not need scratch memory may ignore the
+     * call; those that do will allocate their own if this is not called.
+     */
+    virtual void setTemporaryBuffers(const cl::Buffer &keys, const cl::Buffer &values) = 0;
+
+    /**
+     * Register a callback that is passed every event enqueued by the sort,
+     * for time accounting (see @ref Statistics::timeEventCallback).
+     */
+    virtual void setEventCallback(
+        void (CL_CALLBACK *callback)(const cl::Event &event, void *userData),
+        void *userData) = 0;
+
+    /**
+     * Enqueue a sort of @a elements key/value pairs.
+     *
+     * @param queue        Command queue to enqueue the work to.
+     * @param keys,values  Data to sort (in-place).
+     * @param elements     Number of key/value pairs.
+     * @param keyBits      Upper bound on the number of significant bits in
+     *                     any key. Backends use this to skip sorting passes.
+     * @param events       Events to wait for (or @c NULL).
+     * @param[out] event   Event that fires when the sort is complete (or @c NULL).
+     */
+    virtual void enqueue(const cl::CommandQueue &queue,
+                         const cl::Buffer &keys, const cl::Buffer &values,
+                         std::size_t elements, unsigned int keyBits,
+                         const std::vector<cl::Event> *events = NULL,
+                         cl::Event *event = NULL) = 0;
+
+    /**
+     * Factory that returns the best available backend for the device. The
+     * caller is responsible for deleting the result.
+     */
+    static KeyValueSort *create(const cl::Context &context, const cl::Device &device);
+};
+
+#endif /* !SORT_CL_H */
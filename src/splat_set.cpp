@@ -32,14 +32,28 @@
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
 #include <algorithm>
+#include <iomanip>
+#include <ios>
 #include <iosfwd>
+#include <sstream>
 #include <utility>
 #include <stdexcept>
+#include <boost/filesystem/operations.hpp>
+#include <boost/functional/hash.hpp>
 #include "splat_set.h"
 #include "errors.h"
 #include "misc.h"
+#include "cancel.h"
 #include "timeplot.h"
 
+#if HAVE_COMPRESS2
+# include <zlib.h>
+#endif
+
+#if HAVE_GETRLIMIT
+# include <sys/resource.h>
+#endif
+
 namespace SplatSet
 {
 
@@ -72,6 +86,32 @@ void splatToBuckets(const Splat &splat,
     }
 }
 
+SplatToBucketsGrid::SplatToBucketsGrid(const Grid &grid, Grid::size_type bucketSize)
+    : toCell(grid), divider(bucketSize)
+{
+}
+
+void SplatToBucketsGrid::operator()(
+    const Splat &splat,
+    boost::array<Grid::difference_type, 3> &lower,
+    boost::array<Grid::difference_type, 3> &upper) const
+{
+    float loWorld[3], hiWorld[3];
+    Grid::difference_type lo[3], hi[3];
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        loWorld[i] = splat.position[i] - splat.radius;
+        hiWorld[i] = splat.position[i] + splat.radius;
+    }
+    toCell(loWorld, lo);
+    toCell(hiWorld, hi);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        lower[i] = divider(lo[i]);
+        upper[i] = divider(hi[i]);
+    }
+}
+
 #if !BLOBS_USE_SSE2
 SplatToBuckets::SplatToBuckets(float spacing, Grid::size_type bucketSize)
     : invSpacing(1.0f / spacing), divider(bucketSize)
@@ -93,8 +133,108 @@ void SplatToBuckets::operator()(
         upper[i] = divider(hiCell);
     }
 }
+
+void SplatToBuckets::operator()(
+    const Splat *splats, std::size_t count,
+    boost::array<Grid::difference_type, 3> *lower,
+    boost::array<Grid::difference_type, 3> *upper) const
+{
+    for (std::size_t i = 0; i < count; i++)
+        operator()(splats[i], lower[i], upper[i]);
+}
 #endif
 
+#if HAVE_COMPRESS2
+
+bool blobCompressionSupported()
+{
+    return true;
+}
+
+std::size_t blobBlockBound(std::size_t rawWords)
+{
+    return compressBound(rawWords * sizeof(std::tr1::uint32_t));
+}
+
+std::size_t compressBlobBlock(char *out, const std::tr1::uint32_t *raw, std::size_t rawWords)
+{
+    const std::size_t rawBytes = rawWords * sizeof(std::tr1::uint32_t);
+    uLongf outLen = blobBlockBound(rawWords);
+    int status = compress2(
+        reinterpret_cast<Bytef *>(out), &outLen,
+        reinterpret_cast<const Bytef *>(raw), rawBytes,
+        Z_BEST_SPEED);
+    // Can only fail due to a too-small output buffer, which compressBound rules out
+    MLSGPU_ASSERT(status == Z_OK, std::length_error);
+    return outLen;
+}
+
+void uncompressBlobBlock(std::tr1::uint32_t *raw, std::size_t rawWords,
+                         const char *comp, std::size_t compBytes)
+{
+    const std::size_t rawBytes = rawWords * sizeof(std::tr1::uint32_t);
+    uLongf outLen = rawBytes;
+    int status = uncompress(
+        reinterpret_cast<Bytef *>(raw), &outLen,
+        reinterpret_cast<const Bytef *>(comp), compBytes);
+    if (status != Z_OK || outLen != rawBytes)
+        throw std::ios::failure("Corrupt compressed blob block");
+}
+
+#else // !HAVE_COMPRESS2
+
+bool blobCompressionSupported()
+{
+    return false;
+}
+
+std::size_t blobBlockBound(std::size_t rawWords)
+{
+    (void) rawWords;
+    MLSGPU_ASSERT(false, state_error);
+    return 0;
+}
+
+std::size_t compressBlobBlock(char *out, const std::tr1::uint32_t *raw, std::size_t rawWords)
+{
+    (void) out;
+    (void) raw;
+    (void) rawWords;
+    MLSGPU_ASSERT(false, state_error);
+    return 0;
+}
+
+void uncompressBlobBlock(std::tr1::uint32_t *raw, std::size_t rawWords,
+                         const char *comp, std::size_t compBytes)
+{
+    (void) raw;
+    (void) rawWords;
+    (void) comp;
+    (void) compBytes;
+    MLSGPU_ASSERT(false, state_error);
+}
+
+#endif // !HAVE_COMPRESS2
+
+std::string blobCacheHash(const std::string &key)
+{
+    const std::size_t h = boost::hash<std::string>()(key);
+    std::ostringstream o;
+    o << std::hex << std::setw(2 * sizeof(h)) << std::setfill('0') << h;
+    return o.str();
+}
+
+LocalBlobFileReader::LocalBlobFileReader(const boost::filesystem::path &path)
+    : stream(path, std::ios::binary)
+{
+    stream.exceptions(std::ios::failbit | std::ios::badbit);
+}
+
+void LocalBlobFileReader::read(char *buffer, std::size_t bytes)
+{
+    stream.read(buffer, bytes);
+}
+
 } // namespace detail
 
 BlobInfo SimpleBlobStream::operator*() const
@@ -103,7 +243,7 @@ BlobInfo SimpleBlobStream::operator*() const
     BlobInfo ans;
     ans.firstSplat = currentId;
     ans.lastSplat = currentId + 1;
-    detail::splatToBuckets(current, grid, bucketSize, ans.lower, ans.upper);
+    toBuckets(current, ans.lower, ans.upper);
     return ans;
 }
 
@@ -130,6 +270,40 @@ void FileSet::addFile(FastPly::Reader *file)
     nSplats += file->size();
 }
 
+std::string FileSet::fingerprint() const
+{
+    std::ostringstream o;
+    o.precision(10);
+    try
+    {
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            const FastPly::Reader &file = files[i];
+            o << file.getPath().string() << '|'
+                << boost::filesystem::file_size(file.getPath()) << '|'
+                << last_write_time(file.getPath()) << '|'
+                << file.getSmooth() << '|'
+                << file.getMaxRadius() << '|'
+                << file.getOffset()[0] << ','
+                << file.getOffset()[1] << ','
+                << file.getOffset()[2] << '|';
+        }
+    }
+    catch (boost::filesystem::filesystem_error &)
+    {
+        return std::string();
+    }
+    return o.str();
+}
+
+void FileSet::getWorldOffset(double offset[3]) const
+{
+    if (files.empty())
+        std::fill(offset, offset + 3, 0.0);
+    else
+        std::copy(files[0].getOffset(), files[0].getOffset() + 3, offset);
+}
+
 std::pair<splat_id, splat_id> FileSet::partition(int rank, int size) const
 {
     // First determine the rank as indices into the list of splats. There are
@@ -158,8 +332,112 @@ std::pair<splat_id, splat_id> FileSet::partition(int rank, int size) const
     return std::make_pair(ans[0], ans[1]);
 }
 
+/**
+ * Default capacity for @ref SplatSet::FileSet::HandleCache: most of the
+ * process file descriptor limit, leaving headroom for output files, the
+ * temporary files and whatever the OpenCL implementation needs.
+ */
+static std::size_t defaultHandleCacheCapacity()
+{
+#if HAVE_GETRLIMIT
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY)
+    {
+        const std::size_t headroom = 64;
+        if (lim.rlim_cur > 2 * headroom)
+            return std::size_t(lim.rlim_cur) - headroom;
+        return std::max(std::size_t(lim.rlim_cur) / 2, std::size_t(1));
+    }
+#endif
+    return 1000;
+}
+
+FileSet::HandleCache::HandleCache(const FileSet &owner)
+    : owner(owner), capacity(defaultHandleCacheCapacity())
+{
+}
+
+void FileSet::HandleCache::evict()
+{
+    for (std::list<std::size_t>::iterator i = order.begin(); i != order.end(); ++i)
+    {
+        map_type::iterator pos = entries.find(*i);
+        assert(pos != entries.end());
+        if (pos->second.pins == 0)
+        {
+            entries.erase(pos);
+            order.erase(i);
+            return;
+        }
+    }
+    // Everything is pinned: allow the cache to exceed its capacity rather
+    // than fail, since pins are expected to be few and short-lived.
+}
+
+FileSet::HandleCache::Entry &FileSet::HandleCache::acquire(std::size_t fileId)
+{
+    MLSGPU_ASSERT(fileId < owner.files.size(), std::out_of_range);
+    map_type::iterator pos = entries.find(fileId);
+    if (pos != entries.end())
+    {
+        order.splice(order.end(), order, pos->second.lruPos);
+        Statistics::getStatistic<Statistics::Counter>("files.handles.hits").add(1);
+        return pos->second;
+    }
+
+    while (entries.size() >= capacity && !order.empty())
+    {
+        const std::size_t oldSize = entries.size();
+        evict();
+        if (entries.size() == oldSize)
+            break; // everything remaining is pinned
+    }
+
+    Entry entry;
+    entry.handle.reset(new FastPly::Reader::Handle(owner.files[fileId]));
+    entry.pins = 0;
+    entry.lruPos = order.insert(order.end(), fileId);
+    Statistics::getStatistic<Statistics::Counter>("files.handles.misses").add(1);
+    return entries.insert(std::make_pair(fileId, entry)).first->second;
+}
+
+boost::shared_ptr<FastPly::Reader::Handle> FileSet::HandleCache::get(std::size_t fileId)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return acquire(fileId).handle;
+}
+
+void FileSet::HandleCache::pin(std::size_t fileId)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    acquire(fileId).pins++;
+}
+
+void FileSet::HandleCache::unpin(std::size_t fileId)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    map_type::iterator pos = entries.find(fileId);
+    MLSGPU_ASSERT(pos != entries.end() && pos->second.pins > 0, state_error);
+    pos->second.pins--;
+}
+
+void FileSet::HandleCache::setCapacity(std::size_t capacity)
+{
+    MLSGPU_ASSERT(capacity > 0, std::invalid_argument);
+    boost::lock_guard<boost::mutex> lock(mutex);
+    this->capacity = capacity;
+    while (entries.size() > capacity && !order.empty())
+    {
+        const std::size_t oldSize = entries.size();
+        evict();
+        if (entries.size() == oldSize)
+            break; // everything remaining is pinned
+    }
+}
+
 FileSet::ReaderThreadBase::ReaderThreadBase(const FileSet &owner) :
-    owner(owner), outQueue(), buffer("mem.FileSet.ReaderThread.buffer", owner.bufferSize),
+    owner(owner), outQueue(),
+    buffer("mem.FileSet.ReaderThread.buffer", owner.bufferSize, owner.numaNode),
     tworker("reader")
 {
 }
@@ -173,9 +451,19 @@ void FileSet::ReaderThreadBase::free(const Item &item)
 void FileSet::ReaderThreadBase::drain()
 {
     Item item;
-    while ((item = pop()).ptr != NULL)
+    try
     {
-        free(item);
+        while ((item = pop()).ptr != NULL)
+        {
+            free(item);
+        }
+    }
+    catch (cancelled &)
+    {
+        /* The run is cancelled, so the reader thread is exiting through the
+         * token as well; there is nothing left worth draining, and drain is
+         * called from a destructor so the exception must not escape.
+         */
     }
 }
 
@@ -208,16 +496,23 @@ std::size_t FileSet::MySplatStream::read(Splat *splats, splat_id *splatIds, std:
         // Try a parallel load + decode, and fall back if there are non-finites
         const std::size_t n = std::min(curItem.last - pos, (splat_id) count);
         const std::size_t offset = pos - curItem.first;
+        const std::size_t blockSize = 4096;
+        const std::size_t nBlocks = divUp(n, blockSize);
         bool nonFinite = false;
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) if (useOMP && n > 16384) reduction(||:nonFinite) shared(file, splats, splatIds) default(none)
 #endif
-        for (std::size_t i = 0; i < n; i++)
+        for (std::size_t b = 0; b < nBlocks; b++)
         {
-            splats[i] = file.decode(curItem.ptr, offset + i);
-            if (splatIds != NULL)
-                splatIds[i] = pos + i;
-            nonFinite = nonFinite || !splats[i].isFinite();
+            const std::size_t start = b * blockSize;
+            const std::size_t end = std::min(n, start + blockSize);
+            file.decodeBatch(curItem.ptr, offset + start, end - start, splats + start);
+            for (std::size_t i = start; i < end; i++)
+            {
+                if (splatIds != NULL)
+                    splatIds[i] = pos + i;
+                nonFinite = nonFinite || !splats[i].isFinite();
+            }
         }
 
         std::size_t p;
@@ -257,26 +552,45 @@ FileSet::MySplatStream::~MySplatStream()
     thread.join();
 }
 
+namespace
+{
+
+/// Append @a value to @a out as a varint (see @ref SplatSet::SubsetBase::splatRanges)
+void putVarint(Statistics::Container::vector<std::tr1::uint8_t> &out, splat_id value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(std::tr1::uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(std::tr1::uint8_t(value));
+}
+
+/// Decode a varint starting at @a pos, advancing @a pos past it
+splat_id getVarint(Statistics::Container::vector<std::tr1::uint8_t>::const_iterator &pos)
+{
+    splat_id value = 0;
+    unsigned int shift = 0;
+    while (*pos & 0x80)
+    {
+        value |= splat_id(*pos & 0x7F) << shift;
+        shift += 7;
+        ++pos;
+    }
+    value |= splat_id(*pos) << shift;
+    ++pos;
+    return value;
+}
+
+} // anonymous namespace
+
 void SubsetBase::flush()
 {
     if (first != last)
     {
         nRanges++;
-        if (first - prev < (1 << 16)
-            && last - first < (1 << 15))
-        {
-            std::tr1::uint32_t encoded = first - prev;
-            encoded |= (last - first) << 16;
-            encoded |= std::tr1::uint32_t(1) << 31;
-            splatRanges.push_back(encoded);
-        }
-        else
-        {
-            splatRanges.push_back(first >> 32);
-            splatRanges.push_back(first & UINT32_C(0xFFFFFFFF));
-            splatRanges.push_back(last >> 32);
-            splatRanges.push_back(last & UINT32_C(0xFFFFFFFF));
-        }
+        putVarint(splatRanges, first - prev);
+        putVarint(splatRanges, last - first);
         prev = last;
         first = last;
     }
@@ -320,23 +634,8 @@ SubsetBase::const_iterator SubsetBase::end() const
 
 void SubsetBase::const_iterator::increment()
 {
-    if (*pos & (std::tr1::uint32_t(1) << 31))
-    {
-        // Differential
-        prev += (*pos) & 0xFFFF;
-        prev += (*pos >> 16) & 0x7FFF;
-        ++pos;
-    }
-    else
-    {
-        // Full encoding
-        pos += 2;
-        prev = *pos;
-        prev <<= 32;
-        ++pos;
-        prev |= *pos;
-        ++pos;
-    }
+    prev += getVarint(pos);
+    prev += getVarint(pos);
 }
 
 bool SubsetBase::const_iterator::equal(const const_iterator &other) const
@@ -346,23 +645,10 @@ bool SubsetBase::const_iterator::equal(const const_iterator &other) const
 
 std::pair<splat_id, splat_id> SubsetBase::const_iterator::dereference() const
 {
-    if (*pos & (std::tr1::uint32_t(1) << 31))
-    {
-        // Differential
-        splat_id offset = *pos & 0xFFFF;
-        splat_id length = (*pos >> 16) & 0x7FFF;
-        splat_id first = prev + offset;
-        return std::make_pair(first, first + length);
-    }
-    else
-    {
-        Statistics::Container::vector<std::tr1::uint32_t>::const_iterator p = pos;
-        splat_id first = *p++; first <<= 32;
-        first |= *p++;
-        splat_id last = *p++; last <<= 32;
-        last |= *p++;
-        return std::make_pair(first, last);
-    }
+    Statistics::Container::vector<std::tr1::uint8_t>::const_iterator p = pos;
+    splat_id first = prev + getVarint(p);
+    splat_id last = first + getVarint(p);
+    return std::make_pair(first, last);
 }
 
 } // namespace SplatSet
@@ -32,7 +32,9 @@
 #endif
 
 #include "tr1_cstdint.h"
+#include "tr1_unordered_map.h"
 #include <vector>
+#include <list>
 #include <utility>
 #include <algorithm>
 #include <stdexcept>
@@ -46,11 +48,13 @@
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/type_traits/integral_constant.hpp>
 #include <boost/iterator/iterator_facade.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/optional.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/exception_ptr.hpp>
 #include "grid.h"
 #include "misc.h"
 #include "splat.h"
@@ -116,7 +120,10 @@ struct BlobInfo
  * Polymorphic interface for iteration over a sequence of splats. It is designed
  * to pull splats out in large chunks rather than one at a time. This amortises
  * the cost of the virtual function calls, and avoids the need for internal
- * buffering. The splats returned must all be finite.
+ * buffering: with one dispatch per buffer rather than per splat, consumers
+ * such as the blob pre-pass process splats in cache-sized blocks with no
+ * indirection inside their inner loops. The splats returned must all be
+ * finite.
  *
  * @see @ref SetConcept
  */
@@ -255,6 +262,128 @@ extern const std::pair<splat_id, splat_id> rangeAll;
 class SplatToBuckets;
 struct Bbox;
 
+/**
+ * Whether blob files will be written with block compression. This is false
+ * when zlib was not found at configure time, in which case the raw encoding
+ * is used instead.
+ */
+bool blobCompressionSupported();
+
+/**
+ * Upper bound on the number of bytes @ref compressBlobBlock may produce for
+ * a block of @a rawWords encoded words.
+ */
+std::size_t blobBlockBound(std::size_t rawWords);
+
+/**
+ * Compress a block of encoded blob words.
+ *
+ * @param out        Output buffer, with at least @ref blobBlockBound(@a rawWords) bytes.
+ * @param raw        The encoded words to compress.
+ * @param rawWords   Number of words to compress.
+ * @return The number of bytes written to @a out.
+ *
+ * @pre @ref blobCompressionSupported() is true.
+ */
+std::size_t compressBlobBlock(char *out, const std::tr1::uint32_t *raw, std::size_t rawWords);
+
+/**
+ * Reverse @ref compressBlobBlock.
+ *
+ * @param[out] raw   Output buffer for exactly @a rawWords words.
+ * @param rawWords   Number of words originally compressed.
+ * @param comp       The compressed bytes.
+ * @param compBytes  Number of compressed bytes.
+ *
+ * @throw std::ios::failure if the data do not decompress to exactly @a rawWords words.
+ * @pre @ref blobCompressionSupported() is true.
+ */
+void uncompressBlobBlock(std::tr1::uint32_t *raw, std::size_t rawWords,
+                         const char *comp, std::size_t compBytes);
+
+/**
+ * Hash a blob cache key to a short string suitable for use in a filename.
+ * Collisions are possible; users must store the full key alongside the data
+ * and verify it on lookup.
+ */
+std::string blobCacheHash(const std::string &key);
+
+/**
+ * Abstract source of the bytes of a single blob file. Blob streams read
+ * through this interface rather than opening the file directly, so that
+ * subclasses of @ref FastBlobSet can substitute other transports (see
+ * @ref FastBlobSet::openBlobFile). Reads are strictly sequential from the
+ * start of the file.
+ */
+class BlobFileReader : public boost::noncopyable
+{
+public:
+    virtual ~BlobFileReader() {}
+
+    /**
+     * Read exactly @a bytes bytes from the current position and advance
+     * past them.
+     *
+     * @throw std::ios::failure if the file ends early or cannot be read.
+     */
+    virtual void read(char *buffer, std::size_t bytes) = 0;
+};
+
+/**
+ * Implementation of @ref BlobFileReader that reads a local file.
+ */
+class LocalBlobFileReader : public BlobFileReader
+{
+private:
+    boost::filesystem::ifstream stream;
+
+public:
+    explicit LocalBlobFileReader(const boost::filesystem::path &path);
+    virtual void read(char *buffer, std::size_t bytes);
+};
+
+/**
+ * Grid-aligned counterpart to @ref SplatToBuckets, for replaying splats as
+ * blobs in a hot loop. It captures and validates the grid and bucket size
+ * once at construction, then converts per splat through the unchecked
+ * @ref Grid::WorldToCell fast path: the splat streams that drive it only
+ * yield finite splats within the grid's domain, which is exactly what
+ * @ref splatToBuckets would otherwise revalidate per element.
+ *
+ * The results match @ref splatToBuckets for splats satisfying its
+ * preconditions.
+ */
+class SplatToBucketsGrid
+{
+private:
+    Grid::WorldToCell toCell;   ///< Unchecked world-to-cell conversion
+    DownDivider divider;        ///< Divides cells by the bucket size
+
+public:
+    typedef void result_type;
+
+    /**
+     * Constructor.
+     * @param grid        Grid for spacing and alignment
+     * @param bucketSize  Size of buckets in cells
+     * @pre @a bucketSize &gt; 0 and the grid's spacing is positive.
+     */
+    SplatToBucketsGrid(const Grid &grid, Grid::size_type bucketSize);
+
+    /**
+     * Perform the conversion.
+     * @param      splat   Input splat
+     * @param[out] lower   Lower bound bucket coordinates (inclusive)
+     * @param[out] upper   Upper bound bucket coordinates (inclusive)
+     * @pre <code>splat.isFinite()</code> and the splat's bounding box is
+     * representable in the grid (see @ref Grid::WorldToCell).
+     */
+    void operator()(
+        const Splat &splat,
+        boost::array<Grid::difference_type, 3> &lower,
+        boost::array<Grid::difference_type, 3> &upper) const;
+};
+
 } // namespace detail
 
 /**
@@ -276,7 +405,7 @@ public:
     }
 
     SimpleBlobStream(SplatStream *splatStream, const Grid &grid, Grid::size_type bucketSize)
-        : splatStream(splatStream), grid(grid), bucketSize(bucketSize)
+        : splatStream(splatStream), toBuckets(grid, bucketSize)
     {
         MLSGPU_ASSERT(bucketSize > 0, std::invalid_argument);
         ++*this; // primes the 1-element buffer
@@ -291,8 +420,12 @@ private:
     Splat current;
     /// ID corresponding to @ref current
     splat_id currentId;
-    const Grid grid;
-    Grid::size_type bucketSize;
+    /**
+     * Per-splat bucket conversion, validated once at construction. The
+     * splat stream only yields finite splats, so the unchecked path is
+     * safe here.
+     */
+    detail::SplatToBucketsGrid toBuckets;
 };
 
 /**
@@ -311,6 +444,18 @@ class SequenceSet
 public:
     splat_id maxSplats() const { return last - first; }
 
+    /**
+     * Partitions the range of splats into roughly equal-sized subranges.
+     * Calling this function with a fixed @a size and values of @a rank in
+     * [0, @a size) will return a sequence of ranges which together will
+     * cover all the splats, in sequence and without overlaps.
+     */
+    std::pair<splat_id, splat_id> partition(int rank, int size) const
+    {
+        const splat_id total = last - first;
+        return std::make_pair(mulDiv(total, rank, size), mulDiv(total, rank + 1, size));
+    }
+
     SplatStream *makeSplatStream(bool useOMP = true) const
     {
         return makeSplatStream(&detail::rangeAll, &detail::rangeAll + 1, useOMP);
@@ -328,6 +473,12 @@ public:
         return new SimpleBlobStream(makeSplatStream(), grid, bucketSize);
     }
 
+    /**
+     * Return a fingerprint for keying persistent caches. In-memory sets
+     * cannot be fingerprinted, so this returns the empty string.
+     */
+    std::string fingerprint() const { return std::string(); }
+
     SequenceSet()
     {
     }
@@ -504,8 +655,42 @@ public:
         return ans;
     }
 
+    /**
+     * Hint to the OS that the given splat ranges will be read soon (see
+     * @ref fetchahead), so that it can start pulling them into the
+     * filesystem cache while other work proceeds. The ranges are mapped to
+     * per-file byte extents and nearby extents are coalesced, so on
+     * spinning disks the readahead happens in (file, offset) order rather
+     * than the order the bucket walk will consume them.
+     *
+     * This is purely an optimization hint and does nothing on platforms
+     * without @c posix_fadvise.
+     *
+     * @param firstRange,lastRange  Iterator range over splat ID ranges,
+     *                              which must be in sorted order.
+     */
+    template<typename RangeIterator>
+    void prefetch(RangeIterator firstRange, RangeIterator lastRange) const;
+
     splat_id maxSplats() const { return nSplats; }
 
+    /**
+     * Return a fingerprint for keying persistent caches. It covers each
+     * file's path, size and modification time as well as the radius
+     * transformation, so it changes whenever an input file is replaced or
+     * the decode parameters change. Returns the empty string if any of the
+     * files cannot be queried, in which case caching must be skipped.
+     */
+    std::string fingerprint() const;
+
+    /**
+     * Retrieve the decode offset of the files (see
+     * @ref FastPly::Reader::setOffset). The files are assumed to all carry
+     * the same offset, so the first file's value is returned; @a offset is
+     * zeroed if the set is empty.
+     */
+    void getWorldOffset(double offset[3]) const;
+
     /**
      * Partitions the range of splats into roughly equal-sized subranges.
      * Calling this function with a fixed @a size and values of @a rank in
@@ -525,7 +710,36 @@ public:
      */
     void setBufferSize(std::size_t bufferSize) { this->bufferSize = bufferSize; }
 
-    FileSet() : nSplats(0), bufferSize(DEFAULT_BUFFER_SIZE) {}
+    /**
+     * Set the NUMA node on which reader threads run and their buffers are
+     * allocated. This is a placement hint that affects streams created
+     * after the call; a negative value (the default) leaves placement to
+     * the OS.
+     */
+    void setNumaNode(int node) { numaNode = node; }
+
+    /**
+     * Set the maximum number of file handles the set keeps open between
+     * read bursts (see @ref HandleCache). The default is derived from the
+     * process file descriptor limit. It is not safe to call this function
+     * while streams exist.
+     */
+    void setHandleCacheCapacity(std::size_t capacity) { handleCache.setCapacity(capacity); }
+
+    /**
+     * Protect the handle for a file from eviction from the handle cache,
+     * opening it if necessary. This is intended for planners that know
+     * which files they are about to need. Each call must be balanced by a
+     * call to @ref unpinFile.
+     *
+     * @pre @a fileId is the index of a file previously passed to @ref addFile.
+     */
+    void pinFile(std::size_t fileId) const { handleCache.pin(fileId); }
+
+    /// Balances a previous call to @ref pinFile.
+    void unpinFile(std::size_t fileId) const { handleCache.unpin(fileId); }
+
+    FileSet() : nSplats(0), bufferSize(DEFAULT_BUFFER_SIZE), numaNode(-1), handleCache(*this) {}
 
 private:
     /**
@@ -558,6 +772,14 @@ private:
              */
             boost::optional<CircularBuffer::Allocation> alloc;
 
+            /**
+             * For zero-copy reads, a reference to the file handle whose
+             * mapping backs @ref ptr, keeping the mapping alive until the
+             * item has been consumed. Empty for items staged through the
+             * circular buffer.
+             */
+            boost::shared_ptr<FastPly::Reader::Handle> handle;
+
             Item() : first(0), last(0), ptr(NULL)
             {
             }
@@ -640,6 +862,75 @@ private:
         const bool useOMP;              ///< Whether to use OpenMP for acceleration
     };
 
+    /**
+     * Cache of open file handles, shared by all reader threads of the set.
+     * Without it each reader thread opens and closes a handle every time
+     * consecutive ranges come from different files, which with many
+     * thousands of input tiles causes measurable syscall churn and throws
+     * away the OS readahead state attached to each descriptor.
+     *
+     * The cache holds at most @ref capacity handles and evicts the least
+     * recently used unpinned one when full. Pinned handles (see @ref pin)
+     * are never evicted, so a planner that knows which files it is about
+     * to touch can keep them open. Eviction only drops the cache's
+     * reference: readers still holding the @c shared_ptr (for example via
+     * @ref ReaderThreadBase::Item::handle) keep the file open until they
+     * are done with it.
+     *
+     * All member functions are thread-safe.
+     */
+    class HandleCache : public boost::noncopyable
+    {
+    private:
+        /// One cached handle
+        struct Entry
+        {
+            boost::shared_ptr<FastPly::Reader::Handle> handle;
+            unsigned int pins;   ///< Number of outstanding pins
+            /// Position in @ref order, for O(1) LRU updates
+            std::list<std::size_t>::iterator lruPos;
+        };
+        typedef std::tr1::unordered_map<std::size_t, Entry> map_type;
+
+        const FileSet &owner;      ///< Set whose files are cached
+        boost::mutex mutex;        ///< Guards all mutable state
+        std::size_t capacity;      ///< Maximum number of cached handles
+        map_type entries;          ///< Cached handles, keyed by file ID
+        /// File IDs in order of use (least recently used at the front)
+        std::list<std::size_t> order;
+
+        /// Drop the least recently used unpinned handle, if there is one
+        void evict();
+
+        /**
+         * Find the entry for a file, opening it (and evicting if the cache
+         * is full) if necessary, and mark it most recently used.
+         * The caller must hold @ref mutex.
+         */
+        Entry &acquire(std::size_t fileId);
+
+    public:
+        explicit HandleCache(const FileSet &owner);
+
+        /**
+         * Return an open handle for a file, opening it (and evicting the
+         * least recently used unpinned handle if the cache is full) if
+         * necessary.
+         */
+        boost::shared_ptr<FastPly::Reader::Handle> get(std::size_t fileId);
+
+        /// Implements @ref FileSet::pinFile.
+        void pin(std::size_t fileId);
+        /// Implements @ref FileSet::unpinFile.
+        void unpin(std::size_t fileId);
+
+        /**
+         * Change the cache capacity, evicting handles as necessary.
+         * @pre @a capacity is at least 1.
+         */
+        void setCapacity(std::size_t capacity);
+    };
+
     /// Backing store of files
     boost::ptr_vector<FastPly::Reader> files;
 
@@ -648,6 +939,12 @@ private:
 
     /// Buffer sized used by streams
     std::size_t bufferSize;
+
+    /// NUMA node for reader threads and their buffers (negative for none)
+    int numaNode;
+
+    /// Open handles kept across read bursts (must be declared after @ref files)
+    mutable HandleCache handleCache;
 };
 
 /**
@@ -707,6 +1004,15 @@ private:
  *  - covers at most two buckets in each axis;
  *  - is sufficiently close to the previous one.
  *
+ * When zlib is available, the encoded words are not written to the blob file
+ * raw but in compressed blocks: a block is a 32-bit count of encoded words,
+ * a 32-bit count of compressed bytes, then the zlib-compressed words. Since
+ * the encoded words are already differential the blocks compress well, and
+ * each block can be decompressed (or skipped) independently given only its
+ * header. A block always contains whole records. Whether a file is
+ * compressed is recorded per file (see @ref BlobFile::compressed), so blob
+ * files written without zlib can still be read.
+ *
  * @param Base A model of @ref SubsettableConcept.
  */
 template<typename Base>
@@ -758,26 +1064,92 @@ public:
          */
         BlobInfo curBlob;
         /**
-         * Input stream over the blob file. This may be a closed stream at
-         * the start and end of the blob stream.
+         * Reader over the current blob file (see @ref openBlobFile). This
+         * may be NULL at the start and end of the blob stream.
          */
-        boost::filesystem::ifstream stream;
+        boost::scoped_ptr<detail::BlobFileReader> reader;
         /**
-         * Index corresponding to @ref stream. If @ref stream is closed, this
+         * Index corresponding to @ref reader. If @ref reader is NULL, this
          * is the number of the next file to read.
          */
         std::size_t curFile;
 
+        /// Decompressed words of the current block, for compressed blob files
+        Statistics::Container::PODBuffer<std::tr1::uint32_t> blockWords;
+        /// Staging buffer for a compressed block read from the file
+        Statistics::Container::PODBuffer<char> compBuffer;
+        std::size_t blockPos;    ///< Next word to consume from @ref blockWords
+        std::size_t blockSize;   ///< Number of valid words in @ref blockWords
+
+        /**
+         * Read the next encoded word, either directly from the stream or
+         * from the current decompressed block, loading the next block if
+         * necessary.
+         */
+        std::tr1::uint32_t nextWord();
+
         void refill(); ///< Load curBlob from the stream
     };
 
     BlobStream *makeBlobStream(const Grid &grid, Grid::size_type bucketSize) const;
 
+    /// On-disk record for one splat in the splat cache file
+    struct CacheEntry
+    {
+        splat_id id;      ///< ID of the splat in the base set
+        Splat splat;      ///< Decoded splat
+    };
+
+    /**
+     * Splat stream that reads back the splats recorded in the splat cache
+     * file by @ref computeBlobs, rather than re-reading and re-decoding the
+     * original input files. The start of each range is located with a binary
+     * search over the (sorted) cached IDs, after which the records are read
+     * sequentially.
+     */
+    class CacheSplatStream : public SplatStream
+    {
+    public:
+        virtual std::size_t read(Splat *splats, splat_id *ids, std::size_t count);
+
+        template<typename RangeIterator>
+        CacheSplatStream(const FastBlobSet<Base> &owner,
+                         RangeIterator firstRange, RangeIterator lastRange)
+            : owner(owner),
+            ranges("mem.CacheSplatStream::ranges"),
+            buffer("mem.CacheSplatStream::buffer"),
+            curRange(0), pos(0), rangeEnd(0)
+        {
+            for (RangeIterator i = firstRange; i != lastRange; ++i)
+                ranges.push_back(*i);
+            reader.reset(createReader(SYSCALL_READER));
+            reader->open(owner.cachePath);
+        }
+
+    private:
+        const FastBlobSet<Base> &owner;
+        /// Reader over the splat cache file
+        boost::scoped_ptr<BinaryReader> reader;
+        /// Copy of the ranges to walk
+        Statistics::Container::vector<std::pair<splat_id, splat_id> > ranges;
+        /// Staging buffer for records read from the cache file
+        Statistics::Container::PODBuffer<CacheEntry> buffer;
+        std::size_t curRange;          ///< Next range to locate in the cache
+        std::tr1::uint64_t pos;        ///< Next record in the current range
+        std::tr1::uint64_t rangeEnd;   ///< Past-the-end record of the current range
+
+        /// Index of the first cached record with ID &gt;= @a id
+        std::tr1::uint64_t lowerBound(splat_id id) const;
+    };
+
     /// Remove the temporary files holding the blobs, if any
     void eraseBlobFiles();
 
+    /// Remove the temporary file holding the splat cache, if any
+    void eraseSplatCache();
+
     FastBlobSet();
-    ~FastBlobSet();
+    virtual ~FastBlobSet();
 
     /**
      * Generate the internal acceleration structures and compute bounding box.
@@ -796,6 +1168,72 @@ public:
                       std::ostream *progressStream = NULL,
                       bool warnNonFinite = true);
 
+    /**
+     * Request that @ref computeBlobs also write the decoded splats to a
+     * compact temporary file. Subsequent splat streams are then served from
+     * this cache rather than by re-reading and re-decoding the original
+     * input files, so each byte of the input is read exactly once even when
+     * the OS cache is cold. The cache costs temporary disk space
+     * (<code>sizeof(CacheEntry)</code> bytes per finite splat).
+     *
+     * This must be called before @ref computeBlobs to have any effect. It
+     * only applies to the single-node @ref computeBlobs; the MPI collective
+     * version ignores it since the cache would be scattered across ranks.
+     */
+    void setSplatCache(bool enable) { useSplatCache = enable; }
+
+    /**
+     * Request that blob data be persisted in @a dir and reused across runs.
+     * When set, @ref computeBlobs first looks for blob data previously saved
+     * for the same inputs and parameters (keyed by the base class
+     * fingerprint together with the spacing and bucket size) and, if found,
+     * loads the bounding grid and splat count from it instead of making a
+     * pass over the input; otherwise it computes the blobs as usual and
+     * saves them to @a dir afterwards.
+     *
+     * This must be called before @ref computeBlobs to have any effect. Like
+     * @ref setSplatCache it only applies to the single-node @ref
+     * computeBlobs. It has no effect if the base class cannot be
+     * fingerprinted.
+     */
+    void setBlobCache(const boost::filesystem::path &dir) { blobCacheDir = dir; }
+
+    /**
+     * Set the number of streams @ref computeBlobs uses to read the input.
+     * Each stream covers a contiguous subrange of the splats (the same
+     * split as the MPI collective version uses across ranks) and runs on
+     * its own thread. A single stream cannot always saturate a parallel
+     * filesystem, so raising this can make a first-time pass run at
+     * filesystem speed; it buys nothing on a single local disk.
+     *
+     * This must be called before @ref computeBlobs to have any effect, and
+     * like @ref setSplatCache it only applies to the single-node @ref
+     * computeBlobs (the MPI collective version already reads one stream per
+     * rank).
+     *
+     * @pre @a threads &gt;= 1
+     */
+    void setComputeThreads(int threads)
+    {
+        MLSGPU_ASSERT(threads >= 1, std::invalid_argument);
+        computeThreads = threads;
+    }
+
+    SplatStream *makeSplatStream(bool useOMP = true) const
+    {
+        if (!cachePath.empty())
+            return new CacheSplatStream(*this, &detail::rangeAll, &detail::rangeAll + 1);
+        return Base::makeSplatStream(useOMP);
+    }
+
+    template<typename RangeIterator>
+    SplatStream *makeSplatStream(RangeIterator firstRange, RangeIterator lastRange, bool useOMP = false) const
+    {
+        if (!cachePath.empty())
+            return new CacheSplatStream(*this, firstRange, lastRange);
+        return Base::makeSplatStream(firstRange, lastRange, useOMP);
+    }
+
     /**
      * Return the bounding grid generated by @ref computeBlobs. The grid will
      * have an origin at the world origin and the @a spacing passed to @ref
@@ -827,8 +1265,13 @@ protected:
         boost::filesystem::path path;  ///< Path to the file
         std::tr1::uint64_t nBlobs;     ///< Number of blobs in the file
         bool owner;                    ///< If true, the file will be deleted on destruction
+        /**
+         * If true, the encoded words are stored in compressed blocks rather
+         * than raw (see @ref detail::compressBlobBlock).
+         */
+        bool compressed;
 
-        BlobFile() : nBlobs(0), owner(true) {}
+        BlobFile() : nBlobs(0), owner(true), compressed(false) {}
     };
 
     /**
@@ -850,9 +1293,35 @@ protected:
 
     splat_id nSplats;  ///< Exact splat count computed during blob generation
 
+    /// Whether @ref computeBlobs should write the splat cache
+    bool useSplatCache;
+    /// Number of concurrent streams used by @ref computeBlobs
+    int computeThreads;
+    /**
+     * Directory for persisting blob data across runs. It is empty when no
+     * persistent cache was requested.
+     */
+    boost::filesystem::path blobCacheDir;
+    /**
+     * Path to the splat cache file. It is empty when there is no cache, in
+     * which case splat streams fall back to the base class.
+     */
+    boost::filesystem::path cachePath;
+    /// Number of records in the splat cache file
+    std::tr1::uint64_t cacheEntries;
+
     /// Erase a temporary file, if it is owned
     static void eraseBlobFile(const BlobFile &bf);
 
+    /**
+     * Open a reader over one of the files in @ref blobFiles. The caller
+     * takes ownership of the returned reader. The base implementation
+     * opens the file from the local filesystem; subclasses may override it
+     * to read the bytes through some other transport (see
+     * @ref FastBlobSetMPI).
+     */
+    virtual detail::BlobFileReader *openBlobFile(std::size_t fileIndex) const;
+
     /**
      * Compute a bounding grid from a bounding box. Unlike the bounding box,
      * the returned grid is guaranteed to be aligned to a size of
@@ -870,6 +1339,8 @@ protected:
      * @param[out] bf            Blob file produced.
      * @param[out] nSplats       Number of finite splats encountered in the range.
      * @param progress           Optional progress meter, incremented once per finite splat.
+     * @param cacheOut           If non-NULL, the decoded splats are appended to this
+     *                           stream as @ref CacheEntry records, in splat ID order.
      *
      * @post
      * - @a bf.owner is @c true
@@ -883,7 +1354,22 @@ protected:
         splat_id first, splat_id last,
         const detail::SplatToBuckets &toBuckets,
         detail::Bbox &bbox, BlobFile &bf, splat_id &nSplats,
-        ProgressMeter *progress);
+        ProgressMeter *progress,
+        std::ostream *cacheOut = NULL);
+
+    /**
+     * Adapter around @ref computeBlobsRange for running one stream of
+     * @ref computeBlobs. Exceptions are captured into @a error rather than
+     * propagated, so that the spawning thread can join all the workers
+     * before rethrowing.
+     */
+    void computeBlobsRangeThread(
+        std::pair<splat_id, splat_id> range,
+        const detail::SplatToBuckets &toBuckets,
+        detail::Bbox &bbox, BlobFile &bf, splat_id &nSplats,
+        ProgressMeter *progress,
+        std::ostream *cacheOut,
+        boost::exception_ptr &error);
 
 private:
     /**
@@ -892,6 +1378,26 @@ private:
      */
     bool fastPath(const Grid &grid, Grid::size_type bucketSize) const;
 
+    /**
+     * Try to satisfy @ref computeBlobs from the persistent blob cache.
+     * On success the bounding grid, splat count and blob file list have
+     * been populated from the cached data and true is returned. Any
+     * missing, stale or unreadable cache entry results in false.
+     *
+     * @param key        Full cache key (see @ref setBlobCache).
+     * @param spacing    Grid spacing passed to @ref computeBlobs.
+     */
+    bool loadBlobCache(const std::string &key, float spacing);
+
+    /**
+     * Persist the freshly computed blob data for later runs. This is
+     * best-effort: failures are logged as warnings and do not affect the
+     * current run.
+     *
+     * @param key        Full cache key (see @ref setBlobCache).
+     */
+    void saveBlobCache(const std::string &key);
+
     /**
      * Append a blob to @a blobData.
      * @param blobData The list of encoded blobs to append to.
@@ -947,10 +1453,10 @@ public:
         splat_id prev;
 
         /// Position in the owner's encoded array
-        Statistics::Container::vector<std::tr1::uint32_t>::const_iterator pos;
+        Statistics::Container::vector<std::tr1::uint8_t>::const_iterator pos;
 
         const_iterator(splat_id prev,
-                       Statistics::Container::vector<std::tr1::uint32_t>::const_iterator pos)
+                       Statistics::Container::vector<std::tr1::uint8_t>::const_iterator pos)
             : prev(prev), pos(pos) {}
 
     public:
@@ -1025,20 +1531,16 @@ protected:
     friend class Serialize::Access;
     /**
      * Store of splat ID ranges. Each range is a half-open interval of valid
-     * IDs. They are encoded in one of two forms. The full encoding uses 4
-     * 32-bit words:
-     * -# First splat (high)
-     * -# First splat (low)
-     * -# Last splat (high)
-     * -# Last splat (low)
+     * IDs, encoded as two variable-length integers:
+     * -# First splat minus last splat from previous range
+     * -# Length
      *
-     * The differential encoding packs fields into a single 32-bit word. From
-     * lowest to highest bit:
-     * - [0:16]  First splat minus last splat from previous range
-     * - [16:31] Length
-     * - [31:32] 1
+     * Each varint is stored least-significant group first, 7 bits per byte,
+     * with the top bit set on all but the final byte of a value. Typical
+     * ranges thus cost two bytes, and arbitrarily large gaps and lengths
+     * degrade gracefully rather than needing an escape encoding.
      */
-    Statistics::Container::vector<std::tr1::uint32_t> splatRanges;
+    Statistics::Container::vector<std::tr1::uint8_t> splatRanges;
 
     /**
      * @name
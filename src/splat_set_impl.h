@@ -50,15 +50,23 @@
 #include <iterator>
 #include <utility>
 #include <iostream>
+#include <sstream>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
 #include <boost/next_prior.hpp>
 #include <boost/exception/all.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
 #include <boost/foreach.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <cerrno>
 #include "allocator.h"
+#include "decache.h"
 #include "errors.h"
+#include "cancel.h"
 #include "splat_set.h"
+#include "numa.h"
 #include "thread_name.h"
 #include "timeplot.h"
 #include "misc.h"
@@ -208,6 +216,7 @@ template<typename RangeIterator>
 void FileSet::ReaderThread<RangeIterator>::operator()()
 {
     thread_set_name("reader");
+    numaBindThread(owner.numaNode);
 
     // Maximum number of bytes to load at one time. This must be less than the buffer
     // size, and should be much less for efficiency.
@@ -216,80 +225,186 @@ void FileSet::ReaderThread<RangeIterator>::operator()()
     Statistics::Variable &readRangeStat = Statistics::getStatistic<Statistics::Variable>("files.read.splats");
     Statistics::Variable &readMergedStat = Statistics::getStatistic<Statistics::Variable>("files.read.merged");
 
-    boost::scoped_ptr<FastPly::Reader::Handle> handle;
+    boost::shared_ptr<FastPly::Reader::Handle> handle;
     std::size_t handleId = 0;
     FileRangeIterator<RangeIterator> first(owner, firstRange, lastRange, maxChunk);
     FileRangeIterator<RangeIterator> last(owner, lastRange);
 
-    Timeplot::Action totalTimer("compute", tworker);
-    FileRangeIterator<RangeIterator> cur = first;
-    while (cur != last)
-    {
-        FileRange range = *cur;
-        const std::size_t vertexSize = owner.files[range.fileId].getVertexSize();
+    // Vertex ranges making up the current merged run, reused across runs
+    std::vector<FastPly::Reader::size_type> batchFirsts, batchLasts;
 
-        if (!handle || range.fileId != handleId)
+    try
+    {
+        Timeplot::Action totalTimer("compute", tworker);
+        FileRangeIterator<RangeIterator> cur = first;
+        while (cur != last)
         {
-            if (vertexSize > maxChunk)
+            FileRange range = *cur;
+            const std::size_t vertexSize = owner.files[range.fileId].getVertexSize();
+
+            if (!handle || range.fileId != handleId)
             {
-                // TODO: associate the filename with it? Might be too late.
-                throw std::runtime_error("Far too many bytes per vertex");
+                if (vertexSize > maxChunk)
+                {
+                    // TODO: associate the filename with it? Might be too late.
+                    throw std::runtime_error("Far too many bytes per vertex");
+                }
+                /* The cache keeps the handle open across bursts, so hopping
+                 * between files does not cost an open/close pair each time.
+                 */
+                handle = owner.handleCache.get(range.fileId);
+                handleId = range.fileId;
             }
-            handle.reset(); // close the old handle
-            handle.reset(new FastPly::Reader::Handle(owner.files[range.fileId]));
-            handleId = range.fileId;
-        }
 
-        const FastPly::Reader::size_type start = range.start;
-        FastPly::Reader::size_type end = range.end;
-        /* Request merging */
-        FileRangeIterator<RangeIterator> next = cur;
-        ++next;
-        while (next != last)
-        {
-            const FileRange nextRange = *next;
-            if (nextRange.start < end
-                || (nextRange.fileId != range.fileId)
-                || (nextRange.start - end) * vertexSize > maxChunk / 2
-                || (nextRange.end - start) * vertexSize > maxChunk)
-                break;
-            end = nextRange.end;
+            const FastPly::Reader::size_type start = range.start;
+            FastPly::Reader::size_type end = range.end;
+            /* Request merging: runs of nearby ranges in the same file are
+             * fetched together with one vectored read that discards the gap
+             * bytes (see FastPly::Reader::Handle::readRawBatch). Only the
+             * payload counts against the buffer budget, while the span cap
+             * bounds how many discarded bytes a single request may fetch, so
+             * heavily fragmented bins coalesce into far fewer requests than
+             * one per range.
+             */
+            FastPly::Reader::size_type payload = range.end - range.start;
+            batchFirsts.clear();
+            batchLasts.clear();
+            batchFirsts.push_back(range.start);
+            batchLasts.push_back(range.end);
+            FileRangeIterator<RangeIterator> next = cur;
             ++next;
-        }
-
-        CircularBuffer::Allocation alloc = buffer.allocate(tworker, vertexSize, end - start);
-        char *chunk = (char *) alloc.get();
-        {
-            Timeplot::Action readTimer("load", tworker, readTimeStat);
-            handle->readRaw(start, end, chunk);
-        }
-        readMergedStat.add(end - start);
-
-        {
-            Timeplot::Action pushTimer("push", tworker);
-            while (cur != next)
+            while (next != last)
             {
-                readRangeStat.add(range.end - range.start);
-
-                Item item;
-                item.first = range.start + (splat_id(range.fileId) << scanIdShift);
-                item.last = item.first + (range.end - range.start);
-                item.ptr = chunk + (range.start - start) * vertexSize;
-                ++cur;
-                if (cur != next)
-                    range = *cur;
+                const FileRange nextRange = *next;
+                if (nextRange.start < end
+                    || (nextRange.fileId != range.fileId)
+                    || (nextRange.start - end) * vertexSize > maxChunk / 2
+                    || (payload + (nextRange.end - nextRange.start)) * vertexSize > maxChunk
+                    || (nextRange.end - start) * vertexSize > 2 * maxChunk)
+                    break;
+                if (nextRange.start == end)
+                    batchLasts.back() = nextRange.end; // contiguous: extend in place
                 else
-                    item.alloc = alloc;
+                {
+                    batchFirsts.push_back(nextRange.start);
+                    batchLasts.push_back(nextRange.end);
+                }
+                payload += nextRange.end - nextRange.start;
+                end = nextRange.end;
+                ++next;
+            }
 
-                outQueue.push(item);
+            /* Zero-copy path: if the reader can expose the file contents directly
+             * (e.g. a memory mapping), hand out pointers into the mapping instead
+             * of staging the data through the circular buffer.
+             */
+            boost::optional<CircularBuffer::Allocation> alloc;
+            char *chunk = const_cast<char *>(handle->dataRaw(start, end));
+            bool packed = false; // ranges packed tightly rather than span-relative
+            if (chunk == NULL)
+            {
+                alloc = buffer.allocate(tworker, vertexSize, payload);
+                chunk = (char *) alloc->get();
+                {
+                    Timeplot::Action readTimer("load", tworker, readTimeStat);
+                    handle->readRawBatch(&batchFirsts[0], &batchLasts[0], batchFirsts.size(), chunk);
+                }
+                packed = true;
+            }
+            readMergedStat.add(payload);
+
+            {
+                Timeplot::Action pushTimer("push", tworker);
+                FastPly::Reader::size_type done = 0; // payload vertices already handed out
+                while (cur != next)
+                {
+                    readRangeStat.add(range.end - range.start);
+
+                    Item item;
+                    item.first = range.start + (splat_id(range.fileId) << scanIdShift);
+                    item.last = item.first + (range.end - range.start);
+                    item.ptr = chunk + (packed ? done : range.start - start) * vertexSize;
+                    done += range.end - range.start;
+                    if (!alloc)
+                        item.handle = handle; // keep the mapping alive downstream
+                    ++cur;
+                    if (cur != next)
+                        range = *cur;
+                    else
+                        item.alloc = alloc;
+
+                    outQueue.push(item);
+                }
             }
         }
     }
+    catch (cancelled &)
+    {
+        /* Fast abort: the consumer is unwinding through the token too, so
+         * neither the buffer space nor the queue entries will be wanted.
+         */
+    }
 
     // Signal completion
     outQueue.stop();
 }
 
+template<typename RangeIterator>
+void FileSet::prefetch(RangeIterator firstRange, RangeIterator lastRange) const
+{
+    if (!fetchaheadSupported())
+        return;
+
+    /* Upper bound on the bytes covered by one hint. It also bounds the
+     * number of splats FileRangeIterator::increment adds to the splat ID,
+     * so it must stay well clear of overflowing the within-file ID space.
+     */
+    const FastPly::Reader::size_type maxChunk =
+        FastPly::Reader::size_type(64) * 1024 * 1024;
+    // Maximum gap (in bytes) to bridge when coalescing adjacent extents
+    const FastPly::Reader::size_type maxGap = 256 * 1024;
+
+    Statistics::Counter &bytesStat =
+        Statistics::getStatistic<Statistics::Counter>("files.prefetch.bytes");
+
+    FileRangeIterator<RangeIterator> cur(*this, firstRange, lastRange, maxChunk);
+    const FileRangeIterator<RangeIterator> last(*this, lastRange);
+
+    bool pending = false;
+    std::size_t fileId = 0;
+    FastPly::Reader::size_type start = 0, end = 0; // byte extent within fileId
+    while (cur != last)
+    {
+        const FileRange range = *cur;
+        const FastPly::Reader &file = files[range.fileId];
+        const FastPly::Reader::size_type rangeStart =
+            file.getHeaderSize() + range.start * file.getVertexSize();
+        const FastPly::Reader::size_type rangeEnd =
+            file.getHeaderSize() + range.end * file.getVertexSize();
+        if (pending && (range.fileId != fileId || rangeStart > end + maxGap))
+        {
+            fetchahead(files[fileId].getPath().string(), start, end - start);
+            bytesStat.add(end - start);
+            pending = false;
+        }
+        if (!pending)
+        {
+            pending = true;
+            fileId = range.fileId;
+            start = rangeStart;
+            end = rangeEnd;
+        }
+        else
+            end = std::max(end, rangeEnd);
+        ++cur;
+    }
+    if (pending)
+    {
+        fetchahead(files[fileId].getPath().string(), start, end - start);
+        bytesStat.add(end - start);
+    }
+}
+
 static inline std::tr1::int32_t extractUnsigned(std::tr1::uint32_t value, int lbit, int hbit)
 {
     assert(0 <= lbit && lbit < hbit && hbit <= 32);
@@ -336,14 +451,40 @@ BlobStream &FastBlobSet<Base>::MyBlobStream::operator++()
     return *this;
 }
 
+template<typename Base>
+std::tr1::uint32_t FastBlobSet<Base>::MyBlobStream::nextWord()
+{
+    if (!owner.blobFiles[curFile].compressed)
+    {
+        std::tr1::uint32_t data;
+        reader->read(reinterpret_cast<char *>(&data), sizeof(data));
+        return data;
+    }
+
+    while (blockPos == blockSize)
+    {
+        // Header is the number of encoded words, then the compressed bytes
+        std::tr1::uint32_t header[2];
+        reader->read(reinterpret_cast<char *>(&header), sizeof(header));
+        blockWords.reserve(header[0], false);
+        compBuffer.reserve(header[1], false);
+        reader->read(compBuffer.data(), header[1]);
+        detail::uncompressBlobBlock(blockWords.data(), header[0],
+                                    compBuffer.data(), header[1]);
+        blockPos = 0;
+        blockSize = header[0];
+    }
+    return blockWords[blockPos++];
+}
+
 template<typename Base>
 void FastBlobSet<Base>::MyBlobStream::refill()
 {
     while (remaining == 0)
     {
-        if (stream.is_open())
+        if (reader)
         {
-            stream.close();
+            reader.reset();
             curFile++;
         }
         if (curFile >= owner.blobFiles.size())
@@ -354,16 +495,16 @@ void FastBlobSet<Base>::MyBlobStream::refill()
         }
         else
         {
-            stream.open(owner.blobFiles[curFile].path, std::ios::binary);
-            stream.exceptions(std::ios::failbit | std::ios::badbit);
+            reader.reset(owner.openBlobFile(curFile));
             remaining = owner.blobFiles[curFile].nBlobs;
+            blockPos = 0;
+            blockSize = 0;
         }
     }
 
     try
     {
-        std::tr1::uint32_t data;
-        stream.read(reinterpret_cast<char *>(&data), sizeof(data));
+        std::tr1::uint32_t data = nextWord();
         if (data & UINT32_C(0x80000000))
         {
             // Differential record
@@ -379,7 +520,8 @@ void FastBlobSet<Base>::MyBlobStream::refill()
         {
             // Full record
             std::tr1::uint32_t buffer[9];
-            stream.read(reinterpret_cast<char *>(&buffer), sizeof(buffer));
+            for (unsigned int i = 0; i < 9; i++)
+                buffer[i] = nextWord();
             std::tr1::uint64_t firstHi = data;
             std::tr1::uint64_t firstLo = buffer[0];
             std::tr1::uint64_t lastHi = buffer[1];
@@ -426,7 +568,11 @@ FastBlobSet<Base>::MyBlobStream::MyBlobStream(
     owner(owner),
     bucketDivider(bucketSize / owner.internalBucketSize),
     remaining(0),
-    curFile(0)
+    curFile(0),
+    blockWords("mem.MyBlobStream::blockWords"),
+    compBuffer("mem.MyBlobStream::compBuffer"),
+    blockPos(0),
+    blockSize(0)
 {
     MLSGPU_ASSERT(bucketSize > 0 && owner.internalBucketSize > 0
                   && bucketSize % owner.internalBucketSize == 0, std::invalid_argument);
@@ -437,7 +583,7 @@ FastBlobSet<Base>::MyBlobStream::MyBlobStream(
 
 template<typename Base>
 FastBlobSet<Base>::FastBlobSet()
-: Base(), internalBucketSize(0), nSplats(0)
+: Base(), internalBucketSize(0), nSplats(0), useSplatCache(false), computeThreads(1), cacheEntries(0)
 {
 }
 
@@ -453,6 +599,12 @@ void FastBlobSet<Base>::eraseBlobFile(const BlobFile &bf)
     }
 }
 
+template<typename Base>
+detail::BlobFileReader *FastBlobSet<Base>::openBlobFile(std::size_t fileIndex) const
+{
+    return new detail::LocalBlobFileReader(blobFiles[fileIndex].path);
+}
+
 template<typename Base>
 void FastBlobSet<Base>::eraseBlobFiles()
 {
@@ -463,10 +615,25 @@ void FastBlobSet<Base>::eraseBlobFiles()
     blobFiles.clear();
 }
 
+template<typename Base>
+void FastBlobSet<Base>::eraseSplatCache()
+{
+    if (!cachePath.empty())
+    {
+        boost::system::error_code ec;
+        remove(cachePath, ec);
+        if (ec)
+            Log::log[Log::warn] << "Could not delete " << cachePath.string() << ": " << ec.message() << std::endl;
+        cachePath.clear();
+    }
+    cacheEntries = 0;
+}
+
 template<typename Base>
 FastBlobSet<Base>::~FastBlobSet()
 {
     eraseBlobFiles();
+    eraseSplatCache();
 }
 
 template<typename Base>
@@ -479,6 +646,56 @@ BlobStream *FastBlobSet<Base>::makeBlobStream(
         return Base::makeBlobStream(grid, bucketSize);
 }
 
+template<typename Base>
+std::tr1::uint64_t FastBlobSet<Base>::CacheSplatStream::lowerBound(splat_id id) const
+{
+    std::tr1::uint64_t lo = 0;
+    std::tr1::uint64_t hi = owner.cacheEntries;
+    while (lo < hi)
+    {
+        const std::tr1::uint64_t mid = lo + (hi - lo) / 2;
+        splat_id midId;
+        reader->read(&midId, sizeof(midId), mid * sizeof(CacheEntry));
+        if (midId < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+template<typename Base>
+std::size_t FastBlobSet<Base>::CacheSplatStream::read(
+    Splat *splats, splat_id *ids, std::size_t count)
+{
+    std::size_t n = 0;
+    while (n < count)
+    {
+        while (pos == rangeEnd)
+        {
+            if (curRange == ranges.size())
+                return n;
+            pos = lowerBound(ranges[curRange].first);
+            rangeEnd = lowerBound(ranges[curRange].second);
+            curRange++;
+        }
+
+        const std::size_t nRead =
+            (std::size_t) std::min(std::tr1::uint64_t(count - n), rangeEnd - pos);
+        buffer.reserve(nRead, false);
+        reader->read(&buffer[0], nRead * sizeof(CacheEntry), pos * sizeof(CacheEntry));
+        for (std::size_t i = 0; i < nRead; i++)
+        {
+            splats[n + i] = buffer[i].splat;
+            if (ids != NULL)
+                ids[n + i] = buffer[i].id;
+        }
+        pos += nRead;
+        n += nRead;
+    }
+    return n;
+}
+
 namespace detail
 {
 
@@ -576,6 +793,25 @@ public:
         boost::array<Grid::difference_type, 3> &lower,
         boost::array<Grid::difference_type, 3> &upper) const;
 
+    /**
+     * Perform the conversion for a batch of splats. The results are
+     * identical to calling the single-splat overload once per element, but
+     * the SSE implementation switches the rounding mode once per chunk of
+     * splats instead of twice per splat, which matters in the blob pass
+     * where this function runs for every input splat.
+     *
+     * @param      splats        Input splats
+     * @param      count         Number of elements in each of the arrays
+     * @param[out] lower         Lower bound coordinates (inclusive), per splat
+     * @param[out] upper         Upper bound coordinates (inclusive), per splat
+     *
+     * @pre Every input splat satisfies <code>splat.isFinite()</code>.
+     */
+    void operator()(
+        const Splat *splats, std::size_t count,
+        boost::array<Grid::difference_type, 3> *lower,
+        boost::array<Grid::difference_type, 3> *upper) const;
+
     /**
      * Constructor.
      * @param      spacing       Grid spacing
@@ -639,7 +875,8 @@ void FastBlobSet<Base>::computeBlobsRange(
     splat_id first, splat_id last,
     const detail::SplatToBuckets &toBuckets,
     detail::Bbox &bbox, BlobFile &bf, splat_id &nSplats,
-    ProgressMeter *progress)
+    ProgressMeter *progress,
+    std::ostream *cacheOut)
 {
     Statistics::Registry &registry = Statistics::Registry::getInstance();
 
@@ -648,6 +885,7 @@ void FastBlobSet<Base>::computeBlobsRange(
     bbox = detail::Bbox();
     nSplats = 0;
     bf.nBlobs = 0;
+    bf.compressed = detail::blobCompressionSupported();
     boost::filesystem::ofstream out;
     createTmpFile(bf.path, out);
 
@@ -657,6 +895,7 @@ void FastBlobSet<Base>::computeBlobsRange(
         static const std::size_t BUFFER_SIZE = 64 * 1024;
         Statistics::Container::vector<Splat> buffer("mem.computeBlobs.buffer", BUFFER_SIZE);
         Statistics::Container::vector<splat_id> bufferIds("mem.computeBlobs.buffer", BUFFER_SIZE);
+        Statistics::Container::PODBuffer<CacheEntry> cacheBuffer("mem.computeBlobs.cacheBuffer");
 
         boost::scoped_ptr<SplatStream> splats(Base::makeSplatStream(&ranges, &ranges + 1, true));
         while (true)
@@ -665,6 +904,26 @@ void FastBlobSet<Base>::computeBlobsRange(
             if (nBuffer == 0)
                 break;
 
+            if (cacheOut != NULL)
+            {
+                // Record the decoded splats so that later streams do not
+                // need to touch the input files again.
+                cacheBuffer.reserve(nBuffer, false);
+                for (std::size_t i = 0; i < nBuffer; i++)
+                {
+                    cacheBuffer[i].id = bufferIds[i];
+                    cacheBuffer[i].splat = buffer[i];
+                }
+                cacheOut->write(reinterpret_cast<const char *>(&cacheBuffer[0]),
+                                nBuffer * sizeof(CacheEntry));
+                if (!*cacheOut)
+                {
+                    if (err == 0)
+                        err = errno;
+                    throw std::ios::failure("");
+                }
+            }
+
 #ifdef _OPENMP
 #pragma omp parallel shared(out, buffer, bufferIds, bbox, bf, toBuckets, err) default(none)
 #endif
@@ -687,6 +946,22 @@ void FastBlobSet<Base>::computeBlobsRange(
                     bool haveCurBlob = false;
                     std::tr1::uint64_t threadBlobs = 0;
 
+                    /* Convert the whole subrange to bucket coordinates up
+                     * front: the batch overload amortizes its rounding-mode
+                     * switches over many splats.
+                     */
+                    Statistics::Container::PODBuffer<boost::array<Grid::difference_type, 3> >
+                        bucketLower("mem.computeBlobs.threadBuckets");
+                    Statistics::Container::PODBuffer<boost::array<Grid::difference_type, 3> >
+                        bucketUpper("mem.computeBlobs.threadBuckets");
+                    if (last > first)
+                    {
+                        bucketLower.reserve(last - first, false);
+                        bucketUpper.reserve(last - first, false);
+                        toBuckets(&buffer[first], last - first,
+                                  bucketLower.data(), bucketUpper.data());
+                    }
+
                     // Compute the blobs for a single subrange. The first blob will always
                     // be a non-differential encoding, so the encoding depends on the number
                     // of subchunks chosen.
@@ -694,7 +969,8 @@ void FastBlobSet<Base>::computeBlobsRange(
                     {
                         const Splat &splat = buffer[i];
                         BlobInfo blob;
-                        toBuckets(splat, blob.lower, blob.upper);
+                        blob.lower = bucketLower[i - first];
+                        blob.upper = bucketUpper[i - first];
                         blob.firstSplat = bufferIds[i];
                         blob.lastSplat = blob.firstSplat + 1;
                         threadBbox += splat;
@@ -722,6 +998,19 @@ void FastBlobSet<Base>::computeBlobsRange(
                         threadBlobs++;
                     }
 
+                    /* Compress the subrange into a self-contained block
+                     * before entering the ordered section, so that the
+                     * compression itself runs in parallel.
+                     */
+                    Statistics::Container::PODBuffer<char> threadComp("mem.computeBlobs.threadComp");
+                    std::tr1::uint32_t compBytes = 0;
+                    if (bf.compressed && !threadBlobData.empty())
+                    {
+                        threadComp.reserve(detail::blobBlockBound(threadBlobData.size()), false);
+                        compBytes = detail::compressBlobBlock(
+                            threadComp.data(), &threadBlobData[0], threadBlobData.size());
+                    }
+
 #ifdef _OPENMP
 #pragma omp ordered
 #endif
@@ -729,7 +1018,21 @@ void FastBlobSet<Base>::computeBlobsRange(
                         // Write the blobs for this subrange out to file
                         bbox += threadBbox;
                         bf.nBlobs += threadBlobs;
-                        out.write(reinterpret_cast<const char *>(&threadBlobData[0]), threadBlobData.size() * sizeof(threadBlobData[0]));
+                        if (bf.compressed)
+                        {
+                            if (!threadBlobData.empty())
+                            {
+                                const std::tr1::uint32_t header[2] =
+                                {
+                                    std::tr1::uint32_t(threadBlobData.size()),
+                                    compBytes
+                                };
+                                out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+                                out.write(threadComp.data(), compBytes);
+                            }
+                        }
+                        else
+                            out.write(reinterpret_cast<const char *>(&threadBlobData[0]), threadBlobData.size() * sizeof(threadBlobData[0]));
                         if (!out && err == 0)
                             err = errno;
                     }
@@ -767,6 +1070,27 @@ void FastBlobSet<Base>::computeBlobsRange(
         out.tellp() * sizeof(BlobData));
 }
 
+template<typename Base>
+void FastBlobSet<Base>::computeBlobsRangeThread(
+    std::pair<splat_id, splat_id> range,
+    const detail::SplatToBuckets &toBuckets,
+    detail::Bbox &bbox, BlobFile &bf, splat_id &nSplats,
+    ProgressMeter *progress,
+    std::ostream *cacheOut,
+    boost::exception_ptr &error)
+{
+    try
+    {
+        computeBlobsRange(
+            range.first, range.second,
+            toBuckets, bbox, bf, nSplats, progress, cacheOut);
+    }
+    catch (...)
+    {
+        error = boost::current_exception();
+    }
+}
+
 template<typename Base>
 Grid FastBlobSet<Base>::makeBoundingGrid(float spacing, Grid::size_type bucketSize, const detail::Bbox &bbox)
 {
@@ -819,9 +1143,36 @@ void FastBlobSet<Base>::computeBlobs(
     MLSGPU_ASSERT(bucketSize > 0, std::invalid_argument);
     internalBucketSize = bucketSize;
     eraseBlobFiles();
+    eraseSplatCache();
     nSplats = 0;
 
-    blobFiles.push_back(BlobFile());
+    std::string cacheKey;
+    if (!blobCacheDir.empty())
+    {
+        const std::string fp = Base::fingerprint();
+        if (!fp.empty())
+        {
+            std::ostringstream key;
+            key.precision(10);
+            key << "mlsgpu blob cache 1|" << spacing << '|' << bucketSize << '|' << fp;
+            cacheKey = key.str();
+            if (loadBlobCache(cacheKey, spacing))
+            {
+                registry.getStatistic<Statistics::Variable>("blobset.cache.hit").add(1);
+                if (progressStream != NULL)
+                    *progressStream << "Reusing cached bounding box data\n";
+                splat_id nonFinite = Base::maxSplats() - nSplats;
+                if (nonFinite > 0 && warnNonFinite)
+                    Log::log[Log::warn] << "Input contains " << nonFinite << " splat(s) with non-finite values\n";
+                registry.getStatistic<Statistics::Variable>("blobset.nonfinite").add(nonFinite);
+                return;
+            }
+            registry.getStatistic<Statistics::Variable>("blobset.cache.hit").add(0);
+        }
+    }
+
+    const int threads = computeThreads;
+    blobFiles.resize(threads);
 
     boost::scoped_ptr<ProgressDisplay> progress;
     if (progressStream != NULL)
@@ -832,12 +1183,137 @@ void FastBlobSet<Base>::computeBlobs(
 
     detail::Bbox bbox;
 
+    /* Per-stream outputs. Each stream covers a contiguous subrange of the
+     * splats (the same split that the MPI collective version makes across
+     * ranks) and produces its own blob file and, if requested, its own slice
+     * of the splat cache. The per-buffer progress updates are batched per
+     * thread so they do not contend on the display mutex.
+     */
+    boost::scoped_ptr<BatchedProgress> batchedProgress;
+    if (progress)
+        batchedProgress.reset(new BatchedProgress(progress.get()));
+    std::vector<detail::Bbox> threadBbox(threads);
+    std::vector<splat_id> threadSplats(threads);
+    std::vector<boost::exception_ptr> threadError(threads);
+    std::vector<boost::filesystem::path> threadCachePath(threads);
+    boost::ptr_vector<boost::filesystem::ofstream> threadCacheOut;
+
     const detail::SplatToBuckets toBuckets(spacing, bucketSize);
-    computeBlobsRange(
-        detail::rangeAll.first, detail::rangeAll.second,
-        toBuckets,
-        bbox, blobFiles.back(), nSplats,
-        progress.get());
+    try
+    {
+        if (useSplatCache)
+        {
+            threadCacheOut.reserve(threads);
+            for (int i = 0; i < threads; i++)
+            {
+                threadCacheOut.push_back(new boost::filesystem::ofstream);
+                createTmpFile(threadCachePath[i], threadCacheOut[i]);
+            }
+        }
+
+        if (threads == 1)
+        {
+            // No point in spawning a thread just to wait for it
+            computeBlobsRangeThread(
+                detail::rangeAll, toBuckets,
+                threadBbox[0], blobFiles[0], threadSplats[0],
+                batchedProgress.get(),
+                useSplatCache ? static_cast<std::ostream *>(&threadCacheOut[0]) : static_cast<std::ostream *>(NULL),
+                threadError[0]);
+        }
+        else
+        {
+            boost::ptr_vector<boost::thread> workers;
+            workers.reserve(threads);
+            for (int i = 0; i < threads; i++)
+                workers.push_back(new boost::thread(boost::bind(
+                    &FastBlobSet<Base>::computeBlobsRangeThread, this,
+                    Base::partition(i, threads),
+                    boost::cref(toBuckets),
+                    boost::ref(threadBbox[i]), boost::ref(blobFiles[i]),
+                    boost::ref(threadSplats[i]),
+                    batchedProgress.get(),
+                    useSplatCache ? static_cast<std::ostream *>(&threadCacheOut[i]) : static_cast<std::ostream *>(NULL),
+                    boost::ref(threadError[i]))));
+            for (int i = 0; i < threads; i++)
+                workers[i].join();
+        }
+
+        if (batchedProgress)
+            batchedProgress->flush();
+
+        for (int i = 0; i < threads; i++)
+            if (threadError[i])
+                boost::rethrow_exception(threadError[i]);
+
+        for (int i = 0; i < threads; i++)
+        {
+            bbox += threadBbox[i];
+            nSplats += threadSplats[i];
+        }
+
+        if (useSplatCache)
+        {
+            for (int i = 0; i < threads; i++)
+            {
+                threadCacheOut[i].close();
+                if (!threadCacheOut[i])
+                    throw boost::enable_error_info(std::ios::failure("Failed to write splat cache"))
+                        << boost::errinfo_errno(errno)
+                        << boost::errinfo_file_name(threadCachePath[i].string());
+            }
+            /* Stitch the slices together in stream order, which is splat ID
+             * order, by appending to the first slice in place. From here on
+             * the cache file is owned through cachePath (see
+             * eraseSplatCache).
+             */
+            cachePath = threadCachePath[0];
+            threadCachePath[0].clear();
+            if (threads > 1)
+            {
+                boost::filesystem::ofstream out(cachePath, std::ios::binary | std::ios::app);
+                static const std::size_t COPY_BUFFER_SIZE = 1024 * 1024;
+                Statistics::Container::PODBuffer<char> copyBuffer("mem.computeBlobs.copyBuffer");
+                copyBuffer.reserve(COPY_BUFFER_SIZE, false);
+                for (int i = 1; i < threads; i++)
+                {
+                    boost::filesystem::ifstream in(threadCachePath[i], std::ios::binary);
+                    while (in)
+                    {
+                        in.read(copyBuffer.data(), COPY_BUFFER_SIZE);
+                        out.write(copyBuffer.data(), in.gcount());
+                    }
+                    if (in.bad() || !out)
+                        throw boost::enable_error_info(std::ios::failure("Failed to merge splat cache"))
+                            << boost::errinfo_errno(errno)
+                            << boost::errinfo_file_name(threadCachePath[i].string());
+                    in.close();
+                    boost::system::error_code ec;
+                    remove(threadCachePath[i], ec);
+                    if (ec)
+                        Log::log[Log::warn] << "Could not delete " << threadCachePath[i].string() << ": " << ec.message() << std::endl;
+                    threadCachePath[i].clear();
+                }
+                out.close();
+                if (!out)
+                    throw boost::enable_error_info(std::ios::failure("Failed to write splat cache"))
+                        << boost::errinfo_errno(errno)
+                        << boost::errinfo_file_name(cachePath.string());
+            }
+            cacheEntries = nSplats;
+        }
+    }
+    catch (std::exception &)
+    {
+        eraseSplatCache();
+        for (int i = 0; i < threads; i++)
+            if (!threadCachePath[i].empty())
+            {
+                boost::system::error_code ec;
+                remove(threadCachePath[i], ec);
+            }
+        throw;
+    }
 
     assert(nSplats <= Base::maxSplats());
     splat_id nonFinite = Base::maxSplats() - nSplats;
@@ -851,6 +1327,149 @@ void FastBlobSet<Base>::computeBlobs(
     registry.getStatistic<Statistics::Variable>("blobset.nonfinite").add(nonFinite);
 
     boundingGrid = makeBoundingGrid(spacing, bucketSize, bbox);
+
+    if (!cacheKey.empty())
+        saveBlobCache(cacheKey);
+}
+
+template<typename Base>
+bool FastBlobSet<Base>::loadBlobCache(const std::string &key, float spacing)
+{
+    const std::string hash = detail::blobCacheHash(key);
+    const boost::filesystem::path metaPath = blobCacheDir / (hash + ".meta");
+    const boost::filesystem::path blobPath = blobCacheDir / (hash + ".blobs");
+
+    try
+    {
+        boost::filesystem::ifstream meta(metaPath);
+        if (!meta)
+            return false;
+
+        // The full key is stored to guard against hash collisions and
+        // changed inputs with a colliding fingerprint
+        std::string storedKey;
+        if (!getline(meta, storedKey) || storedKey != key)
+            return false;
+
+        std::tr1::uint64_t storedBlobs, storedSplats;
+        int compressed;
+        Grid::difference_type extents[3][2];
+        meta >> storedBlobs >> storedSplats >> compressed;
+        for (unsigned int i = 0; i < 3; i++)
+            meta >> extents[i][0] >> extents[i][1];
+        if (!meta)
+            return false;
+        if (compressed && !detail::blobCompressionSupported())
+            return false;
+        if (!boost::filesystem::exists(blobPath))
+            return false;
+
+        const float ref[3] = {0.0f, 0.0f, 0.0f};
+        boundingGrid.setSpacing(spacing);
+        boundingGrid.setReference(ref);
+        for (unsigned int i = 0; i < 3; i++)
+            boundingGrid.setExtent(i, extents[i][0], extents[i][1]);
+        nSplats = storedSplats;
+
+        blobFiles.push_back(BlobFile());
+        blobFiles.back().path = blobPath;
+        blobFiles.back().nBlobs = storedBlobs;
+        blobFiles.back().owner = false;
+        blobFiles.back().compressed = (compressed != 0);
+        return true;
+    }
+    catch (std::exception &)
+    {
+        return false;
+    }
+}
+
+template<typename Base>
+void FastBlobSet<Base>::saveBlobCache(const std::string &key)
+{
+    assert(!blobFiles.empty());
+    const std::string hash = detail::blobCacheHash(key);
+    const boost::filesystem::path metaPath = blobCacheDir / (hash + ".meta");
+    const boost::filesystem::path blobPath = blobCacheDir / (hash + ".blobs");
+
+    try
+    {
+        std::tr1::uint64_t totalBlobs = 0;
+        const bool compressed = blobFiles.front().compressed;
+        if (blobFiles.size() == 1)
+        {
+            BlobFile &bf = blobFiles.back();
+            totalBlobs = bf.nBlobs;
+            boost::system::error_code ec;
+            rename(bf.path, blobPath, ec);
+            if (!ec)
+            {
+                // The cached copy is now the working copy
+                bf.path = blobPath;
+                bf.owner = false;
+            }
+            else
+            {
+                // Probably a different filesystem to the temporary directory
+                copy_file(bf.path, blobPath, boost::filesystem::copy_option::overwrite_if_exists);
+            }
+        }
+        else
+        {
+            /* A parallel pass produces one blob file per stream. They are
+             * concatenated for the cache: each stream starts with a full
+             * (non-differential) record and compressed blocks are
+             * self-contained, so the result reads back as a single file.
+             */
+            boost::filesystem::ofstream out(blobPath, std::ios::binary | std::ios::trunc);
+            static const std::size_t COPY_BUFFER_SIZE = 1024 * 1024;
+            Statistics::Container::PODBuffer<char> copyBuffer("mem.saveBlobCache.copyBuffer");
+            copyBuffer.reserve(COPY_BUFFER_SIZE, false);
+            BOOST_FOREACH(const BlobFile &bf, blobFiles)
+            {
+                boost::filesystem::ifstream in(bf.path, std::ios::binary);
+                while (in)
+                {
+                    in.read(copyBuffer.data(), COPY_BUFFER_SIZE);
+                    out.write(copyBuffer.data(), in.gcount());
+                }
+                if (in.bad() || !out)
+                    throw boost::enable_error_info(std::ios::failure("Failed to copy blob data"))
+                        << boost::errinfo_file_name(bf.path.string());
+                totalBlobs += bf.nBlobs;
+            }
+            out.close();
+            if (!out)
+                throw boost::enable_error_info(std::ios::failure("Failed to write blob cache"))
+                    << boost::errinfo_file_name(blobPath.string());
+
+            // The cached copy is now the working copy
+            eraseBlobFiles();
+            blobFiles.push_back(BlobFile());
+            blobFiles.back().path = blobPath;
+            blobFiles.back().nBlobs = totalBlobs;
+            blobFiles.back().owner = false;
+            blobFiles.back().compressed = compressed;
+        }
+
+        /* The metadata is written last so that an interrupted save leaves
+         * only an unreferenced blob file, which will be overwritten by the
+         * next save.
+         */
+        boost::filesystem::ofstream meta(metaPath);
+        meta << key << '\n';
+        meta << totalBlobs << ' ' << nSplats << ' ' << int(compressed) << '\n';
+        for (unsigned int i = 0; i < 3; i++)
+            meta << boundingGrid.getExtent(i).first << ' ' << boundingGrid.getExtent(i).second << '\n';
+        meta.close();
+        if (!meta)
+            throw boost::enable_error_info(std::ios::failure("Failed to write blob cache metadata"))
+                << boost::errinfo_file_name(metaPath.string());
+    }
+    catch (std::exception &e)
+    {
+        Log::log[Log::warn] << "Could not save blob cache: " << e.what() << std::endl;
+    }
 }
 
 template<typename Base>
@@ -37,9 +37,10 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/thread/thread.hpp>
-#include <boost/ref.hpp>
+#include <boost/bind.hpp>
 #include "grid.h"
 #include "splat_set.h"
+#include "blob_mpi.h"
 #include "progress.h"
 #include "progress_mpi.h"
 #include "errors.h"
@@ -52,9 +53,23 @@ template<typename Base>
 class FastBlobSetMPI : public FastBlobSet<Base>
 {
 public:
+    FastBlobSetMPI() : serviceComm(MPI_COMM_NULL), serviceRank(-1) {}
+
+    /// Destructor. Implicitly calls @ref stopBlobService.
+    virtual ~FastBlobSetMPI();
+
     /**
      * Computes the blobs for the underlying set collectively across all ranks.
-     * The results are broadcast back to the ranks.
+     * Each rank processes its share of the splats (see
+     * @ref FileSet::partition) and writes its own blob file; the splat count
+     * and bounding box are merged with reductions and the blob file metadata
+     * is exchanged, so the pre-pass time shrinks with the number of ranks.
+     *
+     * The blob data itself is never replicated: each rank keeps only its own
+     * file and serves pages of it on demand (see @ref BlobServerMPI), and
+     * blob streams pull just the pages they touch through a small LRU cache.
+     * The service runs until @ref stopBlobService (or destruction), so @a
+     * comm must remain valid for the lifetime of the set.
      *
      * @param comm           Communicator for the collective operation.
      * @param root           Master for the collective operation (affects logging only)
@@ -77,8 +92,87 @@ public:
         float spacing, Grid::size_type bucketSize,
         std::ostream *progressStream = NULL,
         bool warnNonFinite = true);
+
+    /**
+     * Shut down the demand-paged blob service. This is a collective
+     * operation over the communicator passed to @ref computeBlobs: it
+     * synchronizes the ranks before stopping the local server, so that no
+     * rank can still be reading the blob stream of another. After it
+     * returns, blob streams may no longer be created on any rank. It is
+     * called implicitly by the destructor, and is a no-op when the service
+     * is not running.
+     */
+    void stopBlobService();
+
+protected:
+    /**
+     * Open a reader over one of the blob files. The rank that produced the
+     * file reads it directly; other ranks read it on demand through
+     * @ref RemoteBlobFileReader and the page cache.
+     */
+    virtual detail::BlobFileReader *openBlobFile(std::size_t fileIndex) const;
+
+private:
+    /// Number of pages retained by @ref pageCache
+    static const std::size_t pageCachePages = 256;
+
+    /**
+     * Communicator over which the blob service runs. It is
+     * @c MPI_COMM_NULL when the service is not running.
+     */
+    MPI_Comm serviceComm;
+    int serviceRank;   ///< Own rank in @ref serviceComm
+
+    /// Server for the locally-held blob file
+    boost::scoped_ptr<BlobServerMPI> server;
+    /**
+     * Cache of pages fetched from other ranks' blob files. It is created
+     * lazily by @ref openBlobFile, and is mutable because opening a blob
+     * stream is logically const.
+     */
+    mutable boost::scoped_ptr<BlobPageCache> pageCache;
 };
 
+template<typename Base>
+const std::size_t FastBlobSetMPI<Base>::pageCachePages;
+
+template<typename Base>
+FastBlobSetMPI<Base>::~FastBlobSetMPI()
+{
+    stopBlobService();
+}
+
+template<typename Base>
+void FastBlobSetMPI<Base>::stopBlobService()
+{
+    if (server)
+    {
+        /* Do not stop serving until every rank has agreed that it will
+         * issue no more requests, otherwise a rank could block forever
+         * waiting for a reply.
+         */
+        MPI_Barrier(serviceComm);
+        server->stop();
+        server.reset();
+    }
+    pageCache.reset();
+    serviceComm = MPI_COMM_NULL;
+    serviceRank = -1;
+}
+
+template<typename Base>
+detail::BlobFileReader *FastBlobSetMPI<Base>::openBlobFile(std::size_t fileIndex) const
+{
+    if (serviceComm == MPI_COMM_NULL || int(fileIndex) == serviceRank)
+        return FastBlobSet<Base>::openBlobFile(fileIndex);
+    else
+    {
+        if (!pageCache)
+            pageCache.reset(new BlobPageCache(pageCachePages));
+        return new RemoteBlobFileReader(serviceComm, int(fileIndex), *pageCache);
+    }
+}
+
 template<typename Base>
 void FastBlobSetMPI<Base>::computeBlobs(
     MPI_Comm comm, int root,
@@ -93,6 +187,7 @@ void FastBlobSetMPI<Base>::computeBlobs(
     Statistics::Registry &registry = Statistics::Registry::getInstance();
 
     MLSGPU_ASSERT(bucketSize > 0, std::invalid_argument);
+    stopBlobService();
     this->internalBucketSize = bucketSize;
     this->eraseBlobFiles();
     this->blobFiles.reserve(size);
@@ -109,10 +204,14 @@ void FastBlobSetMPI<Base>::computeBlobs(
             *progressStream << "Computing bounding box\n";
             progressDisplay.reset(new ProgressDisplay(Base::maxSplats(), *progressStream));
         }
-        // On non-root node this will pass a NULL upstream, which is correct
+        // On non-root nodes the parent is NULL, which is correct: only the
+        // root's relay feeds a real meter.
         progress.reset(new ProgressMPI(progressDisplay.get(), Base::maxSplats(), comm, root));
-        if (rank == root)
-            progressThread.reset(new boost::thread(boost::ref(*progress)));
+        /* Every rank runs a relay in the reduction tree, with one local
+         * producer (the computeBlobsRange call below).
+         */
+        progressThread.reset(new boost::thread(
+            boost::bind(&ProgressMPI::operator(), progress.get(), 1U)));
     }
 
     typename FastBlobSet<Base>::BlobFile blobFile; // TODO: exception safety
@@ -131,18 +230,18 @@ void FastBlobSetMPI<Base>::computeBlobs(
         MPI_Allreduce(MPI_IN_PLACE, &bbox.bboxMax[0], 3, MPI_FLOAT, MPI_MAX, comm);
 
         assert(this->nSplats <= Base::maxSplats());
+        const splat_id nonFinite = Base::maxSplats() - this->nSplats;
         if (progress)
+        {
+            if (rank == root)
+                *progress += nonFinite;
             progress->sync();
+            progress->close();
+            progressThread->join();
+            progressThread.reset();
+        }
         if (rank == root)
         {
-            splat_id nonFinite = Base::maxSplats() - this->nSplats;
-            if (progressThread)
-            {
-                *progress += nonFinite;
-                progress->sync();
-                progressThread->join();
-                progressThread.reset();
-            }
             if (nonFinite > 0 && warnNonFinite)
             {
                 Log::log[Log::warn] << "Input contains " << nonFinite << " splat(s) with non-finite values\n";
@@ -151,25 +250,35 @@ void FastBlobSetMPI<Base>::computeBlobs(
         }
         this->boundingGrid = this->makeBoundingGrid(spacing, bucketSize, bbox);
 
-        /* Distribute the filenames. This is not done with MPI_Alltoall since that requires
-         * placing all the filenames in a single buffer.
+        /* Distribute the metadata (but not the contents) of the blob files.
+         * This is not done with MPI_Alltoall since that requires placing all
+         * the filenames in a single buffer. The path of a remote file is
+         * only informative: each file is read via its producing rank, which
+         * is also the only rank that owns (and hence deletes) it.
          */
         for (int i = 0; i < size; i++)
         {
             std::tr1::uint64_t nBlobs = blobFile.nBlobs;
             boost::filesystem::path path = blobFile.path;
+            int compressed = blobFile.compressed ? 1 : 0;
 
             MPI_Bcast(&nBlobs, 1, Serialize::mpi_type_traits<std::tr1::uint64_t>::type(),
                       i, comm);
             Serialize::broadcast(path, comm, i);
+            MPI_Bcast(&compressed, 1, MPI_INT, i, comm);
             this->blobFiles.push_back(typename FastBlobSet<Base>::BlobFile());
             this->blobFiles.back().path = path;
             this->blobFiles.back().nBlobs = nBlobs;
-            this->blobFiles.back().owner = (rank == root);
-            MPI_Barrier(comm); // ensures that the master takes ownership before the worker releases it
+            this->blobFiles.back().owner = (i == rank);
+            this->blobFiles.back().compressed = (compressed != 0);
             if (i == rank)
-                blobFile.owner = false;
+                blobFile.owner = false; // ownership now held by the blobFiles entry
         }
+
+        serviceComm = comm;
+        serviceRank = rank;
+        server.reset(new BlobServerMPI(comm, this->blobFiles[rank].path));
+        server->start();
     }
     catch (std::exception &e)
     {
@@ -34,6 +34,7 @@
 #include <xmmintrin.h>
 #include <emmintrin.h>
 #include <limits>
+#include <algorithm>
 #include "tr1_cstdint.h"
 #include "splat.h"
 #include "misc.h"
@@ -114,6 +115,80 @@ void SplatToBuckets::operator()(
     divide(hiCell, upper);
 }
 
+void SplatToBuckets::operator()(
+    const Splat *splats, std::size_t count,
+    boost::array<Grid::difference_type, 3> *lower,
+    boost::array<Grid::difference_type, 3> *upper) const
+{
+    unsigned int csrOrig = _mm_getcsr();
+    unsigned int csrDown = (csrOrig & ~_MM_ROUND_MASK) | _MM_ROUND_DOWN;
+
+    /* Number of splats handled per rounding-mode switch. The scaled extents
+     * are staged through a buffer so that only the conversions run under
+     * round-down (see below); it is sized to stay comfortably in L1 cache.
+     */
+    const std::size_t chunkSize = 64;
+    // The unions are just to force alignment - we never use the vector members
+    union
+    {
+        float f[chunkSize * 8];
+        __m128 dummy;
+    } world;
+    union
+    {
+        std::tr1::int32_t v[chunkSize * 8];
+        __m128i dummy;
+    } cell;
+
+    for (std::size_t start = 0; start < count; start += chunkSize)
+    {
+        const std::size_t n = std::min(chunkSize, count - start);
+
+        /* Compute the scaled bounding boxes under the ambient rounding
+         * mode, exactly as the single-splat overload does: only the
+         * float-to-int conversions may round down.
+         */
+        for (std::size_t i = 0; i < n; i++)
+        {
+            const Splat &splat = splats[start + i];
+            __m128 position = _mm_loadu_ps(splat.position);
+            __m128 radius = _mm_load1_ps(&splat.radius);
+            __m128 loWorld = _mm_mul_ps(_mm_sub_ps(position, radius), invSpacing);
+            __m128 hiWorld = _mm_mul_ps(_mm_add_ps(position, radius), invSpacing);
+            _mm_store_ps(world.f + i * 8, loWorld);
+            _mm_store_ps(world.f + i * 8 + 4, hiWorld);
+        }
+
+        /* Switch to round-down once for the whole chunk. See the
+         * single-splat overload for why this is inline asm rather than
+         * _MM_SET_ROUNDING_MODE; the memory clobbers additionally stop the
+         * compiler from sinking the arithmetic above into the round-down
+         * region, and the conversions are themselves volatile asm so that
+         * they cannot migrate past either mode switch.
+         */
+        asm volatile("ldmxcsr %0" : : "m" (csrDown) : "memory");
+        for (std::size_t i = 0; i < n * 2; i++)
+        {
+            __m128i converted;
+            asm volatile(
+                "cvtps2dq %1, %0"
+                : "=x" (converted)
+                : "x" (_mm_load_ps(world.f + i * 4)));
+            _mm_store_si128((__m128i *) (cell.v + i * 4), converted);
+        }
+        asm volatile("ldmxcsr %0" : : "m" (csrOrig) : "memory");
+
+        /* The reciprocal-multiply division is mode-independent, and divide
+         * can throw, so it runs only once the original mode is restored.
+         */
+        for (std::size_t i = 0; i < n; i++)
+        {
+            divide(_mm_load_si128((const __m128i *) (cell.v + i * 8)), lower[start + i]);
+            divide(_mm_load_si128((const __m128i *) (cell.v + i * 8 + 4)), upper[start + i]);
+        }
+    }
+}
+
 SplatToBuckets::SplatToBuckets(float spacing, Grid::size_type bucketSize)
 {
     float invSpacing1 = 1.0f / spacing;
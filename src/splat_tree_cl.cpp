@@ -38,6 +38,7 @@
 #include "tr1_cstdint.h"
 #include <limits>
 #include <vector>
+#include <algorithm>
 #include "tr1_cstdint.h"
 #include "splat_tree_cl.h"
 #include "splat.h"
@@ -53,8 +54,53 @@ void SplatTreeCL::validateDevice(const cl::Device &device)
         throw CLH::invalid_device(device, "image support is required");
 }
 
+SplatTreeCL::BuildScratch::BuildScratch(
+    const cl::Context &context,
+    std::size_t maxLevels, std::size_t maxSplats, std::size_t maxBatch)
+    : maxLevels(maxLevels), maxSplats(maxSplats), maxBatch(maxBatch)
+{
+    MLSGPU_ASSERT(1 <= maxLevels && maxLevels <= MAX_LEVELS, std::length_error);
+    MLSGPU_ASSERT(1 <= maxSplats && maxSplats <= MAX_SPLATS, std::length_error);
+    MLSGPU_ASSERT(1 <= maxBatch && maxBatch <= MAX_BATCH, std::length_error);
+    const std::tr1::uint64_t maxStart = (std::tr1::uint64_t(1) << (3 * maxLevels)) / 7;
+
+    // If this section is modified, remember to update resourceUsage below
+    jumpPos = cl::Buffer(context, CL_MEM_READ_WRITE, maxBatch * maxStart * sizeof(command_type));
+    commandMap = cl::Buffer(context, CL_MEM_READ_WRITE, maxSplats * 8 * sizeof(command_type));
+    entryKeys = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(code_type));
+    entryValues = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(command_type));
+    binInfo = cl::Buffer(context, CL_MEM_READ_ONLY, maxBatch * sizeof(KernelBin));
+}
+
+CLH::ResourceUsage SplatTreeCL::BuildScratch::resourceUsage(
+    const std::size_t maxLevels, const std::size_t maxSplats, const std::size_t maxBatch)
+{
+    MLSGPU_ASSERT(1 <= maxLevels && maxLevels <= MAX_LEVELS, std::length_error);
+    MLSGPU_ASSERT(1 <= maxSplats && maxSplats <= MAX_SPLATS, std::length_error);
+    MLSGPU_ASSERT(1 <= maxBatch && maxBatch <= MAX_BATCH, std::length_error);
+    const std::tr1::uint64_t maxStart = (std::tr1::uint64_t(1) << (3 * maxLevels)) / 7;
+
+    CLH::ResourceUsage ans;
+
+    // Keep this up to date with the actual allocations above
+
+    // jumpPos = cl::Buffer(context, CL_MEM_READ_WRITE, maxBatch * maxStart * sizeof(command_type));
+    ans.addBuffer("jumpPos", maxBatch * maxStart * sizeof(command_type));
+    // commandMap = cl::Buffer(context, CL_MEM_READ_WRITE, maxSplats * 8 * sizeof(command_type));
+    ans.addBuffer("commandMap", maxSplats * 8 * sizeof(command_type));
+    // entryKeys = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(code_type));
+    ans.addBuffer("entryKeys", (maxSplats * 8) * sizeof(code_type));
+    // entryValues = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(command_type));
+    ans.addBuffer("entryValues", (maxSplats * 8) * sizeof(command_type));
+    // binInfo = cl::Buffer(context, CL_MEM_READ_ONLY, maxBatch * sizeof(KernelBin));
+    ans.addBuffer("binInfo", maxBatch * sizeof(KernelBin));
+
+    return ans;
+}
+
 CLH::ResourceUsage SplatTreeCL::resourceUsage(
-    const cl::Device &device, const std::size_t maxLevels, const std::size_t maxSplats)
+    const cl::Device &device, const std::size_t maxLevels, const std::size_t maxSplats,
+    const std::size_t maxBatch, bool includeScratch)
 {
     /* Not currently used, although it should be to determine constant overheads in
      * the clogs primitives.
@@ -63,6 +109,7 @@ CLH::ResourceUsage SplatTreeCL::resourceUsage(
 
     MLSGPU_ASSERT(1 <= maxLevels && maxLevels <= MAX_LEVELS, std::length_error);
     MLSGPU_ASSERT(1 <= maxSplats && maxSplats <= MAX_SPLATS, std::length_error);
+    MLSGPU_ASSERT(1 <= maxBatch && maxBatch <= MAX_BATCH, std::length_error);
     const std::tr1::uint64_t maxStart = (std::tr1::uint64_t(1) << (3 * maxLevels)) / 7;
     const std::size_t maxRanges = std::min(maxStart, std::tr1::uint64_t(8 * maxSplats));
 
@@ -70,18 +117,13 @@ CLH::ResourceUsage SplatTreeCL::resourceUsage(
 
     // Keep this up to date with the actual allocations below
 
-    // start = cl::Buffer(context, CL_MEM_READ_WRITE, maxStart * sizeof(command_type));
-    ans.addBuffer("start", maxStart * sizeof(command_type));
-    // jumpPos = cl::Buffer(context, CL_MEM_READ_WRITE, maxStart * sizeof(command_type));
-    ans.addBuffer("jumpPos", maxStart * sizeof(command_type));
+    // start = cl::Buffer(context, CL_MEM_READ_WRITE, maxBatch * maxStart * sizeof(command_type));
+    ans.addBuffer("start", maxBatch * maxStart * sizeof(command_type));
     // commands = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8 + maxRanges * 2) * sizeof(command_type));
     ans.addBuffer("commands", (maxSplats * 8 + maxRanges * 2) * sizeof(command_type));
-    // commandMap = cl::Buffer(context, CL_MEM_READ_WRITE, maxSplats * 8 * sizeof(command_type));
-    ans.addBuffer("commandMap", maxSplats * 8 * sizeof(command_type));
-    // entryKeys = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(code_type));
-    ans.addBuffer("entryKeys", (maxSplats * 8) * sizeof(code_type));
-    // entryValues = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(command_type));
-    ans.addBuffer("entryValues", (maxSplats * 8) * sizeof(command_type));
+
+    if (includeScratch)
+        ans += BuildScratch::resourceUsage(maxLevels, maxSplats, maxBatch);
 
     // TODO: add in constant overheads for the scan and sort primitives
 
@@ -89,7 +131,9 @@ CLH::ResourceUsage SplatTreeCL::resourceUsage(
 }
 
 SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
-                         std::size_t maxLevels, std::size_t maxSplats)
+                         std::size_t maxLevels, std::size_t maxSplats,
+                         std::size_t maxBatch,
+                         boost::shared_ptr<BuildScratch> scratch)
     :
     writeEntriesKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeEntries.time")),
     countCommandsKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.countCommands.time")),
@@ -97,14 +141,25 @@ SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
     writeStartKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeStart.time")),
     writeStartTopKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.writeStartTop.time")),
     fillKernelTime(Statistics::getStatistic<Statistics::Variable>("kernel.octree.fill.time")),
-    maxSplats(maxSplats), maxLevels(maxLevels), numSplats(0),
-    sort(context, device, clogs::TYPE_UINT, clogs::TYPE_INT),
+    scratch(scratch),
+    maxSplats(maxSplats), maxLevels(maxLevels), maxBatch(maxBatch),
+    numSplats(0), splatStride(0), numStart(0),
+    sort(KeyValueSort::create(context, device)),
     scan(context, device, clogs::TYPE_UINT)
 {
     MLSGPU_ASSERT(1 <= maxSplats && maxSplats <= MAX_SPLATS, std::length_error);
     MLSGPU_ASSERT(1 <= maxLevels && maxLevels <= MAX_LEVELS, std::length_error);
+    MLSGPU_ASSERT(1 <= maxBatch && maxBatch <= MAX_BATCH, std::length_error);
+    if (scratch)
+    {
+        MLSGPU_ASSERT(scratch->maxLevels >= maxLevels, std::length_error);
+        MLSGPU_ASSERT(scratch->maxSplats >= maxSplats, std::length_error);
+        MLSGPU_ASSERT(scratch->maxBatch >= maxBatch, std::length_error);
+    }
+    else
+        this->scratch.reset(new BuildScratch(context, maxLevels, maxSplats, maxBatch));
 
-    sort.setEventCallback(
+    sort->setEventCallback(
         &Statistics::timeEventCallback,
         &Statistics::getStatistic<Statistics::Variable>("kernel.octree.sort.time"));
     scan.setEventCallback(
@@ -114,19 +169,16 @@ SplatTreeCL::SplatTreeCL(const cl::Context &context, const cl::Device &device,
     const std::tr1::uint64_t maxStart = (std::tr1::uint64_t(1) << (3 * maxLevels)) / 7;
     const std::size_t maxRanges = std::min(maxStart, std::tr1::uint64_t(8 * maxSplats));
 
-    // If this section is modified, remember to update deviceMemory above
-    start = cl::Buffer(context, CL_MEM_READ_WRITE, maxStart * sizeof(command_type));
-    jumpPos = cl::Buffer(context, CL_MEM_READ_WRITE, maxStart * sizeof(command_type));
+    // If this section is modified, remember to update resourceUsage above
+    start = cl::Buffer(context, CL_MEM_READ_WRITE, maxBatch * maxStart * sizeof(command_type));
     commands = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8 + maxRanges * 2) * sizeof(command_type));
-    commandMap = cl::Buffer(context, CL_MEM_READ_WRITE, maxSplats * 8 * sizeof(command_type));
-    entryKeys = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(code_type));
-    entryValues = cl::Buffer(context, CL_MEM_READ_WRITE, (maxSplats * 8) * sizeof(command_type));
+    hostBins.resize(maxBatch);
 
     // Ensure that commands will be big enough to act as a temporary buffer
     BOOST_STATIC_ASSERT(sizeof(command_type) >= sizeof(code_type));
     // These buffers are not live during the sort, so we save memory by using them as
     // temporary buffers for the sort.
-    sort.setTemporaryBuffers(commands, commandMap);
+    sort->setTemporaryBuffers(commands, this->scratch->commandMap);
 
     std::map<std::string, std::string> defines;
     defines["MAX_LEVELS"] = boost::lexical_cast<std::string>(maxLevels);
@@ -145,24 +197,22 @@ void SplatTreeCL::enqueueWriteEntries(
     const cl::Buffer &keys,
     const cl::Buffer &values,
     const cl::Buffer &splats,
-    command_type firstSplat,
+    const cl::Buffer &binInfo,
+    std::size_t numBins,
     command_type numSplats,
-    const Grid::difference_type offset[3],
     std::size_t minShift,
     std::size_t maxShift,
     const std::vector<cl::Event> *events,
     cl::Event *event)
 {
-    cl_int3 offset3 = {{ offset[0], offset[1], offset[2] }};
-
     writeEntriesKernel.setArg(0, keys);
     writeEntriesKernel.setArg(1, values);
     writeEntriesKernel.setArg(2, splats);
-    writeEntriesKernel.setArg(3, offset3);
-    writeEntriesKernel.setArg(4, cl::__local(sizeof(code_type) * (maxShift + 1)));
-    writeEntriesKernel.setArg(5, (cl_uint) minShift);
-    writeEntriesKernel.setArg(6, (cl_uint) maxShift);
-    writeEntriesKernel.setArg(7, (cl_uint) firstSplat);
+    writeEntriesKernel.setArg(3, binInfo);
+    writeEntriesKernel.setArg(4, (cl_uint) numBins);
+    writeEntriesKernel.setArg(5, cl::__local(sizeof(code_type) * (maxShift + 1)));
+    writeEntriesKernel.setArg(6, (cl_uint) minShift);
+    writeEntriesKernel.setArg(7, (cl_uint) maxShift);
 
     CLH::enqueueNDRangeKernel(queue,
                               writeEntriesKernel,
@@ -244,6 +294,8 @@ void SplatTreeCL::enqueueWriteStart(
     code_type curOffset,
     bool havePrev,
     code_type prevOffset,
+    code_type levelSize,
+    code_type stride,
     code_type numCodes,
     const std::vector<cl::Event> *events,
     cl::Event *event)
@@ -255,7 +307,16 @@ void SplatTreeCL::enqueueWriteStart(
     kernel.setArg(2, jumpPos);
     kernel.setArg(3, curOffset);
     if (havePrev)
+    {
         kernel.setArg(4, prevOffset);
+        kernel.setArg(5, levelSize);
+        kernel.setArg(6, stride);
+    }
+    else
+    {
+        kernel.setArg(4, levelSize);
+        kernel.setArg(5, stride);
+    }
 
     CLH::enqueueNDRangeKernel(queue,
                               kernel,
@@ -268,24 +329,44 @@ void SplatTreeCL::enqueueWriteStart(
 
 void SplatTreeCL::enqueueBuild(
     const cl::CommandQueue &queue,
-    const cl::Buffer &splats, std::size_t firstSplat, std::size_t numSplats,
-    const Grid::size_type size[3], const Grid::difference_type offset[3],
+    const cl::Buffer &splats, std::size_t splatStride,
+    const Bin *bins, std::size_t numBins,
     unsigned int subsamplingShift,
     const std::vector<cl::Event> *events,
     cl::Event *event)
 {
-    MLSGPU_ASSERT(numSplats <= maxSplats, std::length_error);
-    MLSGPU_ASSERT(firstSplat < CL_UINT_MAX - numSplats, std::length_error);
-    Grid::size_type maxSize = Grid::size_type(1U) << (maxLevels + subsamplingShift - 1);
-    MLSGPU_ASSERT(size[0] <= maxSize && size[1] <= maxSize && size[2] <= maxSize,
-                  std::length_error);
+    MLSGPU_ASSERT(1 <= numBins && numBins <= maxBatch, std::length_error);
     unsigned int maxShift = maxLevels + subsamplingShift - 1;
     unsigned int minShift = std::min(subsamplingShift, maxShift);
-    // TODO: this will always construct a full-size octree, even if size[] only
-    // specifies a much smaller space. At a minimum, it should be possible to make
-    // levelOffsets more compact.
+    const Grid::size_type maxSize = Grid::size_type(1U) << maxShift;
 
-    this->numSplats = numSplats;
+    std::size_t totalSplats = 0;
+    for (std::size_t i = 0; i < numBins; i++)
+    {
+        MLSGPU_ASSERT(bins[i].firstSplat < CL_UINT_MAX - bins[i].numSplats, std::length_error);
+        MLSGPU_ASSERT(bins[i].firstSplat + bins[i].numSplats <= splatStride, std::out_of_range);
+        MLSGPU_ASSERT(bins[i].size[0] <= maxSize && bins[i].size[1] <= maxSize && bins[i].size[2] <= maxSize,
+                      std::length_error);
+        totalSplats += bins[i].numSplats;
+    }
+    MLSGPU_ASSERT(totalSplats <= maxSplats, std::length_error);
+
+    /* Shrink the tree to fit the largest bin in the batch instead of always
+     * building the worst-case size. The kernels are parameterized on the
+     * shifts and already clip entries outside the octree bounds, so only the
+     * host-side level layout needs to change. This trims the levels, the
+     * jump-position fill, the start writes and the sort key bits when the
+     * bins are smaller than the maximum block, which is the common case for
+     * fine bucketing configurations.
+     */
+    Grid::size_type maxDim = 1;
+    for (std::size_t i = 0; i < numBins; i++)
+        for (unsigned int j = 0; j < 3; j++)
+            maxDim = std::max(maxDim, bins[i].size[j]);
+    while (maxShift > minShift && (Grid::size_type(1) << (maxShift - 1)) >= maxDim)
+        maxShift--;
+
+    this->numSplats = totalSplats;
     std::size_t pos = 0;
     levelOffsets.resize(maxShift + 1);
     for (std::size_t i = minShift; i <= maxShift; i++)
@@ -293,45 +374,102 @@ void SplatTreeCL::enqueueBuild(
         levelOffsets[i] = pos;
         pos += 1U << (3 * (maxShift - i));
     }
-    std::size_t numStart = pos;
+    numStart = pos;
 
-    std::vector<cl::Event> wait(1);
+    /* Per-bin constants for writeEntries. Bin i's keys are biased by
+     * i * numStart so that a single sort of the batch leaves each bin's
+     * entries contiguous, with UINT_MAX still strictly greater than any
+     * valid key.
+     */
+    std::size_t firstEntry = 0;
+    for (std::size_t i = 0; i < numBins; i++)
+    {
+        KernelBin &kb = hostBins[i];
+        for (unsigned int j = 0; j < 3; j++)
+            kb.bias[j] = bins[i].offset[j];
+        kb.bias[3] = 0;
+        kb.keyOffset = code_type(i * numStart);
+        kb.firstEntry = firstEntry;
+        kb.firstSplat = bins[i].firstSplat;
+        kb.pad = 0;
+        firstEntry += bins[i].numSplats;
+    }
+
+    /* Number of bits in the biased keys, to bound the radix sort. The bound
+     * is already computed from the bins' actual extents: maxShift was reduced
+     * above to fit the largest bin, and the batch bias adds just enough bits
+     * for the bin count. Per-bin widths cannot be narrower than this, because
+     * every bin in a batch shares the level count (the start array is written
+     * with a uniform per-bin stride).
+     *
+     * Clipped entries carry a key of UINT_MAX, and the sort orders by only
+     * the low keyBits bits, so the all-ones value must remain strictly
+     * greater than every valid key; hence the + 1, without which a batch
+     * whose total code count is exactly a power of two would let sentinels
+     * sort amongst the last bin's root entries.
+     */
+    unsigned int keyBits = 3 * (maxShift - minShift) + 1;
+    while ((std::size_t(1) << keyBits) < numBins * numStart + 1)
+        keyBits++;
 
-    cl::Event writeEntriesEvent, sortEvent, countEvent, scanEvent,
-        writeSplatIdsEvent, levelEvent, fillJumpPosEvent;
     this->splats = splats;
+    this->splatStride = splatStride;
+
+    /* The queue is required to be in-order (see @ref BuildScratch), so the
+     * commands are ordered without any per-command event chaining: the
+     * caller's wait list is attached to the first command and an event is
+     * requested only for the last. This keeps the host-side cost of a build
+     * to the bare enqueues, which matters when the bins are small enough
+     * for launch overhead to dominate.
+     *
+     * hostBins is a member, so it remains valid until the transfer completes
+     * (enqueueBuild may not be called again until the previous build is done).
+     */
+    queue.enqueueWriteBuffer(scratch->binInfo, CL_FALSE, 0, numBins * sizeof(KernelBin), &hostBins[0],
+                             events, NULL);
 
-    // TODO: revisit this dependency tracking
-    const std::size_t numEntries = numSplats * 8;
-    enqueueWriteEntries(queue, entryKeys, entryValues, this->splats, firstSplat, numSplats, offset, minShift, maxShift, events, &writeEntriesEvent);
-    wait[0] = writeEntriesEvent;
-    sort.enqueue(queue, entryKeys, entryValues, numEntries, 3 * (maxShift - minShift) + 1, &wait, &sortEvent);
-    wait[0] = sortEvent;
-    enqueueCountCommands(queue, commandMap, entryKeys, numEntries, &wait, &countEvent);
-    wait[0] = countEvent;
+    const std::size_t numEntries = totalSplats * 8;
+    enqueueWriteEntries(queue, scratch->entryKeys, scratch->entryValues, this->splats, scratch->binInfo, numBins, totalSplats, minShift, maxShift, NULL, NULL);
+    sort->enqueue(queue, scratch->entryKeys, scratch->entryValues, numEntries, keyBits, NULL, NULL);
+    enqueueCountCommands(queue, scratch->commandMap, scratch->entryKeys, numEntries, NULL, NULL);
     const command_type scanOffset = 1; // make room for the first end pointer
-    scan.enqueue(queue, commandMap, numEntries, &scanOffset, &wait, &scanEvent);
-    wait[0] = scanEvent;
-    enqueueFill(queue, jumpPos, 0, numStart, (command_type) -1, &wait, &fillJumpPosEvent);
-    wait[0] = fillJumpPosEvent;
-    enqueueWriteSplatIds(queue, commands, start, jumpPos, commandMap, entryKeys, entryValues, numEntries, &wait, &writeSplatIdsEvent);
-    wait[0] = writeSplatIdsEvent;
+    scan.enqueue(queue, scratch->commandMap, numEntries, &scanOffset, NULL, NULL);
+    enqueueFill(queue, scratch->jumpPos, 0, numBins * numStart, (command_type) -1, NULL, NULL);
+    enqueueWriteSplatIds(queue, commands, start, scratch->jumpPos, scratch->commandMap, scratch->entryKeys, scratch->entryValues, numEntries, NULL, NULL);
 
     for (int i = maxShift; i >= int(minShift); i--)
     {
         std::size_t levelSize = std::size_t(1) << (3 * (maxShift - i));
         bool havePrev = (i != int(maxShift));
-        enqueueWriteStart(queue, start, commands, jumpPos,
+        bool last = (i == int(minShift));
+        enqueueWriteStart(queue, start, commands, scratch->jumpPos,
                           levelOffsets[i],
                           havePrev,
                           havePrev ? levelOffsets[i + 1] : 0,
-                          levelSize,
-                          &wait, &levelEvent);
-        wait[0] = levelEvent;
+                          levelSize, numStart,
+                          levelSize * numBins,
+                          NULL, last ? event : NULL);
     }
+}
 
-    if (event != NULL)
-        *event = wait[0];
+void SplatTreeCL::enqueueBuild(
+    const cl::CommandQueue &queue,
+    const cl::Buffer &splats, std::size_t splatStride,
+    std::size_t firstSplat, std::size_t numSplats,
+    const Grid::size_type size[3], const Grid::difference_type offset[3],
+    unsigned int subsamplingShift,
+    const std::vector<cl::Event> *events,
+    cl::Event *event)
+{
+    Bin bin;
+    bin.firstSplat = firstSplat;
+    bin.numSplats = numSplats;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        bin.size[i] = size[i];
+        bin.offset[i] = offset[i];
+    }
+    enqueueBuild(queue, splats, splatStride, &bin, 1, subsamplingShift, events, event);
 }
 
 void SplatTreeCL::clearSplats()
@@ -35,10 +35,12 @@
 #include <utility>
 #include <boost/noncopyable.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
 #include <clogs/clogs.h>
 #include "splat_tree.h"
 #include "clh.h"
 #include "grid.h"
+#include "sort_cl.h"
 #include "statistics.h"
 
 /**
@@ -48,6 +50,12 @@
  *
  * To ease implementation, levels are numbered backwards i.e. level 0 is the
  * largest, finest-grained level, and the last level is 1x1x1.
+ *
+ * Several independent octrees (one per bin) can be built with a single batch
+ * of kernel launches. This amortizes kernel launch overheads when the
+ * individual bins are small. The octrees for a batch are stored
+ * back-to-back in the start array; @ref getStartBase gives the offset for
+ * each bin.
  */
 class SplatTreeCL : public boost::noncopyable
 {
@@ -88,7 +96,96 @@ public:
         MAX_SPLATS = 0x7FFFFFFF / 16
     };
 
+    enum
+    {
+        /**
+         * The maximum legal value for @a maxBatch passed to the constructor.
+         * This value guarantees that the biased sort keys for the last bin of
+         * a batch still fit in @ref code_type (with the maximum key reserved
+         * as a sentinel), even when @a maxLevels is @ref MAX_LEVELS.
+         */
+        MAX_BATCH = 8
+    };
+
+    /**
+     * Description of one bin in a batched build. The octrees for several
+     * bins are built with a single sequence of kernel launches, which
+     * amortizes kernel launch overheads when the bins are small.
+     */
+    struct Bin
+    {
+        std::size_t firstSplat;           ///< Index of the first splat in the bin
+        std::size_t numSplats;            ///< Number of splats in the bin
+        Grid::size_type size[3];          ///< The number of cells to cover with the octree
+        Grid::difference_type offset[3];  ///< The offset of the octree within the overall grid
+    };
+
+    /**
+     * Intermediate device buffers used only while @ref enqueueBuild is in
+     * progress. By default each @ref SplatTreeCL owns a private set, but
+     * when several instances are pipelined (so that one octree can be
+     * traversed while the next is built), a single set may be shared between
+     * them: the caller must enqueue all the builds on one in-order command
+     * queue, which makes the builds mutually exclusive and hence the scratch
+     * buffers free for reuse. Sharing eliminates the largest per-instance
+     * allocations, so more device memory is available for raising the splat
+     * and batch limits.
+     */
+    class BuildScratch : public boost::noncopyable
+    {
+        friend class SplatTreeCL;
+    private:
+        cl::Buffer commandMap;   ///< Maps sorted entries to positions in the command array
+        cl::Buffer jumpPos;      ///< Position in command array of jump command for each key (-1 if not present)
+        cl::Buffer entryKeys;    ///< Sort keys for entries
+        cl::Buffer entryValues;  ///< Splat IDs for entries
+        cl::Buffer binInfo;      ///< Per-bin constants for the writeEntries kernel
+
+        std::size_t maxLevels;   ///< Maximum levels for which memory has been allocated
+        std::size_t maxSplats;   ///< Maximum splats for which memory has been allocated
+        std::size_t maxBatch;    ///< Maximum bins per batch for which memory has been allocated
+
+    public:
+        /**
+         * Constructor. The limits must be at least as large as those of
+         * every @ref SplatTreeCL that will use this scratch.
+         *
+         * @param context   OpenCL context used to create the buffers.
+         * @param maxLevels Maximum number of octree levels.
+         * @param maxSplats Maximum number of splats supported, summed over a batch.
+         * @param maxBatch  Maximum number of bins per batched build.
+         *
+         * @pre
+         * - 1 <= @a maxLevels <= @ref MAX_LEVELS
+         * - 1 <= @a maxSplats <= @ref MAX_SPLATS
+         * - 1 <= @a maxBatch <= @ref MAX_BATCH.
+         */
+        BuildScratch(const cl::Context &context,
+                     std::size_t maxLevels, std::size_t maxSplats,
+                     std::size_t maxBatch = 1);
+
+        /**
+         * Estimates the device resources needed, based on the constructor
+         * arguments.
+         */
+        static CLH::ResourceUsage resourceUsage(
+            std::size_t maxLevels, std::size_t maxSplats, std::size_t maxBatch = 1);
+    };
+
 private:
+    /**
+     * Per-bin constants passed to the writeEntries kernel. This must match
+     * the layout of the @c BuildBin structure in @ref octree.cl.
+     */
+    struct KernelBin
+    {
+        cl_int bias[4];       ///< Offset of the bin's octree within the overall grid (fourth element unused)
+        cl_uint keyOffset;    ///< Amount added to codes to separate the bin's keys from other bins'
+        cl_uint firstEntry;   ///< First workitem index belonging to the bin
+        cl_uint firstSplat;   ///< Index of the bin's first splat in the splats buffer
+        cl_uint pad;          ///< Padding to match OpenCL structure alignment
+    };
+
     /**
      * @name
      * @{
@@ -126,26 +223,30 @@ private:
     /** @} */
 
     /**
-     * @name
-     * @{
      * Intermediate data structures used while building the octree.
      *
      * These are never deleted, so that the memory can be recycled each
-     * time the octree is regenerated.
+     * time the octree is regenerated. They may be shared with other
+     * instances (see @ref BuildScratch).
      */
-    cl::Buffer commandMap;   ///< Maps sorted entries to positions in the command array
-    cl::Buffer jumpPos;      ///< Position in command array of jump command for each key (-1 if not present)
-    cl::Buffer entryKeys;    ///< Sort keys for entries
-    cl::Buffer entryValues;  ///< Splat IDs for entries
-    /** @} */
+    boost::shared_ptr<BuildScratch> scratch;
 
     std::size_t maxSplats;   ///< Maximum splats for which memory has been allocated
     std::size_t maxLevels;   ///< Maximum levels for which memory has been allocated
+    std::size_t maxBatch;    ///< Maximum bins per batch for which memory has been allocated
 
-    std::size_t numSplats;   ///< Number of splats in the octree
+    std::size_t numSplats;   ///< Number of splats in the octree(s)
+    std::size_t splatStride; ///< Plane stride of @ref splats (see @ref getSplatStride)
+    std::size_t numStart;    ///< Number of start entries for one octree of the current build
     std::vector<std::size_t> levelOffsets; ///< Start of each level in compacted arrays
 
-    clogs::Radixsort sort;   ///< Sorter for sorting the entries
+    /**
+     * Staging area for @ref BuildScratch::binInfo. It is a member rather than a local
+     * so that it remains valid until the (asynchronous) upload completes.
+     */
+    std::vector<KernelBin> hostBins;
+
+    boost::scoped_ptr<KeyValueSort> sort; ///< Sorter for sorting the entries (see @ref KeyValueSort::create)
     clogs::Scan scan;        ///< Scanner for computing @ref commandMap
 
     /// Wrapper to call @ref writeEntries
@@ -153,9 +254,9 @@ private:
                              const cl::Buffer &keys,
                              const cl::Buffer &values,
                              const cl::Buffer &splats,
-                             command_type firstSplat,
+                             const cl::Buffer &binInfo,
+                             std::size_t numBins,
                              command_type numSplats,
-                             const Grid::difference_type offset[3],
                              std::size_t minShift,
                              std::size_t maxShift,
                              const std::vector<cl::Event> *events,
@@ -193,6 +294,8 @@ private:
                            code_type curOffset,
                            bool havePrev,
                            code_type prevOffset,
+                           code_type levelSize,
+                           code_type stride,
                            code_type numCodes,
                            const std::vector<cl::Event> *events,
                            cl::Event *event);
@@ -219,12 +322,19 @@ public:
      * Estimates the device resources needed, based on the constructor
      * arguments.
      *
+     * @param includeScratch  If false, the buffers provided by a shared
+     *                  @ref BuildScratch are excluded; callers sharing one
+     *                  scratch set between several instances should add
+     *                  @ref BuildScratch::resourceUsage once instead.
+     *
      * @pre
      * - 1 <= @a maxLevels <= @ref MAX_LEVELS
-     * - 1 <= @a maxSplats <= @ref MAX_SPLATS.
+     * - 1 <= @a maxSplats <= @ref MAX_SPLATS
+     * - 1 <= @a maxBatch <= @ref MAX_BATCH.
      */
     static CLH::ResourceUsage resourceUsage(
-        const cl::Device &device, std::size_t maxLevels, std::size_t maxSplats);
+        const cl::Device &device, std::size_t maxLevels, std::size_t maxSplats,
+        std::size_t maxBatch = 1, bool includeScratch = true);
 
     /**
      * Constructor. This allocates the maximum supported sizes for all the
@@ -233,23 +343,75 @@ public:
      * @param context   OpenCL context used to create buffers, images etc.
      * @param device    OpenCL device used to specialise kernels.
      * @param maxLevels Maximum number of octree levels (maximum dimension is 2^<sup>@a maxLevels - 1</sup>).
-     * @param maxSplats Maximum number of splats supported.
+     * @param maxSplats Maximum number of splats supported, summed over a batch.
+     * @param maxBatch  Maximum number of bins per batched build.
+     * @param scratch   Build-time scratch buffers to share with other
+     *                  instances (see @ref BuildScratch). If null, a private
+     *                  set is allocated.
      *
      * @pre
      * - 1 <= @a maxLevels <= @ref MAX_LEVELS
-     * - 1 <= @a maxSplats <= @ref MAX_SPLATS.
+     * - 1 <= @a maxSplats <= @ref MAX_SPLATS
+     * - 1 <= @a maxBatch <= @ref MAX_BATCH.
+     * - If @a scratch is non-null, its limits are at least as large as the
+     *   corresponding arguments.
      */
     SplatTreeCL(const cl::Context &context, const cl::Device &device,
-                std::size_t maxLevels, std::size_t maxSplats);
+                std::size_t maxLevels, std::size_t maxSplats,
+                std::size_t maxBatch = 1,
+                boost::shared_ptr<BuildScratch> scratch = boost::shared_ptr<BuildScratch>());
 
     /**
-     * Asynchronously builds the octree, discarding any previous contents.
+     * Asynchronously builds one octree per bin, discarding any previous
+     * contents. All the octrees are built with a single sequence of kernel
+     * launches, so the launch overheads are amortized over the batch. The
+     * octrees are sized to fit the largest bin in the batch rather than the
+     * worst case, so the level count (see @ref getNumLevels) varies from
+     * batch to batch.
      *
      * This must not be called while either a previous #enqueueBuild is still in
-     * progress, or while the octree is being traversed.
+     * progress, or while any of the octrees are being traversed.
+     *
+     * @param queue         The command queue for the building operations.
+     * @param splats        The splats to use in the octrees, in the two-plane
+     *                      structure-of-arrays layout: a plane of
+     *                      position/radius values followed, @a splatStride
+     *                      float4 elements later, by a plane of
+     *                      normal/quality values.
+     * @param splatStride   Offset (in float4 elements) in @a splats from the
+     *                      position/radius plane to the normal/quality plane.
+     * @param bins          Descriptions of the bins, one octree per bin.
+     * @param numBins       Number of bins in the batch.
+     * @param subsamplingShift Number of fine levels to drop.
+     * @param events        Events to wait for (or @c NULL).
+     * @param[out] event    Event that fires when the octrees are ready to use (or @c NULL).
+     *
+     * @pre
+     * - @a queue is in-order. The commands are enqueued without internal
+     *   event chaining, relying on the queue to order them (this is already
+     *   required for scratch sharing; see @ref BuildScratch).
+     * - 1 <= @a numBins <= @a maxBatch.
+     * - Each bin's size is no more than 2^(maxLevels - subSamplingShift - 1) elements
+     *   in any direction.
+     * - The bins' splat ranges are disjoint, lie within [0, @a splatStride),
+     *   and together contain at most @a maxSplats splats (the splat radii are
+     *   rewritten in-place, so a splat may not belong to more than one bin).
+     *
+     * @note @a splats is not copied. It becomes the backing store of splats for the octrees.
+     */
+    void enqueueBuild(const cl::CommandQueue &queue,
+                      const cl::Buffer &splats, std::size_t splatStride,
+                      const Bin *bins, std::size_t numBins,
+                      unsigned int subsamplingShift,
+                      const std::vector<cl::Event> *events = NULL,
+                      cl::Event *event = NULL);
+
+    /**
+     * Convenience overload of @ref enqueueBuild for a single bin.
      *
      * @param queue         The command queue for the building operations.
-     * @param splats        The splats to use in the octree.
+     * @param splats        The splats to use in the octree (see the batched overload).
+     * @param splatStride   Offset in @a splats between the two planes (see the batched overload).
      * @param firstSplat    Index of the first splat to use.
      * @param numSplats     Number of splats to use from the @a splats array.
      * @param size          The number of cells to cover with the octree.
@@ -257,15 +419,10 @@ public:
      * @param subsamplingShift Number of fine levels to drop.
      * @param events        Events to wait for (or @c NULL).
      * @param[out] event    Event that fires when the octree is ready to use (or @c NULL).
-     *
-     * @pre
-     * - @a size is no more than 2^(maxLevels - subSamplingShift - 1) elements in any direction.
-     * - @a numSplats is at most @a maxSplats.
-     *
-     * @note @a splats is not copied. It becomes the backing store of splats for the octree.
      */
     void enqueueBuild(const cl::CommandQueue &queue,
-                      const cl::Buffer &splats, std::size_t firstSplat, std::size_t numSplats,
+                      const cl::Buffer &splats, std::size_t splatStride,
+                      std::size_t firstSplat, std::size_t numSplats,
                       const Grid::size_type size[3], const Grid::difference_type offset[3],
                       unsigned int subsamplingShift,
                       const std::vector<cl::Event> *events = NULL,
@@ -286,6 +443,23 @@ public:
      * @}
      */
 
+    /**
+     * Retrieve the plane stride passed to the last @ref enqueueBuild. It
+     * locates the normal/quality plane of the splats within @ref getSplats.
+     */
+    std::size_t getSplatStride() const { return splatStride; }
+
+    /**
+     * Retrieve the offset into the start array at which the octree for one
+     * bin of the most recent build begins.
+     *
+     * @pre @a bin is less than the number of bins passed to the last @ref enqueueBuild.
+     */
+    code_type getStartBase(std::size_t bin) const { return code_type(bin * numStart); }
+
+    /// Retrieve the maximum number of bins per batched build.
+    std::size_t getMaxBatch() const { return maxBatch; }
+
     /**
      * Drop the reference to the splats buffer. After calling this,
      * the tree must not be used until @ref enqueueBuild is called again.
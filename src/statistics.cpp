@@ -36,7 +36,9 @@
 
 #include <string>
 #include <stdexcept>
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <vector>
 #include <utility>
 #include <queue>
@@ -44,6 +46,7 @@
 #include <boost/foreach.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/ptr_container/serialize_ptr_map.hpp>
+#include <boost/serialization/vector.hpp>
 #include "statistics.h"
 
 namespace Statistics
@@ -126,27 +129,191 @@ void Counter::serialize(Archive &ar, const unsigned int)
 }
 
 
+const int Variable::histogramMinExp;
+const int Variable::histogramMaxExp;
+const int Variable::histogramSubBuckets;
+
 Variable::Variable(const std::string &name) : Statistic(name), sum(0.0), sum2(0.0), n(0)
 {
 }
 
+Variable::Shard::Shard(Variable *owner)
+    : owner(owner), sum(0.0), sum2(0.0), n(0)
+{
+    buckets.resize(owner->buckets.size());
+}
+
+Variable::Shard *Variable::makeShard()
+{
+    std::auto_ptr<Shard> s;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        s.reset(new Shard(this));
+        shards.push_back(s.get());
+    }
+    Shard *ans = s.release();
+    shard->reset(ans);
+    return ans;
+}
+
+void Variable::destroyShard(Shard *shard)
+{
+    Variable *owner = shard->owner;
+    boost::lock_guard<boost::mutex> lock(owner->mutex);
+    owner->sum += shard->sum;
+    owner->sum2 += shard->sum2;
+    owner->n += shard->n;
+    for (std::size_t i = 0; i < shard->buckets.size(); i++)
+        owner->buckets[i] += shard->buckets[i];
+    owner->shards.erase(
+        std::remove(owner->shards.begin(), owner->shards.end(), shard),
+        owner->shards.end());
+    delete shard;
+}
+
+void Variable::flushShardsUnlocked() const
+{
+    for (std::size_t i = 0; i < shards.size(); i++)
+    {
+        Shard &s = *shards[i];
+        boost::lock_guard<boost::mutex> lock(s.mutex);
+        sum += s.sum;
+        sum2 += s.sum2;
+        n += s.n;
+        s.sum = 0.0;
+        s.sum2 = 0.0;
+        s.n = 0;
+        for (std::size_t j = 0; j < s.buckets.size(); j++)
+        {
+            buckets[j] += s.buckets[j];
+            s.buckets[j] = 0;
+        }
+    }
+}
+
+void Variable::flushShards() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    flushShardsUnlocked();
+}
+
 void Variable::add(double value)
 {
+    if (shard)
+    {
+        Shard *s = shard->get();
+        if (s == NULL)
+            s = makeShard();
+        boost::lock_guard<boost::mutex> lock(s->mutex);
+        s->sum += value;
+        s->sum2 += value * value;
+        s->n++;
+        if (!s->buckets.empty())
+            s->buckets[bucketIndex(value)]++;
+        return;
+    }
+
     boost::lock_guard<boost::mutex> lock(mutex);
     sum += value;
     sum2 += value * value;
     n++;
+    if (!buckets.empty())
+        buckets[bucketIndex(value)]++;
+}
+
+void Variable::enableHistogram()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (buckets.empty())
+    {
+        const std::size_t size = std::size_t(histogramMaxExp - histogramMinExp) * histogramSubBuckets + 2;
+        buckets.resize(size);
+        for (std::size_t i = 0; i < shards.size(); i++)
+        {
+            boost::lock_guard<boost::mutex> shardLock(shards[i]->mutex);
+            shards[i]->buckets.resize(size);
+        }
+    }
+}
+
+void Variable::enableSharding()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!shard)
+        shard.reset(new boost::thread_specific_ptr<Shard>(&Variable::destroyShard));
+}
+
+std::size_t Variable::bucketIndex(double value) const
+{
+    if (!(value > 0.0))
+        return 0;   // also catches NaN
+    int e;
+    double m = std::frexp(value, &e);   // value = m . 2^e with m in [0.5, 1)
+    if (e <= histogramMinExp)
+        return 0;
+    if (e > histogramMaxExp)
+        return buckets.size() - 1;
+    int sub = int((m - 0.5) * (2 * histogramSubBuckets));
+    if (sub >= histogramSubBuckets)
+        sub = histogramSubBuckets - 1;  // protect against rounding up
+    return std::size_t(e - 1 - histogramMinExp) * histogramSubBuckets + sub + 1;
+}
+
+double Variable::bucketUpperBound(std::size_t idx) const
+{
+    if (idx == 0)
+        return std::ldexp(1.0, histogramMinExp);
+    if (idx == buckets.size() - 1)
+        return std::numeric_limits<double>::infinity();
+    const std::size_t off = idx - 1;
+    const int e = histogramMinExp + int(off / histogramSubBuckets);
+    const int sub = int(off % histogramSubBuckets);
+    return std::ldexp(1.0 + double(sub + 1) / histogramSubBuckets, e);
+}
+
+double Variable::getPercentileUnlocked(double pct) const
+{
+    if (buckets.empty())
+        throw std::logic_error("Cannot compute a percentile unless enableHistogram was called");
+
+    unsigned long long total = 0;
+    for (std::size_t i = 0; i < buckets.size(); i++)
+        total += buckets[i];
+    if (total < 1)
+        throw std::length_error("Cannot compute a percentile without at least 1 sample");
+
+    unsigned long long rank = (unsigned long long) std::ceil(pct / 100.0 * total);
+    if (rank < 1)
+        rank = 1;
+    unsigned long long seen = 0;
+    std::size_t idx = 0;
+    for (; idx < buckets.size(); idx++)
+    {
+        seen += buckets[idx];
+        if (seen >= rank)
+            break;
+    }
+    return bucketUpperBound(idx);
+}
+
+double Variable::getPercentile(double pct) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    flushShardsUnlocked();
+    return getPercentileUnlocked(pct);
 }
 
 unsigned long long Variable::getNumSamples() const
 {
     boost::lock_guard<boost::mutex> lock(mutex);
+    flushShardsUnlocked();
     return n;
 }
 
 double Variable::getMean() const
 {
     boost::lock_guard<boost::mutex> lock(mutex);
+    flushShardsUnlocked();
     if (n < 1)
         throw std::length_error("Cannot compute mean without at least 1 sample");
     return sum / n;
@@ -169,33 +336,58 @@ double Variable::getVarianceUnlocked() const
 double Variable::getVariance() const
 {
     boost::lock_guard<boost::mutex> lock(mutex);
+    flushShardsUnlocked();
     return getVarianceUnlocked();
 }
 
 void Variable::write(std::ostream &o) const
 {
+    flushShardsUnlocked();
     if (n >= 1)
         o << sum << " : " << sum / n << ' ';
     if (n >= 2)
         o << "+/- " << std::sqrt(getVarianceUnlocked()) << ' ';
     o << "[" << n << "]";
+    if (!buckets.empty())
+    {
+        unsigned long long total = 0;
+        for (std::size_t i = 0; i < buckets.size(); i++)
+            total += buckets[i];
+        if (total > 0)
+        {
+            o << " p50 " << getPercentileUnlocked(50.0)
+              << " p95 " << getPercentileUnlocked(95.0)
+              << " p99 " << getPercentileUnlocked(99.0);
+        }
+    }
 }
 
 void Variable::merge(const Statistic &other)
 {
     const Variable &stat = dynamic_cast<const Variable &>(other);
+    flushShards();
+    stat.flushShards();
     sum += stat.sum;
     sum2 += stat.sum2;
     n += stat.n;
+    if (!stat.buckets.empty())
+    {
+        if (buckets.empty())
+            buckets.resize(stat.buckets.size());
+        for (std::size_t i = 0; i < buckets.size(); i++)
+            buckets[i] += stat.buckets[i];
+    }
 }
 
 template<typename Archive>
 void Variable::serialize(Archive &ar, const unsigned int)
 {
+    flushShardsUnlocked(); // no-op on load, where no shards exist
     ar & boost::serialization::base_object<Statistic>(*this);
     ar & sum;
     ar & sum2;
     ar & n;
+    ar & buckets;
 }
 
 
@@ -41,9 +41,12 @@
 #include <string>
 #include <ostream>
 #include <iterator>
+#include <vector>
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/iterator/iterator_adaptor.hpp>
 #include <boost/type_traits/remove_pointer.hpp>
@@ -158,18 +161,116 @@ public:
 
 /**
  * Statistic subclass that computes mean and standard deviation.
+ *
+ * It can optionally also record a log-bucketed histogram of the samples
+ * (see @ref enableHistogram), from which approximate percentiles are
+ * computed. This uses a fixed amount of memory regardless of the number of
+ * samples, at the cost of only bounding each percentile to within one
+ * bucket (a factor of 2<sup>1/4</sup>).
+ *
+ * Variables that are sampled from many threads at once can be switched to
+ * sharded accumulation (see @ref enableSharding), which removes the
+ * contention on the per-sample lock.
  */
 class Variable : public Statistic
 {
     friend class ::TestVariable;
     friend class boost::serialization::access;
 private:
-    double sum;             ///< sum of samples
-    double sum2;            ///< sum of squares of samples
-    unsigned long long n;   ///< number of samples
+    /**
+     * @name Histogram layout constants
+     * @{
+     * Each power-of-two range of sample values [2<sup>e</sup>, 2<sup>e+1</sup>)
+     * with @ref histogramMinExp &lt;= @a e &lt; @ref histogramMaxExp is split
+     * into @ref histogramSubBuckets equal-width buckets. One extra bucket at
+     * each end catches samples outside the range (including non-positive
+     * samples at the bottom).
+     */
+    static const int histogramMinExp = -32;
+    static const int histogramMaxExp = 40;
+    static const int histogramSubBuckets = 4;
+    /** @} */
+
+    /**
+     * @name Accumulated sample data
+     * @{
+     * These are @c mutable because in sharded mode (see @ref enableSharding)
+     * the per-thread shards are folded into them whenever the statistic is
+     * read, including through @c const accessors.
+     */
+    mutable double sum;             ///< sum of samples
+    mutable double sum2;            ///< sum of squares of samples
+    mutable unsigned long long n;   ///< number of samples
+
+    /**
+     * Histogram bucket counts. This is empty unless @ref enableHistogram has
+     * been called, in which case it has a fixed size determined by the layout
+     * constants.
+     */
+    mutable std::vector<unsigned long long> buckets;
+    /** @} */
+
+    /**
+     * Per-thread accumulator used in sharded mode. The mutex is still taken
+     * for every sample, but apart from the occasional merge-on-read it is
+     * only ever taken by the owning thread, so it stays in the uncontended
+     * fast path instead of serializing all the sampling threads.
+     */
+    struct Shard
+    {
+        boost::mutex mutex;     ///< Protects the fields below
+        Variable *owner;        ///< Variable the samples belong to
+        double sum;             ///< sum of samples since the last fold
+        double sum2;            ///< sum of squares of samples since the last fold
+        unsigned long long n;   ///< number of samples since the last fold
+        /// Histogram counts, sized to match the owner's (empty if no histogram)
+        std::vector<unsigned long long> buckets;
+
+        /// Constructor. The caller must hold the owner's lock.
+        explicit Shard(Variable *owner);
+    };
+
+    /**
+     * Shards registered by sampling threads, protected by the base class
+     * mutex. The shards themselves are owned by @ref shard.
+     */
+    std::vector<Shard *> shards;
+
+    /**
+     * Holds each sampling thread's @ref Shard. This is @c NULL unless @ref
+     * enableSharding has been called. It is declared last so that its
+     * cleanup (which folds the current thread's shard back in) runs before
+     * the accumulators are destroyed.
+     */
+    boost::scoped_ptr<boost::thread_specific_ptr<Shard> > shard;
+
+    /// Create and register a shard for the calling thread
+    Shard *makeShard();
+
+    /**
+     * Cleanup handler for @ref shard: folds a departing thread's samples
+     * into the owner and unregisters the shard.
+     */
+    static void destroyShard(Shard *shard);
+
+    /**
+     * Fold the samples accumulated in the shards into the main accumulators.
+     * The caller must hold the lock.
+     */
+    void flushShardsUnlocked() const;
+
+    /// Take the lock and call @ref flushShardsUnlocked
+    void flushShards() const;
 
     double getVarianceUnlocked() const;  ///< compute variance with the caller taking the lock
 
+    /// Return the index of the histogram bucket that @a value falls into
+    std::size_t bucketIndex(double value) const;
+    /// Return the upper bound of the values covered by bucket @a idx
+    double bucketUpperBound(std::size_t idx) const;
+    /// Implementation of @ref getPercentile, with the caller taking the lock
+    double getPercentileUnlocked(double pct) const;
+
     Variable() : Statistic("") {} // for serialization
 
     template<typename Archive>
@@ -201,6 +302,39 @@ public:
      */
     double getVariance() const;                 ///< Return the sample variance
 
+    /**
+     * Start recording a histogram of the samples. Only samples added after
+     * this call are recorded, so it should normally be called immediately
+     * after obtaining the statistic. It is harmless to call it more than
+     * once. When a histogram is present, approximate 50th, 95th and 99th
+     * percentiles are included in the stream output.
+     */
+    void enableHistogram();
+
+    /**
+     * Switch to per-thread (sharded) accumulation. Each sampling thread then
+     * accumulates into a private shard, and the shards are folded back into
+     * the variable whenever it is read. The per-sample lock remains, but it
+     * becomes thread-private and hence uncontended, so heavily-sampled
+     * statistics no longer serialize the threads sampling them. It is
+     * harmless to call this more than once.
+     *
+     * @warning A sharded variable must outlive every thread that adds
+     * samples to it (a departing thread folds its shard into the variable).
+     * Statistics in the default registry satisfy this trivially.
+     */
+    void enableSharding();
+
+    /**
+     * Return an approximate percentile of the samples, as the upper bound of
+     * the histogram bucket containing the @a pct'th percentile sample.
+     *
+     * @param pct  The percentile to query, in [0, 100].
+     * @throw std::logic_error if @ref enableHistogram has not been called.
+     * @throw std::length_error if no samples have been added.
+     */
+    double getPercentile(double pct) const;
+
     virtual void merge(const Statistic &other);
 };
 
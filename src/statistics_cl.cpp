@@ -34,20 +34,35 @@
 
 #include <vector>
 #include <queue>
+#include <map>
+#include <string>
 #include <utility>
+#include <algorithm>
+#include <stdexcept>
 #include <boost/ref.hpp>
 #include <boost/thread/locks.hpp>
 #include <CL/cl.hpp>
 #include "statistics.h"
 #include "statistics_cl.h"
+#include "timeplot.h"
 #include "logging.h"
+#include "errors.h"
 
 namespace Statistics
 {
 
+/// Mapping of a queue's profiling clock onto the timeplot epoch
+struct QueueClock
+{
+    std::string worker;   ///< Timeplot worker name for the queue's events
+    double offset;        ///< Added to a device timestamp scaled to seconds
+};
+
 static bool eventsEnabled = false;
 static std::queue<std::pair<std::vector<cl::Event>, boost::reference_wrapper<Variable> > > savedEvents;
-static boost::mutex savedEventsMutex;
+/// Calibrations made by @ref calibrateEventClock, keyed by the raw queue handle
+static std::map<cl_command_queue, QueueClock> queueClocks;
+static boost::mutex savedEventsMutex;   ///< Guards @ref savedEvents and @ref queueClocks
 
 void enableEventTiming(bool enable)
 {
@@ -115,7 +130,24 @@ static void flushEventTimes(bool finalize)
             {
                 double duration = 1e-9 * (cl_long(values[1]) - cl_long(values[0]));
                 if (duration >= 0.0 && duration < 100.0)
+                {
                     total += duration;
+                    /* If the queue's clock has been calibrated, also attribute
+                     * the GPU time to this kernel in the timeplot stream.
+                     */
+                    cl_command_queue queue;
+                    if (clGetEventInfo(event(), CL_EVENT_COMMAND_QUEUE,
+                                       sizeof(queue), &queue, NULL) == CL_SUCCESS)
+                    {
+                        std::map<cl_command_queue, QueueClock>::const_iterator clock
+                            = queueClocks.find(queue);
+                        if (clock != queueClocks.end())
+                            Timeplot::recordRawEvent(
+                                clock->second.worker, stat.getName(),
+                                clock->second.offset + 1e-9 * values[0],
+                                clock->second.offset + 1e-9 * values[1]);
+                    }
+                }
                 else
                     Log::log[Log::debug] << "Warning: nonsense event times: " << values[1] << " - " << values[0] << " = " << duration << "s\n";
             }
@@ -153,10 +185,87 @@ void CL_CALLBACK timeEventCallback(const cl::Event &event, void *stat)
     timeEvent(event, *static_cast<Variable *>(stat));
 }
 
+void calibrateEventClock(const cl::CommandQueue &queue, const std::string &worker)
+{
+    if (!eventsEnabled)
+        return;
+    try
+    {
+        cl::Event event;
+        queue.enqueueMarker(&event);
+        event.wait();
+        const double host = Timeplot::getTime();
+
+        cl_ulong device;
+        cl_int status = clGetEventProfilingInfo(
+            event(), CL_PROFILING_COMMAND_END, sizeof(device), &device, NULL);
+        if (status != CL_SUCCESS)
+        {
+            if (status != CL_PROFILING_INFO_NOT_AVAILABLE)
+                Log::log[Log::warn] << "Warning: could not calibrate the profiling clock for " << worker << '\n';
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(savedEventsMutex);
+        QueueClock &clock = queueClocks[queue()];
+        clock.worker = worker;
+        clock.offset = host - 1e-9 * device;
+    }
+    catch (cl::Error &e)
+    {
+        Log::log[Log::warn] << "Warning: could not calibrate the profiling clock for " << worker
+            << " (" << e.what() << ")\n";
+    }
+}
+
 void finalizeEventTimes()
 {
     boost::lock_guard<boost::mutex> lock(savedEventsMutex);
     flushEventTimes(true);
 }
 
+static bool kernelCountersEnabled = false;
+
+void enableKernelCounters(bool enable)
+{
+    kernelCountersEnabled = enable;
+}
+
+bool isKernelCountersEnabled()
+{
+    return kernelCountersEnabled;
+}
+
+KernelCounters::KernelCounters(const cl::Context &context, const std::vector<std::string> &names)
+{
+    MLSGPU_ASSERT(!names.empty(), std::invalid_argument);
+    stats.reserve(names.size());
+    for (std::size_t i = 0; i < names.size(); i++)
+        stats.push_back(&getStatistic<Counter>(names[i]));
+
+    std::vector<cl_uint> zeros(names.size());
+    buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                        zeros.size() * sizeof(cl_uint), &zeros[0]);
+}
+
+void KernelCounters::flush(const cl::CommandQueue &queue)
+{
+    std::vector<cl_uint> values(stats.size());
+    queue.enqueueReadBuffer(buffer, CL_TRUE, 0, values.size() * sizeof(cl_uint), &values[0]);
+
+    bool dirty = false;
+    for (std::size_t i = 0; i < values.size(); i++)
+        if (values[i] != 0)
+        {
+            stats[i]->add(values[i]);
+            dirty = true;
+        }
+    // Only pay for the zeroing transfer when a kernel actually counted something
+    if (dirty)
+    {
+        std::fill(values.begin(), values.end(), cl_uint(0));
+        queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, values.size() * sizeof(cl_uint), &values[0]);
+    }
+}
+
 } // namespace Statistics
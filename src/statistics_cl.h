@@ -32,6 +32,8 @@
 #endif
 
 #include <vector>
+#include <string>
+#include <boost/noncopyable.hpp>
 #include <CL/cl.hpp>
 #include "statistics.h"
 
@@ -85,6 +87,26 @@ void CL_CALLBACK timeEventCallback(const cl::Event &event, void *stat);
  */
 void timeEvents(const std::vector<cl::Event> &events, Variable &stat);
 
+/**
+ * Associate the profiling clock of @a queue with the host clock, so that the
+ * per-kernel times recorded by @ref timeEvent can also be written to the
+ * @ref Timeplot stream with absolute start and end times (the event record
+ * is named after the statistic). This enqueues a marker on the queue and
+ * waits for it, so it should be called during setup rather than on a hot
+ * path. Events from queues that have not been calibrated still contribute
+ * to their statistics, but do not appear in the timeplot.
+ *
+ * The calibration includes the latency of observing the marker's completion
+ * on the host, so the reported times may be slightly earlier than the true
+ * wall-clock times. If event timing is not enabled, or the calibration
+ * fails (e.g. because profiling is not enabled on the queue), this is a
+ * no-op.
+ *
+ * @param queue   Queue whose profiling clock is to be calibrated
+ * @param worker  Timeplot worker name under which the queue's events are recorded
+ */
+void calibrateEventClock(const cl::CommandQueue &queue, const std::string &worker);
+
 /**
  * Ensure that the events registered using @ref timeEvent have had their
  * times extracted and recorded. This must only be called after the events
@@ -93,6 +115,66 @@ void timeEvents(const std::vector<cl::Event> &events, Variable &stat);
  */
 void finalizeEventTimes();
 
+/**
+ * Enables the device-resident kernel counters (see @ref KernelCounters).
+ * The counter updates are compiled into the kernels on demand, so this must
+ * be set before any kernels are built.
+ */
+void enableKernelCounters(bool enable = true);
+
+/**
+ * Queries whether kernel counters have been enabled.
+ */
+bool isKernelCountersEnabled();
+
+/**
+ * A device-resident array of diagnostic counters that kernels update with
+ * atomics. The counters accumulate on the device across any number of
+ * launches, and @ref flush reads the whole array back in a single transfer,
+ * adds the values to named @ref Counter statistics and re-zeroes the array.
+ * This batching is what makes the counters cheap enough to leave enabled:
+ * the per-launch cost is a few global atomics, and the host pays one small
+ * readback per flush rather than one per counter per launch.
+ *
+ * The slot order of the buffer is the order of the names given to the
+ * constructor; the kernels using the buffer must agree on this order. Each
+ * slot is a @c cl_uint, so it should be flushed often enough (e.g. once per
+ * bin) that no counter can accumulate 2^32 increments in between.
+ *
+ * The class is not thread-safe: a flush must not race with launches that
+ * update the buffer, so each instance should be tied to a single command
+ * queue's work.
+ */
+class KernelCounters : public boost::noncopyable
+{
+private:
+    cl::Buffer buffer;             ///< One @c cl_uint slot per counter
+    std::vector<Counter *> stats;  ///< Host statistic receiving each slot
+
+public:
+    /**
+     * Constructor. Allocates the zero-initialized device buffer and looks up
+     * (creating if necessary) the named statistics.
+     *
+     * @param context  Context in which to allocate the buffer.
+     * @param names    Statistic names, one per slot, in slot order.
+     * @pre @a names is non-empty.
+     */
+    KernelCounters(const cl::Context &context, const std::vector<std::string> &names);
+
+    /// Retrieve the counter buffer, to pass as a kernel argument.
+    const cl::Buffer &getBuffer() const { return buffer; }
+
+    /**
+     * Read back the counters, credit them to their statistics and zero the
+     * buffer again. The readback is synchronous, so this should be called at
+     * a point where the host is about to wait for the device anyway.
+     *
+     * @param queue    Queue on which the updating kernels were enqueued.
+     */
+    void flush(const cl::CommandQueue &queue);
+};
+
 } // namespace Statistics
 
 #endif /* !MLSGPU_STATISTICS_CL_H */
@@ -0,0 +1,108 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Periodic publication of statistics snapshots during a run.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "statistics_monitor.h"
+#include "statistics.h"
+#include "thread_name.h"
+#include "logging.h"
+#include "errors.h"
+
+namespace Statistics
+{
+
+Monitor::Monitor(const std::string &filename, double interval)
+    : filename(filename), interval(interval), stopping(false)
+{
+    MLSGPU_ASSERT(interval > 0.0, std::invalid_argument);
+    thread = boost::thread(boost::bind(&Monitor::run, this));
+}
+
+Monitor::~Monitor()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = true;
+    }
+    stopCondition.notify_one();
+    thread.join();
+}
+
+void Monitor::run()
+{
+    thread_set_name("monitor");
+    const boost::posix_time::time_duration sleepTime =
+        boost::posix_time::milliseconds(long(interval * 1000.0));
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!stopping)
+    {
+        stopCondition.timed_wait(lock, sleepTime);
+        if (stopping)
+            break;
+        lock.unlock();
+        writeSnapshot();
+        lock.lock();
+    }
+}
+
+void Monitor::writeSnapshot()
+{
+    const boost::filesystem::path target(filename);
+    const boost::filesystem::path tmp(filename + ".tmp");
+    try
+    {
+        {
+            boost::filesystem::ofstream out(tmp);
+            if (!out)
+                throw std::ios::failure("Could not open snapshot file");
+            out.exceptions(std::ios::failbit | std::ios::badbit);
+            out.precision(15);
+            out << "elapsed: " << elapsed.getElapsed() << '\n';
+            out << Registry::getInstance();
+        }
+        // Atomically replace the previous snapshot, so that a reader
+        // never sees a half-written file.
+        boost::filesystem::rename(tmp, target);
+    }
+    catch (std::exception &e)
+    {
+        // A failed snapshot should not bring down the run
+        Log::log[Log::warn] << "Warning: could not write statistics snapshot: "
+            << e.what() << '\n';
+    }
+}
+
+} // namespace Statistics
@@ -0,0 +1,92 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Periodic publication of statistics snapshots during a run.
+ */
+
+#ifndef MLSGPU_STATISTICS_MONITOR_H
+#define MLSGPU_STATISTICS_MONITOR_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "timer.h"
+
+namespace Statistics
+{
+
+/**
+ * Background thread that periodically writes a snapshot of the default
+ * @ref Registry to a file, so that external monitoring can watch a
+ * long-running job rather than waiting for the end-of-run dump.
+ *
+ * Each snapshot is written to a temporary file and then renamed over the
+ * target, so a reader never sees a partially-written snapshot. The format
+ * is the same one statistic per line format used for the final dump,
+ * preceded by a line giving the elapsed wall-clock time.
+ *
+ * The thread is started by the constructor and stopped (promptly, without
+ * waiting out the current interval) by the destructor.
+ */
+class Monitor : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor. This starts the background thread.
+     *
+     * @param filename   File to (atomically) overwrite with each snapshot.
+     * @param interval   Time between snapshots, in seconds.
+     *
+     * @pre @a interval &gt; 0.
+     */
+    Monitor(const std::string &filename, double interval);
+
+    /// Destructor. Signals the thread to shut down and waits for it.
+    ~Monitor();
+
+private:
+    const std::string filename;   ///< Target filename for snapshots
+    const double interval;        ///< Seconds between snapshots
+
+    Timer elapsed;                ///< Time since the monitor was started
+    bool stopping;                ///< Set by the destructor to terminate the thread
+    boost::mutex mutex;           ///< Protects @ref stopping
+    boost::condition_variable stopCondition;  ///< Signalled when @ref stopping is set
+    boost::thread thread;         ///< The background thread
+
+    /// Thread function: writes a snapshot every @ref interval seconds
+    void run();
+
+    /// Write a single snapshot (temporary file plus rename)
+    void writeSnapshot();
+};
+
+} // namespace Statistics
+
+#endif /* !MLSGPU_STATISTICS_MONITOR_H */
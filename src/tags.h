@@ -37,7 +37,9 @@ enum
     MLSGPU_TAG_SCATTER_HAS_WORK = 1,    ///< Tells requester to either retrieve work or shut down
     MLSGPU_TAG_GATHER_HAS_WORK = 2,     ///< Tells the receiver to either receive work or decrement refcount
     MLSGPU_TAG_WORK = 3,                ///< Generic tag for transmitting a work item
-    MLSGPU_TAG_PROGRESS = 4             ///< A report of progress
+    MLSGPU_TAG_PROGRESS = 4,            ///< A report of progress
+    MLSGPU_TAG_BLOB_REQUEST = 5,        ///< Request for a page of a remote blob file
+    MLSGPU_TAG_BLOB_REPLY = 6           ///< Reply carrying the bytes of a blob file page
 };
 
 #endif /* !TAGS_H */
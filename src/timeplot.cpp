@@ -31,37 +31,113 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <map>
 #include <cerrno>
 #include <cassert>
-#include <boost/thread/mutex.hpp>
-#include <boost/thread/locks.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/exception/all.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
 #include "timeplot.h"
 #include "statistics.h"
 #include "timer.h"
 #include "errors.h"
+#include "logging.h"
 
 namespace Timeplot
 {
 
 static bool hasFile = false;
-static boost::mutex outputMutex;
+static bool binaryFile = false;
 static Timer::timestamp startTime = Timer::currentTime();
 static std::ofstream log;
 
-void init(const std::string &filename)
+static boost::mutex internMutex;        ///< Protects @ref internTable
+/// Interned names for the binary format (see @ref internName)
+static std::map<std::string, std::size_t> internTable;
+
+/// Append @a value to @a out in varint form (see the format description in timeplot.h)
+static void putVarint(std::string &out, unsigned long long value)
+{
+    while (value >= 0x80)
+    {
+        out += char((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+/**
+ * Return the string number for @a name, emitting a definition record the
+ * first time each name is seen. A definition always reaches the writer queue
+ * before any event record referencing it, because the number only becomes
+ * visible to other threads once the definition has been queued.
+ */
+static std::size_t internName(const std::string &name)
+{
+    boost::lock_guard<boost::mutex> lock(internMutex);
+    std::map<std::string, std::size_t>::const_iterator pos = internTable.find(name);
+    if (pos != internTable.end())
+        return pos->second;
+
+    const std::size_t id = internTable.size();
+    internTable[name] = id;
+    std::string record;
+    record += char(0);
+    putVarint(record, name.size());
+    record += name;
+    Log::asyncWrite(log, record);
+    return id;
+}
+
+/// Format and queue one event record in the binary format
+static void writeBinaryEvent(
+    const std::string &worker, const std::string &action,
+    double start, double stop,
+    const boost::optional<std::size_t> &value)
+{
+    const std::size_t workerId = internName(worker);
+    const std::size_t actionId = internName(action);
+    const unsigned long long startNs = (unsigned long long) (start * 1e9 + 0.5);
+    const unsigned long long stopNs = (unsigned long long) (stop * 1e9 + 0.5);
+
+    std::string record;
+    record += char(value ? 2 : 1);
+    putVarint(record, workerId);
+    putVarint(record, actionId);
+    putVarint(record, startNs);
+    putVarint(record, stopNs - startNs);
+    if (value)
+        putVarint(record, *value);
+    Log::asyncWrite(log, record);
+}
+
+/**
+ * Prepare an in-memory stream for formatting one record. The finished record
+ * is handed to @ref Log::asyncWrite, which serializes all writers without a
+ * lock on the caller's side and takes the file I/O off the worker threads.
+ */
+static void initRecord(std::ostringstream &record)
+{
+    record << std::fixed;
+    record.precision(9);
+}
+
+void init(const std::string &filename, bool binary)
 {
     MLSGPU_ASSERT(!hasFile, state_error);
     startTime = Timer::currentTime();
     try
     {
-        log.open(filename.c_str());
+        log.open(filename.c_str(),
+                 binary ? std::ios::out | std::ios::binary : std::ios::out);
         if (!log)
             throw std::ios::failure("Could not open timeplot file");
-        log << std::fixed;
-        log.precision(9);
+        if (binary)
+            log.write("TPB1", 4);
         hasFile = true;
+        binaryFile = binary;
     }
     catch (std::ios::failure &e)
     {
@@ -139,12 +215,24 @@ void Action::pause(Timer::timestamp time)
 
     if (hasFile)
     {
-        boost::lock_guard<boost::mutex> lock(outputMutex);
-        log << "EVENT " << worker.getName() << ' ' << name << ' '
-            << Timer::getElapsed(startTime, start) << ' '
-            << Timer::getElapsed(startTime, time) << '\n';
-        if (value)
-            log << "VALUE " << *value << '\n';
+        if (binaryFile)
+        {
+            writeBinaryEvent(worker.getName(), name,
+                             Timer::getElapsed(startTime, start),
+                             Timer::getElapsed(startTime, time),
+                             value);
+        }
+        else
+        {
+            std::ostringstream record;
+            initRecord(record);
+            record << "EVENT " << worker.getName() << ' ' << name << ' '
+                << Timer::getElapsed(startTime, start) << ' '
+                << Timer::getElapsed(startTime, time) << '\n';
+            if (value)
+                record << "VALUE " << *value << '\n';
+            Log::asyncWrite(log, record.str());
+        }
     }
 }
 
@@ -170,16 +258,70 @@ Action::~Action()
     worker.stop(this, oldAction, stop);
 }
 
+const char *waitReasonName(WaitReason reason)
+{
+    switch (reason)
+    {
+    case WAIT_INPUT:  return "wait.input";
+    case WAIT_MEMORY: return "wait.memory";
+    case WAIT_OUTPUT: return "wait.output";
+    }
+    MLSGPU_ASSERT(false, std::invalid_argument);
+    return "wait.unknown"; // unreachable, but placates the compiler
+}
+
+WaitAction::WaitAction(WaitReason reason, Worker &worker)
+    : Action(waitReasonName(reason), worker,
+             Statistics::getStatistic<Statistics::Variable>(waitReasonName(reason)))
+{
+}
+
 void recordEvent(const std::string &name, Worker &worker)
 {
     if (hasFile)
     {
-        boost::lock_guard<boost::mutex> lock(outputMutex);
         Timer::timestamp now = Timer::currentTime();
         double t = Timer::getElapsed(startTime, now);
-        log << "EVENT " << worker.getName() << ' ' << name << ' '
-            << t << ' '
-            << t << '\n';
+        if (binaryFile)
+        {
+            writeBinaryEvent(worker.getName(), name, t, t,
+                             boost::optional<std::size_t>());
+        }
+        else
+        {
+            std::ostringstream record;
+            initRecord(record);
+            record << "EVENT " << worker.getName() << ' ' << name << ' '
+                << t << ' '
+                << t << '\n';
+            Log::asyncWrite(log, record.str());
+        }
+    }
+}
+
+double getTime()
+{
+    return Timer::getElapsed(startTime, Timer::currentTime());
+}
+
+void recordRawEvent(const std::string &worker, const std::string &action,
+                    double start, double stop)
+{
+    if (hasFile)
+    {
+        if (binaryFile)
+        {
+            writeBinaryEvent(worker, action, start, stop,
+                             boost::optional<std::size_t>());
+        }
+        else
+        {
+            std::ostringstream record;
+            initRecord(record);
+            record << "EVENT " << worker << ' ' << action << ' '
+                << start << ' ' << stop << '\n';
+            Log::asyncWrite(log, record.str());
+        }
     }
 }
 
@@ -49,6 +49,21 @@
  * The file format may evolve in future, so tools should ignore lines that do
  * not start with EVENT, and should also ignore extra fields.
  *
+ * Alternatively, a compact binary format can be selected at @ref init time.
+ * It is several times smaller, which makes always-on tracing of long runs
+ * affordable. The file starts with the magic bytes <tt>TPB1</tt>, followed
+ * by records introduced by a one-byte opcode:
+ * - 0: a string definition: a varint length followed by that many bytes.
+ *   Strings are numbered from 0 in order of definition, and worker and
+ *   action names are referenced by number.
+ * - 1: an event: varint worker string number, action string number, start
+ *   time and duration. Times are in nanoseconds since the program started.
+ * - 2: as for 1, but followed by one extra varint holding the user value
+ *   (the @c VALUE line of the text format).
+ * Varints are stored least-significant group first, 7 bits per byte, with
+ * the top bit set on all but the final byte. @ref utils/timeplot.py reads
+ * both formats transparently.
+ *
  * A @a worker is intended to model a thread: a worker can be working on only
  * one thing at a time. Provided that workers are given unique names (which is
  * not enforced), it is guaranteed that two events for the same worker will not
@@ -64,10 +79,11 @@ namespace Timeplot
  * be updated as normal.
  *
  * @param filename          File to which the data are written.
+ * @param binary            If true, use the compact binary format.
  * @throw std::ios::failure if the file could not be opened.
  * @pre @ref init has not already been called.
  */
-void init(const std::string &filename);
+void init(const std::string &filename, bool binary = false);
 
 class Action;
 
@@ -208,11 +224,66 @@ public:
     ~Action();
 };
 
+/**
+ * Reason why a worker blocked, used to tag wait events so that a trace (or
+ * the aggregate statistics) shows which resource of a loaded pipeline needs
+ * to grow. The enumerators run roughly upstream-to-downstream.
+ */
+enum WaitReason
+{
+    WAIT_INPUT,       ///< The queue feeding the worker was empty
+    WAIT_MEMORY,      ///< A buffer or item pool was exhausted
+    WAIT_OUTPUT       ///< Downstream had no capacity to accept work
+};
+
+/**
+ * Map a @ref WaitReason to the name used both for the action in the plot
+ * and for the aggregate statistic in the default registry
+ * (<tt>wait.input</tt>, <tt>wait.memory</tt> or <tt>wait.output</tt>).
+ */
+const char *waitReasonName(WaitReason reason);
+
+/**
+ * An @ref Action recording a typed wait. The action name identifies the
+ * reason, and the elapsed time additionally accumulates into a per-reason
+ * statistic in the default registry, so a single run reports how much time
+ * was lost to empty inputs, exhausted pools and full downstream stages
+ * respectively. Like any other action it pauses an enclosing action, whose
+ * statistic is then left measuring only the unblocked time.
+ */
+class WaitAction : public Action
+{
+public:
+    /**
+     * Constructor.
+     * @param reason Why the worker is about to block.
+     * @param worker Owning worker.
+     */
+    WaitAction(WaitReason reason, Worker &worker);
+};
+
 /**
  * Record an event that takes no time.
  */
 void recordEvent(const std::string &name, Worker &worker);
 
+/**
+ * Return the current time measured in the timeplot epoch i.e. seconds since
+ * the program started. This matches the times written in @c EVENT records.
+ */
+double getTime();
+
+/**
+ * Record an event whose times were measured externally (e.g. by the OpenCL
+ * event profiling machinery) rather than on the calling thread. The times
+ * are in the timeplot epoch (see @ref getTime). The caller is responsible
+ * for ensuring that events recorded against the same worker do not overlap;
+ * the @a worker does not need to correspond to a live @ref Worker object,
+ * but must not clash with the name of one.
+ */
+void recordRawEvent(const std::string &worker, const std::string &action,
+                    double start, double stop);
+
 } // namespace Timeplot
 
 #endif /* !TIMEPLOT_H */
@@ -27,7 +27,61 @@
 #include <stdexcept>
 #include "timer.h"
 
-#if TIMER_TYPE_POSIX
+#if TIMER_TYPE_TSC
+# include <cpuid.h>
+
+Timer::Source Timer::source = Timer::SOURCE_UNINITIALIZED;
+double Timer::tickPeriod = 1e-9;
+
+std::tr1::uint64_t Timer::clockTicks()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return std::tr1::uint64_t(now.tv_sec) * UINT64_C(1000000000) + now.tv_nsec;
+}
+
+/// Whether the CPU advertises a constant-rate, never-stopping TSC
+static bool hasInvariantTsc()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000U, &eax, &ebx, &ecx, &edx) || eax < 0x80000007U)
+        return false;
+    if (!__get_cpuid(0x80000007U, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (edx >> 8) & 1U;
+}
+
+void Timer::initSource()
+{
+    if (hasInvariantTsc())
+    {
+        /* Calibrate the tick rate against the monotonic clock over a short
+         * interval. Scheduling delay does not matter because both clocks
+         * are sampled at both ends.
+         */
+        const std::tr1::uint64_t t0 = clockTicks();
+        const std::tr1::uint64_t c0 = __builtin_ia32_rdtsc();
+        struct timespec delay = {0, 5000000}; // 5ms
+        nanosleep(&delay, NULL);
+        const std::tr1::uint64_t t1 = clockTicks();
+        const std::tr1::uint64_t c1 = __builtin_ia32_rdtsc();
+        if (c1 > c0 && t1 > t0)
+        {
+            tickPeriod = (t1 - t0) * 1e-9 / (c1 - c0);
+            source = SOURCE_TSC;
+            return;
+        }
+    }
+    tickPeriod = 1e-9;
+    source = SOURCE_CLOCK;
+}
+
+double Timer::getElapsed(const timestamp &start, const timestamp &end)
+{
+    return std::tr1::int64_t(end - start) * tickPeriod;
+}
+
+#elif TIMER_TYPE_POSIX
 
 Timer::timestamp Timer::currentTime()
 {
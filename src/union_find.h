@@ -96,6 +96,15 @@ private:
         friend bool merge(NodeVector &nodes,
                           typename NodeVector::iterator::value_type::size_type a,
                           typename NodeVector::iterator::value_type::size_type b);
+#if HAVE_SYNC_BUILTINS
+    template<typename NodeVector>
+        friend typename NodeVector::iterator::value_type::size_type
+        findRootConcurrent(const NodeVector &nodes, typename NodeVector::iterator::value_type::size_type id);
+    template<typename NodeVector>
+        friend bool mergeConcurrent(NodeVector &nodes,
+                                    typename NodeVector::iterator::value_type::size_type a,
+                                    typename NodeVector::iterator::value_type::size_type b);
+#endif
 #if UNIT_TESTS
     friend class ::TestUnionFind;
 #endif
@@ -133,6 +142,25 @@ private:
         parentSize = -s;
     }
 
+#if HAVE_SYNC_BUILTINS
+    /// Read @ref parentSize with a fresh load, for use by concurrent callers.
+    size_type loadParentSize() const
+    {
+        return *(const volatile size_type *) &parentSize;
+    }
+
+    /**
+     * Atomically replace @ref parentSize if it still has an expected value.
+     *
+     * @retval @c true if the value was @a expect and has been replaced by @a value.
+     * @retval @c false otherwise (no change is made).
+     */
+    bool casParentSize(size_type expect, size_type value) const
+    {
+        return __sync_bool_compare_and_swap(&parentSize, expect, value);
+    }
+#endif
+
     template<typename Archive>
     void serialize(Archive &ar, const unsigned int)
     {
@@ -207,6 +235,105 @@ bool merge(NodeVector &nodes,
     return merged;
 }
 
+#if HAVE_SYNC_BUILTINS
+
+/**
+ * Variant of @ref findRoot that may be called concurrently with other calls
+ * to itself and to @ref mergeConcurrent on the same structure. It uses path
+ * splitting rather than full compression: each node visited is redirected to
+ * its grandparent with a compare-and-swap, and a failed swap simply means
+ * another thread already improved the path.
+ *
+ * @param nodes        Random access container of nodes giving a union-find structure.
+ * @param id           Index of the query node.
+ * @return Index of a node that was a root of the component at some point
+ * during the call. If no merges are in flight, this is the unique root.
+ */
+template<typename NodeVector>
+typename NodeVector::iterator::value_type::size_type
+findRootConcurrent(const NodeVector &nodes, typename NodeVector::iterator::value_type::size_type id)
+{
+    typedef typename NodeVector::iterator::value_type::size_type size_type;
+    while (true)
+    {
+        size_type parent = nodes[id].loadParentSize();
+        if (parent < 0)
+            return id;
+        size_type grand = nodes[parent].loadParentSize();
+        if (grand < 0)
+            return parent;
+        nodes[id].casParentSize(parent, grand);
+        id = parent;
+    }
+}
+
+/**
+ * Variant of @ref merge that may be called concurrently with other calls to
+ * itself and to @ref findRootConcurrent on the same structure. Roots are
+ * linked with a compare-and-swap (smaller component under larger, using the
+ * sizes as a balance heuristic), and the loser's size is then credited to
+ * whichever root currently heads the combined component. Sizes are therefore
+ * exact once all threads have finished, but may transiently under-count
+ * while merges are in flight.
+ *
+ * Unlike @ref merge this does not invoke the @ref Node::merge customization
+ * point, so it must only be used with plain @ref Node instances, not
+ * subclasses carrying extra per-component state.
+ *
+ * @param nodes        Random access container of nodes giving a union-find structure.
+ * @param a, b         Two nodes (not necessarily roots) to combine.
+ * @retval @c true if this call merged two separate components.
+ * @retval @c false if @a a and @a b were already in the same component.
+ */
+template<typename NodeVector>
+bool mergeConcurrent(NodeVector &nodes,
+                     typename NodeVector::iterator::value_type::size_type a,
+                     typename NodeVector::iterator::value_type::size_type b)
+{
+    typedef typename NodeVector::iterator::value_type::size_type size_type;
+    while (true)
+    {
+        a = findRootConcurrent(nodes, a);
+        b = findRootConcurrent(nodes, b);
+        if (a == b)
+            return false;
+        size_type sa = nodes[a].loadParentSize();
+        size_type sb = nodes[b].loadParentSize();
+        if (sa >= 0 || sb >= 0)
+            continue;        // lost a race: one of them is no longer a root
+        /* Link the smaller component under the larger, breaking ties by
+         * index. The tie-break makes the link direction a pure function of
+         * the observed snapshots, so two threads racing to merge the same
+         * pair of roots contend on the same field and one of them must fail.
+         */
+        if (sa < sb || (sa == sb && a < b))
+        {
+            std::swap(a, b); // a becomes the smaller component (sizes are negated)
+            std::swap(sa, sb);
+        }
+        if (!nodes[a].casParentSize(sa, b))
+            continue;        // a was merged or resized under us; start over
+
+        /* The link is published; now credit a's size to the root. If b has
+         * itself been linked away in the meantime, chase the new root. The
+         * swap can only succeed while the target is still a root, so the
+         * size cannot be written over a parent pointer.
+         */
+        while (!(sb < 0 && nodes[b].casParentSize(sb, sb + sa)))
+        {
+            sb = nodes[b].loadParentSize();
+            if (sb >= 0)
+            {
+                b = findRootConcurrent(nodes, b);
+                sb = nodes[b].loadParentSize();
+            }
+        }
+        return true;
+    }
+}
+
+#endif /* HAVE_SYNC_BUILTINS */
+
 } // namespace UnionFind
 
 #endif /* !UNION_FIND_H */
@@ -0,0 +1,265 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Triangle reordering for GPU post-transform vertex cache locality.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "tr1_cstdint.h"
+#include "vcache.h"
+
+namespace VCache
+{
+
+namespace
+{
+
+/// Size of the LRU cache modelled while scoring vertices
+const unsigned int scoreCacheSize = 32;
+/// Entries actually simulated: the three just-used vertices sit in front
+const unsigned int simCacheSize = scoreCacheSize + 3;
+
+/// Score for a vertex in one of the three most recent positions
+const float lastTriScore = 0.75f;
+/// Exponent shaping the falloff of the score over the rest of the cache
+const float cacheDecayPower = 1.5f;
+/// Scale of the bonus for vertices with few remaining triangles
+const float valenceBoostScale = 2.0f;
+/// Exponent of the bonus for vertices with few remaining triangles
+const float valenceBoostPower = 0.5f;
+
+/// Per-vertex state for @ref optimizeTriangleOrder
+struct VertexData
+{
+    std::tr1::uint32_t adjStart;   ///< Offset into the adjacency array
+    std::tr1::uint32_t remaining;  ///< Unemitted triangles using this vertex
+    std::tr1::int32_t cachePos;    ///< Position in the simulated cache, or -1
+    float score;                   ///< Current Forsyth score
+};
+
+/**
+ * Score a vertex from its cache position and remaining valence
+ * (see Forsyth's paper for the rationale behind the constants).
+ */
+float vertexScore(const VertexData &v)
+{
+    if (v.remaining == 0)
+        return -1.0f; // no triangle left that could want it
+
+    float score = 0.0f;
+    if (v.cachePos >= 0)
+    {
+        if (v.cachePos < 3)
+            score = lastTriScore;
+        else
+        {
+            const float scale = 1.0f / (scoreCacheSize - 3);
+            score = 1.0f - (v.cachePos - 3) * scale;
+            score = std::pow(score, cacheDecayPower);
+        }
+    }
+    score += valenceBoostScale * std::pow(float(v.remaining), -valenceBoostPower);
+    return score;
+}
+
+} // anonymous namespace
+
+void optimizeTriangleOrder(
+    const std::tr1::uint32_t *indices,
+    std::size_t numTriangles,
+    std::tr1::uint32_t *order)
+{
+    if (numTriangles == 0)
+        return;
+
+    std::tr1::uint32_t numVertices = 0;
+    for (std::size_t i = 0; i < numTriangles * 3; i++)
+        numVertices = std::max(numVertices, indices[i] + 1);
+
+    /* Build vertex-to-triangle adjacency by counting sort. */
+    std::vector<VertexData> vertices(numVertices);
+    for (std::size_t i = 0; i < numTriangles * 3; i++)
+        vertices[indices[i]].remaining++;
+    std::tr1::uint32_t sum = 0;
+    for (std::tr1::uint32_t v = 0; v < numVertices; v++)
+    {
+        vertices[v].adjStart = sum;
+        sum += vertices[v].remaining;
+        vertices[v].cachePos = -1;
+    }
+    std::vector<std::tr1::uint32_t> adjacency(numTriangles * 3);
+    {
+        std::vector<std::tr1::uint32_t> fill(numVertices, 0);
+        for (std::size_t i = 0; i < numTriangles; i++)
+            for (int j = 0; j < 3; j++)
+            {
+                const std::tr1::uint32_t v = indices[i * 3 + j];
+                adjacency[vertices[v].adjStart + fill[v]++] = i;
+            }
+    }
+    for (std::tr1::uint32_t v = 0; v < numVertices; v++)
+        vertices[v].score = vertexScore(vertices[v]);
+
+    std::vector<float> triScore(numTriangles);
+    std::vector<bool> emitted(numTriangles, false);
+    for (std::size_t i = 0; i < numTriangles; i++)
+        triScore[i] = vertices[indices[i * 3]].score
+            + vertices[indices[i * 3 + 1]].score
+            + vertices[indices[i * 3 + 2]].score;
+
+    std::tr1::uint32_t cache[simCacheSize + 3];
+    unsigned int cacheSize = 0;
+
+    /* The next triangle is normally the best one touching the cache. When
+     * the cache runs dry (a new connected component), fall back to a scan
+     * for the best remaining triangle; the cursor makes the scans linear in
+     * total because triangles behind it are never un-emitted.
+     */
+    std::tr1::int32_t best = -1;
+    std::size_t scanPos = 0;
+    for (std::size_t out = 0; out < numTriangles; out++)
+    {
+        if (best < 0)
+        {
+            float bestScore = -1.0f;
+            while (emitted[scanPos])
+                scanPos++;
+            for (std::size_t i = scanPos; i < numTriangles; i++)
+                if (!emitted[i] && triScore[i] > bestScore)
+                {
+                    bestScore = triScore[i];
+                    best = i;
+                }
+        }
+
+        const std::tr1::uint32_t tri = best;
+        order[out] = tri;
+        emitted[tri] = true;
+
+        /* Move the triangle's vertices to the front of the cache and detach
+         * the triangle from them.
+         */
+        for (int j = 0; j < 3; j++)
+        {
+            const std::tr1::uint32_t v = indices[tri * 3 + j];
+            VertexData &vd = vertices[v];
+
+            std::tr1::uint32_t *adj = &adjacency[vd.adjStart];
+            for (std::tr1::uint32_t k = 0; ; k++)
+                if (adj[k] == tri)
+                {
+                    adj[k] = adj[vd.remaining - 1];
+                    break;
+                }
+            vd.remaining--;
+
+            if (vd.cachePos < 0)
+            {
+                if (cacheSize < simCacheSize)
+                    cacheSize++;
+                vd.cachePos = cacheSize - 1; // will be rotated to the front
+            }
+            /* Rotate the vertex to the front; cachePos values are fixed up
+             * in the rescoring pass below.
+             */
+            std::tr1::uint32_t pos = vd.cachePos;
+            if (pos >= cacheSize)
+                pos = cacheSize - 1;
+            for (std::tr1::uint32_t k = pos; k > 0; k--)
+                cache[k] = cache[k - 1];
+            cache[0] = v;
+            for (unsigned int k = 0; k < cacheSize; k++)
+                vertices[cache[k]].cachePos = k;
+        }
+
+        /* Rescore the cached vertices and find the best triangle among
+         * those they still reference. Vertices pushed beyond the scoring
+         * window are evicted.
+         */
+        best = -1;
+        float bestScore = -1.0f;
+        unsigned int newSize = std::min(cacheSize, scoreCacheSize);
+        for (unsigned int k = cacheSize; k-- > 0; )
+        {
+            VertexData &vd = vertices[cache[k]];
+            if (k >= scoreCacheSize)
+                vd.cachePos = -1;
+            vd.score = vertexScore(vd);
+        }
+        cacheSize = newSize;
+        for (unsigned int k = 0; k < cacheSize; k++)
+        {
+            const VertexData &vd = vertices[cache[k]];
+            for (std::tr1::uint32_t t = 0; t < vd.remaining; t++)
+            {
+                const std::tr1::uint32_t i = adjacency[vd.adjStart + t];
+                float score = vertices[indices[i * 3]].score
+                    + vertices[indices[i * 3 + 1]].score
+                    + vertices[indices[i * 3 + 2]].score;
+                triScore[i] = score;
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    best = i;
+                }
+            }
+        }
+    }
+}
+
+double averageCacheMissRatio(
+    const std::tr1::uint32_t *indices,
+    std::size_t numTriangles,
+    unsigned int cacheSize)
+{
+    if (numTriangles == 0)
+        return 0.0;
+
+    std::vector<std::tr1::uint32_t> cache;
+    std::size_t misses = 0;
+    std::size_t head = 0;
+    for (std::size_t i = 0; i < numTriangles * 3; i++)
+    {
+        const std::tr1::uint32_t v = indices[i];
+        if (std::find(cache.begin(), cache.end(), v) == cache.end())
+        {
+            misses++;
+            if (cache.size() < cacheSize)
+                cache.push_back(v);
+            else
+            {
+                cache[head] = v; // FIFO replacement, as in hardware
+                head = (head + 1) % cacheSize;
+            }
+        }
+    }
+    return double(misses) / numTriangles;
+}
+
+} // namespace VCache
@@ -0,0 +1,89 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Triangle reordering for GPU post-transform vertex cache locality.
+ */
+
+#ifndef VCACHE_H
+#define VCACHE_H
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cstddef>
+#include "tr1_cstdint.h"
+
+/**
+ * Reordering of triangle lists to improve GPU post-transform vertex cache hit
+ * rates. The algorithm is the linear-time greedy one by Tom Forsyth
+ * ("Linear-Speed Vertex Cache Optimisation", 2006): vertices are scored by
+ * their position in a simulated cache and by how many unemitted triangles
+ * still reference them, and the triangle with the best vertex-score sum is
+ * emitted next. The result is not tied to one cache size; it is within a few
+ * percent of slower optimizers across typical hardware cache sizes.
+ */
+namespace VCache
+{
+
+/**
+ * Compute a cache-aware emission order for a triangle list. The triangles
+ * themselves are not moved: the permutation is returned so that the caller
+ * can apply it to records of whatever layout it holds (e.g. raw PLY
+ * triangles).
+ *
+ * Vertex indices need not be dense, but scratch memory proportional to the
+ * largest index is allocated, so indices should be compact (as they are for
+ * a welded output chunk).
+ *
+ * @param      indices       Vertex indices, 3 per triangle.
+ * @param      numTriangles  Number of triangles.
+ * @param[out] order         Permutation of <code>[0, numTriangles)</code>:
+ *                           element @a i is the original position of the
+ *                           triangle to emit in position @a i.
+ *
+ * @pre @a order has room for @a numTriangles elements.
+ */
+void optimizeTriangleOrder(
+    const std::tr1::uint32_t *indices,
+    std::size_t numTriangles,
+    std::tr1::uint32_t *order);
+
+/**
+ * Measure the average cache miss ratio (transformed vertices per triangle)
+ * of a triangle list against a simulated FIFO cache, as found in real
+ * hardware. Lower is better; 3.0 means no reuse at all and values around
+ * 0.6-0.7 are typical for an optimized regular mesh. This is primarily for
+ * testing and diagnostics.
+ *
+ * @param indices       Vertex indices, 3 per triangle.
+ * @param numTriangles  Number of triangles.
+ * @param cacheSize     Number of entries in the simulated cache.
+ */
+double averageCacheMissRatio(
+    const std::tr1::uint32_t *indices,
+    std::size_t numTriangles,
+    unsigned int cacheSize);
+
+} // namespace VCache
+
+#endif /* !VCACHE_H */
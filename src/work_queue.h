@@ -35,12 +35,15 @@
 #include <stdexcept>
 #include <map>
 #include <queue>
+#include <vector>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/smart_ptr/scoped_array.hpp>
 #include <boost/noncopyable.hpp>
 #include "errors.h"
+#include "timeplot.h"
+#include "cancel.h"
 
 /**
  * Thread-safe queue, supporting multiple producers and multiple consumers. The
@@ -49,10 +52,20 @@
  * default-constructed value. It is the user's responsibility to use a type for
  * which this can be distinguished from real data.
  *
+ * The queue has two lanes: ordinary items are FIFO amongst themselves, but an
+ * item pushed as @em urgent is returned ahead of every ordinary item (and
+ * FIFO amongst other urgent items). This lets latency-critical items, such as
+ * a bin that completes an output chunk, overtake a backlog of ordinary work.
+ *
  * It is a requirement that the assignment operator for the value type does
  * not throw. In particular, containers should not be used, or should be
  * passed by smart pointer.
  *
+ * All blocking operations honour @ref Cancel: once the run is cancelled,
+ * pushes and pops throw @ref cancelled instead of queueing or delivering
+ * data (even if items remain), so neither producers nor consumers finish
+ * working through a backlog whose output is about to be discarded.
+ *
  * @param ValueType   The type of data stored in the queue.
  */
 template<typename ValueType>
@@ -63,11 +76,24 @@ public:
     typedef std::size_t size_type;
 
     /**
-     * Add an item to the queue. This will never block.
+     * Add an item to the queue. This will never block. If @a urgent is true
+     * the item is placed in the priority lane (see the class documentation).
      *
      * @pre The queue is not stopped.
      */
-    void push(const value_type &item);
+    void push(const value_type &item, bool urgent = false);
+
+    /**
+     * Add several items to the queue with a single lock acquisition and a
+     * single wakeup. When a producer generates a burst of items this is
+     * cheaper than repeated calls to @ref push, which takes the mutex and
+     * signals the condition variable once per item.
+     *
+     * The items are enqueued in vector order, all in the same lane.
+     *
+     * @pre The queue is not stopped.
+     */
+    void pushBatch(const std::vector<value_type> &items, bool urgent = false);
 
     /**
      * Extract an item from the queue. This will block if the queue is empty.
@@ -77,8 +103,30 @@ public:
      *
      * If the queue has been marked stopped and there is no more data in the
      * queue, it will return a default-constructed value.
+     *
+     * If @a tworker is non-NULL, time spent blocked on an empty queue is
+     * recorded against it as a typed wait (see @ref Timeplot::WaitAction).
+     * The default reason suits a queue of incoming work; a queue used as an
+     * item pool should pass @ref Timeplot::WAIT_MEMORY instead.
      */
-    value_type pop();
+    value_type pop(Timeplot::Worker *tworker = NULL,
+                   Timeplot::WaitReason reason = Timeplot::WAIT_INPUT);
+
+    /**
+     * Extract up to @a max items from the queue with a single lock
+     * acquisition, appending them to @a out. Like @ref pop this blocks while
+     * the queue is empty and not stopped, but it never blocks to fill the
+     * batch once at least one item is available. Urgent items are returned
+     * ahead of ordinary ones, and waits are tagged, as for @ref pop.
+     *
+     * @return The number of items appended, which is zero only when the
+     * queue has been stopped and drained.
+     *
+     * @pre @a max &gt; 0.
+     */
+    size_type popBatch(std::vector<value_type> &out, size_type max,
+                       Timeplot::Worker *tworker = NULL,
+                       Timeplot::WaitReason reason = Timeplot::WAIT_INPUT);
 
     /**
      * Determine whether calling @ref pop will block. In a multithreaded
@@ -87,6 +135,12 @@ public:
      */
     bool empty();
 
+    /**
+     * Number of items waiting to be popped. As with @ref empty, the result is
+     * immediately stale and should only be used as a load estimate.
+     */
+    size_type size();
+
     /**
      * Indicate that there will be no more data added. It is not safe to call
      * this simultaneously with @ref push.
@@ -102,12 +156,22 @@ public:
 
     /**
      * Constructor.
+     *
+     * @param cancellable  If false, the queue ignores @ref Cancel. This is
+     *                     for infrastructure (such as the log writer) that
+     *                     must keep operating while a cancelled run is
+     *                     reported and torn down.
      */
-    WorkQueue();
+    explicit WorkQueue(bool cancellable = true);
+
+    /// Destructor
+    ~WorkQueue();
 
 private:
-    std::queue<value_type> queue;
+    std::queue<value_type> queue;        ///< Ordinary items
+    std::queue<value_type> urgentQueue;  ///< Items pushed as urgent
     bool stopped;
+    bool cancellable;                    ///< Whether operations honour @ref Cancel
     boost::mutex mutex;
     boost::condition_variable dataCondition;
     // TODO account for the memory
@@ -115,27 +179,81 @@ private:
 
 
 template<typename ValueType>
-WorkQueue<ValueType>::WorkQueue()
-    : stopped(false)
+WorkQueue<ValueType>::WorkQueue(bool cancellable)
+    : stopped(false), cancellable(cancellable)
 {
+    if (cancellable)
+        Cancel::registerWaiter(mutex, dataCondition);
 }
 
 template<typename ValueType>
-void WorkQueue<ValueType>::push(const ValueType &value)
+WorkQueue<ValueType>::~WorkQueue()
 {
+    if (cancellable)
+        Cancel::unregisterWaiter(dataCondition);
+}
+
+template<typename ValueType>
+void WorkQueue<ValueType>::push(const ValueType &value, bool urgent)
+{
+    if (cancellable)
+        Cancel::check();
     boost::lock_guard<boost::mutex> lock(mutex);
     MLSGPU_ASSERT(!stopped, state_error);
-    queue.push(value);
+    if (urgent)
+        urgentQueue.push(value);
+    else
+        queue.push(value);
     dataCondition.notify_one();
 }
 
 template<typename ValueType>
-ValueType WorkQueue<ValueType>::pop()
+void WorkQueue<ValueType>::pushBatch(const std::vector<value_type> &items, bool urgent)
+{
+    if (items.empty())
+        return;
+    if (cancellable)
+        Cancel::check();
+    boost::lock_guard<boost::mutex> lock(mutex);
+    MLSGPU_ASSERT(!stopped, state_error);
+    std::queue<value_type> &lane = urgent ? urgentQueue : queue;
+    for (std::size_t i = 0; i < items.size(); i++)
+        lane.push(items[i]);
+    /* One wakeup for the whole burst: a single item can only be consumed by
+     * one thread, while a larger batch may feed every sleeping consumer.
+     */
+    if (items.size() == 1)
+        dataCondition.notify_one();
+    else
+        dataCondition.notify_all();
+}
+
+template<typename ValueType>
+ValueType WorkQueue<ValueType>::pop(Timeplot::Worker *tworker, Timeplot::WaitReason reason)
 {
     boost::unique_lock<boost::mutex> lock(mutex);
-    while (!stopped && queue.empty())
-        dataCondition.wait(lock);
-    if (queue.empty())
+    if (tworker != NULL && !stopped && queue.empty() && urgentQueue.empty())
+    {
+        // Only record an action when we are actually going to block
+        Timeplot::WaitAction wait(reason, *tworker);
+        while (!stopped && !(cancellable && Cancel::isRequested()) && queue.empty() && urgentQueue.empty())
+            dataCondition.wait(lock);
+    }
+    else
+        while (!stopped && !(cancellable && Cancel::isRequested()) && queue.empty() && urgentQueue.empty())
+            dataCondition.wait(lock);
+    /* A cancelled consumer must not keep chewing through the backlog, so
+     * the token beats any data still in the queue.
+     */
+    if (cancellable)
+        Cancel::check();
+    if (!urgentQueue.empty())
+    {
+        value_type ans = urgentQueue.front();
+        urgentQueue.pop();
+        return ans;
+    }
+    else if (queue.empty())
         return value_type();
     else
     {
@@ -145,11 +263,53 @@ ValueType WorkQueue<ValueType>::pop()
     }
 }
 
+template<typename ValueType>
+typename WorkQueue<ValueType>::size_type WorkQueue<ValueType>::popBatch(
+    std::vector<value_type> &out, size_type max,
+    Timeplot::Worker *tworker, Timeplot::WaitReason reason)
+{
+    MLSGPU_ASSERT(max > 0, std::invalid_argument);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (tworker != NULL && !stopped && queue.empty() && urgentQueue.empty())
+    {
+        // Only record an action when we are actually going to block
+        Timeplot::WaitAction wait(reason, *tworker);
+        while (!stopped && !(cancellable && Cancel::isRequested()) && queue.empty() && urgentQueue.empty())
+            dataCondition.wait(lock);
+    }
+    else
+        while (!stopped && !(cancellable && Cancel::isRequested()) && queue.empty() && urgentQueue.empty())
+            dataCondition.wait(lock);
+    if (cancellable)
+        Cancel::check();   // see pop
+    size_type n = 0;
+    while (n < max && !urgentQueue.empty())
+    {
+        out.push_back(urgentQueue.front());
+        urgentQueue.pop();
+        n++;
+    }
+    while (n < max && !queue.empty())
+    {
+        out.push_back(queue.front());
+        queue.pop();
+        n++;
+    }
+    return n;
+}
+
 template<typename ValueType>
 bool WorkQueue<ValueType>::empty()
 {
     boost::unique_lock<boost::mutex> lock(mutex);
-    return !stopped && queue.empty();
+    return !stopped && queue.empty() && urgentQueue.empty();
+}
+
+template<typename ValueType>
+typename WorkQueue<ValueType>::size_type WorkQueue<ValueType>::size()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return queue.size() + urgentQueue.size();
 }
 
 template<typename ValueType>
@@ -167,4 +327,394 @@ void WorkQueue<ValueType>::stop()
     dataCondition.notify_all(); // wake up any consumers waiting on an empty queue
 }
 
+#if HAVE_SYNC_BUILTINS
+
+/**
+ * Variant of @ref WorkQueue for heavily-contended queues. It has the same
+ * semantics as @ref WorkQueue, but @ref push is lock-free: producers append to
+ * an intrusive stack with a single atomic operation and only touch the mutex
+ * when a consumer is known to be asleep. Consumers detach the entire stack at
+ * once and refill a private FIFO from it, so the mutex is only ever contended
+ * between the (typically few) consumers.
+ *
+ * Batches are detached in order and reversed, so items from a single producer
+ * are seen in the order they were pushed.
+ *
+ * This implementation requires the GCC @c __sync atomic builtins; when they
+ * are not available it falls back to being a plain @ref WorkQueue.
+ *
+ * @param ValueType   The type of data stored in the queue.
+ */
+template<typename ValueType>
+class LowContentionWorkQueue : public boost::noncopyable
+{
+public:
+    typedef ValueType value_type;
+    typedef std::size_t size_type;
+
+    /// @copydoc WorkQueue::push
+    void push(const value_type &item, bool urgent = false);
+
+    /**
+     * @copydoc WorkQueue::pushBatch
+     *
+     * The whole batch is spliced onto the incoming stack with a single
+     * compare-and-swap, so this is no more expensive than a single @ref push
+     * regardless of the batch size.
+     */
+    void pushBatch(const std::vector<value_type> &items, bool urgent = false);
+
+    /// @copydoc WorkQueue::pop
+    value_type pop(Timeplot::Worker *tworker = NULL,
+                   Timeplot::WaitReason reason = Timeplot::WAIT_INPUT);
+
+    /// @copydoc WorkQueue::popBatch
+    size_type popBatch(std::vector<value_type> &out, size_type max,
+                       Timeplot::Worker *tworker = NULL,
+                       Timeplot::WaitReason reason = Timeplot::WAIT_INPUT);
+
+    /// @copydoc WorkQueue::empty
+    bool empty();
+
+    /// @copydoc WorkQueue::size
+    size_type size();
+
+    /// @copydoc WorkQueue::stop
+    void stop();
+
+    /// @copydoc WorkQueue::start
+    void start();
+
+    /// @copydoc WorkQueue::WorkQueue
+    explicit LowContentionWorkQueue(bool cancellable = true);
+    ~LowContentionWorkQueue();
+
+private:
+    /// Node in the intrusive producer stack
+    struct Node
+    {
+        value_type value;
+        Node *next;
+    };
+
+    /**
+     * Stack of incoming items, most recent first. Producers push here with an
+     * atomic compare-and-swap and never take the mutex for the data itself.
+     */
+    Node * volatile incoming;
+
+    /// As @ref incoming, but for items pushed as urgent
+    Node * volatile incomingUrgent;
+
+    /**
+     * Items already detached from @ref incoming, in FIFO order. Protected by
+     * @ref mutex.
+     */
+    std::queue<value_type> ready;
+
+    /// As @ref ready, but for items pushed as urgent; it is drained first
+    std::queue<value_type> readyUrgent;
+
+    /**
+     * Number of consumers that may be about to sleep or are sleeping. Only
+     * modified with @ref mutex held; read unlocked by producers to decide
+     * whether to notify.
+     */
+    volatile unsigned int waiters;
+
+    /**
+     * Approximate number of items in the queue, maintained with atomic
+     * increments so that @ref size does not need the mutex. It is only an
+     * estimate: it is updated separately from the stack and FIFO themselves.
+     */
+    volatile size_type count;
+
+    bool stopped;              ///< Protected by @ref mutex
+    bool cancellable;          ///< Whether operations honour @ref Cancel
+    boost::mutex mutex;        ///< Protects @ref ready, @ref waiters and @ref stopped
+    boost::condition_variable dataCondition;
+
+    /// Atomically detach an entire incoming stack, which may be empty.
+    static Node *grabIncoming(Node * volatile &head);
+
+    /// Reverse a detached batch into push order and append it to @a dest
+    static void refill(Node *batch, std::queue<value_type> &dest);
+};
+
+template<typename ValueType>
+LowContentionWorkQueue<ValueType>::LowContentionWorkQueue(bool cancellable)
+    : incoming(NULL), incomingUrgent(NULL), waiters(0), count(0), stopped(false),
+    cancellable(cancellable)
+{
+    if (cancellable)
+        Cancel::registerWaiter(mutex, dataCondition);
+}
+
+template<typename ValueType>
+LowContentionWorkQueue<ValueType>::~LowContentionWorkQueue()
+{
+    if (cancellable)
+        Cancel::unregisterWaiter(dataCondition);
+    for (int lane = 0; lane < 2; lane++)
+    {
+        Node *n = grabIncoming(lane == 0 ? incomingUrgent : incoming);
+        while (n != NULL)
+        {
+            Node *next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+}
+
+template<typename ValueType>
+typename LowContentionWorkQueue<ValueType>::Node *
+LowContentionWorkQueue<ValueType>::grabIncoming(Node * volatile &head)
+{
+    Node *ans = __sync_lock_test_and_set(&head, (Node *) NULL);
+    __sync_synchronize();
+    return ans;
+}
+
+template<typename ValueType>
+void LowContentionWorkQueue<ValueType>::refill(Node *batch, std::queue<value_type> &dest)
+{
+    // Reverse the batch so that items come out in push order
+    Node *prev = NULL;
+    while (batch != NULL)
+    {
+        Node *next = batch->next;
+        batch->next = prev;
+        prev = batch;
+        batch = next;
+    }
+    while (prev != NULL)
+    {
+        Node *next = prev->next;
+        dest.push(prev->value);
+        delete prev;
+        prev = next;
+    }
+}
+
+template<typename ValueType>
+void LowContentionWorkQueue<ValueType>::push(const value_type &item, bool urgent)
+{
+    if (cancellable)
+        Cancel::check();
+    MLSGPU_ASSERT(!stopped, state_error);
+    Node * volatile &head = urgent ? incomingUrgent : incoming;
+    __sync_fetch_and_add(&count, size_type(1));
+    Node *n = new Node;
+    n->value = item;
+    do
+    {
+        n->next = head;
+    } while (__sync_val_compare_and_swap(&head, n->next, n) != n->next);
+    /* The CAS above is a full barrier, so this read cannot be hoisted above
+     * the publication of the node. If a consumer advertised itself in waiters
+     * before we pushed, we will see it here and wake it; otherwise the
+     * consumer advertises first and then re-examines the stack, so it cannot
+     * miss our node. */
+    if (waiters != 0)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        dataCondition.notify_one();
+    }
+}
+
+template<typename ValueType>
+void LowContentionWorkQueue<ValueType>::pushBatch(const std::vector<value_type> &items, bool urgent)
+{
+    if (items.empty())
+        return;
+    if (cancellable)
+        Cancel::check();
+    MLSGPU_ASSERT(!stopped, state_error);
+    Node * volatile &head = urgent ? incomingUrgent : incoming;
+    __sync_fetch_and_add(&count, size_type(items.size()));
+    /* Link the batch so that the earliest item sits deepest in the stack;
+     * the reversal in refill then restores push order, exactly as if the
+     * items had been pushed one at a time.
+     */
+    Node *chainHead = NULL;
+    Node *chainTail = NULL;
+    for (std::size_t i = 0; i < items.size(); i++)
+    {
+        Node *n = new Node;
+        n->value = items[i];
+        n->next = chainHead;
+        chainHead = n;
+        if (chainTail == NULL)
+            chainTail = n;
+    }
+    do
+    {
+        chainTail->next = head;
+    } while (__sync_val_compare_and_swap(&head, chainTail->next, chainHead) != chainTail->next);
+    // See push for why this unlocked test cannot miss a waiter
+    if (waiters != 0)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (items.size() == 1)
+            dataCondition.notify_one();
+        else
+            dataCondition.notify_all();
+    }
+}
+
+template<typename ValueType>
+ValueType LowContentionWorkQueue<ValueType>::pop(Timeplot::Worker *tworker, Timeplot::WaitReason reason)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true)
+    {
+        if (cancellable)
+            Cancel::check();   // the token beats any backlog, as for WorkQueue
+        if (!readyUrgent.empty())
+        {
+            value_type ans = readyUrgent.front();
+            readyUrgent.pop();
+            __sync_fetch_and_sub(&count, size_type(1));
+            return ans;
+        }
+        if (!ready.empty())
+        {
+            value_type ans = ready.front();
+            ready.pop();
+            __sync_fetch_and_sub(&count, size_type(1));
+            return ans;
+        }
+
+        /* Advertise ourselves before checking the stacks (see push). */
+        waiters++;
+        __sync_synchronize();
+        Node *urgentBatch = grabIncoming(incomingUrgent);
+        Node *batch = grabIncoming(incoming);
+        if (urgentBatch != NULL || batch != NULL)
+        {
+            waiters--;
+            refill(urgentBatch, readyUrgent);
+            refill(batch, ready);
+        }
+        else if (stopped)
+        {
+            waiters--;
+            return value_type();
+        }
+        else
+        {
+            if (tworker != NULL)
+            {
+                Timeplot::WaitAction wait(reason, *tworker);
+                dataCondition.wait(lock);
+            }
+            else
+                dataCondition.wait(lock);
+            waiters--;
+        }
+    }
+}
+
+template<typename ValueType>
+typename LowContentionWorkQueue<ValueType>::size_type
+LowContentionWorkQueue<ValueType>::popBatch(std::vector<value_type> &out, size_type max,
+                                            Timeplot::Worker *tworker, Timeplot::WaitReason reason)
+{
+    MLSGPU_ASSERT(max > 0, std::invalid_argument);
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true)
+    {
+        if (cancellable)
+            Cancel::check();   // see pop
+        size_type n = 0;
+        while (n < max && !readyUrgent.empty())
+        {
+            out.push_back(readyUrgent.front());
+            readyUrgent.pop();
+            n++;
+        }
+        while (n < max && !ready.empty())
+        {
+            out.push_back(ready.front());
+            ready.pop();
+            n++;
+        }
+        if (n > 0)
+        {
+            __sync_fetch_and_sub(&count, n);
+            return n;
+        }
+
+        /* Advertise ourselves before checking the stacks (see push). */
+        waiters++;
+        __sync_synchronize();
+        Node *urgentBatch = grabIncoming(incomingUrgent);
+        Node *batch = grabIncoming(incoming);
+        if (urgentBatch != NULL || batch != NULL)
+        {
+            waiters--;
+            refill(urgentBatch, readyUrgent);
+            refill(batch, ready);
+        }
+        else if (stopped)
+        {
+            waiters--;
+            return 0;
+        }
+        else
+        {
+            if (tworker != NULL)
+            {
+                Timeplot::WaitAction wait(reason, *tworker);
+                dataCondition.wait(lock);
+            }
+            else
+                dataCondition.wait(lock);
+            waiters--;
+        }
+    }
+}
+
+template<typename ValueType>
+bool LowContentionWorkQueue<ValueType>::empty()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return !stopped && ready.empty() && readyUrgent.empty()
+        && incoming == NULL && incomingUrgent == NULL;
+}
+
+template<typename ValueType>
+typename LowContentionWorkQueue<ValueType>::size_type LowContentionWorkQueue<ValueType>::size()
+{
+    return count;
+}
+
+template<typename ValueType>
+void LowContentionWorkQueue<ValueType>::start()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    stopped = false;
+}
+
+template<typename ValueType>
+void LowContentionWorkQueue<ValueType>::stop()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    stopped = true;
+    dataCondition.notify_all(); // wake up any consumers waiting on an empty queue
+}
+
+#else /* !HAVE_SYNC_BUILTINS */
+
+template<typename ValueType>
+class LowContentionWorkQueue : public WorkQueue<ValueType>
+{
+public:
+    explicit LowContentionWorkQueue(bool cancellable = true)
+        : WorkQueue<ValueType>(cancellable) {}
+};
+
+#endif /* !HAVE_SYNC_BUILTINS */
+
 #endif /* !WORK_QUEUE_H */
@@ -0,0 +1,350 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Thread pool classes.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cstddef>
+#include <vector>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "worker_group.h"
+#include "statistics.h"
+#include "thread_name.h"
+#include "errors.h"
+#include "tr1_cstdint.h"
+
+#if HAVE_CLOCK_GETTIME
+# include <time.h>
+#endif
+#if HAVE_GETRUSAGE
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE 1 // for RUSAGE_THREAD
+# endif
+# include <sys/resource.h>
+#endif
+#if HAVE_PERF_EVENT_OPEN
+# include <cstring>
+# include <linux/perf_event.h>
+# include <sys/syscall.h>
+# include <sys/ioctl.h>
+# include <unistd.h>
+#endif
+
+namespace
+{
+
+/// Flag set by @ref ThreadCounters::setEnabled
+static bool threadCountersEnabled = false;
+
+#if HAVE_PERF_EVENT_OPEN
+
+/// The hardware events a @ref ThreadCounters group tries to count
+static const struct
+{
+    std::tr1::uint64_t config;   ///< A @c PERF_COUNT_HW value
+    const char *suffix;          ///< Appended to the thread name to form the statistic name
+} counterEvents[] =
+{
+    { PERF_COUNT_HW_CPU_CYCLES,             ".cycles" },
+    { PERF_COUNT_HW_INSTRUCTIONS,           ".instructions" },
+    { PERF_COUNT_HW_CACHE_MISSES,           ".cache.misses" },
+    { PERF_COUNT_HW_STALLED_CYCLES_BACKEND, ".stalls.backend" }
+};
+
+/**
+ * Open one hardware counter for the calling thread, counting user space
+ * only. Pass a negative @a group for a group leader (created stopped, so
+ * the group can be started atomically once fully built); otherwise the
+ * counter joins the leader's group.
+ *
+ * @return The file descriptor, or negative on failure.
+ */
+static int openCounter(std::tr1::uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = (group < 0);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP
+        | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+#endif // HAVE_PERF_EVENT_OPEN
+
+} // anonymous namespace
+
+void ThreadCounters::setEnabled(bool enable)
+{
+    threadCountersEnabled = enable;
+}
+
+bool ThreadCounters::isEnabled()
+{
+    return threadCountersEnabled;
+}
+
+ThreadCounters::ThreadCounters()
+    : fd(-1)
+{
+#if HAVE_PERF_EVENT_OPEN
+    if (!threadCountersEnabled)
+        return;
+    fd = openCounter(counterEvents[0].config, -1);
+    if (fd < 0)
+        return;  // no permission, inside a VM without a PMU, etc.
+    suffixes.push_back(counterEvents[0].suffix);
+    /* Counters the hardware lacks (commonly the stall counter) are simply
+     * left out of the group; their statistics are then absent rather than
+     * zero, so they cannot be mistaken for a perfectly-behaved stage.
+     */
+    for (std::size_t i = 1; i < sizeof(counterEvents) / sizeof(counterEvents[0]); i++)
+    {
+        const int extra = openCounter(counterEvents[i].config, fd);
+        if (extra >= 0)
+        {
+            extraFds.push_back(extra);
+            suffixes.push_back(counterEvents[i].suffix);
+        }
+    }
+    ioctl(fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+ThreadCounters::~ThreadCounters()
+{
+#if HAVE_PERF_EVENT_OPEN
+    for (std::size_t i = 0; i < extraFds.size(); i++)
+        close(extraFds[i]);
+    if (fd >= 0)
+        close(fd);
+#endif
+}
+
+void ThreadCounters::record(const std::string &name) const
+{
+#if HAVE_PERF_EVENT_OPEN
+    if (fd < 0)
+        return;
+    // PERF_FORMAT_GROUP layout: nr, time_enabled, time_running, value per counter
+    std::vector<std::tr1::uint64_t> data(3 + suffixes.size());
+    const ssize_t bytes = read(fd, &data[0], data.size() * sizeof(std::tr1::uint64_t));
+    if (bytes != ssize_t(data.size() * sizeof(std::tr1::uint64_t))
+        || data[0] != suffixes.size())
+        return;
+    /* If the kernel had to multiplex the group off the PMU, scale the counts
+     * up by the fraction of the time they were actually running, as perf(1)
+     * does.
+     */
+    double scale = 1.0;
+    if (data[2] > 0 && data[2] < data[1])
+        scale = double(data[1]) / double(data[2]);
+    for (std::size_t i = 0; i < suffixes.size(); i++)
+    {
+        Statistics::getStatistic<Statistics::Variable>(name + suffixes[i])
+            .add(double(data[3 + i]) * scale);
+    }
+#else
+    (void) name;
+#endif
+}
+
+ThreadUsage::ThreadUsage()
+    : cpu(0.0), minorFaults(0), majorFaults(0), switches(0)
+{
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        cpu = ts.tv_sec + 1e-9 * ts.tv_nsec;
+#endif
+#if HAVE_GETRUSAGE && defined(RUSAGE_THREAD)
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) == 0)
+    {
+        minorFaults = ru.ru_minflt;
+        majorFaults = ru.ru_majflt;
+        switches = ru.ru_nivcsw;
+    }
+#endif
+}
+
+void ThreadUsage::record(const std::string &name, const ThreadUsage &start) const
+{
+    Statistics::getStatistic<Statistics::Variable>(name + ".cpu")
+        .add(cpu - start.cpu);
+    Statistics::getStatistic<Statistics::Variable>(name + ".faults.minor")
+        .add(double(minorFaults - start.minorFaults));
+    Statistics::getStatistic<Statistics::Variable>(name + ".faults.major")
+        .add(double(majorFaults - start.majorFaults));
+    Statistics::getStatistic<Statistics::Variable>(name + ".switches")
+        .add(double(switches - start.switches));
+}
+
+ElasticScheduler::ElasticScheduler(std::size_t budget, double interval)
+    : budget(budget), interval(interval), enabled(true), stopping(false)
+{
+    MLSGPU_ASSERT(interval > 0.0, std::invalid_argument);
+}
+
+void ElasticScheduler::setEnabled(bool enabled)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    this->enabled = enabled;
+}
+
+ElasticScheduler::~ElasticScheduler()
+{
+    stop();
+}
+
+void ElasticScheduler::addGroup(ElasticGroup &group)
+{
+    MLSGPU_ASSERT(!thread, state_error);
+    groups.push_back(&group);
+}
+
+void ElasticScheduler::start()
+{
+    MLSGPU_ASSERT(!thread, state_error);
+
+    std::size_t totalWorkers = 0;
+    for (std::size_t i = 0; i < groups.size(); i++)
+        totalWorkers += groups[i]->maxActiveWorkers();
+    /* With a single group there is nothing to trade off, and if the budget
+     * covers every worker then throttling could only hurt. Groups are left
+     * fully active in those cases.
+     */
+    if (groups.size() < 2 || budget >= totalWorkers)
+        return;
+
+    stopping = false;
+    thread.reset(new boost::thread(boost::bind(&ElasticScheduler::run, this)));
+}
+
+void ElasticScheduler::stop()
+{
+    if (!thread)
+        return;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = true;
+    }
+    stopCondition.notify_one();
+    thread->join();
+    thread.reset();
+    /* Leave the groups fully active so that later phases which run without
+     * the scheduler (or a restarted pass) are not stuck with a stale
+     * throttle.
+     */
+    for (std::size_t i = 0; i < groups.size(); i++)
+        groups[i]->setActiveWorkers(groups[i]->maxActiveWorkers());
+}
+
+void ElasticScheduler::run()
+{
+    thread_set_name("elastic");
+    const boost::posix_time::time_duration sleepTime =
+        boost::posix_time::milliseconds(long(interval * 1000.0));
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!stopping)
+    {
+        stopCondition.timed_wait(lock, sleepTime);
+        if (stopping)
+            break;
+        const bool doBalance = enabled;
+        lock.unlock();
+        if (doBalance)
+            rebalance();
+        lock.lock();
+    }
+}
+
+void ElasticScheduler::rebalance()
+{
+    const std::size_t n = groups.size();
+    std::vector<double> backlog(n);
+    std::vector<std::size_t> active(n, 1);
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+        /* Until a group has processed its first item there is no timing
+         * information, so items are assumed to take unit time and queue
+         * depth alone drives the decision.
+         */
+        double itemTime = groups[i]->meanItemTime();
+        if (itemTime <= 0.0)
+            itemTime = 1.0;
+        backlog[i] = double(groups[i]->queueDepth()) * itemTime;
+    }
+
+    /* Every group starts with one worker (it may never be throttled to
+     * zero); the rest of the budget goes greedily to the group with the
+     * largest backlog per active worker. Ties (in particular an idle
+     * pipeline, where every backlog is zero) are broken in favour of the
+     * group with the fewest active workers, so idle phases spread the
+     * budget rather than piling it on one group.
+     */
+    std::size_t total = n;
+    while (total < budget)
+    {
+        std::ptrdiff_t best = -1;
+        double bestScore = 0.0;
+        for (std::size_t i = 0; i < n; i++)
+        {
+            if (active[i] >= groups[i]->maxActiveWorkers())
+                continue;
+            const double score = backlog[i] / double(active[i]);
+            if (best < 0 || score > bestScore
+                || (score == bestScore && active[i] < active[best]))
+            {
+                best = i;
+                bestScore = score;
+            }
+        }
+        if (best < 0)
+            break;   // every group is at its maximum
+        active[best]++;
+        total++;
+    }
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+        if (groups[i]->getActiveWorkers() != active[i])
+        {
+            groups[i]->setActiveWorkers(active[i]);
+            Statistics::getStatistic<Statistics::Counter>("elastic.migrations").add();
+        }
+    }
+}
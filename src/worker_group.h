@@ -34,21 +34,101 @@
 #include <boost/noncopyable.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <cstdlib>
 #include <cstddef>
 #include <stdexcept>
 #include <iostream>
+#include <vector>
 #include "work_queue.h"
+#include "cancel.h"
 #include "statistics.h"
 #include "errors.h"
+#include "numa.h"
 #include "thread_name.h"
 #include "timeplot.h"
 
+/**
+ * Snapshot of the calling thread's execution resources: CPU time, page
+ * faults and involuntary context switches. The wall-clock busy times in
+ * @ref Timeplot conflate computation with faults, lock waits and CPU
+ * starvation; comparing wall time against these counters shows which of
+ * those a slow stage is actually paying for.
+ *
+ * Counters that the platform cannot provide read as zero, so differences
+ * of two snapshots are still safe to record.
+ */
+class ThreadUsage
+{
+private:
+    double cpu;                         ///< Thread CPU time in seconds
+    unsigned long long minorFaults;     ///< Faults serviced without I/O
+    unsigned long long majorFaults;     ///< Faults requiring I/O
+    unsigned long long switches;        ///< Involuntary context switches
+
+public:
+    /// Captures the counters for the calling thread
+    ThreadUsage();
+
+    /**
+     * Record the difference between this snapshot and an earlier @a start
+     * on the same thread, as one sample each of statistics
+     * <i>name</i><code>.cpu</code>, <i>name</i><code>.faults.minor</code>,
+     * <i>name</i><code>.faults.major</code> and
+     * <i>name</i><code>.switches</code>.
+     */
+    void record(const std::string &name, const ThreadUsage &start) const;
+};
+
+/**
+ * Hardware performance counters for the calling thread, collected through
+ * the Linux perf_event interface. @ref ThreadUsage says how much CPU time a
+ * stage burned; these counters say what it burned it on, separating a
+ * memory-bound stage (high cache misses and backend stalls per instruction)
+ * from a compute-bound one, without rerunning under an external profiler.
+ *
+ * Counting starts at construction and the totals are folded into
+ * @ref Statistics::Registry by @ref record, one sample per counter per
+ * thread. The counters are strictly opt-in (see @ref setEnabled, driven by
+ * the <tt>--statistics-counters</tt> option): when disabled, unsupported by
+ * the platform, or denied by the kernel, construction quietly yields an
+ * object whose @ref record is a no-op.
+ */
+class ThreadCounters : public boost::noncopyable
+{
+private:
+    int fd;                              ///< Group leader (negative when unavailable)
+    std::vector<int> extraFds;           ///< Other members of the counter group
+    std::vector<const char *> suffixes;  ///< Statistic suffix per opened counter, in group order
+
+public:
+    /// Globally switches collection on or off (off by default)
+    static void setEnabled(bool enable = true);
+    /// Queries the flag set by @ref setEnabled
+    static bool isEnabled();
+
+    /// Opens the counter group for the calling thread and starts it counting
+    ThreadCounters();
+    /// Closes the counter group
+    ~ThreadCounters();
+
+    /**
+     * Read the counters and record each as one sample of statistic
+     * <i>name</i> plus the counter's suffix (<code>.cycles</code>,
+     * <code>.instructions</code>, <code>.cache.misses</code> and
+     * <code>.stalls.backend</code>). Must be called from the thread that
+     * constructed the object. Counts are scaled up for any time the kernel
+     * multiplexed the group off the PMU.
+     */
+    void record(const std::string &name) const;
+};
+
 /**
  * Base class from which workers may derive. They are not required to do so,
  * but if not they must provide the same interface.
@@ -57,6 +137,7 @@ class WorkerBase : public boost::noncopyable
 {
 private:
     Timeplot::Worker tworker;
+    int numaNode;      ///< NUMA node for the worker thread (negative for none)
 public:
     /**
      * Constructor. The @ref Timeplot::Worker is given a name composed of @a
@@ -67,7 +148,7 @@ public:
      * @param idx      Number of the worker within the pool (zero-based).
      */
     WorkerBase(const std::string &name, int idx)
-        : tworker(name, idx) {}
+        : tworker(name, idx), numaNode(-1) {}
 
     /**
      * Called when the group starts. Reimplement if special action is needed.
@@ -83,6 +164,17 @@ public:
      */
     void stop() {}
 
+    /**
+     * Set the NUMA node on which the worker's thread should run. This is
+     * only a placement hint: it takes effect when the owning group is next
+     * started, and a negative value (the default) leaves the thread
+     * placement to the OS.
+     */
+    void setNumaNode(int node) { numaNode = node; }
+
+    /// Retrieve the node set with @ref setNumaNode
+    int getNumaNode() const { return numaNode; }
+
     /**
      * Retrieve the @ref Timeplot::Worker to use for recording actions associated
      * with this worker.
@@ -90,12 +182,56 @@ public:
     Timeplot::Worker &getTimeplotWorker() { return tworker; }
 };
 
+/**
+ * Type-erased view of a worker group through which @ref ElasticScheduler
+ * observes load and throttles concurrency. @ref WorkerGroup implements it;
+ * the scheduler never needs to know the item or worker types.
+ *
+ * The "active" count is the number of worker threads that are permitted to
+ * take new items from the group's queue. It is a soft limit: a thread that is
+ * busy with an item (or already blocked inside the queue) finishes or
+ * consumes that item first and only then parks itself, so reductions take
+ * effect with a lag of one item.
+ */
+class ElasticGroup
+{
+public:
+    /// Number of items waiting in the queue (an immediately-stale estimate).
+    virtual std::size_t queueDepth() = 0;
+
+    /// Upper bound for @ref setActiveWorkers (the number of constructed workers).
+    virtual std::size_t maxActiveWorkers() const = 0;
+
+    /// Current number of workers permitted to take new items.
+    virtual std::size_t getActiveWorkers() const = 0;
+
+    /**
+     * Permit @a active workers to take new items. The value is clamped to
+     * [1, @ref maxActiveWorkers]: a group is never throttled to zero, so a
+     * stage can always drain and the pipeline cannot stall.
+     */
+    virtual void setActiveWorkers(std::size_t active) = 0;
+
+    /**
+     * Mean wall-clock time (in seconds) to process one item, taken from the
+     * group's compute statistic. Returns 0 until at least one item has been
+     * processed.
+     */
+    virtual double meanItemTime() const = 0;
+
+    virtual ~ElasticGroup() {}
+};
+
 /**
  * A collection of threads operating on work-items, fed by a queue.
  *
  * @param WorkItem     A POD type describing an item of work.
  * @param Worker       Function object class that is called to process elements.
  * @param Derived      The class that is being derived from the template.
+ * @param Queue        Queue class used to pass items to the workers. It
+ *                     defaults to @ref WorkQueue; groups that are fed by many
+ *                     producer threads can use @ref LowContentionWorkQueue
+ *                     instead to take queue overhead off the producers.
  *
  * The @a Worker class must have an @c operator() that accepts a reference to a
  * @a WorkItem. The operator does not need to be @c const.  The worker class
@@ -115,8 +251,9 @@ public:
  * only be called by a single manager thread. The other functions are
  * thread-safe, allowing for multiple producers.
  */
-template<typename WorkItem, typename Worker, typename Derived>
-class WorkerGroup
+template<typename WorkItem, typename Worker, typename Derived,
+         typename Queue = WorkQueue<boost::shared_ptr<WorkItem> > >
+class WorkerGroup : public ElasticGroup
 {
 public:
     typedef WorkItem work_item_type;
@@ -142,12 +279,28 @@ public:
     }
 
     /**
-     * Enqueue an item of work.
+     * Enqueue an item of work. If @a urgent is true the item is placed in
+     * the queue's priority lane, ahead of all ordinary items (see
+     * @ref WorkQueue::push). This is used for latency-critical items such
+     * as a bin that completes an output chunk.
+     */
+    void push(Timeplot::Worker &tworker, boost::shared_ptr<WorkItem> item, bool urgent = false)
+    {
+        Timeplot::recordEvent("push", tworker);
+        workQueue.push(item, urgent);
+    }
+
+    /**
+     * Enqueue several items of work with a single lock acquisition and a
+     * single wakeup (see @ref WorkQueue::pushBatch). Use this in preference
+     * to repeated calls to @ref push when a producer completes a burst of
+     * items at once.
      */
-    void push(Timeplot::Worker &tworker, boost::shared_ptr<WorkItem> item)
+    void pushBatch(Timeplot::Worker &tworker,
+                   const std::vector<boost::shared_ptr<WorkItem> > &items, bool urgent = false)
     {
         Timeplot::recordEvent("push", tworker);
-        workQueue.push(item);
+        workQueue.pushBatch(items, urgent);
     }
 
     /**
@@ -165,7 +318,7 @@ public:
         for (std::size_t i = 0; i < workers.size(); i++)
             workers[i].start();
         for (std::size_t i = 0; i < workers.size(); i++)
-            threads.push_back(new boost::thread(Thread(*static_cast<Derived *>(this), getWorker(i))));
+            threads.push_back(new boost::thread(Thread(*static_cast<Derived *>(this), getWorker(i), i)));
     }
 
     /**
@@ -182,6 +335,11 @@ public:
         MLSGPU_ASSERT(threads.size() == workers.size(), state_error);
 
         workQueue.stop();
+        /* Release any workers parked by setActiveWorkers so that they can
+         * observe the stopped queue and exit. The next start() begins with
+         * all workers active; a scheduler re-throttles from there.
+         */
+        setActiveWorkers(workers.size());
         static_cast<Derived *>(this)->stopPreJoin();
         for (std::size_t i = 0; i < threads.size(); i++)
             threads[i].join();
@@ -195,12 +353,63 @@ public:
         return workers.size();
     }
 
+    /**
+     * Set the NUMA node on which all the workers in the group should run.
+     * This only takes effect the next time the group is started.
+     *
+     * @see @ref WorkerBase::setNumaNode
+     */
+    void setNumaNode(int node)
+    {
+        for (std::size_t i = 0; i < workers.size(); i++)
+            workers[i].setNumaNode(node);
+    }
+
     /// Obtain the statistic for reporting compute times
     Statistics::Variable &getComputeStat() const
     {
         return computeStat;
     }
 
+    virtual std::size_t queueDepth()
+    {
+        return workQueue.size();
+    }
+
+    virtual std::size_t maxActiveWorkers() const
+    {
+        return workers.size();
+    }
+
+    virtual std::size_t getActiveWorkers() const
+    {
+        boost::lock_guard<boost::mutex> lock(activeMutex);
+        return activeWorkers;
+    }
+
+    virtual void setActiveWorkers(std::size_t active)
+    {
+        if (active < 1)
+            active = 1;
+        if (active > workers.size())
+            active = workers.size();
+        bool wake;
+        {
+            boost::lock_guard<boost::mutex> lock(activeMutex);
+            wake = active > activeWorkers;
+            activeWorkers = active;
+        }
+        if (wake)
+            activeCondition.notify_all();
+    }
+
+    virtual double meanItemTime() const
+    {
+        if (computeStat.getNumSamples() == 0)
+            return 0.0;
+        return computeStat.getMean();
+    }
+
 protected:
 
     /**
@@ -219,6 +428,19 @@ protected:
         return workers.at(index);
     }
 
+    /**
+     * Set the maximum number of items a worker thread removes from the queue
+     * per lock acquisition (the default is 1). Items held by a worker cannot
+     * be taken over by an idle one, so this should only be raised for groups
+     * whose per-item processing time is small relative to the queue overhead,
+     * or which have a single worker and hence nothing to balance.
+     */
+    void setPopBatch(std::size_t items)
+    {
+        MLSGPU_ASSERT(items > 0, std::invalid_argument);
+        popBatchSize = items;
+    }
+
     /**
      * Constructor. The derived class must chain to this, and then
      * make exactly @a numWorkers calls to @ref addWorker to provide the
@@ -233,13 +455,27 @@ protected:
                 std::size_t numWorkers)
         : threadName(name),
         workQueue(),
+        popBatchSize(1),
         firstPopStat(Statistics::getStatistic<Statistics::Variable>(name + ".pop.first")),
         popStat(Statistics::getStatistic<Statistics::Variable>(name + ".pop")),
         getStat(Statistics::getStatistic<Statistics::Variable>(name + ".get")),
         computeStat(Statistics::getStatistic<Statistics::Variable>(name + ".compute"))
     {
         MLSGPU_ASSERT(numWorkers > 0, std::invalid_argument);
+        /* Per-item compute times tend to have a long tail, so record
+         * percentiles rather than relying on the mean alone.
+         */
+        computeStat.enableHistogram();
+        /* These statistics take a sample per work item from every thread in
+         * the group, so at high thread counts their lock would become a
+         * contention point of its own.
+         */
+        firstPopStat.enableSharding();
+        popStat.enableSharding();
+        getStat.enableSharding();
+        computeStat.enableSharding();
         workers.reserve(numWorkers);
+        activeWorkers = numWorkers;
     }
 
     ~WorkerGroup()
@@ -254,10 +490,11 @@ private:
     {
         Derived &owner;
         Worker &worker;
+        std::size_t idx;       ///< Index of the worker within the group
 
     public:
-        Thread(Derived &owner, Worker &worker)
-            : owner(owner), worker(worker) {}
+        Thread(Derived &owner, Worker &worker, std::size_t idx)
+            : owner(owner), worker(worker), idx(idx) {}
 
         void operator()()
         {
@@ -265,23 +502,67 @@ private:
             try
             {
                 thread_set_name(owner.threadName);
+                numaBindThread(worker.getNumaNode());
+                const ThreadUsage startUsage;
+                const ThreadCounters counters;
                 bool firstPop = true;
+                std::vector<boost::shared_ptr<WorkItem> > items;
                 while (true)
                 {
-                    boost::shared_ptr<WorkItem> item;
+                    /* Workers beyond the active count park here until a
+                     * scheduler re-enables them or the group is stopped
+                     * (stop raises the active count to wake them).
+                     */
+                    {
+                        boost::unique_lock<boost::mutex> lock(owner.activeMutex);
+                        while (idx >= owner.activeWorkers)
+                            owner.activeCondition.wait(lock);
+                    }
+
+                    /* Draining a batch amortizes the queue lock and the
+                     * associated futex traffic over several items; with the
+                     * default batch size of 1 this is the classic
+                     * one-item-per-pop loop.
+                     */
+                    items.clear();
                     {
+                        /* Time blocked on the empty queue is carved out of the
+                         * pop statistic into the wait.input aggregate, so pop
+                         * times measure queue overhead rather than starvation.
+                         */
                         Timeplot::Action timer("pop", tworker, firstPop ? owner.firstPopStat : owner.popStat);
-                        item = owner.workQueue.pop();
+                        owner.workQueue.popBatch(items, owner.popBatchSize, &tworker);
                     }
-                    if (!item)
+                    if (items.empty())
                         break; // we have been asked to shut down
                     firstPop = false;
 
-                    worker(*item);
-
-                    owner.freeItem(item);
+                    for (std::size_t i = 0; i < items.size(); i++)
+                    {
+                        /* Re-tested per item (not just per pop) so that a
+                         * cancelled run abandons the rest of a batch too.
+                         */
+                        Cancel::check();
+                        owner.processItem(worker, *items[i]);
+
+                        owner.freeItem(items[i]);
+                        items[i].reset();
+                    }
                 }
                 worker.stop();
+                /* One sample per worker per run; comparing these against
+                 * the wall-clock busy times shows whether a slow group is
+                 * computing, faulting or being starved of CPU.
+                 */
+                ThreadUsage().record(owner.threadName, startUsage);
+                counters.record(owner.threadName);
+            }
+            catch (cancelled &)
+            {
+                /* The run is being torn down: exit without flushing the
+                 * worker (its output would be discarded anyway) so that
+                 * stop() can join us in about one item's time.
+                 */
             }
             catch (std::runtime_error &e)
             {
@@ -309,7 +590,21 @@ private:
     /**
      * Queue of items waiting to be processed.
      */
-    WorkQueue<boost::shared_ptr<WorkItem> > workQueue;
+    Queue workQueue;
+
+    /**
+     * Maximum number of items a worker removes from @ref workQueue per lock
+     * acquisition (see @ref setPopBatch).
+     */
+    std::size_t popBatchSize;
+
+    /**
+     * Number of workers currently permitted to take new items
+     * (see @ref ElasticGroup). Protected by @ref activeMutex.
+     */
+    std::size_t activeWorkers;
+    mutable boost::mutex activeMutex;          ///< Protects @ref activeWorkers
+    boost::condition_variable activeCondition; ///< Signalled when @ref activeWorkers increases
 
     Statistics::Variable &firstPopStat;
     Statistics::Variable &popStat;
@@ -334,6 +629,17 @@ private:
     {
     }
 
+    /**
+     * Process a single item by applying the worker to it. This is a hook
+     * that subclasses may override to wrap per-item error handling (such as
+     * containment and retry of transient device failures) around the
+     * worker invocation.
+     */
+    void processItem(Worker &worker, WorkItem &item)
+    {
+        worker(item);
+    }
+
     /**
      * Release transient resources stored in an item. This is a hook that
      * subclasses may override.
@@ -344,4 +650,81 @@ private:
     }
 };
 
+/**
+ * Background thread that migrates worker-thread slots between groups as
+ * pipeline load shifts over a run (bucketing-heavy early, mesher-heavy
+ * late). Each registered group is given at least one active worker; the
+ * remaining budget is handed out greedily to whichever group has the
+ * largest estimated backlog (queue depth times mean per-item compute time)
+ * per active worker. Groups whose workers are fundamentally serial simply
+ * have a maximum of one and keep their slot.
+ *
+ * The scheduler only throttles workers that already exist (see
+ * @ref ElasticGroup::setActiveWorkers); it never creates threads, so
+ * per-worker resources remain fixed at group construction.
+ *
+ * All groups must be registered before @ref start, and the scheduler must be
+ * stopped before any of the groups is destroyed.
+ */
+class ElasticScheduler : public boost::noncopyable
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param budget     Total active workers to aim for across all registered
+     *                   groups (typically the number of CPU cores). If this is
+     *                   less than the number of groups it is raised to it,
+     *                   since every group keeps one worker.
+     * @param interval   Seconds between rebalances.
+     *
+     * @pre @a interval &gt; 0.
+     */
+    explicit ElasticScheduler(std::size_t budget, double interval = 0.5);
+
+    /// Destructor. Implicitly calls @ref stop if still running.
+    ~ElasticScheduler();
+
+    /**
+     * Register a group to be balanced.
+     * @pre The scheduler has not been started.
+     */
+    void addGroup(ElasticGroup &group);
+
+    /**
+     * Start the balancing thread. It is a no-op if fewer than two groups are
+     * registered or if the budget covers every worker, since there is then
+     * nothing to trade off.
+     */
+    void start();
+
+    /// Signal the balancing thread to shut down and wait for it.
+    void stop();
+
+    /**
+     * Suspend or resume rebalancing. While disabled the balancing thread
+     * keeps running but leaves the active-worker counts alone, so counts
+     * set externally (see @ref ControlServer) stick; re-enabling resumes
+     * from whatever the counts then are. Thread-safe.
+     */
+    void setEnabled(bool enabled);
+
+private:
+    std::vector<ElasticGroup *> groups;   ///< Registered groups
+    const std::size_t budget;             ///< Total active workers to aim for
+    const double interval;                ///< Seconds between rebalances
+
+    bool enabled;                         ///< Whether rebalances are applied (see @ref setEnabled)
+    bool stopping;                        ///< Set by @ref stop to terminate the thread
+    boost::mutex mutex;                   ///< Protects @ref stopping
+    boost::condition_variable stopCondition; ///< Signalled when @ref stopping is set
+    boost::scoped_ptr<boost::thread> thread; ///< The balancing thread (NULL when not running)
+
+    /// Thread function: rebalances every @ref interval seconds
+    void run();
+
+    /// Recompute and apply the active-worker counts
+    void rebalance();
+};
+
 #endif /* !WORKER_GROUP_H */
@@ -82,6 +82,8 @@ private:
     MPI_Comm comm;
     int root;
     Statistics::Variable &sendStat;
+    /// Channel for the fixed-shape envelope that precedes every item
+    Serialize::PersistentSend<std::size_t> hasWork;
 public:
     /**
      * Constructor.
@@ -92,7 +94,8 @@ public:
      * @param sendStat  Statistic for time spent sending
      */
     WorkerGather(const std::string &name, MPI_Comm comm, int root, Statistics::Variable &sendStat)
-        : WorkerBase(name, 0), comm(comm), root(root), sendStat(sendStat)
+        : WorkerBase(name, 0), comm(comm), root(root), sendStat(sendStat),
+        hasWork(1, comm, root, MLSGPU_TAG_GATHER_HAS_WORK)
     {
     }
 
@@ -100,16 +103,14 @@ public:
     {
         Timeplot::Action action("send", getTimeplotWorker(), sendStat);
         std::size_t workSize = sizeItem(item);
-        MPI_Send(&workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(), root,
-                 MLSGPU_TAG_GATHER_HAS_WORK, comm);
+        hasWork(&workSize);
         sendItem(item, comm, root);
     }
 
     void stop()
     {
         std::size_t workSize = 0;
-        MPI_Send(&workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(), root,
-                 MLSGPU_TAG_GATHER_HAS_WORK, comm);
+        hasWork(&workSize);
     }
 };
 
@@ -128,10 +129,13 @@ private:
     const MPI_Comm comm;
     const std::size_t senders;
     Timeplot::Worker tworker;
+    /// Channel for the fixed-shape envelope that precedes every item
+    Serialize::PersistentRecv<std::size_t> hasWork;
 
 public:
     ReceiverGather(const std::string &name, Group &outGroup, MPI_Comm comm, std::size_t senders)
-        : outGroup(outGroup), comm(comm), senders(senders), tworker(name)
+        : outGroup(outGroup), comm(comm), senders(senders), tworker(name),
+        hasWork(1, comm, MPI_ANY_SOURCE, MLSGPU_TAG_GATHER_HAS_WORK)
     {
     }
 
@@ -146,8 +150,7 @@ public:
             MPI_Status status;
             {
                 Timeplot::Action action("wait", tworker, waitStat);
-                MPI_Recv(&workSize, 1, Serialize::mpi_type_traits<std::size_t>::type(),
-                         MPI_ANY_SOURCE, MLSGPU_TAG_GATHER_HAS_WORK, comm, &status);
+                hasWork(&workSize, &status);
             }
             if (workSize == 0)
                 rem--;
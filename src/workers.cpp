@@ -33,6 +33,7 @@
 #endif
 
 #include <cstddef>
+#include <cstring>
 #include <vector>
 #include <CL/cl.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
@@ -55,7 +56,28 @@
 #include "statistics_cl.h"
 #include "errors.h"
 #include "thread_name.h"
+#include "timer.h"
 #include "misc.h"
+#include "logging.h"
+
+/**
+ * Number of bins to batch into a single octree build. Larger batches
+ * amortize kernel launch overheads when the bins are small, but they also
+ * scale the memory for the octree start arrays, so the batch is reduced to
+ * keep that memory bounded for very deep octrees.
+ */
+static std::size_t chooseTreeBatch(int levels)
+{
+    const std::size_t startMem =
+        (std::size_t(1) << (3 * levels)) / 7 * sizeof(SplatTreeCL::command_type);
+    std::size_t batch = SplatTreeCL::MAX_BATCH;
+    while (batch > 1 && batch * startMem > (std::size_t(256) << 20))
+        batch /= 2;
+    return batch;
+}
+
+const std::size_t MeshBatch::BATCH_BYTES;
+const std::size_t MeshBatch::SMALL_BYTES;
 
 MesherGroupBase::Worker::Worker(MesherGroup &owner)
     : WorkerBase("mesher", 0), owner(owner) {}
@@ -63,26 +85,52 @@ MesherGroupBase::Worker::Worker(MesherGroup &owner)
 void MesherGroupBase::Worker::operator()(WorkItem &item)
 {
     Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
-    owner.input(item.work, getTimeplotWorker());
+    for (std::size_t i = 0; i < item.works.size(); i++)
+        owner.input(item.works[i], getTimeplotWorker());
     owner.meshBuffer.free(item.alloc);
 }
 
 MesherGroup::MesherGroup(std::size_t memMesh)
-    : WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup>(
+    : WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup,
+                  LowContentionWorkQueue<boost::shared_ptr<MesherGroupBase::WorkItem> > >(
         "mesher", 1),
-    meshBuffer("mem.MesherGroup.mesh", memMesh)
+    meshBuffer("mem.MesherGroup.mesh", memMesh),
+    itemPool("mem.MesherGroup.itemPool")
 {
     addWorker(new Worker(*this));
+    /* With only one consumer there is no load balance to lose, so let it
+     * drain a burst of bins per lock acquisition. Small bins otherwise cost
+     * more in futex calls than in useful work.
+     */
+    setPopBatch(8);
 }
 
 boost::shared_ptr<MesherGroup::WorkItem> MesherGroup::get(Timeplot::Worker &tworker, std::size_t size)
 {
-    boost::shared_ptr<WorkItem> item = WorkerGroup<WorkItem, Worker, MesherGroup>::get(tworker, size);
+    boost::shared_ptr<WorkItem> item;
+    {
+        boost::lock_guard<boost::mutex> lock(itemPoolMutex);
+        if (!itemPool.empty())
+        {
+            item = itemPool.back();
+            itemPool.pop_back();
+        }
+    }
+    if (!item)
+        item = boost::make_shared<WorkItem>();
     std::size_t rounded = roundUp(size, sizeof(cl_ulong)); // to ensure alignment
     item->alloc = meshBuffer.allocate(tworker, rounded, &getStat);
     return item;
 }
 
+void MesherGroup::freeItem(boost::shared_ptr<WorkItem> item)
+{
+    item->works.clear();  // release the event and mesh references
+    item->pinned.reset(); // return the staging block to its pool
+    boost::lock_guard<boost::mutex> lock(itemPoolMutex);
+    itemPool.push_back(item);
+}
+
 
 DeviceWorkerGroup::DeviceWorkerGroup(
     std::size_t numWorkers, std::size_t spare,
@@ -90,36 +138,65 @@ DeviceWorkerGroup::DeviceWorkerGroup(
     const cl::Context &context, const cl::Device &device,
     std::size_t maxBucketSplats, Grid::size_type maxCells,
     std::size_t meshMemory,
-    int levels, int subsampling, float boundaryLimit,
-    MlsShape shape)
+    int levels, int subsampling, int pipeline, float boundaryLimit,
+    MlsShape shape, double timeSlice, bool zeroCopy, bool halfNormals)
 :
     Base("device", numWorkers),
     progress(NULL), outputGenerator(outputGenerator),
     context(context), device(device),
     maxBucketSplats(maxBucketSplats), maxCells(maxCells), meshMemory(meshMemory),
     subsampling(subsampling),
+    zeroCopy(zeroCopy),
+    halfNormals(halfNormals),
+    share(CLH::DeviceShare::get(device)),
     copyQueue(context, device, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE),
+    pinnedMesh("mem.DeviceWorkerGroup.pinnedMesh", context, device),
     itemPool(),
+    bonusItems_(0),
+    queuedPeak(Statistics::getStatistic<Statistics::Peak>("device.splats.queued")),
     popMutex(NULL),
-    popCondition(NULL)
+    popCondition(NULL),
+    admitting_(true),
+    splatRate_(0.0)
 {
     for (std::size_t i = 0; i < numWorkers; i++)
     {
-        addWorker(new Worker(*this, context, device, levels, boundaryLimit, shape, i));
+        addWorker(new Worker(*this, context, device, levels, pipeline, boundaryLimit, shape, timeSlice, i));
     }
     const std::size_t items = numWorkers + spare;
     const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
     for (std::size_t i = 0; i < items; i++)
-    {
-        boost::shared_ptr<WorkItem> item = boost::make_shared<WorkItem>(context, maxItemSplats);
-        itemPool.push(item);
-    }
+        itemPool.push(makeItem());
     unallocated_ = maxItemSplats * items;
+    poolSplats = maxItemSplats * items;
 
     CLH::ResourceUsage usage = resourceUsage(
         numWorkers, spare, device,
-        maxBucketSplats, maxCells, meshMemory, levels);
+        maxBucketSplats, maxCells, meshMemory, levels, pipeline, halfNormals);
     usage.addStatistics(Statistics::Registry::getInstance(), "mem.device.");
+
+    /* Measure the headroom for admitting extra items during small-bin
+     * phases. The device-fit validation warns above 80% of device memory;
+     * aim for 70% here so that consumers outside this estimate (e.g. the
+     * copy staging buffers) keep their share. The pool is at most doubled,
+     * since beyond that the workers rather than the buffers are the limit.
+     */
+    const std::size_t limit = std::size_t(device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 10) * 7;
+    if (usage.getTotalMemory() < limit)
+    {
+        const std::size_t headroom = limit - usage.getTotalMemory();
+        bonusItems_ = std::min(items, headroom / splatsBytes(maxItemSplats, halfNormals));
+    }
+}
+
+boost::shared_ptr<DeviceWorkerGroup::WorkItem> DeviceWorkerGroup::makeItem()
+{
+    const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
+    boost::shared_ptr<WorkItem> item = boost::make_shared<WorkItem>(context, maxItemSplats, zeroCopy, halfNormals);
+    if (zeroCopy)
+        item->mapped = static_cast<cl_float4 *>(copyQueue.enqueueMapBuffer(
+            item->splats, CL_TRUE, CL_MAP_WRITE, 0, splatsBytes(maxItemSplats, halfNormals)));
+    return item;
 }
 
 void DeviceWorkerGroup::start(const Grid &fullGrid)
@@ -128,9 +205,14 @@ void DeviceWorkerGroup::start(const Grid &fullGrid)
     Base::start();
 }
 
-bool DeviceWorkerGroup::canGet()
+bool DeviceWorkerGroup::canGet(std::size_t numSplats)
 {
-    return !itemPool.empty();
+    if (!isAdmitting())
+        return false;
+    if (!itemPool.empty())
+        return true;
+    boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
+    return bonusItems_ > 0 && numSplats * 2 <= maxBucketSplats;
 }
 
 boost::shared_ptr<DeviceWorkerGroup::WorkItem> DeviceWorkerGroup::get(
@@ -138,10 +220,39 @@ boost::shared_ptr<DeviceWorkerGroup::WorkItem> DeviceWorkerGroup::get(
 {
     Timeplot::Action timer("get", tworker, getStat);
     timer.setValue(numSplats * sizeof(Splat));
-    boost::shared_ptr<DeviceWorkerGroup::WorkItem> item = itemPool.pop();
+
+    bool bonus = false;
+    if (itemPool.empty())
+    {
+        /* A small batch with the pool exhausted means the device is bounded
+         * by buffer turnaround rather than compute; admit an extra item out
+         * of the measured headroom (see @ref bonusItems_) rather than
+         * stalling the copy thread.
+         */
+        boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
+        if (bonusItems_ > 0 && numSplats * 2 <= maxBucketSplats)
+        {
+            bonusItems_--;
+            bonus = true;
+        }
+    }
+
+    boost::shared_ptr<DeviceWorkerGroup::WorkItem> item;
+    if (bonus)
+    {
+        const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
+        item = makeItem();
+        Statistics::getStatistic<Statistics::Counter>("device.bonusItems").add();
+        boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
+        unallocated_ += maxItemSplats;
+        poolSplats += maxItemSplats;
+    }
+    else
+        item = itemPool.pop(&tworker, Timeplot::WAIT_MEMORY);
 
     boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
     unallocated_ -= numSplats;
+    queuedPeak = poolSplats - unallocated_;
     return item;
 }
 
@@ -150,6 +261,16 @@ void DeviceWorkerGroup::freeItem(boost::shared_ptr<WorkItem> item)
     item->subItems.clear();
     item->copyEvent = cl::Event(); // release the reference
 
+    if (zeroCopy)
+    {
+        /* Re-establish the persistent mapping so that the next fill can
+         * write in place. On a shared-memory device this returns the same
+         * storage without copying.
+         */
+        item->mapped = static_cast<cl_float4 *>(copyQueue.enqueueMapBuffer(
+            item->splats, CL_TRUE, CL_MAP_WRITE, 0, splatsBytes(maxBucketSplats, halfNormals)));
+    }
+
     if (popCondition != NULL)
     {
         boost::lock_guard<boost::mutex> popLock(*popMutex);
@@ -160,12 +281,187 @@ void DeviceWorkerGroup::freeItem(boost::shared_ptr<WorkItem> item)
         itemPool.push(item);
 }
 
+namespace
+{
+
+/// Whether an OpenCL error code indicates device resource exhaustion
+static bool isResourceError(cl_int err)
+{
+    return err == CL_MEM_OBJECT_ALLOCATION_FAILURE
+        || err == CL_OUT_OF_RESOURCES
+        || err == CL_OUT_OF_HOST_MEMORY;
+}
+
+} // anonymous namespace
+
+std::size_t DeviceWorkerGroup::splitItem(WorkItem &item)
+{
+    Statistics::Container::vector<SubItem> halves("mem.DeviceWorkerGroup.subItems");
+    halves.reserve(item.subItems.size() * 2);
+    std::size_t extra = 0;
+    BOOST_FOREACH(const SubItem &sub, item.subItems)
+    {
+        unsigned int axis = 0;
+        for (unsigned int j = 1; j < 3; j++)
+            if (sub.grid.numCells(j) > sub.grid.numCells(axis))
+                axis = j;
+        const Grid::size_type cells = sub.grid.numCells(axis);
+        if (cells < 2)
+        {
+            halves.push_back(sub);
+            continue;
+        }
+        extra += sub.numSplats;
+
+        Grid::difference_type lo[3], hi[3];
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            lo[j] = 0;
+            hi[j] = sub.grid.numCells(j);
+        }
+
+        SubItem half = sub;
+        hi[axis] = cells / 2;
+        half.grid = sub.grid.subGrid(lo[0], hi[0], lo[1], hi[1], lo[2], hi[2]);
+        halves.push_back(half);
+
+        /* The boundary vertices generated by both halves are welded through
+         * the external-vertex keys, exactly as for adjacent bins from the
+         * bucketer. The progress credit stays with the first half so that it
+         * is not counted twice.
+         */
+        lo[axis] = cells / 2;
+        hi[axis] = cells;
+        half.grid = sub.grid.subGrid(lo[0], hi[0], lo[1], hi[1], lo[2], hi[2]);
+        half.progressSplats = 0;
+        halves.push_back(half);
+    }
+    if (extra != 0)
+        item.subItems.swap(halves);
+    return extra;
+}
+
+void DeviceWorkerGroup::processItem(Worker &worker, WorkItem &item)
+{
+    /* Each round of resource failure halves the bins, so the limit means the
+     * final attempt runs bins an eighth of the original size in the worst
+     * case.
+     */
+    const int maxSplits = 3;
+    for (int attempt = 0; ; attempt++)
+    {
+        try
+        {
+            worker(item);
+            return;
+        }
+        catch (cl::Error &e)
+        {
+            if (isResourceError(e.err()) && attempt < maxSplits)
+            {
+                const std::size_t extra = splitItem(item);
+                if (extra != 0)
+                {
+                    Log::log[Log::warn]
+                        << "Device memory exhausted on "
+                        << device.getInfo<CL_DEVICE_NAME>() << ": "
+                        << e.what() << " (" << e.err() << "); splitting bins and retrying\n";
+                    Statistics::getStatistic<Statistics::Counter>("device.splits").add();
+                    /* Both halves of a split bin return the full bin's splats
+                     * to the pool, so take out the duplicate credit up front.
+                     */
+                    boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
+                    unallocated_ = (unallocated_ >= extra) ? unallocated_ - extra : 0;
+                    continue;
+                }
+            }
+            else if (!isResourceError(e.err()) && attempt == 0)
+            {
+                Log::log[Log::warn]
+                    << "OpenCL error processing a bucket on device "
+                    << device.getInfo<CL_DEVICE_NAME>() << ": "
+                    << e.what() << " (" << e.err() << "); retrying\n";
+                continue;
+            }
+            throw;
+        }
+    }
+}
+
 std::size_t DeviceWorkerGroup::unallocated()
 {
     boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
     return unallocated_;
 }
 
+void DeviceWorkerGroup::setAdmitting(bool admitting)
+{
+    {
+        boost::lock_guard<boost::mutex> admittingLock(admittingMutex);
+        if (admitting_ == admitting)
+            return;
+        admitting_ = admitting;
+    }
+    Statistics::getStatistic<Statistics::Counter>(
+        admitting ? "device.attach" : "device.detach").add();
+    Log::log[Log::info] << "Device " << device.getInfo<CL_DEVICE_NAME>()
+        << (admitting ? " attached: taking new work\n"
+                      : " detached: draining in-flight work, taking no more\n");
+    /* Copy workers blocked because no device could take their batch must
+     * re-examine the group set when a device returns.
+     */
+    if (admitting && popCondition != NULL)
+    {
+        boost::lock_guard<boost::mutex> popLock(*popMutex);
+        popCondition->notify_all();
+    }
+}
+
+bool DeviceWorkerGroup::isAdmitting()
+{
+    boost::lock_guard<boost::mutex> admittingLock(admittingMutex);
+    return admitting_;
+}
+
+void DeviceWorkerGroup::releaseReservation(std::size_t numSplats)
+{
+    boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
+    unallocated_ += numSplats;
+}
+
+void DeviceWorkerGroup::recordRate(std::size_t numSplats, double seconds)
+{
+    if (seconds <= 0.0)
+        return;
+    const double rate = numSplats / seconds;
+    boost::lock_guard<boost::mutex> rateLock(splatRateMutex);
+    if (splatRate_ <= 0.0)
+        splatRate_ = rate;
+    else
+    {
+        // EWMA to smooth out per-bin noise while tracking clock changes
+        splatRate_ = 0.75 * splatRate_ + 0.25 * rate;
+    }
+}
+
+double DeviceWorkerGroup::estimateQueueTime(std::size_t extraSplats)
+{
+    double rate;
+    {
+        boost::lock_guard<boost::mutex> rateLock(splatRateMutex);
+        rate = splatRate_;
+    }
+    if (rate <= 0.0)
+        return 0.0;
+
+    std::size_t queued;
+    {
+        boost::lock_guard<boost::mutex> unallocatedLock(unallocatedMutex);
+        queued = poolSplats - unallocated_;
+    }
+    return (queued + extraSplats) / rate;
+}
+
 Grid::size_type DeviceWorkerGroupBase::computeMaxSwathe(
     Grid::size_type yMax,
     Grid::size_type y,
@@ -186,155 +482,315 @@ CLH::ResourceUsage DeviceWorkerGroup::resourceUsage(
     const cl::Device &device,
     std::size_t maxBucketSplats, Grid::size_type maxCells,
     std::size_t meshMemory,
-    int levels)
+    int levels, int pipeline, bool halfNormals)
 {
     Grid::size_type block = maxCells + 1;
     Grid::size_type maxSwathe = computeMaxSwathe(
-        MAX_IMAGE_HEIGHT, block, MlsFunctor::wgs[1], MlsFunctor::wgs[2]);
+        MAX_IMAGE_HEIGHT, block, MlsFunctor::maxWgs[1], MlsFunctor::maxWgs[2]);
 
     CLH::ResourceUsage workerUsage;
     workerUsage += Marching::resourceUsage(
         device, block, block, block,
-        maxSwathe, meshMemory, MlsFunctor::wgs);
-    workerUsage += SplatTreeCL::resourceUsage(device, levels, maxBucketSplats);
+        maxSwathe, meshMemory, MlsFunctor::maxWgs);
+    /* The build-time scratch buffers are shared between the pipelined tree
+     * copies, so they are counted once rather than once per copy.
+     */
+    workerUsage += SplatTreeCL::resourceUsage(device, levels, maxBucketSplats,
+                                              chooseTreeBatch(levels), false) * pipeline;
+    workerUsage += SplatTreeCL::BuildScratch::resourceUsage(levels, maxBucketSplats,
+                                                            chooseTreeBatch(levels));
 
     const std::size_t maxItemSplats = maxBucketSplats; // the same thing for now
     CLH::ResourceUsage itemUsage;
-    itemUsage.addBuffer("splats", maxItemSplats * sizeof(Splat));
+    itemUsage.addBuffer("splats", splatsBytes(maxItemSplats, halfNormals));
     return workerUsage * numWorkers + itemUsage * (numWorkers + spare);
 }
 
 DeviceWorkerGroupBase::Worker::Worker(
     DeviceWorkerGroup &owner,
     const cl::Context &context, const cl::Device &device,
-    int levels, float boundaryLimit,
-    MlsShape shape, int idx)
+    int levels, int pipeline, float boundaryLimit,
+    MlsShape shape, double timeSlice, int idx)
 :
     WorkerBase("device", idx),
     owner(owner),
     queue(context, device, Statistics::isEventTimingEnabled() ? CL_QUEUE_PROFILING_ENABLE : 0),
-    tree(context, device, levels, owner.maxBucketSplats),
-    input(context, shape),
+    treeQueue(context, device, Statistics::isEventTimingEnabled() ? CL_QUEUE_PROFILING_ENABLE : 0),
+    nextTree(0),
+    treeBusy(pipeline),
+    input(context, shape, owner.halfNormals),
     marching(context, device, owner.maxCells + 1, owner.maxCells + 1, owner.maxCells + 1,
-             computeMaxSwathe(MAX_IMAGE_HEIGHT, owner.maxCells + 1, input.alignment()[1], input.alignment()[2]),
-             owner.meshMemory, input.alignment()),
-    scaleBias(context)
+             computeMaxSwathe(MAX_IMAGE_HEIGHT, owner.maxCells + 1, MlsFunctor::maxWgs[1], MlsFunctor::maxWgs[2]),
+             owner.meshMemory, MlsFunctor::maxWgs)
 {
+    MLSGPU_ASSERT(pipeline >= 1, std::invalid_argument);
+    /* The two queues can execute concurrently, so their per-kernel event
+     * times are attributed to separate timeplot workers.
+     */
+    Statistics::calibrateEventClock(queue, getTimeplotWorker().getName() + ".gpu");
+    Statistics::calibrateEventClock(treeQueue, getTimeplotWorker().getName() + ".gpu.tree");
+    /* All builds are enqueued on the single in-order treeQueue, so the
+     * build scratch can never be in use by two copies at once and may be
+     * shared between them.
+     */
+    boost::shared_ptr<SplatTreeCL::BuildScratch> treeScratch(
+        new SplatTreeCL::BuildScratch(context, levels, owner.maxBucketSplats,
+                                      chooseTreeBatch(levels)));
+    for (int i = 0; i < pipeline; i++)
+        trees.push_back(new SplatTreeCL(context, device, levels, owner.maxBucketSplats,
+                                        chooseTreeBatch(levels), treeScratch));
     input.setBoundaryLimit(boundaryLimit);
-    filterChain.addFilter(boost::ref(scaleBias));
+    if (timeSlice > 0.0)
+    {
+        input.setTimeSlice(timeSlice);
+        marching.setTimeSlice(timeSlice);
+    }
 }
 
 void DeviceWorkerGroupBase::Worker::start()
 {
-    scaleBias.setScaleBias(owner.fullGrid);
+    /* The grid-to-world transform is fused into the marching vertex welding
+     * kernel, so no separate scale-bias filter pass is needed.
+     */
+    marching.setScaleBias(owner.fullGrid);
 }
 
 void DeviceWorkerGroupBase::Worker::operator()(WorkItem &work)
 {
+    /* In cooperative mode, hold the device for the duration of this item's
+     * submission burst so that co-tenant jobs alternate instead of
+     * interleaving their launches.
+     */
+    CLH::DeviceShare::Turn coopTurn(owner.share, getTimeplotWorker());
+
     Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
-    BOOST_FOREACH(const SubItem &sub, work.subItems)
+    Timer itemTimer;
+    std::size_t itemSplats = 0;
+    const std::size_t maxBatch = trees[0].getMaxBatch();
+    const std::size_t numBatches = divUp(work.subItems.size(), maxBatch);
+
+    /* The builds are software-pipelined ahead of the evaluation. @ref
+     * Marching::generate blocks on intermediate readbacks, so if the next
+     * build were only enqueued once the previous batch had been handed to
+     * generate, the device would run out of tree work whenever the host is
+     * waiting on a readback. Instead, builds for up to pipeline - 1 future
+     * batches are enqueued on treeQueue before this batch's MLS launches,
+     * and the event graph (copyEvent -> build -> MLS -> marker) lets the
+     * driver overlap them without further host involvement.
+     */
+    std::vector<cl::Event> buildEvents(numBatches);
+    std::vector<std::size_t> batchTree(numBatches);
+    std::vector<unsigned int> batchShift(numBatches);
+    std::size_t built = 0;
+
+    for (std::size_t batch = 0; batch < numBatches; batch++)
     {
-        cl_uint3 keyOffset;
-        for (int i = 0; i < 3; i++)
-            keyOffset.s[i] = sub.grid.getExtent(i).first;
-        // same thing, just as a different type for a different API
-        Grid::difference_type offset[3] =
+        while (built < numBatches && built < batch + trees.size())
         {
-            (Grid::difference_type) keyOffset.s[0],
-            (Grid::difference_type) keyOffset.s[1],
-            (Grid::difference_type) keyOffset.s[2]
-        };
+            const std::size_t firstBin = built * maxBatch;
+            const std::size_t lastBin = std::min(firstBin + maxBatch, work.subItems.size());
 
-        Grid::size_type size[3];
-        for (int i = 0; i < 3; i++)
-        {
-            /* Note: numVertices not numCells, because Marching does per-vertex queries.
-             * So we need information about the cell that is just beyond the last vertex,
-             * just to avoid special-casing it.
+            /* Build all the octrees for the batch with one sequence of kernel
+             * launches, so that launch overheads are amortized across the bins.
              */
-            size[i] = sub.grid.numVertices(i);
-        }
-
-        /* We need to round up the octree size to a multiple of the granularity used for MLS. */
-        Grid::size_type expandedSize[3];
-        for (int i = 0; i < 3; i++)
-            expandedSize[i] = roundUp(size[i], MlsFunctor::wgs[i]);
+            std::vector<SplatTreeCL::Bin> bins(lastBin - firstBin);
+            std::tr1::uint64_t batchSplats = 0;
+            std::tr1::uint64_t batchCells = 0;
+            for (std::size_t i = firstBin; i < lastBin; i++)
+            {
+                const SubItem &sub = work.subItems[i];
+                SplatTreeCL::Bin &bin = bins[i - firstBin];
+                bin.firstSplat = sub.firstSplat;
+                bin.numSplats = sub.numSplats;
+                for (int j = 0; j < 3; j++)
+                {
+                    bin.offset[j] = sub.grid.getExtent(j).first;
+                    /* We need to round up the octree size to a multiple of the
+                     * granularity used for MLS.
+                     */
+                    bin.size[j] = roundUp(sub.grid.numVertices(j), MlsFunctor::maxWgs[j]);
+                }
+                batchSplats += sub.numSplats;
+                batchCells += sub.grid.numCells();
+            }
 
-        filterChain.setOutput(owner.outputGenerator(sub.chunkId, getTimeplotWorker()));
+            /* Pick the octree refinement level for the batch from its splat
+             * density. In sparse batches the finest leaves are mostly empty:
+             * the build work (which scales with splats times levels) buys
+             * nothing for the traversal. Coarsening drops such levels while
+             * leaving the output bit-identical, since the octree is purely an
+             * acceleration structure and the marching resolution is
+             * unchanged. Coarsen while even the next-coarser leaves would
+             * average under one splat, but by at most two levels so that
+             * dense pockets inside a sparse batch do not degrade too far.
+             */
+            unsigned int shift = owner.subsampling;
+            while (shift < (unsigned int) owner.subsampling + 2
+                   && batchSplats < (batchCells >> (3 * (shift + 1))))
+                shift++;
+            if (shift != (unsigned int) owner.subsampling)
+                Statistics::getStatistic<Statistics::Counter>("device.tree.coarsened").add();
+
+            /* The build must still wait for the last consumer of its tree,
+             * which may be several batches back. The lookahead never exceeds
+             * the number of trees, so the tree's previous consumer has
+             * already recorded its marker.
+             */
+            std::vector<cl::Event> wait;
+            wait.push_back(work.copyEvent);
+            if (treeBusy[nextTree]() != NULL)
+                wait.push_back(treeBusy[nextTree]);
+            trees[nextTree].enqueueBuild(treeQueue, work.splats, owner.maxBucketSplats,
+                                         &bins[0], bins.size(),
+                                         shift, &wait, &buildEvents[built]);
+            batchTree[built] = nextTree;
+            batchShift[built] = shift;
+            nextTree = (nextTree + 1) % trees.size();
+            built++;
+        }
 
-        cl::Event treeBuildEvent;
+        SplatTreeCL &tree = trees[batchTree[batch]];
+        const std::size_t firstBin = batch * maxBatch;
+        const std::size_t lastBin = std::min(firstBin + maxBatch, work.subItems.size());
         std::vector<cl::Event> wait(1);
 
-        wait[0] = work.copyEvent;
-        tree.enqueueBuild(queue, work.splats, sub.firstSplat, sub.numSplats,
-                          expandedSize, offset, owner.subsampling, &wait, &treeBuildEvent);
-        wait[0] = treeBuildEvent;
+        for (std::size_t i = firstBin; i < lastBin; i++)
+        {
+            const SubItem &sub = work.subItems[i];
+            cl_uint3 keyOffset;
+            for (int j = 0; j < 3; j++)
+                keyOffset.s[j] = sub.grid.getExtent(j).first;
+            // same thing, just as a different type for a different API
+            Grid::difference_type offset[3] =
+            {
+                (Grid::difference_type) keyOffset.s[0],
+                (Grid::difference_type) keyOffset.s[1],
+                (Grid::difference_type) keyOffset.s[2]
+            };
 
-        input.set(offset, tree, owner.subsampling);
-        marching.generate(queue, input, filterChain, size, keyOffset, &wait);
+            Grid::size_type size[3];
+            for (int j = 0; j < 3; j++)
+            {
+                /* Note: numVertices not numCells, because Marching does per-vertex queries.
+                 * So we need information about the cell that is just beyond the last vertex,
+                 * just to avoid special-casing it.
+                 */
+                size[j] = sub.grid.numVertices(j);
+            }
 
-        tree.clearSplats();
+            filterChain.setOutput(owner.outputGenerator(sub.chunkId, getTimeplotWorker(), owner.pinnedMesh, meshBatch));
 
-        if (owner.progress != NULL)
-            *owner.progress += sub.progressSplats;
+            wait[0] = buildEvents[batch];
+            input.set(offset, tree, i - firstBin, batchShift[batch]);
+            marching.generate(queue, input, filterChain, size, keyOffset, &wait);
+            /* One batched readback of the device-side workload counters per
+             * bin. Marching::generate has just blocked on its own readbacks,
+             * so this adds no extra synchronization point.
+             */
+            input.flushCounters(queue);
 
-        {
-            boost::lock_guard<boost::mutex> unallocatedLock(owner.unallocatedMutex);
-            owner.unallocated_ += sub.numSplats;
+            if (owner.progress != NULL)
+                *owner.progress += sub.progressSplats;
+
+            {
+                boost::lock_guard<boost::mutex> unallocatedLock(owner.unallocatedMutex);
+                owner.unallocated_ += sub.numSplats;
+            }
+            itemSplats += sub.numSplats;
         }
+
+        /* Record when the tree's last consumer finishes, so that a later
+         * build can safely recycle it.
+         */
+        CLH::enqueueMarkerWithWaitList(queue, NULL, &treeBusy[batchTree[batch]]);
+        tree.clearSplats();
     }
+    /* Push any partially filled small-mesh batch now rather than holding it
+     * while this thread waits for its next work item.
+     */
+    meshBatch.flush(getTimeplotWorker());
+    owner.recordRate(itemSplats, itemTimer.getElapsed());
 }
 
 CopyGroup::CopyGroup(
     const std::vector<DeviceWorkerGroup *> &outGroups,
-    std::size_t maxQueueSplats)
+    std::size_t maxQueueSplats,
+    int numaNode)
 :
     WorkerGroup<CopyGroup::WorkItem, CopyGroup::Worker, CopyGroup>(
         "copy", 1),
     outGroups(outGroups),
     maxDeviceItemSplats(outGroups[0]->getMaxItemSplats()),
-    splatBuffer("mem.CopyGroup.splats", maxQueueSplats * sizeof(Splat)),
+    zeroCopy(outGroups[0]->isZeroCopy()),
+    halfNormals(outGroups[0]->isHalfNormals()),
+    splatBuffer("mem.CopyGroup.splats", maxQueueSplats * sizeof(Splat), numaNode),
     writeStat(Statistics::getStatistic<Statistics::Variable>("copy.write")),
     splatsStat(Statistics::getStatistic<Statistics::Variable>("copy.splats")),
     sizeStat(Statistics::getStatistic<Statistics::Variable>("copy.size"))
 {
     addWorker(new Worker(*this, outGroups[0]->getContext(), outGroups[0]->getDevice()));
+    setNumaNode(numaNode);
     BOOST_FOREACH(DeviceWorkerGroup *g, outGroups)
         g->setPopCondition(&popMutex, &popCondition);
 }
 
+boost::shared_ptr<Splat> CopyGroup::allocateBatch(Timeplot::Worker &tworker, std::size_t numSplats)
+{
+    CircularBuffer::Allocation alloc = splatBuffer.allocate(tworker, numSplats * sizeof(Splat), &getStat);
+    return boost::shared_ptr<Splat>(
+        (Splat *) alloc.get(),
+        boost::bind(&CopyGroup::freeBatch, this, alloc));
+}
+
+void CopyGroup::freeBatch(CircularBuffer::Allocation alloc)
+{
+    splatBuffer.free(alloc);
+}
+
 CopyGroupBase::Worker::Worker(
     CopyGroup &owner, const cl::Context &context, const cl::Device &device)
     : WorkerBase("copy", 0), owner(owner),
-    pinned("mem.CopyGroup.pinned", context, device, owner.maxDeviceItemSplats),
+    // the staging buffers are not used in zero-copy mode
+    pinned0("mem.CopyGroup.pinned", context, device, owner.zeroCopy ? 1
+            : divUp(DeviceWorkerGroupBase::splatsBytes(owner.maxDeviceItemSplats, owner.halfNormals),
+                    sizeof(cl_float4))),
+    pinned1("mem.CopyGroup.pinned", context, device, owner.zeroCopy ? 1
+            : divUp(DeviceWorkerGroupBase::splatsBytes(owner.maxDeviceItemSplats, owner.halfNormals),
+                    sizeof(cl_float4))),
+    pinned(&pinned0),
     bufferedItems("mem.CopyGroup.bufferedItems"),
-    bufferedSplats(0)
+    bufferedSplats(0),
+    bufferedClosing(false),
+    zcOutGroup(NULL)
 {
 }
 
-void CopyGroupBase::Worker::flush()
+DeviceWorkerGroup *CopyGroupBase::Worker::chooseOutGroup(std::size_t numSplats)
 {
-    if (bufferedItems.empty())
-        return;
-
     boost::unique_lock<boost::mutex> popLock(owner.popMutex);
     DeviceWorkerGroup *outGroup = NULL;
     while (true)
     {
-        /* Try all devices for which we can pop immediately, and take the one that
-         * seems likely to run out the soonest. It's a poor guess, but does at
-         * least make sure that we always service totally idle devices before ones
-         * that still have work queued.
+        /* Try all devices for which we can pop immediately, and take the one
+         * expected to finish this batch soonest given its observed
+         * throughput and the work already queued to it. Devices with no
+         * measurement yet report an estimate of zero, so idle devices on a
+         * heterogeneous rig are serviced first and quickly acquire a
+         * measurement. Ties (e.g. at startup) are broken on free space.
          */
-        std::size_t best = 0;
+        double bestTime = 0.0;
+        std::size_t bestSpace = 0;
         BOOST_FOREACH(DeviceWorkerGroup *g, owner.outGroups)
         {
-            if (g->canGet())
+            if (g->canGet(numSplats))
             {
-                std::size_t u = g->unallocated();
-                if (u >= best)
+                const double t = g->estimateQueueTime(numSplats);
+                const std::size_t u = g->unallocated();
+                if (outGroup == NULL || t < bestTime
+                    || (t == bestTime && u >= bestSpace))
                 {
-                    best = u;
+                    bestTime = t;
+                    bestSpace = u;
                     outGroup = g;
                 }
             }
@@ -342,38 +798,102 @@ void CopyGroupBase::Worker::flush()
         if (outGroup != NULL)
             break;
 
-        // No spare slots. Wait until there is one
+        // No spare slots on any device. Wait until there is one
         {
-            Timeplot::Action timer("get", getTimeplotWorker(), owner.outGroups[0]->getGetStat());
+            Timeplot::WaitAction timer(Timeplot::WAIT_OUTPUT, getTimeplotWorker());
             owner.popCondition.wait(popLock);
         }
     }
     popLock.release()->unlock();
+    return outGroup;
+}
+
+void CopyGroupBase::Worker::flush()
+{
+    if (bufferedItems.empty())
+        return;
+
+    const bool urgent = bufferedClosing;
+    bufferedClosing = false;
+
+    if (owner.zeroCopy)
+    {
+        /* The splats were gathered straight into the work item's persistent
+         * mapping, so there is nothing to upload. Unmapping makes the
+         * in-place writes visible to the device; on a shared-memory device
+         * this is a cheap synchronization, not a copy.
+         */
+        boost::shared_ptr<DeviceWorkerGroup::WorkItem> item;
+        item.swap(zcItem);
+        DeviceWorkerGroup *outGroup = zcOutGroup;
+        zcOutGroup = NULL;
+
+        item->subItems.swap(bufferedItems);
+        outGroup->getCopyQueue().enqueueUnmapMemObject(
+            item->splats, item->mapped, NULL, &item->copyEvent);
+        item->mapped = NULL;
+        /* The item was reserved at full capacity before its final size was
+         * known; return the unused part to the spare-capacity estimate.
+         */
+        outGroup->releaseReservation(owner.maxDeviceItemSplats - bufferedSplats);
+        outGroup->push(getTimeplotWorker(), item, urgent);
+        bufferedSplats = 0;
+        return;
+    }
+
+    DeviceWorkerGroup *outGroup = chooseOutGroup(bufferedSplats);
 
     // This should now never block
     boost::shared_ptr<DeviceWorkerGroup::WorkItem> item = outGroup->get(getTimeplotWorker(), bufferedSplats);
     item->subItems.swap(bufferedItems);
+    /* The two planes are uploaded with separate writes, since the plane
+     * stride of the staging buffer and of the device item are both their
+     * full capacities while only the first bufferedSplats elements of each
+     * plane are live. The copy queue is out-of-order, so the second write
+     * explicitly waits for the first to make the item's event cover both.
+     */
+    std::vector<cl::Event> planeWait(1);
     outGroup->getCopyQueue().enqueueWriteBuffer(
         item->splats,
         CL_FALSE,
-        0, bufferedSplats * sizeof(Splat),
-        pinned.get(),
-        NULL, &item->copyEvent);
+        0, bufferedSplats * sizeof(cl_float4),
+        pinned->get(),
+        NULL, &planeWait[0]);
+    outGroup->getCopyQueue().enqueueWriteBuffer(
+        item->splats,
+        CL_FALSE,
+        outGroup->getMaxItemSplats() * sizeof(cl_float4),
+        bufferedSplats * (owner.halfNormals ? 4 * sizeof(cl_half) : sizeof(cl_float4)),
+        pinned->get() + owner.maxDeviceItemSplats,
+        &planeWait, &item->copyEvent);
     cl::Event copyEvent = item->copyEvent;
-    outGroup->push(getTimeplotWorker(), item);
+    outGroup->push(getTimeplotWorker(), item, urgent);
 
-    /* Ensures that we can start refilling the pinned memory right away. Note
-     * that this is not the same as doing a synchronous transfer, because we
-     * are still overlapping the transfer with enqueuing the item.
+    /* Switch to the other staging buffer and refill it while this transfer
+     * is still in flight. We only have to drain the previous transfer out
+     * of that buffer (usually long finished) before reusing it.
      */
+    pinned = (pinned == &pinned0) ? &pinned1 : &pinned0;
+    if (prevCopyEvent() != NULL)
     {
         Timeplot::Action writeTimer("write", getTimeplotWorker(), owner.getWriteStat());
         writeTimer.setValue(bufferedSplats * sizeof(Splat));
-        copyEvent.wait();
+        prevCopyEvent.wait();
     }
+    prevCopyEvent = copyEvent;
     bufferedSplats = 0;
 }
 
+void CopyGroupBase::Worker::stop()
+{
+    flush();
+    if (prevCopyEvent() != NULL)
+    {
+        prevCopyEvent.wait();
+        prevCopyEvent = cl::Event(); // release the reference
+    }
+}
+
 void CopyGroupBase::Worker::operator()(WorkItem &work)
 {
     Timeplot::Action timer("compute", getTimeplotWorker(), owner.getComputeStat());
@@ -382,25 +902,68 @@ void CopyGroupBase::Worker::operator()(WorkItem &work)
     if (bufferedSplats + work.numSplats > owner.maxDeviceItemSplats)
         flush();
 
-    const Splat *in = work.getSplats();
-    Splat *out = pinned.get() + bufferedSplats;
+    /* Gather the bin's spans out of the shared batch. This is the only
+     * host-side copy of the splats after the load from disk, and it is also
+     * where the interleaved host Splat structs are split into the two-plane
+     * device layout: it fills either the pinned staging buffer, or in
+     * zero-copy mode the work item's own device-visible storage.
+     */
+    cl_float4 *stagingBase;
+    if (owner.zeroCopy)
+    {
+        if (!zcItem)
+        {
+            /* Bind an output item up front so the gather can write it in
+             * place. The reservation is made at full capacity since the
+             * final batch size is not yet known; flush() returns the
+             * unused part.
+             */
+            zcOutGroup = chooseOutGroup(owner.maxDeviceItemSplats);
+            zcItem = zcOutGroup->get(getTimeplotWorker(), owner.maxDeviceItemSplats);
+        }
+        stagingBase = zcItem->mapped;
+    }
+    else
+        stagingBase = pinned->get();
+    cl_float4 *posOut = stagingBase + bufferedSplats;
+    /* The normal/quality plane always starts maxDeviceItemSplats float4s
+     * in, but its element type depends on whether quantization is enabled.
+     */
+    cl_float4 * const plane = stagingBase + owner.maxDeviceItemSplats;
+    cl_float4 *normOut = plane + bufferedSplats;
+    cl_half *halfOut = reinterpret_cast<cl_half *>(plane) + 4 * bufferedSplats;
+    const Splat *base = work.batch.get();
     std::size_t progressSplats = 0;
-    for (std::size_t i = 0; i < work.numSplats; i++)
+    BOOST_FOREACH(const WorkItem::Span &span, work.spans)
     {
-        /* Each splat is accounted in the progress meter with the
-         * bin it is inside (half-open intervals). Note that this
-         * test is a short-cut that makes assumptions about the
-         * grid written by BucketLoader.
-         */
-        bool inside = true;
-        for (int j = 0; j < 3; j++)
+        const Splat *in = base + span.first;
+        for (std::size_t i = 0; i < span.second; i++)
         {
-            Grid::extent_type e = work.grid.getExtent(j);
-            float p = in[i].position[j];
-            inside = inside && p >= e.first && p < e.second;
+            /* Each splat is accounted in the progress meter with the
+             * bin it is inside (half-open intervals). Note that this
+             * test is a short-cut that makes assumptions about the
+             * grid written by BucketLoader.
+             */
+            bool inside = true;
+            for (int j = 0; j < 3; j++)
+            {
+                Grid::extent_type e = work.grid.getExtent(j);
+                float p = in[i].position[j];
+                inside = inside && p >= e.first && p < e.second;
+            }
+            progressSplats += inside;
+            // The halves of a Splat are exactly the two planes' float4s
+            std::memcpy(posOut++, in[i].position, sizeof(cl_float4));
+            if (owner.halfNormals)
+            {
+                *halfOut++ = floatToHalf(in[i].normal[0]);
+                *halfOut++ = floatToHalf(in[i].normal[1]);
+                *halfOut++ = floatToHalf(in[i].normal[2]);
+                *halfOut++ = floatToHalf(in[i].quality);
+            }
+            else
+                std::memcpy(normOut++, in[i].normal, sizeof(cl_float4));
         }
-        progressSplats += inside;
-        out[i] = in[i];
     }
     DeviceWorkerGroup::SubItem subItem;
     subItem.chunkId = work.chunkId;
@@ -410,9 +973,13 @@ void CopyGroupBase::Worker::operator()(WorkItem &work)
     subItem.progressSplats = progressSplats;
     bufferedItems.push_back(subItem);
     bufferedSplats += work.numSplats;
+    bufferedClosing = bufferedClosing || work.chunkClosing;
 
     owner.splatsStat.add(work.numSplats);
     owner.sizeStat.add(work.grid.numCells());
 
-    owner.splatBuffer.free(work.splats);
+    /* Drop this bin's reference promptly: the batch storage only returns to
+     * the circular buffer once the last bin sharing it has released it.
+     */
+    work.batch.reset();
 }
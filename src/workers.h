@@ -41,6 +41,8 @@
 #include <boost/thread/locks.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/foreach.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
 #include <cstddef>
@@ -68,6 +70,7 @@
 #include "allocator.h"
 #include "worker_group.h"
 #include "timeplot.h"
+#include "misc.h"
 
 class MesherGroup;
 
@@ -76,8 +79,20 @@ class MesherGroupBase
 public:
     struct WorkItem
     {
-        MesherWork work;
+        /**
+         * Meshes carried by this item. A large mesh travels alone, but
+         * small meshes are packed several to an item (see @ref MeshBatch)
+         * so that the queue and allocation overheads are amortized over
+         * the batch. All the payloads share @ref alloc and @ref pinned.
+         */
+        std::vector<MesherWork> works;
         CircularBuffer::Allocation alloc; ///< Allocation backing the mesh data
+        /**
+         * Pinned staging block holding the mesh data when it was read back
+         * from a device (see @ref OutputGeneratorBuilder). It is empty for
+         * items received over MPI, whose data lives in @ref alloc instead.
+         */
+        CLH::PinnedMemoryPool::Allocation pinned;
     };
 
     class Worker : public WorkerBase
@@ -93,13 +108,62 @@ public:
     };
 };
 
+/**
+ * Work item being filled with small meshes before it is queued (see
+ * @ref OutputGeneratorBuilder). The sparse tail of a run produces thousands
+ * of meshes of at most a few kilobytes each, and pushing each one separately
+ * costs more in queue wakeups and buffer allocations than its processing.
+ * Packing them into one item (one @ref CircularBuffer allocation, one queue
+ * transaction) makes the downstream overhead scale with bytes rather than
+ * bin count.
+ *
+ * Each device worker thread owns one batch, so no locking is needed. The
+ * batch is queued when its payload block fills up, and the owning thread
+ * flushes a partial batch at the end of each of its own work items so that
+ * meshes do not linger while it waits for more work.
+ */
+class MeshBatch : public boost::noncopyable
+{
+public:
+    /// Payload capacity of a batched work item
+    static const std::size_t BATCH_BYTES = 256 * 1024;
+    /// Meshes up to this size (rounded for alignment) are batched
+    static const std::size_t SMALL_BYTES = BATCH_BYTES / 8;
+
+    /// Item being filled (@c NULL when no batch is in progress)
+    boost::shared_ptr<MesherGroupBase::WorkItem> item;
+    /// Payload bytes of @ref item already used
+    std::size_t bytes;
+    /**
+     * Queues a completed item to the output group it was drawn from. It is
+     * set when a batch is started, which erases the group's type so that
+     * @ref flush can be called without knowing it.
+     */
+    boost::function<void(Timeplot::Worker &, const boost::shared_ptr<MesherGroupBase::WorkItem> &)> pusher;
+
+    MeshBatch() : bytes(0) {}
+
+    /// Queue the pending item, if any
+    void flush(Timeplot::Worker &tworker)
+    {
+        if (item)
+        {
+            pusher(tworker, item);
+            item.reset();
+            bytes = 0;
+        }
+    }
+};
+
 /**
  * Object for handling asynchronous meshing. It always uses one consumer thread, since
  * the operation is fundamentally not thread-safe. However, there may be multiple
- * producers.
+ * producers, so the low-contention queue is used to keep the queue overhead off
+ * the device threads that feed it.
  */
 class MesherGroup : protected MesherGroupBase,
-    public WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup>
+    public WorkerGroup<MesherGroupBase::WorkItem, MesherGroupBase::Worker, MesherGroup,
+                       LowContentionWorkQueue<boost::shared_ptr<MesherGroupBase::WorkItem> > >
 {
 public:
     typedef MesherGroupBase::WorkItem WorkItem;
@@ -109,6 +173,11 @@ public:
 
     boost::shared_ptr<WorkItem> get(Timeplot::Worker &tworker, std::size_t size);
 
+    /**
+     * Returns the item to @ref itemPool. It is called by the base class.
+     */
+    void freeItem(boost::shared_ptr<WorkItem> item);
+
     /**
      * Constructor.
      *
@@ -119,6 +188,16 @@ private:
     MesherBase::InputFunctor input;
     CircularBuffer meshBuffer;
 
+    /**
+     * Recycled work items. The mesh payload is already recycled through
+     * @ref meshBuffer, but without this pool each bin would also heap-allocate
+     * a fresh @ref WorkItem. Items released by @ref freeItem are reused by
+     * @ref get, so after warm-up there is no per-bin heap traffic. The pool
+     * grows to the maximum number of items in flight and stays there.
+     */
+    Statistics::Container::vector<boost::shared_ptr<WorkItem> > itemPool;
+    boost::mutex itemPoolMutex;    ///< Protects @ref itemPool
+
     friend class MesherGroupBase::Worker;
 
     void outputFunc(
@@ -155,6 +234,16 @@ protected:
         Grid::size_type yMax, Grid::size_type y, Grid::size_type yAlign, Grid::size_type zAlign);
 
 public:
+    /**
+     * Size in bytes of a work item's splat buffer: a full float4 plane of
+     * position/radius values, followed by a plane of normal/quality values
+     * that is half4 when quantization is enabled (see @ref WorkItem).
+     */
+    static std::size_t splatsBytes(std::size_t maxItemSplats, bool halfNormals)
+    {
+        return maxItemSplats * (sizeof(cl_float4) + (halfNormals ? 4 * sizeof(cl_half) : sizeof(cl_float4)));
+    }
+
     /// Data about a single bucket.
     struct SubItem
     {
@@ -170,12 +259,36 @@ public:
     {
         /// Data for individual buckets
         Statistics::Container::vector<SubItem> subItems;
-        cl::Buffer splats;             ///< Backing store for splats
+        /**
+         * Backing store for splats, in a two-plane structure-of-arrays
+         * layout: float4 position/radius values for splats
+         * [0, @a maxItemSplats) followed by their normal/quality
+         * values. The split lets the octree build read (and the MLS kernels
+         * gather) each plane with coalesced float4 loads; the plane stride
+         * is always the full item capacity, so partially-filled items leave
+         * a gap between the used parts of the planes rather than moving the
+         * second plane. With @a halfNormals the second plane holds half4
+         * values (quantized on the host, converted back by @c vload_half4
+         * in the kernels), shrinking the item and its upload from 32 to 24
+         * bytes per splat; positions and radii keep full precision since
+         * bucketing and the distance field depend on them directly.
+         */
+        cl::Buffer splats;
         cl::Event copyEvent;           ///< Event signaled when the splats are ready to use on device
+        /**
+         * Persistent host mapping of @ref splats in zero-copy mode (see
+         * @ref DeviceWorkerGroup::isZeroCopy), @c NULL otherwise or while
+         * the buffer is unmapped for device use.
+         */
+        cl_float4 *mapped;
 
-        WorkItem(const cl::Context &context, std::size_t maxItemSplats)
+        WorkItem(const cl::Context &context, std::size_t maxItemSplats, bool zeroCopy,
+                 bool halfNormals)
             : subItems("mem.DeviceWorkerGroup.subItems"),
-            splats(context, CL_MEM_READ_WRITE, maxItemSplats * sizeof(Splat))
+            splats(context,
+                   CL_MEM_READ_WRITE | (zeroCopy ? CL_MEM_ALLOC_HOST_PTR : 0),
+                   splatsBytes(maxItemSplats, halfNormals)),
+            mapped(NULL)
         {
         }
     };
@@ -185,21 +298,43 @@ public:
     private:
         DeviceWorkerGroup &owner;
 
-        const cl::CommandQueue queue;
-        SplatTreeCL tree;
+        const cl::CommandQueue queue;     ///< Queue for MLS and marching
+        const cl::CommandQueue treeQueue; ///< Queue for octree construction, so that it can overlap MLS
+
+        /**
+         * Octrees in flight, used round-robin. With more than one octree,
+         * the (integer-heavy) build of the next batch of bins can execute
+         * on @ref treeQueue while the (float-heavy) MLS evaluation of the
+         * previous batch executes on @ref queue.
+         */
+        boost::ptr_vector<SplatTreeCL> trees;
+        std::size_t nextTree;             ///< Next element of @ref trees to build into
+
+        /**
+         * Event signaled when the last enqueued consumer of each element of
+         * @ref trees has completed. A null event means the tree has not been
+         * used yet.
+         */
+        std::vector<cl::Event> treeBusy;
+
         MlsFunctor input;
         Marching marching;
-        ScaleBiasFilter scaleBias;
         MeshFilterChain filterChain;
 
+        /**
+         * Pending small meshes awaiting enough company to be worth queueing
+         * (see @ref MeshBatch). Flushed at the end of each work item.
+         */
+        MeshBatch meshBatch;
+
     public:
         typedef void result_type;
 
         Worker(
             DeviceWorkerGroup &owner,
             const cl::Context &context, const cl::Device &device,
-            int levels, float boundaryLimit,
-            MlsShape shape, int idx);
+            int levels, int pipeline, float boundaryLimit,
+            MlsShape shape, double timeSlice, int idx);
 
         void start();
         void operator()(WorkItem &work);
@@ -217,12 +352,14 @@ class DeviceWorkerGroup :
 {
 public:
     /**
-     * Functor that generates an output function given the current chunk ID and
-     * worker. This is used to abstract the downstream worker group class.
+     * Functor that generates an output function given the current chunk ID,
+     * worker, the pinned staging pool of the device that produced the
+     * output, and the calling thread's small-mesh batch. This is used to
+     * abstract the downstream worker group class.
      *
      * @see @ref DeviceWorkerGroup::DeviceWorkerGroup
      */
-    typedef boost::function<Marching::OutputFunctor(const ChunkId &, Timeplot::Worker &)> OutputGenerator;
+    typedef boost::function<Marching::OutputFunctor(const ChunkId &, Timeplot::Worker &, CLH::PinnedMemoryPool &, MeshBatch &)> OutputGenerator;
 
 private:
     typedef WorkerGroup<DeviceWorkerGroupBase::WorkItem, DeviceWorkerGroupBase::Worker, DeviceWorkerGroup> Base;
@@ -236,13 +373,51 @@ private:
     const std::size_t maxBucketSplats;  ///< Maximum splats in a single bucket
     const Grid::size_type maxCells;
     const std::size_t meshMemory;
+    /**
+     * Base octree subsampling shift. Sparse batches may be built with a
+     * larger shift (a coarser refinement level) chosen from their splat
+     * density; see @ref Worker::operator()().
+     */
     const int subsampling;
+    const bool zeroCopy;          ///< Whether work items are filled in place through persistent mappings
+    const bool halfNormals;       ///< Whether the normal/quality plane is quantized (see @ref isHalfNormals)
+
+    /**
+     * Turn arbitration with other processes sharing the device, or @c NULL
+     * when cooperative mode is disabled (see @ref CLH::DeviceShare).
+     */
+    CLH::DeviceShare * const share;
 
     cl::CommandQueue copyQueue;   ///< Queue for transferring data to the device
 
+    /**
+     * Recycled pinned staging blocks for mesh readback. Meshes produced by
+     * this device are read back into blocks from this pool (see
+     * @ref OutputGeneratorBuilder), so the device-to-host transfers run at
+     * pinned rates without pinning memory separately for each bin. The
+     * blocks in flight are bounded by the downstream group's mesh buffer.
+     */
+    CLH::PinnedMemoryPool pinnedMesh;
+
     /// Pool of unused buffers to be recycled
     WorkQueue<boost::shared_ptr<WorkItem> > itemPool;
 
+    /**
+     * Number of extra work items that may still be created on demand. The
+     * item pool is sized at startup for worst-case bins, and the device-fit
+     * validation budgets for that worst case. When the bins actually
+     * arriving are small the budgeted memory goes unused while the workers
+     * wait for the next upload, so @ref get admits extra items for small
+     * batches out of the headroom between the validated usage and the
+     * device's memory. Once created, a bonus item is recycled through
+     * @ref itemPool like any other, so the pool grows to its high-water
+     * mark and stays there.
+     */
+    std::size_t bonusItems_;
+
+    /// High-water mark of splats queued to this device
+    Statistics::Peak &queuedPeak;
+
     /// Mutex held while signaling @ref popCondition
     boost::mutex *popMutex;
 
@@ -254,6 +429,45 @@ private:
     /// Mutex protecting @ref unallocated_.
     boost::mutex unallocatedMutex;
 
+    /// Whether the device is taking new bins (see @ref setAdmitting)
+    bool admitting_;
+    /// Mutex protecting @ref admitting_.
+    boost::mutex admittingMutex;
+
+    /// Total splat capacity of the item pool
+    std::size_t poolSplats;
+
+    /**
+     * Exponentially-weighted average of the observed processing rate
+     * (splats per second) for this device. It is zero until the first work
+     * item completes.
+     */
+    double splatRate_;
+    /// Mutex protecting @ref splatRate_.
+    boost::mutex splatRateMutex;
+
+    /**
+     * Fold a new measurement into @ref splatRate_. Called by the worker
+     * after processing each item.
+     */
+    void recordRate(std::size_t numSplats, double seconds);
+
+    /**
+     * Split every bin in @a item in half along its longest axis, in place.
+     * Both halves of a bin share the original bin's splat range: the octree
+     * build only enters a splat into cells it actually intersects, so splats
+     * that fall outside a half simply contribute nothing to it. Bins that
+     * are already a single cell along every axis are kept as they are.
+     *
+     * @return The total splats over all bins that were split (the amount by
+     *         which the halves will over-credit the item pool), or 0 if
+     *         nothing could be split.
+     */
+    static std::size_t splitItem(WorkItem &item);
+
+    /// Create one pool work item (persistently mapped in zero-copy mode)
+    boost::shared_ptr<WorkItem> makeItem();
+
     friend class DeviceWorkerGroupBase::Worker;
 
 public:
@@ -266,8 +480,9 @@ public:
      * @param numWorkers         Number of worker threads to use (each with a separate OpenCL queue and state)
      * @param spare              Number of extra slots (beyond @a numWorkers) for items.
      * @param outputGenerator    Output handler generator. The generator is passed a chunk
-     *                           ID and @ref Timeplot::Worker, and returns a @ref Marching::OutputFunctor which
-     *                           which will receive the output blocks for the corresponding chunk.
+     *                           ID, a @ref Timeplot::Worker and this group's pinned staging pool, and
+     *                           returns a @ref Marching::OutputFunctor which
+     *                           will receive the output blocks for the corresponding chunk.
      * @param context            OpenCL context to run on.
      * @param device             OpenCL device to run on.
      * @param maxBucketSplats    Space to allocate for holding splats for one bucket.
@@ -275,8 +490,19 @@ public:
      * @param meshMemory         Maximum device bytes to use for mesh-related data.
      * @param levels             Levels to allocate for the octree.
      * @param subsampling        Octree subsampling level.
+     * @param pipeline           Number of octree builds to keep in flight per worker.
      * @param boundaryLimit      Tuning factor for boundary pruning.
      * @param shape              The shape to fit to the data
+     * @param timeSlice          Approximate bound on per-launch device time in
+     *                           seconds, for display GPUs with a driver
+     *                           watchdog (see @ref MlsFunctor::setTimeSlice
+     *                           and @ref Marching::setTimeSlice). Zero
+     *                           disables time slicing.
+     * @param zeroCopy           If true, work items are allocated in host-visible
+     *                           memory and filled in place (see @ref isZeroCopy).
+     * @param halfNormals        If true, the normal/quality plane of the work
+     *                           items is quantized to half precision (see
+     *                           @ref isHalfNormals).
      */
     DeviceWorkerGroup(
         std::size_t numWorkers, std::size_t spare,
@@ -284,8 +510,8 @@ public:
         const cl::Context &context, const cl::Device &device,
         std::size_t maxBucketSplats, Grid::size_type maxCells,
         std::size_t meshMemory,
-        int levels, int subsampling, float boundaryLimit,
-        MlsShape shape);
+        int levels, int subsampling, int pipeline, float boundaryLimit,
+        MlsShape shape, double timeSlice, bool zeroCopy, bool halfNormals);
 
     /// Returns total resources that would be used by all workers and workitems
     static CLH::ResourceUsage resourceUsage(
@@ -293,7 +519,7 @@ public:
         const cl::Device &device,
         std::size_t maxBucketSplats, Grid::size_type maxCells,
         std::size_t meshMemory,
-        int levels);
+        int levels, int pipeline, bool halfNormals);
 
     /**
      * @copydoc WorkerGroup::start
@@ -325,15 +551,47 @@ public:
     boost::shared_ptr<WorkItem> get(Timeplot::Worker &tworker, std::size_t size);
 
     /**
-     * Determine whether @ref get will block.
+     * Determine whether @ref get will block for a batch of @a numSplats
+     * splats. Small batches may be admitted even when the item pool is
+     * empty (see @ref bonusItems_). A detached device (see
+     * @ref setAdmitting) always answers no.
+     */
+    bool canGet(std::size_t numSplats);
+
+    /**
+     * Attach or detach the device at runtime. A detached device takes no
+     * new bins — @ref canGet answers no, so the copy workers route every
+     * batch to the remaining devices — but the handful of items already
+     * uploaded to it are processed to completion, after which its worker
+     * threads sit idle on the queue. Re-attaching merely resumes admission:
+     * the context, compiled kernels and device buffers are kept for the
+     * life of the run, so a returning device is productive immediately.
+     *
+     * Detaching every device leaves the copy workers waiting until one is
+     * re-attached; the job pauses rather than fails.
      */
-    bool canGet();
+    void setAdmitting(bool admitting);
+
+    /// Queries the flag set by @ref setAdmitting (initially true)
+    bool isAdmitting();
 
     /**
      * Returns the item to the pool. It is called by the base class.
      */
     void freeItem(boost::shared_ptr<WorkItem> item);
 
+    /**
+     * Process one item, containing OpenCL failures. If the worker throws a
+     * @c cl::Error indicating resource exhaustion (e.g. a pathological bin
+     * that needs more scratch memory than @ref resourceUsage predicted),
+     * every bin in the item is split in half with @ref splitItem and the
+     * item is retried, up to a few rounds of halving. Any other @c cl::Error
+     * (e.g. a spurious enqueue failure on a flaky device) is retried once on
+     * the same worker before being allowed to propagate. This keeps a single
+     * oversized bin or glitch from aborting a long reconstruction.
+     */
+    void processItem(Worker &worker, WorkItem &item);
+
     /**
      * Estimate spare queue capacity. It takes the theoretical maximum capacity
      * and subtracts splats that are in the queue. It is not necessarily possible
@@ -341,8 +599,45 @@ public:
      */
     std::size_t unallocated();
 
+    /**
+     * Estimate the time (in seconds) this device would take to process the
+     * splats already queued to it plus @a extraSplats more, based on the
+     * processing rate observed so far. Returns 0.0 if no rate has been
+     * measured yet, so that idle, unmeasured devices attract work and
+     * hence a measurement.
+     */
+    double estimateQueueTime(std::size_t extraSplats);
+
+    /**
+     * Whether splats reach the device zero-copy. On devices that share
+     * memory with the host (@c CL_DEVICE_HOST_UNIFIED_MEMORY), the work item
+     * buffers are allocated with @c CL_MEM_ALLOC_HOST_PTR and kept
+     * persistently mapped while in the pool, so @ref CopyGroup gathers
+     * splats straight into device-visible memory and no separate upload is
+     * needed. The mapping is released (a cheap synchronization, not a copy)
+     * when the item is pushed, and re-established by @ref freeItem.
+     */
+    bool isZeroCopy() const { return zeroCopy; }
+
+    /**
+     * Whether the normal/quality plane of the work items is quantized to
+     * half precision (see @ref WorkItem). @ref CopyGroup converts normals
+     * and quality to half at gather time when this is set.
+     */
+    bool isHalfNormals() const { return halfNormals; }
+
+    /**
+     * Return capacity that was reserved by @ref get but not used. This is
+     * needed in zero-copy mode, where an item is bound before the number of
+     * splats it will hold is known and must therefore be reserved at full
+     * capacity.
+     */
+    void releaseReservation(std::size_t numSplats);
+
     /// Return the maximum number of splats that can be copied to a work item
     std::size_t getMaxItemSplats() const { return maxBucketSplats; }
+    /// Return the total splat capacity of the item pool
+    std::size_t getPoolSplats() const { return poolSplats; }
     const cl::Context &getContext() const { return context; }
     const cl::Device &getDevice() const { return device; }
     const cl::CommandQueue &getCopyQueue() const { return copyQueue; }
@@ -354,27 +649,80 @@ class CopyGroup;
 class CopyGroupBase
 {
 public:
-    /// A single bin of splats
+    /**
+     * A single bin of splats. Rather than owning a copy of its splats, a bin
+     * holds a shared reference to the batch that @ref BucketLoader read from
+     * disk, plus a list of spans identifying its subset of the batch. Splats
+     * that fall in several overlapping bins are thus stored only once on the
+     * host; the single gather happens when the worker fills the pinned
+     * staging buffer. The batch storage is recycled when the last bin
+     * referencing it has been processed.
+     */
     struct WorkItem
     {
+        /// A contiguous run of splats within a batch: (first element, element count)
+        typedef std::pair<std::size_t, std::size_t> Span;
+
         ChunkId chunkId;
         Grid grid;
-        CircularBuffer::Allocation splats;  ///< Allocation from @ref CopyGroup::splatBuffer
+        boost::shared_ptr<const Splat> batch; ///< Batch from @ref CopyGroup::allocateBatch
+        /// Spans into @ref batch that make up this bin, in splat ID order
+        Statistics::Container::vector<Span> spans;
         std::size_t numSplats;              ///< Number of splats in the bin
+        /// Whether the bin closes a chunk (see @ref BucketCollector::Bin::chunkClosing)
+        bool chunkClosing;
 
-        Splat *getSplats() const { return (Splat *) splats.get(); }
+        WorkItem() : spans("mem.CopyGroup.spans"), numSplats(0), chunkClosing(false) {}
     };
 
     class Worker : public WorkerBase
     {
     private:
         CopyGroup &owner;
-        CLH::PinnedMemory<Splat> pinned;  ///< Staging area for copies
+        /**
+         * Double-buffered staging areas for copies. While the transfer from
+         * one buffer is still in flight, the worker refills the other, so
+         * that accumulating the next batch overlaps the upload of the
+         * previous one. Each buffer mirrors the two-plane layout of
+         * @ref DeviceWorkerGroup::WorkItem::splats, with a plane stride of
+         * @ref CopyGroup::maxDeviceItemSplats.
+         */
+        CLH::PinnedMemory<cl_float4> pinned0, pinned1;
+        CLH::PinnedMemory<cl_float4> *pinned; ///< Staging buffer currently being filled
+        /**
+         * Event for the transfer out of the buffer that is @em not currently
+         * being filled (NULL-like if none is in flight). It must complete
+         * before that buffer may be refilled.
+         */
+        cl::Event prevCopyEvent;
         /**
          * Bins that have been saved up but not yet flushed to the device.
          */
         Statistics::Container::vector<DeviceWorkerGroup::SubItem> bufferedItems;
         std::size_t bufferedSplats;       ///< Number of splats stored in @ref pinned
+        /**
+         * Whether any of the buffered bins closes a chunk. If so, the next
+         * @ref flush pushes the device item on the urgent lane (see
+         * @ref WorkQueue::push) so that the chunk's buffered state in the
+         * mesher can be retired sooner.
+         */
+        bool bufferedClosing;
+
+        /**
+         * In zero-copy mode, the work item currently being filled in place
+         * (see @ref DeviceWorkerGroup::isZeroCopy), and the group it was
+         * taken from. The item is bound when the first bin of a batch is
+         * gathered and released by @ref flush; the staging buffers are
+         * unused in this mode.
+         */
+        boost::shared_ptr<DeviceWorkerGroup::WorkItem> zcItem;
+        DeviceWorkerGroup *zcOutGroup;    ///< Owner of @ref zcItem
+
+        /**
+         * Pick the output group expected to finish @a numSplats more splats
+         * soonest, waiting if no group currently has a free item.
+         */
+        DeviceWorkerGroup *chooseOutGroup(std::size_t numSplats);
 
     public:
         typedef void result_type;
@@ -383,13 +731,25 @@ public:
 
         void flush();   ///< Flush items in @ref bufferedItems to the output
         void operator()(WorkItem &work);
-        void stop() { flush(); }
+        void stop();    ///< Flush and then drain the last in-flight transfer
     };
 };
 
 /**
  * A worker object that copies bins of data to the GPU. It receives data from
  * @ref BucketLoader and sends it to the next available @ref DeviceWorkerGroup.
+ *
+ * Splats travel disk &rarr; page cache &rarr; @ref CircularBuffer &rarr;
+ * batch &rarr; pinned staging &rarr; device; on unified-memory devices the
+ * staging step is elided (see @a zeroCopy). A direct-storage path that reads
+ * file extents straight into device memory (GPUDirect Storage style) was
+ * considered and rejected: the vendor APIs take CUDA device pointers and have
+ * no OpenCL equivalent, and the decode step must run on the host anyway
+ * (coordinate rebasing, quality computation, FLOAT64 narrowing and non-native
+ * vertex layouts), so such a path could only serve a narrow native-layout
+ * case. If the compute layer ever migrates to an API with direct-storage
+ * support, the place to short-circuit is @ref BucketLoader's load step
+ * feeding this group.
  */
 class CopyGroup :
     protected CopyGroupBase,
@@ -403,10 +763,13 @@ public:
      * Constructor.
      * @param outGroups       Target devices. The first is used for allocating pinned memory.
      * @param maxQueueSplats  Splats to store in the internal queue.
+     * @param numaNode        NUMA node for the worker and the splat buffer,
+     *                        or negative (the default) for no binding.
      */
     CopyGroup(
         const std::vector<DeviceWorkerGroup *> &outGroups,
-        std::size_t maxQueueSplats);
+        std::size_t maxQueueSplats,
+        int numaNode = -1);
 
     /**
      * @copydoc WorkerGroup::get
@@ -414,18 +777,36 @@ public:
     boost::shared_ptr<WorkItem> get(Timeplot::Worker &tworker, std::size_t size)
     {
         boost::shared_ptr<WorkItem> item = BaseType::get(tworker, size);
-        item->splats = splatBuffer.allocate(tworker, size * sizeof(Splat), &getStat);
         item->numSplats = size;
+        item->spans.clear();
         return item;
     }
 
+    /**
+     * Allocate backing store for one batch of splats from the internal
+     * circular buffer. Work items reference the batch through
+     * @ref WorkItem::batch; the storage returns to the buffer once the last
+     * referencing item has been processed and the caller has dropped its
+     * reference. Blocks until space is available, which is what bounds the
+     * amount of splat data queued ahead of the devices.
+     *
+     * @pre @a numSplats * sizeof(Splat) is no more than the @a
+     * maxQueueSplats capacity passed to the constructor.
+     */
+    boost::shared_ptr<Splat> allocateBatch(Timeplot::Worker &tworker, std::size_t numSplats);
+
     /// Statistic for timing @c clEnqueueWriteBuffer
     Statistics::Variable &getWriteStat() const { return writeStat; }
 
 private:
     const std::vector<DeviceWorkerGroup *> outGroups;
     const std::size_t maxDeviceItemSplats;     ///< Maximum splats to send to the device in one go
-    CircularBuffer splatBuffer;                ///< Buffer holding incoming splats
+    const bool zeroCopy;                       ///< Whether the output groups are filled in place
+    const bool halfNormals;                    ///< Whether the gather quantizes the normal/quality plane
+    CircularBuffer splatBuffer;                ///< Buffer holding incoming splat batches
+
+    /// Deleter hook for @ref allocateBatch: returns the storage to @ref splatBuffer
+    void freeBatch(CircularBuffer::Allocation alloc);
 
     boost::mutex popMutex;                     ///< Mutex held while checking for device to target
     boost::condition_variable popCondition;    ///< Condition signalled by devices when space available
@@ -441,6 +822,14 @@ private:
 /**
  * Wraps a worker group class to provide the @ref DeviceWorkerGroup::OutputGenerator
  * interface. The returned functor will push the data to the output group.
+ *
+ * The mesh is always read back to host memory here, even in multi-device
+ * runs. This is deliberate: the downstream consumer (@ref OOCMesher) welds
+ * and chunks vertices across the outputs of @em all devices on the host, so
+ * there is no device-resident consumer that a peer-to-peer handoff could
+ * feed, and OpenCL 1.x in any case provides no peer copy primitive. If a
+ * device-side welding stage is ever added, this is the place to route
+ * buffers between devices instead of through @ref HostKeyMesh.
  */
 template<typename OutGroup>
 class OutputGeneratorBuilder
@@ -457,10 +846,22 @@ private:
         OutGroup &outGroup;
         ChunkId chunkId;
         Timeplot::Worker &tworker;
+        CLH::PinnedMemoryPool &pinnedPool;
+        MeshBatch &batch;
+
+        /// Queues a completed batch item (type-erased into @ref MeshBatch::pusher)
+        static void pushItem(OutGroup &outGroup, Timeplot::Worker &tworker,
+                             const boost::shared_ptr<MesherGroupBase::WorkItem> &item)
+        {
+            outGroup.push(tworker, item);
+        }
+
     public:
         typedef void result_type;
-        Functor(OutGroup &outGroup, const ChunkId &chunkId, Timeplot::Worker &tworker)
-            : outGroup(outGroup), chunkId(chunkId), tworker(tworker)
+        Functor(OutGroup &outGroup, const ChunkId &chunkId, Timeplot::Worker &tworker,
+                CLH::PinnedMemoryPool &pinnedPool, MeshBatch &batch)
+            : outGroup(outGroup), chunkId(chunkId), tworker(tworker), pinnedPool(pinnedPool),
+            batch(batch)
         {
         }
 
@@ -479,9 +880,10 @@ public:
     {
     }
 
-    result_type operator()(const ChunkId &chunkId, Timeplot::Worker &tworker) const
+    result_type operator()(const ChunkId &chunkId, Timeplot::Worker &tworker,
+                           CLH::PinnedMemoryPool &pinnedPool, MeshBatch &batch) const
     {
-        return Functor(outGroup, chunkId, tworker);
+        return Functor(outGroup, chunkId, tworker, pinnedPool, batch);
     }
 };
 
@@ -492,20 +894,57 @@ void OutputGeneratorBuilder<OutGroup>::Functor::operator()(
             const std::vector<cl::Event> *events,
             cl::Event *event) const
 {
-    std::size_t bytes = mesh.getHostBytes();
+    const std::size_t bytes = mesh.getHostBytes();
+    const std::size_t rounded = roundUp(bytes, sizeof(cl_ulong)); // to ensure alignment
+
+    boost::shared_ptr<MesherGroupBase::WorkItem> item;
+    void *ptr;
+    bool batched = rounded <= MeshBatch::SMALL_BYTES;
+    if (batched)
+    {
+        /* Small meshes are packed into a shared item (see @ref MeshBatch).
+         * Only the queueing is deferred: the readback below is enqueued
+         * immediately, so the device-side mesh buffers are recycled just as
+         * in the unbatched path.
+         */
+        if (batch.item && batch.bytes + rounded > MeshBatch::BATCH_BYTES)
+            batch.flush(tworker);
+        if (!batch.item)
+        {
+            batch.item = outGroup.get(tworker, MeshBatch::BATCH_BYTES);
+            batch.item->pinned = pinnedPool.allocate(MeshBatch::BATCH_BYTES);
+            batch.pusher = boost::bind(&Functor::pushItem, boost::ref(outGroup), _1, _2);
+        }
+        item = batch.item;
+        ptr = static_cast<char *>(item->pinned.get()) + batch.bytes;
+        batch.bytes += rounded;
+    }
+    else
+    {
+        item = outGroup.get(tworker, bytes);
+        /* The circular-buffer allocation made by get() is retained purely as the
+         * shared memory budget: it bounds the mesh bytes in flight across all
+         * devices, exactly as before. The payload itself goes into a recycled
+         * pinned block so that the reads below run at pinned-transfer rates.
+         */
+        item->pinned = pinnedPool.allocate(bytes);
+        ptr = item->pinned.get();
+    }
 
-    boost::shared_ptr<typename OutGroup::WorkItem> item = outGroup.get(tworker, bytes);
-    item->work.mesh = HostKeyMesh(item->alloc.get(), mesh);
+    item->works.push_back(MesherWork());
+    MesherWork &work = item->works.back();
+    work.mesh = HostKeyMesh(ptr, mesh);
     std::vector<cl::Event> wait(3);
-    enqueueReadMesh(queue, mesh, item->work.mesh, events, &wait[0], &wait[1], &wait[2]);
+    enqueueReadMesh(queue, mesh, work.mesh, events, &wait[0], &wait[1], &wait[2]);
     CLH::enqueueMarkerWithWaitList(queue, &wait, event);
 
-    item->work.chunkId = chunkId;
-    item->work.hasEvents = true;
-    item->work.verticesEvent = wait[0];
-    item->work.vertexKeysEvent = wait[1];
-    item->work.trianglesEvent = wait[2];
-    outGroup.push(tworker, item);
+    work.chunkId = chunkId;
+    work.hasEvents = true;
+    work.verticesEvent = wait[0];
+    work.vertexKeysEvent = wait[1];
+    work.trianglesEvent = wait[2];
+    if (!batched)
+        outGroup.push(tworker, item);
 }
 
 template<typename T>
@@ -60,6 +60,11 @@ MemoryReader::offset_type MemoryReader::sizeImpl() const
     return size_;
 }
 
+const char *MemoryReader::dataImpl() const
+{
+    return data_;
+}
+
 MemoryReader::MemoryReader(const char *data, std::size_t size)
     : data_(data), size_(size)
 {
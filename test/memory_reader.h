@@ -51,6 +51,7 @@ private:
     virtual void closeImpl();
     virtual std::size_t readImpl(void *buffer, std::size_t count, offset_type offset) const;
     virtual offset_type sizeImpl() const;
+    virtual const char *dataImpl() const;
 
 public:
     /**
@@ -82,6 +82,16 @@ void MemoryWriterPlyBase::parse(
     const std::string &content,
     std::vector<boost::array<float, 3> > &vertices,
     std::vector<boost::array<std::tr1::uint32_t, 3> > &triangles)
+{
+    std::vector<boost::array<float, 3> > normals;
+    parse(content, vertices, normals, triangles);
+}
+
+void MemoryWriterPlyBase::parse(
+    const std::string &content,
+    std::vector<boost::array<float, 3> > &vertices,
+    std::vector<boost::array<float, 3> > &normals,
+    std::vector<boost::array<std::tr1::uint32_t, 3> > &triangles)
 {
     std::istringstream in(content);
     in.imbue(std::locale::classic());
@@ -91,12 +101,15 @@ void MemoryWriterPlyBase::parse(
 
     std::size_t numVertices = 0, numTriangles = 0;
     std::size_t headerSize = 0;
+    bool hasNormals = false;
     while (getline(in, line))
     {
         if (line.substr(0, vertexPrefix.size()) == vertexPrefix)
             numVertices = boost::lexical_cast<std::size_t>(line.substr(vertexPrefix.size()));
         else if (line.substr(0, trianglePrefix.size()) == trianglePrefix)
             numTriangles = boost::lexical_cast<std::size_t>(line.substr(trianglePrefix.size()));
+        else if (line == "property float32 nx")
+            hasNormals = true;
         else if (line == "end_header")
         {
             headerSize = in.tellg();
@@ -107,10 +120,25 @@ void MemoryWriterPlyBase::parse(
     MemoryReader handle(content.data(), content.size());
     handle.open("memory"); // filename is irrelevant
     vertices.resize(numVertices);
-    handle.read(&vertices[0][0], numVertices * sizeof(vertices[0]), headerSize);
+    normals.clear();
+    BinaryReader::offset_type pos = headerSize;
+    if (hasNormals)
+    {
+        normals.resize(numVertices);
+        for (std::size_t i = 0; i < numVertices; i++)
+        {
+            handle.read(&vertices[i][0], sizeof(vertices[i]), pos);
+            handle.read(&normals[i][0], sizeof(normals[i]), pos + sizeof(vertices[i]));
+            pos += sizeof(vertices[i]) + sizeof(normals[i]);
+        }
+    }
+    else
+    {
+        handle.read(&vertices[0][0], numVertices * sizeof(vertices[0]), pos);
+        pos += numVertices * sizeof(vertices[0]);
+    }
 
     triangles.resize(numTriangles);
-    BinaryReader::offset_type pos = headerSize + numVertices * sizeof(vertices[0]);
     for (std::size_t i = 0; i < numTriangles; i++)
     {
         handle.read(&triangles[i][0], sizeof(triangles[i]), pos + 1);
@@ -99,6 +99,22 @@ public:
         std::vector<boost::array<float, 3> > &vertices,
         std::vector<boost::array<std::tr1::uint32_t, 3> > &triangles);
 
+    /**
+     * Overload that also extracts per-vertex normals (see
+     * @ref FastPly::Writer::setNormals). If the file does not contain
+     * normals, @a normals is left empty.
+     *
+     * @param content        File contents
+     * @param[out] vertices  Vertices
+     * @param[out] normals   Per-vertex normals, if present
+     * @param[out] triangles Triangles
+     */
+    static void parse(
+        const std::string &content,
+        std::vector<boost::array<float, 3> > &vertices,
+        std::vector<boost::array<float, 3> > &normals,
+        std::vector<boost::array<std::tr1::uint32_t, 3> > &triangles);
+
 protected:
     std::tr1::unordered_map<std::string, std::string> outputs;
 };
@@ -48,6 +48,7 @@ class TestBinaryWriterMPI : public CppUnit::TestFixture
     CPPUNIT_TEST_SUITE(TestBinaryWriterMPI);
     CPPUNIT_TEST(testResize);
     CPPUNIT_TEST(testWrite);
+    CPPUNIT_TEST(testWriteAll);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -61,6 +62,7 @@ private:
 
     void testResize();
     void testWrite();
+    void testWriteAll();
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBinaryWriterMPI, TestSet::perBuild());
 
@@ -154,3 +156,43 @@ void TestBinaryWriterMPI::testWrite()
         reader->close();
     }
 }
+
+void TestBinaryWriterMPI::testWriteAll()
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    char buffer[64];
+    for (std::size_t i = 0; i < sizeof(buffer); i++)
+        buffer[i] = rank + i + 1;
+
+    /* Disjoint blocks per rank, with the last rank contributing nothing
+     * when there is more than one rank, to exercise a zero count.
+     */
+    const bool contribute = (size == 1) || (rank < size - 1);
+    writer->writeAll(buffer, contribute ? sizeof(buffer) : 0,
+                     BinaryWriterMPI::offset_type(rank) * sizeof(buffer));
+    writer->close();
+    MPI_Barrier(comm);
+
+    if (rank == 0)
+    {
+        boost::scoped_ptr<BinaryReader> reader(createReader(SYSCALL_READER));
+        reader->open(testPath);
+        const int writers = (size == 1) ? 1 : size - 1;
+        for (int r = 0; r < writers; r++)
+        {
+            char expected[sizeof(buffer)];
+            for (std::size_t i = 0; i < sizeof(buffer); i++)
+                expected[i] = r + i + 1;
+
+            std::size_t c = reader->read(buffer, sizeof(buffer),
+                                         BinaryWriterMPI::offset_type(r) * sizeof(buffer));
+            CPPUNIT_ASSERT_EQUAL(sizeof(buffer), c);
+            for (std::size_t i = 0; i < sizeof(buffer); i++)
+                CPPUNIT_ASSERT_EQUAL(int(expected[i]), int(buffer[i]));
+        }
+        reader->close();
+    }
+}
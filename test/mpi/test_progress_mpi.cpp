@@ -32,6 +32,7 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/ref.hpp>
+#include <boost/bind.hpp>
 #include <string>
 #include <mpi.h>
 #include "../testutil.h"
@@ -86,8 +87,8 @@ void TestProgressMPI::testSimple()
         parent.reset(new ProgressDisplay(total, output));
 
     ProgressMPI progress(parent.get(), total, MPI_COMM_WORLD, 0);
-    if (rank == 0)
-        thread.reset(new boost::thread(boost::ref(progress)));
+    // Every rank is a relay in the reduction tree, with one local producer
+    thread.reset(new boost::thread(boost::bind(&ProgressMPI::operator(), &progress, 1U)));
 
     int firstChunk = rank * chunksPerProcess;
     for (int i = 0; i < chunksPerProcess; i++)
@@ -100,10 +101,11 @@ void TestProgressMPI::testSimple()
             progress.sync();
     }
     progress.sync();
+    progress.close();
+    thread->join();
 
     if (rank == 0)
     {
-        thread->join();
         CPPUNIT_ASSERT_EQUAL(std::string(
                 "\n"
                 "0%   10   20   30   40   50   60   70   80   90   100%\n"
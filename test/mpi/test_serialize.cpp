@@ -62,6 +62,7 @@ class TestSerialize : public CppUnit::TestFixture
     SERIALIZE_TEST(testGrid);
     SERIALIZE_TEST(testChunkId);
     SERIALIZE_TEST(testSubset);
+    SERIALIZE_TEST(testBins);
     SERIALIZE_TEST(testMesherWork);
     CPPUNIT_TEST(testBroadcastString);
     CPPUNIT_TEST(testBroadcastPath);
@@ -81,6 +82,8 @@ private:
     void testChunkIdRecv(MPI_Comm comm, int source);
     void testSubsetSend(MPI_Comm comm, int dest);
     void testSubsetRecv(MPI_Comm comm, int source);
+    void testBinsSend(MPI_Comm comm, int dest);
+    void testBinsRecv(MPI_Comm comm, int source);
     void testMesherWorkSend(MPI_Comm comm, int dest);
     void testMesherWorkRecv(MPI_Comm comm, int source);
     void testBroadcastString();
@@ -180,6 +183,57 @@ void TestSerialize::testSubsetRecv(MPI_Comm comm, int source)
     MLSGPU_ASSERT_EQUAL(UINT64_C(1000000000000), ranges[2].second);
 }
 
+void TestSerialize::testBinsSend(MPI_Comm comm, int dest)
+{
+    Statistics::Container::vector<BucketCollector::Bin> bins("mem.test.bins", 2);
+
+    bins[0].ranges.addRange(1, 5);
+    bins[0].ranges.addRange(15, 20);
+    bins[0].ranges.flush();
+    bins[0].chunkId.gen = 7;
+    bins[0].chunkId.coords[0] = 1;
+    bins[0].chunkId.coords[1] = 2;
+    bins[0].chunkId.coords[2] = 3;
+    const float ref0[3] = {0.0f, 1.0f, 2.0f};
+    bins[0].grid = Grid(ref0, 1.5f, 0, 10, 2, 8, -4, 4);
+
+    bins[1].ranges.addRange(100, 200);
+    bins[1].ranges.flush();
+    bins[1].chunkId.gen = 8;
+    bins[1].chunkId.coords[0] = 4;
+    bins[1].chunkId.coords[1] = 5;
+    bins[1].chunkId.coords[2] = 6;
+    const float ref1[3] = {-1.0f, -2.0f, -3.0f};
+    bins[1].grid = Grid(ref1, 0.5f, -5, 5, -6, 6, -7, 7);
+
+    Serialize::send(bins, comm, dest);
+}
+
+void TestSerialize::testBinsRecv(MPI_Comm comm, int source)
+{
+    Statistics::Container::vector<BucketCollector::Bin> bins("mem.test.bins", 2);
+    Serialize::recv(bins, comm, source);
+
+    MLSGPU_ASSERT_EQUAL(2, bins[0].ranges.numRanges());
+    MLSGPU_ASSERT_EQUAL(9, bins[0].ranges.numSplats());
+    MLSGPU_ASSERT_EQUAL(7, bins[0].chunkId.gen);
+    MLSGPU_ASSERT_EQUAL(1, bins[0].chunkId.coords[0]);
+    MLSGPU_ASSERT_EQUAL(2, bins[0].chunkId.coords[1]);
+    MLSGPU_ASSERT_EQUAL(3, bins[0].chunkId.coords[2]);
+    MLSGPU_ASSERT_EQUAL(1.5f, bins[0].grid.getSpacing());
+    MLSGPU_ASSERT_EQUAL(0, bins[0].grid.getExtent(0).first);
+    MLSGPU_ASSERT_EQUAL(10, bins[0].grid.getExtent(0).second);
+
+    MLSGPU_ASSERT_EQUAL(1, bins[1].ranges.numRanges());
+    MLSGPU_ASSERT_EQUAL(100, bins[1].ranges.numSplats());
+    MLSGPU_ASSERT_EQUAL(8, bins[1].chunkId.gen);
+    MLSGPU_ASSERT_EQUAL(6, bins[1].chunkId.coords[2]);
+    MLSGPU_ASSERT_EQUAL(-1.0f, bins[1].grid.getReference()[0]);
+    MLSGPU_ASSERT_EQUAL(0.5f, bins[1].grid.getSpacing());
+    MLSGPU_ASSERT_EQUAL(-7, bins[1].grid.getExtent(2).first);
+    MLSGPU_ASSERT_EQUAL(7, bins[1].grid.getExtent(2).second);
+}
+
 void TestSerialize::testMesherWorkSend(MPI_Comm comm, int dest)
 {
     // TODO: also need to test the interaction with events. But I'm not sure
@@ -38,9 +38,11 @@
 #include <mpi.h>
 #include "../test_splat_set.h"
 #include "../testutil.h"
+#include "../../src/tr1_cstdint.h"
 #include "../../src/grid.h"
 #include "../../src/splat.h"
 #include "../../src/splat_set_mpi.h"
+#include "../../src/statistics.h"
 
 using namespace SplatSet;
 
@@ -52,6 +54,7 @@ class TestFastFileSetMPI : public TestFastFileSet
     CPPUNIT_TEST(testEmpty);
 #endif
     CPPUNIT_TEST(testProgress);
+    CPPUNIT_TEST(testPageCache);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -67,6 +70,7 @@ public:
 
     void testEmpty();            ///< Test error checking for an empty set
     void testProgress();         ///< Run with a progress stream (does not check output)
+    void testPageCache();        ///< Remote blob files are read on demand through the page cache
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestFastFileSetMPI, TestSet::perBuild());
 
@@ -111,3 +115,44 @@ void TestFastFileSetMPI::testProgress()
     boost::iostreams::stream<boost::iostreams::null_sink> nullStream(nullSink);
     set->computeBlobs(comm, 0, 2.5f, 5, &nullStream, false);
 }
+
+void TestFastFileSetMPI::testPageCache()
+{
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    boost::scoped_ptr<FastBlobSetMPI<FileSet> > set(new FastBlobSetMPI<FileSet>());
+    TestFileSet::populate(*set, splatData, store);
+    set->computeBlobs(comm, 0, 2.5f, 5, NULL, false);
+
+    const Statistics::Counter &fetches =
+        Statistics::getStatistic<Statistics::Counter>("blob.page.fetches");
+    const Statistics::Counter &hits =
+        Statistics::getStatistic<Statistics::Counter>("blob.page.hits");
+    const unsigned long long fetchesBefore = fetches.getTotal();
+    const unsigned long long hitsBefore = hits.getTotal();
+
+    /* Walk the blob stream twice. The first walk pulls the pages of the
+     * other ranks' blob files on demand; the second is served from the
+     * cache. Both must see the same blobs.
+     */
+    std::tr1::uint64_t counts[2];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        counts[pass] = 0;
+        boost::scoped_ptr<BlobStream> stream(
+            set->makeBlobStream(set->getBoundingGrid(), 5));
+        while (!stream->empty())
+        {
+            counts[pass]++;
+            ++*stream;
+        }
+    }
+    CPPUNIT_ASSERT(counts[0] > 0);
+    CPPUNIT_ASSERT_EQUAL(counts[0], counts[1]);
+    if (size > 1)
+    {
+        CPPUNIT_ASSERT(fetches.getTotal() > fetchesBefore);
+        CPPUNIT_ASSERT(hits.getTotal() > hitsBefore);
+    }
+}
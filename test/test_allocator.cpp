@@ -132,10 +132,12 @@ class TestContainers : public CppUnit::TestFixture
 {
     CPPUNIT_TEST_SUITE(TestContainers);
     CPPUNIT_TEST(testAll);
+    CPPUNIT_TEST(testGroup);
     CPPUNIT_TEST_SUITE_END();
 
 private:
     void testAll();     ///< Test all the container types in one test
+    void testGroup();   ///< Test per-subsystem aggregation of usage
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestContainers, TestSet::perBuild());
 
@@ -178,3 +180,28 @@ void TestContainers::testAll()
     size_type allDiff = allNew - allOld;
     CPPUNIT_ASSERT_EQUAL(vectorDiff + setDiff + mapDiff, allDiff);
 }
+
+void TestContainers::testGroup()
+{
+    typedef Statistics::Allocator<std::allocator<int> >::size_type size_type;
+    typedef Statistics::Peak Peak;
+    Peak &peakA = Statistics::getStatistic<Peak>("mem.grouptest.a");
+    Peak &peakB = Statistics::getStatistic<Peak>("mem.grouptest.b");
+    Peak &peakGroup = Statistics::getStatistic<Peak>("mem.grouptest.all");
+
+    size_type aOld = peakA.get();
+    size_type bOld = peakB.get();
+    size_type groupOld = peakGroup.get();
+
+    Statistics::Container::vector<int> a("mem.grouptest.a");
+    a.reserve(50);
+    Statistics::Container::vector<int> b("mem.grouptest.b");
+    b.reserve(30);
+
+    size_type aDiff = peakA.get() - aOld;
+    size_type bDiff = peakB.get() - bOld;
+    size_type groupDiff = peakGroup.get() - groupOld;
+    CPPUNIT_ASSERT(aDiff > 0);
+    CPPUNIT_ASSERT(bDiff > 0);
+    CPPUNIT_ASSERT_EQUAL(aDiff + bDiff, groupDiff);
+}
@@ -30,6 +30,8 @@
 
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
+#include <vector>
+#include <algorithm>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
@@ -46,6 +48,7 @@ class TestAsyncWriter : public CppUnit::TestFixture
 {
     CPPUNIT_TEST_SUITE(TestAsyncWriter);
     CPPUNIT_TEST(testStress);
+    CPPUNIT_TEST(testCoalesce);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -56,6 +59,12 @@ private:
     boost::filesystem::path filename;
 
     void testStress();   ///< Make lots of writes to file, check that they arrive
+    /**
+     * Feed a single worker tiny writes that alternate between two files, so
+     * that contiguous runs are repeatedly built up and broken, and check
+     * that both files arrive intact.
+     */
+    void testCoalesce();
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestAsyncWriter, TestSet::perNightly());
 
@@ -123,3 +132,64 @@ void TestAsyncWriter::testStress()
     CPPUNIT_ASSERT_EQUAL(size, pos);
     reader->close();
 }
+
+void TestAsyncWriter::testCoalesce()
+{
+    Timeplot::Worker tworker("test");
+    const std::size_t size = 1000000;
+
+    boost::filesystem::path filename2;
+    boost::filesystem::ofstream dummy;
+    createTmpFile(filename2, dummy);
+
+    boost::shared_ptr<BinaryWriter> out[2];
+    out[0].reset(createWriter(SYSCALL_WRITER));
+    out[1].reset(createWriter(SYSCALL_WRITER));
+    out[0]->open(filename);
+    out[1]->open(filename2);
+    out[0]->resize(size);
+    out[1]->resize(size);
+
+    /* A small buffer keeps the producer only just ahead of the single
+     * worker, so the queue repeatedly backs up and drains, exercising both
+     * the coalescing and the immediate-flush paths.
+     */
+    AsyncWriter async(1, 4096);
+    async.start();
+
+    std::tr1::mt19937 engine;
+    std::tr1::uniform_int<int> sizeDist(1, 64);
+    std::tr1::uniform_int<int> fileDist(0, 1);
+    std::size_t pos[2] = {0, 0};
+    while (pos[0] < size || pos[1] < size)
+    {
+        int f = fileDist(engine);
+        if (pos[f] >= size)
+            f = !f;
+        std::size_t chunk = std::min(std::size_t(sizeDist(engine)), size - pos[f]);
+        boost::shared_ptr<AsyncWriterItem> item = async.get(tworker, chunk);
+        char *ptr = reinterpret_cast<char *>(item->get());
+        for (std::size_t i = 0; i < chunk; i++)
+            ptr[i] = char(((pos[f] + i) * (f + 3)) & 0xFF);
+        async.push(tworker, item, out[f], chunk, pos[f]);
+        pos[f] += chunk;
+    }
+    out[0].reset();
+    out[1].reset();
+    async.stop();
+
+    for (int f = 0; f < 2; f++)
+    {
+        boost::scoped_ptr<BinaryReader> reader(createReader(SYSCALL_READER));
+        reader->open(f == 0 ? filename : filename2);
+        std::vector<char> buffer(size);
+        CPPUNIT_ASSERT_EQUAL(size, reader->read(&buffer[0], size, 0));
+        for (std::size_t i = 0; i < size; i++)
+        {
+            if (buffer[i] != char((i * (f + 3)) & 0xFF))
+                CPPUNIT_ASSERT_EQUAL(int(char((i * (f + 3)) & 0xFF)), int(buffer[i]));
+        }
+        reader->close();
+    }
+    boost::filesystem::remove(filename2);
+}
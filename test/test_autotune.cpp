@@ -0,0 +1,181 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref Autotune.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <CL/cl.hpp>
+#include "testutil.h"
+#include "../src/autotune.h"
+
+class TestAutotune : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestAutotune);
+    CPPUNIT_TEST(testCachePersistence);
+    CPPUNIT_TEST(testTune);
+    CPPUNIT_TEST(testTuneCached);
+    CPPUNIT_TEST(testTuneStale);
+    CPPUNIT_TEST(testTuneAllFail);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    boost::filesystem::path cachePath;
+    int calls;                    ///< Number of measurement calls made
+
+    /// Measurement function: fixed times, "fast" being the winner
+    double measure(const std::string &config);
+    /// Measurement function that always fails with an OpenCL error
+    double measureFail(const std::string &config);
+
+    std::vector<std::string> makeCandidates();
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testCachePersistence();  ///< Values survive into a new @ref Autotune::Cache
+    void testTune();              ///< The fastest candidate wins a sweep
+    void testTuneCached();        ///< A cached result short-circuits the sweep
+    void testTuneStale();         ///< A cached result not in the candidates re-tunes
+    void testTuneAllFail();       ///< An exception is raised if nothing runs
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestAutotune, TestSet::perBuild());
+
+void TestAutotune::setUp()
+{
+    cachePath = boost::filesystem::temp_directory_path() / "mlsgpu-test-tune.cache";
+    boost::filesystem::remove(cachePath);
+    calls = 0;
+}
+
+void TestAutotune::tearDown()
+{
+    boost::filesystem::remove(cachePath);
+}
+
+double TestAutotune::measure(const std::string &config)
+{
+    calls++;
+    if (config == "fast")
+        return 1.0;
+    else if (config == "slow")
+        return 3.0;
+    else
+        throw cl::Error(CL_INVALID_WORK_GROUP_SIZE, "clEnqueueNDRangeKernel");
+}
+
+double TestAutotune::measureFail(const std::string &config)
+{
+    (void) config;
+    calls++;
+    throw cl::Error(CL_INVALID_WORK_GROUP_SIZE, "clEnqueueNDRangeKernel");
+}
+
+std::vector<std::string> TestAutotune::makeCandidates()
+{
+    std::vector<std::string> candidates;
+    candidates.push_back("slow");
+    candidates.push_back("fast");
+    candidates.push_back("broken");
+    return candidates;
+}
+
+void TestAutotune::testCachePersistence()
+{
+    {
+        Autotune::Cache cache(cachePath);
+        cache.update("fp", "alg", "value");
+        std::string value;
+        CPPUNIT_ASSERT(cache.lookup("fp", "alg", value));
+        CPPUNIT_ASSERT_EQUAL(std::string("value"), value);
+        CPPUNIT_ASSERT(!cache.lookup("fp", "other", value));
+    }
+    {
+        Autotune::Cache cache(cachePath);
+        std::string value;
+        CPPUNIT_ASSERT(cache.lookup("fp", "alg", value));
+        CPPUNIT_ASSERT_EQUAL(std::string("value"), value);
+    }
+}
+
+void TestAutotune::testTune()
+{
+    Autotune::Cache cache(cachePath);
+    std::string best = Autotune::tune(
+        cache, "fp", "alg", makeCandidates(),
+        boost::bind(&TestAutotune::measure, this, _1));
+    CPPUNIT_ASSERT_EQUAL(std::string("fast"), best);
+    CPPUNIT_ASSERT_EQUAL(3, calls);  // the broken candidate was tried and skipped
+}
+
+void TestAutotune::testTuneCached()
+{
+    Autotune::Cache cache(cachePath);
+    cache.update("fp", "alg", "slow");
+    std::string best = Autotune::tune(
+        cache, "fp", "alg", makeCandidates(),
+        boost::bind(&TestAutotune::measure, this, _1));
+    CPPUNIT_ASSERT_EQUAL(std::string("slow"), best);
+    CPPUNIT_ASSERT_EQUAL(0, calls);
+}
+
+void TestAutotune::testTuneStale()
+{
+    Autotune::Cache cache(cachePath);
+    cache.update("fp", "alg", "retired");  // not in the candidate list
+    std::string best = Autotune::tune(
+        cache, "fp", "alg", makeCandidates(),
+        boost::bind(&TestAutotune::measure, this, _1));
+    CPPUNIT_ASSERT_EQUAL(std::string("fast"), best);
+    CPPUNIT_ASSERT_EQUAL(3, calls);
+
+    // The sweep result replaces the stale record
+    std::string value;
+    CPPUNIT_ASSERT(cache.lookup("fp", "alg", value));
+    CPPUNIT_ASSERT_EQUAL(std::string("fast"), value);
+}
+
+void TestAutotune::testTuneAllFail()
+{
+    Autotune::Cache cache(cachePath);
+    CPPUNIT_ASSERT_THROW(
+        Autotune::tune(cache, "fp", "alg", makeCandidates(),
+                       boost::bind(&TestAutotune::measureFail, this, _1)),
+        std::runtime_error);
+}
@@ -33,6 +33,7 @@
 #include <boost/scoped_ptr.hpp>
 #include <fstream>
 #include <sstream>
+#include <vector>
 #include <cctype>
 #include <locale>
 #include <iomanip>
@@ -99,6 +100,9 @@ class TestBinaryReader : public TestBinaryIO
     CPPUNIT_TEST(testReadEnd);
     CPPUNIT_TEST(testReadPastEnd);
     CPPUNIT_TEST(testReadZero);
+    CPPUNIT_TEST(testReadv);
+    CPPUNIT_TEST(testReadvEnd);
+    CPPUNIT_TEST(testReadvLarge);
     CPPUNIT_TEST(testSize);
     CPPUNIT_TEST_SUITE_END_ABSTRACT();
 
@@ -110,6 +114,9 @@ private:
     void testReadEnd();       ///< Test a read that crosses the end of file
     void testReadPastEnd();   ///< Test a read that does not intersect the file
     void testReadZero();      ///< Test reading zero bytes
+    void testReadv();         ///< Test a vectored read scattered over small slices
+    void testReadvEnd();      ///< Test a vectored read that crosses the end of file
+    void testReadvLarge();    ///< Test a vectored read with enough slices to need batching
     void testSize();          ///< Test @ref BinaryReader::size
 };
 
@@ -122,6 +129,8 @@ class TestBinaryWriter : public TestBinaryIO
     CPPUNIT_TEST(testWriteExtend);
     CPPUNIT_TEST(testWriteInside);
     CPPUNIT_TEST(testWriteZero);
+    CPPUNIT_TEST(testWritev);
+    CPPUNIT_TEST(testWritevLarge);
     CPPUNIT_TEST(testResize);
     CPPUNIT_TEST_SUITE_END_ABSTRACT();
 
@@ -138,6 +147,8 @@ private:
     void testWriteExtend();      ///< Write past the current end
     void testWriteInside();      ///< Write within the file
     void testWriteZero();        ///< Test a zero-byte write
+    void testWritev();           ///< Test a vectored write of small slices
+    void testWritevLarge();      ///< Test a vectored write with enough slices to need batching
     void testResize();           ///< Test @ref BinaryWriter::resize
 };
 
@@ -154,6 +165,7 @@ private:
 BINARY_READER_CLASS(TestSyscallReader, SYSCALL_READER);
 BINARY_READER_CLASS(TestMmapReader, MMAP_READER);
 BINARY_READER_CLASS(TestStreamReader, STREAM_READER);
+BINARY_READER_CLASS(TestDirectReader, DIRECT_READER);
 
 #define BINARY_WRITER_CLASS(name, writerType) \
     class name : public TestBinaryReader \
@@ -278,6 +290,61 @@ void TestBinaryReader::testReadZero()
     CPPUNIT_ASSERT_EQUAL('?', buffer[0]);
 }
 
+void TestBinaryReader::testReadv()
+{
+    char head[4], sink[3], tail[4];
+    BinaryReader::Slice slices[4];
+    slices[0].data = head;  slices[0].size = 4;
+    slices[1].data = sink;  slices[1].size = 3;  // discarded gap
+    slices[2].data = NULL;  slices[2].size = 0;  // empty slices must be harmless
+    slices[3].data = tail;  slices[3].size = 4;
+
+    boost::scoped_ptr<BinaryReader> b(factoryReader());
+    b->open(testPath);
+    std::size_t bytes = b->readv(slices, 4, 0);
+    MLSGPU_ASSERT_EQUAL(11, bytes);
+    CPPUNIT_ASSERT_EQUAL(std::string("hell"), std::string(head, 4));
+    CPPUNIT_ASSERT_EQUAL(std::string("orld"), std::string(tail, 4));
+}
+
+void TestBinaryReader::testReadvEnd()
+{
+    char head[6], tail[8];
+    BinaryReader::Slice slices[2];
+    slices[0].data = head;  slices[0].size = 6;
+    slices[1].data = tail;  slices[1].size = 8;
+    tail[4] = '?'; // sentinel value
+
+    boost::scoped_ptr<BinaryReader> b(factoryReader());
+    b->open(testPath);
+    std::size_t bytes = b->readv(slices, 2, seekPos);
+    MLSGPU_ASSERT_EQUAL(10, bytes);
+    CPPUNIT_ASSERT_EQUAL(std::string("big of"), std::string(head, 6));
+    CPPUNIT_ASSERT_EQUAL(std::string("fset"), std::string(tail, 4));
+    CPPUNIT_ASSERT_EQUAL('?', tail[4]);
+}
+
+void TestBinaryReader::testReadvLarge()
+{
+    // Enough slices to overflow an IOV_MAX batch or the fallback bounce buffer
+    const std::size_t numSlices = 20000;
+    const std::size_t pieceSize = 13;
+    std::vector<char> buffer(numSlices * pieceSize);
+    std::vector<BinaryReader::Slice> slices(numSlices);
+    for (std::size_t i = 0; i < numSlices; i++)
+    {
+        slices[i].data = &buffer[i * pieceSize];
+        slices[i].size = pieceSize;
+    }
+
+    boost::scoped_ptr<BinaryReader> b(factoryReader());
+    b->open(testPath);
+    std::size_t bytes = b->readv(&slices[0], numSlices, 0);
+    MLSGPU_ASSERT_EQUAL(buffer.size(), bytes);
+    const std::string expected = "hello world" + std::string(buffer.size() - 11, '\0');
+    CPPUNIT_ASSERT_EQUAL(expected, std::string(buffer.begin(), buffer.end()));
+}
+
 void TestBinaryReader::testSize()
 {
     boost::scoped_ptr<BinaryReader> b(factoryReader());
@@ -359,6 +426,48 @@ void TestBinaryWriter::testWriteZero()
     MLSGPU_ASSERT_EQUAL(0, file_size(testPath));
 }
 
+void TestBinaryWriter::testWritev()
+{
+    const std::string expected = std::string(5, '\0') + "goodbye cruel world";
+
+    BinaryWriter::Slice slices[4];
+    slices[0].data = "goodbye";   slices[0].size = 7;
+    slices[1].data = " cruel";    slices[1].size = 6;
+    slices[2].data = "";          slices[2].size = 0;  // empty slices must be harmless
+    slices[3].data = " world";    slices[3].size = 6;
+
+    boost::scoped_ptr<BinaryWriter> b(factoryWriter());
+    b->open(testPath);
+    std::size_t bytes = b->writev(slices, 4, 5);
+    MLSGPU_ASSERT_EQUAL(19, bytes);
+    b->close();
+
+    ASSERT_CONTENT(expected, testPath);
+}
+
+void TestBinaryWriter::testWritevLarge()
+{
+    // Enough slices to overflow an IOV_MAX batch or the fallback bounce buffer
+    const std::size_t numSlices = 20000;
+    const std::string piece = "0123456789abc";
+    std::string expected;
+    std::vector<BinaryWriter::Slice> slices(numSlices);
+    for (std::size_t i = 0; i < numSlices; i++)
+    {
+        slices[i].data = piece.data();
+        slices[i].size = piece.size();
+        expected += piece;
+    }
+
+    boost::scoped_ptr<BinaryWriter> b(factoryWriter());
+    b->open(testPath);
+    std::size_t bytes = b->writev(&slices[0], numSlices, 0);
+    MLSGPU_ASSERT_EQUAL(expected.size(), bytes);
+    b->close();
+
+    ASSERT_CONTENT(expected, testPath);
+}
+
 void TestBinaryWriter::testResize()
 {
     boost::scoped_ptr<BinaryWriter> b(factoryWriter());
@@ -368,3 +477,182 @@ void TestBinaryWriter::testResize()
 
     MLSGPU_ASSERT_EQUAL(seekPos, file_size(testPath));
 }
+
+#if HAVE_COMPRESS2
+
+/**
+ * Tests for the block-compressed container classes. These do not reuse
+ * @ref TestBinaryIO because the container requires either @ref
+ * BinaryWriter::resize before writing or append-only usage, and the
+ * physical file contents do not match the logical ones.
+ */
+class TestCompressedIO : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestCompressedIO);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testUnsized);
+    CPPUNIT_TEST(testHoles);
+    CPPUNIT_TEST(testBadMagic);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    virtual void setUp();     ///< Create a temporary file to hold the container
+    virtual void tearDown();  ///< Erase the temporary file
+
+private:
+    boost::filesystem::path testPath;
+
+    /// Generate deterministic pseudo-random data for round-tripping
+    static std::string makeData(std::size_t size);
+
+    void testRoundTrip();     ///< Write pieces out of order and read the whole file back
+    void testUnsized();       ///< Append data without calling @c resize first
+    void testHoles();         ///< Unwritten regions read back as zeros and take no space
+    void testBadMagic();      ///< Opening a file that is not a container fails cleanly
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCompressedIO, TestSet::perBuild());
+
+void TestCompressedIO::setUp()
+{
+    boost::filesystem::ofstream f;
+    createTmpFile(testPath, f);
+    f.close();
+}
+
+void TestCompressedIO::tearDown()
+{
+    boost::filesystem::remove(testPath);
+}
+
+std::string TestCompressedIO::makeData(std::size_t size)
+{
+    std::string ans(size, '\0');
+    std::tr1::uint32_t state = 12345;
+    for (std::size_t i = 0; i < size; i++)
+    {
+        state = state * 1103515245 + 12345;
+        ans[i] = char(state >> 24);
+    }
+    return ans;
+}
+
+void TestCompressedIO::testRoundTrip()
+{
+    // Spans several blocks plus a short tail block
+    const std::size_t size = 3 * 1024 * 1024 + 12345;
+    const std::size_t split = 1024 * 1024 + 7; // unaligned to block boundaries
+    const std::string data = makeData(size);
+
+    boost::scoped_ptr<BinaryWriter> w(createWriter(COMPRESSED_WRITER));
+    w->open(testPath);
+    w->resize(size);
+    // Write the pieces out of order, as the vertex and triangle passes do
+    std::size_t bytes = w->write(data.data() + split, size - split, split);
+    MLSGPU_ASSERT_EQUAL(size - split, bytes);
+    bytes = w->write(data.data(), split, 0);
+    MLSGPU_ASSERT_EQUAL(split, bytes);
+    w->close();
+
+    boost::scoped_ptr<BinaryReader> r(createReader(COMPRESSED_READER));
+    r->open(testPath);
+    MLSGPU_ASSERT_EQUAL(size, r->size());
+
+    std::vector<char> buffer(size);
+    bytes = r->read(&buffer[0], size, 0);
+    MLSGPU_ASSERT_EQUAL(size, bytes);
+    CPPUNIT_ASSERT(data == std::string(buffer.begin(), buffer.end()));
+
+    // Small read crossing a block boundary
+    bytes = r->read(&buffer[0], 20, 1048570);
+    MLSGPU_ASSERT_EQUAL(20, bytes);
+    CPPUNIT_ASSERT_EQUAL(data.substr(1048570, 20), std::string(&buffer[0], 20));
+
+    // Reads past the end are clamped
+    bytes = r->read(&buffer[0], 32, size - 5);
+    MLSGPU_ASSERT_EQUAL(5, bytes);
+    bytes = r->read(&buffer[0], 32, size + 100);
+    MLSGPU_ASSERT_EQUAL(0, bytes);
+    r->close();
+}
+
+void TestCompressedIO::testUnsized()
+{
+    // Spans several blocks plus a short tail block
+    const std::size_t size = 3 * 1024 * 1024 + 12345;
+    const std::string data = makeData(size);
+
+    boost::scoped_ptr<BinaryWriter> w(createWriter(COMPRESSED_WRITER));
+    w->open(testPath);
+    // Append in uneven chunks, as the temporary file writers do
+    std::size_t offset = 0;
+    std::size_t chunk = 1;
+    while (offset < size)
+    {
+        const std::size_t n = std::min(chunk, size - offset);
+        std::size_t bytes = w->write(data.data() + offset, n, offset);
+        MLSGPU_ASSERT_EQUAL(n, bytes);
+        offset += n;
+        chunk = chunk * 2 + 1;
+    }
+    w->close();
+
+    boost::scoped_ptr<BinaryReader> r(createReader(COMPRESSED_READER));
+    r->open(testPath);
+    MLSGPU_ASSERT_EQUAL(size, r->size());
+
+    std::vector<char> buffer(size);
+    std::size_t bytes = r->read(&buffer[0], size, 0);
+    MLSGPU_ASSERT_EQUAL(size, bytes);
+    CPPUNIT_ASSERT(data == std::string(buffer.begin(), buffer.end()));
+    r->close();
+}
+
+void TestCompressedIO::testHoles()
+{
+    const std::size_t size = 5 * 1024 * 1024 / 2;
+    const std::string msg = "hello world";
+    const BinaryIO::offset_type msgOffset = 2 * 1024 * 1024 + 100;
+
+    boost::scoped_ptr<BinaryWriter> w(createWriter(COMPRESSED_WRITER));
+    w->open(testPath);
+    w->resize(size);
+    std::size_t bytes = w->write(msg.data(), msg.size(), msgOffset);
+    MLSGPU_ASSERT_EQUAL(msg.size(), bytes);
+    w->close();
+
+    // The untouched blocks and the zero-filled tail should compress away
+    CPPUNIT_ASSERT(file_size(testPath) < 100000);
+
+    boost::scoped_ptr<BinaryReader> r(createReader(COMPRESSED_READER));
+    r->open(testPath);
+    MLSGPU_ASSERT_EQUAL(size, r->size());
+
+    std::vector<char> buffer(200, '?');
+    bytes = r->read(&buffer[0], buffer.size(), msgOffset - 50);
+    MLSGPU_ASSERT_EQUAL(buffer.size(), bytes);
+    const std::string expected
+        = std::string(50, '\0') + msg + std::string(buffer.size() - 50 - msg.size(), '\0');
+    CPPUNIT_ASSERT_EQUAL(expected, std::string(buffer.begin(), buffer.end()));
+
+    // A block that was never written at all reads back as zeros
+    bytes = r->read(&buffer[0], buffer.size(), 12345);
+    MLSGPU_ASSERT_EQUAL(buffer.size(), bytes);
+    CPPUNIT_ASSERT_EQUAL(std::string(buffer.size(), '\0'),
+                         std::string(buffer.begin(), buffer.end()));
+    r->close();
+}
+
+void TestCompressedIO::testBadMagic()
+{
+    {
+        boost::filesystem::ofstream f(testPath, std::ios::binary);
+        f << "this is not a compressed container, but is long enough to hold a footer";
+        f.close();
+    }
+
+    boost::scoped_ptr<BinaryReader> r(createReader(COMPRESSED_READER));
+    CPPUNIT_ASSERT_THROW(r->open(testPath), std::ios::failure);
+    CPPUNIT_ASSERT_EQUAL(false, r->isOpen());
+}
+
+#endif // HAVE_COMPRESS2
@@ -0,0 +1,114 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref BloomFilter.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __STDC_CONSTANT_MACROS
+# define __STDC_CONSTANT_MACROS
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstddef>
+#include "../src/tr1_cstdint.h"
+#include "../src/bloom_filter.h"
+#include "testutil.h"
+
+/// Tests for @ref BloomFilter
+class TestBloomFilter : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestBloomFilter);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testNoFalseNegatives);
+    CPPUNIT_TEST(testFalsePositiveRate);
+    CPPUNIT_TEST(testResize);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    void testEmpty();              ///< An unsized filter contains nothing
+    void testNoFalseNegatives();   ///< Every added key must be reported present
+    void testFalsePositiveRate();  ///< Absent keys are mostly rejected
+    void testResize();             ///< @ref BloomFilter::resize discards content
+
+    /// Deterministic pseudo-random 64-bit key sequence
+    static std::tr1::uint64_t scramble(std::tr1::uint64_t i)
+    {
+        return i * UINT64_C(0x9E3779B97F4A7C15) + (i >> 3);
+    }
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBloomFilter, TestSet::perBuild());
+
+void TestBloomFilter::testEmpty()
+{
+    BloomFilter f("mem.test.bloomFilter");
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), f.capacity());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), f.size());
+    CPPUNIT_ASSERT(!f.maybeContains(0));
+    CPPUNIT_ASSERT(!f.maybeContains(UINT64_C(0xFFFFFFFFFFFFFFFF)));
+}
+
+void TestBloomFilter::testNoFalseNegatives()
+{
+    const std::size_t N = 10000;
+    BloomFilter f("mem.test.bloomFilter");
+    f.resize(N);
+    CPPUNIT_ASSERT(f.capacity() >= N);
+    for (std::size_t i = 0; i < N; i++)
+        f.add(scramble(i));
+    CPPUNIT_ASSERT_EQUAL(N, f.size());
+    for (std::size_t i = 0; i < N; i++)
+        CPPUNIT_ASSERT(f.maybeContains(scramble(i)));
+}
+
+void TestBloomFilter::testFalsePositiveRate()
+{
+    const std::size_t N = 10000;
+    BloomFilter f("mem.test.bloomFilter");
+    f.resize(N);
+    for (std::size_t i = 0; i < N; i++)
+        f.add(scramble(i));
+
+    std::size_t hits = 0;
+    for (std::size_t i = N; i < 2 * N; i++)
+        if (f.maybeContains(scramble(i)))
+            hits++;
+    // Expected rate at 10 bits per key is well under 1%; allow a wide margin
+    CPPUNIT_ASSERT(hits < N / 20);
+}
+
+void TestBloomFilter::testResize()
+{
+    BloomFilter f("mem.test.bloomFilter");
+    f.resize(16);
+    f.add(123);
+    CPPUNIT_ASSERT(f.maybeContains(123));
+
+    f.resize(1000);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), f.size());
+    CPPUNIT_ASSERT(!f.maybeContains(123));
+}
@@ -267,6 +267,10 @@ class TestBucket : public CppUnit::TestFixture
     CPPUNIT_TEST(testFlat);
     CPPUNIT_TEST(testEmpty);
     CPPUNIT_TEST(testChunkCells);
+    CPPUNIT_TEST(testSlabs);
+    CPPUNIT_TEST(testSlabsChunked);
+    CPPUNIT_TEST(testThreads);
+    CPPUNIT_TEST(testThreadsDensityError);
     CPPUNIT_TEST_SUITE_ADD_CUSTOM_TESTS(addRandom);
     CPPUNIT_TEST_SUITE_END();
 
@@ -306,6 +310,10 @@ public:
     void testFlat();              ///< Top level already meets the requirements
     void testEmpty();             ///< Edge case with zero splats inside the grid
     void testChunkCells();        ///< Test non-zero @a chunkCells
+    void testSlabs();             ///< Test the slab-sliced driver
+    void testSlabsChunked();      ///< Test slab slicing combined with chunking
+    void testThreads();           ///< Test that a threaded walk reproduces the serial output
+    void testThreadsDensityError(); ///< Test that @ref Bucket::DensityError propagates from a worker
     void testRandom(unsigned long seed); ///< Randomly-generated test case
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBucket, TestSet::perBuild());
@@ -565,6 +573,96 @@ void TestBucket::testChunkCells()
     validate(splats, grid, blocks, maxSplats, INT_MAX, chunkCellsRounded);
 }
 
+void TestBucket::testSlabs()
+{
+    setupSimple();
+
+    const float ref[3] = {-10.0f, 0.0f, 10.0f};
+    Grid grid(ref, 2.5f, 4, 20, 0, 20, -4, 4);
+    std::vector<Block> blocks;
+    const int maxSplats = 5;
+    const int maxCells = 8;
+    const int maxSplit = 1000000;
+    // Rounded up to 8 (the microblock size), giving slabs of 8, 8 and 4
+    // cells along the Y axis.
+    const int slabCells = 6;
+    bucketSlabs(splats, grid, maxSplats, maxCells, 0, maxCells, maxSplit, slabCells,
+           boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3));
+    validate(splats, grid, blocks, maxSplats, maxCells, 0);
+}
+
+void TestBucket::testSlabsChunked()
+{
+    setupSimple();
+
+    const float ref[3] = {-10.0f, 0.0f, 10.0f};
+    Grid grid(ref, 2.5f, 4, 20, 0, 20, -4, 4);
+    std::vector<Block> blocks;
+    const int maxSplats = 20;
+    const int maxCells = 8;
+    const int maxSplit = 1000000;
+    const int chunkCells = 14;
+    const int chunkCellsRounded = 16;
+    // Rounded up to the rounded chunk size, giving slabs of 16 and 4 cells
+    // along the Y axis.
+    const int slabCells = 10;
+    bucketSlabs(splats, grid, maxSplats, INT_MAX, chunkCells, maxCells, maxSplit, slabCells,
+           boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3));
+    validate(splats, grid, blocks, maxSplats, INT_MAX, chunkCellsRounded);
+}
+
+void TestBucket::testThreads()
+{
+    setupSimple();
+
+    const float ref[3] = {-10.0f, 0.0f, 10.0f};
+    Grid grid(ref, 2.5f, 4, 20, 0, 20, -4, 4);
+    const int maxSplats = 5;
+    const int maxCells = 8;
+    const int maxSplit = 8; // force multi-level recursion so subtrees exist
+
+    std::vector<Block> serialBlocks, threadedBlocks;
+    bucket(splats, grid, maxSplats, maxCells, 0, maxCells, maxSplit,
+           boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(serialBlocks), _1, _2, _3));
+    bucket(splats, grid, maxSplats, maxCells, 0, maxCells, maxSplit,
+           boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(threadedBlocks), _1, _2, _3),
+           Recursion(), 4);
+    validate(splats, grid, threadedBlocks, maxSplats, maxCells, 0);
+
+    /* The threaded walk must produce exactly the serial output, in the serial
+     * order: downstream consumers depend on the walk being deterministic.
+     */
+    CPPUNIT_ASSERT_EQUAL(serialBlocks.size(), threadedBlocks.size());
+    for (std::size_t i = 0; i < serialBlocks.size(); i++)
+    {
+        const Block &s = serialBlocks[i];
+        const Block &t = threadedBlocks[i];
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            CPPUNIT_ASSERT_EQUAL(s.grid.getExtent(j).first, t.grid.getExtent(j).first);
+            CPPUNIT_ASSERT_EQUAL(s.grid.getExtent(j).second, t.grid.getExtent(j).second);
+        }
+        CPPUNIT_ASSERT(s.splatIds == t.splatIds);
+    }
+}
+
+void TestBucket::testThreadsDensityError()
+{
+    setupSimple();
+
+    const float ref[3] = {-10.0f, 0.0f, 10.0f};
+    Grid grid(ref, 2.5f, 4, 20, 0, 20, -4, 4);
+    std::vector<Block> blocks;
+    const int maxSplats = 1;
+    const int maxCells = 8;
+    const int maxSplit = 8;
+    CPPUNIT_ASSERT_THROW(
+        bucket(splats, grid, maxSplats, maxCells, 0, maxCells, maxSplit,
+           boost::bind(&TestBucket::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3),
+           Recursion(), 4),
+        DensityError);
+}
+
 static int simpleRandomInt(std::tr1::mt19937 &engine, int min, int max)
 {
     using std::tr1::mt19937;
@@ -0,0 +1,331 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref bucket_plan.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/bind.hpp>
+#include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <boost/ref.hpp>
+#include <map>
+#include <sstream>
+#include <vector>
+#include "../src/tr1_cstdint.h"
+#include "testutil.h"
+#include "test_splat_set.h"
+#include "../src/bucket.h"
+#include "../src/bucket_plan.h"
+#include "../src/splat_set.h"
+
+using namespace Bucket;
+
+static bool gridsIntersect(const Grid &a, const Grid &b)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (a.getExtent(i).second <= b.getExtent(i).first
+            || b.getExtent(i).second <= a.getExtent(i).first)
+            return false;
+    }
+    return true;
+}
+
+/// Tests for @ref Bucket::Plan and @ref Bucket::bucketPlan
+class TestBucketPlan : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestBucketPlan);
+    CPPUNIT_TEST(testSaveLoad);
+    CPPUNIT_TEST(testLoadBad);
+    CPPUNIT_TEST(testReplaySame);
+    CPPUNIT_TEST(testReplayFiner);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    struct Block
+    {
+        Grid grid;
+        SplatSet::splat_id numSplats;
+        std::vector<SplatSet::splat_id> splatIds;
+        std::vector<Splat> splats;
+    };
+
+    typedef SplatSet::FastBlobSet<SplatSet::VectorsSet> Splats;
+    Splats splats;
+
+    void setupSimple();
+
+    /**
+     * Record a plan by running @ref Bucket::bucket over the standard test
+     * grid with the standard parameters. The processed blocks are appended
+     * to @a blocks.
+     */
+    void recordSimple(Plan &plan, std::vector<Block> &blocks);
+
+    /// Check the guarantees that @ref Bucket::bucket also makes
+    void validate(const Splats &splats, const Grid &fullGrid,
+                  const std::vector<Block> &blocks,
+                  std::size_t maxSplats, Grid::size_type maxCells);
+
+    template<typename T>
+    static void bucketFunc(
+        std::vector<Block> &blocks,
+        const typename SplatSet::Traits<T>::subset_type &splats,
+        const Grid &grid,
+        const Recursion &recursionState);
+
+public:
+    void testSaveLoad();     ///< Round-trip a plan through the text format
+    void testLoadBad();      ///< Loading rejects foreign and truncated files
+    void testReplaySame();   ///< Replay against the same grid reproduces the decomposition
+    void testReplayFiner();  ///< Replay against a finer grid refines oversized leaves
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestBucketPlan, TestSet::perBuild());
+
+template<typename T>
+void TestBucketPlan::bucketFunc(
+    std::vector<Block> &blocks,
+    const typename SplatSet::Traits<T>::subset_type &splats,
+    const Grid &grid,
+    const Recursion &)
+{
+    blocks.push_back(Block());
+    Block &block = blocks.back();
+    block.numSplats = splats.numSplats();
+    block.grid = grid;
+    boost::scoped_ptr<SplatSet::SplatStream> splatStream(splats.makeSplatStream());
+    Splat splat;
+    SplatSet::splat_id id;
+    while (splatStream->read(&splat, &id, 1) != 0)
+    {
+        block.splatIds.push_back(id);
+        block.splats.push_back(splat);
+    }
+}
+
+void TestBucketPlan::validate(
+    const Splats &splats,
+    const Grid &fullGrid,
+    const std::vector<Block> &blocks,
+    std::size_t maxSplats,
+    Grid::size_type maxCells)
+{
+    /* To check that we haven't left out any part of a splat, we add up the
+     * areas of the intersections with the blocks and check that it adds up to
+     * the full bounding box of the splat (see TestBucket::validate).
+     */
+    std::map<SplatSet::splat_id, std::tr1::uint64_t> areas;
+
+    BOOST_FOREACH(const Block &block, blocks)
+    {
+        CPPUNIT_ASSERT(block.numSplats > 0);
+        CPPUNIT_ASSERT(block.numSplats <= maxSplats);
+        for (int i = 0; i < 3; i++)
+        {
+            CPPUNIT_ASSERT(block.grid.numCells(i) <= maxCells);
+            CPPUNIT_ASSERT_EQUAL(fullGrid.getReference()[i], block.grid.getReference()[i]);
+            CPPUNIT_ASSERT(fullGrid.getExtent(i).first <= block.grid.getExtent(i).first);
+            CPPUNIT_ASSERT(fullGrid.getExtent(i).second >= block.grid.getExtent(i).second);
+        }
+        CPPUNIT_ASSERT_EQUAL(fullGrid.getSpacing(), block.grid.getSpacing());
+
+        for (std::size_t i = 0; i < block.splatIds.size(); i++)
+        {
+            const Splat &splat = block.splats[i];
+            std::tr1::uint64_t area = 1;
+            boost::array<Grid::difference_type, 3> lower, upper;
+            SplatSet::detail::splatToBuckets(splat, block.grid, 1, lower, upper);
+            for (int k = 0; k < 3; k++)
+            {
+                lower[k] = std::max(lower[k], 0);
+                upper[k] = std::min(upper[k], Grid::difference_type(block.grid.numCells(k)) - 1);
+                CPPUNIT_ASSERT(lower[k] <= upper[k]);
+                area *= (upper[k] - lower[k] + 1);
+            }
+            areas[block.splatIds[i]] += area;
+        }
+    }
+
+    /* The blocks must not overlap */
+    for (std::size_t b1 = 0; b1 < blocks.size(); b1++)
+        for (std::size_t b2 = b1 + 1; b2 < blocks.size(); b2++)
+        {
+            CPPUNIT_ASSERT(!gridsIntersect(blocks[b1].grid, blocks[b2].grid));
+        }
+
+    /* Every splat must be fully covered */
+    boost::scoped_ptr<SplatSet::SplatStream> splatStream(splats.makeSplatStream());
+    Splat splat;
+    SplatSet::splat_id id;
+    while (splatStream->read(&splat, &id, 1) != 0)
+    {
+        boost::array<Grid::difference_type, 3> lower, upper;
+        SplatSet::detail::splatToBuckets(splat, fullGrid, 1, lower, upper);
+        std::tr1::uint64_t area = 1;
+        for (unsigned int k = 0; k < 3; k++)
+            if (lower[k] <= upper[k])
+                area *= upper[k] - lower[k] + 1;
+            else
+                area = 0;
+        CPPUNIT_ASSERT_EQUAL(area, areas[id]);
+    }
+}
+
+void TestBucketPlan::setupSimple()
+{
+    createSplats(splats);
+    splats.computeBlobs(2.5f, 1);
+}
+
+void TestBucketPlan::recordSimple(Plan &plan, std::vector<Block> &blocks)
+{
+    const float ref[3] = {-10.0f, 0.0f, 10.0f};
+    Grid grid(ref, 2.5f, 4, 20, 0, 20, -4, 4);
+    const int maxSplats = 5;
+    const int maxCells = 8;
+    const int maxSplit = 1000000;
+
+    ProcessorType<Splats>::type process
+        = boost::bind(&TestBucketPlan::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3);
+    PlanRecorder<Splats> recorder(plan, process);
+    plan.setNumSplats(splats.numSplats());
+    bucket(splats, grid, maxSplats, maxCells, 0, maxCells, maxSplit, recorder);
+}
+
+void TestBucketPlan::testSaveLoad()
+{
+    setupSimple();
+
+    Plan plan;
+    std::vector<Block> blocks;
+    recordSimple(plan, blocks);
+    CPPUNIT_ASSERT(!plan.empty());
+    CPPUNIT_ASSERT_EQUAL(blocks.size(), plan.numLeaves());
+    CPPUNIT_ASSERT_EQUAL(splats.numSplats(), plan.getNumSplats());
+
+    std::stringstream store;
+    plan.save(store);
+
+    Plan loaded;
+    CPPUNIT_ASSERT(loaded.load(store));
+    CPPUNIT_ASSERT_EQUAL(plan.numLeaves(), loaded.numLeaves());
+    CPPUNIT_ASSERT_EQUAL(plan.getNumSplats(), loaded.getNumSplats());
+    for (std::size_t i = 0; i < plan.numLeaves(); i++)
+    {
+        const Plan::Leaf &a = plan.getLeaf(i);
+        const Plan::Leaf &b = loaded.getLeaf(i);
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(a.worldLower[j], b.worldLower[j], 1e-9);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(a.worldUpper[j], b.worldUpper[j], 1e-9);
+        }
+        CPPUNIT_ASSERT_EQUAL(a.numSplats, b.numSplats);
+    }
+}
+
+void TestBucketPlan::testLoadBad()
+{
+    Plan plan;
+
+    {
+        std::stringstream store("");
+        CPPUNIT_ASSERT(!plan.load(store));
+        CPPUNIT_ASSERT(plan.empty());
+    }
+    {
+        std::stringstream store("something-else 1\n0 0\n");
+        CPPUNIT_ASSERT(!plan.load(store));
+    }
+    {
+        std::stringstream store("mlsgpu-bucket-plan 999\n0 0\n");
+        CPPUNIT_ASSERT(!plan.load(store));
+    }
+    {
+        // Header promises a leaf that is not there
+        std::stringstream store("mlsgpu-bucket-plan 1\n10 1\n");
+        CPPUNIT_ASSERT(!plan.load(store));
+        CPPUNIT_ASSERT(plan.empty());
+    }
+}
+
+void TestBucketPlan::testReplaySame()
+{
+    setupSimple();
+
+    Plan plan;
+    std::vector<Block> recorded;
+    recordSimple(plan, recorded);
+
+    // Round-trip through the text format to test the whole pipeline
+    std::stringstream store;
+    plan.save(store);
+    Plan loaded;
+    CPPUNIT_ASSERT(loaded.load(store));
+
+    const float ref[3] = {-10.0f, 0.0f, 10.0f};
+    Grid grid(ref, 2.5f, 4, 20, 0, 20, -4, 4);
+    const int maxSplats = 5;
+    const int maxCells = 8;
+    const int maxSplit = 1000000;
+    std::vector<Block> blocks;
+    bucketPlan(splats, grid, loaded, maxSplats, maxCells, maxCells, maxSplit,
+               boost::bind(&TestBucketPlan::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3));
+
+    validate(splats, grid, blocks, maxSplats, maxCells);
+    /* With unchanged grid and parameters every leaf still fits, so the
+     * decomposition must be reproduced exactly.
+     */
+    CPPUNIT_ASSERT_EQUAL(recorded.size(), blocks.size());
+    for (std::size_t i = 0; i < blocks.size(); i++)
+        CPPUNIT_ASSERT_EQUAL(recorded[i].numSplats, blocks[i].numSplats);
+}
+
+void TestBucketPlan::testReplayFiner()
+{
+    setupSimple();
+
+    Plan plan;
+    std::vector<Block> recorded;
+    recordSimple(plan, recorded);
+
+    /* Same world box as the recorded grid but half the spacing: leaves now
+     * span twice as many cells, so replay must refine them rather than pass
+     * them through.
+     */
+    const float ref[3] = {-10.0f, 0.0f, 10.0f};
+    Grid grid(ref, 1.25f, 8, 40, 0, 40, -8, 8);
+    const int maxSplats = 5;
+    const int maxCells = 8;
+    const int maxSplit = 1000000;
+    std::vector<Block> blocks;
+    bucketPlan(splats, grid, plan, maxSplats, maxCells, maxCells, maxSplit,
+               boost::bind(&TestBucketPlan::bucketFunc<Splats>, boost::ref(blocks), _1, _2, _3));
+
+    validate(splats, grid, blocks, maxSplats, maxCells);
+    CPPUNIT_ASSERT(blocks.size() > recorded.size());
+}
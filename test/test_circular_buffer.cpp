@@ -59,6 +59,7 @@ class TestCircularBuffer : public CppUnit::TestFixture
     CPPUNIT_TEST(testZero);
 #endif
     CPPUNIT_TEST(testUnallocated);
+    CPPUNIT_TEST(testOutOfOrder);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -70,6 +71,7 @@ private:
     void testOverflow();        ///< Test exception handling when total size overflows
     void testZero();            ///< Test that an exception is thrown when asking for zero elements
     void testUnallocated();     ///< Test @ref CircularBufferBase::unallocated
+    void testOutOfOrder();      ///< Test that space freed out of order is reclaimed immediately
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestCircularBuffer, TestSet::perBuild());
 
@@ -282,19 +284,44 @@ void TestCircularBuffer::testUnallocated()
 
     MLSGPU_ASSERT_EQUAL(6, buffer.unallocated());
 
-    buffer.free(a2); // does not make more space available until a1 freed
-    MLSGPU_ASSERT_EQUAL(6, buffer.unallocated());
+    buffer.free(a2); // space is reclaimed immediately, even though a1 is still live
+    MLSGPU_ASSERT_EQUAL(7, buffer.unallocated());
 
     CircularBuffer::Allocation a3 = buffer.allocate(worker, 5);
-    MLSGPU_ASSERT_EQUAL(1, buffer.unallocated());
+    MLSGPU_ASSERT_EQUAL(2, buffer.unallocated());
 
     buffer.free(a1);
     MLSGPU_ASSERT_EQUAL(5, buffer.unallocated());
 
-    CircularBuffer::Allocation a4 = buffer.allocate(worker, 3); // wastes 1 slot at end
-    MLSGPU_ASSERT_EQUAL(1, buffer.unallocated());
+    buffer.free(a3);
+    MLSGPU_ASSERT_EQUAL(10, buffer.unallocated());
+}
 
+void TestCircularBuffer::testOutOfOrder()
+{
+    Timeplot::Worker worker("test");
+    CircularBuffer buffer("test", 10);
+
+    // Fill the buffer completely
+    CircularBuffer::Allocation a1 = buffer.allocate(worker, 2);
+    CircularBuffer::Allocation a2 = buffer.allocate(worker, 2);
+    CircularBuffer::Allocation a3 = buffer.allocate(worker, 2);
+    CircularBuffer::Allocation a4 = buffer.allocate(worker, 4);
+    MLSGPU_ASSERT_EQUAL(0, buffer.unallocated());
+
+    /* Free a hole in the middle while a1 and a4 are still live. The
+     * coalesced hole must be immediately reusable; previously it was pinned
+     * until a1 was freed.
+     */
+    buffer.free(a2);
     buffer.free(a3);
+    MLSGPU_ASSERT_EQUAL(4, buffer.unallocated());
+
+    CircularBuffer::Allocation a5 = buffer.allocate(worker, 4);
+    CPPUNIT_ASSERT_EQUAL(static_cast<char *>(a1.get()) + 2, static_cast<char *>(a5.get()));
+
+    buffer.free(a1);
     buffer.free(a4);
+    buffer.free(a5);
     MLSGPU_ASSERT_EQUAL(10, buffer.unallocated());
 }
@@ -0,0 +1,271 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref ClassifyCL.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/tr1/random.hpp>
+#include "testutil.h"
+#include "test_clh.h"
+#include "../src/classify_cl.h"
+#include "../src/clh.h"
+#include "../src/grid.h"
+#include "../src/misc.h"
+#include "../src/splat.h"
+
+using namespace std;
+
+/// Tests for @ref ClassifyCL
+class TestClassifyCL : public CLH::Test::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestClassifyCL);
+    CPPUNIT_TEST(testDivDown);
+    CPPUNIT_TEST(testMakeCode);
+    CPPUNIT_TEST(testClassify);
+    CPPUNIT_TEST(testAccumulate);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    cl::Program classifyProgram;  ///< Program compiled from @ref classify.cl.
+
+    void callDivDown(cl_int out[3], cl_int x, cl_int y, cl_int z, cl_int size);
+    cl_uint callMakeCode(cl_int x, cl_int y, cl_int z);
+
+    /// Reference implementation matching @c SplatSet::detail::SplatToBuckets
+    static void splatToMicro(
+        const Splat &splat, const Grid &grid, Grid::size_type microSize,
+        const Grid::size_type dims[3],
+        Grid::difference_type lower[3], Grid::difference_type upper[3]);
+
+    void testDivDown();     ///< Test @c divDown in @ref classify.cl against the host version.
+    void testMakeCode();    ///< Test that @c makeCode in @ref classify.cl matches @ref octree.cl.
+    void testClassify();    ///< Test histogram and codes against a host reference.
+    void testAccumulate();  ///< Test that counts accumulate over batches and clear on reset.
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestClassifyCL, TestSet::perCommit());
+
+void TestClassifyCL::setUp()
+{
+    CLH::Test::TestFixture::setUp();
+    map<string, string> defines;
+    defines["UNIT_TESTS"] = "1";
+    classifyProgram = CLH::build(context, "kernels/classify.cl", defines);
+}
+
+void TestClassifyCL::tearDown()
+{
+    classifyProgram = NULL;
+    CLH::Test::TestFixture::tearDown();
+}
+
+void TestClassifyCL::callDivDown(cl_int out[3], cl_int x, cl_int y, cl_int z, cl_int size)
+{
+    cl::Buffer outBuffer(context, CL_MEM_WRITE_ONLY, 3 * sizeof(cl_int));
+    cl::Kernel kernel(classifyProgram, "testDivDown");
+    cl_int3 a = {{ x, y, z }};
+    kernel.setArg(0, outBuffer);
+    kernel.setArg(1, a);
+    kernel.setArg(2, size);
+    queue.enqueueTask(kernel);
+    queue.enqueueReadBuffer(outBuffer, CL_TRUE, 0, 3 * sizeof(cl_int), out);
+}
+
+cl_uint TestClassifyCL::callMakeCode(cl_int x, cl_int y, cl_int z)
+{
+    cl_uint ans;
+    cl::Buffer out(context, CL_MEM_WRITE_ONLY, sizeof(cl_uint));
+    cl::Kernel kernel(classifyProgram, "testMakeCode");
+    cl_int3 xyz = {{ x, y, z }};
+    kernel.setArg(0, out);
+    kernel.setArg(1, xyz);
+    queue.enqueueTask(kernel);
+    queue.enqueueReadBuffer(out, CL_TRUE, 0, sizeof(cl_uint), &ans);
+    return ans;
+}
+
+void TestClassifyCL::testDivDown()
+{
+    const cl_int values[] = { -7, -4, -1, 0, 1, 3, 8 };
+    const unsigned int n = sizeof(values) / sizeof(values[0]);
+    for (cl_int size = 1; size <= 4; size++)
+        for (unsigned int i = 0; i < n; i++)
+        {
+            cl_int out[3];
+            callDivDown(out, values[i], values[(i + 1) % n], values[(i + 2) % n], size);
+            CPPUNIT_ASSERT_EQUAL(divDown(values[i], size), out[0]);
+            CPPUNIT_ASSERT_EQUAL(divDown(values[(i + 1) % n], size), out[1]);
+            CPPUNIT_ASSERT_EQUAL(divDown(values[(i + 2) % n], size), out[2]);
+        }
+}
+
+void TestClassifyCL::testMakeCode()
+{
+    CPPUNIT_ASSERT_EQUAL(cl_uint(0), callMakeCode(0, 0, 0));
+    CPPUNIT_ASSERT_EQUAL(cl_uint(7), callMakeCode(1, 1, 1));
+    CPPUNIT_ASSERT_EQUAL(cl_uint(174), callMakeCode(2, 5, 3));
+    CPPUNIT_ASSERT_EQUAL(cl_uint(511), callMakeCode(7, 7, 7));
+}
+
+void TestClassifyCL::splatToMicro(
+    const Splat &splat, const Grid &grid, Grid::size_type microSize,
+    const Grid::size_type dims[3],
+    Grid::difference_type lower[3], Grid::difference_type upper[3])
+{
+    float loWorld[3], hiWorld[3];
+    Grid::difference_type lo[3], hi[3];
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        loWorld[i] = splat.position[i] - splat.radius;
+        hiWorld[i] = splat.position[i] + splat.radius;
+    }
+    grid.worldToCell(loWorld, lo);
+    grid.worldToCell(hiWorld, hi);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        lower[i] = std::max(divDown(lo[i], Grid::difference_type(microSize)), Grid::difference_type(0));
+        upper[i] = std::min(divDown(hi[i], Grid::difference_type(microSize)),
+                            Grid::difference_type(dims[i]) - 1);
+    }
+}
+
+void TestClassifyCL::testClassify()
+{
+    const Grid::size_type microSize = 3;
+    const Grid::size_type dims[3] = { 5, 4, 3 };
+
+    const float ref[3] = { 10.0f, -1.5f, 2.0f };
+    Grid grid(ref, 2.5f, 2, 2 + 5 * 3, -1, -1 + 4 * 3, 3, 3 + 3 * 3);
+
+    std::tr1::mt19937 engine;
+    std::tr1::uniform_real<float> posDist(-5.0f, 40.0f);
+    std::tr1::uniform_real<float> radiusDist(0.25f, 5.0f);
+    std::tr1::variate_generator<std::tr1::mt19937 &, std::tr1::uniform_real<float> > genPos(engine, posDist);
+    std::tr1::variate_generator<std::tr1::mt19937 &, std::tr1::uniform_real<float> > genRadius(engine, radiusDist);
+
+    const std::size_t numSplats = 200;
+    std::vector<Splat> splats(numSplats);
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        Splat &s = splats[i];
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            s.position[j] = genPos();
+            s.normal[j] = 1.0f;
+        }
+        s.radius = genRadius();
+        s.quality = 1.0f;
+    }
+
+    // Host reference histogram
+    std::vector<ClassifyCL::code_type> expected(dims[0] * dims[1] * dims[2], 0);
+    std::vector<bool> single(numSplats);
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        Grid::difference_type lower[3], upper[3];
+        splatToMicro(splats[i], grid, microSize, dims, lower, upper);
+        for (Grid::difference_type z = lower[2]; z <= upper[2]; z++)
+            for (Grid::difference_type y = lower[1]; y <= upper[1]; y++)
+                for (Grid::difference_type x = lower[0]; x <= upper[0]; x++)
+                    expected[(z * dims[1] + y) * dims[0] + x]++;
+        single[i] = lower[0] == upper[0] && lower[1] == upper[1] && lower[2] == upper[2];
+    }
+
+    ClassifyCL classify(context, device, numSplats, dims[0] * dims[1] * dims[2]);
+    classify.reset(queue, dims);
+    classify.enqueueClassify(queue, &splats[0], numSplats, grid, microSize);
+
+    std::vector<ClassifyCL::count_entry> counts;
+    classify.readHistogram(queue, counts);
+    std::size_t nonEmpty = 0;
+    for (std::size_t i = 0; i < expected.size(); i++)
+        if (expected[i] != 0)
+            nonEmpty++;
+    CPPUNIT_ASSERT_EQUAL(nonEmpty, counts.size());
+    for (std::size_t i = 0; i < counts.size(); i++)
+    {
+        CPPUNIT_ASSERT(counts[i].first < expected.size());
+        CPPUNIT_ASSERT_EQUAL(expected[counts[i].first], counts[i].second);
+    }
+
+    std::vector<ClassifyCL::code_type> codes;
+    classify.readCodes(queue, codes);
+    CPPUNIT_ASSERT_EQUAL(numSplats, codes.size());
+    for (std::size_t i = 0; i < numSplats; i++)
+        if (single[i])
+            CPPUNIT_ASSERT(codes[i] != ClassifyCL::BAD_CODE);
+        else
+            CPPUNIT_ASSERT_EQUAL(ClassifyCL::BAD_CODE, codes[i]);
+}
+
+void TestClassifyCL::testAccumulate()
+{
+    const Grid::size_type microSize = 2;
+    const Grid::size_type dims[3] = { 2, 2, 2 };
+    const float ref[3] = { 0.0f, 0.0f, 0.0f };
+    Grid grid(ref, 1.0f, 0, 4, 0, 4, 0, 4);
+
+    Splat s;
+    for (unsigned int j = 0; j < 3; j++)
+    {
+        s.position[j] = 1.0f;
+        s.normal[j] = 1.0f;
+    }
+    s.radius = 0.5f;
+    s.quality = 1.0f;
+
+    ClassifyCL classify(context, device, 4, 8);
+    classify.reset(queue, dims);
+    classify.enqueueClassify(queue, &s, 1, grid, microSize);
+    classify.enqueueClassify(queue, &s, 1, grid, microSize);
+
+    std::vector<ClassifyCL::count_entry> counts;
+    classify.readHistogram(queue, counts);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), counts.size());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), counts[0].first);
+    CPPUNIT_ASSERT_EQUAL(ClassifyCL::code_type(2), counts[0].second);
+
+    classify.reset(queue, dims);
+    classify.enqueueClassify(queue, &s, 1, grid, microSize);
+    classify.readHistogram(queue, counts);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), counts.size());
+    CPPUNIT_ASSERT_EQUAL(ClassifyCL::code_type(1), counts[0].second);
+}
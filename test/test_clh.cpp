@@ -38,7 +38,9 @@
 #include <boost/program_options.hpp>
 #include <boost/smart_ptr/scoped_array.hpp>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
+#include <vector>
 #include <locale>
 #include <sstream>
 #include <string>
@@ -86,6 +88,36 @@ cl::Buffer Mixin::createBuffer(cl_mem_flags flags, ::size_t size)
     return cl::Buffer(context, flags | CL_MEM_COPY_HOST_PTR, size, data.get());
 }
 
+cl::Buffer createSplatBuffer(
+    const cl::Context &context, cl_mem_flags flags,
+    const std::vector<Splat> &splats)
+{
+    const ::size_t n = splats.size();
+    std::vector<cl_float4> planes(2 * n);
+    for (::size_t i = 0; i < n; i++)
+    {
+        // The halves of a Splat are exactly the two planes' float4s
+        std::memcpy(&planes[i], splats[i].position, sizeof(cl_float4));
+        std::memcpy(&planes[n + i], splats[i].normal, sizeof(cl_float4));
+    }
+    return cl::Buffer(context, flags | CL_MEM_COPY_HOST_PTR,
+                      planes.size() * sizeof(cl_float4), &planes[0]);
+}
+
+void readSplatBuffer(
+    const cl::CommandQueue &queue, const cl::Buffer &buffer,
+    std::vector<Splat> &splats)
+{
+    const ::size_t n = splats.size();
+    std::vector<cl_float4> planes(2 * n);
+    queue.enqueueReadBuffer(buffer, CL_TRUE, 0, planes.size() * sizeof(cl_float4), &planes[0]);
+    for (::size_t i = 0; i < n; i++)
+    {
+        std::memcpy(splats[i].position, &planes[i], sizeof(cl_float4));
+        std::memcpy(splats[i].normal, &planes[n + i], sizeof(cl_float4));
+    }
+}
+
 void TestFixture::setUp()
 {
     CppUnit::TestFixture::setUp();
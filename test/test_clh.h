@@ -33,6 +33,8 @@
 
 #include <cppunit/TestFixture.h>
 #include <CL/cl.hpp>
+#include <vector>
+#include "../src/splat.h"
 
 namespace CLH
 {
@@ -69,6 +71,29 @@ protected:
     cl::Buffer createBuffer(cl_mem_flags flags, ::size_t size);
 };
 
+/**
+ * Create a buffer holding @a splats in the two-plane structure-of-arrays
+ * device layout used by the splat kernels (see @c kernels/octree.cl), with a
+ * plane stride equal to the number of splats.
+ *
+ * @param context  Context in which to create the buffer.
+ * @param flags    Flags to pass to CL (do not specify @c CL_MEM_COPY_HOST_PTR
+ *                 or @c CL_MEM_USE_HOST_PTR).
+ * @param splats   The splats to upload; must be non-empty.
+ */
+cl::Buffer createSplatBuffer(
+    const cl::Context &context, cl_mem_flags flags,
+    const std::vector<Splat> &splats);
+
+/**
+ * Read back a buffer created by @ref createSplatBuffer (or with the same
+ * layout), re-interleaving the planes into host splats. The number of splats
+ * read, and the plane stride assumed, are both @c splats.size().
+ */
+void readSplatBuffer(
+    const cl::CommandQueue &queue, const cl::Buffer &buffer,
+    std::vector<Splat> &splats);
+
 /**
  * Test fixture class that handles OpenCL setup.
  *
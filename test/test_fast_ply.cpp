@@ -37,6 +37,7 @@
 #include <cppunit/extensions/ExceptionTestCaseDecorator.h>
 #include <string>
 #include <cstddef>
+#include <cstring>
 #include <algorithm>
 #include <vector>
 #include <iterator>
@@ -88,12 +89,15 @@ class TestFastPlyReader : public CppUnit::TestFixture
     TEST_EXCEPTION_FILENAME(testShortFile, boost::exception, testFilename);
     TEST_EXCEPTION_FILENAME(testList, FormatError, testFilename);
     TEST_EXCEPTION_FILENAME(testNotFloat, FormatError, testFilename);
-    TEST_EXCEPTION_FILENAME(testFormatAscii, FormatError, testFilename);
     TEST_EXCEPTION_FILENAME(testFormatMissing, FormatError, testFilename);
 #endif
 
     CPPUNIT_TEST(testReadHeader);
+    CPPUNIT_TEST(testAscii);
     CPPUNIT_TEST(testRead);
+    CPPUNIT_TEST(testDataRaw);
+    CPPUNIT_TEST(testReadDouble);
+    CPPUNIT_TEST(testOffset);
     CPPUNIT_TEST(testReadZero);
     CPPUNIT_TEST(testReadIterator);
     CPPUNIT_TEST_SUITE_END();
@@ -159,7 +163,6 @@ public:
     void testShortFile();              ///< File too small to hold all the vertex data
     void testList();                   ///< Vertex element contains a list
     void testNotFloat();               ///< Vertex property is not a float
-    void testFormatAscii();            ///< Ascii format file
     void testFormatMissing();          ///< No format line
     /** @} */
 
@@ -168,7 +171,11 @@ public:
      * @{
      */
     void testReadHeader();             ///< Checks that header-related fields are set properly
+    void testAscii();                  ///< ASCII files are converted and read back
     void testRead();                   ///< Tests @ref FastPly::Reader::Handle::read with a pointer
+    void testDataRaw();                ///< Tests @ref FastPly::Reader::Handle::dataRaw zero-copy access
+    void testReadDouble();             ///< Tests decoding of FLOAT64 fields
+    void testOffset();                 ///< Tests rebasing of positions with @ref FastPly::Reader::setOffset
     void testReadZero();               ///< Tests a zero-splat read
     void testReadIterator();           ///< Tests @ref FastPly::Reader::Handle::read with an output iterator
     /** @} */
@@ -365,22 +372,42 @@ void TestFastPlyReader::testNotFloat()
     boost::scoped_ptr<Reader> r(factory(content));
 }
 
-void TestFastPlyReader::testFormatAscii()
+void TestFastPlyReader::testAscii()
 {
-    setContent(
+    const int numVertices = 5;
+    std::string content =
         "ply\n"
         "format ascii 1.0\n"
         "element vertex 5\n"
-        "property float32 x\n"
         "property float32 y\n"
         "property float32 z\n"
+        "property float32 x\n"
         "property float32 nx\n"
         "property float32 ny\n"
         "property float32 nz\n"
         "property float32 radius\n"
         "property uint8 foo\n"
-        "end_header\n");
-    boost::scoped_ptr<Reader> r(factory(content));
+        "element face 1\n"
+        "property list uint8 uint32 vertex_indices\n"
+        "end_header\n";
+    for (int i = 0; i < numVertices; i++)
+    {
+        for (int j = 0; j < 7; j++)
+        {
+            content += boost::lexical_cast<std::string>(i * 100 + j);
+            content += ' ';
+        }
+        content += "42\n"; // the skipped foo property
+    }
+    content += "3 0 1 2\n"; // face data, ignored by the reader
+
+    boost::scoped_ptr<Reader> r(factory(content, testFilename, 2.0f, 250.0f));
+    CPPUNIT_ASSERT_EQUAL(Reader::size_type(numVertices), r->size());
+
+    Reader::Handle h(*r);
+    Splat out[numVertices];
+    h.read(0, numVertices, out);
+    verify(0, out, out + numVertices);
 }
 
 void TestFastPlyReader::testFormatMissing()
@@ -491,6 +518,162 @@ void TestFastPlyReader::testRead()
 #endif
 }
 
+void TestFastPlyReader::testDataRaw()
+{
+    setupRead(5);
+
+    boost::scoped_ptr<Reader> r(factory(content, testFilename, 2.0f, 250.0f));
+    Reader::Handle h(*r);
+
+    const char *data = h.dataRaw(1, 4);
+    CPPUNIT_ASSERT(data != NULL);
+
+    std::vector<char> expected(3 * r->getVertexSize());
+    h.readRaw(1, 4, &expected[0]);
+    CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), data));
+
+#if DEBUG
+    CPPUNIT_ASSERT_THROW(h.dataRaw(1, 6), std::out_of_range);
+#endif
+}
+
+void TestFastPlyReader::testReadDouble()
+{
+    const int numVertices = 5;
+    const std::string header =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex 5\n"
+        "property float64 y\n"
+        "property float64 z\n"
+        "property float64 x\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "property float32 radius\n"
+        "end_header\n";
+    setContent(header, numVertices * (3 * sizeof(double) + 4 * sizeof(float)));
+
+    std::size_t p = header.size();
+    for (int i = 0; i < numVertices; i++)
+        for (int j = 0; j < 7; j++)
+        {
+            if (j < 3)
+            {
+                double v = i * 100.0 + j;
+                std::memcpy(&content[p], &v, sizeof(v));
+                p += sizeof(v);
+            }
+            else
+            {
+                float v = i * 100.0f + j;
+                std::memcpy(&content[p], &v, sizeof(v));
+                p += sizeof(v);
+            }
+        }
+
+    boost::scoped_ptr<Reader> r(factory(content, testFilename, 2.0f, 250.0f));
+    Reader::Handle h(*r);
+
+    Splat out[numVertices];
+    h.read(0, numVertices, out);
+    verify(0, out, out + numVertices);
+}
+
+void TestFastPlyReader::testOffset()
+{
+    const int numVertices = 3;
+    const std::string header =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex 3\n"
+        "property float64 x\n"
+        "property float64 y\n"
+        "property float64 z\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "property float32 radius\n"
+        "end_header\n";
+    setContent(header, numVertices * (3 * sizeof(double) + 4 * sizeof(float)));
+
+    /* UTM-scale coordinates whose fractional parts would be lost by a
+     * direct narrowing to float.
+     */
+    const double offset[3] = { 261000.0, 6243000.0, -16.0 };
+    std::size_t p = header.size();
+    for (int i = 0; i < numVertices; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            double v = offset[j] + i + j * 0.125;
+            std::memcpy(&content[p], &v, sizeof(v));
+            p += sizeof(v);
+        }
+        for (int j = 3; j < 7; j++)
+        {
+            float v = i * 100.0f + j;
+            std::memcpy(&content[p], &v, sizeof(v));
+            p += sizeof(v);
+        }
+    }
+
+    boost::scoped_ptr<Reader> r(factory(content, testFilename, 2.0f, 250.0f));
+    r->setOffset(offset);
+    CPPUNIT_ASSERT_EQUAL(offset[0], r->getOffset()[0]);
+    CPPUNIT_ASSERT_EQUAL(offset[1], r->getOffset()[1]);
+    CPPUNIT_ASSERT_EQUAL(offset[2], r->getOffset()[2]);
+
+    Reader::Handle h(*r);
+    Splat out[numVertices];
+    h.read(0, numVertices, out);
+    for (int i = 0; i < numVertices; i++)
+    {
+        // The residuals are exact because the subtraction happens in double
+        CPPUNIT_ASSERT_EQUAL(float(i) + 0.000f, out[i].position[0]);
+        CPPUNIT_ASSERT_EQUAL(float(i) + 0.125f, out[i].position[1]);
+        CPPUNIT_ASSERT_EQUAL(float(i) + 0.250f, out[i].position[2]);
+        CPPUNIT_ASSERT_EQUAL(i * 100.0f + 3.0f, out[i].normal[0]);
+    }
+
+    /* The canonical packed FLOAT32 layout is decoded by a separate fast
+     * path, so check that it also honours the offset.
+     */
+    const std::string header2 =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex 3\n"
+        "property float32 x\n"
+        "property float32 y\n"
+        "property float32 z\n"
+        "property float32 nx\n"
+        "property float32 ny\n"
+        "property float32 nz\n"
+        "property float32 radius\n"
+        "end_header\n";
+    setContent(header2, numVertices * 7 * sizeof(float));
+    p = header2.size();
+    for (int i = 0; i < numVertices; i++)
+        for (int j = 0; j < 7; j++)
+        {
+            float v = i * 100.0f + j;
+            std::memcpy(&content[p], &v, sizeof(v));
+            p += sizeof(v);
+        }
+
+    boost::scoped_ptr<Reader> r2(factory(content, testFilename, 2.0f, 250.0f));
+    const double offset2[3] = { 1.0, 2.0, 3.0 };
+    r2->setOffset(offset2);
+    Reader::Handle h2(*r2);
+    h2.read(0, numVertices, out);
+    for (int i = 0; i < numVertices; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(i * 100.0f + 0.0f - 1.0f, out[i].position[0]);
+        CPPUNIT_ASSERT_EQUAL(i * 100.0f + 1.0f - 2.0f, out[i].position[1]);
+        CPPUNIT_ASSERT_EQUAL(i * 100.0f + 2.0f - 3.0f, out[i].position[2]);
+    }
+}
+
 void TestFastPlyReader::testReadZero()
 {
     setupRead(5);
@@ -560,6 +743,7 @@ class TestFastPlyWriter : public CppUnit::TestFixture
     CPPUNIT_TEST_SUITE(TestFastPlyWriter);
     TEST_EXCEPTION_FILENAME(testBadFilename, std::ios_base::failure, "/not_a_valid_filename/");
     CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST(testDeferred);
 #if DEBUG
     CPPUNIT_TEST(testState);
     CPPUNIT_TEST(testOverrun);
@@ -568,6 +752,7 @@ class TestFastPlyWriter : public CppUnit::TestFixture
 public:
     void testBadFilename();   ///< Try to write to an invalid filename, check for error
     void testSimple();        ///< Test normal operation
+    void testDeferred();      ///< Test streaming mode with counts patched on close
     void testState();         ///< Test assertions that the file is/is not open
     void testOverrun();       ///< Test writing beyond the end of the file
 };
@@ -645,6 +830,46 @@ void TestFastPlyWriter::testSimple()
     CPPUNIT_ASSERT(0 == memcmp(data + headerSize + 75, indices + 6, 12));
 }
 
+void TestFastPlyWriter::testDeferred()
+{
+    const float vertices[3 * 3] =
+    {
+        1.0f, 2.0f, 4.0f,
+        -1.0f, -2.0f, -4.0f,
+        5.5f, 6.25f, 7.75f
+    };
+    const std::tr1::uint32_t indices[6] =
+    {
+        0, 1, 2,
+        2, 1, 0
+    };
+
+    MemoryWriterPly w;
+    w.openDeferred("file");
+
+    MLSGPU_ASSERT_EQUAL(0, w.appendVertices(2, vertices));
+    MLSGPU_ASSERT_EQUAL(2, w.appendVertices(1, vertices + 2 * 3));
+    w.appendTriangles(2, indices);
+    w.close();
+
+    const std::string &out = w.getOutput("file");
+    const std::size_t dataSize = 3 * 3 * sizeof(float) + 2 * 13;
+    CPPUNIT_ASSERT(out.size() > dataSize);
+    const std::size_t headerSize = out.size() - dataSize;
+    const std::string header(out, 0, headerSize);
+
+    // The provisional zero counts must have been patched with the real ones
+    CPPUNIT_ASSERT(header.find("element vertex 00000000000000000003\n") != std::string::npos);
+    CPPUNIT_ASSERT(header.find("element face 00000000000000000002\n") != std::string::npos);
+
+    const char *data = out.data() + headerSize;
+    CPPUNIT_ASSERT(0 == memcmp(data, vertices, sizeof(vertices)));
+    MLSGPU_ASSERT_EQUAL(3, data[36]);
+    CPPUNIT_ASSERT(0 == memcmp(data + 37, indices + 0, 12));
+    MLSGPU_ASSERT_EQUAL(3, data[49]);
+    CPPUNIT_ASSERT(0 == memcmp(data + 50, indices + 3, 12));
+}
+
 void TestFastPlyWriter::testState()
 {
     MemoryWriterPly w;
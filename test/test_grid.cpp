@@ -47,11 +47,14 @@ class TestGrid : public CppUnit::TestFixture
     CPPUNIT_TEST(testNumVertices);
     CPPUNIT_TEST(testGetVertex);
     CPPUNIT_TEST(testWorldToVertex);
+    CPPUNIT_TEST(testWorldToVertexFast);
     CPPUNIT_TEST(testWorldToCell);
+    CPPUNIT_TEST(testWorldToCellFast);
 #if DEBUG
     CPPUNIT_TEST(testWorldToCellOverflow);
 #endif
     CPPUNIT_TEST(testSubGrid);
+    CPPUNIT_TEST(testWorldOffset);
     CPPUNIT_TEST_SUITE_END();
 private:
     float ref[3];
@@ -69,9 +72,12 @@ public:
     void testNumVertices();
     void testGetVertex();
     void testWorldToVertex();
+    void testWorldToVertexFast();   ///< @ref Grid::WorldToVertex matches @ref Grid::worldToVertex
     void testWorldToCell();
+    void testWorldToCellFast();     ///< @ref Grid::WorldToCell matches @ref Grid::worldToCell
     void testWorldToCellOverflow();
     void testSubGrid();
+    void testWorldOffset();
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestGrid, TestSet::perBuild());
 
@@ -165,6 +171,33 @@ void TestGrid::testWorldToVertex()
     CPPUNIT_ASSERT_DOUBLES_EQUAL(500, test[2], 1e-3);
 }
 
+void TestGrid::testWorldToVertexFast()
+{
+    const Grid::WorldToVertex toVertex(grid);
+    CPPUNIT_ASSERT_EQUAL(1.0f / spacing, toVertex.getInvSpacing());
+
+    float world[3];
+    for (int i = -20; i <= 20; i++)
+    {
+        world[0] = 7.3f * i;
+        world[1] = -2.1f * i + 5.0f;
+        world[2] = 0.37f * i - 2990.0f;
+        float expected[3], test[3];
+        grid.worldToVertex(world, expected);
+        toVertex(world, test);
+        for (unsigned int j = 0; j < 3; j++)
+            CPPUNIT_ASSERT_EQUAL(expected[j], test[j]);
+    }
+
+    // In-place conversion must give the same answer
+    float expected[3];
+    world[0] = 1.5f; world[1] = 39.0f; world[2] = -1497.75f;
+    grid.worldToVertex(world, expected);
+    toVertex(world, world);
+    for (unsigned int j = 0; j < 3; j++)
+        CPPUNIT_ASSERT_EQUAL(expected[j], world[j]);
+}
+
 void TestGrid::testWorldToCell()
 {
     float world[3];
@@ -183,6 +216,24 @@ void TestGrid::testWorldToCell()
     CPPUNIT_ASSERT_EQUAL(Grid::difference_type(999), test[2]);
 }
 
+void TestGrid::testWorldToCellFast()
+{
+    const Grid::WorldToCell toCell(grid);
+
+    float world[3];
+    for (int i = -20; i <= 20; i++)
+    {
+        world[0] = 7.3f * i;
+        world[1] = -2.1f * i + 5.0f;
+        world[2] = 0.37f * i - 2990.0f;
+        Grid::difference_type expected[3], test[3];
+        grid.worldToCell(world, expected);
+        toCell(world, test);
+        for (unsigned int j = 0; j < 3; j++)
+            CPPUNIT_ASSERT_EQUAL(expected[j], test[j]);
+    }
+}
+
 void TestGrid::testWorldToCellOverflow()
 {
     float world[3];
@@ -233,3 +284,30 @@ void TestGrid::testSubGrid()
     CPPUNIT_ASSERT_EQUAL(Grid::size_type(5), g.numCells(1));
     CPPUNIT_ASSERT_EQUAL(Grid::size_type(0), g.numCells(2));
 }
+
+void TestGrid::testWorldOffset()
+{
+    // Default is zero
+    CPPUNIT_ASSERT_EQUAL(0.0, grid.getWorldOffset()[0]);
+    CPPUNIT_ASSERT_EQUAL(0.0, grid.getWorldOffset()[1]);
+    CPPUNIT_ASSERT_EQUAL(0.0, grid.getWorldOffset()[2]);
+
+    const double offset[3] = { 261000.0, 6243000.0, -15.0 };
+    grid.setWorldOffset(offset);
+    CPPUNIT_ASSERT_EQUAL(offset[0], grid.getWorldOffset()[0]);
+    CPPUNIT_ASSERT_EQUAL(offset[1], grid.getWorldOffset()[1]);
+    CPPUNIT_ASSERT_EQUAL(offset[2], grid.getWorldOffset()[2]);
+
+    // The offset must not leak into the local coordinate transformations
+    float test[3];
+    grid.getVertex(0, 0, 0, test);
+    CPPUNIT_ASSERT_EQUAL(-13.5f, test[0]);
+    CPPUNIT_ASSERT_EQUAL(18.0f, test[1]);
+    CPPUNIT_ASSERT_EQUAL(-2997.75f, test[2]);
+
+    // But it is carried by subgrids
+    Grid g = grid.subGrid(3, 7, 10, 15, -5, -5);
+    CPPUNIT_ASSERT_EQUAL(offset[0], g.getWorldOffset()[0]);
+    CPPUNIT_ASSERT_EQUAL(offset[1], g.getWorldOffset()[1]);
+    CPPUNIT_ASSERT_EQUAL(offset[2], g.getWorldOffset()[2]);
+}
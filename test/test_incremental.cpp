@@ -0,0 +1,154 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref SplatHash and @ref ChunkHashes.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include "testutil.h"
+#include "../src/incremental.h"
+
+class TestSplatHash : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestSplatHash);
+    CPPUNIT_TEST(testDeterministic);
+    CPPUNIT_TEST(testSensitive);
+    CPPUNIT_TEST_SUITE_END();
+public:
+    void testDeterministic();    ///< The same input gives the same hash
+    void testSensitive();        ///< Different inputs give different hashes
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestSplatHash, TestSet::perBuild());
+
+void TestSplatHash::testDeterministic()
+{
+    const char data[] = "hello world";
+    SplatHash a, b;
+    a.append(data, sizeof(data));
+    a.append(UINT64_C(12345));
+    b.append(data, sizeof(data));
+    b.append(UINT64_C(12345));
+    CPPUNIT_ASSERT_EQUAL(a.get(), b.get());
+}
+
+void TestSplatHash::testSensitive()
+{
+    const char data1[] = "hello world";
+    const char data2[] = "hello worle";
+    SplatHash empty, a, b, c;
+    a.append(data1, sizeof(data1));
+    b.append(data2, sizeof(data2));
+    c.append(UINT64_C(0));
+    CPPUNIT_ASSERT(a.get() != b.get());
+    CPPUNIT_ASSERT(a.get() != empty.get());
+    CPPUNIT_ASSERT(c.get() != empty.get());
+}
+
+class TestChunkHashes : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestChunkHashes);
+    CPPUNIT_TEST(testSetFind);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testLoadMissing);
+    CPPUNIT_TEST_SUITE_END();
+public:
+    void testSetFind();          ///< Test @ref ChunkHashes::set and @ref ChunkHashes::find
+    void testRoundTrip();        ///< Test that save followed by load recovers the table
+    void testLoadMissing();      ///< Loading a missing file leaves the table empty
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestChunkHashes, TestSet::perBuild());
+
+static ChunkHashes::key_type makeKey(
+    Grid::size_type x, Grid::size_type y, Grid::size_type z)
+{
+    ChunkHashes::key_type key;
+    key[0] = x;
+    key[1] = y;
+    key[2] = z;
+    return key;
+}
+
+void TestChunkHashes::testSetFind()
+{
+    ChunkHashes table;
+    ChunkHashes::value_type value;
+
+    CPPUNIT_ASSERT(!table.find(makeKey(0, 0, 0), value));
+
+    table.set(makeKey(0, 0, 0), 100);
+    table.set(makeKey(1, 2, 3), 200);
+    table.set(makeKey(0, 0, 0), 300); // replaces the first entry
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), table.size());
+
+    CPPUNIT_ASSERT(table.find(makeKey(0, 0, 0), value));
+    CPPUNIT_ASSERT_EQUAL(ChunkHashes::value_type(300), value);
+    CPPUNIT_ASSERT(table.find(makeKey(1, 2, 3), value));
+    CPPUNIT_ASSERT_EQUAL(ChunkHashes::value_type(200), value);
+    CPPUNIT_ASSERT(!table.find(makeKey(3, 2, 1), value));
+}
+
+void TestChunkHashes::testRoundTrip()
+{
+    const boost::filesystem::path path =
+        boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+
+    ChunkHashes out;
+    out.set(makeKey(0, 0, 0), UINT64_C(0xdeadbeefcafebabe));
+    out.set(makeKey(4, 5, 6), 42);
+    out.save(path);
+
+    try
+    {
+        ChunkHashes in;
+        in.load(path);
+        CPPUNIT_ASSERT_EQUAL(out.size(), in.size());
+        ChunkHashes::value_type value;
+        CPPUNIT_ASSERT(in.find(makeKey(0, 0, 0), value));
+        CPPUNIT_ASSERT_EQUAL(ChunkHashes::value_type(UINT64_C(0xdeadbeefcafebabe)), value);
+        CPPUNIT_ASSERT(in.find(makeKey(4, 5, 6), value));
+        CPPUNIT_ASSERT_EQUAL(ChunkHashes::value_type(42), value);
+    }
+    catch (...)
+    {
+        boost::filesystem::remove(path);
+        throw;
+    }
+    boost::filesystem::remove(path);
+}
+
+void TestChunkHashes::testLoadMissing()
+{
+    const boost::filesystem::path path =
+        boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+
+    ChunkHashes table;
+    table.load(path);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), table.size());
+}
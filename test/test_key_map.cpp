@@ -0,0 +1,188 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref KeyMap.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __STDC_CONSTANT_MACROS
+# define __STDC_CONSTANT_MACROS
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <map>
+#include <cstddef>
+#include "../src/tr1_cstdint.h"
+#include "../src/key_map.h"
+#include "testutil.h"
+
+/// Tests for @ref KeyMap
+class TestKeyMap : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestKeyMap);
+    CPPUNIT_TEST(testInsert);
+    CPPUNIT_TEST(testReservedKey);
+    CPPUNIT_TEST(testGrowth);
+    CPPUNIT_TEST(testIterate);
+    CPPUNIT_TEST(testSwap);
+    CPPUNIT_TEST(testCopy);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    typedef KeyMap<std::tr1::uint32_t> map_type;
+
+    void testInsert();       ///< Basic insertion, duplicates, find
+    void testReservedKey();  ///< The all-ones key is a legal key
+    void testGrowth();       ///< Many keys across several rehashes, validated against std::map
+    void testIterate();      ///< Iteration visits each entry exactly once
+    void testSwap();         ///< @ref KeyMap::swap exchanges contents
+    void testCopy();         ///< Copy construction and assignment deep-copy
+
+    /// Deterministic pseudo-random 64-bit key sequence
+    static std::tr1::uint64_t scramble(std::tr1::uint64_t i)
+    {
+        return i * UINT64_C(0x9E3779B97F4A7C15) + (i >> 3);
+    }
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestKeyMap, TestSet::perBuild());
+
+void TestKeyMap::testInsert()
+{
+    map_type m("mem.test.keyMap");
+    CPPUNIT_ASSERT(m.empty());
+
+    std::pair<std::tr1::uint32_t *, bool> r = m.insert(100, 1);
+    CPPUNIT_ASSERT(r.second);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(1), *r.first);
+
+    r = m.insert(100, 2);   // duplicate: value must not change
+    CPPUNIT_ASSERT(!r.second);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(1), *r.first);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), m.size());
+
+    *r.first = 3;           // the returned pointer aliases the stored value
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(3), *m.find(100));
+    CPPUNIT_ASSERT(m.find(101) == NULL);
+}
+
+void TestKeyMap::testReservedKey()
+{
+    const std::tr1::uint64_t allOnes = UINT64_C(0xFFFFFFFFFFFFFFFF);
+    map_type m("mem.test.keyMap");
+
+    CPPUNIT_ASSERT(m.find(allOnes) == NULL);
+    CPPUNIT_ASSERT(m.insert(allOnes, 7).second);
+    CPPUNIT_ASSERT(!m.insert(allOnes, 8).second);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(7), *m.find(allOnes));
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), m.size());
+
+    std::size_t count = 0;
+    for (map_type::const_iterator i = m.begin(); i != m.end(); ++i)
+    {
+        CPPUNIT_ASSERT_EQUAL(allOnes, i->key);
+        CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(7), i->value);
+        count++;
+    }
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), count);
+}
+
+void TestKeyMap::testGrowth()
+{
+    const std::size_t N = 10000;
+    map_type m("mem.test.keyMap");
+    std::map<std::tr1::uint64_t, std::tr1::uint32_t> ref;
+
+    for (std::size_t i = 0; i < N; i++)
+    {
+        const std::tr1::uint64_t key = scramble(i % (N / 2)); // second half are duplicates
+        const bool added = m.insert(key, std::tr1::uint32_t(i)).second;
+        CPPUNIT_ASSERT_EQUAL(ref.insert(std::make_pair(key, std::tr1::uint32_t(i))).second, added);
+    }
+    CPPUNIT_ASSERT_EQUAL(ref.size(), m.size());
+    for (std::map<std::tr1::uint64_t, std::tr1::uint32_t>::const_iterator i = ref.begin();
+         i != ref.end(); ++i)
+    {
+        const std::tr1::uint32_t *v = m.find(i->first);
+        CPPUNIT_ASSERT(v != NULL);
+        CPPUNIT_ASSERT_EQUAL(i->second, *v);
+    }
+}
+
+void TestKeyMap::testIterate()
+{
+    const std::size_t N = 1000;
+    map_type m("mem.test.keyMap");
+    for (std::size_t i = 0; i < N; i++)
+        m.insert(scramble(i), std::tr1::uint32_t(i));
+    m.insert(UINT64_C(0xFFFFFFFFFFFFFFFF), N);
+
+    std::map<std::tr1::uint64_t, std::tr1::uint32_t> seen;
+    for (map_type::const_iterator i = m.begin(); i != m.end(); ++i)
+        CPPUNIT_ASSERT(seen.insert(std::make_pair(i->key, i->value)).second);
+
+    CPPUNIT_ASSERT_EQUAL(m.size(), seen.size());
+    for (std::size_t i = 0; i < N; i++)
+        CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(i), seen[scramble(i)]);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(N), seen[UINT64_C(0xFFFFFFFFFFFFFFFF)]);
+}
+
+void TestKeyMap::testSwap()
+{
+    map_type a("mem.test.keyMap");
+    map_type b("mem.test.keyMap");
+    a.insert(1, 10);
+    b.insert(2, 20);
+    b.insert(3, 30);
+
+    a.swap(b);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), a.size());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), b.size());
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(20), *a.find(2));
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(10), *b.find(1));
+    CPPUNIT_ASSERT(a.find(1) == NULL);
+}
+
+void TestKeyMap::testCopy()
+{
+    map_type a("mem.test.keyMap");
+    for (std::size_t i = 0; i < 100; i++)
+        a.insert(scramble(i), std::tr1::uint32_t(i));
+
+    map_type b(a);
+    a.insert(scramble(200), 200);   // must not be visible in the copy
+    CPPUNIT_ASSERT_EQUAL(std::size_t(100), b.size());
+    for (std::size_t i = 0; i < 100; i++)
+        CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(i), *b.find(scramble(i)));
+    CPPUNIT_ASSERT(b.find(scramble(200)) == NULL);
+
+    map_type c("mem.test.keyMap");
+    c.insert(999, 1);
+    c = a;
+    CPPUNIT_ASSERT_EQUAL(a.size(), c.size());
+    CPPUNIT_ASSERT(c.find(999) == NULL);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(200), *c.find(scramble(200)));
+}
@@ -0,0 +1,126 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref KeyValueCache.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include "testutil.h"
+#include "../src/keyvalue_cache.h"
+
+class TestKeyValueCache : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestKeyValueCache);
+    CPPUNIT_TEST(testPersistence);
+    CPPUNIT_TEST(testEscaping);
+    CPPUNIT_TEST(testOverwrite);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    boost::filesystem::path cachePath;
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testPersistence();   ///< Values survive into a new instance
+    void testEscaping();      ///< Keys and values containing whitespace round-trip
+    void testOverwrite();     ///< The latest update wins, including after reload
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestKeyValueCache, TestSet::perBuild());
+
+void TestKeyValueCache::setUp()
+{
+    cachePath = boost::filesystem::temp_directory_path() / "mlsgpu-test-kv.cache";
+    boost::filesystem::remove(cachePath);
+}
+
+void TestKeyValueCache::tearDown()
+{
+    boost::filesystem::remove(cachePath);
+}
+
+void TestKeyValueCache::testPersistence()
+{
+    {
+        KeyValueCache cache(cachePath);
+        cache.update("key", "field", "value");
+        std::string value;
+        CPPUNIT_ASSERT(cache.lookup("key", "field", value));
+        CPPUNIT_ASSERT_EQUAL(std::string("value"), value);
+        CPPUNIT_ASSERT(!cache.lookup("key", "other", value));
+        CPPUNIT_ASSERT(!cache.lookup("other", "field", value));
+    }
+    {
+        KeyValueCache cache(cachePath);
+        std::string value;
+        CPPUNIT_ASSERT(cache.lookup("key", "field", value));
+        CPPUNIT_ASSERT_EQUAL(std::string("value"), value);
+    }
+}
+
+void TestKeyValueCache::testEscaping()
+{
+    const std::string key = "/some dir/a file.ply";
+    const std::string field = "id:1 2\t3";
+    const std::string value = "100% of\nthis";
+    {
+        KeyValueCache cache(cachePath);
+        cache.update(key, field, value);
+    }
+    {
+        KeyValueCache cache(cachePath);
+        std::string out;
+        CPPUNIT_ASSERT(cache.lookup(key, field, out));
+        CPPUNIT_ASSERT_EQUAL(value, out);
+        // Distinct keys that would collide if whitespace were stripped
+        CPPUNIT_ASSERT(!cache.lookup("/some", "dir/a", out));
+    }
+}
+
+void TestKeyValueCache::testOverwrite()
+{
+    {
+        KeyValueCache cache(cachePath);
+        cache.update("key", "field", "old");
+        cache.update("key", "field", "new");
+        std::string value;
+        CPPUNIT_ASSERT(cache.lookup("key", "field", value));
+        CPPUNIT_ASSERT_EQUAL(std::string("new"), value);
+    }
+    {
+        // Both records are in the file; the later one must win on reload
+        KeyValueCache cache(cachePath);
+        std::string value;
+        CPPUNIT_ASSERT(cache.lookup("key", "field", value));
+        CPPUNIT_ASSERT_EQUAL(std::string("new"), value);
+    }
+}
@@ -0,0 +1,200 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref ManifoldChecker.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cstddef>
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <boost/array.hpp>
+#include <CL/cl.h>
+#include "testutil.h"
+#include "../src/tr1_cstdint.h"
+#include "../src/mesh.h"
+#include "../src/manifold_checker.h"
+
+class TestManifoldChecker : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestManifoldChecker);
+    CPPUNIT_TEST(testClosed);
+    CPPUNIT_TEST(testBoundary);
+    CPPUNIT_TEST(testOveruse);
+    CPPUNIT_TEST(testOrientation);
+    CPPUNIT_TEST(testDegenerate);
+    CPPUNIT_TEST(testExternal);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Backing store for meshes built by @ref makeMesh
+    std::list<std::vector<cl_ulong> > store;
+
+    /**
+     * Build a block with the given triangles and external vertex keys. The
+     * vertex count is taken as one more than the largest index used, and
+     * vertex positions are left undefined (the checker must not read them).
+     */
+    HostKeyMesh makeMesh(
+        const std::vector<boost::array<cl_uint, 3> > &triangles,
+        const std::vector<cl_ulong> &keys);
+
+public:
+    void testClosed();       ///< A closed mesh passes with no boundary
+    void testBoundary();     ///< A lone triangle has three boundary edges
+    void testOveruse();      ///< An edge used three times is non-manifold
+    void testOrientation();  ///< Inconsistent winding is non-manifold
+    void testDegenerate();   ///< Triangles with repeated vertices are flagged
+    void testExternal();     ///< Shared edges are welded across blocks by key
+
+    virtual void tearDown() { store.clear(); }
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestManifoldChecker, TestSet::perBuild());
+
+HostKeyMesh TestManifoldChecker::makeMesh(
+    const std::vector<boost::array<cl_uint, 3> > &triangles,
+    const std::vector<cl_ulong> &keys)
+{
+    cl_uint numVertices = 0;
+    for (std::size_t i = 0; i < triangles.size(); i++)
+        for (unsigned int j = 0; j < 3; j++)
+            numVertices = std::max(numVertices, triangles[i][j] + 1);
+
+    const MeshSizes sizes(numVertices, triangles.size(), numVertices - keys.size());
+    store.push_back(std::vector<cl_ulong>(sizes.getHostBytes() / sizeof(cl_ulong) + 1));
+    HostKeyMesh mesh(&store.back()[0], sizes);
+    std::copy(triangles.begin(), triangles.end(), mesh.triangles);
+    std::copy(keys.begin(), keys.end(), mesh.vertexKeys);
+    return mesh;
+}
+
+static boost::array<cl_uint, 3> makeTriangle(cl_uint a, cl_uint b, cl_uint c)
+{
+    boost::array<cl_uint, 3> ans = {{ a, b, c }};
+    return ans;
+}
+
+void TestManifoldChecker::testClosed()
+{
+    // Tetrahedron, consistently wound, all vertices internal
+    std::vector<boost::array<cl_uint, 3> > triangles;
+    triangles.push_back(makeTriangle(0, 2, 1));
+    triangles.push_back(makeTriangle(0, 1, 3));
+    triangles.push_back(makeTriangle(1, 2, 3));
+    triangles.push_back(makeTriangle(2, 0, 3));
+
+    ManifoldChecker checker;
+    checker.add(makeMesh(triangles, std::vector<cl_ulong>()));
+    const ManifoldChecker::Summary summary = checker.summarize();
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(0), summary.nonManifoldEdges);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(0), summary.boundaryEdges);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(0), summary.degenerateTriangles);
+}
+
+void TestManifoldChecker::testBoundary()
+{
+    std::vector<boost::array<cl_uint, 3> > triangles;
+    triangles.push_back(makeTriangle(0, 1, 2));
+
+    ManifoldChecker checker;
+    checker.add(makeMesh(triangles, std::vector<cl_ulong>()));
+    const ManifoldChecker::Summary summary = checker.summarize();
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(0), summary.nonManifoldEdges);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(3), summary.boundaryEdges);
+}
+
+void TestManifoldChecker::testOveruse()
+{
+    // Three triangles fanning off the edge 0-1
+    std::vector<boost::array<cl_uint, 3> > triangles;
+    triangles.push_back(makeTriangle(0, 1, 2));
+    triangles.push_back(makeTriangle(1, 0, 3));
+    triangles.push_back(makeTriangle(1, 0, 4));
+
+    ManifoldChecker checker;
+    checker.add(makeMesh(triangles, std::vector<cl_ulong>()));
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(1), checker.summarize().nonManifoldEdges);
+}
+
+void TestManifoldChecker::testOrientation()
+{
+    // Both triangles traverse the edge 0-1 in the same direction
+    std::vector<boost::array<cl_uint, 3> > triangles;
+    triangles.push_back(makeTriangle(0, 1, 2));
+    triangles.push_back(makeTriangle(0, 1, 3));
+
+    ManifoldChecker checker;
+    checker.add(makeMesh(triangles, std::vector<cl_ulong>()));
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(1), checker.summarize().nonManifoldEdges);
+}
+
+void TestManifoldChecker::testDegenerate()
+{
+    std::vector<boost::array<cl_uint, 3> > triangles;
+    triangles.push_back(makeTriangle(0, 0, 1));
+
+    ManifoldChecker checker;
+    checker.add(makeMesh(triangles, std::vector<cl_ulong>()));
+    const ManifoldChecker::Summary summary = checker.summarize();
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(1), summary.degenerateTriangles);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(0), summary.boundaryEdges);
+}
+
+void TestManifoldChecker::testExternal()
+{
+    /* Two blocks, each one triangle with one internal vertex (0) and two
+     * external ones (1, 2). The external edge is shared between the blocks
+     * with opposite windings, so after reconciliation only the four edges
+     * touching the internal vertices lie on the boundary.
+     */
+    std::vector<boost::array<cl_uint, 3> > triangles;
+    triangles.push_back(makeTriangle(0, 1, 2));
+
+    std::vector<cl_ulong> keysA;
+    keysA.push_back(100);
+    keysA.push_back(200);
+    std::vector<cl_ulong> keysB;
+    keysB.push_back(200);
+    keysB.push_back(100);
+
+    ManifoldChecker checker;
+    checker.add(makeMesh(triangles, keysA));
+    checker.add(makeMesh(triangles, keysB));
+    const ManifoldChecker::Summary summary = checker.summarize();
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(0), summary.nonManifoldEdges);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(4), summary.boundaryEdges);
+
+    // A third use of the welded edge makes it non-manifold
+    checker.add(makeMesh(triangles, keysA));
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint64_t(1), checker.summarize().nonManifoldEdges);
+}
@@ -380,6 +380,12 @@ void TestMarching::callCompactVertices(
     kernel.setArg(6, dInKeys);
     kernel.setArg(7, minExternalKey);
     kernel.setArg(8, cl_ulong(0));
+    cl_float4 scaleBias;
+    scaleBias.s[0] = 0.0f;
+    scaleBias.s[1] = 0.0f;
+    scaleBias.s[2] = 0.0f;
+    scaleBias.s[3] = 1.0f;
+    kernel.setArg(9, scaleBias);
     CLH::enqueueNDRangeKernel(queue,
                               kernel,
                               cl::NullRange,
@@ -534,7 +540,7 @@ void TestMarching::testCopySlice()
         cl::NDRange(2, 2),
         cl::NDRange(2, 1));
     queue.enqueueBarrier();
-    marching.copySlice(queue, image, 2, 0, params, NULL, NULL);
+    marching.copySlice(queue, image, image, 2, 0, params, NULL, NULL);
     queue.finish();
 
     memset(values, 0, sizeof(values));
@@ -569,7 +575,7 @@ void TestMarching::testGenerate(
     {
         FastPly::Writer writer(STREAM_WRITER);
         OOCMesher mesher(writer, TrivialNamer(filename));
-        marching.generate(queue, generator, deviceMesher(mesher.functor(0), ChunkId(), tworker), size, keyOffset, NULL);
+        marching.generate(queue, generator, deviceMesher(mesher.functor(), ChunkId(), tworker), size, keyOffset, NULL);
         mesher.write(tworker);
     }
 
@@ -578,7 +584,7 @@ void TestMarching::testGenerate(
     {
         MemoryWriterPly writer;
         OOCMesher mesher(writer, TrivialNamer(filename));
-        marching.generate(queue, generator, deviceMesher(mesher.functor(0), ChunkId(), tworker), size, keyOffset, NULL);
+        marching.generate(queue, generator, deviceMesher(mesher.functor(), ChunkId(), tworker), size, keyOffset, NULL);
         mesher.write(tworker);
 
         const std::string &output = writer.getOutput(filename);
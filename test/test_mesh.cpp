@@ -41,6 +41,7 @@
 #include "testutil.h"
 #include "test_clh.h"
 #include "../src/mesh.h"
+#include "../src/marching.h"
 
 /**
  * Tests construction of a @ref DeviceKeyMesh.
@@ -80,6 +81,7 @@ class TestEnqueueReadMesh : public CLH::Test::TestFixture
     CPPUNIT_TEST(testSkipVertices);
     CPPUNIT_TEST(testSkipVertexKeys);
     CPPUNIT_TEST(testSkipTriangles);
+    CPPUNIT_TEST(testCompactKeys);
     CPPUNIT_TEST_SUITE_END();
 private:
     /**
@@ -114,6 +116,7 @@ public:
     void testSkipVertices();    ///< Test skipping transfer of vertices.
     void testSkipVertexKeys();  ///< Test skipping transfer of keys.
     void testSkipTriangles();   ///< Test skipping transfer of triangles.
+    void testCompactKeys();     ///< Test transfer and expansion of 32-bit compact keys.
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestEnqueueReadMesh, TestSet::perBuild());
 
@@ -251,3 +254,43 @@ void TestEnqueueReadMesh::testSkipTriangles()
     vertexKeysEvent.wait();
     validateVertexKeys(hMesh, dMesh.numInternalVertices());
 }
+
+void TestEnqueueReadMesh::testCompactKeys()
+{
+    const unsigned int xBits = 7;
+    const unsigned int yBits = 8;
+    const cl_ulong keyBase = (cl_ulong(3) << (2 * Marching::KEY_AXIS_BITS + 1)) | 0x40;
+
+    std::vector<cl_uint> compacted(expectedVertexKeys.size());
+    for (unsigned int i = 0; i < compacted.size(); i++)
+    {
+        const cl_uint x = 2 * i + 1;
+        const cl_uint y = 100 + i;
+        const cl_uint z = 3 * i;
+        compacted[i] = (((z << yBits) | y) << xBits) | x;
+        expectedVertexKeys[i] =
+            ((cl_ulong(z) << (2 * Marching::KEY_AXIS_BITS))
+             | (cl_ulong(y) << Marching::KEY_AXIS_BITS)
+             | x) + keyBase;
+    }
+
+    dMesh.vertexKeys = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  dMesh.numVertices() * sizeof(cl_uint),
+                                  &compacted[0]);
+    dMesh.compactKeys = true;
+    dMesh.keyBase = keyBase;
+    dMesh.compactKeyBits[0] = xBits;
+    dMesh.compactKeyBits[1] = yBits;
+
+    cl::Event vertexKeysEvent;
+    enqueueReadMesh(queue, dMesh, hMesh, NULL, NULL, &vertexKeysEvent, NULL);
+
+    vertexKeysEvent.wait();
+    CPPUNIT_ASSERT_EQUAL(true, hMesh.compactKeys);
+    hMesh.expandKeys();
+    CPPUNIT_ASSERT_EQUAL(false, hMesh.compactKeys);
+    validateVertexKeys(hMesh, dMesh.numInternalVertices());
+
+    hMesh.expandKeys(); // must now be a no-op
+    validateVertexKeys(hMesh, dMesh.numInternalVertices());
+}
@@ -33,6 +33,7 @@
 #include <vector>
 #include <boost/ref.hpp>
 #include <boost/smart_ptr/scoped_array.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
 #include <CL/cl.hpp>
 #include "testutil.h"
 #include "test_clh.h"
@@ -156,6 +157,7 @@ class TestMeshFilterChain : public CLH::Test::TestFixture
     CPPUNIT_TEST(testFilters);
     CPPUNIT_TEST(testCull);
     CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testFuseScaleBias);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -173,6 +175,7 @@ public:
     void testFilters();       ///< Test normal operation with filters in the chain
     void testCull();          ///< Test case where a filter completely eliminates the mesh
     void testEmpty();         ///< Passes an empty mesh into the front end
+    void testFuseScaleBias(); ///< Adjacent scale-bias filters are fused into one pass
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestMeshFilterChain, TestSet::perBuild());
 
@@ -268,6 +271,44 @@ void TestMeshFilterChain::testEmpty()
     MLSGPU_ASSERT_EQUAL(0, hMesh.numTriangles());
 }
 
+void TestMeshFilterChain::testFuseScaleBias()
+{
+    boost::shared_ptr<ScaleBiasFilter> filter1(new ScaleBiasFilter(context));
+    boost::shared_ptr<ScaleBiasFilter> filter2(new ScaleBiasFilter(context));
+    filter1->setScaleBias(2.0f, 1.0f, 0.0f, 0.0f);
+    filter2->setScaleBias(3.0f, 0.0f, 1.0f, 0.0f);
+    filterChain.addFilter(filter1);
+    filterChain.addFilter(filter2);
+
+    /* The second filter must have been folded into the first:
+     * v -> 3 * (2v + (1,0,0)) + (0,1,0) = 6v + (3,1,0).
+     */
+    const cl_float4 fused = filter1->getScaleBias();
+    CPPUNIT_ASSERT_EQUAL(6.0f, fused.s[3]);
+    CPPUNIT_ASSERT_EQUAL(3.0f, fused.s[0]);
+    CPPUNIT_ASSERT_EQUAL(1.0f, fused.s[1]);
+    CPPUNIT_ASSERT_EQUAL(0.0f, fused.s[2]);
+
+    std::vector<cl_float> inVertices(dMesh.numVertices() * 3);
+    for (std::size_t i = 0; i < inVertices.size(); i++)
+        inVertices[i] = cl_float(i) - 5.0f;
+    queue.enqueueWriteBuffer(dMesh.vertices, CL_TRUE, 0,
+                             inVertices.size() * sizeof(cl_float), &inVertices[0]);
+
+    cl::Event event;
+    filterChain(queue, dMesh, NULL, &event);
+    queue.flush();
+    event.wait();
+
+    MLSGPU_ASSERT_EQUAL(5, hMesh.numVertices());
+    MLSGPU_ASSERT_EQUAL(3, hMesh.numTriangles());
+    const float bias[3] = { 3.0f, 1.0f, 0.0f };
+    for (std::size_t i = 0; i < hMesh.numVertices(); i++)
+        for (int j = 0; j < 3; j++)
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(
+                inVertices[i * 3 + j] * 6.0f + bias[j], hMesh.vertices[i][j], 1e-3);
+}
+
 class TestScaleBiasFilter : public CLH::Test::TestFixture
 {
     CPPUNIT_TEST_SUITE(TestScaleBiasFilter);
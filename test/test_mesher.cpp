@@ -35,6 +35,7 @@
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <string>
+#include <sstream>
 #include <vector>
 #include <utility>
 #include <stdexcept>
@@ -54,10 +55,12 @@
 #include <boost/foreach.hpp>
 #include <boost/array.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include <CL/cl.hpp>
 #include "testutil.h"
 #include "../src/fast_ply.h"
 #include "../src/mesher.h"
+#include "../src/statistics.h"
 #include "test_clh.h"
 #include "memory_reader.h"
 #include "memory_writer.h"
@@ -120,6 +123,55 @@ void TestChunkNamer::testBig()
     CPPUNIT_ASSERT_EQUAL(string("foo_0100_123456_2345678.ply"), namer(chunkId));
 }
 
+class TestShardedChunkNamer : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestShardedChunkNamer);
+    CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    boost::filesystem::path tmpDir;   ///< Directory holding the generated hierarchy
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testSimple();   ///< Test name generation and directory creation
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestShardedChunkNamer, TestSet::perBuild());
+
+void TestShardedChunkNamer::setUp()
+{
+    tmpDir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directory(tmpDir);
+}
+
+void TestShardedChunkNamer::tearDown()
+{
+    boost::filesystem::remove_all(tmpDir);
+}
+
+void TestShardedChunkNamer::testSimple()
+{
+    ChunkId chunkId;
+    chunkId.gen = 123;
+    chunkId.coords[0] = 1;
+    chunkId.coords[1] = 5;
+    chunkId.coords[2] = 3000;
+    const string base = (tmpDir / "foo").string();
+    ShardedChunkNamer namer(base);
+    CPPUNIT_ASSERT_EQUAL(base + ".chunks/0001/0005/foo_0001_0005_3000.ply", namer(chunkId));
+    CPPUNIT_ASSERT(boost::filesystem::is_directory(base + ".chunks/0001/0005"));
+
+    // A second call must give the same name and not disturb the directory
+    CPPUNIT_ASSERT_EQUAL(base + ".chunks/0001/0005/foo_0001_0005_3000.ply", namer(chunkId));
+
+    // A copy shares the record of created directories
+    ShardedChunkNamer copy = namer;
+    chunkId.coords[2] = 3001;
+    CPPUNIT_ASSERT_EQUAL(base + ".chunks/0001/0005/foo_0001_0005_3001.ply", copy(chunkId));
+}
+
 /**
  * Tests that are shared across all the @ref MesherBase subclasses.
  */
@@ -133,6 +185,7 @@ class TestMesherBase : public CLH::Test::TestFixture
     CPPUNIT_TEST(testWeld);
     CPPUNIT_TEST(testPrune);
     CPPUNIT_TEST(testChunk);
+    CPPUNIT_TEST(testNormals);
     // CPPUNIT_TEST(testRandom); // Moved to TestMesherBaseSlow
     CPPUNIT_TEST_SUITE_END_ABSTRACT();
 private:
@@ -245,6 +298,7 @@ public:
     void testWeld();            ///< Tests vertex welding
     void testPrune();           ///< Tests component pruning
     void testChunk();           ///< Test chunking into multiple files
+    void testNormals();         ///< Test writing per-vertex normals
     void testRandom();          ///< Test with pseudo-random data
 };
 
@@ -498,42 +552,18 @@ void TestMesherBase::testSimple()
     MemoryWriterPly writer;
 
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer));
-    unsigned int passes = mesher->numPasses();
-    for (unsigned int i = 0; i < passes; i++)
-    {
-        const MesherBase::InputFunctor functor = mesher->functor(i);
-        /* Reverse the order on each pass, to ensure that the mesher
-         * classes are robust to non-deterministic reordering.
-         */
-        if (i % 2 == 0)
-        {
-            add(ChunkId(), functor,
-                boost::size(internalVertices0), 0, boost::size(indices0),
-                internalVertices0, NULL, NULL, indices0);
-            add(ChunkId(), functor,
-                0, boost::size(externalVertices1), boost::size(indices1),
-                NULL, externalVertices1, externalKeys1, indices1);
-            add(ChunkId(), functor,
-                boost::size(internalVertices2),
-                boost::size(externalVertices2),
-                boost::size(indices2),
-                internalVertices2, externalVertices2, externalKeys2, indices2);
-        }
-        else
-        {
-            add(ChunkId(), functor,
-                boost::size(internalVertices2),
-                boost::size(externalVertices2),
-                boost::size(indices2),
-                internalVertices2, externalVertices2, externalKeys2, indices2);
-            add(ChunkId(), functor,
-                0, boost::size(externalVertices1), boost::size(indices1),
-                NULL, externalVertices1, externalKeys1, indices1);
-            add(ChunkId(), functor,
-                boost::size(internalVertices0), 0, boost::size(indices0),
-                internalVertices0, NULL, NULL, indices0);
-        }
-    }
+    const MesherBase::InputFunctor functor = mesher->functor();
+    add(ChunkId(), functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    add(ChunkId(), functor,
+        0, boost::size(externalVertices1), boost::size(indices1),
+        NULL, externalVertices1, externalKeys1, indices1);
+    add(ChunkId(), functor,
+        boost::size(internalVertices2),
+        boost::size(externalVertices2),
+        boost::size(indices2),
+        internalVertices2, externalVertices2, externalKeys2, indices2);
     mesher->write(tworker);
 
     // Check that boost::size really works on these arrays
@@ -576,19 +606,15 @@ void TestMesherBase::testNoInternal()
     MemoryWriterPly writer;
 
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer));
-    unsigned int passes = mesher->numPasses();
-    for (unsigned int i = 0; i < passes; i++)
-    {
-        const MesherBase::InputFunctor functor = mesher->functor(i);
-        add(ChunkId(), functor,
-            0, boost::size(externalVertices1), boost::size(indices1),
-            NULL, externalVertices1, externalKeys1, indices1);
-        add(ChunkId(), functor,
-            0,
-            boost::size(externalVertices2),
-            boost::size(indices2),
-            NULL, externalVertices2, externalKeys2, indices2);
-    }
+    const MesherBase::InputFunctor functor = mesher->functor();
+    add(ChunkId(), functor,
+        0, boost::size(externalVertices1), boost::size(indices1),
+        NULL, externalVertices1, externalKeys1, indices1);
+    add(ChunkId(), functor,
+        0,
+        boost::size(externalVertices2),
+        boost::size(indices2),
+        NULL, externalVertices2, externalKeys2, indices2);
     mesher->write(tworker);
 
     checkIsomorphic(boost::size(expectedVertices), boost::size(expectedIndices),
@@ -630,19 +656,15 @@ void TestMesherBase::testNoExternal()
     MemoryWriterPly writer;
 
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer));
-    unsigned int passes = mesher->numPasses();
-    for (unsigned int i = 0; i < passes; i++)
-    {
-        const MesherBase::InputFunctor functor = mesher->functor(i);
-        add(ChunkId(), functor,
-            boost::size(internalVertices0), 0, boost::size(indices0),
-            internalVertices0, NULL, NULL, indices0);
-        add(ChunkId(), functor,
-            boost::size(internalVertices2),
-            0,
-            boost::size(indices2),
-            internalVertices2, NULL, NULL, indices2);
-    }
+    const MesherBase::InputFunctor functor = mesher->functor();
+    add(ChunkId(), functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    add(ChunkId(), functor,
+        boost::size(internalVertices2),
+        0,
+        boost::size(indices2),
+        internalVertices2, NULL, NULL, indices2);
     mesher->write(tworker);
 
     checkIsomorphic(boost::size(expectedVertices), boost::size(expectedIndices),
@@ -656,12 +678,8 @@ void TestMesherBase::testEmpty()
     MemoryWriterPly writer;
 
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer));
-    unsigned int passes = mesher->numPasses();
-    for (unsigned int i = 0; i < passes; i++)
-    {
-        const MesherBase::InputFunctor functor = mesher->functor(i);
-        add(ChunkId(), functor, 0, 0, 0, NULL, NULL, NULL, NULL);
-    }
+    const MesherBase::InputFunctor functor = mesher->functor();
+    add(ChunkId(), functor, 0, 0, 0, NULL, NULL, NULL, NULL);
     mesher->write(tworker);
 
     // Output should not be produced for empty chunks
@@ -712,27 +730,23 @@ void TestMesherBase::testWeld()
     MemoryWriterPly writer;
 
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer));
-    unsigned int passes = mesher->numPasses();
-    for (unsigned int i = 0; i < passes; i++)
-    {
-        const MesherBase::InputFunctor functor = mesher->functor(i);
-        add(ChunkId(), functor,
-            boost::size(internalVertices0), 0, boost::size(indices0),
-            internalVertices0, NULL, NULL, indices0);
-        add(ChunkId(), functor,
-            0, boost::size(externalVertices1), boost::size(indices1),
-            NULL, externalVertices1, externalKeys1, indices1);
-        add(ChunkId(), functor,
-            boost::size(internalVertices2),
-            boost::size(externalVertices2),
-            boost::size(indices2),
-            internalVertices2, externalVertices2, externalKeys2, indices2);
-        add(ChunkId(), functor,
-            boost::size(internalVertices3),
-            boost::size(externalVertices3),
-            boost::size(indices3),
-            internalVertices3, externalVertices3, externalKeys3, indices3);
-    }
+    const MesherBase::InputFunctor functor = mesher->functor();
+    add(ChunkId(), functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    add(ChunkId(), functor,
+        0, boost::size(externalVertices1), boost::size(indices1),
+        NULL, externalVertices1, externalKeys1, indices1);
+    add(ChunkId(), functor,
+        boost::size(internalVertices2),
+        boost::size(externalVertices2),
+        boost::size(indices2),
+        internalVertices2, externalVertices2, externalKeys2, indices2);
+    add(ChunkId(), functor,
+        boost::size(internalVertices3),
+        boost::size(externalVertices3),
+        boost::size(indices3),
+        internalVertices3, externalVertices3, externalKeys3, indices3);
     mesher->write(tworker);
 
     // Check that boost::size really works on these arrays
@@ -892,29 +906,25 @@ void TestMesherBase::testPrune()
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer));
     // There are 22 vertices total, and we want a threshold of 6
     mesher->setPruneThreshold(6.5 / 22.0);
-    unsigned int passes = mesher->numPasses();
-    for (unsigned int i = 0; i < passes; i++)
-    {
-        const MesherBase::InputFunctor functor = mesher->functor(i);
-        add(ChunkId(), functor,
-            boost::size(internalVertices0),
-            boost::size(externalVertices0),
-            boost::size(indices0),
-            internalVertices0, externalVertices0, externalKeys0, indices0);
-        add(ChunkId(), functor,
-            boost::size(internalVertices1),
-            boost::size(externalVertices1),
-            boost::size(indices1),
-            internalVertices1, externalVertices1, externalKeys1, indices1);
-        add(ChunkId(), functor,
-            0, boost::size(externalVertices2), boost::size(indices2),
-            NULL, externalVertices2, externalKeys2, indices2);
-        add(ChunkId(), functor,
-            boost::size(internalVertices3),
-            boost::size(externalVertices3),
-            boost::size(indices3),
-            internalVertices3, externalVertices3, externalKeys3, indices3);
-    }
+    const MesherBase::InputFunctor functor = mesher->functor();
+    add(ChunkId(), functor,
+        boost::size(internalVertices0),
+        boost::size(externalVertices0),
+        boost::size(indices0),
+        internalVertices0, externalVertices0, externalKeys0, indices0);
+    add(ChunkId(), functor,
+        boost::size(internalVertices1),
+        boost::size(externalVertices1),
+        boost::size(indices1),
+        internalVertices1, externalVertices1, externalKeys1, indices1);
+    add(ChunkId(), functor,
+        0, boost::size(externalVertices2), boost::size(indices2),
+        NULL, externalVertices2, externalKeys2, indices2);
+    add(ChunkId(), functor,
+        boost::size(internalVertices3),
+        boost::size(externalVertices3),
+        boost::size(indices3),
+        internalVertices3, externalVertices3, externalKeys3, indices3);
     mesher->write(tworker);
 
     checkIsomorphic(boost::size(expectedVertices), boost::size(expectedIndices),
@@ -946,7 +956,6 @@ void TestMesherBase::testChunk()
     ChunkNamer namer("chunk");
     MemoryWriterPly writer;
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer, namer));
-    unsigned int passes = mesher->numPasses();
 
     ChunkId chunkId[4];
     for (unsigned int i = 0; i < 4; i++)
@@ -956,26 +965,23 @@ void TestMesherBase::testChunk()
         chunkId[i].coords[1] = i * i;
         chunkId[i].coords[2] = 1;
     }
-    for (unsigned int i = 0; i < passes; i++)
-    {
-        const MesherBase::InputFunctor functor = mesher->functor(i);
-        add(chunkId[0], functor,
-            boost::size(internalVertices0), 0, boost::size(indices0),
-            internalVertices0, NULL, NULL, indices0);
-        add(chunkId[1], functor,
-            0, boost::size(externalVertices1), boost::size(indices1),
-            NULL, externalVertices1, externalKeys1, indices1);
-        add(chunkId[2], functor,
-            boost::size(internalVertices2),
-            boost::size(externalVertices2),
-            boost::size(indices2),
-            internalVertices2, externalVertices2, externalKeys2, indices2);
-        add(chunkId[3], functor,
-            boost::size(internalVertices3),
-            boost::size(externalVertices3),
-            boost::size(indices3),
-            internalVertices3, externalVertices3, externalKeys3, indices3);
-    }
+    const MesherBase::InputFunctor functor = mesher->functor();
+    add(chunkId[0], functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    add(chunkId[1], functor,
+        0, boost::size(externalVertices1), boost::size(indices1),
+        NULL, externalVertices1, externalKeys1, indices1);
+    add(chunkId[2], functor,
+        boost::size(internalVertices2),
+        boost::size(externalVertices2),
+        boost::size(indices2),
+        internalVertices2, externalVertices2, externalKeys2, indices2);
+    add(chunkId[3], functor,
+        boost::size(internalVertices3),
+        boost::size(externalVertices3),
+        boost::size(indices3),
+        internalVertices3, externalVertices3, externalKeys3, indices3);
     mesher->write(tworker);
 
     checkIsomorphic(boost::size(internalVertices0),
@@ -992,6 +998,63 @@ void TestMesherBase::testChunk()
                     expectedVertices3, indices3, writer.getOutput("chunk_0003_0009_0001.ply"));
 }
 
+void TestMesherBase::testNormals()
+{
+    Timeplot::Worker tworker("test");
+
+    /* Two components with constant face normals, so the expected per-vertex
+     * normals are known exactly regardless of how area weighting combines
+     * the faces: a square in the z = 0 plane facing +z, and a triangle in
+     * the x = 5 plane facing +x.
+     */
+    const boost::array<cl_float, 3> vertices[] =
+    {
+        {{ 0.0f, 0.0f, 0.0f }},
+        {{ 1.0f, 0.0f, 0.0f }},
+        {{ 0.0f, 1.0f, 0.0f }},
+        {{ 1.0f, 1.0f, 0.0f }},
+        {{ 5.0f, 0.0f, 0.0f }},
+        {{ 5.0f, 1.0f, 0.0f }},
+        {{ 5.0f, 0.0f, 1.0f }}
+    };
+    const cl_uint indices[] =
+    {
+        0, 1, 2,
+        1, 3, 2,
+        4, 5, 6
+    };
+
+    MemoryWriterPly writer;
+    writer.setNormals(true);
+
+    boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer));
+    const MesherBase::InputFunctor functor = mesher->functor();
+    add(ChunkId(), functor,
+        boost::size(vertices), 0, boost::size(indices),
+        vertices, NULL, NULL, indices);
+    mesher->write(tworker);
+
+    checkIsomorphic(boost::size(vertices), boost::size(indices),
+                    vertices, indices, writer.getOutput(""));
+
+    vector<boost::array<float, 3> > actualVertices;
+    vector<boost::array<float, 3> > actualNormals;
+    vector<boost::array<std::tr1::uint32_t, 3> > actualTriangles;
+    MemoryWriterPly::parse(writer.getOutput(""), actualVertices, actualNormals, actualTriangles);
+    CPPUNIT_ASSERT_EQUAL(actualVertices.size(), actualNormals.size());
+    for (size_t i = 0; i < actualNormals.size(); i++)
+    {
+        // Vertices in the x = 5 plane face +x, the others +z
+        boost::array<float, 3> expected = {{ 0.0f, 0.0f, 0.0f }};
+        if (actualVertices[i][0] == 5.0f)
+            expected[0] = 1.0f;
+        else
+            expected[2] = 1.0f;
+        for (int j = 0; j < 3; j++)
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected[j], actualNormals[i][j], 1e-6);
+    }
+}
+
 static int simpleRandomInt(std::tr1::mt19937 &engine, int min, int max)
 {
     using std::tr1::mt19937;
@@ -1168,22 +1231,18 @@ void TestMesherBase::testRandom()
     MemoryWriterPly writer;
     boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer, namer));
     mesher->setPruneThreshold(pruneThreshold);
-    unsigned int passes = mesher->numPasses();
 
-    for (unsigned int pass = 0; pass < passes; pass++)
+    const MesherBase::InputFunctor functor = mesher->functor();
+    BOOST_FOREACH(Chunk &chunk, chunks)
     {
-        const MesherBase::InputFunctor functor = mesher->functor(pass);
-        BOOST_FOREACH(Chunk &chunk, chunks)
+        BOOST_FOREACH(Block &block, chunk.blocks)
         {
-            BOOST_FOREACH(Block &block, chunk.blocks)
-            {
-                CLH::enqueueMarkerWithWaitList(queue, NULL, &block.work.verticesEvent);
-                CLH::enqueueMarkerWithWaitList(queue, NULL, &block.work.vertexKeysEvent);
-                CLH::enqueueMarkerWithWaitList(queue, NULL, &block.work.trianglesEvent);
-                block.work.hasEvents = true;
-                queue.flush();
-                functor(block.work, tworker);
-            }
+            CLH::enqueueMarkerWithWaitList(queue, NULL, &block.work.verticesEvent);
+            CLH::enqueueMarkerWithWaitList(queue, NULL, &block.work.vertexKeysEvent);
+            CLH::enqueueMarkerWithWaitList(queue, NULL, &block.work.trianglesEvent);
+            block.work.hasEvents = true;
+            queue.flush();
+            functor(block.work, tworker);
         }
     }
     mesher->write(tworker);
@@ -1217,9 +1276,14 @@ class TestMesherBaseSlow : public TestMesherBase
 class TestOOCMesher : public TestMesherBase
 {
     CPPUNIT_TEST_SUB_SUITE(TestOOCMesher, TestMesherBase);
+    CPPUNIT_TEST(testKeyMapSpill);
+    CPPUNIT_TEST(testChunkStream);
     CPPUNIT_TEST_SUITE_END();
 protected:
     virtual MesherBase *mesherFactory(FastPly::Writer &writer, const MesherBase::Namer &namer);
+public:
+    void testKeyMapSpill();     ///< Test welding against vertex maps that were spilled to disk
+    void testChunkStream();     ///< Test streaming finalized chunks down a side channel
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestOOCMesher, TestSet::perBuild());
 
@@ -1231,17 +1295,24 @@ class TestTmpWriterWorkerGroup : public CppUnit::TestFixture
     CPPUNIT_TEST_SUITE(TestTmpWriterWorkerGroup);
     CPPUNIT_TEST(testInitialState);
     CPPUNIT_TEST(testRandom);
+#if HAVE_COMPRESS2
+    CPPUNIT_TEST(testRandomCompressed);
+#endif
     CPPUNIT_TEST_SUITE_END();
 
 private:
     /// Checks that an obtained item is empty
     void checkEmpty(const OOCMesher::TmpWriterItem &item);
 
+    /// Implementation of @ref testRandom and @ref testRandomCompressed
+    void runRandom(bool compressed);
+
     OOCMesher::TmpWriterWorkerGroup group;
 
 public:
     void testInitialState();  ///< Tests that the paths are initially empty
     void testRandom();        ///< Throws in lots of random data, checks that it comes back
+    void testRandomCompressed(); ///< Like @ref testRandom, but with compressed temporary files
 
     virtual void tearDown();  ///< Delete the temporary files
 
@@ -1264,6 +1335,16 @@ void TestTmpWriterWorkerGroup::testInitialState()
 }
 
 void TestTmpWriterWorkerGroup::testRandom()
+{
+    runRandom(false);
+}
+
+void TestTmpWriterWorkerGroup::testRandomCompressed()
+{
+    runRandom(true);
+}
+
+void TestTmpWriterWorkerGroup::runRandom(bool compressed)
 {
     using std::tr1::mt19937;
     using std::tr1::uniform_int;
@@ -1278,7 +1359,7 @@ void TestTmpWriterWorkerGroup::testRandom()
     variate_generator<mt19937 &, uniform_real<float> > genVertex(engine, uniform_real<float>(-100.0f, 100.0f));
 
     Timeplot::Worker tworker("test");
-    group.start();
+    group.start(compressed);
 
     std::vector<vertex_type> expectedVertices;
     std::vector<triangle_type> expectedTriangles;
@@ -1336,26 +1417,30 @@ void TestTmpWriterWorkerGroup::testRandom()
 
     group.stop();
 
-    CPPUNIT_ASSERT(!group.verticesFile.is_open());
-    CPPUNIT_ASSERT(!group.trianglesFile.is_open());
+    CPPUNIT_ASSERT(!group.verticesFile->isOpen());
+    CPPUNIT_ASSERT(!group.trianglesFile->isOpen());
     CPPUNIT_ASSERT(!group.getVerticesPath().empty());
     CPPUNIT_ASSERT(!group.getTrianglesPath().empty());
 
-    boost::filesystem::ifstream inVertices(group.getVerticesPath(), std::ios::in | std::ios::binary);
-    boost::filesystem::ifstream inTriangles(group.getTrianglesPath(), std::ios::in | std::ios::binary);
+    boost::scoped_ptr<BinaryReader> inVertices(createReader(group.getReaderType()));
+    inVertices->open(group.getVerticesPath());
+    boost::scoped_ptr<BinaryReader> inTriangles(createReader(group.getReaderType()));
+    inTriangles->open(group.getTrianglesPath());
     std::vector<vertex_type> actualVertices(expectedVertices.size());
     std::vector<triangle_type> actualTriangles(expectedTriangles.size());
 
-    inVertices.read(reinterpret_cast<char *>(&actualVertices[0]), expectedVertices.size() * sizeof(vertex_type));
-    CPPUNIT_ASSERT(inVertices);
-    MLSGPU_ASSERT_EQUAL(expectedVertices.size() * sizeof(vertex_type), inVertices.gcount());
+    MLSGPU_ASSERT_EQUAL(expectedVertices.size() * sizeof(vertex_type), inVertices->size());
+    std::size_t bytes = inVertices->read(
+        &actualVertices[0], expectedVertices.size() * sizeof(vertex_type), 0);
+    MLSGPU_ASSERT_EQUAL(expectedVertices.size() * sizeof(vertex_type), bytes);
     for (std::size_t i = 0; i < expectedVertices.size(); i++)
         for (int j = 0; j < 3; j++)
             CPPUNIT_ASSERT_EQUAL(expectedVertices[i][j], actualVertices[i][j]);
 
-    inTriangles.read(reinterpret_cast<char *>(&actualTriangles[0]), expectedTriangles.size() * sizeof(triangle_type));
-    CPPUNIT_ASSERT(inTriangles);
-    MLSGPU_ASSERT_EQUAL(expectedTriangles.size() * sizeof(triangle_type), inTriangles.gcount());
+    MLSGPU_ASSERT_EQUAL(expectedTriangles.size() * sizeof(triangle_type), inTriangles->size());
+    bytes = inTriangles->read(
+        &actualTriangles[0], expectedTriangles.size() * sizeof(triangle_type), 0);
+    MLSGPU_ASSERT_EQUAL(expectedTriangles.size() * sizeof(triangle_type), bytes);
     for (std::size_t i = 0; i < expectedTriangles.size(); i++)
         for (int j = 0; j < 3; j++)
             CPPUNIT_ASSERT_EQUAL(expectedTriangles[i][j], actualTriangles[i][j]);
@@ -1382,3 +1467,149 @@ MesherBase *TestOOCMesher::mesherFactory(FastPly::Writer &writer, const MesherBa
 {
     return new OOCMesher(writer, namer);
 }
+
+void TestOOCMesher::testKeyMapSpill()
+{
+    Timeplot::Worker tworker("test");
+
+    // Welded union of blocks 1 and 3 (see testWeld)
+    const boost::array<cl_float, 3> expectedVertices[] =
+    {
+        {{ 1.0f, 0.0f, 1.0f }},
+        {{ 1.0f, 0.0f, 2.0f }},
+        {{ 1.0f, 0.0f, 3.0f }},
+        {{ 1.0f, 0.0f, 4.0f }},
+        {{ 3.0f, 3.0f, 3.0f }},
+        {{ 4.0f, 5.0f, 6.0f }},
+        {{ 2.0f, 0.0f, 2.0f }}
+    };
+    const cl_uint expectedIndices[] =
+    {
+        0, 1, 3,
+        1, 2, 3,
+        2, 0, 3,
+        4, 1, 5,
+        5, 1, 6,
+        6, 1, 2
+    };
+
+    ChunkId chunkId[2];
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        chunkId[i].gen = i;
+        chunkId[i].coords[0] = i;
+        chunkId[i].coords[1] = i;
+        chunkId[i].coords[2] = 1;
+    }
+
+    ChunkNamer namer("chunk");
+    MemoryWriterPly writer;
+    boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer, namer));
+    // Force the welding map of whichever chunk is not active to be spilled
+    mesher->setKeyMapCapacity(1);
+
+    const unsigned long long oldSpills =
+        Statistics::getStatistic<Statistics::Counter>("mesher.keymap.spills").getTotal();
+
+    const MesherBase::InputFunctor functor = mesher->functor();
+    add(chunkId[0], functor,
+        0, boost::size(externalVertices1), boost::size(indices1),
+        NULL, externalVertices1, externalKeys1, indices1);
+    // Touching another chunk evicts chunk 0's welding map to disk
+    add(chunkId[1], functor,
+        boost::size(internalVertices0), 0, boost::size(indices0),
+        internalVertices0, NULL, NULL, indices0);
+    // Revisit chunk 0: must weld against the keys that are now on disk
+    add(chunkId[0], functor,
+        boost::size(internalVertices3),
+        boost::size(externalVertices3),
+        boost::size(indices3),
+        internalVertices3, externalVertices3, externalKeys3, indices3);
+    mesher->write(tworker);
+
+    CPPUNIT_ASSERT(Statistics::getStatistic<Statistics::Counter>("mesher.keymap.spills").getTotal() > oldSpills);
+
+    checkIsomorphic(boost::size(expectedVertices), boost::size(expectedIndices),
+                    expectedVertices, expectedIndices, writer.getOutput("chunk_0000_0000_0001.ply"));
+    checkIsomorphic(boost::size(internalVertices0), boost::size(indices0),
+                    internalVertices0, indices0, writer.getOutput("chunk_0001_0001_0001.ply"));
+}
+
+/// Reads a whole file into a string (for @ref TestOOCMesher::testChunkStream)
+static std::string slurpFile(const boost::filesystem::path &path)
+{
+    boost::filesystem::ifstream in(path, std::ios::in | std::ios::binary);
+    CPPUNIT_ASSERT(in);
+    std::ostringstream data;
+    data << in.rdbuf();
+    return data.str();
+}
+
+void TestOOCMesher::testChunkStream()
+{
+    Timeplot::Worker tworker("test");
+
+    const boost::filesystem::path tmpDir =
+        boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directory(tmpDir);
+
+    /* Unlike the other tests this uses a real writer, because the stream
+     * payload is produced by reading the finished chunk back from disk.
+     */
+    FastPly::Writer writer(SYSCALL_WRITER);
+    ChunkNamer namer((tmpDir / "chunk").string());
+    const std::string streamPath = (tmpDir / "stream").string();
+
+    ChunkId chunkId[2];
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        chunkId[i].gen = i;
+        chunkId[i].coords[0] = i;
+        chunkId[i].coords[1] = i;
+        chunkId[i].coords[2] = 1;
+    }
+
+    {
+        boost::scoped_ptr<MesherBase> mesher(mesherFactory(writer, namer));
+        mesher->setChunkStream(streamPath);
+        const MesherBase::InputFunctor functor = mesher->functor();
+        add(chunkId[0], functor,
+            boost::size(internalVertices0), 0, boost::size(indices0),
+            internalVertices0, NULL, NULL, indices0);
+        add(chunkId[1], functor,
+            0, boost::size(externalVertices1), boost::size(indices1),
+            NULL, externalVertices1, externalKeys1, indices1);
+        mesher->write(tworker);
+    }
+
+    const std::string stream = slurpFile(streamPath);
+    const char expectedMagic[8] = {'m', 'l', 's', 'g', 'p', 'u', 'C', '1'};
+    std::size_t pos = 0;
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        CPPUNIT_ASSERT(pos + sizeof(expectedMagic) + sizeof(std::tr1::uint32_t) <= stream.size());
+        CPPUNIT_ASSERT(std::memcmp(stream.data() + pos, expectedMagic, sizeof(expectedMagic)) == 0);
+        pos += sizeof(expectedMagic);
+
+        std::tr1::uint32_t nameLen;
+        std::memcpy(&nameLen, stream.data() + pos, sizeof(nameLen));
+        pos += sizeof(nameLen);
+        CPPUNIT_ASSERT(pos + nameLen + sizeof(std::tr1::uint64_t) <= stream.size());
+        const std::string name = stream.substr(pos, nameLen);
+        pos += nameLen;
+
+        std::tr1::uint64_t payloadLen;
+        std::memcpy(&payloadLen, stream.data() + pos, sizeof(payloadLen));
+        pos += sizeof(payloadLen);
+        CPPUNIT_ASSERT(pos + payloadLen <= stream.size());
+        const std::string payload = stream.substr(pos, payloadLen);
+        pos += payloadLen;
+
+        // The payload must be the finished chunk, byte for byte
+        CPPUNIT_ASSERT_EQUAL(namer(chunkId[i]), name);
+        CPPUNIT_ASSERT(payload == slurpFile(name));
+    }
+    CPPUNIT_ASSERT_EQUAL(stream.size(), pos);
+
+    boost::filesystem::remove_all(tmpDir);
+}
@@ -316,12 +316,59 @@ void TestFloatToBits::testSimple()
     CPPUNIT_ASSERT_EQUAL(UINT32_C(0x00000000), floatToBits(0.0f));
 }
 
+/// Tests for @ref floatToHalf.
+class TestFloatToHalf : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestFloatToHalf);
+    CPPUNIT_TEST(testExact);
+    CPPUNIT_TEST(testRounding);
+    CPPUNIT_TEST(testExtremes);
+    CPPUNIT_TEST_SUITE_END();
+public:
+    void testExact();      ///< Values that are exactly representable
+    void testRounding();   ///< Round-to-nearest-even behaviour
+    void testExtremes();   ///< Overflow, denormals, zeros, infinities and NaN
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestFloatToHalf, TestSet::perBuild());
+
+void TestFloatToHalf::testExact()
+{
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x3C00), floatToHalf(1.0f));
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x3800), floatToHalf(0.5f));
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0xC000), floatToHalf(-2.0f));
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x3C01), floatToHalf(1.0009765625f));
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x7BFF), floatToHalf(65504.0f)); // largest finite half
+}
+
+void TestFloatToHalf::testRounding()
+{
+    // Halfway cases go to the even mantissa
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x3C00), floatToHalf(1.00048828125f));
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x3C02), floatToHalf(1.00146484375f));
+    // Mantissa overflow during rounding must carry into the exponent
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x4000), floatToHalf(1.99999f));
+}
+
+void TestFloatToHalf::testExtremes()
+{
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x0000), floatToHalf(0.0f));
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x8000), floatToHalf(-0.0f));
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x7C00), floatToHalf(65520.0f)); // rounds to infinity
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x7C00), floatToHalf(std::numeric_limits<float>::infinity()));
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x0001), floatToHalf(5.9604644775390625e-8f)); // smallest denormal
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x0000), floatToHalf(2.9802322387695312e-8f)); // underflows (tie to even)
+    const uint16_t nan = floatToHalf(std::numeric_limits<float>::quiet_NaN());
+    CPPUNIT_ASSERT_EQUAL(UINT16_C(0x7C00), uint16_t(nan & 0x7C00));
+    CPPUNIT_ASSERT(nan & 0x3FF); // NaN must not collapse to infinity
+}
+
 
 /// Tests for temporary file creation
 class TestTmpFile : public CppUnit::TestFixture
 {
     CPPUNIT_TEST_SUITE(TestTmpFile);
     CPPUNIT_TEST(testCreate);
+    CPPUNIT_TEST(testStripe);
 #if DEBUG
     CPPUNIT_TEST(testBadPath);
 #endif
@@ -332,6 +379,7 @@ private:
 
 public:
     void testCreate();      ///< Test basic creation
+    void testStripe();      ///< Test round-robin placement over several directories
     void testBadPath();     ///< Test exception handling when the path is wrong
 
     virtual void tearDown();
@@ -360,6 +408,36 @@ void TestTmpFile::testCreate()
     in.close();
 }
 
+void TestTmpFile::testStripe()
+{
+    std::vector<boost::filesystem::path> dirs(2);
+    dirs[0] = boost::filesystem::unique_path("mlsgpu-test-stripe0-%%%%");
+    dirs[1] = boost::filesystem::unique_path("mlsgpu-test-stripe1-%%%%");
+    boost::filesystem::create_directory(dirs[0]);
+    boost::filesystem::create_directory(dirs[1]);
+    try
+    {
+        setTmpFileDirs(dirs);
+        for (int i = 0; i < 4; i++)
+        {
+            boost::filesystem::ofstream out;
+            boost::filesystem::path path;
+            createTmpFile(path, out);
+            out.close();
+            CPPUNIT_ASSERT_EQUAL(dirs[i % 2].string(), path.parent_path().string());
+            boost::filesystem::remove(path);
+        }
+    }
+    catch (...)
+    {
+        boost::filesystem::remove_all(dirs[0]);
+        boost::filesystem::remove_all(dirs[1]);
+        throw;
+    }
+    boost::filesystem::remove_all(dirs[0]);
+    boost::filesystem::remove_all(dirs[1]);
+}
+
 void TestTmpFile::testBadPath()
 {
     setTmpFileDir("//\\bad");
@@ -134,9 +134,12 @@ void TestMls::setUp()
     CLH::Test::TestFixture::setUp();
     map<string, string> defines;
     defines["UNIT_TESTS"] = "1";
-    defines["WGS_X"] = boost::lexical_cast<std::string>(MlsFunctor::wgs[0]);
-    defines["WGS_Y"] = boost::lexical_cast<std::string>(MlsFunctor::wgs[1]);
-    defines["WGS_Z"] = boost::lexical_cast<std::string>(MlsFunctor::wgs[2]);
+    defines["WGS_X"] = boost::lexical_cast<std::string>(MlsFunctor::maxWgs[0]);
+    defines["WGS_Y"] = boost::lexical_cast<std::string>(MlsFunctor::maxWgs[1]);
+    defines["WGS_Z"] = boost::lexical_cast<std::string>(MlsFunctor::maxWgs[2]);
+    defines["FILL_WGS_X"] = boost::lexical_cast<std::string>(MlsFunctor::fillWgs[0]);
+    defines["FILL_WGS_Y"] = boost::lexical_cast<std::string>(MlsFunctor::fillWgs[1]);
+    defines["CLASSIFY_WGS"] = boost::lexical_cast<std::string>(MlsFunctor::classifyWgs);
     defines["FIT_SPHERE"] = "1";
     defines["FIT_PLANE"] = "0";
     mlsProgram = CLH::build(context, "kernels/mls.cl", defines);
@@ -241,7 +244,7 @@ float TestMls::callProjectDistOriginSphere(const std::vector<float> &params)
 std::vector<float> TestMls::callFitSphere(const std::vector<Splat> &splats)
 {
     std::vector<float> ans(5);
-    cl::Buffer in(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(Splat) * splats.size(), (void *) &splats[0]);
+    cl::Buffer in = CLH::Test::createSplatBuffer(context, CL_MEM_READ_ONLY, splats);
     cl::Buffer out(context, CL_MEM_WRITE_ONLY, 5 * sizeof(cl_float));
     cl::Kernel kernel(mlsProgram, "testFitSphere");
     kernel.setArg(0, out);
@@ -434,7 +437,7 @@ void TestMls::testProcessCorners()
     Grid::size_type imageWidth = roundUp(sizeX, generator.alignment()[0]);
     Grid::size_type imageHeight = roundUp(sizeY, generator.alignment()[1]);
     Grid::size_type imageDepth = roundUp(sizeZ, generator.alignment()[2]);
-    swathe.zFirst = MlsFunctor::wgs[2];
+    swathe.zFirst = MlsFunctor::maxWgs[2];
     swathe.zLast = 26;
     swathe.zStride = imageHeight + 10;
     swathe.zBias = (2 - cl_int(swathe.zFirst)) * cl_int(swathe.zStride);
@@ -472,8 +475,7 @@ void TestMls::testProcessCorners()
     hCommands.push_back(N - 1);
     hCommands.push_back(-1);
 
-    cl::Buffer dSplats(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                       N * sizeof(Splat), &hSplats[0]);
+    cl::Buffer dSplats = CLH::Test::createSplatBuffer(context, CL_MEM_READ_ONLY, hSplats);
     cl::Buffer dStart(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
                       hStart.size() * sizeof(SplatTreeCL::command_type), &hStart[0]);
     cl::Buffer dCommands(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
@@ -482,33 +484,43 @@ void TestMls::testProcessCorners()
     cl::Image2D dCorners = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT),
                                        imageWidth, imageDepth * swathe.zStride + swathe.zBias);
 
-    generator.set(offset, dSplats, dCommands, dStart, subsampling);
-    generator.enqueue(queue, dCorners, swathe, NULL, NULL);
-    queue.finish();
+    generator.set(offset, dSplats, hSplats.size(), dCommands, dStart, 0, subsampling);
 
-    // Read back and verify results
-    for (Grid::size_type z = swathe.zFirst; z <= swathe.zLast; z++)
+    /* Run twice, forcing the exact-sized launch on the first pass and the
+     * persistent-threads launch on the second (see
+     * MlsFunctor::persistentGroups), so that both kernels are verified
+     * against the same reference.
+     */
+    for (int pass = 0; pass < 2; pass++)
     {
-        cl_float hCorners[sizeY][sizeX];
-        cl::size_t<3> origin, region;
-        origin[0] = 0; origin[1] = z * swathe.zStride + swathe.zBias; origin[2] = 0;
-        region[0] = swathe.width; region[1] = swathe.height; region[2] = 1;
-        queue.enqueueReadImage(dCorners, CL_TRUE, origin, region, 0, 0, &hCorners[0][0]);
-
-        for (unsigned int y = 0; y < swathe.height; y++)
-            for (unsigned int x = 0; x < swathe.width; x++)
-            {
-                float cx = x + offset[0];
-                float cy = y + offset[1];
-                float cz = z + offset[2];
-                float expected = sqrt(sqr(cx - center[0]) + sqr(cy - center[1]) + sqr(cz - center[2]))
-                    - radius;
-                if ((z >> subsampling) == 1 && (y >> subsampling) == 1)
-                    expected = std::numeric_limits<float>::quiet_NaN(); // the special cases in hStart
-                if (fabs(expected) > std::sqrt(3.0f))
-                    expected = std::numeric_limits<float>::quiet_NaN(); // divergence test
-                float actual = hCorners[y][x];
-                MLSGPU_ASSERT_DOUBLES_EQUAL(expected, actual, 1e-5);
-            }
+        generator.persistentGroups = (pass == 0) ? 1 : (std::size_t(1) << 16);
+        generator.enqueue(queue, dCorners, swathe, NULL, NULL);
+        queue.finish();
+
+        // Read back and verify results
+        for (Grid::size_type z = swathe.zFirst; z <= swathe.zLast; z++)
+        {
+            cl_float hCorners[sizeY][sizeX];
+            cl::size_t<3> origin, region;
+            origin[0] = 0; origin[1] = z * swathe.zStride + swathe.zBias; origin[2] = 0;
+            region[0] = swathe.width; region[1] = swathe.height; region[2] = 1;
+            queue.enqueueReadImage(dCorners, CL_TRUE, origin, region, 0, 0, &hCorners[0][0]);
+
+            for (unsigned int y = 0; y < swathe.height; y++)
+                for (unsigned int x = 0; x < swathe.width; x++)
+                {
+                    float cx = x + offset[0];
+                    float cy = y + offset[1];
+                    float cz = z + offset[2];
+                    float expected = sqrt(sqr(cx - center[0]) + sqr(cy - center[1]) + sqr(cz - center[2]))
+                        - radius;
+                    if ((z >> subsampling) == 1 && (y >> subsampling) == 1)
+                        expected = std::numeric_limits<float>::quiet_NaN(); // the special cases in hStart
+                    if (fabs(expected) > std::sqrt(3.0f))
+                        expected = std::numeric_limits<float>::quiet_NaN(); // divergence test
+                    float actual = hCorners[y][x];
+                    MLSGPU_ASSERT_DOUBLES_EQUAL(expected, actual, 1e-5);
+                }
+        }
     }
 }
@@ -0,0 +1,201 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for @ref NormalsCL.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/tr1/cmath.hpp>
+#include "testutil.h"
+#include "test_clh.h"
+#include "../src/normals_cl.h"
+#include "../src/splat_tree_cl.h"
+#include "../src/clh.h"
+#include "../src/grid.h"
+#include "../src/splat.h"
+
+using namespace std;
+
+/// Tests for @ref NormalsCL
+class TestNormalsCL : public CLH::Test::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestNormalsCL);
+    CPPUNIT_TEST(testSmallestEigenvector);
+    CPPUNIT_TEST(testPlane);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    cl::Program normalsProgram;  ///< Program compiled from @ref normals.cl.
+
+    /// Wrapper around the @c testSmallestEigenvector test kernel
+    void callSmallestEigenvector(
+        float out[3],
+        float cxx, float cxy, float cxz, float cyy, float cyz, float czz);
+
+    void testSmallestEigenvector(); ///< Test the eigenvector computation on known matrices.
+    void testPlane();               ///< Run the full prepare/build/estimate protocol on a planar cloud.
+
+public:
+    virtual void setUp();
+    virtual void tearDown();
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestNormalsCL, TestSet::perCommit());
+
+void TestNormalsCL::setUp()
+{
+    CLH::Test::TestFixture::setUp();
+    map<string, string> defines;
+    defines["UNIT_TESTS"] = "1";
+    normalsProgram = CLH::build(context, "kernels/normals.cl", defines);
+}
+
+void TestNormalsCL::tearDown()
+{
+    normalsProgram = NULL;
+    CLH::Test::TestFixture::tearDown();
+}
+
+void TestNormalsCL::callSmallestEigenvector(
+    float out[3],
+    float cxx, float cxy, float cxz, float cyy, float cyz, float czz)
+{
+    cl::Buffer outBuffer(context, CL_MEM_WRITE_ONLY, 3 * sizeof(cl_float));
+    cl::Kernel kernel(normalsProgram, "testSmallestEigenvector");
+    kernel.setArg(0, outBuffer);
+    kernel.setArg(1, cxx);
+    kernel.setArg(2, cxy);
+    kernel.setArg(3, cxz);
+    kernel.setArg(4, cyy);
+    kernel.setArg(5, cyz);
+    kernel.setArg(6, czz);
+    queue.enqueueTask(kernel);
+    queue.enqueueReadBuffer(outBuffer, CL_TRUE, 0, 3 * sizeof(cl_float), out);
+}
+
+void TestNormalsCL::testSmallestEigenvector()
+{
+    float v[3];
+
+    // Diagonal matrix: eigenvector of the smallest diagonal entry
+    callSmallestEigenvector(v, 4.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.25f);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, v[0], 1e-4);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, v[1], 1e-4);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, std::abs(double(v[2])), 1e-4);
+
+    /* I - nn^T for n = (1,1,1)/sqrt(3): eigenvalues are 0 (along n) and 1
+     * (twice), so the smallest eigenvector is n up to sign.
+     */
+    const float third = 1.0f / 3.0f;
+    callSmallestEigenvector(v, 2.0f * third, -third, -third, 2.0f * third, -third, 2.0f * third);
+    const double invSqrt3 = 1.0 / std::sqrt(3.0);
+    if (v[0] < 0.0f)
+        for (unsigned int i = 0; i < 3; i++)
+            v[i] = -v[i];
+    for (unsigned int i = 0; i < 3; i++)
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(invSqrt3, v[i], 1e-4);
+
+    // Isotropic neighbourhood: no unique answer, but must still be finite
+    callSmallestEigenvector(v, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f);
+    double len = 0.0;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        CPPUNIT_ASSERT((std::tr1::isfinite)(v[i]));
+        len += double(v[i]) * v[i];
+    }
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, len, 1e-4);
+}
+
+void TestNormalsCL::testPlane()
+{
+    /* A regular grid of splats on the plane z = 2.5, with only positions
+     * valid. After the full protocol every splat must have recovered a +z
+     * normal (oriented towards the overhead viewpoint): the neighbourhoods
+     * are exactly coplanar, so the fit has no approximation error, even at
+     * the edges of the cloud.
+     */
+    const Grid::size_type side = 8;
+    const std::size_t numSplats = side * side;
+    const float searchRadius = 2.0f;
+
+    std::vector<Splat> splats(numSplats);
+    for (Grid::size_type y = 0; y < side; y++)
+        for (Grid::size_type x = 0; x < side; x++)
+        {
+            Splat &s = splats[y * side + x];
+            s.position[0] = x + 0.5f;
+            s.position[1] = y + 0.5f;
+            s.position[2] = 2.5f;
+            // Garbage that the stage must overwrite
+            s.radius = -100.0f;
+            s.normal[0] = 100.0f;
+            s.normal[1] = -100.0f;
+            s.normal[2] = 0.0f;
+            s.quality = -1.0f;
+        }
+
+    cl::Buffer splatsBuffer = CLH::Test::createSplatBuffer(context, CL_MEM_READ_WRITE, splats);
+
+    NormalsCL normals(context, device);
+    normals.enqueuePrepare(queue, splatsBuffer, numSplats, 0, numSplats, searchRadius);
+
+    const Grid::size_type size[3] = { side, side, side };
+    const Grid::difference_type offset[3] = { 0, 0, 0 };
+    SplatTreeCL tree(context, device, 4, numSplats);
+    tree.enqueueBuild(queue, splatsBuffer, numSplats, 0, numSplats, size, offset, 0);
+
+    const float viewpoint[3] = { 4.0f, 4.0f, 100.0f };
+    normals.enqueueEstimate(queue, splatsBuffer, tree, 0, 0, numSplats,
+                            offset, 0, viewpoint, 1.0f);
+
+    CLH::Test::readSplatBuffer(queue, splatsBuffer, splats);
+    for (std::size_t i = 0; i < numSplats; i++)
+    {
+        const Splat &s = splats[i];
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, s.normal[0], 1e-3);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.0, s.normal[1], 1e-3);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, s.normal[2], 1e-3);
+        /* The radius field now holds the inverse squared radius; the radius
+         * itself must be positive and no more than the search radius, and
+         * for the interior (9 neighbours at unit spacing) close to
+         * 2.sqrt(pi/9) ~ 1.18.
+         */
+        CPPUNIT_ASSERT(s.radius >= 1.0f / (searchRadius * searchRadius));
+        const float radius = 1.0f / std::sqrt(s.radius);
+        CPPUNIT_ASSERT(radius > 0.5f && radius <= searchRadius);
+        CPPUNIT_ASSERT_EQUAL(s.radius, s.quality);
+    }
+}
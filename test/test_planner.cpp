@@ -0,0 +1,161 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref planner.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/ref.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "testutil.h"
+#include "../src/planner.h"
+#include "../src/bucket_collector.h"
+#include "../src/splat_set.h"
+
+/// Tests for @ref Planner::Sampler and @ref Planner::report
+class TestPlanner : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestPlanner);
+    CPPUNIT_TEST(testSampleFraction);
+    CPPUNIT_TEST(testSampleAll);
+    CPPUNIT_TEST(testReport);
+    CPPUNIT_TEST(testReportEmpty);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /// Downstream functor that records the bins it receives
+    struct Output
+    {
+        typedef void result_type;
+
+        std::vector<BucketCollector::Bin> bins;
+
+        void operator()(const Statistics::Container::vector<BucketCollector::Bin> &batch)
+        {
+            bins.insert(bins.end(), batch.begin(), batch.end());
+        }
+    };
+
+    /**
+     * Feed @a numBins bins of @a binSplats splats each through @a sampler,
+     * in batches of @a batchSize.
+     */
+    static void feed(Planner::Sampler &sampler,
+                     std::size_t numBins, std::size_t batchSize,
+                     SplatSet::splat_id binSplats);
+
+public:
+    void testSampleFraction();   ///< Error diffusion keeps the right share of bins
+    void testSampleAll();        ///< A fraction of 1 keeps every bin
+    void testReport();           ///< Report names the bottleneck stage
+    void testReportEmpty();      ///< Report handles an empty sample gracefully
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestPlanner, TestSet::perBuild());
+
+void TestPlanner::feed(
+    Planner::Sampler &sampler,
+    std::size_t numBins, std::size_t batchSize,
+    SplatSet::splat_id binSplats)
+{
+    std::size_t made = 0;
+    while (made < numBins)
+    {
+        Statistics::Container::vector<BucketCollector::Bin> batch("mem.test.batch");
+        for (std::size_t i = 0; i < batchSize && made < numBins; i++, made++)
+        {
+            batch.push_back(BucketCollector::Bin());
+            batch.back().ranges.addRange(
+                made * binSplats, (made + 1) * binSplats);
+            batch.back().ranges.flush();
+        }
+        sampler(batch);
+    }
+}
+
+void TestPlanner::testSampleFraction()
+{
+    Output output;
+    Planner::Sampler sampler(boost::ref(output), 0.25);
+    feed(sampler, 100, 7, 10);
+
+    CPPUNIT_ASSERT_EQUAL(std::size_t(100), sampler.getTotalBins());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(25), sampler.getKeptBins());
+    CPPUNIT_ASSERT_EQUAL(SplatSet::splat_id(1000), sampler.getTotalSplats());
+    CPPUNIT_ASSERT_EQUAL(SplatSet::splat_id(250), sampler.getKeptSplats());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(25), output.bins.size());
+    // Error diffusion keeps every 4th bin, starting with the 4th
+    for (std::size_t i = 0; i < output.bins.size(); i++)
+    {
+        const SplatSet::splat_id first = output.bins[i].ranges.begin()->first;
+        CPPUNIT_ASSERT_EQUAL(SplatSet::splat_id((4 * i + 3) * 10), first);
+    }
+}
+
+void TestPlanner::testSampleAll()
+{
+    Output output;
+    Planner::Sampler sampler(boost::ref(output), 1.0);
+    feed(sampler, 20, 6, 5);
+
+    CPPUNIT_ASSERT_EQUAL(std::size_t(20), sampler.getKeptBins());
+    CPPUNIT_ASSERT_EQUAL(SplatSet::splat_id(100), sampler.getKeptSplats());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(20), output.bins.size());
+}
+
+void TestPlanner::testReport()
+{
+    Output output;
+    Planner::Sampler sampler(boost::ref(output), 0.5);
+    feed(sampler, 40, 10, 100);
+
+    std::vector<Planner::Stage> stages;
+    stages.push_back(Planner::Stage("load", 1.0, 1));
+    stages.push_back(Planner::Stage("device", 8.0, 4, "device-threads", 2));
+    stages.push_back(Planner::Stage("mesher", 0.5, 1));
+
+    std::ostringstream o;
+    Planner::report(o, sampler, 10.0, stages, 1000);
+    const std::string text = o.str();
+    CPPUNIT_ASSERT(text.find("Bottleneck stage: device.") != std::string::npos);
+    // Sampled half the splats in 10s, so the full pass should predict 20s
+    CPPUNIT_ASSERT(text.find("Predicted bucket/device pass: 20.0s") != std::string::npos);
+}
+
+void TestPlanner::testReportEmpty()
+{
+    Output output;
+    Planner::Sampler sampler(boost::ref(output), 0.5);
+
+    std::vector<Planner::Stage> stages;
+    stages.push_back(Planner::Stage("device", 0.0, 1));
+
+    std::ostringstream o;
+    Planner::report(o, sampler, 0.0, stages, 1000);
+    CPPUNIT_ASSERT(o.str().find("sample was empty") != std::string::npos);
+}
@@ -221,6 +221,63 @@ void TestSplatToBucketsClass::testIntRounding()
     MLSGPU_ASSERT_EQUAL(2, upper[2]);
 }
 
+void TestSplatToBucketsClass::testBatch()
+{
+    SplatSet::detail::SplatToBuckets s2b(4.0f, 10);
+    // Enough splats to cross the batch implementation's internal chunking
+    const std::size_t N = 150;
+    std::vector<Splat> splats;
+    for (std::size_t i = 0; i < N; i++)
+    {
+        float x = 37.0f * i - 2000.0f;
+        float y = -53.0f * i + 1500.0f;
+        float z = 11.0f * i - 800.0f;
+        float r = 0.5f * (i % 17) + 0.25f;
+        splats.push_back(makeSplat(x, y, z, r));
+    }
+
+    std::vector<boost::array<Grid::difference_type, 3> > lower(N), upper(N);
+    s2b(&splats[0], N, &lower[0], &upper[0]);
+    for (std::size_t i = 0; i < N; i++)
+    {
+        boost::array<Grid::difference_type, 3> lowerRef, upperRef;
+        s2b(splats[i], lowerRef, upperRef);
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            CPPUNIT_ASSERT_EQUAL(lowerRef[j], lower[i][j]);
+            CPPUNIT_ASSERT_EQUAL(upperRef[j], upper[i][j]);
+        }
+    }
+}
+
+void TestSplatToBucketsGrid::testMatchesChecked()
+{
+    const float ref[3] = {10.0f, -50.0f, 40.0f};
+    Grid grid(ref, 20.0f, -1, 5, 1, 100, 2, 50);
+    // grid base is at (-10, -30, 80)
+    SplatSet::detail::SplatToBucketsGrid s2b(grid, 3);
+    boost::array<Grid::difference_type, 3> lower, upper;
+    boost::array<Grid::difference_type, 3> lowerRef, upperRef;
+
+    Splat s1 = makeSplat(115.0f, -31.0f, 1090.0f, 7.0f);
+    s2b(s1, lower, upper);
+    SplatSet::detail::splatToBuckets(s1, grid, 3, lowerRef, upperRef);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(lowerRef[i], lower[i]);
+        CPPUNIT_ASSERT_EQUAL(upperRef[i], upper[i]);
+    }
+
+    Splat s2 = makeSplat(-1000.0f, -1000.0f, -1000.0f, 100.0f);
+    s2b(s2, lower, upper);
+    SplatSet::detail::splatToBuckets(s2, grid, 3, lowerRef, upperRef);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(lowerRef[i], lower[i]);
+        CPPUNIT_ASSERT_EQUAL(upperRef[i], upper[i]);
+    }
+}
+
 void TestFileSet::populate(
     SplatSet::FileSet &set,
     const std::vector<std::vector<Splat> > &splatData,
@@ -319,6 +376,139 @@ void TestFastFileSet::testProgress()
     set->computeBlobs(2.5f, 5, &nullStream, false);
 }
 
+void TestFastFileSet::testSplatCache()
+{
+    boost::scoped_ptr<Set> set(new Set);
+    TestFileSet::populate(*set, splatData, store);
+    set->setSplatCache(true);
+    set->computeBlobs(2.5f, 5, NULL, false);
+
+    // The full stream is served from the cache and must replay exactly the
+    // splats seen by computeBlobs.
+    std::vector<Splat> actual;
+    std::vector<SplatSet::splat_id> ids;
+    {
+        boost::scoped_ptr<SplatSet::SplatStream> stream(set->makeSplatStream());
+        const std::size_t count = 5;
+        Splat buffer[count];
+        SplatSet::splat_id bufferIds[count];
+        std::size_t n;
+        while ((n = stream->read(buffer, bufferIds, count)) != 0)
+        {
+            for (std::size_t i = 0; i < n; i++)
+            {
+                actual.push_back(buffer[i]);
+                ids.push_back(bufferIds[i]);
+            }
+        }
+        MLSGPU_ASSERT_EQUAL(0, stream->read(buffer, bufferIds, count));
+    }
+    validateSplats(flatSplats, actual, ids);
+
+    // A ranged stream must serve the matching subsequence from the cache
+    typedef std::pair<SplatSet::splat_id, SplatSet::splat_id> Range;
+    std::vector<Range> ranges;
+    ranges.push_back(Range(ids[1], ids[ids.size() / 2]));
+    ranges.push_back(Range(ids[ids.size() / 2] + 1, ids.back() + 1));
+
+    std::vector<Splat> expected;
+    std::vector<SplatSet::splat_id> expectedIds;
+    for (std::size_t r = 0; r < ranges.size(); r++)
+        for (std::size_t i = 0; i < ids.size(); i++)
+            if (ids[i] >= ranges[r].first && ids[i] < ranges[r].second)
+            {
+                expected.push_back(actual[i]);
+                expectedIds.push_back(ids[i]);
+            }
+
+    std::vector<Splat> actualSub;
+    std::vector<SplatSet::splat_id> actualSubIds;
+    {
+        boost::scoped_ptr<SplatSet::SplatStream> stream(
+            set->makeSplatStream(ranges.begin(), ranges.end()));
+        Splat splat;
+        SplatSet::splat_id id;
+        while (stream->read(&splat, &id, 1) != 0)
+        {
+            actualSub.push_back(splat);
+            actualSubIds.push_back(id);
+        }
+    }
+    CPPUNIT_ASSERT_EQUAL(expected.size(), actualSub.size());
+    for (std::size_t i = 0; i < expected.size(); i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(expectedIds[i], actualSubIds[i]);
+        CPPUNIT_ASSERT_EQUAL(expected[i].position[0], actualSub[i].position[0]);
+        CPPUNIT_ASSERT_EQUAL(expected[i].position[1], actualSub[i].position[1]);
+        CPPUNIT_ASSERT_EQUAL(expected[i].position[2], actualSub[i].position[2]);
+        CPPUNIT_ASSERT_EQUAL(expected[i].radius, actualSub[i].radius);
+    }
+}
+
+void TestFastFileSet::testComputeThreads()
+{
+    // Serial reference for the aggregated outputs
+    std::vector<std::string> refStore;
+    boost::scoped_ptr<Set> ref(new Set);
+    TestFileSet::populate(*ref, splatData, refStore);
+    ref->computeBlobs(2.5f, 5, NULL, false);
+
+    boost::scoped_ptr<Set> set(new Set);
+    TestFileSet::populate(*set, splatData, store);
+    set->setComputeThreads(3);
+    set->setSplatCache(true);
+    set->computeBlobs(2.5f, 5, NULL, false);
+
+    // The merged splat count and bounding grid must match the serial pass
+    CPPUNIT_ASSERT_EQUAL(ref->numSplats(), set->numSplats());
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(ref->getBoundingGrid().getExtent(i).first,
+                             set->getBoundingGrid().getExtent(i).first);
+        CPPUNIT_ASSERT_EQUAL(ref->getBoundingGrid().getExtent(i).second,
+                             set->getBoundingGrid().getExtent(i).second);
+    }
+
+    // The stitched splat cache must replay the input in splat ID order
+    std::vector<Splat> actual;
+    std::vector<SplatSet::splat_id> ids;
+    {
+        boost::scoped_ptr<SplatSet::SplatStream> stream(set->makeSplatStream());
+        const std::size_t count = 5;
+        Splat buffer[count];
+        SplatSet::splat_id bufferIds[count];
+        std::size_t n;
+        while ((n = stream->read(buffer, bufferIds, count)) != 0)
+        {
+            for (std::size_t i = 0; i < n; i++)
+            {
+                actual.push_back(buffer[i]);
+                ids.push_back(bufferIds[i]);
+            }
+        }
+    }
+    validateSplats(flatSplats, actual, ids);
+
+    /* The per-stream blob files will not split blobs at the same points as
+     * a serial pass, but together they must cover every finite splat exactly
+     * once and in increasing ID order.
+     */
+    SplatSet::splat_id covered = 0;
+    SplatSet::splat_id prevLast = 0;
+    boost::scoped_ptr<SplatSet::BlobStream> blobs(
+        set->makeBlobStream(set->getBoundingGrid(), 5));
+    while (!blobs->empty())
+    {
+        SplatSet::BlobInfo blob = **blobs;
+        CPPUNIT_ASSERT(blob.firstSplat >= prevLast);
+        CPPUNIT_ASSERT(blob.firstSplat < blob.lastSplat);
+        covered += blob.lastSplat - blob.firstSplat;
+        prevLast = blob.lastSplat;
+        ++*blobs;
+    }
+    CPPUNIT_ASSERT_EQUAL(set->numSplats(), covered);
+}
+
 SplatSet::FastBlobSet<SplatSet::SequenceSet<const Splat *> > *TestFastSequenceSet::setFactory(
     const std::vector<std::vector<Splat> > &splatData,
     float spacing, Grid::size_type bucketSize)
@@ -369,6 +559,50 @@ TestSubset::setFactory(const std::vector<std::vector<Splat> > &splatData,
     return set.release();
 }
 
+void TestSubsetBase::testEncode()
+{
+    /* Exercises one-byte varints, multi-byte varints, gaps and lengths
+     * beyond 32 bits, and coalescing of abutting ranges.
+     */
+    const SplatSet::splat_id ranges[][2] =
+    {
+        { 0, 1 },
+        { 2, 100 },
+        { 100, 200 },                                   // coalesces with previous
+        { 1000000, 2000000 },
+        { UINT64_C(0x123456789A), UINT64_C(0x3456789ABC) }
+    };
+    const SplatSet::splat_id expected[][2] =
+    {
+        { 0, 1 },
+        { 2, 200 },
+        { 1000000, 2000000 },
+        { UINT64_C(0x123456789A), UINT64_C(0x3456789ABC) }
+    };
+    const std::size_t numExpected = sizeof(expected) / sizeof(expected[0]);
+
+    SplatSet::SubsetBase subset;
+    SplatSet::splat_id nSplats = 0;
+    for (std::size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++)
+    {
+        subset.addRange(ranges[i][0], ranges[i][1]);
+        nSplats += ranges[i][1] - ranges[i][0];
+    }
+    subset.flush();
+
+    CPPUNIT_ASSERT_EQUAL(numExpected, subset.numRanges());
+    CPPUNIT_ASSERT_EQUAL(nSplats, subset.numSplats());
+    std::size_t pos = 0;
+    for (SplatSet::SubsetBase::const_iterator i = subset.begin(); i != subset.end(); ++i)
+    {
+        CPPUNIT_ASSERT(pos < numExpected);
+        CPPUNIT_ASSERT_EQUAL(expected[pos][0], i->first);
+        CPPUNIT_ASSERT_EQUAL(expected[pos][1], i->second);
+        pos++;
+    }
+    CPPUNIT_ASSERT_EQUAL(numExpected, pos);
+}
+
 void TestMerge::testMergeHelper(
     std::size_t numA,
     const SplatSet::splat_id rangesA[][2],
@@ -31,6 +31,7 @@
 # include <config.h>
 #endif
 #include <vector>
+#include <limits>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include "../src/splat.h"
 #include "../src/splat_set.h"
@@ -61,6 +62,35 @@ public:
         return total;
     }
 
+    /**
+     * Partitions the range of splats into roughly equal-sized subranges.
+     * @see @ref SplatSet::FileSet::partition.
+     */
+    std::pair<splat_id, splat_id> partition(int rank, int size) const
+    {
+        splat_id pos[2] =
+        {
+            mulDiv(maxSplats(), rank, size),
+            mulDiv(maxSplats(), rank + 1, size)
+        };
+
+        splat_id ans[2];
+        for (int i = 0; i < 2; i++)
+        {
+            std::size_t curFile = 0;
+            while (curFile < this->size() && pos[i] > at(curFile).size())
+            {
+                pos[i] -= at(curFile).size();
+                curFile++;
+            }
+            if (curFile >= this->size())
+                ans[i] = std::numeric_limits<splat_id>::max();
+            else
+                ans[i] = (splat_id(curFile) << scanIdShift) + pos[i];
+        }
+        return std::make_pair(ans[0], ans[1]);
+    }
+
     SplatStream *makeSplatStream(bool useOMP = true) const
     {
         return makeSplatStream(&detail::rangeAll, &detail::rangeAll + 1, useOMP);
@@ -71,6 +101,12 @@ public:
         return new SimpleBlobStream(makeSplatStream(), grid, bucketSize);
     }
 
+    /**
+     * Return a fingerprint for keying persistent caches. In-memory sets
+     * cannot be fingerprinted, so this returns the empty string.
+     */
+    std::string fingerprint() const { return std::string(); }
+
     template<typename RangeIterator>
     SplatStream *makeSplatStream(RangeIterator firstRange, RangeIterator lastRange, bool useOMP = false) const
     {
@@ -220,12 +256,26 @@ class TestSplatToBucketsClass : public CppUnit::TestFixture
     CPPUNIT_TEST(testSimple);
     CPPUNIT_TEST(testFloatRounding);
     CPPUNIT_TEST(testIntRounding);
+    CPPUNIT_TEST(testBatch);
     CPPUNIT_TEST_SUITE_END();
 
 public:
     void testSimple();          ///< Test case that tests a bit of everything
     void testFloatRounding();   ///< Test the rounding on the float operations
     void testIntRounding();     ///< Test the rounding on the integer division
+    void testBatch();           ///< Test that the batch overload matches the single-splat one
+};
+
+/// Tests for @ref SplatSet::detail::SplatToBucketsGrid (the grid-aligned fast path)
+class TestSplatToBucketsGrid : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestSplatToBucketsGrid);
+    CPPUNIT_TEST(testMatchesChecked);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    /// Test that it matches @ref SplatSet::detail::splatToBuckets on legal splats
+    void testMatchesChecked();
 };
 
 /// Base class for testing models of @ref SplatSet::SetConcept.
@@ -275,6 +325,14 @@ protected:
     std::vector<std::vector<Splat> > splatData;
     Grid grid;                     ///< Grid for hitting the fast path
 
+    /**
+     * Check that retrieved splats match what is expected.  The @a splatIds can
+     * have any values provided that they're strictly increasing.
+     */
+    void validateSplats(const std::vector<Splat> &expected,
+                        const std::vector<Splat> &actual,
+                        const std::vector<SplatSet::splat_id> &ids);
+
 private:
     /// Captures the parameters given to the function object
     struct Entry
@@ -286,14 +344,6 @@ private:
         boost::array<Grid::difference_type, 3> upper;
     };
 
-    /**
-     * Check that retrieved splats match what is expected.  The @a splatIds can
-     * have any values provided that they're strictly increasing.
-     */
-    void validateSplats(const std::vector<Splat> &expected,
-                        const std::vector<Splat> &actual,
-                        const std::vector<SplatSet::splat_id> &ids);
-
     /// Check that retrieved blobs match what is expected
     void validateBlobs(const std::vector<Splat> &expected,
                        const std::vector<SplatSet::BlobInfo> &actual,
@@ -378,12 +428,14 @@ class TestFastBlobSet : public TestSplatSubsettable<SplatSet::FastBlobSet<BaseTy
     CPPUNIT_TEST_SUB_SUITE(TestFastBlobSet<BaseType>, BaseFixture);
     CPPUNIT_TEST(testBoundingGrid);
     CPPUNIT_TEST(testAddBlob);
+    CPPUNIT_TEST(testBlobCache);
     CPPUNIT_TEST_SUITE_END_ABSTRACT();
 public:
     typedef typename BaseFixture::Set Set;
 
     void testBoundingGrid();         ///< Tests that the extracted bounding box is correct
     void testAddBlob();              ///< Tests the encoding of blobs
+    void testBlobCache();            ///< Tests saving and reloading the persistent blob cache
 };
 
 /// Tests for @ref SplatSet::FastBlobSet<SplatSet::SequenceSet<const Splat *> >.
@@ -399,6 +451,17 @@ protected:
                             float spacing, Grid::size_type bucketSize);
 };
 
+/// Tests for @ref SplatSet::SubsetBase
+class TestSubsetBase : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestSubsetBase);
+    CPPUNIT_TEST(testEncode);
+    CPPUNIT_TEST_SUITE_END();
+public:
+    /// Test round-tripping of ranges through the encoded representation
+    void testEncode();
+};
+
 /// Tests for @ref SplatSet::merge
 class TestMerge : public CppUnit::TestFixture
 {
@@ -469,6 +532,8 @@ class TestFastFileSet : public TestFastBlobSet<SplatSet::FileSet>
     CPPUNIT_TEST(testEmpty);
 #endif
     CPPUNIT_TEST(testProgress);
+    CPPUNIT_TEST(testSplatCache);
+    CPPUNIT_TEST(testComputeThreads);
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -480,6 +545,8 @@ protected:
 public:
     void testEmpty();            ///< Test error checking for an empty set
     void testProgress();         ///< Run with a progress stream (does not check output)
+    void testSplatCache();       ///< Test that streams replayed from the splat cache match the input
+    void testComputeThreads();   ///< Test computing the blobs with several concurrent streams
 };
 
 template<typename SetType>
@@ -878,6 +945,101 @@ void TestFastBlobSet<BaseType>::testAddBlob()
     CPPUNIT_ASSERT(blob == curBlob);
     ++*stream;
     CPPUNIT_ASSERT(stream->empty());
+
+    // Check the same records through the block-compressed encoding
+    if (SplatSet::detail::blobCompressionSupported())
+    {
+        Set cset;
+        cset.blobFiles.push_back(typename SplatSet::FastBlobSet<BaseType>::BlobFile());
+        {
+            Statistics::Container::PODBuffer<char> comp("mem.test.comp");
+            comp.reserve(SplatSet::detail::blobBlockBound(blobData.size()), false);
+            std::tr1::uint32_t header[2];
+            header[0] = blobData.size();
+            header[1] = SplatSet::detail::compressBlobBlock(comp.data(), &blobData[0], blobData.size());
+            boost::filesystem::ofstream out;
+            createTmpFile(cset.blobFiles[0].path, out);
+            out.exceptions(std::ios::failbit | std::ios::badbit);
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(comp.data(), header[1]);
+        }
+        cset.blobFiles[0].nBlobs = 2;
+        cset.blobFiles[0].compressed = true;
+        cset.internalBucketSize = 1;
+
+        stream.reset(cset.makeBlobStream(cset.boundingGrid, cset.internalBucketSize));
+        CPPUNIT_ASSERT(!stream->empty());
+        blob = **stream;
+        CPPUNIT_ASSERT(blob == prevBlob);
+        ++*stream;
+        CPPUNIT_ASSERT(!stream->empty());
+        blob = **stream;
+        CPPUNIT_ASSERT(blob == curBlob);
+        ++*stream;
+        CPPUNIT_ASSERT(stream->empty());
+    }
+}
+
+template<typename BaseType>
+void TestFastBlobSet<BaseType>::testBlobCache()
+{
+    const float spacing = 2.5f;
+    const Grid::size_type bucketSize = 5;
+    const std::string key = "mlsgpu blob cache test key";
+
+    // Use the temporary file directory to hold the cache entry
+    boost::filesystem::path tmpFile;
+    {
+        boost::filesystem::ofstream dummy;
+        createTmpFile(tmpFile, dummy);
+    }
+    const boost::filesystem::path cacheDir = tmpFile.parent_path();
+    const std::string hash = SplatSet::detail::blobCacheHash(key);
+
+    boost::scoped_ptr<Set> set(this->setFactory(this->splatData, spacing, bucketSize));
+    set->blobCacheDir = cacheDir;
+    set->saveBlobCache(key);
+
+    Set reload;
+    reload.blobCacheDir = cacheDir;
+    reload.internalBucketSize = bucketSize;
+    CPPUNIT_ASSERT(reload.loadBlobCache(key, spacing));
+    CPPUNIT_ASSERT_EQUAL(set->numSplats(), reload.numSplats());
+    CPPUNIT_ASSERT_EQUAL(spacing, reload.getBoundingGrid().getSpacing());
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(set->getBoundingGrid().getExtent(i).first,
+                             reload.getBoundingGrid().getExtent(i).first);
+        CPPUNIT_ASSERT_EQUAL(set->getBoundingGrid().getExtent(i).second,
+                             reload.getBoundingGrid().getExtent(i).second);
+    }
+
+    // The reloaded blob stream must replay the original exactly
+    boost::scoped_ptr<SplatSet::BlobStream> expected(
+        set->makeBlobStream(set->getBoundingGrid(), bucketSize));
+    boost::scoped_ptr<SplatSet::BlobStream> actual(
+        reload.makeBlobStream(reload.getBoundingGrid(), bucketSize));
+    while (!expected->empty())
+    {
+        CPPUNIT_ASSERT(!actual->empty());
+        SplatSet::BlobInfo e = **expected;
+        SplatSet::BlobInfo a = **actual;
+        CPPUNIT_ASSERT(e == a);
+        ++*expected;
+        ++*actual;
+    }
+    CPPUNIT_ASSERT(actual->empty());
+
+    // A non-matching key must miss
+    Set miss;
+    miss.blobCacheDir = cacheDir;
+    miss.internalBucketSize = bucketSize;
+    CPPUNIT_ASSERT(!miss.loadBlobCache(key + " stale", spacing));
+
+    boost::system::error_code ec;
+    remove(cacheDir / (hash + ".meta"), ec);
+    remove(cacheDir / (hash + ".blobs"), ec);
+    remove(tmpFile, ec);
 }
 
 #endif /* !TEST_SPLAT_SET_H */
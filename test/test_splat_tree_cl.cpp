@@ -36,6 +36,7 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <cstddef>
 #include <vector>
+#include <set>
 #include <cmath>
 #include "testutil.h"
 #include "test_clh.h"
@@ -51,6 +52,7 @@ class TestSplatTreeCL : public TestSplatTree, public CLH::Test::Mixin
     CPPUNIT_TEST(testLevelShift);
     CPPUNIT_TEST(testPointBoxDist2);
     CPPUNIT_TEST(testMakeCode);
+    CPPUNIT_TEST(testBatch);
     CPPUNIT_TEST_SUITE_END();
 
 protected:
@@ -72,6 +74,7 @@ private:
     void testLevelShift();     ///< Test @ref levelShift in @ref octree.cl.
     void testPointBoxDist2();  ///< Test @ref pointBoxDist2 in @ref octree.cl.
     void testMakeCode();       ///< Test @ref makeCode in @ref octree.cl.
+    void testBatch();          ///< Test building a batch of octrees in one pass.
 public:
     virtual void setUp();
     virtual void tearDown();
@@ -107,9 +110,8 @@ void TestSplatTreeCL::build(
 {
     SplatTreeCL tree(context, device, maxLevels, maxSplats);
     std::vector<cl::Event> events(1);
-    cl::Buffer splatBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                           splats.size() * sizeof(Splat), (void *) &splats[0]);
-    tree.enqueueBuild(queue, splatBuffer, 0, splats.size(), size, offset, subsamplingShift, NULL, &events[0]);
+    cl::Buffer splatBuffer = CLH::Test::createSplatBuffer(context, CL_MEM_READ_WRITE, splats);
+    tree.enqueueBuild(queue, splatBuffer, splats.size(), 0, splats.size(), size, offset, subsamplingShift, NULL, &events[0]);
 
     std::size_t commandsSize = tree.getCommands().getInfo<CL_MEM_SIZE>();
     std::size_t startSize = tree.getStart().getInfo<CL_MEM_SIZE>();
@@ -168,6 +170,143 @@ int TestSplatTreeCL::callMakeCode(cl_int x, cl_int y, cl_int z)
     return ans;
 }
 
+static void addSplat(vector<Splat> &splats, float x, float y, float z, float r)
+{
+    Splat s;
+    s.position[0] = x;
+    s.position[1] = y;
+    s.position[2] = z;
+    s.radius = r;
+    // Normal and quality are irrelevant - just init to avoid undefined data
+    s.normal[0] = 1.0f;
+    s.normal[1] = 0.0f;
+    s.normal[2] = 0.0f;
+    s.quality = 1.0f;
+    splats.push_back(s);
+}
+
+/**
+ * Walk the command list for one cell, returning the set of splat IDs that
+ * are visited. An empty set is returned if the cell has no chain.
+ */
+static std::set<SplatTree::command_type> walkCell(
+    const std::vector<SplatTree::command_type> &commands,
+    const std::vector<SplatTree::command_type> &start,
+    std::size_t idx)
+{
+    typedef SplatTree::command_type command_type;
+    std::set<command_type> ans;
+    CPPUNIT_ASSERT(idx < start.size());
+    command_type pos = start[idx];
+    if (pos != -1)
+    {
+        int ttl = 1000;  // prevents a loop from making the test run forever
+        while (true)
+        {
+            CPPUNIT_ASSERT(--ttl > 0);
+            CPPUNIT_ASSERT(pos >= 0 && pos < (command_type) commands.size());
+            command_type end = commands[pos++];
+            CPPUNIT_ASSERT(end > pos && end < (command_type) commands.size());
+            for (command_type i = pos; i < end; i++)
+            {
+                command_type cmd = commands[i];
+                CPPUNIT_ASSERT(cmd >= 0);
+                CPPUNIT_ASSERT(!ans.count(cmd));
+                ans.insert(cmd);
+            }
+            command_type next = commands[end];
+            CPPUNIT_ASSERT(next >= -1);
+            if (next == -1)
+                break;
+            pos = next;
+        }
+    }
+    return ans;
+}
+
+void TestSplatTreeCL::testBatch()
+{
+    typedef SplatTree::command_type command_type;
+    const int maxLevels = 5;
+    const int subsamplingShift = 0;
+    const std::size_t maxSplats = 100;
+    const Grid::size_type size[3] = {16, 16, 12};
+    const Grid::difference_type offsets[2][3] =
+    {
+        { 3, 0, 1 },
+        { -2, 4, 0 }
+    };
+
+    vector<Splat> binSplats[2];
+    addSplat(binSplats[0], 10.5f, 7.5f, 8.5f, 1.0f);
+    addSplat(binSplats[0], 11.5f, 9.5f, 5.5f, 2.0f);
+    addSplat(binSplats[0], 10.0f, 10.0f, 6.0f, 4.5f);
+    addSplat(binSplats[0], 3.0f, 0.5f, 1.0f, 0.75f);
+    addSplat(binSplats[1], 5.0f, 7.5f, 2.5f, 1.5f);
+    addSplat(binSplats[1], -1.0f, 4.5f, 0.5f, 0.25f);
+    addSplat(binSplats[1], 7.0f, 12.0f, 5.0f, 3.0f);
+
+    // Reference: build each bin on its own
+    std::size_t refLevels[2];
+    std::vector<command_type> refCommands[2], refStart[2];
+    for (int b = 0; b < 2; b++)
+        build(refLevels[b], refCommands[b], refStart[b], binSplats[b],
+              maxLevels, subsamplingShift, maxSplats, size, offsets[b]);
+
+    // Batched: both bins packed into one buffer and built together
+    vector<Splat> allSplats = binSplats[0];
+    allSplats.insert(allSplats.end(), binSplats[1].begin(), binSplats[1].end());
+    cl::Buffer splatBuffer = CLH::Test::createSplatBuffer(context, CL_MEM_READ_WRITE, allSplats);
+
+    SplatTreeCL::Bin bins[2];
+    std::size_t firstSplat = 0;
+    for (int b = 0; b < 2; b++)
+    {
+        bins[b].firstSplat = firstSplat;
+        bins[b].numSplats = binSplats[b].size();
+        for (int j = 0; j < 3; j++)
+        {
+            bins[b].size[j] = size[j];
+            bins[b].offset[j] = offsets[b][j];
+        }
+        firstSplat += binSplats[b].size();
+    }
+
+    SplatTreeCL tree(context, device, maxLevels, maxSplats, 2);
+    cl::Event event;
+    tree.enqueueBuild(queue, splatBuffer, allSplats.size(), bins, 2, subsamplingShift, NULL, &event);
+    event.wait();
+
+    std::size_t commandsSize = tree.getCommands().getInfo<CL_MEM_SIZE>();
+    std::size_t startSize = tree.getStart().getInfo<CL_MEM_SIZE>();
+    std::vector<command_type> commands(commandsSize / sizeof(command_type));
+    std::vector<command_type> start(startSize / sizeof(command_type));
+    queue.enqueueReadBuffer(tree.getCommands(), CL_TRUE, 0, commandsSize, &commands[0]);
+    queue.enqueueReadBuffer(tree.getStart(), CL_TRUE, 0, startSize, &start[0]);
+
+    /* Each bin of the batch must visit exactly the same splats per cell as
+     * the corresponding single-bin build.
+     */
+    for (int b = 0; b < 2; b++)
+    {
+        const std::size_t base = tree.getStartBase(b);
+        const command_type splatBias = (command_type) bins[b].firstSplat;
+        for (Grid::size_type z = 0; z < size[2]; z++)
+            for (Grid::size_type y = 0; y < size[1]; y++)
+                for (Grid::size_type x = 0; x < size[0]; x++)
+                {
+                    std::size_t idx = SplatTree::makeCode(x, y, z);
+                    std::set<command_type> expected = walkCell(refCommands[b], refStart[b], idx);
+                    std::set<command_type> actual = walkCell(commands, start, base + idx);
+                    // The batched build numbers splats relative to the whole buffer
+                    std::set<command_type> rebased;
+                    for (std::set<command_type>::const_iterator i = actual.begin(); i != actual.end(); ++i)
+                        rebased.insert(*i - splatBias);
+                    CPPUNIT_ASSERT(expected == rebased);
+                }
+    }
+}
+
 void TestSplatTreeCL::testLevelShift()
 {
     CPPUNIT_ASSERT_EQUAL(0, callLevelShift(0, 0, 0,  0, 0, 0)); // single cell
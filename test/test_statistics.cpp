@@ -36,6 +36,8 @@
 #include <typeinfo>
 #include <boost/foreach.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind/bind.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/serialization/scoped_ptr.hpp>
@@ -75,6 +77,8 @@ class TestVariable : public TestStatistic
     CPPUNIT_TEST(testGetStddev);
     CPPUNIT_TEST(testGetVariance);
     CPPUNIT_TEST(testGetNumSamples);
+    CPPUNIT_TEST(testPercentile);
+    CPPUNIT_TEST(testSharded);
     CPPUNIT_TEST(testStream);
     CPPUNIT_TEST(testSerialize);
     CPPUNIT_TEST_SUITE_END();
@@ -90,6 +94,8 @@ private:
     void testGetStddev();      ///< Test @ref Statistics::Variable::getStddev
     void testGetVariance();    ///< Test @ref Statistics::Variable::getVariance
     void testGetNumSamples();  ///< Test @ref Statistics::Variable::getNumSamples
+    void testPercentile();     ///< Test @ref Statistics::Variable::getPercentile
+    void testSharded();        ///< Test @ref Statistics::Variable::enableSharding
     void testStream();         ///< Test stream output of @ref Statistics::Variable
     void testSerialize();      ///< Test that serialization and deserialization works
 
@@ -233,6 +239,71 @@ void TestVariable::testGetNumSamples()
     CPPUNIT_ASSERT_EQUAL(2ULL, stat2s->getNumSamples());
 }
 
+void TestVariable::testPercentile()
+{
+    // Histograms are off by default
+    CPPUNIT_ASSERT_THROW(stat1->getPercentile(50.0), std::logic_error);
+
+    Statistics::Variable v("v");
+    v.enableHistogram();
+    CPPUNIT_ASSERT_THROW(v.getPercentile(50.0), std::length_error);
+
+    for (int i = 0; i < 50; i++)
+        v.add(1.0);
+    for (int i = 0; i < 49; i++)
+        v.add(10.0);
+    v.add(100.0);
+
+    /* The answers are the upper bounds of the buckets holding the samples:
+     * [1, 1.25) for 1.0, [10, 12) for 10.0 and [96, 112) for 100.0.
+     */
+    CPPUNIT_ASSERT_EQUAL(1.25, v.getPercentile(50.0));
+    CPPUNIT_ASSERT_EQUAL(12.0, v.getPercentile(95.0));
+    CPPUNIT_ASSERT_EQUAL(12.0, v.getPercentile(99.0));
+    CPPUNIT_ASSERT_EQUAL(112.0, v.getPercentile(100.0));
+
+    // The histogram must survive the serialization used by clone and merge
+    boost::scoped_ptr<Statistics::Statistic> copy(v.clone());
+    Statistics::Variable &c = dynamic_cast<Statistics::Variable &>(*copy);
+    CPPUNIT_ASSERT_EQUAL(12.0, c.getPercentile(95.0));
+}
+
+namespace
+{
+    /// Thread function for @ref TestVariable::testSharded
+    static void addSamples(Statistics::Variable *v, double value, int count)
+    {
+        for (int i = 0; i < count; i++)
+            v->add(value);
+    }
+} // anonymous namespace
+
+void TestVariable::testSharded()
+{
+    Statistics::Variable v("v");
+    v.enableHistogram();
+    v.enableSharding();
+
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&addSamples, &v, double(1 << i), 250));
+    threads.join_all();
+
+    // Departing threads fold their shards back into the variable
+    CPPUNIT_ASSERT_EQUAL(1000ULL, v.n);
+
+    // Samples from a live thread are only folded in when the variable is read
+    v.add(16.0);
+    CPPUNIT_ASSERT_EQUAL(1000ULL, v.n);
+    CPPUNIT_ASSERT_EQUAL(1001ULL, v.getNumSamples());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL((250.0 * (1 + 2 + 4 + 8) + 16.0) / 1001.0, v.getMean(), 1e-12);
+
+    /* The shards must feed the histogram as well. The 501st of the 1001
+     * samples is a 4.0, whose bucket [4, 5) has upper bound 5.
+     */
+    CPPUNIT_ASSERT_EQUAL(5.0, v.getPercentile(50.0));
+}
+
 void TestVariable::testStream()
 {
     {
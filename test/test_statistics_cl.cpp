@@ -0,0 +1,89 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Tests for the OpenCL-specific statistics machinery.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef __CL_ENABLE_EXCEPTIONS
+# define __CL_ENABLE_EXCEPTIONS
+#endif
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+#include <vector>
+#include "testutil.h"
+#include "test_clh.h"
+#include "../src/statistics.h"
+#include "../src/statistics_cl.h"
+
+using namespace std;
+
+/// Tests for @ref Statistics::KernelCounters
+class TestKernelCounters : public CLH::Test::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestKernelCounters);
+    CPPUNIT_TEST(testFlush);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    void testFlush();   ///< Test that flush credits the statistics and re-zeroes the buffer
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestKernelCounters, TestSet::perBuild());
+
+void TestKernelCounters::testFlush()
+{
+    vector<string> names;
+    names.push_back("test.kernelcounters.a");
+    names.push_back("test.kernelcounters.b");
+    Statistics::KernelCounters counters(context, names);
+    Statistics::Counter &statA = Statistics::getStatistic<Statistics::Counter>(names[0]);
+    Statistics::Counter &statB = Statistics::getStatistic<Statistics::Counter>(names[1]);
+    const unsigned long long baseA = statA.getTotal();
+    const unsigned long long baseB = statB.getTotal();
+
+    // The buffer must start zeroed, so an immediate flush adds nothing
+    counters.flush(queue);
+    CPPUNIT_ASSERT_EQUAL(baseA, statA.getTotal());
+    CPPUNIT_ASSERT_EQUAL(baseB, statB.getTotal());
+
+    // Simulate kernel updates by writing values directly
+    cl_uint values[2] = {3, 0};
+    queue.enqueueWriteBuffer(counters.getBuffer(), CL_TRUE, 0, sizeof(values), values);
+    counters.flush(queue);
+    CPPUNIT_ASSERT_EQUAL(baseA + 3, statA.getTotal());
+    CPPUNIT_ASSERT_EQUAL(baseB, statB.getTotal());
+
+    // The flush must have re-zeroed the buffer, so the values accumulate
+    values[0] = 2;
+    values[1] = 7;
+    queue.enqueueWriteBuffer(counters.getBuffer(), CL_TRUE, 0, sizeof(values), values);
+    counters.flush(queue);
+    counters.flush(queue); // must not double-count
+    CPPUNIT_ASSERT_EQUAL(baseA + 5, statA.getTotal());
+    CPPUNIT_ASSERT_EQUAL(baseB + 7, statB.getTotal());
+}
@@ -31,6 +31,9 @@
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <vector>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
 #include "../src/union_find.h"
 #include "testutil.h"
 
@@ -42,6 +45,9 @@ class TestUnionFind : public CppUnit::TestFixture
     CPPUNIT_TEST(testMerge);
     CPPUNIT_TEST(testFind);
     CPPUNIT_TEST(testSize);
+#if HAVE_SYNC_BUILTINS
+    CPPUNIT_TEST(testConcurrent);
+#endif
     CPPUNIT_TEST_SUITE_END();
 
 private:
@@ -68,6 +74,9 @@ public:
     void testMerge();
     void testFind();
     void testSize();
+#if HAVE_SYNC_BUILTINS
+    void testConcurrent();   ///< Stress @ref UnionFind::mergeConcurrent from several threads
+#endif
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestUnionFind, TestSet::perBuild());
 
@@ -137,6 +146,42 @@ void TestUnionFind::testFind()
     }
 }
 
+#if HAVE_SYNC_BUILTINS
+
+/// Thread function for @ref TestUnionFind::testConcurrent
+static void concurrentWorker(std::vector<UnionFind::Node<int> > &nodes, int thread, int numThreads)
+{
+    const int N = int(nodes.size());
+    /* Each thread welds an interleaved shard of the edges (i, i - 2), so the
+     * threads repeatedly race to merge the same chains of components.
+     */
+    for (int i = 2 + thread; i < N; i += numThreads)
+        UnionFind::mergeConcurrent(nodes, i, i - 2);
+}
+
+void TestUnionFind::testConcurrent()
+{
+    const int N = 100000;
+    const int numThreads = 4;
+    std::vector<UnionFind::Node<int> > big(N);
+
+    boost::thread_group threads;
+    for (int t = 0; t < numThreads; t++)
+        threads.create_thread(boost::bind(&concurrentWorker, boost::ref(big), t, numThreads));
+    threads.join_all();
+
+    // The structure is quiescent again, so the serial functions apply
+    int even = UnionFind::findRoot(big, 0);
+    int odd = UnionFind::findRoot(big, 1);
+    CPPUNIT_ASSERT(even != odd);
+    CPPUNIT_ASSERT_EQUAL(N / 2, big[even].size());
+    CPPUNIT_ASSERT_EQUAL(N / 2, big[odd].size());
+    for (int i = 0; i < N; i++)
+        CPPUNIT_ASSERT_EQUAL((i % 2) ? odd : even, UnionFind::findRoot(big, i));
+}
+
+#endif /* HAVE_SYNC_BUILTINS */
+
 void TestUnionFind::testSize()
 {
     int roots[4];
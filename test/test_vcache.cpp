@@ -0,0 +1,145 @@
+/*
+ * mlsgpu: surface reconstruction from point clouds
+ * Copyright (C) 2013  University of Cape Town
+ *
+ * This file is part of mlsgpu.
+ *
+ * mlsgpu is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Test code for @ref vcache.h.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <algorithm>
+#include <vector>
+#include "../src/tr1_cstdint.h"
+#include <boost/tr1/random.hpp>
+#include "testutil.h"
+#include "../src/vcache.h"
+
+/// Tests for @ref VCache
+class TestVCache : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(TestVCache);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testSingle);
+    CPPUNIT_TEST(testGrid);
+    CPPUNIT_TEST_SUITE_END();
+
+private:
+    /**
+     * Build a @a size x @a size grid of vertices triangulated with two
+     * triangles per cell, then shuffle the triangle order to destroy any
+     * incidental locality.
+     */
+    static void makeShuffledGrid(unsigned int size, std::vector<std::tr1::uint32_t> &indices);
+
+    /// Check that @a order is a permutation of <code>[0, n)</code>
+    static void checkPermutation(const std::vector<std::tr1::uint32_t> &order, std::size_t n);
+
+public:
+    void testEmpty();   ///< Zero triangles must be accepted
+    void testSingle();  ///< One triangle is trivially ordered
+    void testGrid();    ///< Optimizing a shuffled grid improves the miss ratio
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestVCache, TestSet::perBuild());
+
+void TestVCache::makeShuffledGrid(unsigned int size, std::vector<std::tr1::uint32_t> &indices)
+{
+    indices.clear();
+    for (unsigned int y = 0; y < size; y++)
+        for (unsigned int x = 0; x < size; x++)
+        {
+            const std::tr1::uint32_t base = y * (size + 1) + x;
+            indices.push_back(base);
+            indices.push_back(base + 1);
+            indices.push_back(base + size + 1);
+            indices.push_back(base + 1);
+            indices.push_back(base + size + 2);
+            indices.push_back(base + size + 1);
+        }
+
+    std::tr1::mt19937 engine;
+    const std::size_t numTriangles = indices.size() / 3;
+    for (std::size_t i = numTriangles - 1; i > 0; i--)
+    {
+        std::tr1::uniform_int<std::size_t> chooser(0, i);
+        const std::size_t j = chooser(engine);
+        for (int k = 0; k < 3; k++)
+            std::swap(indices[i * 3 + k], indices[j * 3 + k]);
+    }
+}
+
+void TestVCache::checkPermutation(const std::vector<std::tr1::uint32_t> &order, std::size_t n)
+{
+    std::vector<bool> seen(n, false);
+    CPPUNIT_ASSERT_EQUAL(n, order.size());
+    for (std::size_t i = 0; i < n; i++)
+    {
+        CPPUNIT_ASSERT(order[i] < n);
+        CPPUNIT_ASSERT(!seen[order[i]]);
+        seen[order[i]] = true;
+    }
+}
+
+void TestVCache::testEmpty()
+{
+    VCache::optimizeTriangleOrder(NULL, 0, NULL);
+    CPPUNIT_ASSERT_EQUAL(0.0, VCache::averageCacheMissRatio(NULL, 0, 32));
+}
+
+void TestVCache::testSingle()
+{
+    const std::tr1::uint32_t indices[3] = { 5, 7, 2 };
+    std::tr1::uint32_t order[1];
+    VCache::optimizeTriangleOrder(indices, 1, order);
+    CPPUNIT_ASSERT_EQUAL(std::tr1::uint32_t(0), order[0]);
+    CPPUNIT_ASSERT_EQUAL(3.0, VCache::averageCacheMissRatio(indices, 1, 32));
+}
+
+void TestVCache::testGrid()
+{
+    const unsigned int size = 50;
+    std::vector<std::tr1::uint32_t> indices;
+    makeShuffledGrid(size, indices);
+    const std::size_t numTriangles = indices.size() / 3;
+
+    std::vector<std::tr1::uint32_t> order(numTriangles);
+    VCache::optimizeTriangleOrder(&indices[0], numTriangles, &order[0]);
+    checkPermutation(order, numTriangles);
+
+    std::vector<std::tr1::uint32_t> optimized(indices.size());
+    for (std::size_t i = 0; i < numTriangles; i++)
+        for (int k = 0; k < 3; k++)
+            optimized[i * 3 + k] = indices[order[i] * 3 + k];
+
+    const double before = VCache::averageCacheMissRatio(&indices[0], numTriangles, 32);
+    const double after = VCache::averageCacheMissRatio(&optimized[0], numTriangles, 32);
+    /* A shuffled grid has nearly no reuse within the cache (close to 3.0);
+     * a good ordering approaches the asymptotic limit of 0.5 vertices per
+     * triangle for a regular grid. Require a comfortable margin under both
+     * the shuffled order and the threshold at which optimizing is
+     * worthwhile at all.
+     */
+    CPPUNIT_ASSERT(after < before);
+    CPPUNIT_ASSERT(after < 1.0);
+}
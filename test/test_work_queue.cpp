@@ -39,8 +39,12 @@
 #include <boost/bind.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/smart_ptr/scoped_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include "testutil.h"
 #include "../src/work_queue.h"
+#include "../src/cancel.h"
+#include "../src/statistics.h"
+#include "../src/timeplot.h"
 
 using namespace std;
 
@@ -49,30 +53,93 @@ class TestWorkQueue : public CppUnit::TestFixture
 {
     CPPUNIT_TEST_SUITE(TestWorkQueue);
     CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testUrgent);
+    CPPUNIT_TEST(testBatch);
     CPPUNIT_TEST(testStress);
+    CPPUNIT_TEST(testBatchStress);
+    CPPUNIT_TEST(testWaitStats);
+    CPPUNIT_TEST(testCancel);
     CPPUNIT_TEST_SUITE_END();
-private:
+protected:
     /**
      * Adds a sequence of consecutive integers to the work queue.
      */
-    static void producerThread(WorkQueue<int> &queue, int start, int count);
+    template<typename Queue>
+    static void producerThread(Queue &queue, int start, int count);
 
     /**
      * Pulls integers from a work queue and appends them to a vector. The
      * vector is locked while adding to it. A negative value in the queue is
      * used to signal shutdown.
      */
-    static void consumerThread(WorkQueue<int> &queue, vector<int> &out, boost::mutex &mutex);
+    template<typename Queue>
+    static void consumerThread(Queue &queue, vector<int> &out, boost::mutex &mutex);
+
+    /// As @ref producerThread, but pushing via @c pushBatch in small chunks
+    template<typename Queue>
+    static void batchProducerThread(Queue &queue, int start, int count);
+
+    /// As @ref consumerThread, but draining via @c popBatch until it returns zero
+    template<typename Queue>
+    static void batchConsumerThread(Queue &queue, vector<int> &out, boost::mutex &mutex);
+
+    /// Sleeps briefly, then pushes a single item (see @ref testWaitStats)
+    template<typename Queue>
+    static void lateProducerThread(Queue &queue);
+
+    /// Implementation of @ref testEmpty, parameterized on the queue class
+    template<typename Queue> void runEmpty();
+    /// Implementation of @ref testUrgent, parameterized on the queue class
+    template<typename Queue> void runUrgent();
+    /// Implementation of @ref testBatch, parameterized on the queue class
+    template<typename Queue> void runBatch();
+    /// Implementation of @ref testStress, parameterized on the queue class
+    template<typename Queue> void runStress();
+    /// Implementation of @ref testBatchStress, parameterized on the queue class
+    template<typename Queue> void runBatchStress();
+    /// Implementation of @ref testWaitStats, parameterized on the queue class
+    template<typename Queue> void runWaitStats();
+    /// Implementation of @ref testCancel, parameterized on the queue class
+    template<typename Queue> void runCancel();
 
 public:
-    void testEmpty();            ///< Test WorkQueue::empty
-    void testStress();           ///< Stress test with multiple consumers and producers
+    virtual void testEmpty();    ///< Test the @c empty member function
+    virtual void testUrgent();   ///< Test that urgent items overtake ordinary ones
+    virtual void testBatch();    ///< Test @c pushBatch and @c popBatch semantics
+    virtual void testStress();   ///< Stress test with multiple consumers and producers
+    virtual void testBatchStress(); ///< As @ref testStress, but through the batch interface
+    virtual void testWaitStats(); ///< Test that blocked pops record typed wait statistics
+    virtual void testCancel();   ///< Test interaction with @ref Cancel
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestWorkQueue, TestSet::perCommit());
 
-void TestWorkQueue::testEmpty()
+/// Tests for @ref LowContentionWorkQueue
+class TestLowContentionWorkQueue : public TestWorkQueue
+{
+    CPPUNIT_TEST_SUITE(TestLowContentionWorkQueue);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testUrgent);
+    CPPUNIT_TEST(testBatch);
+    CPPUNIT_TEST(testStress);
+    CPPUNIT_TEST(testBatchStress);
+    CPPUNIT_TEST(testWaitStats);
+    CPPUNIT_TEST(testCancel);
+    CPPUNIT_TEST_SUITE_END();
+public:
+    virtual void testEmpty();
+    virtual void testUrgent();
+    virtual void testBatch();
+    virtual void testStress();
+    virtual void testBatchStress();
+    virtual void testWaitStats();
+    virtual void testCancel();
+};
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestLowContentionWorkQueue, TestSet::perCommit());
+
+template<typename Queue>
+void TestWorkQueue::runEmpty()
 {
-    WorkQueue<int> queue;
+    Queue queue;
     CPPUNIT_ASSERT(queue.empty());
     queue.push(3);
     CPPUNIT_ASSERT(!queue.empty());
@@ -84,13 +151,74 @@ void TestWorkQueue::testEmpty()
     CPPUNIT_ASSERT(queue.empty());
 }
 
-void TestWorkQueue::producerThread(WorkQueue<int> &queue, int start, int end)
+template<typename Queue>
+void TestWorkQueue::runUrgent()
+{
+    Queue queue;
+    queue.push(1);
+    queue.push(2);
+    queue.push(100, true);
+    queue.push(3);
+    queue.push(101, true);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(5), queue.size());
+
+    // Urgent items come out first, in FIFO order within each lane
+    CPPUNIT_ASSERT_EQUAL(100, queue.pop());
+    CPPUNIT_ASSERT_EQUAL(101, queue.pop());
+    CPPUNIT_ASSERT_EQUAL(1, queue.pop());
+    CPPUNIT_ASSERT_EQUAL(2, queue.pop());
+    CPPUNIT_ASSERT_EQUAL(3, queue.pop());
+    CPPUNIT_ASSERT(queue.empty());
+}
+
+template<typename Queue>
+void TestWorkQueue::runBatch()
+{
+    Queue queue;
+    vector<int> items;
+    items.push_back(1);
+    items.push_back(2);
+    items.push_back(3);
+    queue.pushBatch(items);
+    queue.push(4);
+    items.clear();
+    items.push_back(100);
+    items.push_back(101);
+    queue.pushBatch(items, true);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(6), queue.size());
+
+    /* A batch never blocks to fill up: urgent items come out first, then
+     * ordinary ones, up to the limit.
+     */
+    vector<int> out;
+    CPPUNIT_ASSERT_EQUAL(std::size_t(4), queue.popBatch(out, 4));
+    CPPUNIT_ASSERT_EQUAL(std::size_t(4), out.size());
+    CPPUNIT_ASSERT_EQUAL(100, out[0]);
+    CPPUNIT_ASSERT_EQUAL(101, out[1]);
+    CPPUNIT_ASSERT_EQUAL(1, out[2]);
+    CPPUNIT_ASSERT_EQUAL(2, out[3]);
+
+    // Appends to the output vector rather than replacing it
+    CPPUNIT_ASSERT_EQUAL(std::size_t(2), queue.popBatch(out, 10));
+    CPPUNIT_ASSERT_EQUAL(std::size_t(6), out.size());
+    CPPUNIT_ASSERT_EQUAL(3, out[4]);
+    CPPUNIT_ASSERT_EQUAL(4, out[5]);
+
+    // A stopped and drained queue yields an empty batch
+    queue.stop();
+    CPPUNIT_ASSERT_EQUAL(std::size_t(0), queue.popBatch(out, 10));
+    CPPUNIT_ASSERT_EQUAL(std::size_t(6), out.size());
+}
+
+template<typename Queue>
+void TestWorkQueue::producerThread(Queue &queue, int start, int end)
 {
     for (int i = start; i < end; i++)
         queue.push(i);
 }
 
-void TestWorkQueue::consumerThread(WorkQueue<int> &queue, vector<int> &out, boost::mutex &mutex)
+template<typename Queue>
+void TestWorkQueue::consumerThread(Queue &queue, vector<int> &out, boost::mutex &mutex)
 {
     int next;
     while ((next = queue.pop()) > 0)
@@ -100,7 +228,74 @@ void TestWorkQueue::consumerThread(WorkQueue<int> &queue, vector<int> &out, boos
     }
 }
 
-void TestWorkQueue::testStress()
+template<typename Queue>
+void TestWorkQueue::batchProducerThread(Queue &queue, int start, int end)
+{
+    const int chunk = 16;
+    vector<int> items;
+    for (int i = start; i < end; i += chunk)
+    {
+        items.clear();
+        for (int j = i; j < std::min(i + chunk, end); j++)
+            items.push_back(j);
+        queue.pushBatch(items);
+    }
+}
+
+template<typename Queue>
+void TestWorkQueue::batchConsumerThread(Queue &queue, vector<int> &out, boost::mutex &mutex)
+{
+    vector<int> items;
+    while (true)
+    {
+        items.clear();
+        if (queue.popBatch(items, 16) == 0)
+            break;
+        boost::lock_guard<boost::mutex> lock(mutex);
+        out.insert(out.end(), items.begin(), items.end());
+    }
+}
+
+template<typename Queue>
+void TestWorkQueue::runStress()
+{
+    const int numProducers = 8;
+    const int numConsumers = 8;
+    const int elements = 1000000;
+    boost::ptr_vector<boost::thread> producers;
+    boost::ptr_vector<boost::thread> consumers;
+    vector<int> out;
+    boost::mutex outMutex;
+    Queue queue;
+
+    for (int i = 0; i < numProducers; i++)
+    {
+        int start = 1 + elements * i / numProducers;
+        int end = 1 + elements * (i + 1) / numProducers;
+        producers.push_back(new boost::thread(
+                boost::bind(&TestWorkQueue::producerThread<Queue>, boost::ref(queue), start, end)));
+    }
+    for (int i = 0; i < numConsumers; i++)
+    {
+        consumers.push_back(new boost::thread(
+                boost::bind(&TestWorkQueue::consumerThread<Queue>,
+                            boost::ref(queue), boost::ref(out), boost::ref(outMutex))));
+    }
+
+    for (int i = 0; i < numProducers; i++)
+        producers[i].join();
+    queue.stop();
+    for (int i = 0; i < numConsumers; i++)
+        consumers[i].join();
+
+    CPPUNIT_ASSERT_EQUAL(elements, int(out.size()));
+    sort(out.begin(), out.end());
+    for (int i = 0; i < elements; i++)
+        CPPUNIT_ASSERT_EQUAL(i + 1, out[i]);
+}
+
+template<typename Queue>
+void TestWorkQueue::runBatchStress()
 {
     const int numProducers = 8;
     const int numConsumers = 8;
@@ -109,19 +304,19 @@ void TestWorkQueue::testStress()
     boost::ptr_vector<boost::thread> consumers;
     vector<int> out;
     boost::mutex outMutex;
-    WorkQueue<int> queue;
+    Queue queue;
 
     for (int i = 0; i < numProducers; i++)
     {
         int start = 1 + elements * i / numProducers;
         int end = 1 + elements * (i + 1) / numProducers;
         producers.push_back(new boost::thread(
-                boost::bind(&TestWorkQueue::producerThread, boost::ref(queue), start, end)));
+                boost::bind(&TestWorkQueue::batchProducerThread<Queue>, boost::ref(queue), start, end)));
     }
     for (int i = 0; i < numConsumers; i++)
     {
         consumers.push_back(new boost::thread(
-                boost::bind(&TestWorkQueue::consumerThread,
+                boost::bind(&TestWorkQueue::batchConsumerThread<Queue>,
                             boost::ref(queue), boost::ref(out), boost::ref(outMutex))));
     }
 
@@ -136,3 +331,147 @@ void TestWorkQueue::testStress()
     for (int i = 0; i < elements; i++)
         CPPUNIT_ASSERT_EQUAL(i + 1, out[i]);
 }
+
+template<typename Queue>
+void TestWorkQueue::lateProducerThread(Queue &queue)
+{
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    queue.push(2);
+}
+
+template<typename Queue>
+void TestWorkQueue::runWaitStats()
+{
+    Statistics::Variable &stat = Statistics::getStatistic<Statistics::Variable>(
+        Timeplot::waitReasonName(Timeplot::WAIT_INPUT));
+    const unsigned long long oldSamples = stat.getNumSamples();
+
+    Timeplot::Worker tworker("test.consumer");
+    Queue queue;
+
+    // A pop that does not block must not record a wait
+    queue.push(1);
+    CPPUNIT_ASSERT_EQUAL(1, queue.pop(&tworker));
+    CPPUNIT_ASSERT_EQUAL(oldSamples, stat.getNumSamples());
+
+    /* Ensure the consumer blocks by delaying the push. The sleep makes it
+     * overwhelmingly likely (though not certain) that the pop is already
+     * waiting when the item arrives; if not, the test would fail, but the
+     * race window is tiny.
+     */
+    boost::thread producer(boost::bind(&TestWorkQueue::lateProducerThread<Queue>,
+                                       boost::ref(queue)));
+    CPPUNIT_ASSERT_EQUAL(2, queue.pop(&tworker));
+    producer.join();
+    CPPUNIT_ASSERT(stat.getNumSamples() > oldSamples);
+}
+
+void TestWorkQueue::testEmpty()
+{
+    runEmpty<WorkQueue<int> >();
+}
+
+void TestWorkQueue::testUrgent()
+{
+    runUrgent<WorkQueue<int> >();
+}
+
+void TestWorkQueue::testBatch()
+{
+    runBatch<WorkQueue<int> >();
+}
+
+void TestWorkQueue::testStress()
+{
+    runStress<WorkQueue<int> >();
+}
+
+void TestWorkQueue::testBatchStress()
+{
+    runBatchStress<WorkQueue<int> >();
+}
+
+void TestWorkQueue::testWaitStats()
+{
+    runWaitStats<WorkQueue<int> >();
+}
+
+void TestLowContentionWorkQueue::testEmpty()
+{
+    runEmpty<LowContentionWorkQueue<int> >();
+}
+
+void TestLowContentionWorkQueue::testUrgent()
+{
+    runUrgent<LowContentionWorkQueue<int> >();
+}
+
+void TestLowContentionWorkQueue::testBatch()
+{
+    runBatch<LowContentionWorkQueue<int> >();
+}
+
+void TestLowContentionWorkQueue::testStress()
+{
+    runStress<LowContentionWorkQueue<int> >();
+}
+
+void TestLowContentionWorkQueue::testBatchStress()
+{
+    runBatchStress<LowContentionWorkQueue<int> >();
+}
+
+void TestLowContentionWorkQueue::testWaitStats()
+{
+    runWaitStats<LowContentionWorkQueue<int> >();
+}
+
+/// Sleeps briefly, then cancels the run (see @ref TestWorkQueue::runCancel)
+static void lateCancelThread()
+{
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    Cancel::request();
+}
+
+template<typename Queue>
+void TestWorkQueue::runCancel()
+{
+    {
+        Queue queue;
+        queue.push(1);
+        Cancel::request();
+        // The token beats the backlog, and producers are refused too
+        CPPUNIT_ASSERT_THROW(queue.pop(), cancelled);
+        CPPUNIT_ASSERT_THROW(queue.push(2), cancelled);
+        Cancel::reset();
+        CPPUNIT_ASSERT_EQUAL(1, queue.pop()); // reset restores normal service
+    }
+
+    {
+        // A blocked pop must be woken by the cancellation
+        Queue queue;
+        boost::thread thread(lateCancelThread);
+        CPPUNIT_ASSERT_THROW(queue.pop(), cancelled);
+        thread.join();
+        Cancel::reset();
+    }
+
+    {
+        // A non-cancellable queue ignores the token entirely
+        Queue queue(false);
+        queue.push(1);
+        Cancel::request();
+        CPPUNIT_ASSERT_EQUAL(1, queue.pop());
+        Cancel::reset();
+    }
+}
+
+void TestWorkQueue::testCancel()
+{
+    runCancel<WorkQueue<int> >();
+}
+
+void TestLowContentionWorkQueue::testCancel()
+{
+    runCancel<LowContentionWorkQueue<int> >();
+}
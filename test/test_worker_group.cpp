@@ -143,10 +143,14 @@ class TestWorkerGroup : public CppUnit::TestFixture
 {
     CPPUNIT_TEST_SUITE(TestWorkerGroup);
     CPPUNIT_TEST(testStress);
+    CPPUNIT_TEST(testThrottle);
+    CPPUNIT_TEST(testScheduler);
     CPPUNIT_TEST_SUITE_END();
 
 private:
     void testStress();
+    void testThrottle();
+    void testScheduler();
 };
 CPPUNIT_TEST_SUITE_NAMED_REGISTRATION(TestWorkerGroup, TestSet::perCommit());
 
@@ -171,3 +175,71 @@ void TestWorkerGroup::testStress()
         CPPUNIT_ASSERT_EQUAL(2 * i, sink.values[i]);
     }
 }
+
+void TestWorkerGroup::testThrottle()
+{
+    const int numWorkers = 4;
+    const int numbers = 1000;
+    Sink sink;
+    Group group(sink, numWorkers);
+
+    // The count is clamped to [1, numWorkers]
+    group.setActiveWorkers(0);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(1), group.getActiveWorkers());
+    group.setActiveWorkers(100);
+    CPPUNIT_ASSERT_EQUAL(std::size_t(numWorkers), group.getActiveWorkers());
+    group.setActiveWorkers(1);
+
+    // A throttled group must still drain everything pushed to it
+    group.start();
+    boost::thread producer(Producer<Group>(0, numbers, 1, group, 0));
+    producer.join();
+    group.stop();
+
+    CPPUNIT_ASSERT_EQUAL(numbers, int(sink.values.size()));
+    std::sort(sink.values.begin(), sink.values.end());
+    for (int i = 0; i < numbers; i++)
+    {
+        CPPUNIT_ASSERT_EQUAL(2 * i, sink.values[i]);
+    }
+}
+
+void TestWorkerGroup::testScheduler()
+{
+    const int numWorkers = 4;
+    const int numbers = 10000;
+    Sink sinks[2];
+    Group group0(sinks[0], numWorkers);
+    Group group1(sinks[1], numWorkers);
+
+    // Budget below the total worker count, so the groups compete for slots
+    ElasticScheduler scheduler(numWorkers + 1, 0.01);
+    scheduler.addGroup(group0);
+    scheduler.addGroup(group1);
+
+    group0.start();
+    group1.start();
+    scheduler.start();
+
+    boost::thread_group producers;
+    producers.add_thread(new boost::thread(Producer<Group>(0, numbers, 1, group0, 0)));
+    producers.add_thread(new boost::thread(Producer<Group>(0, numbers, 1, group1, 1)));
+    producers.join_all();
+
+    scheduler.stop();
+    group0.stop();
+    group1.stop();
+
+    // Stopping the scheduler restores the groups to full strength
+    CPPUNIT_ASSERT_EQUAL(std::size_t(numWorkers), group0.getActiveWorkers());
+    CPPUNIT_ASSERT_EQUAL(std::size_t(numWorkers), group1.getActiveWorkers());
+    for (int g = 0; g < 2; g++)
+    {
+        CPPUNIT_ASSERT_EQUAL(numbers, int(sinks[g].values.size()));
+        std::sort(sinks[g].values.begin(), sinks[g].values.end());
+        for (int i = 0; i < numbers; i++)
+        {
+            CPPUNIT_ASSERT_EQUAL(2 * i, sinks[g].values[i]);
+        }
+    }
+}
@@ -52,7 +52,7 @@ def main():
     groups = []
     if len(sys.argv) > 1:
         for fname in sys.argv[1:]:
-            with open(fname, 'r') as f:
+            with open(fname, 'rb') as f:
                 groups.append(timeplot.load_data(f))
     else:
         groups.append(timeplot.load_data(sys.stdin))
@@ -0,0 +1,254 @@
+#!/usr/bin/env python
+
+# mlsgpu: surface reconstruction from point clouds
+# Copyright (C) 2013  University of Cape Town
+#
+# This file is part of mlsgpu.
+#
+# mlsgpu is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Archive statistics dumps and compare tagged runs.
+
+mlsgpu already emits a full dump of its statistics registry with
+--statistics-file, using stable metric names, but each dump normally dies
+in a log directory. This tool turns those dumps into a performance-tracking
+workflow:
+
+    stats_archive.py add --archive perf.jsonl --tag r123 stats.txt
+    stats_archive.py list --archive perf.jsonl
+    stats_archive.py export --archive perf.jsonl --tag r123 > r123.csv
+    stats_archive.py compare --archive perf.jsonl r123 r124
+
+The archive is a text file with one JSON object per line, so it appends
+cheaply, diffs sanely and can be consumed by other tools. A tag may hold
+several runs (repeat "add" with the same tag); "compare" then uses the
+spread across runs to decide whether a delta is noise. With a single run
+per tag it falls back to the within-run standard error recorded in the
+dump.
+"""
+
+from __future__ import division, print_function
+import sys
+import re
+import json
+import math
+import time
+from optparse import OptionParser
+
+def parse_stats(f):
+    """Parse a --statistics-file dump into (provenance, metrics).
+
+    provenance is a dict with whatever of version/variant/options were
+    present. metrics maps each statistic name to either
+    {'value': v} for counters and peaks, or
+    {'sum': s, 'mean': m, 'stddev': d, 'n': n} for variables
+    (stddev is None when the dump had fewer than two samples).
+    """
+    provenance = {}
+    metrics = {}
+    float_re = r'[-+0-9.eE]+'
+    variable_re = re.compile(
+        r'^\s*([a-zA-Z0-9_.()+\-<> /:]+?)\s*: (' + float_re + r') : (' + float_re + r') '
+        + r'(?:\+/- (' + float_re + r') )?\[(\d+)\]')
+    scalar_re = re.compile(
+        r'^\s*([a-zA-Z0-9_.()+\-<> /:]+?)\s*: (' + float_re + r')\s*$')
+    for line in f:
+        m = re.match(r'mlsgpu (version|variant): (.*)', line)
+        if m:
+            provenance[m.group(1)] = m.group(2).strip()
+            continue
+        if re.match(r'[a-z]+ options: ', line):
+            provenance['options'] = line.split(':', 1)[1].strip()
+            continue
+        m = variable_re.match(line)
+        if m:
+            metrics[m.group(1)] = {
+                'sum': float(m.group(2)),
+                'mean': float(m.group(3)),
+                'stddev': float(m.group(4)) if m.group(4) is not None else None,
+                'n': int(m.group(5))}
+            continue
+        m = scalar_re.match(line)
+        if m:
+            metrics[m.group(1)] = {'value': float(m.group(2))}
+    return provenance, metrics
+
+def load_archive(filename):
+    """Return the list of run records, or an empty list if absent."""
+    runs = []
+    try:
+        f = open(filename, 'r')
+    except IOError:
+        return runs
+    with f:
+        for line in f:
+            line = line.strip()
+            if line:
+                runs.append(json.loads(line))
+    return runs
+
+def metric_value(metric):
+    """The scalar used for comparisons: the mean for variables (comparable
+    across runs even when workloads repeat items), the value otherwise."""
+    if 'value' in metric:
+        return metric['value']
+    return metric['mean']
+
+def metric_noise(metric):
+    """Standard error of metric_value within one run, or None if unknown."""
+    if 'value' in metric:
+        return None
+    if metric['stddev'] is None or metric['n'] < 2:
+        return None
+    return metric['stddev'] / math.sqrt(metric['n'])
+
+def aggregate_tag(runs, tag):
+    """Combine all runs under a tag into {name: (mean, stderr or None)}.
+
+    With several runs the spread across runs is used, which also captures
+    run-to-run noise that the within-run deviation cannot see.
+    """
+    samples = {}
+    for run in runs:
+        if run['tag'] != tag:
+            continue
+        for name, metric in run['metrics'].items():
+            samples.setdefault(name, []).append(
+                (metric_value(metric), metric_noise(metric)))
+    out = {}
+    for name, values in samples.items():
+        n = len(values)
+        mean = sum(v[0] for v in values) / n
+        if n >= 2:
+            var = sum((v[0] - mean) ** 2 for v in values) / (n - 1)
+            stderr = math.sqrt(var / n)
+        else:
+            stderr = values[0][1]
+        out[name] = (mean, stderr)
+    return out
+
+def cmd_add(options, args):
+    if options.tag is None:
+        sys.exit('add: --tag is required')
+    if not args:
+        sys.exit('add: no statistics files given')
+    with open(options.archive, 'a') as archive:
+        for filename in args:
+            with open(filename, 'r') as f:
+                provenance, metrics = parse_stats(f)
+            if not metrics:
+                sys.exit(filename + ': no statistics found')
+            record = {
+                'tag': options.tag,
+                'time': time.strftime('%Y-%m-%dT%H:%M:%S'),
+                'source': filename,
+                'metrics': metrics}
+            record.update(provenance)
+            archive.write(json.dumps(record, sort_keys = True) + '\n')
+            print('%s: archived %d metrics under tag %s'
+                  % (filename, len(metrics), options.tag))
+
+def cmd_list(options, args):
+    runs = load_archive(options.archive)
+    if args:
+        sys.exit('list: unexpected arguments')
+    tags = {}
+    for run in runs:
+        info = tags.setdefault(run['tag'], [0, run.get('version', '?'), run['time']])
+        info[0] += 1
+        info[2] = max(info[2], run['time'])
+    for tag in sorted(tags):
+        count, version, newest = tags[tag]
+        print('%-20s %3d run(s)  %-19s  %s' % (tag, count, newest, version))
+
+def cmd_export(options, args):
+    if options.tag is None:
+        sys.exit('export: --tag is required')
+    if args:
+        sys.exit('export: unexpected arguments')
+    agg = aggregate_tag(load_archive(options.archive), options.tag)
+    if not agg:
+        sys.exit('export: no runs tagged ' + options.tag)
+    print('metric,mean,stderr')
+    for name in sorted(agg):
+        mean, stderr = agg[name]
+        print('%s,%.17g,%s' % (name, mean, '' if stderr is None else '%.17g' % stderr))
+
+def cmd_compare(options, args):
+    if len(args) != 2:
+        sys.exit('compare: expected exactly two tags')
+    runs = load_archive(options.archive)
+    old = aggregate_tag(runs, args[0])
+    new = aggregate_tag(runs, args[1])
+    for tag, agg in [(args[0], old), (args[1], new)]:
+        if not agg:
+            sys.exit('compare: no runs tagged ' + tag)
+
+    rows = []
+    for name in sorted(set(old) & set(new)):
+        oldMean, oldErr = old[name]
+        newMean, newErr = new[name]
+        delta = newMean - oldMean
+        if oldMean != 0.0:
+            rel = delta / abs(oldMean)
+        elif delta == 0.0:
+            rel = 0.0
+        else:
+            rel = float('inf')
+        if abs(rel) < options.threshold / 100.0:
+            continue
+        # Treat a delta as significant when it clears the combined noise
+        # estimate; without any noise estimate the threshold alone decides.
+        noise = math.sqrt((oldErr or 0.0) ** 2 + (newErr or 0.0) ** 2)
+        if noise > 0.0 and abs(delta) < options.sigma * noise:
+            continue
+        rows.append((abs(rel), name, oldMean, newMean, rel))
+
+    if not rows:
+        print('No significant deltas between %s and %s' % (args[0], args[1]))
+    else:
+        rows.sort(reverse = True)
+        print('%-40s %14s %14s %9s' % ('metric', args[0][:14], args[1][:14], 'delta'))
+        for _, name, oldMean, newMean, rel in rows:
+            print('%-40s %14.6g %14.6g %+8.1f%%' % (name, oldMean, newMean, 100.0 * rel))
+
+    for title, only in [(args[0], set(old) - set(new)), (args[1], set(new) - set(old))]:
+        if only:
+            print('\nOnly in %s:' % title)
+            for name in sorted(only):
+                print('    ' + name)
+
+def main():
+    commands = {
+        'add': cmd_add,
+        'list': cmd_list,
+        'export': cmd_export,
+        'compare': cmd_compare}
+    parser = OptionParser(
+        usage = 'usage: %prog [options] {add|list|export|compare} [args]')
+    parser.add_option('--archive', metavar = 'FILE', default = 'stats-archive.jsonl',
+                      help = 'archive file to use [%default]')
+    parser.add_option('--tag', metavar = 'TAG',
+                      help = 'tag for add/export (e.g. a revision or driver version)')
+    parser.add_option('--threshold', type = 'float', metavar = 'PCT', default = 5.0,
+                      help = 'minimum relative change to report, in percent [%default]')
+    parser.add_option('--sigma', type = 'float', metavar = 'N', default = 2.0,
+                      help = 'minimum multiple of the noise estimate to report [%default]')
+    (options, args) = parser.parse_args()
+    if not args or args[0] not in commands:
+        parser.error('expected one of: ' + ', '.join(sorted(commands)))
+    commands[args[0]](options, args[1:])
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,148 @@
+#!/usr/bin/env python
+
+# mlsgpu: surface reconstruction from point clouds
+# Copyright (C) 2013  University of Cape Town
+#
+# This file is part of mlsgpu.
+#
+# mlsgpu is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Split one reconstruction into independent mlsgpu jobs that need no MPI
+fabric, for running on plain batch clusters of unconnected nodes.
+
+The site's bounding box is cut into axis-aligned tiles anchored at the world
+origin. Because mlsgpu's bounding grids are also anchored at the world
+origin, every tile job run with the same --fit-grid places grid cells in
+exactly the same world positions, so where tiles overlap they reconstruct
+bitwise-identical geometry and their outputs can be welded back into one
+mesh with the plyweld tool (see extras/plyweld.cpp).
+
+Input is the per-file bounding boxes printed by the plybbox tool (run with
+the same --fit-smooth and --max-radius as the reconstruction). Each tile job
+is given only the input files whose support intersects the tile grown by
+--margin, which is what makes the scheme scale: each node reads only its
+neighbourhood of the input. The margin must cover the overlap band that
+--tile-box adds by rounding tile extents down to microblock boundaries
+(--leaf-cells cells, 63 by default), so the default margin is 64 grid
+spacings.
+
+One shell command per tile is written to standard output, followed by a
+comment showing the plyweld invocation that merges the results. The input
+files keep the order of the bounds file in every job, so that overlapping
+tiles sum MLS contributions in the same order and produce identical seams.
+
+Typical use:
+    plybbox --fit-smooth 4 *.ply > bounds.txt
+    tile.py --fit-grid 0.001 --tile 2.0 -o out/tile-%03d.ply bounds.txt -- \\
+        --fit-smooth 4 mlsgpu-extra-options... | parallel
+"""
+
+from __future__ import division, print_function
+import sys
+from optparse import OptionParser
+try:
+    from shlex import quote
+except ImportError:
+    from pipes import quote
+
+class FileBounds(object):
+    """Bounding box line for one input file, as printed by plybbox"""
+    def __init__(self, line):
+        fields = line.split(None, 7)
+        if len(fields) != 8:
+            raise ValueError('Malformed bounds line: ' + line.rstrip())
+        self.bbox_min = [float(x) for x in fields[0:3]]
+        self.bbox_max = [float(x) for x in fields[3:6]]
+        self.num_splats = int(fields[6])
+        self.filename = fields[7].rstrip('\n')
+
+    def intersects(self, box_min, box_max):
+        for i in range(3):
+            if self.bbox_max[i] < box_min[i] or self.bbox_min[i] > box_max[i]:
+                return False
+        return True
+
+def main():
+    usage = 'Usage: %prog [options] bounds.txt [-- mlsgpu-options...]'
+    parser = OptionParser(usage = usage)
+    parser.add_option('--fit-grid', type = 'float', metavar = 'SIZE',
+            help = 'Grid spacing, passed through to every job [required]')
+    parser.add_option('--tile', type = 'float', metavar = 'SIZE',
+            help = 'Tile edge length in input units [required]')
+    parser.add_option('--margin', type = 'float', metavar = 'DIST',
+            help = 'Extra input radius given to each tile [64 grid spacings]')
+    parser.add_option('-o', '--output', metavar = 'PATTERN', default = 'tile-%04d.ply',
+            help = 'Output file pattern with one %d field [%default]')
+    parser.add_option('--mlsgpu', metavar = 'PATH', default = 'mlsgpu',
+            help = 'Name of the mlsgpu binary [%default]')
+    (options, args) = parser.parse_args()
+    if options.fit_grid is None or options.tile is None or not args:
+        parser.print_help(sys.stderr)
+        return 2
+    if options.tile <= options.fit_grid:
+        parser.error('--tile must be larger than --fit-grid')
+    margin = options.margin
+    if margin is None:
+        margin = 64 * options.fit_grid
+
+    extra = args[1:]
+    with open(args[0], 'r') as f:
+        bounds = [FileBounds(line) for line in f if line.strip() != '']
+    bounds = [b for b in bounds if b.num_splats > 0]
+    if not bounds:
+        print('No splats in the bounds file', file = sys.stderr)
+        return 1
+
+    bbox_min = [min(b.bbox_min[i] for b in bounds) for i in range(3)]
+    bbox_max = [max(b.bbox_max[i] for b in bounds) for i in range(3)]
+
+    # Tiles are anchored at the world origin, like mlsgpu's bounding grids,
+    # so that every run of this script over any subset of the site produces
+    # tiles on the same lattice.
+    tiles = []
+    lo = [int(bbox_min[i] // options.tile) for i in range(3)]
+    hi = [int(bbox_max[i] // options.tile) for i in range(3)]
+    for ix in range(lo[0], hi[0] + 1):
+        for iy in range(lo[1], hi[1] + 1):
+            for iz in range(lo[2], hi[2] + 1):
+                tiles.append((ix, iy, iz))
+
+    seq = 0
+    outputs = []
+    for tile in tiles:
+        box_min = [tile[i] * options.tile for i in range(3)]
+        box_max = [(tile[i] + 1) * options.tile for i in range(3)]
+        grown_min = [x - margin for x in box_min]
+        grown_max = [x + margin for x in box_max]
+        files = [b.filename for b in bounds if b.intersects(grown_min, grown_max)]
+        if not files:
+            continue
+        out = options.output % seq
+        seq += 1
+        outputs.append(out)
+        cmd = [options.mlsgpu,
+                '--fit-grid', repr(options.fit_grid),
+                '--tile-box', ','.join([repr(x) for x in box_min + box_max]),
+                '-o', out]
+        cmd.extend(extra)
+        cmd.extend(files)
+        print(' '.join([quote(c) for c in cmd]))
+
+    print('# merge with: plyweld -o merged.ply ' +
+          ' '.join([quote(o) for o in outputs]))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
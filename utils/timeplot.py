@@ -40,11 +40,55 @@ class Worker(object):
         else:
             return (m,)
 
-def load_data(f):
+_BINARY_MAGIC = 'TPB1'
+
+def _read_varint(data, pos):
+    """Decode a varint from bytearray `data` at `pos`; return (value, new pos)."""
+    value = 0
+    shift = 0
+    while data[pos] & 0x80:
+        value |= (data[pos] & 0x7F) << shift
+        shift += 7
+        pos += 1
+    value |= data[pos] << shift
+    return value, pos + 1
+
+def _load_binary(data):
+    """Parse the binary timeplot format (see src/timeplot.h). `data` is a
+    bytearray of everything after the magic."""
+    strings = []
+    workers = {}
+    pos = 0
+    size = len(data)
+    while pos < size:
+        opcode = data[pos]
+        pos += 1
+        if opcode == 0:
+            length, pos = _read_varint(data, pos)
+            strings.append(data[pos : pos + length].decode('ascii'))
+            pos += length
+        elif opcode in (1, 2):
+            worker_id, pos = _read_varint(data, pos)
+            action_id, pos = _read_varint(data, pos)
+            start_ns, pos = _read_varint(data, pos)
+            dur_ns, pos = _read_varint(data, pos)
+            worker_name = strings[worker_id]
+            if worker_name not in workers:
+                workers[worker_name] = Worker(worker_name)
+            action = Action(strings[action_id],
+                            start_ns / 1e9, (start_ns + dur_ns) / 1e9)
+            if opcode == 2:
+                action.value, pos = _read_varint(data, pos)
+            workers[worker_name].actions.append(action)
+        else:
+            raise ValueError('Corrupt binary timeplot data (opcode {})'.format(opcode))
+    return workers
+
+def _load_text(lines):
     workers = {}
     event_re = re.compile(r'^EVENT (\S+) (\S+) ([0-9.]+) ([0-9.]+)$')
     value_re = re.compile(r'^VALUE ([0-9]+)$')
-    for line in f:
+    for line in lines:
         m = event_re.match(line)
         if m:
             worker_name = m.group(1)
@@ -58,5 +102,20 @@ def load_data(f):
         m = value_re.match(line)
         if m:
             worker.actions[-1].value = int(m.group(1))
+    return workers
+
+def load_data(f):
+    """Load either the text or the binary timeplot format, distinguished by
+    the leading magic bytes. Binary files should be opened in binary mode."""
+    content = f.read()
+    if not isinstance(content, str):
+        if content[:len(_BINARY_MAGIC)] == _BINARY_MAGIC.encode('ascii'):
+            workers = _load_binary(bytearray(content[len(_BINARY_MAGIC):]))
+        else:
+            workers = _load_text(content.decode('ascii').splitlines())
+    elif content.startswith(_BINARY_MAGIC):
+        workers = _load_binary(bytearray(content[len(_BINARY_MAGIC):], 'latin-1'))
+    else:
+        workers = _load_text(content.splitlines())
     workers = sorted(list(workers.values()), key = lambda x: x.sort_key())
     return workers
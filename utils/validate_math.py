@@ -0,0 +1,122 @@
+#!/usr/bin/env python
+
+# mlsgpu: surface reconstruction from point clouds
+# Copyright (C) 2013  University of Cape Town
+#
+# This file is part of mlsgpu.
+#
+# mlsgpu is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Validate the relaxed kernel math tiers (--cl-math) against a strict
+reconstruction, so that the fastest tier meeting a tolerance can be
+adopted with evidence rather than hope.
+
+The given inputs are reconstructed once per tier (strict, fused, fast by
+default), and each relaxed output is compared against the strict one with
+the plydiff tool (see extras/plydiff.cpp), which reports Hausdorff-style
+vertex distances. A sensible tolerance is a small fraction of the grid
+spacing used for the reconstruction: differences far below a cell cannot
+move the surface by a visible amount.
+
+Any extra arguments after "--" are passed through to mlsgpu unchanged
+(e.g. --fit-grid, device selection), so the validation runs match the
+production configuration. Each run's wall time is reported alongside its
+mesh delta, which is the speed/accuracy evidence needed to pick a tier.
+"""
+
+from __future__ import division, print_function
+import sys
+import os
+import subprocess
+import tempfile
+import time
+from optparse import OptionParser
+
+
+def run_tier(options, tier, output, extra):
+    """Reconstruct at one tier, returning the wall time in seconds."""
+    cmd = [options.mlsgpu, '--cl-math', tier, '-o', output] + extra
+    print('Running:', ' '.join(cmd), file=sys.stderr)
+    start = time.time()
+    subprocess.check_call(cmd)
+    return time.time() - start
+
+
+def run_diff(options, strict, other):
+    """Compare two outputs with plydiff, returning the symmetric maximum."""
+    out = subprocess.Popen(
+        [options.plydiff, strict, other],
+        stdout=subprocess.PIPE).communicate()[0].decode('utf-8')
+    print(out, end='', file=sys.stderr)
+    for line in out.splitlines():
+        fields = line.split()
+        if fields[:2] == ['symmetric', 'max']:
+            return float(fields[2])
+    raise RuntimeError('Could not parse plydiff output')
+
+
+def main():
+    usage = 'Usage: %prog [options] -- mlsgpu-args...'
+    parser = OptionParser(usage=usage, description='Validate --cl-math tiers against a strict reconstruction')
+    parser.add_option('--mlsgpu', metavar='PATH', default='mlsgpu',
+                      help='mlsgpu binary to run [%default]')
+    parser.add_option('--plydiff', metavar='PATH', default='plydiff',
+                      help='plydiff binary to run [%default]')
+    parser.add_option('--tiers', metavar='LIST', default='strict,fused,fast',
+                      help='comma-separated tiers to test; the first is the reference [%default]')
+    parser.add_option('--tolerance', type='float', metavar='DIST',
+                      help='fail if any tier differs from the reference by more than this')
+    parser.add_option('--keep', action='store_true',
+                      help='keep the per-tier outputs instead of deleting them')
+    (options, args) = parser.parse_args()
+    if not args:
+        parser.error('No mlsgpu arguments given')
+    tiers = options.tiers.split(',')
+    if len(tiers) < 2:
+        parser.error('At least two tiers are needed to compare')
+
+    tmpdir = tempfile.mkdtemp(prefix='mlsgpu-math-')
+    outputs = {}
+    times = {}
+    try:
+        for tier in tiers:
+            outputs[tier] = os.path.join(tmpdir, tier + '.ply')
+            times[tier] = run_tier(options, tier, outputs[tier], args)
+
+        reference = tiers[0]
+        failed = []
+        print('tier time delta')
+        print('%s %.1f -' % (reference, times[reference]))
+        for tier in tiers[1:]:
+            delta = run_diff(options, outputs[reference], outputs[tier])
+            print('%s %.1f %g' % (tier, times[tier], delta))
+            if options.tolerance is not None and delta > options.tolerance:
+                failed.append(tier)
+        if failed:
+            print('Tiers exceeding tolerance:', ', '.join(failed), file=sys.stderr)
+            return 1
+    finally:
+        if options.keep:
+            print('Outputs kept in', tmpdir, file=sys.stderr)
+        else:
+            for output in outputs.values():
+                if os.path.exists(output):
+                    os.remove(output)
+            os.rmdir(tmpdir)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())